@@ -150,6 +150,12 @@ void help(void)
            "        proven         numbers that have been proven to be prime\n"
            "        proven-even    also try harder for an even distribution\n"
            "  --strong-rsa         use \"strong\" primes as RSA key factors\n"
+           "  --threads <n>        search for primes on n threads at once "
+           "(0 = one per CPU)\n"
+           "  --benchmark[=<secs>] time key generation with the given -t, "
+           "-b and --primes,\n"
+           "        and report keys per minute for each key size and thread "
+           "count\n"
            "  --ppk-param <key>=<value>[,<key>=<value>,...]\n"
            "        specify parameters when writing PuTTY private key file "
            "format:\n"
@@ -214,6 +220,9 @@ static char *readpassphrase(const char *filename)
 
 #define DEFAULT_RSADSA_BITS 2048
 
+/* How long --benchmark spends on each measurement, by default */
+#define DEFAULT_BENCHMARK_SECONDS 20
+
 /* For Unix in particular, but harmless if this main() is reused elsewhere */
 const bool buildinfo_gtk_relevant = false;
 
@@ -244,6 +253,9 @@ int main(int argc, char **argv)
     int exit_status = 0;
     const PrimeGenerationPolicy *primegen = &primegen_probabilistic;
     bool strong_rsa = false;
+    unsigned threads = 1;
+    bool benchmark = false;
+    unsigned benchmark_secs = DEFAULT_BENCHMARK_SECONDS;
     ppk_save_parameters params = ppk_save_default_parameters;
     FingerprintType fptype = SSH_FPTYPE_DEFAULT;
 
@@ -383,6 +395,27 @@ int main(int argc, char **argv)
                         }
                     } else if (!strcmp(opt, "-strong-rsa")) {
                         strong_rsa = true;
+                    } else if (!strcmp(opt, "-threads")) {
+                        if (!val && argc > 1)
+                            --argc, val = *++argv;
+                        if (!val) {
+                            errs = true;
+                            fprintf(stderr, "puttygen: option `-%s'"
+                                    " expects an argument\n", opt);
+                        } else {
+                            threads = atoi(val);
+                        }
+                    } else if (!strcmp(opt, "-benchmark")) {
+                        benchmark = true;
+                        if (val) {
+                            benchmark_secs = atoi(val);
+                            if (benchmark_secs < 1) {
+                                errs = true;
+                                fprintf(stderr, "puttygen: option `-%s'"
+                                        " expects a positive number of "
+                                        "seconds\n", opt);
+                            }
+                        }
                     } else if (!strcmp(opt, "-reencrypt")) {
                         reencrypt = true;
                     } else if (!strcmp(opt, "-ppk-param") ||
@@ -615,6 +648,7 @@ int main(int argc, char **argv)
         }
     }
 
+    bool bits_given = (bits != -1);
     if (bits == -1) {
         /*
          * No explicit key size was specified. Default varies
@@ -677,6 +711,109 @@ int main(int argc, char **argv)
     if (nogo)
         RETURN(0);
 
+    primegen_set_threads(threads);
+
+    if (benchmark) {
+        /*
+         * Generate keys of each size for a while on 1, 2, 4, ...
+         * threads, up to the number we were allowed (or one per CPU
+         * if we weren't told), and report how many we made. The
+         * 1-thread row goes through the same PrimeSearch as the
+         * others rather than the serial loop, which sieves less, so
+         * that the rows only differ in the number of threads.
+         */
+        int sizes[3], nsizes = 0;
+        unsigned maxthreads;
+        char *entropy;
+
+        if (infile) {
+            fprintf(stderr, "puttygen: cannot both load a key and run "
+                    "a benchmark\n");
+            RETURN(1);
+        }
+        if (keytype == NOKEYGEN)
+            keytype = RSA2;
+        if (keytype == ECDSA || keytype == EDDSA || bits_given) {
+            sizes[nsizes++] = bits;
+        } else {
+            sizes[nsizes++] = 2048;
+            sizes[nsizes++] = 3072;
+            sizes[nsizes++] = 4096;
+        }
+
+        /* Elliptic-curve keys don't involve any primes to look for */
+        if (keytype == ECDSA || keytype == EDDSA)
+            primegen_set_threads(1);
+        else if (threads == 1)
+            primegen_set_threads(0);
+        maxthreads = primegen_get_threads();
+        primegen_set_search_always(true);
+
+        entropy = get_random_data(32, random_device);
+        if (!entropy) {
+            fprintf(stderr, "puttygen: failed to collect entropy, "
+                    "could not generate key\n");
+            RETURN(1);
+        }
+        random_setup_special();
+        random_reseed(make_ptrlen(entropy, 32));
+        smemclr(entropy, 32);
+        sfree(entropy);
+
+        PrimeGenerationContext *pgc = primegen_new_context(primegen);
+        ProgressReceiver null_progress = { .vt = &null_progress_vt };
+
+        for (int i = 0; i < nsizes; i++) {
+            unsigned t = 1;
+            while (true) {
+                unsigned long start, elapsed;
+                unsigned nkeys = 0;
+
+                primegen_set_threads(t);
+                start = GETTICKCOUNT();
+                do {
+                    ssh_key *key;
+                    if (keytype == DSA) {
+                        struct dss_key *dsskey = snew(struct dss_key);
+                        dsa_generate(dsskey, sizes[i], pgc, &null_progress);
+                        key = &dsskey->sshk;
+                    } else if (keytype == ECDSA) {
+                        struct ecdsa_key *ek = snew(struct ecdsa_key);
+                        ecdsa_generate(ek, sizes[i]);
+                        key = &ek->sshk;
+                    } else if (keytype == EDDSA) {
+                        struct eddsa_key *ek = snew(struct eddsa_key);
+                        eddsa_generate(ek, sizes[i]);
+                        key = &ek->sshk;
+                    } else {
+                        RSAKey *rsakey = snew(RSAKey);
+                        rsa_generate(rsakey, sizes[i], strong_rsa, pgc,
+                                     &null_progress);
+                        rsakey->comment = NULL;
+                        key = &rsakey->sshk;
+                    }
+                    ssh_key_free(key);
+                    nkeys++;
+                    elapsed = GETTICKCOUNT() - start;
+                } while (elapsed < benchmark_secs * TICKSPERSEC);
+
+                printf("%5d bits, %2u thread%s: %9.2f keys/minute "
+                       "(%u in %.1fs)\n", sizes[i], t, t == 1 ? "" : "s",
+                       nkeys * 60.0 * TICKSPERSEC / elapsed, nkeys,
+                       (double)elapsed / TICKSPERSEC);
+                fflush(stdout);
+
+                if (t == maxthreads)
+                    break;
+                t = (t * 2 < maxthreads ? t * 2 : maxthreads);
+            }
+        }
+
+        primegen_set_search_always(false);
+        primegen_free_context(pgc);
+        RETURN(0);
+    }
+
     /*
      * If run with at least one argument _but_ not the required
      * ones, print the usage message and return failure.
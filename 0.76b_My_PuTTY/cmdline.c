@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "putty.h"
 
 /*
@@ -1017,6 +1018,44 @@ int cmdline_process_param(const char *p, char *value,
 	conf_set_str(conf, CONF_proxy_telnet_command, value);
     }
 
+    if (!strcmp(p, "-pipeline")) {
+        /* "auto", "auto,WINDOW[,BLOCK]" or "WINDOW[,BLOCK]" */
+        unsigned long sizes[2] = { 0, 0 };
+        bool autotune = false;
+        const char *q;
+        size_t i;
+	RETURN(2);
+	UNAVAILABLE_IN(TOOLTYPE_NONNETWORK);
+	SAVEABLE(0);
+        q = value;
+        if (!strncmp(q, "auto", 4) && (q[4] == '\0' || q[4] == ',')) {
+            autotune = true;
+            q += 4;
+            if (*q)
+                q++;
+        }
+        for (i = 0; *q && i < lenof(sizes); i++) {
+            if (!isdigit((unsigned char)*q) ||
+                (sizes[i] = parse_blocksize(q)) > INT_MAX) {
+                cmdline_error("'%s' is not a valid pipeline specification",
+                              value);
+                return ret;
+            }
+            q += strcspn(q, ",");
+            if (*q)
+                q++;
+        }
+        if (*q) {
+            /* More fields than a window and a block size */
+            cmdline_error("'%s' is not a valid pipeline specification",
+                          value);
+            return ret;
+        }
+        conf_set_bool(conf, CONF_sftp_autotune, autotune);
+        conf_set_int(conf, CONF_sftp_window, sizes[0]);
+        conf_set_int(conf, CONF_sftp_blocksize, sizes[1]);
+    }
+
 #ifdef _WINDOWS
     /*
      * Cross-tool options only available on Windows.
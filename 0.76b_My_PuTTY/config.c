@@ -2832,6 +2832,15 @@ void setup_config_box(struct controlbox *b, bool midsession,
     ctrl_checkbox(s, "Flush log file frequently", 'u',
 		 HELPCTX(logging_flush),
 		 conf_checkbox_handler, I(CONF_logflush));
+    ctrl_checkbox(s, "Write log file in the background", 'b',
+		 HELPCTX(logging_flush),
+		 conf_checkbox_handler, I(CONF_logasync));
+    ctrl_editbox(s, "Background flush interval (ms)", NO_SHORTCUT, 30,
+		 HELPCTX(logging_flush),
+		 conf_editbox_handler, I(CONF_logasync_interval), I(-1));
+    ctrl_editbox(s, "Background flush size (KB)", NO_SHORTCUT, 30,
+		 HELPCTX(logging_flush),
+		 conf_editbox_handler, I(CONF_logasync_batch), I(-1));
     ctrl_checkbox(s, "Include header", 'i',
 		 HELPCTX(logging_header),
 		 conf_checkbox_handler, I(CONF_logheader));
@@ -3129,6 +3138,9 @@ s = ctrl_getset(b, "Terminal/Bell", "overload",
     ctrl_editbox(s, "Lines of scrollback", 's', 50,
 		 HELPCTX(window_scrollback),
 		 conf_editbox_handler, I(CONF_savelines), I(-1));
+    ctrl_editbox(s, "Memory for scrollback in KB (0 = no limit)", 'y', 50,
+		 HELPCTX(window_scrollback),
+		 conf_editbox_handler, I(CONF_scrollback_memory), I(-1));
 #if MOD_PERSO
 	/*
 	 * PuttyFeatures: Scroll Lines
@@ -3831,6 +3843,9 @@ if( !GetPuttyFlag() ) {
 			  HELPCTX(ssh_compress),
 			  conf_checkbox_handler,
 			  I(CONF_compression));
+	    ctrl_editbox(s, "Compression level (1-9)", 'v', 20,
+			 HELPCTX(ssh_compress),
+			 conf_editbox_handler, I(CONF_compression_level), I(-1));
 	}
 
 	if (!midsession) {
@@ -3991,6 +4006,13 @@ if( !GetPuttyFlag() ) {
 			  HELPCTX(ssh_ciphers),
 			  conf_checkbox_handler,
 			  I(CONF_ssh2_des_cbc));
+
+	    ctrl_editbox(s, "Threads for CTR/GCM/ChaCha20 encryption (0 for one)",
+			 NO_SHORTCUT, 20,
+			 HELPCTX(ssh_ciphers),
+			 conf_editbox_handler,
+			 I(CONF_ssh_crypto_threads),
+			 I(-1));
 	}
 
 	if (!midsession) {
@@ -4262,6 +4284,54 @@ if( !GetPuttyFlag() ) {
 	ctrl_tabdelay(s, pfd->addbutton);
 	ctrl_columns(s, 1, 100);
 
+	if (!midsession || !(protcfginfo == 1 || protcfginfo == -1)) {
+	    /*
+	     * The Connection/SSH/Flow control panel. Changes here
+	     * apply to channels opened after them, so it's available
+	     * in mid-session too.
+	     */
+	    ctrl_settitle(b, "Connection/SSH/Flow control",
+			  "Options controlling SSH-2 channel windows");
+
+	    s = ctrl_getset(b, "Connection/SSH/Flow control", "windows",
+			    "Per-channel sizes (0 for the default)");
+	    ctrl_columns(s, 2, 50, 50);
+	    c = ctrl_editbox(s, "Session window (KB)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_win_session), I(-1));
+	    c->generic.column = 0;
+	    c = ctrl_editbox(s, "Max packet (bytes)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_maxpkt_session), I(-1));
+	    c->generic.column = 1;
+	    c = ctrl_editbox(s, "Tunnel window (KB)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_win_portfwd), I(-1));
+	    c->generic.column = 0;
+	    c = ctrl_editbox(s, "Max packet (bytes)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_maxpkt_portfwd), I(-1));
+	    c->generic.column = 1;
+	    c = ctrl_editbox(s, "X11 window (KB)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_win_x11), I(-1));
+	    c->generic.column = 0;
+	    c = ctrl_editbox(s, "Max packet (bytes)", NO_SHORTCUT, 40,
+			     HELPCTX(no_help), conf_editbox_handler,
+			     I(CONF_ssh_maxpkt_x11), I(-1));
+	    c->generic.column = 1;
+	    ctrl_columns(s, 1, 100);
+
+	    s = ctrl_getset(b, "Connection/SSH/Flow control", "autotune",
+			    "Automatic window sizing");
+	    ctrl_checkbox(s, "Grow windows to suit the link's round-trip time",
+			  'g', HELPCTX(no_help), conf_checkbox_handler,
+			  I(CONF_ssh_win_autotune));
+	    ctrl_editbox(s, "Memory they may use in total (KB)", 'm', 30,
+			 HELPCTX(no_help), conf_editbox_handler,
+			 I(CONF_ssh_win_budget), I(-1));
+	}
+
 	if (!midsession) {
 	    /*
 	     * The Connection/SSH/Bugs panels.
@@ -4383,39 +4453,19 @@ if( !GetPuttyFlag() ) {
 		 HELPCTX(no_help),
 		 conf_editbox_handler, I(CONF_zdownloaddir), I(1));
  
-    ctrl_settitle(b, "Connection/ZModem/rz",
-		  "rz path and options");
-
-    s = ctrl_getset(b, "Connection/ZModem/rz", "receive",
-			"Receive command");
-
-    ctrl_filesel(s, "Command rz:", NO_SHORTCUT,
-		 FILTER_EXE_FILES, FALSE, "Select command to receive zmodem data",
-		 HELPCTX(no_help),
-		 conf_filesel_handler, I(CONF_rzcommand) ) ; 
-
-    ctrl_editbox(s, "Options", NO_SHORTCUT, 
+    s = ctrl_getset(b, "Connection/ZModem", "options",
+			"Transfer options");
+    ctrl_editbox(s, "Receive options", NO_SHORTCUT, 
 		     50,
 		     HELPCTX(no_help),
 		     conf_editbox_handler, I(CONF_rzoptions), I(1)); 
-    ctrl_text(s, "Ctrl+X to quit rz before completing",
-	      HELPCTX(no_help));
-
-    ctrl_settitle(b, "Connection/ZModem/sz",
-		  "sz path and options");
-
-    s = ctrl_getset(b, "Connection/ZModem/sz", "send",
-			"Send command");
-
-    ctrl_filesel(s, "Command sz:", NO_SHORTCUT,
-		 FILTER_EXE_FILES, FALSE, "Select command to send zmodem data",
-		 HELPCTX(no_help),
-		 conf_filesel_handler, I(CONF_szcommand) ) ; 
-
-    ctrl_editbox(s, "Options", NO_SHORTCUT, 
+    ctrl_editbox(s, "Send options", NO_SHORTCUT, 
 		     50,
 		     HELPCTX(no_help),
 		     conf_editbox_handler, I(CONF_szoptions), I(1)); 
+    ctrl_text(s, "-r: resume partial files, -e: escape all control "
+	      "characters, -y: overwrite existing files",
+	      HELPCTX(no_help));
 /**/
 	}
 #endif
@@ -160,7 +160,8 @@ struct aes_extra {
                   keylen, "AES-" #keylen " CBC", _encrypt, _decrypt,    \
                   setiv_cbc, SSH_CIPHER_IS_CBC)                         \
     VTABLES_INNER(aes ## keylen ## _sdctr, "aes" #keylen "-ctr",        \
-                  keylen, "AES-" #keylen " SDCTR",,, setiv_sdctr, 0)
+                  keylen, "AES-" #keylen " SDCTR",,, setiv_sdctr,       \
+                  SSH_CIPHER_IS_SDCTR)
 
 VTABLES(128)
 VTABLES(192)
@@ -179,6 +180,8 @@ static const ssh_cipheralg ssh_rijndael_lysator = {
 };
 
 static const ssh_cipheralg *const aes_list[] = {
+    &ssh_aes256_gcm,               /* in aesgcm.c */
+    &ssh_aes128_gcm,
     &ssh_aes256_sdctr,
     &ssh_aes256_cbc,
     &ssh_rijndael_lysator,
@@ -1529,13 +1532,49 @@ static FUNC_ISA inline void aes_cbc_ni_decrypt(
     }
 }
 
+/*
+ * SDCTR keystream blocks don't depend on each other, so we can keep
+ * several of them in flight through the AES pipeline at once. Each
+ * round key is applied to all of them before moving on to the next.
+ */
+#define NI_SDCTR_PARALLEL 8
+#define NI_X8(stmt) do {                                                \
+        { const int i = 0; stmt; } { const int i = 1; stmt; }           \
+        { const int i = 2; stmt; } { const int i = 3; stmt; }           \
+        { const int i = 4; stmt; } { const int i = 5; stmt; }           \
+        { const int i = 6; stmt; } { const int i = 7; stmt; }           \
+    } while (0)
+
+static FUNC_ISA inline void aes_ni_encrypt_x8(
+    __m128i *v, const __m128i *keysched, int rounds)
+{
+    NI_X8(v[i] = _mm_xor_si128(v[i], keysched[0]));
+    for (int r = 1; r < rounds; r++) {
+        __m128i k = keysched[r];
+        NI_X8(v[i] = _mm_aesenc_si128(v[i], k));
+    }
+    NI_X8(v[i] = _mm_aesenclast_si128(v[i], keysched[rounds]));
+}
+
 static FUNC_ISA inline void aes_sdctr_ni(
     ssh_cipher *ciph, void *vblk, int blklen, aes_ni_fn encrypt)
 {
     aes_ni_context *ctx = container_of(ciph, aes_ni_context, ciph);
+    int rounds = ctx->ciph.vt->real_keybits / 32 + 6;
+    uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
+
+    while (finish - blk >= 16 * NI_SDCTR_PARALLEL) {
+        __m128i v[NI_SDCTR_PARALLEL];
+        NI_X8((v[i] = aes_ni_sdctr_reverse(ctx->iv),
+               ctx->iv = aes_ni_sdctr_increment(ctx->iv)));
+        aes_ni_encrypt_x8(v, ctx->keysched_e, rounds);
+        NI_X8(_mm_storeu_si128(
+                  (__m128i *)blk + i, _mm_xor_si128(
+                      _mm_loadu_si128((const __m128i *)blk + i), v[i])));
+        blk += 16 * NI_SDCTR_PARALLEL;
+    }
 
-    for (uint8_t *blk = (uint8_t *)vblk, *finish = blk + blklen;
-         blk < finish; blk += 16) {
+    for (; blk < finish; blk += 16) {
         __m128i counter = aes_ni_sdctr_reverse(ctx->iv);
         __m128i keystream = encrypt(counter, ctx->keysched_e);
         __m128i input = _mm_loadu_si128((const __m128i *)blk);
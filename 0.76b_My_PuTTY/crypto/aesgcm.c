@@ -0,0 +1,726 @@
+/*
+ * aesgcm.c - AES-GCM for SSH, in the form specified by RFC 5647 and
+ * actually deployed by OpenSSH as aes128-gcm@openssh.com and
+ * aes256-gcm@openssh.com.
+ *
+ * GCM is an AEAD mode, so from the BPP's point of view it looks a lot
+ * like ChaCha20-Poly1305: an ssh_cipher whose required_mac is a
+ * second facet of the same object. The packet length is sent in the
+ * clear (we run in the BPP's ETM mode), and authenticated as the
+ * 'additional data' of the AEAD; the rest of the packet is encrypted
+ * with AES in counter mode and authenticated by GHASH.
+ *
+ * We don't reimplement AES here. The encryption half is done by an
+ * instance of the existing SDCTR cipher from aes.c, which already
+ * knows how to select between the bit-sliced software AES and the
+ * hardware-accelerated versions. The only difference between GCM's
+ * counter mode and SDCTR is that GCM increments just the low 32 bits
+ * of the counter block, whereas SDCTR carries into the whole 128
+ * bits; but each SSH packet restarts the 32-bit counter at 2, and no
+ * SSH packet is anywhere near 2^36 bytes long, so the carry can never
+ * happen and the two are equivalent for our purposes.
+ *
+ * GHASH, the polynomial MAC over GF(2^128), has two implementations:
+ * a portable constant-time one, and one using the x86 PCLMULQDQ
+ * carry-less multiply instruction.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "ssh.h"
+
+/*
+ * Start by deciding whether we can support hardware GHASH at all.
+ */
+#define HW_GHASH_NONE 0
+#define HW_GHASH_CLMUL 1
+
+#ifdef _FORCE_GHASH_CLMUL
+#   define HW_GHASH HW_GHASH_CLMUL
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<wmmintrin.h>) &&       \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_GHASH HW_GHASH_CLMUL
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 4)) && \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_GHASH HW_GHASH_CLMUL
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_FULL_VER >= 150030729
+#      define HW_GHASH HW_GHASH_CLMUL
+#   endif
+#endif
+
+#if defined _FORCE_SOFTWARE_GHASH || !defined HW_GHASH
+#   undef HW_GHASH
+#   define HW_GHASH HW_GHASH_NONE
+#endif
+
+/*
+ * Common state for both implementations. The GHASH accumulator and
+ * key are kept as pairs of 64-bit words holding the big-endian
+ * interpretation of the 16-byte blocks, which is the natural form
+ * for the software multiplier; the hardware version converts to and
+ * from vector registers at the start and end of each bulk call.
+ */
+typedef struct aesgcm_context aesgcm_context;
+
+typedef void (*ghash_fn)(aesgcm_context *ctx, const uint8_t *blocks,
+                         size_t nblocks);
+
+struct aesgcm_extra {
+    /* For the concrete vtables: the SDCTR cipher to build on, and the
+     * GHASH implementation. */
+    const ssh_cipheralg *ctr;
+    ghash_fn ghash;
+    bool hw;
+
+    /* For the selector vtable: the two concrete vtables. */
+    const ssh_cipheralg *sw_alg, *hw_alg;
+};
+
+struct aesgcm_context {
+    ssh_cipher *ctr;
+    ghash_fn ghash;
+
+    /* The GHASH key H, and (for the hardware version) its powers H^2,
+     * H^3, H^4, each as a (high, low) pair of 64-bit words. */
+    uint64_t hkey[4][2];
+
+    /* The running GHASH accumulator. */
+    uint64_t acc[2];
+
+    /* Per-key fixed part of the nonce, and the 64-bit invocation
+     * counter that OpenSSH increments once per packet. */
+    uint8_t fixed_iv[4];
+    uint64_t invocation;
+
+    /* E(K, J0), which is XORed into GHASH to make the final tag. */
+    uint8_t mask[16];
+
+    /* MAC input state: how many bytes of the leading sequence number
+     * we've still to discard, how much of the 4-byte AAD we've seen,
+     * and a partial block of ciphertext waiting to be hashed. */
+    unsigned skiplen, aadlen;
+    uint8_t aad[16];
+    uint8_t partial[16];
+    size_t partlen;
+    uint64_t ctlen;
+
+    BinarySink_IMPLEMENTATION;
+    ssh_cipher ciph;
+    ssh2_mac mac_if;
+};
+
+/* ----------------------------------------------------------------------
+ * Portable constant-time GHASH.
+ *
+ * The core is a 64x64 -> 64 carry-less multiply done using ordinary
+ * integer multiplication. Each operand is split into four words with
+ * only every fourth bit set; multiplying two such words can produce
+ * carries, but they can never reach the next bit that we care about,
+ * because each output bit position only receives contributions from
+ * at most 16 partial products, so the 'holes' in between absorb any
+ * carry. Recombining the right slices of the right products gives the
+ * carry-less product. This approach (from Thomas Pornin's BearSSL)
+ * has no table lookups and no secret-dependent branches, so it's safe
+ * against cache and timing side channels.
+ *
+ * A full 128x128 multiply is done by Karatsuba from three of those on
+ * the original operands (giving the low half of each partial
+ * product) and three on their bit-reversals (giving the high half).
+ */
+
+static inline uint64_t ghash_bmul64(uint64_t x, uint64_t y)
+{
+    const uint64_t m0 = 0x1111111111111111ULL, m1 = m0 << 1,
+        m2 = m0 << 2, m3 = m0 << 3;
+
+    uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+    uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+
+    uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+
+    return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+}
+
+static inline uint64_t ghash_rev64(uint64_t x)
+{
+#define RMS(m, s) x = ((x & (uint64_t)(m)) << (s)) | ((x >> (s)) & (m))
+    RMS(0x5555555555555555ULL, 1);
+    RMS(0x3333333333333333ULL, 2);
+    RMS(0x0F0F0F0F0F0F0F0FULL, 4);
+    RMS(0x00FF00FF00FF00FFULL, 8);
+    RMS(0x0000FFFF0000FFFFULL, 16);
+#undef RMS
+    return (x << 32) | (x >> 32);
+}
+
+static void ghash_sw(aesgcm_context *ctx, const uint8_t *blocks,
+                     size_t nblocks)
+{
+    uint64_t h1 = ctx->hkey[0][0], h0 = ctx->hkey[0][1];
+    uint64_t h0r = ghash_rev64(h0), h1r = ghash_rev64(h1);
+    uint64_t h2 = h0 ^ h1, h2r = h0r ^ h1r;
+    uint64_t y1 = ctx->acc[0], y0 = ctx->acc[1];
+
+    for (; nblocks > 0; nblocks--, blocks += 16) {
+        y1 ^= GET_64BIT_MSB_FIRST(blocks);
+        y0 ^= GET_64BIT_MSB_FIRST(blocks + 8);
+
+        uint64_t y0r = ghash_rev64(y0), y1r = ghash_rev64(y1);
+        uint64_t y2 = y0 ^ y1, y2r = y0r ^ y1r;
+
+        uint64_t z0 = ghash_bmul64(y0, h0);
+        uint64_t z1 = ghash_bmul64(y1, h1);
+        uint64_t z2 = ghash_bmul64(y2, h2);
+        uint64_t z0h = ghash_bmul64(y0r, h0r);
+        uint64_t z1h = ghash_bmul64(y1r, h1r);
+        uint64_t z2h = ghash_bmul64(y2r, h2r);
+        z2 ^= z0 ^ z1;
+        z2h ^= z0h ^ z1h;
+        z0h = ghash_rev64(z0h) >> 1;
+        z1h = ghash_rev64(z1h) >> 1;
+        z2h = ghash_rev64(z2h) >> 1;
+
+        /* 256-bit product, in GCM's reflected bit order */
+        uint64_t v0 = z0, v1 = z0h ^ z2, v2 = z1 ^ z2h, v3 = z1h;
+
+        /* Shift left one bit to undo the reflection, then reduce
+         * modulo x^128 + x^7 + x^2 + x + 1. */
+        v3 = (v3 << 1) | (v2 >> 63);
+        v2 = (v2 << 1) | (v1 >> 63);
+        v1 = (v1 << 1) | (v0 >> 63);
+        v0 = (v0 << 1);
+
+        v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+        v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+        v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+        v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+
+        y0 = v2;
+        y1 = v3;
+    }
+
+    ctx->acc[0] = y1;
+    ctx->acc[1] = y0;
+}
+
+/* ----------------------------------------------------------------------
+ * Hardware-accelerated GHASH using x86 PCLMULQDQ.
+ */
+
+#if HW_GHASH == HW_GHASH_CLMUL
+
+/*
+ * Set target architecture for Clang and GCC
+ */
+#if !defined(__clang__) && defined(__GNUC__)
+#    pragma GCC target("pclmul")
+#    pragma GCC target("sse4.1")
+#endif
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
+#    define FUNC_ISA __attribute__ ((target("sse4.1,pclmul")))
+#else
+#    define FUNC_ISA
+#endif
+
+#include <wmmintrin.h>
+#include <smmintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID(out) __cpuid(1, (out)[0], (out)[1], (out)[2], (out)[3])
+#else
+#define GET_CPU_ID(out) __cpuid(out, 1)
+#endif
+
+static bool ghash_hw_available(void)
+{
+    /*
+     * Determine if PCLMULQDQ is available on this CPU, along with the
+     * SSE4.1 and SSSE3 instructions we use around it.
+     */
+    unsigned int CPUInfo[4];
+    GET_CPU_ID(CPUInfo);
+    return (CPUInfo[2] & (1 << 1)) && (CPUInfo[2] & (1 << 19)) &&
+        (CPUInfo[2] & (1 << 9));
+}
+
+/*
+ * Load and store a 64-bit word pair in the (high, low) form used by
+ * the common state, as a vector holding the 128-bit value with its
+ * most significant bit at the top.
+ */
+static FUNC_ISA inline __m128i ghash_clmul_load(const uint64_t w[2])
+{
+    uint64_t tmp[2] = { w[1], w[0] };
+    return _mm_loadu_si128((const __m128i *)tmp);
+}
+
+static FUNC_ISA inline void ghash_clmul_store(uint64_t w[2], __m128i v)
+{
+    uint64_t tmp[2];
+    _mm_storeu_si128((__m128i *)tmp, v);
+    w[0] = tmp[1];
+    w[1] = tmp[0];
+}
+
+/*
+ * Load a message block, converting from the wire's big-endian byte
+ * order so that the same layout applies.
+ */
+static FUNC_ISA inline __m128i ghash_clmul_loadblock(const uint8_t *p)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    return _mm_shuffle_epi8(
+        v, _mm_setr_epi8(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0));
+}
+
+/*
+ * Unreduced 128x128 -> 256 carry-less multiply, accumulated into
+ * (*lo, *hi) so that several products can share one reduction.
+ */
+static FUNC_ISA inline void ghash_clmul_mul_acc(
+    __m128i a, __m128i b, __m128i *lo, __m128i *hi)
+{
+    __m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+    __m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+    __m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+    t1 = _mm_xor_si128(t1, t2);
+    t0 = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+    t3 = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+    *lo = _mm_xor_si128(*lo, t0);
+    *hi = _mm_xor_si128(*hi, t3);
+}
+
+/*
+ * Reduce a 256-bit product modulo the GCM polynomial. Because GCM
+ * treats its field elements in bit-reflected order, the raw product
+ * is one bit too far right, so we shift left by one first.
+ */
+static FUNC_ISA inline __m128i ghash_clmul_reduce(__m128i lo, __m128i hi)
+{
+    __m128i t7 = _mm_srli_epi32(lo, 31);
+    __m128i t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+
+    __m128i t2 = _mm_srli_epi32(lo, 1);
+    __m128i t4 = _mm_srli_epi32(lo, 2);
+    __m128i t5 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    lo = _mm_xor_si128(lo, t2);
+    return _mm_xor_si128(hi, lo);
+}
+
+static FUNC_ISA inline __m128i ghash_clmul_mul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    ghash_clmul_mul_acc(a, b, &lo, &hi);
+    return ghash_clmul_reduce(lo, hi);
+}
+
+static FUNC_ISA void ghash_clmul_setup(aesgcm_context *ctx)
+{
+    /* Precompute H^2, H^3, H^4 for the four-way aggregated loop. */
+    __m128i h = ghash_clmul_load(ctx->hkey[0]), hn = h;
+    for (unsigned i = 1; i < 4; i++) {
+        hn = ghash_clmul_mul(hn, h);
+        ghash_clmul_store(ctx->hkey[i], hn);
+    }
+}
+
+static FUNC_ISA void ghash_hw(aesgcm_context *ctx, const uint8_t *blocks,
+                              size_t nblocks)
+{
+    __m128i acc = ghash_clmul_load(ctx->acc);
+    __m128i h1 = ghash_clmul_load(ctx->hkey[0]);
+
+    if (nblocks >= 4) {
+        /*
+         * Four blocks at a time: ((((A+B1)H + B2)H + B3)H + B4)H
+         * expands to (A+B1)H^4 + B2 H^3 + B3 H^2 + B4 H, and we can
+         * do all four multiplications independently and reduce the
+         * sum just once.
+         */
+        __m128i h2 = ghash_clmul_load(ctx->hkey[1]);
+        __m128i h3 = ghash_clmul_load(ctx->hkey[2]);
+        __m128i h4 = ghash_clmul_load(ctx->hkey[3]);
+
+        for (; nblocks >= 4; nblocks -= 4, blocks += 64) {
+            __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+            __m128i b1 = _mm_xor_si128(acc, ghash_clmul_loadblock(blocks));
+            ghash_clmul_mul_acc(b1, h4, &lo, &hi);
+            ghash_clmul_mul_acc(ghash_clmul_loadblock(blocks + 16), h3,
+                                &lo, &hi);
+            ghash_clmul_mul_acc(ghash_clmul_loadblock(blocks + 32), h2,
+                                &lo, &hi);
+            ghash_clmul_mul_acc(ghash_clmul_loadblock(blocks + 48), h1,
+                                &lo, &hi);
+            acc = ghash_clmul_reduce(lo, hi);
+        }
+    }
+
+    for (; nblocks > 0; nblocks--, blocks += 16)
+        acc = ghash_clmul_mul(
+            _mm_xor_si128(acc, ghash_clmul_loadblock(blocks)), h1);
+
+    ghash_clmul_store(ctx->acc, acc);
+}
+
+#else /* HW_GHASH == HW_GHASH_NONE */
+
+static bool ghash_hw_available(void)
+{
+    return false;
+}
+
+static void ghash_clmul_setup(aesgcm_context *ctx)
+{
+    unreachable("Should never be called");
+}
+
+static void ghash_hw(aesgcm_context *ctx, const uint8_t *blocks,
+                     size_t nblocks)
+{
+    unreachable("Should never be called");
+}
+
+#endif /* HW_GHASH */
+
+static bool ghash_hw_available_cached(void)
+{
+    static bool initialised = false;
+    static bool hw_available;
+    if (!initialised) {
+        hw_available = ghash_hw_available();
+        initialised = true;
+    }
+    return hw_available;
+}
+
+/* ----------------------------------------------------------------------
+ * The SSH cipher interface.
+ */
+
+static void aesgcm_mac_BinarySink_write(
+    BinarySink *bs, const void *vblk, size_t len);
+
+static ssh_cipher *aesgcm_new(const ssh_cipheralg *alg)
+{
+    const struct aesgcm_extra *extra = (const struct aesgcm_extra *)alg->extra;
+
+    if (extra->hw && !ghash_hw_available_cached())
+        return NULL;
+
+    ssh_cipher *ctr = ssh_cipher_new(extra->ctr);
+    if (!ctr)
+        return NULL;                   /* hardware AES not available */
+
+    aesgcm_context *ctx = snew(aesgcm_context);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ctr = ctr;
+    ctx->ghash = extra->ghash;
+    BinarySink_INIT(ctx, aesgcm_mac_BinarySink_write);
+    ctx->ciph.vt = alg;
+    return &ctx->ciph;
+}
+
+static ssh_cipher *aesgcm_select(const ssh_cipheralg *alg)
+{
+    const struct aesgcm_extra *extra = (const struct aesgcm_extra *)alg->extra;
+    ssh_cipher *c = ssh_cipher_new(extra->hw_alg);
+    if (!c)
+        c = ssh_cipher_new(extra->sw_alg);
+    return c;
+}
+
+static void aesgcm_free(ssh_cipher *ciph)
+{
+    aesgcm_context *ctx = container_of(ciph, aesgcm_context, ciph);
+    ssh_cipher_free(ctx->ctr);
+    smemclr(ctx, sizeof(*ctx));
+    sfree(ctx);
+}
+
+/*
+ * Set up for a new packet: compute the tag mask E(K, IV || 1), and
+ * leave the counter-mode cipher positioned at IV || 2 ready for the
+ * packet data.
+ */
+static void aesgcm_start_message(aesgcm_context *ctx)
+{
+    uint8_t block[16];
+    memcpy(block, ctx->fixed_iv, 4);
+    PUT_64BIT_MSB_FIRST(block + 4, ctx->invocation);
+    PUT_32BIT_MSB_FIRST(block + 12, 1);
+    ssh_cipher_setiv(ctx->ctr, block);
+
+    memset(ctx->mask, 0, 16);
+    ssh_cipher_encrypt(ctx->ctr, ctx->mask, 16);
+    smemclr(block, sizeof(block));
+}
+
+static void aesgcm_setkey(ssh_cipher *ciph, const void *key)
+{
+    aesgcm_context *ctx = container_of(ciph, aesgcm_context, ciph);
+    uint8_t block[16];
+
+    ssh_cipher_setkey(ctx->ctr, key);
+
+    /* The GHASH key is H = E(K, 0). */
+    memset(block, 0, 16);
+    ssh_cipher_setiv(ctx->ctr, block);
+    ssh_cipher_encrypt(ctx->ctr, block, 16);
+    ctx->hkey[0][0] = GET_64BIT_MSB_FIRST(block);
+    ctx->hkey[0][1] = GET_64BIT_MSB_FIRST(block + 8);
+    if (ctx->ghash == ghash_hw)
+        ghash_clmul_setup(ctx);
+    smemclr(block, sizeof(block));
+
+    aesgcm_start_message(ctx);
+}
+
+static void aesgcm_setiv(ssh_cipher *ciph, const void *viv)
+{
+    aesgcm_context *ctx = container_of(ciph, aesgcm_context, ciph);
+    const uint8_t *iv = (const uint8_t *)viv;
+
+    /* Only the first 12 bytes of the SSH-derived IV are used. */
+    memcpy(ctx->fixed_iv, iv, 4);
+    ctx->invocation = GET_64BIT_MSB_FIRST(iv + 4);
+    aesgcm_start_message(ctx);
+}
+
+static void aesgcm_crypt(ssh_cipher *ciph, void *blk, int len)
+{
+    aesgcm_context *ctx = container_of(ciph, aesgcm_context, ciph);
+    ssh_cipher_encrypt(ctx->ctr, blk, len);
+}
+
+static void aesgcm_next_message(ssh_cipher *ciph)
+{
+    aesgcm_context *ctx = container_of(ciph, aesgcm_context, ciph);
+    ctx->invocation++;
+    aesgcm_start_message(ctx);
+}
+
+/* ----------------------------------------------------------------------
+ * The SSH MAC interface, which is a second face of the same object.
+ */
+
+static ssh2_mac *aesgcm_mac_new(const ssh2_macalg *alg, ssh_cipher *cipher)
+{
+    aesgcm_context *ctx = container_of(cipher, aesgcm_context, ciph);
+    ctx->mac_if.vt = alg;
+    BinarySink_DELEGATE_INIT(&ctx->mac_if, ctx);
+    return &ctx->mac_if;
+}
+
+static void aesgcm_mac_free(ssh2_mac *mac)
+{
+    /* Not allocated, just forwarded, no need to free */
+}
+
+static void aesgcm_mac_setkey(ssh2_mac *mac, ptrlen key)
+{
+    /* Uses the same key as the cipher, so ignore */
+}
+
+static void aesgcm_mac_start(ssh2_mac *mac)
+{
+    aesgcm_context *ctx = container_of(mac, aesgcm_context, mac_if);
+
+    ctx->acc[0] = ctx->acc[1] = 0;
+    ctx->skiplen = 4;                  /* SSH sequence number */
+    ctx->aadlen = 0;
+    ctx->partlen = 0;
+    ctx->ctlen = 0;
+}
+
+static void aesgcm_mac_BinarySink_write(
+    BinarySink *bs, const void *vblk, size_t len)
+{
+    aesgcm_context *ctx = BinarySink_DOWNCAST(bs, aesgcm_context);
+    const uint8_t *blk = (const uint8_t *)vblk;
+
+    /* The generic SSH-2 MAC code prefixes the sequence number, which
+     * GCM doesn't authenticate explicitly (it's implicit in the
+     * nonce). Discard it. */
+    while (ctx->skiplen > 0 && len > 0) {
+        ctx->skiplen--;
+        blk++, len--;
+    }
+
+    /* The next 4 bytes are the packet length field, which is the AAD.
+     * Once we have all of it, hash it as a zero-padded block. */
+    while (ctx->aadlen < 4 && len > 0) {
+        ctx->aad[ctx->aadlen++] = *blk++;
+        len--;
+        if (ctx->aadlen == 4) {
+            memset(ctx->aad + 4, 0, 12);
+            ctx->ghash(ctx, ctx->aad, 1);
+        }
+    }
+
+    /* Everything else is ciphertext. */
+    ctx->ctlen += len;
+
+    if (ctx->partlen > 0) {
+        size_t want = 16 - ctx->partlen;
+        if (want > len)
+            want = len;
+        memcpy(ctx->partial + ctx->partlen, blk, want);
+        ctx->partlen += want;
+        blk += want;
+        len -= want;
+        if (ctx->partlen < 16)
+            return;
+        ctx->ghash(ctx, ctx->partial, 1);
+        ctx->partlen = 0;
+    }
+
+    if (len >= 16) {
+        size_t nblocks = len / 16;
+        ctx->ghash(ctx, blk, nblocks);
+        blk += 16 * nblocks;
+        len -= 16 * nblocks;
+    }
+
+    memcpy(ctx->partial, blk, len);
+    ctx->partlen = len;
+}
+
+static void aesgcm_mac_genresult(ssh2_mac *mac, unsigned char *output)
+{
+    aesgcm_context *ctx = container_of(mac, aesgcm_context, mac_if);
+    uint8_t block[16];
+
+    if (ctx->partlen > 0) {
+        memset(ctx->partial + ctx->partlen, 0, 16 - ctx->partlen);
+        ctx->ghash(ctx, ctx->partial, 1);
+        ctx->partlen = 0;
+    }
+
+    /* Final block: bit lengths of the AAD and the ciphertext. */
+    PUT_64BIT_MSB_FIRST(block, (uint64_t)ctx->aadlen * 8);
+    PUT_64BIT_MSB_FIRST(block + 8, ctx->ctlen * 8);
+    ctx->ghash(ctx, block, 1);
+
+    PUT_64BIT_MSB_FIRST(output, ctx->acc[0]);
+    PUT_64BIT_MSB_FIRST(output + 8, ctx->acc[1]);
+    for (unsigned i = 0; i < 16; i++)
+        output[i] ^= ctx->mask[i];
+
+    smemclr(block, sizeof(block));
+}
+
+static const char *aesgcm_mac_text_name(ssh2_mac *mac)
+{
+    aesgcm_context *ctx = container_of(mac, aesgcm_context, mac_if);
+    return ctx->ghash == ghash_hw ? "GHASH (PCLMULQDQ accelerated)" :
+        "GHASH (unaccelerated)";
+}
+
+const ssh2_macalg ssh2_aesgcm_mac = {
+    .new = aesgcm_mac_new,
+    .free = aesgcm_mac_free,
+    .setkey = aesgcm_mac_setkey,
+    .start = aesgcm_mac_start,
+    .genresult = aesgcm_mac_genresult,
+    .text_name = aesgcm_mac_text_name,
+    .name = "",
+    .etm_name = "", /* Not selectable individually, just part of
+                     * AES-GCM */
+    .len = 16,
+    .keylen = 0,
+};
+
+/*
+ * Vtables: as in aes.c, a software one, a hardware one, and a
+ * selector which is never instantiated itself.
+ */
+#define GCM_VTABLES(bits)                                               \
+    static const struct aesgcm_extra extra_aes##bits##_gcm_sw = {       \
+        .ctr = &ssh_aes##bits##_sdctr_sw, .ghash = ghash_sw,            \
+        .hw = false };                                                  \
+    static const struct aesgcm_extra extra_aes##bits##_gcm_hw = {       \
+        .ctr = &ssh_aes##bits##_sdctr_hw, .ghash = ghash_hw,            \
+        .hw = true };                                                   \
+    const ssh_cipheralg ssh_aes##bits##_gcm_sw = {                      \
+        .new = aesgcm_new,                                              \
+        .free = aesgcm_free,                                            \
+        .setiv = aesgcm_setiv,                                          \
+        .setkey = aesgcm_setkey,                                        \
+        .encrypt = aesgcm_crypt,                                        \
+        .decrypt = aesgcm_crypt,                                        \
+        .next_message = aesgcm_next_message,                            \
+        .ssh2_id = "aes" #bits "-gcm@openssh.com",                      \
+        .blksize = 16,                                                  \
+        .real_keybits = bits,                                           \
+        .padded_keybytes = bits/8,                                      \
+        .flags = 0,                                                     \
+        .text_name = "AES-" #bits " GCM (unaccelerated)",               \
+        .required_mac = &ssh2_aesgcm_mac,                               \
+        .extra = &extra_aes##bits##_gcm_sw,                             \
+    };                                                                  \
+    const ssh_cipheralg ssh_aes##bits##_gcm_hw = {                      \
+        .new = aesgcm_new,                                              \
+        .free = aesgcm_free,                                            \
+        .setiv = aesgcm_setiv,                                          \
+        .setkey = aesgcm_setkey,                                        \
+        .encrypt = aesgcm_crypt,                                        \
+        .decrypt = aesgcm_crypt,                                        \
+        .next_message = aesgcm_next_message,                            \
+        .ssh2_id = "aes" #bits "-gcm@openssh.com",                      \
+        .blksize = 16,                                                  \
+        .real_keybits = bits,                                           \
+        .padded_keybytes = bits/8,                                      \
+        .flags = 0,                                                     \
+        .text_name = "AES-" #bits " GCM (AES-NI and PCLMULQDQ accelerated)", \
+        .required_mac = &ssh2_aesgcm_mac,                               \
+        .extra = &extra_aes##bits##_gcm_hw,                             \
+    };                                                                  \
+    static const struct aesgcm_extra extra_aes##bits##_gcm = {          \
+        .sw_alg = &ssh_aes##bits##_gcm_sw,                              \
+        .hw_alg = &ssh_aes##bits##_gcm_hw };                            \
+    const ssh_cipheralg ssh_aes##bits##_gcm = {                         \
+        .new = aesgcm_select,                                           \
+        .ssh2_id = "aes" #bits "-gcm@openssh.com",                      \
+        .blksize = 16,                                                  \
+        .real_keybits = bits,                                           \
+        .padded_keybytes = bits/8,                                      \
+        .flags = 0,                                                     \
+        .text_name = "AES-" #bits " GCM (dummy selector vtable)",       \
+        .required_mac = &ssh2_aesgcm_mac,                               \
+        .extra = &extra_aes##bits##_gcm,                                \
+    };
+
+GCM_VTABLES(128)
+GCM_VTABLES(256)
@@ -177,10 +177,593 @@ static void G_xor(uint8_t *out, const uint8_t *X, const uint8_t *Y)
     smemclr(Z, sizeof(Z));
 }
 
+/* ----------------------------------------------------------------------
+ * Vectorised versions of G, for x86.
+ *
+ * These compute exactly what G_xor does, but do the arithmetic on two
+ * (SSE2) or four (AVX2) 64-bit words at once. Each GB in the first
+ * half of P works on a column of the 4x4 matrix of words, and those
+ * four calls are independent, so they go in separate SIMD lanes. For
+ * the second half the words are rotated between lanes so that the
+ * diagonals line up the same way, and rotated back afterwards.
+ *
+ * The multiplication in GB is only ever of the bottom 32 bits of each
+ * word, which is what PMULUDQ does.
+ */
+
+#if defined _FORCE_SOFTWARE_ARGON2
+    /* leave ARGON2_X86 undefined */
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<immintrin.h>) &&      \
+    (defined(__x86_64__) || defined(__i386))
+#       define ARGON2_X86
+#   endif
+#elif defined(__GNUC__)
+#   if __GNUC__ >= 5 && (defined(__x86_64__) || defined(__i386))
+#       define ARGON2_X86
+#   endif
+#endif
+
+typedef void (*G_xor_fn)(uint8_t *out, const uint8_t *X, const uint8_t *Y);
+
+#ifdef ARGON2_X86
+
+#include <immintrin.h>
+
+#define SSE2_ISA __attribute__ ((target("sse2")))
+#define AVX2_ISA __attribute__ ((target("avx2")))
+
+#define ARGON2_SIMD_NONE 0
+#define ARGON2_SIMD_SSE2 1
+#define ARGON2_SIMD_AVX2 2
+
+static int argon2_simd_available(void)
+{
+    if (cpu_has_avx2())
+        return ARGON2_SIMD_AVX2;
+    if (cpu_has_sse2())
+        return ARGON2_SIMD_SSE2;
+    return ARGON2_SIMD_NONE;
+}
+
+/* GB on vectors of words. The rotations by 32 and 16 (and by 24 for
+ * AVX2, which can shuffle bytes) are done by moving data around
+ * rather than by shifting. */
+#define GB_VEC(a, b, c, d, ADD, XOR, MUL, ROR32, ROR24, ROR16, ROR63)   \
+    do {                                                                \
+        a = ADD(a, ADD(b, ADD(MUL(a, b), MUL(a, b))));                  \
+        d = ROR32(XOR(d, a));                                           \
+        c = ADD(c, ADD(d, ADD(MUL(c, d), MUL(c, d))));                  \
+        b = ROR24(XOR(b, c));                                           \
+        a = ADD(a, ADD(b, ADD(MUL(a, b), MUL(a, b))));                  \
+        d = ROR16(XOR(d, a));                                           \
+        c = ADD(c, ADD(d, ADD(MUL(c, d), MUL(c, d))));                  \
+        b = ROR63(XOR(b, c));                                           \
+    } while (0)
+
+#define SSE2_ROR32(v) _mm_shuffle_epi32(v, 0xB1)
+#define SSE2_ROR24(v) _mm_or_si128(_mm_srli_epi64(v, 24), _mm_slli_epi64(v, 40))
+#define SSE2_ROR16(v) _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x39), 0x39)
+#define SSE2_ROR63(v) _mm_xor_si128(_mm_srli_epi64(v, 63), _mm_add_epi64(v, v))
+#define SSE2_GB(a, b, c, d)                                             \
+    GB_VEC(a, b, c, d, _mm_add_epi64, _mm_xor_si128, _mm_mul_epu32,     \
+           SSE2_ROR32, SSE2_ROR24, SSE2_ROR16, SSE2_ROR63)
+
+/* The high word of a followed by the low word of b */
+#define SSE2_HILO(a, b) _mm_castpd_si128(                               \
+        _mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), 1))
+
+/*
+ * P, in place, on the eight pairs of words v[0], v[step], ...,
+ * v[7*step]. Each vector holds a pair, so a0,a1 are words 0-3 of the
+ * spec's 4x4 matrix, b0,b1 words 4-7 and so on.
+ */
+static inline SSE2_ISA void P_sse2(__m128i *v, unsigned step)
+{
+    __m128i a0 = v[0*step], a1 = v[1*step], b0 = v[2*step], b1 = v[3*step];
+    __m128i c0 = v[4*step], c1 = v[5*step], d0 = v[6*step], d1 = v[7*step];
+    __m128i t0, t1;
+
+    SSE2_GB(a0, b0, c0, d0);
+    SSE2_GB(a1, b1, c1, d1);
+
+    /* Line up the diagonals: (0,5,10,15) (1,6,11,12) in the first
+     * set, (2,7,8,13) (3,4,9,14) in the second */
+    t0 = SSE2_HILO(b0, b1); t1 = SSE2_HILO(b1, b0); b0 = t0; b1 = t1;
+    t0 = SSE2_HILO(d1, d0); t1 = SSE2_HILO(d0, d1); d0 = t0; d1 = t1;
+    SSE2_GB(a0, b0, c1, d0);
+    SSE2_GB(a1, b1, c0, d1);
+    t0 = SSE2_HILO(b1, b0); t1 = SSE2_HILO(b0, b1); b0 = t0; b1 = t1;
+    t0 = SSE2_HILO(d0, d1); t1 = SSE2_HILO(d1, d0); d0 = t0; d1 = t1;
+
+    v[0*step] = a0; v[1*step] = a1; v[2*step] = b0; v[3*step] = b1;
+    v[4*step] = c0; v[5*step] = c1; v[6*step] = d0; v[7*step] = d1;
+}
+
+/*
+ * The 128 words of a block are kept as 64 pairs. The rows that the
+ * first set of calls to P works on are eight consecutive pairs; the
+ * columns for the second set are every eighth pair.
+ */
+static SSE2_ISA void G_xor_sse2(uint8_t *out, const uint8_t *X,
+                                const uint8_t *Y)
+{
+    __m128i R[64], Q[64];
+
+    for (unsigned i = 0; i < 64; i++) {
+        R[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)X + i),
+                             _mm_loadu_si128((const __m128i *)Y + i));
+        Q[i] = R[i];
+    }
+
+    for (unsigned i = 0; i < 8; i++)
+        P_sse2(Q + 8*i, 1);
+
+    for (unsigned i = 0; i < 8; i++)
+        P_sse2(Q + i, 8);
+
+    for (unsigned i = 0; i < 64; i++)
+        _mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(
+                             _mm_loadu_si128((__m128i *)out + i),
+                             _mm_xor_si128(R[i], Q[i])));
+
+    smemclr(R, sizeof(R));
+    smemclr(Q, sizeof(Q));
+}
+
+#define AVX2_ROR32(v) _mm256_shuffle_epi32(v, 0xB1)
+#define AVX2_ROR24(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8(          \
+            3,4,5,6,7,0,1,2, 11,12,13,14,15,8,9,10,                     \
+            3,4,5,6,7,0,1,2, 11,12,13,14,15,8,9,10))
+#define AVX2_ROR16(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8(          \
+            2,3,4,5,6,7,0,1, 10,11,12,13,14,15,8,9,                     \
+            2,3,4,5,6,7,0,1, 10,11,12,13,14,15,8,9))
+#define AVX2_ROR63(v) _mm256_xor_si256(_mm256_srli_epi64(v, 63),        \
+                                       _mm256_add_epi64(v, v))
+#define AVX2_GB(a, b, c, d)                                             \
+    GB_VEC(a, b, c, d, _mm256_add_epi64, _mm256_xor_si256,              \
+           _mm256_mul_epu32, AVX2_ROR32, AVX2_ROR24, AVX2_ROR16,        \
+           AVX2_ROR63)
+
+#define AVX2_LOAD2(v, i, step) _mm256_inserti128_si256(                 \
+        _mm256_castsi128_si256(v[(i)*(step)]), v[((i)+1)*(step)], 1)
+#define AVX2_STORE2(v, i, step, x) do {                                 \
+        v[(i)*(step)] = _mm256_castsi256_si128(x);                      \
+        v[((i)+1)*(step)] = _mm256_extracti128_si256(x, 1);             \
+    } while (0)
+
+/*
+ * As P_sse2, but with a whole row of the matrix in each vector, so the
+ * diagonals are lined up by rotating b, c and d across lanes. With only
+ * one GB's worth of work at a time there isn't enough of it to keep the
+ * CPU busy, so this does P on two separate sets of words, at v and w.
+ */
+static inline AVX2_ISA void P_avx2(__m128i *v, __m128i *w, unsigned step)
+{
+    __m256i a = AVX2_LOAD2(v, 0, step), b = AVX2_LOAD2(v, 2, step);
+    __m256i c = AVX2_LOAD2(v, 4, step), d = AVX2_LOAD2(v, 6, step);
+    __m256i e = AVX2_LOAD2(w, 0, step), f = AVX2_LOAD2(w, 2, step);
+    __m256i g = AVX2_LOAD2(w, 4, step), h = AVX2_LOAD2(w, 6, step);
+
+    AVX2_GB(a, b, c, d);
+    AVX2_GB(e, f, g, h);
+    b = _mm256_permute4x64_epi64(b, 0x39);
+    c = _mm256_permute4x64_epi64(c, 0x4E);
+    d = _mm256_permute4x64_epi64(d, 0x93);
+    f = _mm256_permute4x64_epi64(f, 0x39);
+    g = _mm256_permute4x64_epi64(g, 0x4E);
+    h = _mm256_permute4x64_epi64(h, 0x93);
+    AVX2_GB(a, b, c, d);
+    AVX2_GB(e, f, g, h);
+    b = _mm256_permute4x64_epi64(b, 0x93);
+    c = _mm256_permute4x64_epi64(c, 0x4E);
+    d = _mm256_permute4x64_epi64(d, 0x39);
+    f = _mm256_permute4x64_epi64(f, 0x93);
+    g = _mm256_permute4x64_epi64(g, 0x4E);
+    h = _mm256_permute4x64_epi64(h, 0x39);
+
+    AVX2_STORE2(v, 0, step, a);
+    AVX2_STORE2(v, 2, step, b);
+    AVX2_STORE2(v, 4, step, c);
+    AVX2_STORE2(v, 6, step, d);
+    AVX2_STORE2(w, 0, step, e);
+    AVX2_STORE2(w, 2, step, f);
+    AVX2_STORE2(w, 4, step, g);
+    AVX2_STORE2(w, 6, step, h);
+}
+
+static AVX2_ISA void G_xor_avx2(uint8_t *out, const uint8_t *X,
+                                const uint8_t *Y)
+{
+    __m128i R[64], Q[64];
+
+    for (unsigned i = 0; i < 64; i++) {
+        R[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)X + i),
+                             _mm_loadu_si128((const __m128i *)Y + i));
+        Q[i] = R[i];
+    }
+
+    for (unsigned i = 0; i < 8; i += 2)
+        P_avx2(Q + 8*i, Q + 8*(i+1), 1);
+
+    for (unsigned i = 0; i < 8; i += 2)
+        P_avx2(Q + i, Q + i+1, 8);
+
+    for (unsigned i = 0; i < 64; i++)
+        _mm_storeu_si128((__m128i *)out + i, _mm_xor_si128(
+                             _mm_loadu_si128((__m128i *)out + i),
+                             _mm_xor_si128(R[i], Q[i])));
+
+    smemclr(R, sizeof(R));
+    smemclr(Q, sizeof(Q));
+}
+
+#endif /* ARGON2_X86 */
+
+/*
+ * Limits set by argon2_set_limits, for testing and benchmarking: the
+ * most threads to use (0 meaning one per CPU), and whether the SIMD
+ * versions of G may be used.
+ */
+static unsigned argon2_max_threads = 0;
+static bool argon2_allow_simd = true;
+
+void argon2_set_limits(unsigned max_threads, bool simd)
+{
+    argon2_max_threads = max_threads;
+    argon2_allow_simd = simd;
+}
+
+static G_xor_fn argon2_choose_G(void)
+{
+#ifdef ARGON2_X86
+    static bool initialised = false;
+    static int level;
+    if (!initialised) {
+        level = argon2_simd_available();
+        initialised = true;
+    }
+    if (argon2_allow_simd && level == ARGON2_SIMD_AVX2)
+        return G_xor_avx2;
+    if (argon2_allow_simd && level == ARGON2_SIMD_SSE2)
+        return G_xor_sse2;
+#endif
+    return G_xor;
+}
+
+/* ----------------------------------------------------------------------
+ * Running the lanes of the array on several threads.
+ *
+ * Within one slice, each lane only reads blocks from its own segment
+ * and from other slices, so the segments of a slice can all be done
+ * at once; the only ordering needed is that a slice is finished in
+ * every lane before the next one starts. So the threads are started
+ * once per call to argon2_internal, and for each slice the caller
+ * wakes them up, they and the caller each take the next lane nobody
+ * has claimed until there are none left, and the last to finish
+ * wakes the caller up again.
+ */
+
+/* Most threads argon2_internal will start, and the smallest array
+ * (in Kbyte) worth starting them for */
+#define ARGON2_MAX_THREADS 64
+#define ARGON2_MIN_THREADED_MEM 1024
+
+struct blk { uint8_t data[1024]; };
+
+typedef struct argon2_array {
+    /* Parameters, as named in argon2_internal */
+    uint32_t p, t, y;
+    size_t SL, q, mprime;
+    struct blk *B;
+    G_xor_fn G;
+
+    /* The slice being processed */
+    size_t pass;
+    unsigned slice;
+
+    /* For threads */
+    Semaphore *go, *done;
+    bool quit;
+    atomic_counter next;               /* next lane nobody has taken */
+    atomic_counter busy;               /* threads woken and not finished */
+} argon2_array;
+
+static void argon2_segment(argon2_array *A, size_t i);
+
+/* Process lanes of the current slice until there are none left */
+static void argon2_lanes(argon2_array *A)
+{
+    long i;
+
+    while ((i = atomic_counter_inc(&A->next)) < (long)A->p)
+        argon2_segment(A, i);
+}
+
+static void argon2_threadfunc(void *param)
+{
+    argon2_array *A = (argon2_array *)param;
+
+    while (1) {
+        semaphore_wait(A->go);
+        if (A->quit)
+            break;
+        argon2_lanes(A);
+        if (atomic_counter_dec(&A->busy) == 0)
+            semaphore_post(A->done, 1);
+    }
+}
+
+/*
+ * Start up to nthreads-1 threads to help the caller with the array.
+ * Returns how many it started, which may be none, in which case the
+ * caller does everything itself.
+ */
+static unsigned argon2_threads_start(argon2_array *A, WorkerThread **threads,
+                                     unsigned nthreads)
+{
+    unsigned started = 0;
+
+    A->quit = false;
+    if (nthreads < 2)
+        return 0;
+    if (!(A->go = semaphore_new()))
+        return 0;
+    if (!(A->done = semaphore_new())) {
+        semaphore_free(A->go);
+        return 0;
+    }
+
+    while (started < nthreads - 1 &&
+           (threads[started] = worker_thread_start(argon2_threadfunc, A)))
+        started++;
+
+    if (!started) {
+        semaphore_free(A->go);
+        semaphore_free(A->done);
+    }
+    return started;
+}
+
+static void argon2_threads_stop(argon2_array *A, WorkerThread **threads,
+                                unsigned nstarted)
+{
+    if (!nstarted)
+        return;
+    A->quit = true;
+    semaphore_post(A->go, nstarted);
+    for (unsigned k = 0; k < nstarted; k++)
+        worker_thread_join(threads[k]);
+    semaphore_free(A->go);
+    semaphore_free(A->done);
+}
+
+/* Process every lane of one slice, on all the threads there are */
+static void argon2_slice(argon2_array *A, unsigned nstarted)
+{
+    A->next = 0;
+    A->busy = nstarted;
+    if (nstarted)
+        semaphore_post(A->go, nstarted);
+
+    argon2_lanes(A);
+
+    if (nstarted)
+        semaphore_wait(A->done);
+}
+
 /* ----------------------------------------------------------------------
  * The main Argon2 function.
  */
 
+/*
+ * Process one segment of the array: the part of lane i that lies in the
+ * slice A->slice, on pass A->pass. See argon2_internal for the overall
+ * structure.
+ */
+static void argon2_segment(argon2_array *A, size_t i)
+{
+    uint32_t p = A->p, t = A->t;
+    size_t SL = A->SL, q = A->q, mprime = A->mprime;
+    struct blk *B = A->B;
+    size_t pass = A->pass;
+    unsigned slice = A->slice;
+
+    /*
+     * Usually we'll write a new value into every single block in the
+     * segment, except that in the initial slice on the first pass, we've
+     * already written values into the first two columns during the initial
+     * setup. So 'jstart' indicates the starting index in the segment: 2 in
+     * that one slice, and 0 everywhere else.
+     *
+     * d_mode indicates whether we're being data-dependent (true) or
+     * data-independent (false). In the hybrid Argon2id mode, we start off
+     * independent, and then once we've mixed things up enough (half way
+     * through the first pass), switch over to dependent mode to force long
+     * serial chains of computation.
+     */
+    size_t jstart = (pass == 0 && slice == 0) ? 2 : 0;
+    bool d_mode = (A->y == 0 || (A->y == 2 && !(pass == 0 && slice < 2)));
+    struct blk out2i, tmp2i, in2i;
+
+    /* Process the blocks from left to right, starting at 'jstart'. */
+    for (size_t jpre = jstart; jpre < SL; jpre++) {
+
+        /* j is the x-coordinate of each block we process, made up
+         * of the slice number and the index 'jpre' within the
+         * segment. */
+        size_t j = slice * SL + jpre;
+
+        /* jm1 is j-1 (mod q) */
+        uint32_t jm1 = (j == 0 ? q-1 : j-1);
+
+        /*
+         * Construct two 32-bit pseudorandom integers J1 and J2.
+         * This is the part of the algorithm that varies between
+         * the data-dependent and independent modes.
+         */
+        uint32_t J1, J2;
+        if (d_mode) {
+            /*
+             * Data-dependent: grab the first 64 bits of the block
+             * to the left of this one.
+             */
+            J1 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data);
+            J2 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data + 4);
+        } else {
+            /*
+             * Data-independent: generate pseudorandom data by
+             * hashing a sequence of preimage blocks that include
+             * all our input parameters, plus the coordinates of
+             * this point in the algorithm (array position and
+             * pass number) to make all the hash outputs distinct.
+             *
+             * The hash we use is G itself, applied twice. So we
+             * generate 1Kb of data at a time, which is enough for
+             * 128 (J1,J2) pairs. Hence we only need to do the
+             * hashing if our index within the segment is a
+             * multiple of 128, or if we're at the very start of
+             * the algorithm (in which case we started at 2 rather
+             * than 0). After that we can just keep picking data
+             * out of our most recent hash output.
+             */
+            if (jpre == jstart || jpre % 128 == 0) {
+                /*
+                 * Hash preimage is mostly zeroes, with a
+                 * collection of assorted integer values we had
+                 * anyway.
+                 */
+                memset(in2i.data, 0, sizeof(in2i.data));
+                PUT_64BIT_LSB_FIRST(in2i.data +  0, pass);
+                PUT_64BIT_LSB_FIRST(in2i.data +  8, i);
+                PUT_64BIT_LSB_FIRST(in2i.data + 16, slice);
+                PUT_64BIT_LSB_FIRST(in2i.data + 24, mprime);
+                PUT_64BIT_LSB_FIRST(in2i.data + 32, t);
+                PUT_64BIT_LSB_FIRST(in2i.data + 40, A->y);
+                PUT_64BIT_LSB_FIRST(in2i.data + 48, jpre / 128 + 1);
+
+                /*
+                 * Now apply G twice to generate the hash output
+                 * in out2i.
+                 */
+                memset(tmp2i.data, 0, sizeof(tmp2i.data));
+                A->G(tmp2i.data, tmp2i.data, in2i.data);
+                memset(out2i.data, 0, sizeof(out2i.data));
+                A->G(out2i.data, out2i.data, tmp2i.data);
+            }
+
+            /*
+             * Extract J1 and J2 from the most recent hash output
+             * (whether we've just computed it or not).
+             */
+            J1 = GET_32BIT_LSB_FIRST(
+                out2i.data + 8 * (jpre % 128));
+            J2 = GET_32BIT_LSB_FIRST(
+                out2i.data + 8 * (jpre % 128) + 4);
+        }
+
+        /*
+         * Now convert J1 and J2 into the index of an existing
+         * block of the array to use as input to this step. This
+         * is fairly fiddly.
+         *
+         * The easy part: the y-coordinate of the input block is
+         * obtained by reducing J2 mod p, except that at the very
+         * start of the algorithm (processing the first slice on
+         * the first pass) we simply use the same y-coordinate as
+         * our output block.
+         *
+         * Note that it's safe to use the ordinary % operator
+         * here, without any concern for timing side channels: in
+         * data-independent mode J2 is not correlated to any
+         * secrets, and in data-dependent mode we're going to be
+         * giving away side-channel data _anyway_ when we use it
+         * as an array index (and by assumption we don't care,
+         * because it's already massively randomised from the real
+         * inputs).
+         */
+        uint32_t index_l = (pass == 0 && slice == 0) ? i : J2 % p;
+
+        /*
+         * The hard part: which block in this array row do we use?
+         *
+         * First, we decide what the possible candidates are. This
+         * requires some case analysis, and depends on whether the
+         * array row is the same one we're writing into or not.
+         *
+         * If it's not the same row: we can't use any block from
+         * the current slice (because the segments within a slice
+         * have to be processable in parallel, so in a concurrent
+         * implementation those blocks are potentially in the
+         * process of being overwritten by other threads). But the
+         * other three slices are fair game, except that in the
+         * first pass, slices to the right of us won't have had
+         * any values written into them yet at all.
+         *
+         * If it is the same row, we _are_ allowed to use blocks
+         * from the current slice, but only the ones before our
+         * current position.
+         *
+         * In both cases, we also exclude the individual _column_
+         * just to the left of the current one. (The block
+         * immediately to our left is going to be the _other_
+         * input to G, but the spec also says that we avoid that
+         * column even in a different row.)
+         *
+         * All of this means that we end up choosing from a
+         * cyclically contiguous interval of blocks within this
+         * lane, but the start and end points require some thought
+         * to get them right.
+         */
+
+        /* Start position is the beginning of the _next_ slice
+         * (containing data from the previous pass), unless we're
+         * on pass 0, where the start position has to be 0. */
+        uint32_t Wstart = (pass == 0 ? 0 : (slice + 1) % 4 * SL);
+
+        /* End position splits up by cases. */
+        uint32_t Wend;
+        if (index_l == i) {
+            /* Same lane as output: we can use anything up to (but
+             * not including) the block immediately left of us. */
+            Wend = jm1;
+        } else {
+            /* Different lane from output: we can use anything up
+             * to the previous slice boundary, or one less than
+             * that if we're at the very left edge of our slice
+             * right now. */
+            Wend = SL * slice;
+            if (jpre == 0)
+                Wend = (Wend + q-1) % q;
+        }
+
+        /* Total number of blocks available to choose from */
+        uint32_t Wsize = (Wend + q - Wstart) % q;
+
+        /* Fiddly computation from the spec that chooses from the
+         * available blocks, in a deliberately non-uniform
+         * fashion, using J1 as pseudorandom input data. Output is
+         * zz which is the index within our contiguous interval. */
+        uint32_t x = ((uint64_t)J1 * J1) >> 32;
+        uint32_t y = ((uint64_t)Wsize * x) >> 32;
+        uint32_t zz = Wsize - 1 - y;
+
+        /* And index_z is the actual x coordinate of the block we
+         * want. */
+        uint32_t index_z = (Wstart + zz) % q;
+
+        /* Phew! Combine that block with the one immediately to
+         * our left, and XOR over the top of whatever is already
+         * in our current output block. */
+        A->G(B[i + p * j].data, B[i + p * jm1].data,
+             B[index_l + p * index_z].data);
+    }
+
+    smemclr(out2i.data, sizeof(out2i.data));
+    smemclr(tmp2i.data, sizeof(tmp2i.data));
+    smemclr(in2i.data, sizeof(in2i.data));
+}
+
 static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
                             uint32_t y, ptrlen P, ptrlen S, ptrlen K, ptrlen X,
                             uint8_t *out)
@@ -210,8 +793,6 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
         ssh_hash_final(h, h0);
     }
 
-    struct blk { uint8_t data[1024]; };
-
     /*
      * Array of 1Kb blocks. The total size is (approximately) m, the
      * caller-specified parameter for how much memory to use; the blocks are
@@ -258,225 +839,41 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
     }
 
     /*
-     * Declarations for the main loop.
-     *
-     * The basic structure of the main loop is going to involve processing the
-     * array one whole slice (vertically divided quarter) at a time. Usually
-     * we'll write a new value into every single block in the slice, except
-     * that in the initial slice on the first pass, we've already written
-     * values into the first two columns during the initial setup above. So
-     * 'jstart' indicates the starting index in each segment we process; it
-     * starts off as 2 so that we don't overwrite the inital setup, and then
-     * after the first slice is done, we set it to 0, and it stays there.
-     *
-     * d_mode indicates whether we're being data-dependent (true) or
-     * data-independent (false). In the hybrid Argon2id mode, we start off
-     * independent, and then once we've mixed things up enough, switch over to
-     * dependent mode to force long serial chains of computation.
+     * The main loop processes the array one whole slice (vertically divided
+     * quarter) at a time, making t whole passes from left to right over the
+     * array. Within a slice, the segments in different lanes don't depend
+     * on each other, so they're shared out between threads.
      */
-    size_t jstart = 2;
-    bool d_mode = (y == 0);
-    struct blk out2i, tmp2i, in2i;
+    argon2_array A[1];
+    A->p = p;
+    A->t = t;
+    A->y = y;
+    A->SL = SL;
+    A->q = q;
+    A->mprime = mprime;
+    A->B = B;
+    A->G = argon2_choose_G();
+
+    unsigned nthreads = argon2_max_threads ? argon2_max_threads : ncpus();
+    if (nthreads > p)
+        nthreads = p;
+    if (nthreads > ARGON2_MAX_THREADS)
+        nthreads = ARGON2_MAX_THREADS;
+    if (mprime < ARGON2_MIN_THREADED_MEM)
+        nthreads = 1;
+    WorkerThread *threads[ARGON2_MAX_THREADS];
+    unsigned nstarted = argon2_threads_start(A, threads, nthreads);
 
-    /* Outermost loop: t whole passes from left to right over the array */
     for (size_t pass = 0; pass < t; pass++) {
-
-        /* Within that, we process the array in its four main slices */
         for (unsigned slice = 0; slice < 4; slice++) {
-
-            /* In Argon2id mode, if we're half way through the first pass,
-             * this is the moment to switch d_mode from false to true */
-            if (pass == 0 && slice == 2 && y == 2)
-                d_mode = true;
-
-            /* Loop over every segment in the slice (i.e. every row). So i is
-             * the y-coordinate of each block we process. */
-            for (size_t i = 0; i < p; i++) {
-
-                /* And within that segment, process the blocks from left to
-                 * right, starting at 'jstart' (usually 0, but 2 in the first
-                 * slice). */
-                for (size_t jpre = jstart; jpre < SL; jpre++) {
-
-                    /* j is the x-coordinate of each block we process, made up
-                     * of the slice number and the index 'jpre' within the
-                     * segment. */
-                    size_t j = slice * SL + jpre;
-
-                    /* jm1 is j-1 (mod q) */
-                    uint32_t jm1 = (j == 0 ? q-1 : j-1);
-
-                    /*
-                     * Construct two 32-bit pseudorandom integers J1 and J2.
-                     * This is the part of the algorithm that varies between
-                     * the data-dependent and independent modes.
-                     */
-                    uint32_t J1, J2;
-                    if (d_mode) {
-                        /*
-                         * Data-dependent: grab the first 64 bits of the block
-                         * to the left of this one.
-                         */
-                        J1 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data);
-                        J2 = GET_32BIT_LSB_FIRST(B[i + p * jm1].data + 4);
-                    } else {
-                        /*
-                         * Data-independent: generate pseudorandom data by
-                         * hashing a sequence of preimage blocks that include
-                         * all our input parameters, plus the coordinates of
-                         * this point in the algorithm (array position and
-                         * pass number) to make all the hash outputs distinct.
-                         *
-                         * The hash we use is G itself, applied twice. So we
-                         * generate 1Kb of data at a time, which is enough for
-                         * 128 (J1,J2) pairs. Hence we only need to do the
-                         * hashing if our index within the segment is a
-                         * multiple of 128, or if we're at the very start of
-                         * the algorithm (in which case we started at 2 rather
-                         * than 0). After that we can just keep picking data
-                         * out of our most recent hash output.
-                         */
-                        if (jpre == jstart || jpre % 128 == 0) {
-                            /*
-                             * Hash preimage is mostly zeroes, with a
-                             * collection of assorted integer values we had
-                             * anyway.
-                             */
-                            memset(in2i.data, 0, sizeof(in2i.data));
-                            PUT_64BIT_LSB_FIRST(in2i.data +  0, pass);
-                            PUT_64BIT_LSB_FIRST(in2i.data +  8, i);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 16, slice);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 24, mprime);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 32, t);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 40, y);
-                            PUT_64BIT_LSB_FIRST(in2i.data + 48, jpre / 128 + 1);
-
-                            /*
-                             * Now apply G twice to generate the hash output
-                             * in out2i.
-                             */
-                            memset(tmp2i.data, 0, sizeof(tmp2i.data));
-                            G_xor(tmp2i.data, tmp2i.data, in2i.data);
-                            memset(out2i.data, 0, sizeof(out2i.data));
-                            G_xor(out2i.data, out2i.data, tmp2i.data);
-                        }
-
-                        /*
-                         * Extract J1 and J2 from the most recent hash output
-                         * (whether we've just computed it or not).
-                         */
-                        J1 = GET_32BIT_LSB_FIRST(
-                            out2i.data + 8 * (jpre % 128));
-                        J2 = GET_32BIT_LSB_FIRST(
-                            out2i.data + 8 * (jpre % 128) + 4);
-                    }
-
-                    /*
-                     * Now convert J1 and J2 into the index of an existing
-                     * block of the array to use as input to this step. This
-                     * is fairly fiddly.
-                     *
-                     * The easy part: the y-coordinate of the input block is
-                     * obtained by reducing J2 mod p, except that at the very
-                     * start of the algorithm (processing the first slice on
-                     * the first pass) we simply use the same y-coordinate as
-                     * our output block.
-                     *
-                     * Note that it's safe to use the ordinary % operator
-                     * here, without any concern for timing side channels: in
-                     * data-independent mode J2 is not correlated to any
-                     * secrets, and in data-dependent mode we're going to be
-                     * giving away side-channel data _anyway_ when we use it
-                     * as an array index (and by assumption we don't care,
-                     * because it's already massively randomised from the real
-                     * inputs).
-                     */
-                    uint32_t index_l = (pass == 0 && slice == 0) ? i : J2 % p;
-
-                    /*
-                     * The hard part: which block in this array row do we use?
-                     *
-                     * First, we decide what the possible candidates are. This
-                     * requires some case analysis, and depends on whether the
-                     * array row is the same one we're writing into or not.
-                     *
-                     * If it's not the same row: we can't use any block from
-                     * the current slice (because the segments within a slice
-                     * have to be processable in parallel, so in a concurrent
-                     * implementation those blocks are potentially in the
-                     * process of being overwritten by other threads). But the
-                     * other three slices are fair game, except that in the
-                     * first pass, slices to the right of us won't have had
-                     * any values written into them yet at all.
-                     *
-                     * If it is the same row, we _are_ allowed to use blocks
-                     * from the current slice, but only the ones before our
-                     * current position.
-                     *
-                     * In both cases, we also exclude the individual _column_
-                     * just to the left of the current one. (The block
-                     * immediately to our left is going to be the _other_
-                     * input to G, but the spec also says that we avoid that
-                     * column even in a different row.)
-                     *
-                     * All of this means that we end up choosing from a
-                     * cyclically contiguous interval of blocks within this
-                     * lane, but the start and end points require some thought
-                     * to get them right.
-                     */
-
-                    /* Start position is the beginning of the _next_ slice
-                     * (containing data from the previous pass), unless we're
-                     * on pass 0, where the start position has to be 0. */
-                    uint32_t Wstart = (pass == 0 ? 0 : (slice + 1) % 4 * SL);
-
-                    /* End position splits up by cases. */
-                    uint32_t Wend;
-                    if (index_l == i) {
-                        /* Same lane as output: we can use anything up to (but
-                         * not including) the block immediately left of us. */
-                        Wend = jm1;
-                    } else {
-                        /* Different lane from output: we can use anything up
-                         * to the previous slice boundary, or one less than
-                         * that if we're at the very left edge of our slice
-                         * right now. */
-                        Wend = SL * slice;
-                        if (jpre == 0)
-                            Wend = (Wend + q-1) % q;
-                    }
-
-                    /* Total number of blocks available to choose from */
-                    uint32_t Wsize = (Wend + q - Wstart) % q;
-
-                    /* Fiddly computation from the spec that chooses from the
-                     * available blocks, in a deliberately non-uniform
-                     * fashion, using J1 as pseudorandom input data. Output is
-                     * zz which is the index within our contiguous interval. */
-                    uint32_t x = ((uint64_t)J1 * J1) >> 32;
-                    uint32_t y = ((uint64_t)Wsize * x) >> 32;
-                    uint32_t zz = Wsize - 1 - y;
-
-                    /* And index_z is the actual x coordinate of the block we
-                     * want. */
-                    uint32_t index_z = (Wstart + zz) % q;
-
-                    /* Phew! Combine that block with the one immediately to
-                     * our left, and XOR over the top of whatever is already
-                     * in our current output block. */
-                    G_xor(B[i + p * j].data, B[i + p * jm1].data,
-                          B[index_l + p * index_z].data);
-                }
-            }
-
-            /* We've finished processing a slice. Reset jstart to 0. It will
-             * onily _not_ have been 0 if this was pass 0 slice 0, in which
-             * case it still had its initial value of 2 to avoid the starting
-             * data. */
-            jstart = 0;
+            A->pass = pass;
+            A->slice = slice;
+            argon2_slice(A, nstarted);
         }
     }
 
+    argon2_threads_stop(A, threads, nstarted);
+
     /*
      * The main output is all done. Final output works by taking the XOR of
      * all the blocks in the rightmost column of the array, and then using
@@ -497,9 +894,6 @@ static void argon2_internal(uint32_t p, uint32_t T, uint32_t m, uint32_t t,
     /*
      * Clean up.
      */
-    smemclr(out2i.data, sizeof(out2i.data));
-    smemclr(tmp2i.data, sizeof(tmp2i.data));
-    smemclr(in2i.data, sizeof(in2i.data));
     smemclr(C.data, sizeof(C.data));
     smemclr(B, mprime * sizeof(struct blk));
     sfree(B);
@@ -687,7 +687,7 @@ const ssh_cipheralg ssh_blowfish_ssh2_ctr = {
     .blksize = 8,
     .real_keybits = 256,
     .padded_keybytes = 32,
-    .flags = 0,
+    .flags = SSH_CIPHER_IS_SDCTR,
     .text_name = "Blowfish-256 SDCTR",
 };
 
@@ -50,6 +50,8 @@ struct chacha20 {
     unsigned char current[64];
     /* The index of the above currently used to allow a true streaming cipher */
     int currentIndex;
+    /* Which multi-block implementation to use (CHACHA20_SIMD_*) */
+    int simd;
 };
 
 static INLINE void chacha20_round(struct chacha20 *ctx)
@@ -119,6 +121,255 @@ static INLINE void chacha20_round(struct chacha20 *ctx)
     }
 }
 
+/*
+ * Multi-block ChaCha20, for long runs of data.
+ *
+ * The blocks of keystream are independent of each other, given their
+ * counter values, so on x86 we compute several of them at once, with
+ * each SIMD lane working on a different block: four at a time with
+ * SSE2, or eight with AVX2. Which of those the CPU can do is found
+ * out when a key is set up. Anything else uses chacha20_round one
+ * block at a time.
+ */
+
+#define CHACHA20_SIMD_NONE 0
+#define CHACHA20_SIMD_SSE2 1
+#define CHACHA20_SIMD_AVX2 2
+
+#if defined _FORCE_SOFTWARE_CHACHA20
+    /* leave CHACHA20_X86 undefined */
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<immintrin.h>) &&      \
+    (defined(__x86_64__) || defined(__i386))
+#       define CHACHA20_X86
+#   endif
+#elif defined(__GNUC__)
+#   if __GNUC__ >= 5 && (defined(__x86_64__) || defined(__i386))
+#       define CHACHA20_X86
+#   endif
+#endif
+
+#ifdef CHACHA20_X86
+
+#include <immintrin.h>
+
+#define SSE2_ISA __attribute__ ((target("sse2")))
+#define AVX2_ISA __attribute__ ((target("avx2")))
+
+static int chacha20_simd_available(void)
+{
+    if (cpu_has_avx2())
+        return CHACHA20_SIMD_AVX2;
+    if (cpu_has_sse2())
+        return CHACHA20_SIMD_SSE2;
+    return CHACHA20_SIMD_NONE;
+}
+
+/* The double round, on whichever width of vector */
+#define CHACHA20_QR(x, a, b, c, d, ADD, XOR, ROT16, ROT12, ROT8, ROT7)  \
+    x[a] = ADD(x[a], x[b]); x[d] = XOR(x[d], x[a]); x[d] = ROT16(x[d]); \
+    x[c] = ADD(x[c], x[d]); x[b] = XOR(x[b], x[c]); x[b] = ROT12(x[b]); \
+    x[a] = ADD(x[a], x[b]); x[d] = XOR(x[d], x[a]); x[d] = ROT8(x[d]);  \
+    x[c] = ADD(x[c], x[d]); x[b] = XOR(x[b], x[c]); x[b] = ROT7(x[b])
+#define CHACHA20_DOUBLEROUND(x, ...)                    \
+    do {                                                \
+        CHACHA20_QR(x, 0, 4,  8, 12, __VA_ARGS__);      \
+        CHACHA20_QR(x, 1, 5,  9, 13, __VA_ARGS__);      \
+        CHACHA20_QR(x, 2, 6, 10, 14, __VA_ARGS__);      \
+        CHACHA20_QR(x, 3, 7, 11, 15, __VA_ARGS__);      \
+        CHACHA20_QR(x, 0, 5, 10, 15, __VA_ARGS__);      \
+        CHACHA20_QR(x, 1, 6, 11, 12, __VA_ARGS__);      \
+        CHACHA20_QR(x, 2, 7,  8, 13, __VA_ARGS__);      \
+        CHACHA20_QR(x, 3, 4,  9, 14, __VA_ARGS__);      \
+    } while (0)
+
+#define SSE2_ROTL(v, n) \
+    _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_ROT16(v) \
+    _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1)
+#define SSE2_ROT12(v) SSE2_ROTL(v, 12)
+#define SSE2_ROT8(v) SSE2_ROTL(v, 8)
+#define SSE2_ROT7(v) SSE2_ROTL(v, 7)
+
+/*
+ * Turn four vectors holding one word each of four blocks into four
+ * holding four consecutive words of one block.
+ */
+#define SSE2_TRANSPOSE(a, b, c, d) do {                 \
+        __m128i t0 = _mm_unpacklo_epi32(a, b);          \
+        __m128i t1 = _mm_unpacklo_epi32(c, d);          \
+        __m128i t2 = _mm_unpackhi_epi32(a, b);          \
+        __m128i t3 = _mm_unpackhi_epi32(c, d);          \
+        a = _mm_unpacklo_epi64(t0, t1);                 \
+        b = _mm_unpackhi_epi64(t0, t1);                 \
+        c = _mm_unpacklo_epi64(t2, t3);                 \
+        d = _mm_unpackhi_epi64(t2, t3);                 \
+    } while (0)
+
+#define SSE2_XOR_STORE(p, v) _mm_storeu_si128(                          \
+        (__m128i *)(p), _mm_xor_si128(_mm_loadu_si128((__m128i *)(p)), v))
+
+/* XOR four blocks of keystream, from block 'counter' on, into blk */
+static SSE2_ISA void chacha20_xor4_sse2(
+    const uint32_t *state, uint64_t counter, unsigned char *blk)
+{
+    __m128i x[16], orig[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        orig[i] = _mm_set1_epi32(state[i]);
+    orig[12] = _mm_setr_epi32(counter, counter + 1, counter + 2,
+                              counter + 3);
+    orig[13] = _mm_setr_epi32((counter) >> 32, (counter + 1) >> 32,
+                              (counter + 2) >> 32, (counter + 3) >> 32);
+    for (i = 0; i < 16; i++)
+        x[i] = orig[i];
+
+    for (i = 0; i < 20; i += 2)
+        CHACHA20_DOUBLEROUND(x, _mm_add_epi32, _mm_xor_si128, SSE2_ROT16,
+                             SSE2_ROT12, SSE2_ROT8, SSE2_ROT7);
+
+    for (i = 0; i < 16; i += 4) {
+        __m128i a = _mm_add_epi32(x[i], orig[i]);
+        __m128i b = _mm_add_epi32(x[i + 1], orig[i + 1]);
+        __m128i c = _mm_add_epi32(x[i + 2], orig[i + 2]);
+        __m128i d = _mm_add_epi32(x[i + 3], orig[i + 3]);
+        SSE2_TRANSPOSE(a, b, c, d);
+        SSE2_XOR_STORE(blk + 4*i, a);
+        SSE2_XOR_STORE(blk + 4*i + 64, b);
+        SSE2_XOR_STORE(blk + 4*i + 128, c);
+        SSE2_XOR_STORE(blk + 4*i + 192, d);
+    }
+
+    smemclr(x, sizeof(x));
+}
+
+#define AVX2_ROTL(v, n) \
+    _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_ROT16(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8(    \
+            2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13,               \
+            2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13))
+#define AVX2_ROT8(v) _mm256_shuffle_epi8(v, _mm256_setr_epi8(     \
+            3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14,               \
+            3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14))
+#define AVX2_ROT12(v) AVX2_ROTL(v, 12)
+#define AVX2_ROT7(v) AVX2_ROTL(v, 7)
+
+/* As SSE2_TRANSPOSE, but separately in each 128-bit half */
+#define AVX2_TRANSPOSE(a, b, c, d) do {                 \
+        __m256i t0 = _mm256_unpacklo_epi32(a, b);       \
+        __m256i t1 = _mm256_unpacklo_epi32(c, d);       \
+        __m256i t2 = _mm256_unpackhi_epi32(a, b);       \
+        __m256i t3 = _mm256_unpackhi_epi32(c, d);       \
+        a = _mm256_unpacklo_epi64(t0, t1);              \
+        b = _mm256_unpackhi_epi64(t0, t1);              \
+        c = _mm256_unpacklo_epi64(t2, t3);              \
+        d = _mm256_unpackhi_epi64(t2, t3);              \
+    } while (0)
+
+#define AVX2_XOR_STORE(p, v) _mm256_storeu_si256(                       \
+        (__m256i *)(p),                                                 \
+        _mm256_xor_si256(_mm256_loadu_si256((__m256i *)(p)), v))
+
+/* XOR eight blocks of keystream, from block 'counter' on, into blk */
+static AVX2_ISA void chacha20_xor8_avx2(
+    const uint32_t *state, uint64_t counter, unsigned char *blk)
+{
+    __m256i x[16], orig[16], w[16];
+    int i;
+
+    for (i = 0; i < 16; i++)
+        orig[i] = _mm256_set1_epi32(state[i]);
+    orig[12] = _mm256_setr_epi32(
+        counter, counter + 1, counter + 2, counter + 3,
+        counter + 4, counter + 5, counter + 6, counter + 7);
+    orig[13] = _mm256_setr_epi32(
+        counter >> 32, (counter + 1) >> 32, (counter + 2) >> 32,
+        (counter + 3) >> 32, (counter + 4) >> 32, (counter + 5) >> 32,
+        (counter + 6) >> 32, (counter + 7) >> 32);
+    for (i = 0; i < 16; i++)
+        x[i] = orig[i];
+
+    for (i = 0; i < 20; i += 2)
+        CHACHA20_DOUBLEROUND(x, _mm256_add_epi32, _mm256_xor_si256,
+                             AVX2_ROT16, AVX2_ROT12, AVX2_ROT8, AVX2_ROT7);
+
+    for (i = 0; i < 16; i++)
+        w[i] = _mm256_add_epi32(x[i], orig[i]);
+    for (i = 0; i < 16; i += 4)
+        AVX2_TRANSPOSE(w[i], w[i + 1], w[i + 2], w[i + 3]);
+
+    /*
+     * Now w[4g+k] holds words 4g..4g+3 of block k in its low half and
+     * of block k+4 in its high half.
+     */
+    for (i = 0; i < 4; i++) {
+        AVX2_XOR_STORE(blk + 64*i,
+                       _mm256_permute2x128_si256(w[i], w[i + 4], 0x20));
+        AVX2_XOR_STORE(blk + 64*i + 32,
+                       _mm256_permute2x128_si256(w[i + 8], w[i + 12], 0x20));
+        AVX2_XOR_STORE(blk + 64*i + 256,
+                       _mm256_permute2x128_si256(w[i], w[i + 4], 0x31));
+        AVX2_XOR_STORE(blk + 64*i + 288,
+                       _mm256_permute2x128_si256(w[i + 8], w[i + 12], 0x31));
+    }
+
+    smemclr(x, sizeof(x));
+    smemclr(w, sizeof(w));
+}
+
+#else /* CHACHA20_X86 */
+
+static int chacha20_simd_available(void)
+{
+    return CHACHA20_SIMD_NONE;
+}
+
+#endif /* CHACHA20_X86 */
+
+static int chacha20_simd_available_cached(void)
+{
+    static bool initialised = false;
+    static int simd;
+    if (!initialised) {
+        simd = chacha20_simd_available();
+        initialised = true;
+    }
+    return simd;
+}
+
+/*
+ * XOR nblocks whole blocks of keystream into blk, starting from the
+ * block the state's counter is at, and move the counter on past them.
+ */
+static void chacha20_xor_blocks(struct chacha20 *ctx,
+                                unsigned char *blk, size_t nblocks)
+{
+    uint64_t counter = ctx->state[12] | ((uint64_t)ctx->state[13] << 32);
+
+#ifdef CHACHA20_X86
+    if (ctx->simd >= CHACHA20_SIMD_AVX2) {
+        for (; nblocks >= 8; nblocks -= 8, blk += 512, counter += 8)
+            chacha20_xor8_avx2(ctx->state, counter, blk);
+    }
+    if (ctx->simd >= CHACHA20_SIMD_SSE2) {
+        for (; nblocks >= 4; nblocks -= 4, blk += 256, counter += 4)
+            chacha20_xor4_sse2(ctx->state, counter, blk);
+    }
+#endif
+
+    ctx->state[12] = (uint32_t)counter;
+    ctx->state[13] = (uint32_t)(counter >> 32);
+
+    for (; nblocks > 0; nblocks--, blk += 64) {
+        int i;
+        chacha20_round(ctx);
+        for (i = 0; i < 64; i++)
+            blk[i] ^= ctx->current[i];
+        ctx->currentIndex = 64;
+    }
+}
+
 /* Initialise context with 256bit key */
 static void chacha20_key(struct chacha20 *ctx, const unsigned char *key)
 {
@@ -142,6 +393,8 @@ static void chacha20_key(struct chacha20 *ctx, const unsigned char *key)
 
     /* New key, dump context */
     ctx->currentIndex = 64;
+
+    ctx->simd = chacha20_simd_available_cached();
 }
 
 static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
@@ -157,14 +410,23 @@ static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
 
 static void chacha20_encrypt(struct chacha20 *ctx, unsigned char *blk, int len)
 {
-    while (len) {
-        /* If we don't have any state left, then cycle to the next */
-        if (ctx->currentIndex >= 64) {
-            chacha20_round(ctx);
-        }
+    /* Use up what's left of a block we've already started on */
+    while (ctx->currentIndex < 64 && len) {
+        *blk++ ^= ctx->current[ctx->currentIndex++];
+        --len;
+    }
 
-        /* Do the xor while there's some state left and some plaintext left */
-        while (ctx->currentIndex < 64 && len) {
+    /* Then as many whole blocks as we can, several at a time */
+    if (len >= 64) {
+        chacha20_xor_blocks(ctx, blk, len / 64);
+        blk += len & ~63;
+        len &= 63;
+    }
+
+    /* And the start of one more */
+    if (len) {
+        chacha20_round(ctx);
+        while (len) {
             *blk++ ^= ctx->current[ctx->currentIndex++];
             --len;
         }
@@ -0,0 +1,62 @@
+/*
+ * cpu-features.c - finding out whether the CPU can run the vector
+ * versions of the crypto primitives, as declared in ssh.h.
+ *
+ * (AES-NI and the SHA extensions are looked for by aes.c, sha256.c
+ * and sha1.c themselves, because those also depend on which compiler
+ * intrinsics are available.)
+ */
+
+#include "ssh.h"
+
+#if defined(__clang__) || defined(__GNUC__)
+#   if defined(__x86_64__) || defined(__i386)
+#       define CPU_FEATURES_X86
+#   endif
+#endif
+
+#ifdef CPU_FEATURES_X86
+
+#include <cpuid.h>
+
+bool cpu_has_sse2(void)
+{
+    unsigned int a, b, c, d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (d & (1 << 26));
+}
+
+bool cpu_has_avx2(void)
+{
+    unsigned int a, b, c, d, xcr0_lo, xcr0_hi;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return false;
+
+    /*
+     * AVX2 also needs the OS to save the YMM registers on a context
+     * switch, which it says it does with OSXSAVE and bits 1 and 2 of
+     * XCR0.
+     */
+    if (!(c & (1 << 27)) || !(c & (1 << 28)) || __get_cpuid_max(0, NULL) < 7)
+        return false;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1 << 5)) != 0;
+}
+
+#else /* CPU_FEATURES_X86 */
+
+bool cpu_has_sse2(void)
+{
+    return false;
+}
+
+bool cpu_has_avx2(void)
+{
+    return false;
+}
+
+#endif /* CPU_FEATURES_X86 */
@@ -909,7 +909,7 @@ const ssh_cipheralg ssh_3des_ssh2_ctr = {
     .blksize = 8,
     .real_keybits = 168,
     .padded_keybytes = 24,
-    .flags = 0,
+    .flags = SSH_CIPHER_IS_SDCTR,
     .text_name = "triple-DES SDCTR",
 };
 
@@ -0,0 +1,885 @@
+/*
+ * Dedicated arithmetic for Curve25519 and Ed25519.
+ *
+ * ecc-arithmetic.c can do everything needed for these two curves, but
+ * it works in mp_ints, through Montgomery multiplication, with every
+ * intermediate value allocated and freed. Since the field here is
+ * always GF(2^255-19), this file instead keeps each field element in
+ * five 64-bit words holding 51 bits each, so that a product of two of
+ * them is 25 word multiplications, and reduction mod p is just a
+ * matter of multiplying the overflow by 19 and adding it back in at
+ * the bottom.
+ *
+ * As in ecc-arithmetic.c, nothing here branches on, or indexes memory
+ * by, a secret value: the scalars are only looked at through masks.
+ *
+ * References:
+ *
+ * The field representation and the Montgomery ladder follow the
+ * 'donna' implementations, and RFC 7748:
+ *   https://www.rfc-editor.org/rfc/rfc7748
+ *
+ * The Edwards formulae, and the signed-window table for multiples of
+ * the base point, follow the 'ref10' implementation from SUPERCOP, and
+ * RFC 8032:
+ *   https://www.rfc-editor.org/rfc/rfc8032
+ *   https://www.hyperelliptic.org/EFD/g1p/auto-twisted-extended-1.html
+ */
+
+#include <assert.h>
+
+#include "ssh.h"
+#include "ecc.h"
+
+/* ----------------------------------------------------------------------
+ * 64x64->128-bit multiplication. Where the compiler has a 128-bit
+ * type, we use it; otherwise we put it together from 32-bit pieces,
+ * which is slower but gets the same answers.
+ */
+
+#if defined __SIZEOF_INT128__
+
+typedef __uint128_t fe_wide;
+#define wide_mul(a, b) ((fe_wide)(a) * (b))
+#define wide_add(w, v) ((w) + (v))
+#define wide_lo51(w) ((uint64_t)(w) & FE_MASK)
+#define wide_shr51(w) ((uint64_t)((w) >> 51))
+
+#else
+
+typedef struct fe_wide { uint64_t hi, lo; } fe_wide;
+
+static inline fe_wide wide_mul(uint64_t a, uint64_t b)
+{
+    uint64_t al = (uint32_t)a, ah = a >> 32, bl = (uint32_t)b, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    fe_wide r;
+    r.lo = (mid << 32) | (uint32_t)ll;
+    r.hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return r;
+}
+
+static inline fe_wide wide_add(fe_wide w, fe_wide v)
+{
+    fe_wide r;
+    r.lo = w.lo + v.lo;
+    r.hi = w.hi + v.hi + (r.lo < w.lo);
+    return r;
+}
+
+#define wide_lo51(w) ((w).lo & FE_MASK)
+#define wide_shr51(w) (((w).lo >> 51) | ((w).hi << 13))
+
+#endif
+
+/* ----------------------------------------------------------------------
+ * Field elements.
+ *
+ * An fe holds the value v[0] + v[1]*2^51 + ... + v[4]*2^204, not
+ * necessarily reduced mod p, and with limbs allowed to be a little
+ * over 51 bits. The rules that keep everything in range are:
+ *
+ *  - fe_mul, fe_sq and fe_mul_small produce limbs below 2^52, and so
+ *    does fe_frombytes.
+ *  - fe_add and fe_sub take inputs like that, and produce limbs below
+ *    2^55, which fe_mul and fe_sq can take (their products then stay
+ *    well within 128 bits). fe_add and fe_sub can take one more level
+ *    of sums as their first input, but not as the second input to
+ *    fe_sub, which has to be below 4p limb by limb.
+ *
+ * Only fe_tobytes reduces completely.
+ */
+
+#define FE_MASK (((uint64_t)1 << 51) - 1)
+
+typedef struct fe { uint64_t v[5]; } fe;
+
+static inline uint64_t load64_le(const unsigned char *p)
+{
+    return GET_64BIT_LSB_FIRST(p);
+}
+
+static void fe_frombytes(fe *h, const unsigned char s[32])
+{
+    /* The top bit of the input is ignored */
+    h->v[0] = load64_le(s) & FE_MASK;
+    h->v[1] = (load64_le(s + 6) >> 3) & FE_MASK;
+    h->v[2] = (load64_le(s + 12) >> 6) & FE_MASK;
+    h->v[3] = (load64_le(s + 19) >> 1) & FE_MASK;
+    h->v[4] = (load64_le(s + 24) >> 12) & FE_MASK;
+}
+
+static inline void fe_carry_once(uint64_t t[5])
+{
+    t[1] += t[0] >> 51; t[0] &= FE_MASK;
+    t[2] += t[1] >> 51; t[1] &= FE_MASK;
+    t[3] += t[2] >> 51; t[2] &= FE_MASK;
+    t[4] += t[3] >> 51; t[3] &= FE_MASK;
+    t[0] += 19 * (t[4] >> 51); t[4] &= FE_MASK;
+}
+
+static void fe_tobytes(unsigned char s[32], const fe *f)
+{
+    uint64_t t[5];
+    for (unsigned i = 0; i < 5; i++)
+        t[i] = f->v[i];
+
+    fe_carry_once(t);
+    fe_carry_once(t);
+    /* Now t is between 0 and 2^255-1, properly carried */
+
+    /* Add 19 and carry, which folds any overflow past 2^255 back in:
+     * now t is the value mod p, plus 19 */
+    t[0] += 19;
+    fe_carry_once(t);
+
+    /* Add 2^255-19 and let the carry out of the top fall off, which
+     * takes the 19 away again */
+    t[0] += ((uint64_t)1 << 51) - 19;
+    t[1] += ((uint64_t)1 << 51) - 1;
+    t[2] += ((uint64_t)1 << 51) - 1;
+    t[3] += ((uint64_t)1 << 51) - 1;
+    t[4] += ((uint64_t)1 << 51) - 1;
+    t[1] += t[0] >> 51; t[0] &= FE_MASK;
+    t[2] += t[1] >> 51; t[1] &= FE_MASK;
+    t[3] += t[2] >> 51; t[2] &= FE_MASK;
+    t[4] += t[3] >> 51; t[3] &= FE_MASK;
+    t[4] &= FE_MASK;
+
+    PUT_64BIT_LSB_FIRST(s, t[0] | (t[1] << 51));
+    PUT_64BIT_LSB_FIRST(s + 8, (t[1] >> 13) | (t[2] << 38));
+    PUT_64BIT_LSB_FIRST(s + 16, (t[2] >> 26) | (t[3] << 25));
+    PUT_64BIT_LSB_FIRST(s + 24, (t[3] >> 39) | (t[4] << 12));
+    smemclr(t, sizeof(t));
+}
+
+static inline void fe_0(fe *h)
+{
+    for (unsigned i = 0; i < 5; i++)
+        h->v[i] = 0;
+}
+
+static inline void fe_1(fe *h)
+{
+    fe_0(h);
+    h->v[0] = 1;
+}
+
+static inline void fe_add(fe *h, const fe *f, const fe *g)
+{
+    for (unsigned i = 0; i < 5; i++)
+        h->v[i] = f->v[i] + g->v[i];
+}
+
+/* Subtract by adding 4p first, so that nothing goes negative */
+static inline void fe_sub(fe *h, const fe *f, const fe *g)
+{
+    h->v[0] = (f->v[0] + 0x1FFFFFFFFFFFB4) - g->v[0];
+    for (unsigned i = 1; i < 5; i++)
+        h->v[i] = (f->v[i] + 0x1FFFFFFFFFFFFC) - g->v[i];
+}
+
+static inline void fe_neg(fe *h, const fe *f)
+{
+    fe zero;
+    fe_0(&zero);
+    fe_sub(h, &zero, f);
+}
+
+/* Carry a set of wide column sums into an output fe */
+static inline void fe_carry_wide(fe *h, fe_wide r[5])
+{
+    uint64_t c;
+    c = wide_shr51(r[0]); h->v[0] = wide_lo51(r[0]);
+    r[1] = wide_add(r[1], wide_mul(c, 1));
+    c = wide_shr51(r[1]); h->v[1] = wide_lo51(r[1]);
+    r[2] = wide_add(r[2], wide_mul(c, 1));
+    c = wide_shr51(r[2]); h->v[2] = wide_lo51(r[2]);
+    r[3] = wide_add(r[3], wide_mul(c, 1));
+    c = wide_shr51(r[3]); h->v[3] = wide_lo51(r[3]);
+    r[4] = wide_add(r[4], wide_mul(c, 1));
+    c = wide_shr51(r[4]); h->v[4] = wide_lo51(r[4]);
+    /* c can be close to 64 bits, so 19c needs the wide type too */
+    r[0] = wide_add(wide_mul(c, 19), wide_mul(h->v[0], 1));
+    h->v[0] = wide_lo51(r[0]);
+    h->v[1] += wide_shr51(r[0]);
+}
+
+static void fe_mul(fe *h, const fe *f, const fe *g)
+{
+    const uint64_t *a = f->v, *b = g->v;
+    uint64_t b1_19 = 19 * b[1], b2_19 = 19 * b[2];
+    uint64_t b3_19 = 19 * b[3], b4_19 = 19 * b[4];
+    fe_wide r[5];
+
+    r[0] = wide_add(wide_add(wide_add(wide_add(
+        wide_mul(a[0], b[0]), wide_mul(a[1], b4_19)),
+        wide_mul(a[2], b3_19)), wide_mul(a[3], b2_19)),
+        wide_mul(a[4], b1_19));
+    r[1] = wide_add(wide_add(wide_add(wide_add(
+        wide_mul(a[0], b[1]), wide_mul(a[1], b[0])),
+        wide_mul(a[2], b4_19)), wide_mul(a[3], b3_19)),
+        wide_mul(a[4], b2_19));
+    r[2] = wide_add(wide_add(wide_add(wide_add(
+        wide_mul(a[0], b[2]), wide_mul(a[1], b[1])),
+        wide_mul(a[2], b[0])), wide_mul(a[3], b4_19)),
+        wide_mul(a[4], b3_19));
+    r[3] = wide_add(wide_add(wide_add(wide_add(
+        wide_mul(a[0], b[3]), wide_mul(a[1], b[2])),
+        wide_mul(a[2], b[1])), wide_mul(a[3], b[0])),
+        wide_mul(a[4], b4_19));
+    r[4] = wide_add(wide_add(wide_add(wide_add(
+        wide_mul(a[0], b[4]), wide_mul(a[1], b[3])),
+        wide_mul(a[2], b[2])), wide_mul(a[3], b[1])),
+        wide_mul(a[4], b[0]));
+
+    fe_carry_wide(h, r);
+}
+
+/* Squaring: the same as fe_mul(h, f, f), with the cross terms done
+ * once and doubled */
+static void fe_sq(fe *h, const fe *f)
+{
+    const uint64_t *a = f->v;
+    uint64_t a0_2 = 2 * a[0], a1_2 = 2 * a[1];
+    uint64_t a3_19 = 19 * a[3], a4_19 = 19 * a[4];
+    uint64_t a3_38 = 2 * a3_19, a4_38 = 2 * a4_19;
+    fe_wide r[5];
+
+    r[0] = wide_add(wide_add(
+        wide_mul(a[0], a[0]), wide_mul(a[1], a4_38)),
+        wide_mul(a[2], a3_38));
+    r[1] = wide_add(wide_add(
+        wide_mul(a0_2, a[1]), wide_mul(a[2], a4_38)),
+        wide_mul(a[3], a3_19));
+    r[2] = wide_add(wide_add(
+        wide_mul(a0_2, a[2]), wide_mul(a[1], a[1])),
+        wide_mul(a[3], a4_38));
+    r[3] = wide_add(wide_add(
+        wide_mul(a0_2, a[3]), wide_mul(a1_2, a[2])),
+        wide_mul(a[4], a4_19));
+    r[4] = wide_add(wide_add(
+        wide_mul(a0_2, a[4]), wide_mul(a1_2, a[3])),
+        wide_mul(a[2], a[2]));
+
+    fe_carry_wide(h, r);
+}
+
+static void fe_mul_small(fe *h, const fe *f, uint32_t n)
+{
+    fe_wide r[5];
+    for (unsigned i = 0; i < 5; i++)
+        r[i] = wide_mul(f->v[i], n);
+    fe_carry_wide(h, r);
+}
+
+/* n successive squarings */
+static void fe_sqn(fe *h, const fe *f, unsigned n)
+{
+    fe_sq(h, f);
+    while (--n > 0)
+        fe_sq(h, h);
+}
+
+/*
+ * Compute both f^(2^250-1) (used on the way to inverses and square
+ * roots) and f^11, by the addition chain from ref10.
+ */
+static void fe_pow_2_250_1(fe *out, fe *f11, const fe *f)
+{
+    fe t0, t1, t2;
+
+    fe_sq(&t0, f);                     /* 2 */
+    fe_sqn(&t1, &t0, 2);               /* 8 */
+    fe_mul(&t1, f, &t1);               /* 9 */
+    fe_mul(f11, &t0, &t1);             /* 11 */
+    fe_sq(&t0, f11);                   /* 22 */
+    fe_mul(&t0, &t1, &t0);             /* 2^5-1 */
+    fe_sqn(&t1, &t0, 5);
+    fe_mul(&t0, &t1, &t0);             /* 2^10-1 */
+    fe_sqn(&t1, &t0, 10);
+    fe_mul(&t1, &t1, &t0);             /* 2^20-1 */
+    fe_sqn(&t2, &t1, 20);
+    fe_mul(&t1, &t2, &t1);             /* 2^40-1 */
+    fe_sqn(&t1, &t1, 10);
+    fe_mul(&t0, &t1, &t0);             /* 2^50-1 */
+    fe_sqn(&t1, &t0, 50);
+    fe_mul(&t1, &t1, &t0);             /* 2^100-1 */
+    fe_sqn(&t2, &t1, 100);
+    fe_mul(&t1, &t2, &t1);             /* 2^200-1 */
+    fe_sqn(&t1, &t1, 50);
+    fe_mul(out, &t1, &t0);             /* 2^250-1 */
+
+    smemclr(&t0, sizeof(t0));
+    smemclr(&t1, sizeof(t1));
+    smemclr(&t2, sizeof(t2));
+}
+
+/* Inverse, as f^(p-2) = f^(2^255-21). The inverse of 0 comes out as 0. */
+static void fe_invert(fe *out, const fe *f)
+{
+    fe t, f11;
+    fe_pow_2_250_1(&t, &f11, f);
+    fe_sqn(&t, &t, 5);                 /* 2^255-32 */
+    fe_mul(out, &t, &f11);             /* 2^255-21 */
+    smemclr(&t, sizeof(t));
+    smemclr(&f11, sizeof(f11));
+}
+
+/* f^((p-5)/8) = f^(2^252-3), for square roots */
+static void fe_pow22523(fe *out, const fe *f)
+{
+    fe t, f11;
+    fe_pow_2_250_1(&t, &f11, f);
+    fe_sqn(&t, &t, 2);                 /* 2^252-4 */
+    fe_mul(out, &t, f);                /* 2^252-3 */
+    smemclr(&t, sizeof(t));
+    smemclr(&f11, sizeof(f11));
+}
+
+/* Swap f and g if swap is 1, leave them alone if it's 0 */
+static inline void fe_cswap(fe *f, fe *g, unsigned swap)
+{
+    uint64_t mask = -(uint64_t)swap;
+    for (unsigned i = 0; i < 5; i++) {
+        uint64_t x = mask & (f->v[i] ^ g->v[i]);
+        f->v[i] ^= x;
+        g->v[i] ^= x;
+    }
+}
+
+/* Copy g into f if move is 1 */
+static inline void fe_cmov(fe *f, const fe *g, unsigned move)
+{
+    uint64_t mask = -(uint64_t)move;
+    for (unsigned i = 0; i < 5; i++)
+        f->v[i] ^= mask & (f->v[i] ^ g->v[i]);
+}
+
+/* 1 if f is 0 mod p, otherwise 0 */
+static unsigned fe_iszero(const fe *f)
+{
+    unsigned char s[32];
+    unsigned acc = 0;
+    fe_tobytes(s, f);
+    for (unsigned i = 0; i < 32; i++)
+        acc |= s[i];
+    return 1 & ((acc - 1) >> 8);
+}
+
+/* The low bit of the fully reduced value */
+static unsigned fe_isodd(const fe *f)
+{
+    unsigned char s[32];
+    fe_tobytes(s, f);
+    return s[0] & 1;
+}
+
+/* ----------------------------------------------------------------------
+ * X25519: the Montgomery ladder on Curve25519, x-coordinates only.
+ */
+
+void x25519_multiply(unsigned char out[32], const unsigned char scalar[32],
+                     const unsigned char u[32])
+{
+    fe x1, x2, z2, x3, z3, a, aa, b, bb, e, c, d, da, cb, t;
+    unsigned swap = 0;
+
+    fe_frombytes(&x1, u);
+    fe_1(&x2);
+    fe_0(&z2);
+    x3 = x1;
+    fe_1(&z3);
+
+    /*
+     * Each step takes (x2,z2) = kP and (x3,z3) = (k+1)P, and turns
+     * them into 2kP and (2k+1)P, or (2k+1)P and (2k+2)P, according to
+     * the next bit of the scalar. Rather than branching on the bit,
+     * we swap the two points on the way in and out, and save work by
+     * only swapping when the bit changes.
+     */
+    for (int pos = 254; pos >= 0; pos--) {
+        unsigned bit = 1 & (scalar[pos >> 3] >> (pos & 7));
+        swap ^= bit;
+        fe_cswap(&x2, &x3, swap);
+        fe_cswap(&z2, &z3, swap);
+        swap = bit;
+
+        fe_add(&a, &x2, &z2);
+        fe_sq(&aa, &a);
+        fe_sub(&b, &x2, &z2);
+        fe_sq(&bb, &b);
+        fe_sub(&e, &aa, &bb);
+        fe_add(&c, &x3, &z3);
+        fe_sub(&d, &x3, &z3);
+        fe_mul(&da, &d, &a);
+        fe_mul(&cb, &c, &b);
+        fe_add(&t, &da, &cb);
+        fe_sq(&x3, &t);
+        fe_sub(&t, &da, &cb);
+        fe_sq(&t, &t);
+        fe_mul(&z3, &x1, &t);
+        fe_mul(&x2, &aa, &bb);
+        fe_mul_small(&t, &e, 121665);  /* (A-2)/4 */
+        fe_add(&t, &aa, &t);
+        fe_mul(&z2, &e, &t);
+    }
+    fe_cswap(&x2, &x3, swap);
+    fe_cswap(&z2, &z3, swap);
+
+    /* If the answer is the identity, z2 is 0, and so is its inverse */
+    fe_invert(&z2, &z2);
+    fe_mul(&x2, &x2, &z2);
+    fe_tobytes(out, &x2);
+
+    smemclr(&x2, sizeof(x2));
+    smemclr(&z2, sizeof(z2));
+    smemclr(&x3, sizeof(x3));
+    smemclr(&z3, sizeof(z3));
+    smemclr(&a, sizeof(a));
+    smemclr(&aa, sizeof(aa));
+    smemclr(&b, sizeof(b));
+    smemclr(&bb, sizeof(bb));
+    smemclr(&e, sizeof(e));
+    smemclr(&c, sizeof(c));
+    smemclr(&d, sizeof(d));
+    smemclr(&da, sizeof(da));
+    smemclr(&cb, sizeof(cb));
+    smemclr(&t, sizeof(t));
+}
+
+/* ----------------------------------------------------------------------
+ * Ed25519: the twisted Edwards curve -x^2 + y^2 = 1 + d x^2 y^2, in
+ * extended coordinates (X:Y:Z:T) with x = X/Z, y = Y/Z and xy = T/Z.
+ */
+
+typedef struct ge {
+    fe X, Y, Z, T;
+} ge;
+
+/*
+ * A point ready to be added to another, with the sums and products
+ * the addition formula needs done in advance: (Y+X, Y-X, 2dT, Z).
+ * For a point in the precomputed table of multiples of the base
+ * point, Z is 1, and is left out.
+ */
+typedef struct ge_cached {
+    fe YplusX, YminusX, T2d, Z;
+} ge_cached;
+
+typedef struct ge_precomp {
+    fe YplusX, YminusX, T2d;
+} ge_precomp;
+
+/* The curve constants d and 2d, and sqrt(-1) */
+static const fe ed25519_d = {{
+    0x34dca135978a3, 0x1a8283b156ebd, 0x5e7a26001c029,
+    0x739c663a03cbb, 0x52036cee2b6ff,
+}};
+static const fe ed25519_d2 = {{
+    0x69b9426b2f159, 0x35050762add7a, 0x3cf44c0038052,
+    0x6738cc7407977, 0x2406d9dc56dff,
+}};
+static const fe ed25519_sqrtm1 = {{
+    0x61b274a0ea0b0, 0x0d5a5fc8f189d, 0x7ef5e9cbd0c60,
+    0x78595a6804c9e, 0x2b8324804fc1d,
+}};
+
+/* The base point, as (x, y) */
+static const fe ed25519_Bx = {{
+    0x62d608f25d51a, 0x412a4b4f6592a, 0x75b7171a4b31d,
+    0x1ff60527118fe, 0x216936d3cd6e5,
+}};
+static const fe ed25519_By = {{
+    0x6666666666658, 0x4cccccccccccc, 0x1999999999999,
+    0x3333333333333, 0x6666666666666,
+}};
+
+static void ge_identity(ge *p)
+{
+    fe_0(&p->X);
+    fe_1(&p->Y);
+    fe_1(&p->Z);
+    fe_0(&p->T);
+}
+
+static void ge_to_cached(ge_cached *c, const ge *p)
+{
+    fe_add(&c->YplusX, &p->Y, &p->X);
+    fe_sub(&c->YminusX, &p->Y, &p->X);
+    fe_mul(&c->T2d, &p->T, &ed25519_d2);
+    c->Z = p->Z;
+}
+
+/*
+ * Addition (add-2008-hwcd-3 from the EFD), with the second point
+ * given in cached form. Like the generic code, this formula has no
+ * special cases: it works for doubling and for the identity.
+ */
+static void ge_add_cached(ge *r, const ge *p, const ge_cached *q)
+{
+    fe a, b, c, d, e, f, g, h;
+
+    fe_sub(&a, &p->Y, &p->X);
+    fe_mul(&a, &a, &q->YminusX);
+    fe_add(&b, &p->Y, &p->X);
+    fe_mul(&b, &b, &q->YplusX);
+    fe_mul(&c, &p->T, &q->T2d);
+    fe_mul(&d, &p->Z, &q->Z);
+    fe_add(&d, &d, &d);
+    fe_sub(&e, &b, &a);
+    fe_sub(&f, &d, &c);
+    fe_add(&g, &d, &c);
+    fe_add(&h, &b, &a);
+    fe_mul(&r->X, &e, &f);
+    fe_mul(&r->Y, &g, &h);
+    fe_mul(&r->T, &e, &h);
+    fe_mul(&r->Z, &f, &g);
+}
+
+/* The same, for a point from the table with Z = 1 */
+static void ge_add_precomp(ge *r, const ge *p, const ge_precomp *q)
+{
+    fe a, b, c, d, e, f, g, h;
+
+    fe_sub(&a, &p->Y, &p->X);
+    fe_mul(&a, &a, &q->YminusX);
+    fe_add(&b, &p->Y, &p->X);
+    fe_mul(&b, &b, &q->YplusX);
+    fe_mul(&c, &p->T, &q->T2d);
+    fe_add(&d, &p->Z, &p->Z);
+    fe_sub(&e, &b, &a);
+    fe_sub(&f, &d, &c);
+    fe_add(&g, &d, &c);
+    fe_add(&h, &b, &a);
+    fe_mul(&r->X, &e, &f);
+    fe_mul(&r->Y, &g, &h);
+    fe_mul(&r->T, &e, &h);
+    fe_mul(&r->Z, &f, &g);
+}
+
+/* Doubling (dbl-2008-hwcd, with a = -1 and all of E,F,G,H negated,
+ * which makes no difference to the output) */
+static void ge_double(ge *r, const ge *p)
+{
+    fe a, b, c, e, f, g, h, t;
+
+    fe_sq(&a, &p->X);
+    fe_sq(&b, &p->Y);
+    fe_sq(&c, &p->Z);
+    fe_add(&c, &c, &c);
+    fe_add(&h, &a, &b);
+    fe_add(&t, &p->X, &p->Y);
+    fe_sq(&t, &t);
+    fe_sub(&e, &h, &t);
+    fe_sub(&g, &a, &b);
+    fe_add(&f, &c, &g);
+    fe_mul(&r->X, &e, &f);
+    fe_mul(&r->Y, &g, &h);
+    fe_mul(&r->T, &e, &h);
+    fe_mul(&r->Z, &f, &g);
+}
+
+static void ge_tobytes(unsigned char s[32], const ge *p)
+{
+    fe recip, x, y;
+
+    fe_invert(&recip, &p->Z);
+    fe_mul(&x, &p->X, &recip);
+    fe_mul(&y, &p->Y, &recip);
+    fe_tobytes(s, &y);
+    s[31] ^= fe_isodd(&x) << 7;
+}
+
+/*
+ * Decode a point. This accepts exactly what eddsa_decode in
+ * ecc-ssh.c accepts from the generic code: y must be less than p, and
+ * x must exist, but x = 0 is allowed with either sign bit.
+ *
+ * Not time-constant, but then all the points we decode are public.
+ */
+static bool ge_frombytes(ge *p, const unsigned char s[32])
+{
+    unsigned char check[32];
+    fe u, v, v3, vxx, t;
+
+    fe_frombytes(&p->Y, s);
+    fe_tobytes(check, &p->Y);
+    check[31] |= s[31] & 0x80;
+    if (memcmp(check, s, 32))
+        return false;                  /* y was not less than p */
+
+    /* x^2 = (y^2-1) / (dy^2+1) = u/v */
+    fe_1(&p->Z);
+    fe_sq(&u, &p->Y);
+    fe_mul(&v, &u, &ed25519_d);
+    fe_sub(&u, &u, &p->Z);
+    fe_add(&v, &v, &p->Z);
+
+    /* Candidate square root: x = u v^3 (u v^7)^((p-5)/8) */
+    fe_sq(&v3, &v);
+    fe_mul(&v3, &v3, &v);
+    fe_sq(&t, &v3);
+    fe_mul(&t, &t, &v);
+    fe_mul(&t, &t, &u);
+    fe_pow22523(&t, &t);
+    fe_mul(&t, &t, &v3);
+    fe_mul(&p->X, &t, &u);
+
+    /* That's right up to a factor of sqrt(-1), or there's no root */
+    fe_sq(&vxx, &p->X);
+    fe_mul(&vxx, &vxx, &v);
+    fe_sub(&t, &vxx, &u);
+    if (!fe_iszero(&t)) {
+        fe_add(&t, &vxx, &u);
+        if (!fe_iszero(&t))
+            return false;
+        fe_mul(&p->X, &p->X, &ed25519_sqrtm1);
+    }
+
+    if (fe_isodd(&p->X) != (unsigned)(s[31] >> 7)) {
+        fe_neg(&t, &p->X);
+        fe_mul_small(&p->X, &t, 1);    /* carry back below 2^52 */
+    }
+
+    fe_mul(&p->T, &p->X, &p->Y);
+    return true;
+}
+
+/* 1 if the two points are the same, comparing projectively */
+static unsigned ge_eq(const ge *p, const ge *q)
+{
+    fe a, b, t;
+    unsigned eq;
+
+    fe_mul(&a, &p->X, &q->Z);
+    fe_mul(&b, &q->X, &p->Z);
+    fe_sub(&t, &a, &b);
+    eq = fe_iszero(&t);
+    fe_mul(&a, &p->Y, &q->Z);
+    fe_mul(&b, &q->Y, &p->Z);
+    fe_sub(&t, &a, &b);
+    return eq & fe_iszero(&t);
+}
+
+/* ----------------------------------------------------------------------
+ * Multiples of the base point, using a table of (j * 16^(2i) * B) for
+ * 0 <= i < 32 and 1 <= j <= 8. It's computed the first time it's
+ * needed, rather than compiled in.
+ */
+
+static ge_precomp ed25519_base_table[32][8];
+static bool ed25519_base_table_ready = false;
+
+static void ed25519_make_base_table(void)
+{
+    ge *pts = snewn(32 * 8, ge);
+    fe *zs = snewn(32 * 8, fe);
+    ge_cached cached;
+    ge row;
+
+    /* row = 16^(2i) B, and pts[8i+j-1] = j * row */
+    row.X = ed25519_Bx;
+    row.Y = ed25519_By;
+    fe_1(&row.Z);
+    fe_mul(&row.T, &row.X, &row.Y);
+    for (unsigned i = 0; i < 32; i++) {
+        ge_to_cached(&cached, &row);
+        pts[8*i] = row;
+        for (unsigned j = 1; j < 8; j++)
+            ge_add_cached(&pts[8*i+j], &pts[8*i+j-1], &cached);
+        for (unsigned k = 0; k < 8; k++)
+            ge_double(&row, &row);
+    }
+
+    /*
+     * Convert them all to affine at the cost of one inversion: zs[n]
+     * is the product of the first n+1 Z coordinates, and then we work
+     * back down from the inverse of the lot.
+     */
+    zs[0] = pts[0].Z;
+    for (unsigned n = 1; n < 32 * 8; n++)
+        fe_mul(&zs[n], &zs[n-1], &pts[n].Z);
+    fe inv, zinv, x, y;
+    fe_invert(&inv, &zs[32 * 8 - 1]);
+    for (unsigned n = 32 * 8; n-- > 0 ;) {
+        if (n > 0) {
+            fe_mul(&zinv, &inv, &zs[n-1]);
+            fe_mul(&inv, &inv, &pts[n].Z);
+        } else {
+            zinv = inv;
+        }
+        fe_mul(&x, &pts[n].X, &zinv);
+        fe_mul(&y, &pts[n].Y, &zinv);
+        ge_precomp *pc = &ed25519_base_table[n / 8][n % 8];
+        fe_add(&pc->YplusX, &y, &x);
+        fe_mul_small(&pc->YplusX, &pc->YplusX, 1);
+        fe_sub(&pc->YminusX, &y, &x);
+        fe_mul_small(&pc->YminusX, &pc->YminusX, 1);
+        fe_mul(&pc->T2d, &x, &y);
+        fe_mul(&pc->T2d, &pc->T2d, &ed25519_d2);
+    }
+
+    sfree(pts);
+    sfree(zs);
+    ed25519_base_table_ready = true;
+}
+
+/* 1 if a == b, for small non-negative a and b */
+static inline unsigned small_eq(unsigned a, unsigned b)
+{
+    return 1 & (((a ^ b) - 1) >> 16);
+}
+
+/* Fetch b * 16^(2i) * B from the table, for -8 <= b <= 8, reading
+ * every entry in the row so as not to give b away */
+static void ed25519_base_select(ge_precomp *t, unsigned i, int b)
+{
+    unsigned bneg = 1 & ((unsigned)b >> (sizeof(int) * 8 - 1));
+    unsigned babs = b - (((unsigned)-bneg & (unsigned)b) << 1);
+    ge_precomp minus;
+
+    fe_1(&t->YplusX);
+    fe_1(&t->YminusX);
+    fe_0(&t->T2d);
+    for (unsigned j = 0; j < 8; j++) {
+        const ge_precomp *e = &ed25519_base_table[i][j];
+        unsigned move = small_eq(babs, j + 1);
+        fe_cmov(&t->YplusX, &e->YplusX, move);
+        fe_cmov(&t->YminusX, &e->YminusX, move);
+        fe_cmov(&t->T2d, &e->T2d, move);
+    }
+
+    /* Negating a point swaps Y+X with Y-X, and negates T */
+    minus.YplusX = t->YminusX;
+    minus.YminusX = t->YplusX;
+    fe_neg(&minus.T2d, &t->T2d);
+    fe_mul_small(&minus.T2d, &minus.T2d, 1);
+    fe_cmov(&t->YplusX, &minus.YplusX, bneg);
+    fe_cmov(&t->YminusX, &minus.YminusX, bneg);
+    fe_cmov(&t->T2d, &minus.T2d, bneg);
+    smemclr(&minus, sizeof(minus));
+}
+
+static void ed25519_base_multiply_ge(ge *h, const unsigned char scalar[32])
+{
+    signed char e[64];
+    ge_precomp t;
+    int carry;
+
+    if (!ed25519_base_table_ready)
+        ed25519_make_base_table();
+
+    /*
+     * Write the scalar in base 16 with digits from -8 to 8, so that
+     * it's the sum of e[k] 16^k. Since the scalar is below 2^255, the
+     * top digit doesn't overflow.
+     */
+    for (unsigned i = 0; i < 32; i++) {
+        e[2*i] = scalar[i] & 15;
+        e[2*i+1] = (scalar[i] >> 4) & 15;
+    }
+    carry = 0;
+    for (unsigned i = 0; i < 63; i++) {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry * 16;
+    }
+    e[63] += carry;
+
+    /* Add up the odd digits' multiples, multiply by 16, then add the
+     * even ones' */
+    ge_identity(h);
+    for (unsigned i = 1; i < 64; i += 2) {
+        ed25519_base_select(&t, i / 2, e[i]);
+        ge_add_precomp(h, h, &t);
+    }
+    for (unsigned k = 0; k < 4; k++)
+        ge_double(h, h);
+    for (unsigned i = 0; i < 64; i += 2) {
+        ed25519_base_select(&t, i / 2, e[i]);
+        ge_add_precomp(h, h, &t);
+    }
+
+    smemclr(e, sizeof(e));
+    smemclr(&t, sizeof(t));
+}
+
+void ed25519_base_multiply(unsigned char out[32],
+                           const unsigned char scalar[32])
+{
+    ge h;
+
+    assert(!(scalar[31] & 0x80));
+    ed25519_base_multiply_ge(&h, scalar);
+    ge_tobytes(out, &h);
+    smemclr(&h, sizeof(h));
+}
+
+/*
+ * A multiple of an arbitrary point, by a scalar of up to 256 bits, in
+ * unsigned 4-bit windows from a table of 0..15 times the point.
+ */
+static void ge_multiply(ge *h, const ge *p, const unsigned char scalar[32])
+{
+    ge_cached table[16], t;
+    ge q;
+
+    ge_identity(&q);
+    ge_to_cached(&table[0], &q);
+    ge_to_cached(&table[1], p);
+    q = *p;
+    for (unsigned j = 2; j < 16; j++) {
+        ge_add_cached(&q, &q, &table[1]);
+        ge_to_cached(&table[j], &q);
+    }
+
+    ge_identity(h);
+    for (int i = 63; i >= 0; i--) {
+        unsigned digit = 15 & (scalar[i / 2] >> (4 * (i & 1)));
+        for (unsigned k = 0; k < 4; k++)
+            ge_double(h, h);
+        t = table[0];
+        for (unsigned j = 1; j < 16; j++) {
+            unsigned move = small_eq(digit, j);
+            fe_cmov(&t.YplusX, &table[j].YplusX, move);
+            fe_cmov(&t.YminusX, &table[j].YminusX, move);
+            fe_cmov(&t.T2d, &table[j].T2d, move);
+            fe_cmov(&t.Z, &table[j].Z, move);
+        }
+        ge_add_cached(h, h, &t);
+    }
+
+    smemclr(table, sizeof(table));
+    smemclr(&t, sizeof(t));
+    smemclr(&q, sizeof(q));
+}
+
+bool ed25519_decode(unsigned char x[32], unsigned char y[32],
+                    const unsigned char encoded[32])
+{
+    ge p;
+    if (!ge_frombytes(&p, encoded))
+        return false;
+    fe_tobytes(x, &p.X);
+    fe_tobytes(y, &p.Y);
+    return true;
+}
+
+bool ed25519_verify_equation(
+    const unsigned char R[32], const unsigned char A[32],
+    const unsigned char s[32], const unsigned char h[32])
+{
+    ge r, a, lhs, rhs;
+    ge_cached c;
+
+    if (!ge_frombytes(&r, R) || !ge_frombytes(&a, A))
+        return false;
+
+    ed25519_base_multiply_ge(&lhs, s);
+    ge_multiply(&rhs, &a, h);
+    ge_to_cached(&c, &r);
+    ge_add_cached(&rhs, &rhs, &c);
+    return ge_eq(&lhs, &rhs);
+}
@@ -336,6 +336,10 @@ struct ecsign_extra {
     /* Some EdDSA instances prefix a string to all hash preimages, to
      * disambiguate which signature variant they're being used with */
     ptrlen hash_prefix;
+
+    /* Set for Ed25519 to do the curve arithmetic in ecc-25519.c
+     * rather than ecc-arithmetic.c */
+    bool dedicated;
 };
 
 WeierstrassPoint *ecdsa_public(mp_int *private_key, const ssh_keyalg *alg)
@@ -352,6 +356,41 @@ WeierstrassPoint *ecdsa_public(mp_int *private_key, const ssh_keyalg *alg)
     return toret;
 }
 
+/*
+ * Helpers for the Ed25519 case, which convert between the mp_ints and
+ * EdwardsPoints used everywhere else and the byte strings the
+ * functions in ecc-25519.c take.
+ */
+static void le32_from_mp(unsigned char out[32], mp_int *x)
+{
+    for (size_t i = 0; i < 32; i++)
+        out[i] = mp_get_byte(x, i);
+}
+
+static EdwardsPoint *ed25519_point_from_encoding(
+    const struct ec_curve *curve, const unsigned char enc[32])
+{
+    unsigned char xb[32], yb[32];
+    if (!ed25519_decode(xb, yb, enc))
+        return NULL;
+    mp_int *x = mp_from_bytes_le(make_ptrlen(xb, 32));
+    mp_int *y = mp_from_bytes_le(make_ptrlen(yb, 32));
+    EdwardsPoint *P = ecc_edwards_point_new(curve->e.ec, x, y);
+    mp_free(x);
+    mp_free(y);
+    return P;
+}
+
+static EdwardsPoint *ed25519_public_from_exponent(
+    const struct ec_curve *curve, mp_int *exponent)
+{
+    unsigned char scalar[32], enc[32];
+    le32_from_mp(scalar, exponent);
+    ed25519_base_multiply(enc, scalar);
+    smemclr(scalar, sizeof(scalar));
+    return ed25519_point_from_encoding(curve, enc);
+}
+
 static mp_int *eddsa_exponent_from_hash(
     ptrlen hash, const struct ec_curve *curve)
 {
@@ -394,7 +433,12 @@ EdwardsPoint *eddsa_public(mp_int *private_key, const ssh_keyalg *alg)
     mp_int *exponent = eddsa_exponent_from_hash(
         make_ptrlen(hash, extra->hash->hlen), curve);
 
-    EdwardsPoint *toret = ecc_edwards_multiply(curve->e.G, exponent);
+    EdwardsPoint *toret;
+    if (extra->dedicated) {
+        toret = ed25519_public_from_exponent(curve, exponent);
+    } else {
+        toret = ecc_edwards_multiply(curve->e.G, exponent);
+    }
     mp_free(exponent);
 
     return toret;
@@ -1063,6 +1107,45 @@ static mp_int *eddsa_signing_exponent_from_data(
     return toret;
 }
 
+/*
+ * The rest of eddsa_verify, for Ed25519 done by ecc-25519.c, which
+ * wants both integers in 32 bytes. s is reduced mod the order of the
+ * base point B, which makes no difference to s*B. H is reduced only
+ * mod 8 times the order, which also makes no difference, even if the
+ * public key has a component of order dividing 8, because every
+ * point's order divides 8 times that of B.
+ */
+static bool ed25519_verify(
+    struct eddsa_key *ek, const struct ecsign_extra *extra,
+    ptrlen rstr, ptrlen sstr, ptrlen data)
+{
+    unsigned char A[32], s[32], h[32];
+
+    strbuf *pk = strbuf_new();
+    put_epoint(pk, ek->publicKey, ek->curve, true);
+    assert(pk->len == 32);
+    memcpy(A, pk->u, 32);
+    strbuf_free(pk);
+
+    mp_int *s_unreduced = mp_from_bytes_le(sstr);
+    mp_int *s_reduced = mp_mod(s_unreduced, ek->curve->e.G_order);
+    le32_from_mp(s, s_reduced);
+    mp_free(s_unreduced);
+    mp_free(s_reduced);
+
+    mp_int *H = eddsa_signing_exponent_from_data(ek, extra, rstr, data);
+    mp_int *order8 = mp_new(mp_max_bits(ek->curve->e.G_order) + 3);
+    mp_copy_into(order8, ek->curve->e.G_order);
+    mp_lshift_fixed_into(order8, order8, 3);
+    mp_int *H_reduced = mp_mod(H, order8);
+    le32_from_mp(h, H_reduced);
+    mp_free(H);
+    mp_free(order8);
+    mp_free(H_reduced);
+
+    return ed25519_verify_equation(rstr.ptr, A, s, h);
+}
+
 static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
 {
     struct eddsa_key *ek = container_of(key, struct eddsa_key, sshk);
@@ -1087,6 +1170,9 @@ static bool eddsa_verify(ssh_key *key, ptrlen sig, ptrlen data)
     if (get_err(src) || get_avail(src))
         return false;
 
+    if (extra->dedicated)
+        return ed25519_verify(ek, extra, rstr, sstr, data);
+
     EdwardsPoint *r = eddsa_decode(rstr, ek->curve);
     if (!r)
         return false;
@@ -1212,15 +1298,23 @@ static void eddsa_sign(ssh_key *key, ptrlen data,
         make_ptrlen(hash, extra->hash->hlen));
     mp_int *log_r = mp_mod(log_r_unreduced, ek->curve->e.G_order);
     mp_free(log_r_unreduced);
-    EdwardsPoint *r = ecc_edwards_multiply(ek->curve->e.G, log_r);
 
     /*
-     * Encode r now, because we'll need its encoding for the next
-     * hashing step as well as to write into the actual signature.
+     * Compute r and encode it now, because we'll need its encoding
+     * for the next hashing step as well as to write into the actual
+     * signature.
      */
     strbuf *r_enc = strbuf_new();
-    put_epoint(r_enc, r, ek->curve, true); /* omit string header */
-    ecc_edwards_point_free(r);
+    if (extra->dedicated) {
+        unsigned char scalar[32];
+        le32_from_mp(scalar, log_r);
+        ed25519_base_multiply(strbuf_append(r_enc, 32), scalar);
+        smemclr(scalar, sizeof(scalar));
+    } else {
+        EdwardsPoint *r = ecc_edwards_multiply(ek->curve->e.G, log_r);
+        put_epoint(r_enc, r, ek->curve, true); /* omit string header */
+        ecc_edwards_point_free(r);
+    }
 
     /*
      * Compute the hash of (r || public key || message) just as
@@ -1249,7 +1343,7 @@ static void eddsa_sign(ssh_key *key, ptrlen data,
 
 static const struct ecsign_extra sign_extra_ed25519 = {
     ec_ed25519, &ssh_sha512,
-    NULL, 0, PTRLEN_DECL_LITERAL(""),
+    NULL, 0, PTRLEN_DECL_LITERAL(""), true,
 };
 const ssh_keyalg ssh_ecdsa_ed25519 = {
     .new_pub = eddsa_new_pub,
@@ -1270,6 +1364,30 @@ const ssh_keyalg ssh_ecdsa_ed25519 = {
     .extra = &sign_extra_ed25519,
 };
 
+/* The same, using only the general-purpose arithmetic, for testing */
+static const struct ecsign_extra sign_extra_ed25519_generic = {
+    ec_ed25519, &ssh_sha512,
+    NULL, 0, PTRLEN_DECL_LITERAL(""), false,
+};
+const ssh_keyalg ssh_ecdsa_ed25519_generic = {
+    .new_pub = eddsa_new_pub,
+    .new_priv = eddsa_new_priv,
+    .new_priv_openssh = eddsa_new_priv_openssh,
+    .freekey = eddsa_freekey,
+    .invalid = ec_signkey_invalid,
+    .sign = eddsa_sign,
+    .verify = eddsa_verify,
+    .public_blob = eddsa_public_blob,
+    .private_blob = eddsa_private_blob,
+    .openssh_blob = eddsa_openssh_blob,
+    .cache_str = eddsa_cache_str,
+    .components = eddsa_components,
+    .pubkey_bits = ec_shared_pubkey_bits,
+    .ssh_id = "ssh-ed25519",
+    .cache_id = "ssh-ed25519",
+    .extra = &sign_extra_ed25519_generic,
+};
+
 static const struct ecsign_extra sign_extra_ed448 = {
     ec_ed448, &ssh_shake256_114bytes,
     NULL, 0, PTRLEN_DECL_LITERAL("SigEd448\0\0"),
@@ -1393,6 +1511,7 @@ struct ecdh_key {
     union {
         WeierstrassPoint *w_public;
         MontgomeryPoint *m_public;
+        unsigned char x25519_public[32];
     };
 };
 
@@ -1412,7 +1531,7 @@ static void ssh_ecdhkex_w_setup(ecdh_key *dh)
     dh->w_public = ecc_weierstrass_multiply(dh->curve->w.G, dh->private);
 }
 
-static void ssh_ecdhkex_m_setup(ecdh_key *dh)
+static void ssh_ecdhkex_m_make_private(ecdh_key *dh)
 {
     strbuf *bytes = strbuf_new_nm();
     random_read(strbuf_append(bytes, dh->curve->fieldBytes),
@@ -1430,10 +1549,30 @@ static void ssh_ecdhkex_m_setup(ecdh_key *dh)
         mp_set_bit(dh->private, bit, 0);
 
     strbuf_free(bytes);
+}
 
+static void ssh_ecdhkex_m_setup(ecdh_key *dh)
+{
+    ssh_ecdhkex_m_make_private(dh);
     dh->m_public = ecc_montgomery_multiply(dh->curve->m.G, dh->private);
 }
 
+/*
+ * Curve25519 by ecc-25519.c. The private key is made in the same way,
+ * and kept as an mp_int, but the public one is kept as the bytes we
+ * send.
+ */
+static void ssh_ecdhkex_x25519_setup(ecdh_key *dh)
+{
+    static const unsigned char basepoint[32] = { 9 };
+    unsigned char priv[32];
+
+    ssh_ecdhkex_m_make_private(dh);
+    le32_from_mp(priv, dh->private);
+    x25519_multiply(dh->x25519_public, priv, basepoint);
+    smemclr(priv, sizeof(priv));
+}
+
 ecdh_key *ssh_ecdhkex_newkey(const ssh_kex *kex)
 {
     const struct eckex_extra *extra = (const struct eckex_extra *)kex->extra;
@@ -1460,6 +1599,11 @@ static void ssh_ecdhkex_m_getpublic(ecdh_key *dh, BinarySink *bs)
     mp_free(x);
 }
 
+static void ssh_ecdhkex_x25519_getpublic(ecdh_key *dh, BinarySink *bs)
+{
+    put_data(bs, dh->x25519_public, 32);
+}
+
 void ssh_ecdhkex_getpublic(ecdh_key *dh, BinarySink *bs)
 {
     dh->extra->getpublic(dh, bs);
@@ -1541,6 +1685,32 @@ static mp_int *ssh_ecdhkex_m_getkey(ecdh_key *dh, ptrlen remoteKey)
     return x;
 }
 
+static mp_int *ssh_ecdhkex_x25519_getkey(ecdh_key *dh, ptrlen remoteKey)
+{
+    unsigned char priv[32], remote[32], shared[32];
+    unsigned nonzero = 0;
+
+    /* As above, a too-long remote value has its extra bits ignored
+     * (x25519_multiply ignores the top bit of the last byte itself),
+     * and a short one is padded with zeroes */
+    memset(remote, 0, 32);
+    memcpy(remote, remoteKey.ptr, remoteKey.len < 32 ? remoteKey.len : 32);
+
+    le32_from_mp(priv, dh->private);
+    x25519_multiply(shared, priv, remote);
+    smemclr(priv, sizeof(priv));
+
+    for (size_t i = 0; i < 32; i++)
+        nonzero |= shared[i];
+    if (!nonzero)
+        return NULL;                   /* the identity, as above */
+
+    /* Converted to an integer big-endian, for the same reason */
+    mp_int *x = mp_from_bytes_be(make_ptrlen(shared, 32));
+    smemclr(shared, sizeof(shared));
+    return x;
+}
+
 mp_int *ssh_ecdhkex_getkey(ecdh_key *dh, ptrlen remoteKey)
 {
     return dh->extra->getkey(dh, remoteKey);
@@ -1556,6 +1726,11 @@ static void ssh_ecdhkex_m_cleanup(ecdh_key *dh)
     ecc_montgomery_point_free(dh->m_public);
 }
 
+static void ssh_ecdhkex_x25519_cleanup(ecdh_key *dh)
+{
+    /* Nothing allocated */
+}
+
 void ssh_ecdhkex_freekey(ecdh_key *dh)
 {
     mp_free(dh->private);
@@ -1564,15 +1739,27 @@ void ssh_ecdhkex_freekey(ecdh_key *dh)
 }
 
 static const struct eckex_extra kex_extra_curve25519 = {
+    ec_curve25519,
+    ssh_ecdhkex_x25519_setup,
+    ssh_ecdhkex_x25519_cleanup,
+    ssh_ecdhkex_x25519_getpublic,
+    ssh_ecdhkex_x25519_getkey,
+};
+const ssh_kex ssh_ec_kex_curve25519 = {
+    "curve25519-sha256", NULL, KEXTYPE_ECDH,
+    &ssh_sha256, &kex_extra_curve25519,
+};
+/* The same, using only the general-purpose arithmetic, for testing */
+static const struct eckex_extra kex_extra_curve25519_generic = {
     ec_curve25519,
     ssh_ecdhkex_m_setup,
     ssh_ecdhkex_m_cleanup,
     ssh_ecdhkex_m_getpublic,
     ssh_ecdhkex_m_getkey,
 };
-const ssh_kex ssh_ec_kex_curve25519 = {
+const ssh_kex ssh_ec_kex_curve25519_generic = {
     "curve25519-sha256", NULL, KEXTYPE_ECDH,
-    &ssh_sha256, &kex_extra_curve25519,
+    &ssh_sha256, &kex_extra_curve25519_generic,
 };
 /* Pre-RFC alias */
 const ssh_kex ssh_ec_kex_curve25519_libssh = {
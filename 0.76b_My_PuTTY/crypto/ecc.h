@@ -240,4 +240,46 @@ EdwardsPoint *ecc_edwards_multiply(EdwardsPoint *, mp_int *);
 unsigned ecc_edwards_eq(EdwardsPoint *, EdwardsPoint *);
 void ecc_edwards_get_affine(EdwardsPoint *wp, mp_int **x, mp_int **y);
 
+/* ----------------------------------------------------------------------
+ * Dedicated code for Curve25519 and Ed25519, in ecc-25519.c, which does
+ * the same jobs as the general-purpose code above for those two curves
+ * only, much faster. Everything here is passed in and out as 32-byte
+ * little-endian strings, in the same encodings the protocol uses.
+ */
+
+/*
+ * X25519 as in RFC 7748: multiply the point with x-coordinate u by
+ * the scalar, and return the x-coordinate of the result (which is 0
+ * if the result is the identity). The scalar is used as given, all
+ * 255 bits of it: clamping it is the caller's job. The top bit of u
+ * is ignored.
+ */
+void x25519_multiply(unsigned char out[32], const unsigned char scalar[32],
+                     const unsigned char u[32]);
+
+/*
+ * Multiply the Ed25519 base point by a scalar less than 2^255, and
+ * return the encoding of the result.
+ */
+void ed25519_base_multiply(unsigned char out[32],
+                           const unsigned char scalar[32]);
+
+/*
+ * Decode an encoded Ed25519 point into its affine coordinates,
+ * accepting and rejecting the same encodings as the general code.
+ */
+bool ed25519_decode(unsigned char x[32], unsigned char y[32],
+                    const unsigned char encoded[32]);
+
+/*
+ * Check the Ed25519 verification equation s*B == R + h*A, given the
+ * encodings of R and A. Returns false if it doesn't hold, or if either
+ * point doesn't decode. (s is only looked at mod the order of B, but
+ * h is multiplied by A as given, so that if A has a small-order
+ * component, this gets the same answer as the general code.)
+ */
+bool ed25519_verify_equation(
+    const unsigned char R[32], const unsigned char A[32],
+    const unsigned char s[32], const unsigned char h[32]);
+
 #endif /* PUTTY_ECC_H */
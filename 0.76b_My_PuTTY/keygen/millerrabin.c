@@ -175,18 +175,55 @@ static struct mr_result miller_rabin_test_inner(MillerRabin *mr, mp_int *w)
     return result;
 }
 
-bool miller_rabin_test_random(MillerRabin *mr)
+/*
+ * Make a random witness in the range [2, p-1). If rf is NULL, that's
+ * done with random_read, as usual. Otherwise we do the same thing as
+ * mp_random_in_range, but with random data from rf.
+ */
+static mp_int *miller_rabin_witness(MillerRabin *mr,
+                                    MillerRabinRandomFn rf, void *ctx)
+{
+    if (!rf)
+        return mp_random_in_range(mr->two, mr->pm1);
+
+    mp_int *n_outcomes = mp_sub(mr->pm1, mr->two);
+    size_t bits = mp_max_bits(n_outcomes) + 128;
+    size_t bytes = (bits + 7) / 8;
+    uint8_t *randbuf = snewn(bytes, uint8_t);
+    rf(ctx, randbuf, bytes);
+    randbuf[0] &= (2 << ((bits-1) & 7)) - 1;
+    mp_int *unreduced = mp_from_bytes_be(make_ptrlen(randbuf, bytes));
+    smemclr(randbuf, bytes);
+    sfree(randbuf);
+
+    mp_int *reduced = mp_mod(unreduced, n_outcomes);
+    mp_int *result = mp_new(mp_max_bits(mr->pm1));
+    mp_add_into(result, reduced, mr->two);
+    mp_free(unreduced);
+    mp_free(reduced);
+    mp_free(n_outcomes);
+    return result;
+}
+
+bool miller_rabin_test_random_from(MillerRabin *mr,
+                                   MillerRabinRandomFn rf, void *ctx)
 {
-    mp_int *mw = mp_random_in_range(mr->two, mr->pm1);
+    mp_int *mw = miller_rabin_witness(mr, rf, ctx);
     struct mr_result result = miller_rabin_test_inner(mr, mw);
     mp_free(mw);
     return result.passed;
 }
 
-mp_int *miller_rabin_find_potential_primitive_root(MillerRabin *mr)
+bool miller_rabin_test_random(MillerRabin *mr)
+{
+    return miller_rabin_test_random_from(mr, NULL, NULL);
+}
+
+mp_int *miller_rabin_find_potential_primitive_root_from(
+    MillerRabin *mr, MillerRabinRandomFn rf, void *ctx)
 {
     while (true) {
-        mp_int *mw = mp_unsafe_shrink(mp_random_in_range(mr->two, mr->pm1));
+        mp_int *mw = mp_unsafe_shrink(miller_rabin_witness(mr, rf, ctx));
         struct mr_result result = miller_rabin_test_inner(mr, mw);
 
         if (result.passed && result.potential_primitive_root) {
@@ -203,6 +240,11 @@ mp_int *miller_rabin_find_potential_primitive_root(MillerRabin *mr)
     }
 }
 
+mp_int *miller_rabin_find_potential_primitive_root(MillerRabin *mr)
+{
+    return miller_rabin_find_potential_primitive_root_from(mr, NULL, NULL);
+}
+
 unsigned miller_rabin_checks_needed(unsigned bits)
 {
     /* Table 4.4 from Handbook of Applied Cryptography */
@@ -7,6 +7,7 @@
 
 #include "ssh.h"
 #include "mpint.h"
+#include "mpunsafe.h"
 #include "sshkeygen.h"
 
 /* ----------------------------------------------------------------------
@@ -70,6 +71,16 @@ static mp_int *probprime_generate(
 {
     pcs_ready(pcs);
 
+    if (primesearch_wanted(pcs)) {
+        /* The same thing, but testing several candidates at once */
+        PrimeSearch *ps = primesearch_new(
+            pcs, miller_rabin_checks_needed(pcs_get_bits(pcs)), false);
+        mp_int *p = primesearch_next(ps, prog, NULL);
+        primesearch_free(ps);
+        pcs_free(pcs);
+        return p;
+    }
+
     while (true) {
         progress_report_attempt(prog);
 
@@ -632,24 +643,47 @@ static mp_int *provableprime_generate_inner(
             bits, pcs_get_bits_remaining(pcs));
     pcs_ready(pcs);
 
+    /*
+     * If we're allowed several threads, the Miller-Rabin part of each
+     * attempt happens in a PrimeSearch, which only gives us back
+     * candidates it found a witness for. The Pocklington check stays
+     * here, because the Pockle isn't safe to share between threads.
+     */
+    PrimeSearch *ps = NULL;
+    if (primesearch_wanted(pcs))
+        ps = primesearch_new(pcs, 0, true);
+
     while (true) {
-        mp_int *p = pcs_generate(pcs);
-        if (!p) {
-            pcs_free(pcs);
-            return NULL;
-        }
+        mp_int *p, *witness;
+
+        if (ps) {
+            p = primesearch_next(ps, NULL, &witness);
+            if (!p) {
+                primesearch_free(ps);
+                pcs_free(pcs);
+                return NULL;
+            }
 
-        debug_f_mp("provable_step p=", p);
+            debug_f_mp("provable_step p=", p);
+        } else {
+            p = pcs_generate(pcs);
+            if (!p) {
+                pcs_free(pcs);
+                return NULL;
+            }
 
-        MillerRabin *mr = miller_rabin_new(p);
-        debug_f("provable_step mr setup done");
-        mp_int *witness = miller_rabin_find_potential_primitive_root(mr);
-        miller_rabin_free(mr);
+            debug_f_mp("provable_step p=", p);
 
-        if (!witness) {
-            debug_f("provable_step mr failed");
-            mp_free(p);
-            continue;
+            MillerRabin *mr = miller_rabin_new(p);
+            debug_f("provable_step mr setup done");
+            witness = miller_rabin_find_potential_primitive_root(mr);
+            miller_rabin_free(mr);
+
+            if (!witness) {
+                debug_f("provable_step mr failed");
+                mp_free(p);
+                continue;
+            }
         }
 
         size_t nfactors;
@@ -679,6 +713,8 @@ static mp_int *provableprime_generate_inner(
         }
 
         mp_free(witness);
+        if (ps)
+            primesearch_free(ps);
         pcs_free(pcs);
         debug_f_mp("ppgi(%u) done, got ", p, bits);
         progress_report(prog, progress_origin + progress_scale);
@@ -34,6 +34,12 @@ struct PrimeCandidateSource {
     struct avoid *avoids;
     size_t navoids, avoidsize;
 
+    /* More of the same for pcs_generate_batch, covering the primes
+     * from 2^16 up to PCS_SIEVE_LIMIT. Made on first use. */
+    struct avoid *wide_avoids;
+    size_t nwide_avoids;
+    bool wide_ready;
+
     /* List of known primes that our number will be congruent to 1 modulo */
     mp_int **kps;
     size_t nkps, kpsize;
@@ -58,6 +64,10 @@ PrimeCandidateSource *pcs_new_with_firstbits(unsigned bits,
     s->avoids = NULL;
     s->navoids = s->avoidsize = 0;
 
+    s->wide_avoids = NULL;
+    s->nwide_avoids = 0;
+    s->wide_ready = false;
+
     /* Make the number that's the lower limit of our range */
     mp_int *firstmp = mp_from_integer(first);
     mp_int *base = mp_lshift_fixed(firstmp, bits - nfirst);
@@ -97,6 +107,7 @@ void pcs_free(PrimeCandidateSource *s)
     for (size_t i = 0; i < s->nkps; i++)
         mp_free(s->kps[i]);
     sfree(s->avoids);
+    sfree(s->wide_avoids);
     sfree(s->kps);
     sfree(s);
 }
@@ -410,6 +421,201 @@ mp_int *pcs_generate(PrimeCandidateSource *s)
     }
 }
 
+/*
+ * The primes between 2^16 and PCS_SIEVE_LIMIT, which only
+ * pcs_generate_batch uses, so they're only worked out if it's called.
+ */
+static uint32_t *wideprimes;
+static size_t nwideprimes;
+
+static void init_wideprimes(void)
+{
+    if (wideprimes)
+        return;                        /* already done */
+
+    init_smallprimes();
+
+    /* A[i] says whether 65536+2i+1 might be prime */
+    size_t n = (PCS_SIEVE_LIMIT - 65536) / 2;
+    unsigned char *A = snewn(n, unsigned char);
+    memset(A, 1, n);
+
+    for (size_t i = 1; i < NSMALLPRIMES; i++) {
+        uint32_t p = smallprimes[i];
+        if ((uint64_t)p * p >= PCS_SIEVE_LIMIT)
+            break;
+        /* First odd multiple of p above 2^16 */
+        uint32_t m = (65536 + p - 1) / p * p;
+        if (!(m & 1))
+            m += p;
+        for (size_t j = (m - 65537) / 2; j < n; j += p)
+            A[j] = 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += A[i];
+    uint32_t *primes = snewn(count, uint32_t);
+    size_t pos = 0;
+    for (size_t i = 0; i < n; i++)
+        if (A[i])
+            primes[pos++] = 65537 + 2*i;
+    sfree(A);
+
+    nwideprimes = count;
+    wideprimes = primes;
+}
+
+static void pcs_ready_wide(PrimeCandidateSource *s)
+{
+    s->wide_ready = true;
+
+    /*
+     * As in pcs_ready, don't rule out any prime that the output might
+     * actually be equal to. In practice this only matters for primes
+     * too small to be worth generating in batches anyway.
+     */
+    if (!mp_hs_integer(s->addend, PCS_SIEVE_LIMIT))
+        return;
+
+    init_wideprimes();
+
+    size_t per_prime = s->try_sophie_germain ? 2 : 1;
+    s->wide_avoids = snewn(nwideprimes * per_prime, struct avoid);
+
+    size_t out = 0;
+    for (size_t i = 0; i < nwideprimes; i++) {
+        int64_t mod = wideprimes[i];
+        int64_t addend_m = mp_unsafe_mod_integer(s->addend, mod);
+        int64_t factor_m = mp_unsafe_mod_integer(s->factor, mod);
+
+        if (factor_m == 0)
+            continue;                  /* residue is fixed anyway */
+
+        int64_t finv = invert(factor_m, mod);
+        for (size_t k = 0; k < per_prime; k++) {
+            /* Avoid 0 mod the prime, and for a Sophie Germain prime,
+             * also -2^{-1} as explained in pcs_ready */
+            int64_t res = (k == 0 ? 0 : (mod - 1) / 2);
+            res = (res - addend_m) * finv;
+            res %= mod;
+            if (res < 0)
+                res += mod;
+
+            s->wide_avoids[out].mod = mod;
+            s->wide_avoids[out].res = res;
+            out++;
+        }
+    }
+
+    s->nwide_avoids = out;
+}
+
+static void sieve_run(unsigned char *dead, size_t width, mp_int *x0,
+                      const struct avoid *avoids, size_t navoids)
+{
+    int64_t x_res = 0, last_mod = 0;
+
+    for (size_t i = 0; i < navoids; i++) {
+        int64_t mod = avoids[i].mod, avoid_res = avoids[i].res;
+
+        if (mod != last_mod) {
+            last_mod = mod;
+            x_res = mp_unsafe_mod_integer(x0, mod);
+        }
+
+        /* The first offset j with x0+j == avoid_res (mod mod) */
+        size_t j = (avoid_res - x_res + mod) % mod;
+        for (; j < width; j += mod)
+            dead[j] = 1;
+    }
+}
+
+size_t pcs_generate_batch(PrimeCandidateSource *s, mp_int ***out)
+{
+    assert(s->ready);
+
+    /*
+     * A one-shot source only gets one candidate, and a source whose
+     * range isn't much bigger than a batch would have the ends of its
+     * range noticeably less likely to be picked. Either way, just
+     * hand out one candidate from pcs_generate.
+     */
+    if (s->one_shot || !mp_hs_integer(s->limit, PCS_BATCH_WIDTH * 64)) {
+        mp_int *p = pcs_generate(s);
+        if (!p) {
+            *out = NULL;
+            return 0;
+        }
+        *out = snew(mp_int *);
+        (*out)[0] = p;
+        return 1;
+    }
+
+    if (!s->wide_ready)
+        pcs_ready_wide(s);
+
+    /*
+     * Pick a random run of PCS_BATCH_WIDTH values x0, x0+1, ... all
+     * below our limit, and strike out every one that would make the
+     * output a multiple of a prime we're avoiding.
+     */
+    mp_int *range = mp_copy(s->limit);
+    mp_sub_integer_into(range, range, PCS_BATCH_WIDTH - 1);
+    mp_int *x0 = mp_random_upto(range);
+    mp_free(range);
+
+    unsigned char *dead = snewn(PCS_BATCH_WIDTH, unsigned char);
+    memset(dead, 0, PCS_BATCH_WIDTH);
+    sieve_run(dead, PCS_BATCH_WIDTH, x0, s->avoids, s->navoids);
+    sieve_run(dead, PCS_BATCH_WIDTH, x0, s->wide_avoids, s->nwide_avoids);
+
+    size_t n = 0;
+    uint32_t *offsets = snewn(PCS_BATCH_WIDTH, uint32_t);
+    for (size_t j = 0; j < PCS_BATCH_WIDTH; j++)
+        if (!dead[j])
+            offsets[n++] = j;
+    sfree(dead);
+
+    /*
+     * Shuffle the survivors. A caller taking the first prime in a run
+     * in increasing order would favour primes just after a long gap
+     * between primes; taking the first in a random order, each prime
+     * in the run is equally likely.
+     */
+    for (size_t i = n; i > 1; i--) {
+        unsigned char buf[8];
+        random_read(buf, 8);
+        size_t j = GET_64BIT_MSB_FIRST(buf) % i;
+        uint32_t tmp = offsets[i-1];
+        offsets[i-1] = offsets[j];
+        offsets[j] = tmp;
+    }
+
+    *out = snewn(n ? n : 1, mp_int *);
+    mp_int *x = mp_new(mp_max_bits(s->limit));
+    for (size_t i = 0; i < n; i++) {
+        mp_add_integer_into(x, x0, offsets[i]);
+        mp_int *toret = mp_new(s->bits);
+        mp_mul_into(toret, x, s->factor);
+        mp_add_into(toret, toret, s->addend);
+        (*out)[i] = toret;
+    }
+    mp_free(x);
+    mp_free(x0);
+    smemclr(offsets, PCS_BATCH_WIDTH * sizeof(*offsets));
+    sfree(offsets);
+
+    if (n == 0) {
+        /* Not impossible, if the run happened to fall between two
+         * primes that far apart, but we mustn't report running out */
+        sfree(*out);
+        return pcs_generate_batch(s, out);
+    }
+
+    return n;
+}
+
 void pcs_inspect(PrimeCandidateSource *pcs, mp_int **limit_out,
                  mp_int **factor_out, mp_int **addend_out)
 {
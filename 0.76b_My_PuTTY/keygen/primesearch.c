@@ -0,0 +1,343 @@
+/*
+ * primesearch.c: testing prime candidates on several threads at once,
+ * as declared in sshkeygen.h.
+ *
+ * Candidates come from pcs_generate_batch, and each call to
+ * primesearch_next runs a pass over the part of the batch nobody has
+ * looked at yet. Every thread takes the next candidate nobody has
+ * claimed, and when one passes, it lowers 'found' to its position in
+ * the batch. That's the cancellation flag: a thread that claims a
+ * candidate after 'found', or that's part way through testing one,
+ * stops, because the caller is going to get the one at 'found' (or
+ * an earlier one still being tested) whatever it turns out to be.
+ * Anything left untested is tested on a later pass if it's needed.
+ *
+ * Each candidate's Miller-Rabin witnesses are made by hashing a seed
+ * chosen when the search starts together with the candidate's index
+ * in the whole search, so whether it passes doesn't depend on which
+ * thread tests it or when.
+ */
+
+#include <assert.h>
+
+#include "putty.h"
+#include "ssh.h"
+#include "mpint.h"
+#include "sshkeygen.h"
+
+/* Most threads a search will start */
+#define PRIMESEARCH_MAXTHREADS 64
+
+/* Primes smaller than this are quick enough to find on one thread */
+#define PRIMESEARCH_MIN_BITS 512
+
+static unsigned primegen_threads = 1;
+static bool primegen_search_always = false;
+
+void primegen_set_threads(unsigned nthreads)
+{
+    if (nthreads == 0)
+        nthreads = ncpus();
+    if (nthreads > PRIMESEARCH_MAXTHREADS)
+        nthreads = PRIMESEARCH_MAXTHREADS;
+    primegen_threads = nthreads;
+}
+
+unsigned primegen_get_threads(void)
+{
+    return primegen_threads;
+}
+
+void primegen_set_search_always(bool always)
+{
+    primegen_search_always = always;
+}
+
+bool primesearch_wanted(PrimeCandidateSource *pcs)
+{
+    return (primegen_threads > 1 || primegen_search_always) &&
+        pcs_get_bits(pcs) >= PRIMESEARCH_MIN_BITS;
+}
+
+typedef enum { PS_UNTESTED, PS_PASSED, PS_FAILED } ps_state;
+
+struct ps_job {
+    mp_int *p, *witness;
+    ps_state state;
+};
+
+struct PrimeSearch {
+    PrimeCandidateSource *pcs;
+    unsigned nchecks;
+    bool want_witness;
+    unsigned char seed[32];
+
+    /* The current batch, and the index in the whole search of its
+     * first candidate */
+    struct ps_job *jobs;
+    size_t njobs, cursor;              /* cursor = next one to return */
+    uint64_t base;
+
+    int nthreads;                      /* counting the caller */
+    WorkerThread **threads;            /* [0] is the caller, so unused */
+    Semaphore *go, *done;
+    bool quit;
+
+    atomic_counter next;               /* next job nobody has taken */
+    atomic_counter busy;               /* threads woken and not finished */
+    atomic_counter found;              /* earliest job known to pass */
+};
+
+/*
+ * The random data for one candidate's witnesses: SHA-256 of the
+ * search's seed, the candidate's index and a counter, as many times
+ * as it takes.
+ */
+struct ps_random {
+    const unsigned char *seed;
+    uint64_t index;
+    uint32_t counter;
+    unsigned char buf[32];
+    size_t avail;
+};
+
+static void ps_random_read(void *ctx, void *vout, size_t len)
+{
+    struct ps_random *r = (struct ps_random *)ctx;
+    unsigned char *out = (unsigned char *)vout;
+
+    while (len > 0) {
+        if (!r->avail) {
+            ssh_hash *h = ssh_hash_new(&ssh_sha256);
+            put_data(h, r->seed, 32);
+            put_uint64(h, r->index);
+            put_uint32(h, r->counter);
+            ssh_hash_final(h, r->buf);
+            r->counter++;
+            r->avail = 32;
+        }
+        size_t n = len < r->avail ? len : r->avail;
+        memcpy(out, r->buf + 32 - r->avail, n);
+        r->avail -= n;
+        out += n;
+        len -= n;
+    }
+}
+
+static ps_state primesearch_test(PrimeSearch *ps, long i)
+{
+    struct ps_job *job = &ps->jobs[i];
+    struct ps_random r;
+    ps_state state = PS_PASSED;
+
+    r.seed = ps->seed;
+    r.index = ps->base + i;
+    r.counter = 0;
+    r.avail = 0;
+
+    MillerRabin *mr = miller_rabin_new(job->p);
+    if (ps->want_witness) {
+        job->witness = miller_rabin_find_potential_primitive_root_from(
+            mr, ps_random_read, &r);
+        if (!job->witness)
+            state = PS_FAILED;
+    } else {
+        for (unsigned check = 0; check < ps->nchecks; check++) {
+            if (check > 0 && i > atomic_counter_load(&ps->found)) {
+                /* Someone else found one first; leave this for later */
+                state = PS_UNTESTED;
+                break;
+            }
+            if (!miller_rabin_test_random_from(mr, ps_random_read, &r)) {
+                state = PS_FAILED;
+                break;
+            }
+        }
+    }
+    miller_rabin_free(mr);
+    smemclr(&r, sizeof(r));
+
+    return state;
+}
+
+static void primesearch_work(PrimeSearch *ps)
+{
+    long i;
+
+    while ((i = atomic_counter_inc(&ps->next)) < (long)ps->njobs) {
+        if (i > atomic_counter_load(&ps->found))
+            break;                     /* so is everything after it */
+        if (ps->jobs[i].state != PS_UNTESTED)
+            continue;                  /* done on an earlier pass */
+
+        ps_state state = primesearch_test(ps, i);
+        ps->jobs[i].state = state;
+
+        if (state == PS_PASSED) {
+            long found = atomic_counter_load(&ps->found);
+            while (i < found && !atomic_counter_cas(&ps->found, found, i))
+                found = atomic_counter_load(&ps->found);
+        }
+    }
+}
+
+static void primesearch_threadfunc(void *param)
+{
+    PrimeSearch *ps = (PrimeSearch *)param;
+
+    while (1) {
+        semaphore_wait(ps->go);
+        if (ps->quit)
+            break;
+        primesearch_work(ps);
+        if (atomic_counter_dec(&ps->busy) == 0)
+            semaphore_post(ps->done, 1);
+    }
+}
+
+PrimeSearch *primesearch_new(PrimeCandidateSource *pcs, unsigned nchecks,
+                             bool want_witness)
+{
+    PrimeSearch *ps = snew(PrimeSearch);
+    memset(ps, 0, sizeof(*ps));
+    ps->pcs = pcs;
+    ps->nchecks = nchecks;
+    ps->want_witness = want_witness;
+
+    /* Hashing the seed here also means SHA-256 has picked its
+     * implementation before any thread tries to */
+    unsigned char raw[32];
+    random_read(raw, sizeof(raw));
+    ssh_hash *h = ssh_hash_new(&ssh_sha256);
+    put_data(h, raw, sizeof(raw));
+    ssh_hash_final(h, ps->seed);
+    smemclr(raw, sizeof(raw));
+
+    ps->nthreads = 1;
+    ps->threads = snewn(primegen_threads, WorkerThread *);
+    ps->go = semaphore_new();
+    ps->done = semaphore_new();
+    if (ps->go && ps->done)
+        for (; ps->nthreads < primegen_threads; ps->nthreads++)
+            if (!(ps->threads[ps->nthreads] = worker_thread_start(
+                      primesearch_threadfunc, ps)))
+                break;                 /* make do with what we've got */
+
+    return ps;
+}
+
+static void primesearch_free_batch(PrimeSearch *ps)
+{
+    for (size_t i = 0; i < ps->njobs; i++) {
+        if (ps->jobs[i].p)
+            mp_free(ps->jobs[i].p);
+        if (ps->jobs[i].witness)
+            mp_free(ps->jobs[i].witness);
+    }
+    sfree(ps->jobs);
+    ps->base += ps->njobs;
+    ps->jobs = NULL;
+    ps->njobs = ps->cursor = 0;
+}
+
+static bool primesearch_new_batch(PrimeSearch *ps)
+{
+    mp_int **candidates;
+
+    primesearch_free_batch(ps);
+    size_t n = pcs_generate_batch(ps->pcs, &candidates);
+    if (!n) {
+        sfree(candidates);
+        return false;
+    }
+
+    ps->jobs = snewn(n, struct ps_job);
+    for (size_t i = 0; i < n; i++) {
+        ps->jobs[i].p = candidates[i];
+        ps->jobs[i].witness = NULL;
+        ps->jobs[i].state = PS_UNTESTED;
+    }
+    ps->njobs = n;
+    sfree(candidates);
+    return true;
+}
+
+static void primesearch_pass(PrimeSearch *ps)
+{
+    int nwake = ps->nthreads - 1;
+    if ((size_t)nwake > ps->njobs - ps->cursor - 1)
+        nwake = ps->njobs - ps->cursor - 1;
+
+    /* Start from the first candidate already known to pass, if any */
+    size_t found = ps->cursor;
+    while (found < ps->njobs && ps->jobs[found].state != PS_PASSED)
+        found++;
+
+    ps->next = ps->cursor;
+    ps->found = found;
+    ps->busy = nwake;
+    if (nwake > 0)
+        semaphore_post(ps->go, nwake);
+
+    primesearch_work(ps);
+
+    if (nwake > 0)
+        semaphore_wait(ps->done);
+}
+
+mp_int *primesearch_next(PrimeSearch *ps, ProgressReceiver *prog,
+                         mp_int **witness_out)
+{
+    while (true) {
+        if (ps->cursor == ps->njobs && !primesearch_new_batch(ps))
+            return NULL;
+
+        /*
+         * Hand out whatever has been decided already, in order. If we
+         * get to a candidate nobody has finished testing, test the
+         * rest of the batch and look again.
+         */
+        while (ps->cursor < ps->njobs) {
+            struct ps_job *job = &ps->jobs[ps->cursor];
+
+            if (job->state == PS_UNTESTED) {
+                primesearch_pass(ps);
+                assert(job->state != PS_UNTESTED);
+            }
+
+            ps->cursor++;
+            if (prog)
+                progress_report_attempt(prog);
+
+            if (job->state == PS_PASSED) {
+                mp_int *p = job->p;
+                job->p = NULL;
+                if (witness_out)
+                    *witness_out = job->witness;
+                else if (job->witness)
+                    mp_free(job->witness);
+                job->witness = NULL;
+                return p;
+            }
+        }
+    }
+}
+
+void primesearch_free(PrimeSearch *ps)
+{
+    ps->quit = true;
+    if (ps->nthreads > 1) {
+        semaphore_post(ps->go, ps->nthreads - 1);
+        for (int i = 1; i < ps->nthreads; i++)
+            worker_thread_join(ps->threads[i]);
+    }
+    if (ps->go)
+        semaphore_free(ps->go);
+    if (ps->done)
+        semaphore_free(ps->done);
+
+    primesearch_free_batch(ps);
+    sfree(ps->threads);
+    smemclr(ps, sizeof(*ps));
+    sfree(ps);
+}
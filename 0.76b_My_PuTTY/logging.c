@@ -14,14 +14,32 @@
 /* log session to file stuff ... */
 struct LogContext {
     FILE *lgfp;
+    LogWriter *writer;                 /* non-NULL if writing in background */
     enum { L_CLOSED, L_OPENING, L_OPEN, L_ERROR } state;
     bufchain queue;
     Filename *currlogfilename;
     LogPolicy *lp;
     Conf *conf;
     int logtype;		       /* cached out of conf */
+#ifdef MOD_PERSO
+    /* Timestamp prefix, reused while the second hasn't changed */
+    time_t tscache_time;
+    char tscache[128];
+    size_t tscache_len;
+#endif
 };
 
+/*
+ * Send data to the open log file, either directly or by way of the
+ * background writer. Returns false on a write error.
+ */
+static bool log_output(LogContext *ctx, const void *data, size_t len)
+{
+    if (ctx->writer)
+        return logwriter_write(ctx->writer, data, len);
+    return fwrite(data, 1, len, ctx->lgfp) == len;
+}
+
 static Filename *xlatlognam(Filename *s, char *hostname, int port,
                             struct tm *tm);
 
@@ -106,23 +124,29 @@ size_t t_strftime( char *s, size_t max, const char *format, const struct tm tm,
 
 int log_writetimestamp( struct LogContext *ctx ) {
 // "%m/%d/%Y %H:%M:%S "
-	if( strlen(conf_get_str(ctx->conf,CONF_logtimestamp) )==0 )  return 1 ;
+	const char *fmt = conf_get_str(ctx->conf,CONF_logtimestamp) ;
+	if( fmt[0]=='\0' )  return 1 ;
 	char buf[128] = "" ;
 
-	if( poss( "%f", conf_get_str(ctx->conf,CONF_logtimestamp) ) ) {
+	if( poss( "%f", fmt ) ) {
 		SYSTEMTIME sysTime ;
 		GetLocalTime( &sysTime ) ;
 		time_t temps = time( 0 ) ;
 		struct tm tm = * localtime( &temps ) ;
-		t_strftime( buf, 127, conf_get_str(ctx->conf,CONF_logtimestamp), tm, sysTime ) ;
+		t_strftime( buf, 127, fmt, tm, sysTime ) ;
+		log_output(ctx, buf, strlen(buf));
+		return 1;
 		}
-	else {
-		time_t temps = time( 0 ) ;
+
+	// Sans les millisecondes, le prefixe ne change qu'une fois par seconde
+	time_t temps = time( 0 ) ;
+	if( temps != ctx->tscache_time ) {
 		struct tm tm = * localtime( &temps ) ;
-		m_strftime( buf, 127, conf_get_str(ctx->conf,CONF_logtimestamp), &tm ) ;
+		m_strftime( ctx->tscache, sizeof(ctx->tscache)-1, fmt, &tm ) ;
+		ctx->tscache_len = strlen( ctx->tscache ) ;
+		ctx->tscache_time = temps ;
 		}
-	
-	fwrite(buf, 1, strlen(buf), ctx->lgfp);
+	log_output(ctx, ctx->tscache, ctx->tscache_len);
 	return 1;
 	}
 
@@ -168,7 +192,7 @@ static void logwrite(LogContext *ctx, ptrlen data)
 		if( c[0]=='\n' ) timestamp_newline = 1 ;
 	}
 #endif
-	if (fwrite(data.ptr, 1, data.len, ctx->lgfp) < data.len) {
+	if (!log_output(ctx, data.ptr, data.len)) {
 	    logfclose(ctx);
 	    ctx->state = L_ERROR;
             lp_eventlog(ctx->lp, "Disabled writing session log "
@@ -195,15 +219,60 @@ static PRINTF_LIKE(2, 3) void logprintf(LogContext *ctx, const char *fmt, ...)
 }
 
 /*
- * Flush any open log file.
+ * Flush any open log file. (A background writer flushes on its own
+ * schedule, which is the whole point of having one, so there's
+ * nothing to do here in that case.)
  */
 void logflush(LogContext *ctx)
 {
     if (ctx->logtype > 0)
-	if (ctx->state == L_OPEN)
+	if (ctx->state == L_OPEN && !ctx->writer)
 	    fflush(ctx->lgfp);
 }
 
+/*
+ * Start or stop the background writer to match the configuration.
+ */
+static void log_stop_writer(LogContext *ctx)
+{
+    uint64_t dropped;
+    size_t peak;
+
+    if (!ctx->writer)
+        return;
+
+    dropped = logwriter_dropped(ctx->writer);
+    peak = logwriter_peak(ctx->writer);
+    logwriter_free(ctx->writer);
+    ctx->writer = NULL;
+
+    if (dropped) {
+        char *event = dupprintf(
+            "Session log fell behind: %"PRIu64" bytes were discarded "
+            "(up to %"SIZEu" bytes were queued at once)", dropped, peak);
+        lp_eventlog(ctx->lp, event);
+        sfree(event);
+    }
+}
+
+static void log_start_writer(LogContext *ctx)
+{
+    size_t batch;
+
+    if (ctx->writer || ctx->state != L_OPEN ||
+        !conf_get_bool(ctx->conf, CONF_logasync))
+        return;
+
+    batch = (size_t)max(conf_get_int(ctx->conf, CONF_logasync_batch), 1)
+        * 1024;
+    ctx->writer = logwriter_new(
+        ctx->lgfp, max(batch * 16, (size_t)1 << 20), batch,
+        max(conf_get_int(ctx->conf, CONF_logasync_interval), 10));
+    if (!ctx->writer)
+        lp_eventlog(ctx->lp, "Unable to start background log writer; "
+                    "writing session log directly");
+}
+
 static void logfopen_callback(void *vctx, int mode)
 {
     LogContext *ctx = (LogContext *)vctx;
@@ -219,6 +288,7 @@ static void logfopen_callback(void *vctx, int mode)
 	ctx->lgfp = f_open(ctx->currlogfilename, fmode, false);
 	if (ctx->lgfp) {
 	    ctx->state = L_OPEN;
+            log_start_writer(ctx);
         } else {
 	    ctx->state = L_ERROR;
             shout = true;
@@ -321,6 +391,7 @@ void logfopen(LogContext *ctx)
 
 void logfclose(LogContext *ctx)
 {
+    log_stop_writer(ctx);
     if (ctx->lgfp) {
 	fclose(ctx->lgfp);
 	ctx->lgfp = NULL;
@@ -339,6 +410,20 @@ void logtraffic(LogContext *ctx, unsigned char c, int logmode)
     }
 }
 
+/*
+ * Log a run of traffic data at once, as if by calling logtraffic on
+ * each byte. The run must not contain a newline except as its last
+ * byte, so that the timestamping in logwrite still sees every one.
+ */
+void logtraffic_data(LogContext *ctx, const void *data, size_t len,
+                     int logmode)
+{
+    if (ctx->logtype > 0) {
+	if (ctx->logtype == logmode)
+	    logwrite(ctx, make_ptrlen(data, len));
+    }
+}
+
 static void logevent_internal(LogContext *ctx, const char *event)
 {
     if (ctx->logtype == LGTYP_PACKETS || ctx->logtype == LGTYP_SSHRAW) {
@@ -529,6 +614,10 @@ LogContext *log_init(LogPolicy *lp, Conf *conf)
 {
     LogContext *ctx = snew(LogContext);
     ctx->lgfp = NULL;
+    ctx->writer = NULL;
+#ifdef MOD_PERSO
+    ctx->tscache_time = (time_t)-1;
+#endif
     ctx->state = L_CLOSED;
     ctx->lp = lp;
     ctx->conf = conf_copy(conf);
@@ -562,14 +651,26 @@ void log_reconfig(LogContext *ctx, Conf *conf)
 
     if (reset_logging)
 	logfclose(ctx);
+    else if (conf_get_bool(ctx->conf, CONF_logasync) !=
+             conf_get_bool(conf, CONF_logasync) ||
+             conf_get_int(ctx->conf, CONF_logasync_interval) !=
+             conf_get_int(conf, CONF_logasync_interval) ||
+             conf_get_int(ctx->conf, CONF_logasync_batch) !=
+             conf_get_int(conf, CONF_logasync_batch))
+        log_stop_writer(ctx);          /* restarted below with new settings */
 
     conf_free(ctx->conf);
     ctx->conf = conf_copy(conf);
 
     ctx->logtype = conf_get_int(ctx->conf, CONF_logtype);
+#ifdef MOD_PERSO
+    ctx->tscache_time = (time_t)-1;
+#endif
 
     if (reset_logging)
 	logfopen(ctx);
+    else
+        log_start_writer(ctx);
 }
 
 /*
@@ -504,12 +504,68 @@ static void process_subneg(Telnet *telnet)
     }
 }
 
+/*
+ * Find how many bytes at the start of buf can go straight to the
+ * terminal: at top level, and out of urgent mode, that's everything
+ * up to the next IAC, or the next CR if the server isn't sending in
+ * binary mode (because we have to drop a NUL after it).
+ *
+ * *next_iac caches where the next IAC is (or buf+len if there isn't
+ * one), so that a buffer full of lines ending in CR doesn't get
+ * searched for IAC all over again from every line.
+ */
+static size_t telnet_plain_span(Telnet *telnet, const char *buf, size_t len,
+                                const char **next_iac)
+{
+    const char *end;
+
+    if (*next_iac < buf) {
+        /* We've gone past the last one we found */
+        *next_iac = memchr(buf, IAC, len);
+        if (!*next_iac)
+            *next_iac = buf + len;
+    }
+    end = *next_iac;
+
+    if (telnet->opt_states[o_they_bin.index] != ACTIVE) {
+        const char *cr = memchr(buf, CR, end - buf);
+        if (cr)
+            end = cr;
+    }
+
+    return end - buf;
+}
+
 static void do_telnet_read(Telnet *telnet, const char *buf, size_t len)
 {
     strbuf *outbuf = strbuf_new_nm();
+    const char *next_iac = memchr(buf, IAC, len);
+
+    if (!next_iac)
+        next_iac = buf + len;
+
+    while (len > 0) {
+        /*
+         * Ordinary data doesn't need to go through the state machine
+         * a byte at a time: pass on as much as we can in one go, and
+         * only come back to the state machine for a special byte.
+         */
+        if (telnet->state == TOP_LEVEL && !telnet->in_synch) {
+            size_t n = telnet_plain_span(telnet, buf, len, &next_iac);
+            if (n) {
+                put_data(outbuf, buf, n);
+                buf += n;
+                len -= n;
+                if (outbuf->len >= 4096) {
+                    c_write(telnet, outbuf->u, outbuf->len);
+                    strbuf_clear(outbuf);
+                }
+                continue;
+            }
+        }
 
-    while (len--) {
         int c = (unsigned char) *buf++;
+        len--;
 
         switch (telnet->state) {
           case TOP_LEVEL:
@@ -223,6 +223,11 @@ static void ssh_scp_init(void)
     else
 	using_sftp = fallback_cmd_is_sftp;
 
+    if (using_sftp)
+        xfer_set_pipeline(conf_get_bool(conf, CONF_sftp_autotune),
+                          conf_get_int(conf, CONF_sftp_window),
+                          conf_get_int(conf, CONF_sftp_blocksize));
+
     if (verbose) {
 	if (using_sftp)
 	    tell_user(stderr, "Using SFTP");
@@ -715,6 +720,15 @@ static struct fxp_handle *scp_sftp_filehandle;
 static struct fxp_xfer *scp_sftp_xfer;
 static uint64_t scp_sftp_fileoffset;
 
+static void scp_sftp_pipeline_summary(void)
+{
+    if (verbose || conf_get_bool(conf, CONF_sftp_autotune)) {
+        char *summary = xfer_pipeline_summary(scp_sftp_xfer);
+        tell_user(stderr, "%s", summary);
+        sfree(summary);
+    }
+}
+
 int scp_source_setup(const char *target, bool shouldbedir)
 {
     if (using_sftp) {
@@ -901,6 +915,7 @@ int scp_send_finish(void)
 		return 1;
 	    }
 	}
+	scp_sftp_pipeline_summary();
 	xfer_cleanup(scp_sftp_xfer);
 
 	if (!scp_sftp_filehandle) {
@@ -1562,6 +1577,7 @@ int scp_finish_filerecv(void)
 	    if (xfer_download_data(scp_sftp_xfer, &vbuf, &len))
 		sfree(vbuf);
 	}
+	scp_sftp_pipeline_summary();
 	xfer_cleanup(scp_sftp_xfer);
 
 	req = fxp_close_send(scp_sftp_filehandle);
@@ -1608,6 +1624,8 @@ static void source(const char *src)
     uint64_t i;
     uint64_t stat_bytes;
     time_t stat_starttime, stat_lasttime;
+    char *transbuf;
+    int blocksize;
 
     attr = file_type(src);
     if (attr == FILE_TYPE_NONEXISTENT ||
@@ -1674,9 +1692,10 @@ static void source(const char *src)
     stat_lasttime = 0;
 
 #define PSCP_SEND_BLOCK 4096
-    for (i = 0; i < size; i += PSCP_SEND_BLOCK) {
-	char transbuf[PSCP_SEND_BLOCK];
-	int j, k = PSCP_SEND_BLOCK;
+    blocksize = using_sftp ? xfer_upload_blocksize() : PSCP_SEND_BLOCK;
+    transbuf = snewn(blocksize, char);
+    for (i = 0; i < size; i += blocksize) {
+	int j, k = blocksize;
 
 	if (i + k > size)
 	    k = size - i;
@@ -1696,6 +1715,7 @@ static void source(const char *src)
 	}
 
     }
+    sfree(transbuf);
     close_rfile(f);
 
     (void) scp_send_finish();
@@ -1763,6 +1783,8 @@ static void sink(const char *targ, const char *src)
     uint64_t stat_bytes;
     time_t stat_starttime, stat_lasttime;
     char *stat_name;
+    char *transbuf;
+    int bufsize;
 
     attr = file_type(targ);
     if (attr == FILE_TYPE_DIRECTORY)
@@ -1916,12 +1938,20 @@ static void sink(const char *targ, const char *src)
         stat_name = stripctrl_string(
             string_scc, stripslashes(destfname, true));
 
+	/*
+	 * In SFTP mode, scp_recv_filedata hands back whole read
+	 * replies, so the buffer has to be big enough for those.
+	 */
+	bufsize = 32768;
+	if (using_sftp)
+	    bufsize = max(bufsize, xfer_max_blocksize());
+	transbuf = snewn(bufsize, char);
+
 	received = 0;
 	while (received < act.size) {
-	    char transbuf[32768];
 	    uint64_t blksize;
 	    int read;
-	    blksize = 32768;
+	    blksize = bufsize;
 	    if (blksize > act.size - received)
                 blksize = act.size - received;
 	    read = scp_recv_filedata(transbuf, (int)blksize);
@@ -1952,6 +1982,7 @@ static void sink(const char *targ, const char *src)
 	    }
 	    received += read;
 	}
+	sfree(transbuf);
 	if (act.settime) {
 	    set_file_times(f, act.mtime, act.atime);
 	}
@@ -2215,6 +2246,8 @@ static void usage(void)
     printf("  -1 -2     force use of particular SSH protocol version\n");
     printf("  -4 -6     force use of IPv4 or IPv6\n");
     printf("  -C        enable compression\n");
+    printf("  -pipeline auto | [auto,]window[,block]\n");
+    printf("            adapt, or set limits on, SFTP request pipelining\n");
     printf("  -i key    private key file for user authentication\n");
     printf("  -noagent  disable use of Pageant\n");
     printf("  -agent    enable use of Pageant\n");
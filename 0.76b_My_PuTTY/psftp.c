@@ -242,6 +242,584 @@ static void not_connected(void)
 /* ----------------------------------------------------------------------
  * The meat of the `get' and `put' commands.
  */
+static bool verbose = false;
+
+static void print_pipeline_summary(struct fxp_xfer *xfer)
+{
+    if (verbose || conf_get_bool(conf, CONF_sftp_autotune)) {
+        char *summary = xfer_pipeline_summary(xfer);
+        printf("%s\n", summary);
+        sfree(summary);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Concurrent transfers.
+ *
+ * If the user has asked for more than one file (or stream) in flight
+ * at once, sftp_get_file and sftp_put_file don't transfer each plain
+ * file as they come to it. Instead they add it to the current batch,
+ * which the get and put commands run once they've finished working
+ * through their arguments. The batch keeps up to `parallel_files'
+ * files open at a time, each with its own fxp_xfer - or several, for
+ * a download large enough to split into `parallel_streams' byte
+ * ranges - all sharing the one SFTP channel. Replies are matched to
+ * their owners by request: open, stat and close requests against the
+ * job that sent them, and anything else via xfer_from_request.
+ */
+static int parallel_files = 1, parallel_streams = 1;
+
+/*
+ * Parse the argument to -parallel, "FILES" or "FILES,STREAMS", each
+ * a positive decimal number.
+ */
+static bool parse_parallel(const char *arg, int *files, int *streams)
+{
+    int *fields[2] = { files, streams };
+    const char *p = arg;
+    size_t i;
+
+    *streams = 1;
+    for (i = 0; i < lenof(fields); i++) {
+        unsigned long n;
+        char *end;
+
+        if (*p < '0' || *p > '9')
+            return false;
+        n = strtoul(p, &end, 10);
+        if (n < 1 || n > INT_MAX)
+            return false;
+        *fields[i] = n;
+        p = end;
+        if (*p != ',')
+            break;
+        p++;
+    }
+    return *p == '\0';
+}
+
+/* Don't split a download into streams smaller than this. */
+#define MIN_STREAM_SIZE ((uint64_t)4 << 20)
+
+typedef struct XferBatch XferBatch;
+typedef struct XferJob XferJob;
+typedef struct XferStream XferStream;
+
+struct XferStream {
+    XferJob *job;
+    struct fxp_xfer *xfer;
+    uint64_t pos;                      /* local file position of next data */
+    bool eof;                          /* upload only: local file all read */
+};
+
+struct XferJob {
+    bool upload;
+    char *fname, *outfname;
+    struct sftp_request *statreq, *openreq, *closereq;
+    struct fxp_attrs attrs;
+    struct fxp_handle *fh;
+    WFile *wfile;
+    RFile *rfile;
+    XferStream *streams;
+    size_t nstreams;
+    bool running, err;
+    XferJob *next;
+};
+
+struct XferBatch {
+    XferJob *head, *tail, *next_to_start;
+    XferJob **active;
+    size_t nactive, njobs, nfinished;
+    uint64_t total, done;
+    unsigned long start, last_update;
+    bool progress_shown, ok;
+    char *buffer;
+    int buflen;
+};
+
+static XferBatch *xfer_batch = NULL;
+
+static XferBatch *xfer_batch_new(void)
+{
+    XferBatch *b = snew(XferBatch);
+    memset(b, 0, sizeof(*b));
+    b->active = snewn(parallel_files, XferJob *);
+    b->ok = true;
+    return b;
+}
+
+static void xfer_batch_add(XferBatch *b, bool upload,
+                           const char *fname, const char *outfname)
+{
+    XferJob *job = snew(XferJob);
+    memset(job, 0, sizeof(*job));
+    job->upload = upload;
+    job->fname = dupstr(fname);
+    job->outfname = dupstr(outfname);
+
+    if (b->tail)
+        b->tail->next = job;
+    else
+        b->head = job;
+    b->tail = job;
+    if (!b->next_to_start)
+        b->next_to_start = job;
+    b->njobs++;
+}
+
+static void xfer_batch_free(XferBatch *b)
+{
+    while (b->head) {
+        XferJob *job = b->head;
+        b->head = job->next;
+        sfree(job->fname);
+        sfree(job->outfname);
+        sfree(job);
+    }
+    sfree(b->active);
+    sfree(b->buffer);
+    sfree(b);
+}
+
+/*
+ * The progress line is redrawn in place, so it has to be wiped before
+ * anything else is printed.
+ */
+static void xfer_batch_clear_progress(XferBatch *b)
+{
+    if (b->progress_shown) {
+        printf("\r%79s\r", "");
+        b->progress_shown = false;
+    }
+}
+
+static void xfer_batch_progress(XferBatch *b, bool final)
+{
+    unsigned long now = GETTICKCOUNT(), elapsed = now - b->start;
+    uint64_t rate;
+
+    if (!final && now - b->last_update < TICKSPERSEC)
+        return;
+    b->last_update = now;
+
+    rate = elapsed ? b->done * TICKSPERSEC / elapsed : 0;
+    printf("\r%d/%d files, %"PRIu64" of %"PRIu64" kB, %"PRIu64" kB/s",
+           (int)b->nfinished, (int)b->njobs,
+           b->done / 1024, b->total / 1024, rate / 1024);
+    if (final) {
+        printf("\n");
+        b->progress_shown = false;
+    } else {
+        b->progress_shown = true;
+    }
+    fflush(stdout);
+}
+
+static void xfer_job_fail(XferJob *job)
+{
+    job->err = true;
+    for (size_t i = 0; i < job->nstreams; i++)
+        xfer_set_error(job->streams[i].xfer);
+}
+
+/*
+ * Tidy up a job that's got as far as it's going to. If it has a remote
+ * handle, that has to be closed first, and we come back here when the
+ * reply arrives.
+ */
+static void xfer_job_finish(XferBatch *b, XferJob *job)
+{
+    if (job->nstreams) {
+        print_pipeline_summary(job->streams[0].xfer);
+        for (size_t i = 0; i < job->nstreams; i++)
+            xfer_cleanup(job->streams[i].xfer);
+        sfree(job->streams);
+        job->nstreams = 0;
+    }
+    job->running = false;
+    if (job->wfile) {
+        close_wfile(job->wfile);
+        job->wfile = NULL;
+    }
+    if (job->rfile) {
+        close_rfile(job->rfile);
+        job->rfile = NULL;
+    }
+
+    if (job->fh) {
+        sftp_register(job->closereq = fxp_close_send(job->fh));
+        job->fh = NULL;
+        return;
+    }
+
+    if (job->err)
+        b->ok = false;
+    b->nfinished++;
+    for (size_t i = 0; i < b->nactive; i++) {
+        if (b->active[i] == job) {
+            b->active[i] = b->active[--b->nactive];
+            break;
+        }
+    }
+}
+
+static void xfer_job_start(XferBatch *b, XferJob *job)
+{
+    b->active[b->nactive++] = job;
+
+    if (job->upload) {
+        struct fxp_attrs attrs;
+        uint64_t size;
+        long permissions;
+
+        job->rfile = open_existing_file(job->fname, &size, NULL, NULL,
+                                        &permissions);
+        if (!job->rfile) {
+            xfer_batch_clear_progress(b);
+            printf("local: unable to open %s\n", job->fname);
+            job->err = true;
+            xfer_job_finish(b, job);
+            return;
+        }
+        b->total += size;
+        attrs.flags = 0;
+        PUT_PERMISSIONS(attrs, permissions);
+        sftp_register(job->openreq = fxp_open_send(
+                          job->outfname,
+                          SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC,
+                          &attrs));
+    } else {
+        sftp_register(job->statreq = fxp_stat_send(job->fname));
+        sftp_register(job->openreq = fxp_open_send(
+                          job->fname, SSH_FXF_READ, NULL));
+    }
+}
+
+/*
+ * Called once the remote file is open (and, for a download, we know
+ * its attributes), to open the local end and set the data moving.
+ */
+static void xfer_job_run(XferBatch *b, XferJob *job)
+{
+    xfer_batch_clear_progress(b);
+
+    if (job->upload) {
+        printf("local:%s => remote:%s\n", job->fname, job->outfname);
+        job->nstreams = 1;
+        job->streams = snew(XferStream);
+        job->streams[0].job = job;
+        job->streams[0].pos = 0;
+        job->streams[0].eof = false;
+        job->streams[0].xfer = xfer_upload_init(job->fh, 0);
+    } else {
+        uint64_t size = UINT64_MAX, chunk;
+
+        job->wfile = open_new_file(job->outfname,
+                                   GET_PERMISSIONS(job->attrs, -1));
+        if (!job->wfile) {
+            with_stripctrl(san, job->outfname)
+                printf("local: unable to open %s\n", san);
+            job->err = true;
+            xfer_job_finish(b, job);
+            return;
+        }
+
+        with_stripctrl(san, job->fname) {
+            with_stripctrl(sano, job->outfname)
+                printf("remote:%s => local:%s\n", san, sano);
+        }
+
+        /*
+         * If we know the file size, the file is big enough and the
+         * user wants it, split the file into ranges to be read
+         * concurrently. The last stream reads to EOF, whatever the
+         * file size turns out to be by the time it gets there.
+         */
+        job->nstreams = 1;
+        if (job->attrs.flags & SSH_FILEXFER_ATTR_SIZE) {
+            size = job->attrs.size;
+            b->total += size;
+            if (parallel_streams > 1 && size >= 2 * MIN_STREAM_SIZE)
+                job->nstreams = min((uint64_t)parallel_streams,
+                                    size / MIN_STREAM_SIZE);
+        }
+        chunk = job->nstreams > 1 ? size / job->nstreams : 0;
+
+        job->streams = snewn(job->nstreams, XferStream);
+        for (size_t i = 0; i < job->nstreams; i++) {
+            XferStream *st = &job->streams[i];
+            st->job = job;
+            st->pos = i * chunk;
+            st->eof = false;
+            st->xfer = xfer_download_init_range(
+                job->fh, st->pos,
+                i + 1 < job->nstreams ? (i + 1) * chunk : UINT64_MAX);
+        }
+    }
+
+    job->running = true;
+}
+
+static void xfer_job_check_done(XferBatch *b, XferJob *job)
+{
+    if (!job->running)
+        return;
+    for (size_t i = 0; i < job->nstreams; i++) {
+        XferStream *st = &job->streams[i];
+        if (job->upload && !st->eof && !job->err)
+            return;
+        if (!xfer_done(st->xfer))
+            return;
+    }
+    xfer_job_finish(b, job);
+}
+
+static void xfer_job_gotreply(XferBatch *b, XferJob *job,
+                              struct sftp_request *rreq,
+                              struct sftp_packet *pktin)
+{
+    if (rreq == job->statreq) {
+        job->statreq = NULL;
+        if (!fxp_stat_recv(pktin, rreq, &job->attrs))
+            job->attrs.flags = 0;
+    } else if (rreq == job->openreq) {
+        job->openreq = NULL;
+        job->fh = fxp_open_recv(pktin, rreq);
+        if (!job->fh) {
+            xfer_batch_clear_progress(b);
+            if (job->upload) {
+                printf("%s: open for write: %s\n",
+                       job->outfname, fxp_error());
+            } else {
+                with_stripctrl(san, job->fname)
+                    printf("%s: open for read: %s\n", san, fxp_error());
+            }
+            job->err = true;
+        }
+    } else {
+        assert(rreq == job->closereq);
+        job->closereq = NULL;
+        if (!fxp_close_recv(pktin, rreq) && job->upload && !job->err) {
+            xfer_batch_clear_progress(b);
+            printf("error while closing: %s\n", fxp_error());
+            job->err = true;
+        }
+        xfer_job_finish(b, job);
+        return;
+    }
+
+    if (job->statreq || job->openreq)
+        return;                        /* still waiting for the other */
+    if (job->err)
+        xfer_job_finish(b, job);
+    else
+        xfer_job_run(b, job);
+}
+
+static void xfer_stream_gotreply(XferBatch *b, XferStream *st,
+                                 struct sftp_request *rreq,
+                                 struct sftp_packet *pktin)
+{
+    XferJob *job = st->job;
+    int ret;
+
+    if (job->upload) {
+        ret = xfer_upload_gotreply(st->xfer, rreq, pktin);
+        if (ret <= 0) {
+            if (ret == INT_MIN)        /* pktin not even freed */
+                sfree(pktin);
+            if (!job->err) {
+                xfer_batch_clear_progress(b);
+                printf("error while writing: %s\n", fxp_error());
+                xfer_job_fail(job);
+            }
+        }
+    } else {
+        void *vbuf;
+        int len;
+
+        ret = xfer_download_gotreply(st->xfer, rreq, pktin);
+        if (ret <= 0) {
+            if (ret == INT_MIN)        /* pktin not even freed */
+                sfree(pktin);
+            if (!job->err) {
+                xfer_batch_clear_progress(b);
+                printf("error while reading: %s\n", fxp_error());
+                xfer_job_fail(job);
+            }
+        }
+
+        while (xfer_download_data(st->xfer, &vbuf, &len)) {
+            unsigned char *buf = (unsigned char *)vbuf;
+            int wpos = 0, wlen;
+
+            if (job->nstreams > 1 && !job->err &&
+                seek_file(job->wfile, st->pos, FROM_START) != 0)
+                wpos = -1;
+            while (wpos >= 0 && wpos < len && !job->err) {
+                wlen = write_to_file(job->wfile, buf + wpos, len - wpos);
+                if (wlen <= 0)
+                    wpos = -1;
+                else
+                    wpos += wlen;
+            }
+            if (wpos < 0 && !job->err) {
+                xfer_batch_clear_progress(b);
+                printf("error while writing local file\n");
+                xfer_job_fail(job);
+            }
+            st->pos += len;
+            b->done += len;
+            sfree(vbuf);
+        }
+
+        if (!job->err)
+            xfer_download_queue(st->xfer);
+    }
+
+    xfer_job_check_done(b, job);
+}
+
+/*
+ * Feed upload data into the channel for as long as it will take it,
+ * a block from each file in turn so that none of them starves.
+ */
+static void xfer_batch_pump_uploads(XferBatch *b)
+{
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+        for (size_t i = 0; i < b->nactive; i++) {
+            XferJob *job = b->active[i];
+            XferStream *st;
+            int len;
+
+            if (!job->upload || !job->running || job->err)
+                continue;
+            st = &job->streams[0];
+            if (st->eof)
+                continue;
+            if (!xfer_upload_ready(st->xfer))
+                return;
+
+            if (!b->buffer) {
+                b->buflen = xfer_upload_blocksize();
+                b->buffer = snewn(b->buflen, char);
+            }
+            len = read_from_file(job->rfile, b->buffer, b->buflen);
+            if (len == -1) {
+                xfer_batch_clear_progress(b);
+                printf("error while reading local file\n");
+                xfer_job_fail(job);
+            } else if (len == 0) {
+                st->eof = true;
+            } else {
+                xfer_upload_data(st->xfer, b->buffer, len);
+                st->pos += len;
+                b->done += len;
+            }
+            xfer_job_check_done(b, job);
+            progress = true;
+        }
+    }
+}
+
+static bool xfer_batch_waiting(XferBatch *b)
+{
+    for (size_t i = 0; i < b->nactive; i++) {
+        XferJob *job = b->active[i];
+        if (job->statreq || job->openreq || job->closereq)
+            return true;
+        for (size_t j = 0; j < job->nstreams; j++)
+            if (!xfer_done(job->streams[j].xfer))
+                return true;
+    }
+    return false;
+}
+
+static bool xfer_batch_run(XferBatch *b)
+{
+    b->start = b->last_update = GETTICKCOUNT();
+
+    while (b->nfinished < b->njobs) {
+        struct sftp_packet *pktin;
+        struct sftp_request *rreq;
+        struct fxp_xfer *xfer;
+        bool found = false;
+
+        while (b->nactive < parallel_files && b->next_to_start) {
+            XferJob *job = b->next_to_start;
+            b->next_to_start = job->next;
+            xfer_job_start(b, job);
+        }
+
+        xfer_batch_pump_uploads(b);
+        if (b->nfinished == b->njobs)
+            break;
+
+        if (toplevel_callback_pending()) {
+            /* As in sftp_put_file, these might free up upload space. */
+            run_toplevel_callbacks();
+            continue;
+        }
+
+        if (!xfer_batch_waiting(b)) {
+            /* Nothing to wait for except room in the send buffer. */
+            if (ssh_sftp_loop_iteration() < 0) {
+                xfer_batch_clear_progress(b);
+                printf("psftp: connection lost during transfer\n");
+                return false;
+            }
+            continue;
+        }
+
+        pktin = sftp_recv();
+        if (pktin == NULL) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet "
+                "from server");
+        }
+        rreq = sftp_find_request(pktin);
+        if (!rreq) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
+
+        xfer = xfer_from_request(rreq);
+        for (size_t i = 0; i < b->nactive && !found; i++) {
+            XferJob *job = b->active[i];
+            if (xfer) {
+                for (size_t j = 0; j < job->nstreams; j++) {
+                    if (job->streams[j].xfer == xfer) {
+                        xfer_stream_gotreply(b, &job->streams[j],
+                                             rreq, pktin);
+                        found = true;
+                        break;
+                    }
+                }
+            } else if (rreq == job->statreq || rreq == job->openreq ||
+                       rreq == job->closereq) {
+                xfer_job_gotreply(b, job, rreq, pktin);
+                found = true;
+            }
+        }
+        if (!found) {
+            seat_connection_fatal(
+                psftp_seat, "unable to understand SFTP response packet "
+                "from server: request ID is not part of the current "
+                "transfers");
+        }
+
+        xfer_batch_progress(b, false);
+    }
+
+    xfer_batch_progress(b, true);
+    return b->ok;
+}
+
 bool sftp_get_file(char *fname, char *outfname, bool recurse, bool restart)
 {
     struct fxp_handle *fh;
@@ -420,6 +998,11 @@ bool sftp_get_file(char *fname, char *outfname, bool recurse, bool restart)
 	}
     }
 
+    if (xfer_batch && !restart) {
+        xfer_batch_add(xfer_batch, false, fname, outfname);
+        return true;
+    }
+
     req = fxp_stat_send(fname);
     pktin = sftp_wait_for_reply(req);
     if (!fxp_stat_recv(pktin, req, &attrs))
@@ -522,6 +1105,7 @@ bool sftp_get_file(char *fname, char *outfname, bool recurse, bool restart)
 	}
     }
 
+    print_pipeline_summary(xfer);
     xfer_cleanup(xfer);
 
     close_wfile(file);
@@ -544,6 +1128,8 @@ bool sftp_put_file(char *fname, char *outfname, bool recurse, bool restart)
     bool err = false, eof;
     struct fxp_attrs attrs;
     long permissions;
+    char *buffer;
+    int buflen;
 
     /*
      * In recursive mode, see if we're dealing with a directory.
@@ -666,6 +1252,11 @@ bool sftp_put_file(char *fname, char *outfname, bool recurse, bool restart)
 	return true;
     }
 
+    if (xfer_batch && !restart) {
+        xfer_batch_add(xfer_batch, true, fname, outfname);
+        return true;
+    }
+
     file = open_existing_file(fname, NULL, NULL, NULL, &permissions);
     if (!file) {
 	printf("local: unable to open %s\n", fname);
@@ -723,13 +1314,14 @@ bool sftp_put_file(char *fname, char *outfname, bool recurse, bool restart)
      * thus put up a progress bar.
      */
     xfer = xfer_upload_init(fh, offset);
+    buflen = xfer_upload_blocksize();
+    buffer = snewn(buflen, char);
     eof = false;
     while ((!err && !eof) || !xfer_done(xfer)) {
-	char buffer[4096];
 	int len, ret;
 
 	while (xfer_upload_ready(xfer) && !err && !eof) {
-	    len = read_from_file(file, buffer, sizeof(buffer));
+	    len = read_from_file(file, buffer, buflen);
 	    if (len == -1) {
 		printf("error while reading local file\n");
 		err = true;
@@ -764,7 +1356,9 @@ bool sftp_put_file(char *fname, char *outfname, bool recurse, bool restart)
 	}
     }
 
+    print_pipeline_summary(xfer);
     xfer_cleanup(xfer);
+    sfree(buffer);
 
   cleanup:
     req = fxp_close_send(fh);
@@ -1252,6 +1846,9 @@ int sftp_general_get(struct sftp_command *cmd, bool restart, bool multiple)
 	return 0;
     }
 
+    if (!restart && (parallel_files > 1 || parallel_streams > 1))
+        xfer_batch = xfer_batch_new();
+
     toret = 1;
     do {
 	SftpWildcardMatcher *swcm;
@@ -1301,10 +1898,17 @@ int sftp_general_get(struct sftp_command *cmd, bool restart, bool multiple)
 	if (swcm)
 	    sftp_finish_wildcard_matching(swcm);
 	if (!toret)
-	    return toret;
+	    break;
 
     } while (multiple && i < cmd->nwords);
 
+    if (xfer_batch) {
+        if (!xfer_batch_run(xfer_batch))
+            toret = 0;
+        xfer_batch_free(xfer_batch);
+        xfer_batch = NULL;
+    }
+
     return toret;
 }
 int sftp_cmd_get(struct sftp_command *cmd)
@@ -1361,6 +1965,9 @@ int sftp_general_put(struct sftp_command *cmd, bool restart, bool multiple)
 	return 0;
     }
 
+    if (!restart && (parallel_files > 1 || parallel_streams > 1))
+        xfer_batch = xfer_batch_new();
+
     toret = 1;
     do {
 	WildcardMatcher *wcm;
@@ -1402,10 +2009,17 @@ int sftp_general_put(struct sftp_command *cmd, bool restart, bool multiple)
 	    finish_wildcard_matching(wcm);
 
 	if (!toret)
-	    return toret;
+	    break;
 
     } while (multiple && i < cmd->nwords);
 
+    if (xfer_batch) {
+        if (!xfer_batch_run(xfer_batch))
+            toret = 0;
+        xfer_batch_free(xfer_batch);
+        xfer_batch = NULL;
+    }
+
     return toret;
 }
 int sftp_cmd_put(struct sftp_command *cmd)
@@ -2454,7 +3068,6 @@ int do_sftp(int mode, int modeflags, char *batchfile)
  * Dirty bits: integration with PuTTY.
  */
 
-static bool verbose = false;
 
 void ldisc_echoedit_update(Ldisc *ldisc) { }
 
@@ -2548,6 +3161,10 @@ static void usage(void)
     printf("            force use of particular SSH protocol variant\n");
     printf("  -4 -6     force use of IPv4 or IPv6\n");
     printf("  -C        enable compression\n");
+    printf("  -pipeline auto | [auto,]window[,block]\n");
+    printf("            adapt, or set limits on, SFTP request pipelining\n");
+    printf("  -parallel files[,streams]\n");
+    printf("            transfer several files, or parts of a file, at once\n");
     printf("  -i key    private key file for user authentication\n");
     printf("  -noagent  disable use of Pageant\n");
     printf("  -agent    enable use of Pageant\n");
@@ -2769,6 +3386,9 @@ static int psftp_connect(char *userhost, char *user, int portnumber)
 	    return 1;
 	}
     }
+    xfer_set_pipeline(conf_get_bool(conf, CONF_sftp_autotune),
+                      conf_get_int(conf, CONF_sftp_window),
+                      conf_get_int(conf, CONF_sftp_blocksize));
     if (verbose && realhost != NULL)
 	printf("Connected to %s\n", realhost);
     if (realhost != NULL)
@@ -2853,6 +3473,11 @@ int psftp_main(int argc, char *argv[])
 	    modeflags = modeflags | 1;
 	} else if (strcmp(argv[i], "-be") == 0) {
 	    modeflags = modeflags | 2;
+	} else if (strcmp(argv[i], "-parallel") == 0 && i + 1 < argc) {
+            if (!parse_parallel(argv[++i], &parallel_files,
+                                &parallel_streams))
+                cmdline_error("'%s' is not a valid number of files or "
+                              "streams", argv[i]);
         } else if (strcmp(argv[i], "-sanitise-stderr") == 0) {
             sanitise_stderr = true;
         } else if (strcmp(argv[i], "-no-sanitise-stderr") == 0) {
@@ -1573,6 +1573,7 @@ NORETURN void cleanup_exit(int);
     X(STR, NONE, remote_cmd2) /* fallback if remote_cmd fails; never loaded or saved */ \
     X(BOOL, NONE, nopty) \
     X(BOOL, NONE, compression) \
+    X(INT, NONE, compression_level) /* 1 (fastest) to 9 (best) */ \
     X(INT, INT, ssh_kexlist) \
     X(INT, INT, ssh_hklist) \
     X(BOOL, NONE, ssh_prefer_known_hostkeys) \
@@ -1598,6 +1599,17 @@ NORETURN void cleanup_exit(int);
      */ \
     X(INT, NONE, sshprot) \
     X(BOOL, NONE, ssh2_des_cbc) /* "des-cbc" unrecommended SSH-2 cipher */ \
+    X(INT, NONE, ssh_crypto_threads) /* threads for SSH-2 bulk crypto */ \
+    /* SSH-2 channel windows in KB and max packet sizes in bytes, by \
+     * channel type; 0 means the built-in default */ \
+    X(INT, NONE, ssh_win_session) \
+    X(INT, NONE, ssh_win_portfwd) \
+    X(INT, NONE, ssh_win_x11) \
+    X(INT, NONE, ssh_maxpkt_session) \
+    X(INT, NONE, ssh_maxpkt_portfwd) \
+    X(INT, NONE, ssh_maxpkt_x11) \
+    X(BOOL, NONE, ssh_win_autotune) /* grow windows to fit the link */ \
+    X(INT, NONE, ssh_win_budget) /* KB all auto-tuned windows may add */ \
     X(BOOL, NONE, ssh_no_userauth) /* bypass "ssh-userauth" (SSH-2 only) */ \
     X(BOOL, NONE, ssh_no_trivial_userauth) /* disable trivial types of auth */ \
     X(BOOL, NONE, ssh_show_banner) /* show USERAUTH_BANNERs (SSH-2 only) */ \
@@ -1678,6 +1690,7 @@ NORETURN void cleanup_exit(int);
     X(STR, NONE, wintitle) /* initial window title */ \
     /* Terminal options */ \
     X(INT, NONE, savelines) \
+    X(INT, NONE, scrollback_memory) /* KB kept in memory; 0 = no limit */ \
     X(BOOL, NONE, dec_om) \
     X(BOOL, NONE, wrap_mode) \
     X(BOOL, NONE, lfhascr) \
@@ -1704,6 +1717,9 @@ NORETURN void cleanup_exit(int);
     X(INT, NONE, logtype) /* LGTYP_NONE, LGTYPE_ASCII, ... */ \
     X(INT, NONE, logxfovr) /* LGXF_OVR, LGXF_APN, LGXF_ASK */ \
     X(BOOL, NONE, logflush) \
+    X(BOOL, NONE, logasync) /* write log file from a background thread */ \
+    X(INT, NONE, logasync_interval) /* ms between background flushes */ \
+    X(INT, NONE, logasync_batch) /* KB pending that triggers a flush */ \
     X(BOOL, NONE, logheader) \
     X(BOOL, NONE, logomitpass) \
     X(BOOL, NONE, logomitdata) \
@@ -1783,6 +1799,10 @@ NORETURN void cleanup_exit(int);
      * large window in SSH-2.                                         \
      */ \
     X(BOOL, NONE, ssh_simple) \
+    /* Request pipelining for file transfers in PSFTP and PSCP */ \
+    X(BOOL, NONE, sftp_autotune) \
+    X(INT, NONE, sftp_window) /* bytes in flight, 0 for default */ \
+    X(INT, NONE, sftp_blocksize) /* bytes per request, 0 for default */ \
     X(BOOL, NONE, ssh_connection_sharing) \
     X(BOOL, NONE, ssh_connection_sharing_upstream) \
     X(BOOL, NONE, ssh_connection_sharing_downstream) \
@@ -2051,6 +2071,14 @@ void term_size(Terminal *, int, int, int);
 void term_paint(Terminal *, int, int, int, int, bool);
 void term_scroll(Terminal *, int, int);
 void term_scroll_to_selection(Terminal *, int);
+/* Flags for term_search */
+#define TERM_SEARCH_BACKWARD   1
+#define TERM_SEARCH_MATCH_CASE 2
+#define TERM_SEARCH_REGEX      4
+typedef enum {
+    TERM_SEARCH_NOT_FOUND, TERM_SEARCH_FOUND, TERM_SEARCH_BAD_PATTERN
+} TermSearchResult;
+TermSearchResult term_search(Terminal *, const wchar_t *pattern, int flags);
 void term_pwron(Terminal *, bool);
 void term_clrsb(Terminal *);
 void term_mouse(Terminal *, Mouse_Button, Mouse_Button, Mouse_Action,
@@ -2180,6 +2208,8 @@ void log_reconfig(LogContext *logctx, Conf *conf);
 void logfopen(LogContext *logctx);
 void logfclose(LogContext *logctx);
 void logtraffic(LogContext *logctx, unsigned char c, int logmode);
+void logtraffic_data(LogContext *logctx, const void *data, size_t len,
+                     int logmode);
 void logflush(LogContext *logctx);
 void logevent(LogContext *logctx, const char *event);
 void logeventf(LogContext *logctx, const char *fmt, ...) PRINTF_LIKE(2, 3);
@@ -2191,6 +2221,68 @@ void logeventvf(LogContext *logctx, const char *fmt, va_list ap);
  * value of dupprintf straight to this.
  */
 void logevent_and_free(LogContext *logctx, char *event);
+
+/*
+ * Exports from the platform's background log writer, which logging.c
+ * uses when CONF_logasync is set. logwriter_new returns NULL if it
+ * can't start, in which case the caller should write synchronously.
+ * logwriter_write never blocks: data that doesn't fit in the buffer
+ * is discarded and counted. It returns false once a write to the
+ * file has failed. logwriter_free writes out anything pending, but
+ * leaves the FILE open.
+ */
+typedef struct LogWriter LogWriter;
+LogWriter *logwriter_new(FILE *fp, size_t bufsize, size_t batch,
+                         unsigned interval_ms);
+bool logwriter_write(LogWriter *lw, const void *data, size_t len);
+uint64_t logwriter_dropped(LogWriter *lw);
+size_t logwriter_peak(LogWriter *lw);
+void logwriter_free(LogWriter *lw);
+
+/*
+ * Exports from the platform's scrollback spill file, which
+ * terminal/scrollback.c uses to hold old scrollback once it's over
+ * CONF_scrollback_memory. spill_file_new returns NULL if no file can
+ * be created; the file is deleted when it's freed. The pointer
+ * returned by spill_file_map stays valid until the next call to it
+ * or to spill_file_free, and is NULL if the data can't be mapped.
+ */
+typedef struct SpillFile SpillFile;
+SpillFile *spill_file_new(void);
+bool spill_file_write(SpillFile *sf, uint64_t offset,
+                      const void *data, size_t len);
+const void *spill_file_map(SpillFile *sf, uint64_t offset, size_t len);
+void spill_file_free(SpillFile *sf);
+
+/*
+ * Worker threads, for the few jobs that are shared out between
+ * processors: the SSH-2 crypto pipeline, the lanes of Argon2 and the
+ * prime search. Each platform implements these in utils/threads.c.
+ *
+ * worker_thread_start returns NULL if no thread could be started, and
+ * worker_thread_join waits for fn to return and frees the thread. A
+ * new semaphore has a count of zero, and semaphore_new returns NULL
+ * if one can't be made. ncpus returns how many processors are online,
+ * and is never less than 1.
+ *
+ * The platform header also defines a type atomic_counter, and these
+ * operations on a pointer to one, each a full barrier:
+ *
+ *   atomic_counter_inc(p)            add 1, returning the old value
+ *   atomic_counter_dec(p)            subtract 1, returning the new value
+ *   atomic_counter_load(p)           return the value
+ *   atomic_counter_cas(p, old, new)  set to new if it was old, and
+ *                                    return whether it was
+ */
+typedef struct WorkerThread WorkerThread;
+typedef struct Semaphore Semaphore;
+WorkerThread *worker_thread_start(void (*fn)(void *ctx), void *ctx);
+void worker_thread_join(WorkerThread *wt);
+Semaphore *semaphore_new(void);
+void semaphore_free(Semaphore *sem);
+void semaphore_post(Semaphore *sem, unsigned n);
+void semaphore_wait(Semaphore *sem);
+unsigned ncpus(void);
 enum { PKT_INCOMING, PKT_OUTGOING };
 enum { PKTLOG_EMIT, PKTLOG_BLANK, PKTLOG_OMIT };
 struct logblank_t {
@@ -573,6 +573,9 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_i(sesskey, "LogType", conf_get_int(conf, CONF_logtype));
     write_setting_i(sesskey, "LogFileClash", conf_get_int(conf, CONF_logxfovr));
     write_setting_b(sesskey, "LogFlush", conf_get_bool(conf, CONF_logflush));
+    write_setting_b(sesskey, "LogAsync", conf_get_bool(conf, CONF_logasync));
+    write_setting_i(sesskey, "LogAsyncInterval", conf_get_int(conf, CONF_logasync_interval));
+    write_setting_i(sesskey, "LogAsyncBatch", conf_get_int(conf, CONF_logasync_batch));
     write_setting_b(sesskey, "LogHeader", conf_get_bool(conf, CONF_logheader));
     write_setting_b(sesskey, "SSHLogOmitPasswords", conf_get_bool(conf, CONF_logomitpass));
     write_setting_b(sesskey, "SSHLogOmitData", conf_get_bool(conf, CONF_logomitdata));
@@ -617,6 +620,7 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_s(sesskey, "LocalUserName", conf_get_str(conf, CONF_localusername));
     write_setting_b(sesskey, "NoPTY", conf_get_bool(conf, CONF_nopty));
     write_setting_b(sesskey, "Compression", conf_get_bool(conf, CONF_compression));
+    write_setting_i(sesskey, "CompressionLevel", conf_get_int(conf, CONF_compression_level));
     write_setting_b(sesskey, "TryAgent", conf_get_bool(conf, CONF_tryagent));
     write_setting_b(sesskey, "AgentFwd", conf_get_bool(conf, CONF_agentfwd));
 #ifndef NO_GSSAPI
@@ -647,6 +651,15 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_i(sesskey, "SshProt", conf_get_int(conf, CONF_sshprot));
     write_setting_s(sesskey, "LogHost", conf_get_str(conf, CONF_loghost));
     write_setting_b(sesskey, "SSH2DES", conf_get_bool(conf, CONF_ssh2_des_cbc));
+    write_setting_i(sesskey, "SshCryptoThreads", conf_get_int(conf, CONF_ssh_crypto_threads));
+    write_setting_i(sesskey, "SshWinSession", conf_get_int(conf, CONF_ssh_win_session));
+    write_setting_i(sesskey, "SshWinPortFwd", conf_get_int(conf, CONF_ssh_win_portfwd));
+    write_setting_i(sesskey, "SshWinX11", conf_get_int(conf, CONF_ssh_win_x11));
+    write_setting_i(sesskey, "SshMaxPktSession", conf_get_int(conf, CONF_ssh_maxpkt_session));
+    write_setting_i(sesskey, "SshMaxPktPortFwd", conf_get_int(conf, CONF_ssh_maxpkt_portfwd));
+    write_setting_i(sesskey, "SshMaxPktX11", conf_get_int(conf, CONF_ssh_maxpkt_x11));
+    write_setting_b(sesskey, "SshWinAutoTune", conf_get_bool(conf, CONF_ssh_win_autotune));
+    write_setting_i(sesskey, "SshWinBudget", conf_get_int(conf, CONF_ssh_win_budget));
     write_setting_filename(sesskey, "PublicKeyFile", conf_get_filename(conf, CONF_keyfile));
     write_setting_s(sesskey, "RemoteCommand", conf_get_str(conf, CONF_remote_cmd));
     write_setting_b(sesskey, "RFCEnviron", conf_get_bool(conf, CONF_rfc_environ));
@@ -656,7 +669,7 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_i(sesskey, "EnterSendsCrLf", conf_get_int(conf, CONF_enter_sends_crlf));
     write_setting_i(sesskey, "RXVTHomeEnd", conf_get_int(conf, CONF_rxvt_homeend));
 #else
-    write_setting_b(sesskey, "RXVTHomeEnd", conf_get_bool(conf, CONF_rxvt_homeend));
+    write_setting_i(sesskey, "RXVTHomeEnd", conf_get_int(conf, CONF_rxvt_homeend));
 #endif
     write_setting_i(sesskey, "LinuxFunctionKeys", conf_get_int(conf, CONF_funky_type));
     write_setting_b(sesskey, "NoApplicationKeys", conf_get_bool(conf, CONF_no_applic_k));
@@ -709,6 +722,7 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
 #endif
 		    );
     write_setting_i(sesskey, "ScrollbackLines", conf_get_int(conf, CONF_savelines));
+    write_setting_i(sesskey, "ScrollbackMemory", conf_get_int(conf, CONF_scrollback_memory));
     write_setting_b(sesskey, "DECOriginMode", conf_get_bool(conf, CONF_dec_om));
     write_setting_b(sesskey, "AutoWrapMode", conf_get_bool(conf, CONF_wrap_mode));
     write_setting_b(sesskey, "LFImpliesCR", conf_get_bool(conf, CONF_lfhascr));
@@ -830,6 +844,9 @@ void save_open_settings(settings_w *sesskey, Conf *conf)
     write_setting_b(sesskey, "ConnectionSharing", conf_get_bool(conf, CONF_ssh_connection_sharing));
     write_setting_b(sesskey, "ConnectionSharingUpstream", conf_get_bool(conf, CONF_ssh_connection_sharing_upstream));
     write_setting_b(sesskey, "ConnectionSharingDownstream", conf_get_bool(conf, CONF_ssh_connection_sharing_downstream));
+    write_setting_b(sesskey, "SFTPAutotune", conf_get_bool(conf, CONF_sftp_autotune));
+    write_setting_i(sesskey, "SFTPWindow", conf_get_int(conf, CONF_sftp_window));
+    write_setting_i(sesskey, "SFTPBlockSize", conf_get_int(conf, CONF_sftp_blocksize));
     wmap(sesskey, "SSHManualHostKeys", conf, CONF_ssh_manual_hostkeys, false);
 
     /*
@@ -1025,6 +1042,9 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
     gppi(sesskey, "LogType", 0, conf, CONF_logtype);
     gppi(sesskey, "LogFileClash", LGXF_ASK, conf, CONF_logxfovr);
     gppb(sesskey, "LogFlush", true, conf, CONF_logflush);
+    gppb(sesskey, "LogAsync", false, conf, CONF_logasync);
+    gppi(sesskey, "LogAsyncInterval", 1000, conf, CONF_logasync_interval);
+    gppi(sesskey, "LogAsyncBatch", 64, conf, CONF_logasync_batch);
     gppb(sesskey, "LogHeader", true, conf, CONF_logheader);
     gppb(sesskey, "SSHLogOmitPasswords", true, conf, CONF_logomitpass);
     gppb(sesskey, "SSHLogOmitData", false, conf, CONF_logomitdata);
@@ -1148,6 +1168,7 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
     gpps(sesskey, "LocalUserName", "", conf, CONF_localusername);
     gppb(sesskey, "NoPTY", false, conf, CONF_nopty);
     gppb(sesskey, "Compression", false, conf, CONF_compression);
+    gppi(sesskey, "CompressionLevel", 6, conf, CONF_compression_level);
     gppb(sesskey, "TryAgent", true, conf, CONF_tryagent);
     gppb(sesskey, "AgentFwd", false, conf, CONF_agentfwd);
     gppb(sesskey, "ChangeUsername", false, conf, CONF_change_username);
@@ -1224,6 +1245,15 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
 
     gpps(sesskey, "LogHost", "", conf, CONF_loghost);
     gppb(sesskey, "SSH2DES", false, conf, CONF_ssh2_des_cbc);
+    gppi(sesskey, "SshCryptoThreads", 0, conf, CONF_ssh_crypto_threads);
+    gppi(sesskey, "SshWinSession", 0, conf, CONF_ssh_win_session);
+    gppi(sesskey, "SshWinPortFwd", 0, conf, CONF_ssh_win_portfwd);
+    gppi(sesskey, "SshWinX11", 0, conf, CONF_ssh_win_x11);
+    gppi(sesskey, "SshMaxPktSession", 0, conf, CONF_ssh_maxpkt_session);
+    gppi(sesskey, "SshMaxPktPortFwd", 0, conf, CONF_ssh_maxpkt_portfwd);
+    gppi(sesskey, "SshMaxPktX11", 0, conf, CONF_ssh_maxpkt_x11);
+    gppb(sesskey, "SshWinAutoTune", false, conf, CONF_ssh_win_autotune);
+    gppi(sesskey, "SshWinBudget", 65536, conf, CONF_ssh_win_budget);
     gppb(sesskey, "SshNoAuth", false, conf, CONF_ssh_no_userauth);
     gppb(sesskey, "SshNoTrivialAuth", false, conf, CONF_ssh_no_trivial_userauth);
     gppb(sesskey, "SshBanner", true, conf, CONF_ssh_show_banner);
@@ -1246,7 +1276,7 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
     gppi(sesskey, "EnterSendsCrLf", 0, conf, CONF_enter_sends_crlf);
     gppi(sesskey, "RXVTHomeEnd", 0, conf, CONF_rxvt_homeend);
 #else
-    gppb(sesskey, "RXVTHomeEnd", false, conf, CONF_rxvt_homeend);
+    gppi(sesskey, "RXVTHomeEnd", 0, conf, CONF_rxvt_homeend);
 #endif
     gppi(sesskey, "LinuxFunctionKeys", 0, conf, CONF_funky_type);
     gppb(sesskey, "NoApplicationKeys", false, conf, CONF_no_applic_k);
@@ -1334,6 +1364,7 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
 #else
     gppi(sesskey, "ScrollbackLines", 2000, conf, CONF_savelines);
 #endif
+    gppi(sesskey, "ScrollbackMemory", 0, conf, CONF_scrollback_memory);
     gppb(sesskey, "DECOriginMode", false, conf, CONF_dec_om);
     gppb(sesskey, "AutoWrapMode", true, conf, CONF_wrap_mode);
     gppb(sesskey, "LFImpliesCR", false, conf, CONF_lfhascr);
@@ -1524,6 +1555,9 @@ void load_open_settings(settings_r *sesskey, Conf *conf)
          conf, CONF_ssh_connection_sharing_upstream);
     gppb(sesskey, "ConnectionSharingDownstream", true,
          conf, CONF_ssh_connection_sharing_downstream);
+    gppb(sesskey, "SFTPAutotune", false, conf, CONF_sftp_autotune);
+    gppi(sesskey, "SFTPWindow", 0, conf, CONF_sftp_window);
+    gppi(sesskey, "SFTPBlockSize", 0, conf, CONF_sftp_blocksize);
     gppmap(sesskey, "SSHManualHostKeys", conf, CONF_ssh_manual_hostkeys);
     
     /*
@@ -46,6 +46,11 @@ struct ssh_channel;
  *    of data we're willing to receive in a single SSH2 channel
  *    data message.
  *
+ *  - OUR_V2_MAXPKT_LIMIT is the largest "maximum packet size" the
+ *    user can configure. A channel data message that big still
+ *    fits in OUR_V2_PACKETLIMIT with room for the headers, padding
+ *    and MAC.
+ *
  *  - OUR_V2_PACKETLIMIT is actually the maximum size of SSH
  *    _packet_ we're prepared to cope with.  It must be a multiple
  *    of the cipher block size, and must be at least 35000.
@@ -56,6 +61,7 @@ struct ssh_channel;
 #define OUR_V2_WINSIZE 16384
 #define OUR_V2_BIGWIN 0x7fffffff
 #define OUR_V2_MAXPKT 0x4000UL
+#define OUR_V2_MAXPKT_LIMIT 0x8000UL
 #define OUR_V2_PACKETLIMIT 0x9000UL
 
 typedef struct PacketQueueNode PacketQueueNode;
@@ -643,6 +649,9 @@ struct ssh_cipheralg {
                            unsigned long seq);
     void (*decrypt_length)(ssh_cipher *, void *blk, int len,
                            unsigned long seq);
+    /* Optional: called by the BPP after each complete packet, for
+     * AEAD modes whose nonce advances per message. May be NULL. */
+    void (*next_message)(ssh_cipher *);
     const char *ssh2_id;
     int blksize;
     /* real_keybits is the number of bits of entropy genuinely used by
@@ -661,6 +670,9 @@ struct ssh_cipheralg {
     unsigned int flags;
 #define SSH_CIPHER_IS_CBC       1
 #define SSH_CIPHER_SEPARATE_LENGTH      2
+/* Counter mode with the counter as the IV, so that setiv can move
+ * the cipher to any point in its keystream */
+#define SSH_CIPHER_IS_SDCTR     4
     const char *text_name;
     /* If set, this takes priority over other MAC. */
     const ssh2_macalg *required_mac;
@@ -687,6 +699,13 @@ static inline void ssh_cipher_encrypt_length(
 static inline void ssh_cipher_decrypt_length(
     ssh_cipher *c, void *blk, int len, unsigned long seq)
 { c->vt->decrypt_length(c, blk, len, seq); }
+static inline void ssh_cipher_next_message(ssh_cipher *c)
+{ if (c->vt->next_message) c->vt->next_message(c); }
+/* For SDCTR ciphers and ChaCha20: write out the next len bytes of
+ * keystream, as if encrypting zeroes. The implementations work
+ * several blocks at a time, so one long call beats many short ones. */
+static inline void ssh_cipher_keystream(ssh_cipher *c, void *out, int len)
+{ memset(out, 0, len); c->vt->encrypt(c, out, len); }
 static inline const struct ssh_cipheralg *ssh_cipher_alg(ssh_cipher *c)
 { return c->vt; }
 
@@ -898,7 +917,7 @@ struct ssh_compression_alg {
     /* For zlib@openssh.com: if non-NULL, this name will be considered once
      * userauth has completed successfully. */
     const char *delayed_name;
-    ssh_compressor *(*compress_new)(void);
+    ssh_compressor *(*compress_new)(int level);
     void (*compress_free)(ssh_compressor *);
     void (*compress)(ssh_compressor *, const unsigned char *block, int len,
                      unsigned char **outblock, int *outlen,
@@ -911,8 +930,8 @@ struct ssh_compression_alg {
 };
 
 static inline ssh_compressor *ssh_compressor_new(
-    const ssh_compression_alg *alg)
-{ return alg->compress_new(); }
+    const ssh_compression_alg *alg, int level)
+{ return alg->compress_new(level); }
 static inline ssh_decompressor *ssh_decompressor_new(
     const ssh_compression_alg *alg)
 { return alg->decompress_new(); }
@@ -949,6 +968,9 @@ void argon2_choose_passes(
     Argon2Flavour, uint32_t mem, uint32_t milliseconds, uint32_t *passes,
     uint32_t parallel, uint32_t taglen, ptrlen P, ptrlen S, ptrlen K, ptrlen X,
     strbuf *out);
+/* Limit argon2() to at most max_threads threads (0 meaning one per
+ * CPU), and to its plain C code unless simd is set, for benchmarking */
+void argon2_set_limits(unsigned max_threads, bool simd);
 /* The H' hash defined in Argon2, exposed just for testcrypt */
 strbuf *argon2_long_hash(unsigned length, ptrlen data);
 
@@ -979,6 +1001,12 @@ extern const ssh_cipheralg ssh_aes128_sdctr_sw;
 extern const ssh_cipheralg ssh_aes128_cbc;
 extern const ssh_cipheralg ssh_aes128_cbc_hw;
 extern const ssh_cipheralg ssh_aes128_cbc_sw;
+extern const ssh_cipheralg ssh_aes256_gcm;
+extern const ssh_cipheralg ssh_aes256_gcm_hw;
+extern const ssh_cipheralg ssh_aes256_gcm_sw;
+extern const ssh_cipheralg ssh_aes128_gcm;
+extern const ssh_cipheralg ssh_aes128_gcm_hw;
+extern const ssh_cipheralg ssh_aes128_gcm_sw;
 extern const ssh_cipheralg ssh_blowfish_ssh2_ctr;
 extern const ssh_cipheralg ssh_blowfish_ssh2;
 extern const ssh_cipheralg ssh_arcfour256_ssh2;
@@ -1015,6 +1043,7 @@ extern const ssh_kexes ssh_diffiehellman_gex;
 extern const ssh_kexes ssh_gssk5_sha1_kex;
 extern const ssh_kexes ssh_rsa_kex;
 extern const ssh_kex ssh_ec_kex_curve25519;
+extern const ssh_kex ssh_ec_kex_curve25519_generic;
 extern const ssh_kex ssh_ec_kex_curve448;
 extern const ssh_kex ssh_ec_kex_nistp256;
 extern const ssh_kex ssh_ec_kex_nistp384;
@@ -1025,6 +1054,7 @@ extern const ssh_keyalg ssh_rsa;
 extern const ssh_keyalg ssh_rsa_sha256;
 extern const ssh_keyalg ssh_rsa_sha512;
 extern const ssh_keyalg ssh_ecdsa_ed25519;
+extern const ssh_keyalg ssh_ecdsa_ed25519_generic;
 extern const ssh_keyalg ssh_ecdsa_ed448;
 extern const ssh_keyalg ssh_ecdsa_nistp256;
 extern const ssh_keyalg ssh_ecdsa_nistp384;
@@ -1036,8 +1066,13 @@ extern const ssh2_macalg ssh_hmac_sha1_96;
 extern const ssh2_macalg ssh_hmac_sha1_96_buggy;
 extern const ssh2_macalg ssh_hmac_sha256;
 extern const ssh2_macalg ssh2_poly1305;
+extern const ssh2_macalg ssh2_aesgcm_mac;
 extern const ssh_compression_alg ssh_zlib;
 
+/* Compression levels passed to ssh_compressor_new run from 1
+ * (fastest) to 9 (best); algorithms without levels ignore them. */
+#define ZLIB_DEFAULT_LEVEL 6
+
 /* Special constructor: BLAKE2b can be instantiated with any hash
  * length up to 128 bytes */
 ssh_hash *blake2b_new_general(unsigned hashlen);
@@ -1053,6 +1088,14 @@ bool platform_sha256_hw_available(void);
 bool platform_sha1_hw_available(void);
 bool platform_sha512_hw_available(void);
 
+/*
+ * Whether the CPU, and the OS, will run SSE2 and AVX2 code, for the
+ * vector versions of ChaCha20 and Argon2. Both are always false on
+ * anything but x86. In crypto/cpu-features.c.
+ */
+bool cpu_has_sse2(void);
+bool cpu_has_avx2(void);
+
 /*
  * PuTTY version number formatted as an SSH version string.
  */
@@ -69,7 +69,7 @@ void ssh1_bpp_new_cipher(BinaryPacketProtocol *bpp,
 /* This is only called from outside the BPP in server mode; in client
  * mode the BPP detects compression start time automatically by
  * snooping message types */
-void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp);
+void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp, int level);
 
 /* Helper routine which does common BPP initialisation, e.g. setting
  * up in_pq and out_pq, and initialising input_consumer. */
@@ -134,11 +134,16 @@ static inline void dts_reset(struct DataTransferStatsDirection *s,
 
 BinaryPacketProtocol *ssh2_bpp_new(
     LogContext *logctx, struct DataTransferStats *stats, bool is_server);
+/* Use this many threads for the crypto from the next change of keys
+ * on, if the cipher allows it (see bpp2-pipeline.h). 0 or 1 means
+ * don't use any more threads. */
+void ssh2_bpp_set_crypto_threads(BinaryPacketProtocol *bpp, int nthreads);
 void ssh2_bpp_new_outgoing_crypto(
     BinaryPacketProtocol *bpp,
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
     const ssh2_macalg *mac, bool etm_mode, const void *mac_key,
-    const ssh_compression_alg *compression, bool delayed_compression);
+    const ssh_compression_alg *compression, bool delayed_compression,
+    int compression_level);
 void ssh2_bpp_new_incoming_crypto(
     BinaryPacketProtocol *bpp,
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
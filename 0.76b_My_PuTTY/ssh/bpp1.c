@@ -23,6 +23,7 @@ struct ssh1_bpp_state {
     uint8_t iv[8];                     /* for crcda */
 
     bool pending_compression_request;
+    int pending_compression_level;
     ssh_compressor *compctx;
     ssh_decompressor *decompctx;
 
@@ -102,7 +103,7 @@ void ssh1_bpp_new_cipher(BinaryPacketProtocol *bpp,
     }
 }
 
-void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp)
+void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp, int level)
 {
     struct ssh1_bpp_state *s;
     assert(bpp->vt == &ssh1_bpp_vtable);
@@ -111,7 +112,7 @@ void ssh1_bpp_start_compression(BinaryPacketProtocol *bpp)
     assert(!s->compctx);
     assert(!s->decompctx);
 
-    s->compctx = ssh_compressor_new(&ssh_zlib);
+    s->compctx = ssh_compressor_new(&ssh_zlib, level);
     s->decompctx = ssh_decompressor_new(&ssh_zlib);
 
     bpp_logevent("Started zlib (RFC1950) compression");
@@ -256,7 +257,8 @@ static void ssh1_bpp_handle_input(BinaryPacketProtocol *bpp)
                          * If the response was positive, start
                          * compression.
                          */
-                        ssh1_bpp_start_compression(&s->bpp);
+                        ssh1_bpp_start_compression(
+                            &s->bpp, s->pending_compression_level);
                     }
 
                     /*
@@ -363,6 +365,16 @@ static void ssh1_bpp_handle_output(BinaryPacketProtocol *bpp)
 
     while ((pkt = pq_pop(&s->bpp.out_pq)) != NULL) {
         int type = pkt->type;
+
+        if (type == SSH1_CMSG_REQUEST_COMPRESSION) {
+            /* Remember the level we asked for, to compress at it if
+             * the server agrees. */
+            BinarySource src[1];
+            BinarySource_BARE_INIT(src, pkt->data + pkt->prefix,
+                                   pkt->length - pkt->prefix);
+            s->pending_compression_level = get_uint32(src);
+        }
+
         ssh1_bpp_format_packet(s, pkt);
         ssh_free_pktout(pkt);
 
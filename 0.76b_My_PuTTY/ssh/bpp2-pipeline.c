@@ -0,0 +1,285 @@
+/*
+ * Encrypt, decrypt and MAC batches of SSH-2 packets on several
+ * threads. See bpp2-pipeline.h for what this can and can't do.
+ *
+ * The threads are started when the pipeline is made, and wait for a
+ * batch between times. The thread that calls ssh2_pipeline_run does
+ * its share of the work too, so a pipeline with n threads starts
+ * n-1 of them. Each thread takes the next packet nobody has claimed
+ * yet until there are none left, and the last thread to run out
+ * wakes up the caller.
+ */
+
+#include <assert.h>
+
+#include "putty.h"
+#include "ssh.h"
+#include "bpp2-pipeline.h"
+
+/* Batches smaller than this aren't worth waking anyone up for */
+#define PIPELINE_MIN_PARALLEL 16384
+
+struct pipeline_slot {
+    ssh2_crypto_pipeline *pl;
+    ssh_cipher *cipher;
+    ssh2_mac *mac;
+    WorkerThread *thread;
+};
+
+struct ssh2_crypto_pipeline {
+    bool outgoing, etm_mode, sdctr, separate_length, gcm;
+    int blksize;
+
+    /* For AES-GCM, the IV from the change of keys, and the sequence
+     * number of the packet it applies to */
+    unsigned char gcm_iv[12];
+    unsigned long gcm_sequence;
+
+    int nthreads;                      /* slots with a cipher and MAC */
+    int nslots;                        /* slots with a thread running,
+                                        * slot 0 being the caller's */
+    struct pipeline_slot *slots;
+    Semaphore *go;                     /* one post per thread to wake */
+    Semaphore *done;                   /* posted when the batch is done */
+    bool quit;
+
+    /* The batch being processed */
+    ssh2_pipeline_job *jobs;
+    size_t njobs;
+    atomic_counter next;               /* next job nobody has taken */
+    atomic_counter busy;               /* threads woken and not finished */
+};
+
+bool ssh2_pipeline_supported(const ssh_cipheralg *cipher)
+{
+    if (!cipher || cipher->blksize > SSH2_PIPELINE_MAXBLK)
+        return false;
+
+    /*
+     * A cipher with a separate length field (i.e. ChaCha20-Poly1305)
+     * sets itself up afresh for each packet from the sequence number,
+     * and one in SDCTR mode can be moved to any point in its
+     * keystream by setting its IV. AES-GCM only carries a count of
+     * packets from one to the next, which pipeline_job works out from
+     * the sequence number. Anything else with a next_message method
+     * carries state from one packet to the next.
+     */
+    if (cipher->flags & SSH_CIPHER_SEPARATE_LENGTH)
+        return true;
+    if (cipher->required_mac == &ssh2_aesgcm_mac)
+        return true;
+    return (cipher->flags & SSH_CIPHER_IS_SDCTR) && !cipher->next_message;
+}
+
+void ssh2_pipeline_ctr_add(unsigned char *ctr, int blksize, size_t len)
+{
+    size_t blocks = len / blksize;
+    int i;
+
+    assert(len % blksize == 0);
+    for (i = blksize - 1; i >= 0 && blocks; i--) {
+        blocks += ctr[i];
+        ctr[i] = (unsigned char)blocks;
+        blocks >>= 8;
+    }
+}
+
+static void pipeline_job(ssh2_crypto_pipeline *pl, struct pipeline_slot *slot,
+                         ssh2_pipeline_job *job)
+{
+    ssh_cipher *cipher = slot->cipher;
+    ssh2_mac *mac = slot->mac;
+    unsigned char *data = job->data;
+    long len = job->len;
+
+    /*
+     * Move the cipher to this packet. This comes before the MAC in
+     * every case, because the AES-GCM MAC depends on the nonce.
+     */
+    if (pl->sdctr) {
+        ssh_cipher_setiv(cipher, job->iv);
+    } else if (pl->gcm) {
+        unsigned char iv[16];
+        uint64_t invocation = GET_64BIT_MSB_FIRST(pl->gcm_iv + 4) +
+            (uint32_t)(job->sequence - pl->gcm_sequence);
+        memcpy(iv, pl->gcm_iv, 4);
+        PUT_64BIT_MSB_FIRST(iv + 4, invocation);
+        memset(iv + 12, 0, 4);
+        ssh_cipher_setiv(cipher, iv);
+        smemclr(iv, sizeof(iv));
+    }
+
+    if (pl->outgoing) {
+        /* The same as the end of ssh2_bpp_format_packet_inner */
+        if (pl->separate_length)
+            ssh_cipher_encrypt_length(cipher, data, 4, job->sequence);
+        if (pl->etm_mode) {
+            ssh_cipher_encrypt(cipher, data + 4, len - 4);
+            if (mac)
+                ssh2_mac_generate(mac, data, len, job->sequence);
+        } else {
+            if (mac)
+                ssh2_mac_generate(mac, data, len, job->sequence);
+            ssh_cipher_encrypt(cipher, data, len);
+        }
+    } else if (pl->etm_mode) {
+        /* The same as the ETM case in ssh2_bpp_handle_input */
+        if (pl->separate_length) {
+            unsigned char lenfield[4];
+            memcpy(lenfield, data, 4);
+            ssh_cipher_decrypt_length(cipher, lenfield, 4, job->sequence);
+        }
+        job->mac_ok = !mac || ssh2_mac_verify(mac, data, len, job->sequence);
+        if (job->mac_ok)
+            ssh_cipher_decrypt(cipher, data + 4, len - 4);
+    } else {
+        /* bpp2.c has already decrypted the first block */
+        ssh_cipher_decrypt(cipher, data + pl->blksize, len - pl->blksize);
+        job->mac_ok = !mac || ssh2_mac_verify(mac, data, len, job->sequence);
+    }
+
+    ssh_cipher_next_message(cipher);
+}
+
+static void pipeline_work(struct pipeline_slot *slot)
+{
+    ssh2_crypto_pipeline *pl = slot->pl;
+    long i;
+
+    while ((i = atomic_counter_inc(&pl->next)) < (long)pl->njobs)
+        pipeline_job(pl, slot, &pl->jobs[i]);
+}
+
+static void pipeline_threadfunc(void *param)
+{
+    struct pipeline_slot *slot = (struct pipeline_slot *)param;
+    ssh2_crypto_pipeline *pl = slot->pl;
+
+    while (1) {
+        semaphore_wait(pl->go);
+        if (pl->quit)
+            break;
+        pipeline_work(slot);
+        if (atomic_counter_dec(&pl->busy) == 0)
+            semaphore_post(pl->done, 1);
+    }
+}
+
+ssh2_crypto_pipeline *ssh2_pipeline_new(
+    int nthreads, bool outgoing,
+    const ssh_cipheralg *cipher, const void *ckey,
+    const void *iv, unsigned long sequence,
+    const ssh2_macalg *mac, bool etm_mode, const void *mac_key)
+{
+    ssh2_crypto_pipeline *pl;
+    int i, started;
+
+    if (nthreads < 2 || !ssh2_pipeline_supported(cipher))
+        return NULL;
+
+    pl = snew(ssh2_crypto_pipeline);
+    memset(pl, 0, sizeof(*pl));
+    pl->outgoing = outgoing;
+    pl->etm_mode = etm_mode;
+    pl->sdctr = (cipher->flags & SSH_CIPHER_IS_SDCTR);
+    pl->separate_length = (cipher->flags & SSH_CIPHER_SEPARATE_LENGTH);
+    pl->gcm = (cipher->required_mac == &ssh2_aesgcm_mac);
+    pl->blksize = cipher->blksize;
+    if (pl->gcm) {
+        memcpy(pl->gcm_iv, iv, sizeof(pl->gcm_iv));
+        pl->gcm_sequence = sequence;
+    }
+
+    pl->nthreads = pl->nslots = nthreads;
+    pl->slots = snewn(nthreads, struct pipeline_slot);
+    for (i = 0; i < nthreads; i++) {
+        struct pipeline_slot *slot = &pl->slots[i];
+        slot->pl = pl;
+        slot->cipher = ssh_cipher_new(cipher);
+        ssh_cipher_setkey(slot->cipher, ckey);
+        /* SDCTR and GCM jobs set their own IV; ChaCha20 ignores this */
+        if (pl->sdctr) {
+            unsigned char zero[SSH2_PIPELINE_MAXBLK] = { 0 };
+            ssh_cipher_setiv(slot->cipher, zero);
+        }
+        if (mac) {
+            slot->mac = ssh2_mac_new(mac, slot->cipher);
+            ssh2_mac_setkey(slot->mac, make_ptrlen(mac_key, mac->keylen));
+        } else {
+            slot->mac = NULL;
+        }
+    }
+
+    pl->go = semaphore_new();
+    pl->done = semaphore_new();
+    started = 1;
+    if (pl->go && pl->done)
+        for (; started < nthreads; started++)
+            if (!(pl->slots[started].thread = worker_thread_start(
+                      pipeline_threadfunc, &pl->slots[started])))
+                break;
+    if (started < nthreads) {
+        /* Make do with the threads we did get */
+        pl->nslots = started;
+    }
+
+    return pl;
+}
+
+void ssh2_pipeline_free(ssh2_crypto_pipeline *pl)
+{
+    int i;
+
+    pl->quit = true;
+    if (pl->nslots > 1) {
+        semaphore_post(pl->go, pl->nslots - 1);
+        for (i = 1; i < pl->nslots; i++)
+            worker_thread_join(pl->slots[i].thread);
+    }
+    if (pl->go)
+        semaphore_free(pl->go);
+    if (pl->done)
+        semaphore_free(pl->done);
+
+    /* As in bpp2.c, free the MAC first in case it's part of the cipher.
+     * (Slots whose thread didn't start still have them.) */
+    for (i = 0; i < pl->nthreads; i++) {
+        if (pl->slots[i].mac)
+            ssh2_mac_free(pl->slots[i].mac);
+        ssh_cipher_free(pl->slots[i].cipher);
+    }
+    sfree(pl->slots);
+    smemclr(pl, sizeof(*pl));
+    sfree(pl);
+}
+
+void ssh2_pipeline_run(ssh2_crypto_pipeline *pl,
+                       ssh2_pipeline_job *jobs, size_t njobs)
+{
+    size_t i, total = 0;
+    int nwake;
+
+    if (njobs == 0)
+        return;
+    for (i = 0; i < njobs; i++)
+        total += jobs[i].len;
+    nwake = pl->nslots - 1;
+    if ((size_t)nwake > njobs - 1)
+        nwake = njobs - 1;
+    if (total < PIPELINE_MIN_PARALLEL)
+        nwake = 0;
+
+    pl->jobs = jobs;
+    pl->njobs = njobs;
+    pl->next = 0;
+    pl->busy = nwake;
+    if (nwake > 0)
+        semaphore_post(pl->go, nwake);
+
+    pipeline_work(&pl->slots[0]);
+
+    if (nwake > 0)
+        semaphore_wait(pl->done);
+    pl->jobs = NULL;
+    pl->njobs = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Interface between bpp2.c and bpp2-pipeline.c, which encrypts,
+ * decrypts and MACs batches of SSH-2 packets on several threads.
+ *
+ * This only works for ciphers where the work for one packet doesn't
+ * depend on having done the previous one. That's true of SDCTR,
+ * where the counter a packet starts at is known from how much data
+ * went before it, of AES-GCM, whose nonce is the one set up at the
+ * change of keys plus the number of packets sent since, and of
+ * ChaCha20-Poly1305, where everything is keyed by the sequence
+ * number. It isn't true of CBC, where each packet's
+ * IV is the last ciphertext block of the one before. For everything
+ * else, and for any MAC, each thread keeps its own instances of the
+ * cipher and MAC, set up with the same keys as the BPP's own.
+ *
+ * The packets in a batch are handed out to threads in no particular
+ * order, but ssh2_pipeline_run doesn't return until all of them are
+ * done, and bpp2.c then passes them on in the order they came in.
+ */
+
+#ifndef PUTTY_SSH_BPP2_PIPELINE_H
+#define PUTTY_SSH_BPP2_PIPELINE_H
+
+/* Largest cipher block size the pipeline can keep a counter for */
+#define SSH2_PIPELINE_MAXBLK 16
+
+/* Most packets bpp2.c will put in one batch */
+#define SSH2_PIPELINE_MAXBATCH 64
+
+typedef struct ssh2_crypto_pipeline ssh2_crypto_pipeline;
+
+typedef struct ssh2_pipeline_job {
+    /* The whole packet, length field first, with room for the MAC
+     * after it */
+    unsigned char *data;
+    /* Length of the packet not counting the MAC */
+    long len;
+    unsigned long sequence;
+    /* For SDCTR, the counter at the first byte of the packet that's
+     * encrypted (after the length field in ETM mode, and after the
+     * first block, which bpp2.c has to decrypt itself to find the
+     * length, for incoming packets not in ETM mode) */
+    unsigned char iv[SSH2_PIPELINE_MAXBLK];
+    /* For incoming packets, set to whether the MAC was right */
+    bool mac_ok;
+} ssh2_pipeline_job;
+
+/* Whether a cipher can be used in a pipeline at all */
+bool ssh2_pipeline_supported(const ssh_cipheralg *cipher);
+
+/* Make a pipeline with 'nthreads' threads, counting the caller.
+ * 'iv' and 'sequence' are the IV the cipher was keyed with and the
+ * sequence number of the first packet under the new keys. */
+ssh2_crypto_pipeline *ssh2_pipeline_new(
+    int nthreads, bool outgoing,
+    const ssh_cipheralg *cipher, const void *ckey,
+    const void *iv, unsigned long sequence,
+    const ssh2_macalg *mac, bool etm_mode, const void *mac_key);
+void ssh2_pipeline_free(ssh2_crypto_pipeline *pl);
+
+/* Process a batch of packets, returning when they're all done */
+void ssh2_pipeline_run(ssh2_crypto_pipeline *pl,
+                       ssh2_pipeline_job *jobs, size_t njobs);
+
+/* Advance a big-endian SDCTR counter past 'len' bytes of data */
+void ssh2_pipeline_ctr_add(unsigned char *ctr, int blksize, size_t len);
+
+#endif /* PUTTY_SSH_BPP2_PIPELINE_H */
@@ -7,6 +7,7 @@
 #include "putty.h"
 #include "ssh.h"
 #include "bpp.h"
+#include "bpp2-pipeline.h"
 #include "sshcr.h"
 
 struct ssh2_bpp_direction {
@@ -15,6 +16,13 @@ struct ssh2_bpp_direction {
     ssh2_mac *mac;
     bool etm_mode;
     const ssh_compression_alg *pending_compression;
+    int compression_level;
+
+    /* If the crypto is being done on several threads: for SDCTR, ctr
+     * is the counter at the start of the next packet */
+    ssh2_crypto_pipeline *pipeline;
+    bool sdctr;
+    unsigned char ctr[SSH2_PIPELINE_MAXBLK];
 };
 
 struct ssh2_bpp_state {
@@ -41,6 +49,22 @@ struct ssh2_bpp_state {
     unsigned nnewkeys;
     int prev_type;
 
+    /* Threads to use for encryption, if the cipher allows */
+    int crypto_threads;
+
+    /* Outgoing packets waiting for the pipeline */
+    PktOut *out_batch[SSH2_PIPELINE_MAXBATCH];
+    ssh2_pipeline_job out_jobs[SSH2_PIPELINE_MAXBATCH];
+    size_t out_nbatch;
+
+    /* Incoming packets the pipeline has already dealt with, still in
+     * in_raw until they're taken from here */
+    PktIn *in_batch[SSH2_PIPELINE_MAXBATCH];
+    ssh2_pipeline_job in_jobs[SSH2_PIPELINE_MAXBATCH];
+    size_t in_nbatch, in_batchpos;
+    unsigned char *aheadbuf;
+    size_t aheadbufsize;
+
     BinaryPacketProtocol bpp;
 };
 
@@ -88,6 +112,8 @@ static void ssh2_bpp_free_outgoing_crypto(struct ssh2_bpp_state *s)
         ssh_cipher_free(s->out.cipher);
     if (s->out_comp)
         ssh_compressor_free(s->out_comp);
+    if (s->out.pipeline)
+        ssh2_pipeline_free(s->out.pipeline);
 }
 
 static void ssh2_bpp_free_incoming_crypto(struct ssh2_bpp_state *s)
@@ -99,28 +125,88 @@ static void ssh2_bpp_free_incoming_crypto(struct ssh2_bpp_state *s)
         ssh_cipher_free(s->in.cipher);
     if (s->in_decomp)
         ssh_decompressor_free(s->in_decomp);
+    if (s->in.pipeline)
+        ssh2_pipeline_free(s->in.pipeline);
+}
+
+/*
+ * Throw away incoming packets decrypted ahead of time that nothing
+ * has taken yet. They're still in in_raw.
+ */
+static void ssh2_bpp_drop_in_batch(struct ssh2_bpp_state *s)
+{
+    while (s->in_batchpos < s->in_nbatch) {
+        size_t i = s->in_batchpos++;
+        smemclr(snew_plus_get_aux(s->in_batch[i]), s->in_jobs[i].len);
+        sfree(s->in_batch[i]);
+    }
+    s->in_nbatch = s->in_batchpos = 0;
 }
 
 static void ssh2_bpp_free(BinaryPacketProtocol *bpp)
 {
     struct ssh2_bpp_state *s = container_of(bpp, struct ssh2_bpp_state, bpp);
+    size_t i;
     sfree(s->buf);
+    for (i = 0; i < s->out_nbatch; i++)
+        ssh_free_pktout(s->out_batch[i]);
+    ssh2_bpp_drop_in_batch(s);
+    sfree(s->aheadbuf);
     ssh2_bpp_free_outgoing_crypto(s);
     ssh2_bpp_free_incoming_crypto(s);
     sfree(s->pktin);
     sfree(s);
 }
 
+void ssh2_bpp_set_crypto_threads(BinaryPacketProtocol *bpp, int nthreads)
+{
+    struct ssh2_bpp_state *s;
+    assert(bpp->vt == &ssh2_bpp_vtable);
+    s = container_of(bpp, struct ssh2_bpp_state, bpp);
+
+    s->crypto_threads = nthreads;
+}
+
+/*
+ * Set up a pipeline for one direction, if it's wanted and the cipher
+ * can use one.
+ */
+static void ssh2_bpp_new_pipeline(
+    struct ssh2_bpp_state *s, struct ssh2_bpp_direction *dir, bool outgoing,
+    const ssh_cipheralg *cipher, const void *ckey, const void *iv,
+    const ssh2_macalg *mac, bool etm_mode, const void *mac_key)
+{
+    BinaryPacketProtocol *bpp = &s->bpp; /* for bpp_logevent */
+
+    dir->pipeline = NULL;
+    dir->sdctr = false;
+    if (!cipher || s->crypto_threads < 2)
+        return;
+
+    dir->pipeline = ssh2_pipeline_new(s->crypto_threads, outgoing, cipher,
+                                      ckey, iv, dir->sequence,
+                                      mac, etm_mode, mac_key);
+    if (dir->pipeline) {
+        dir->sdctr = (cipher->flags & SSH_CIPHER_IS_SDCTR);
+        if (dir->sdctr)
+            memcpy(dir->ctr, iv, cipher->blksize);
+        bpp_logevent("Using %d threads for %s encryption",
+                     s->crypto_threads, outgoing ? "outbound" : "inbound");
+    }
+}
+
 void ssh2_bpp_new_outgoing_crypto(
     BinaryPacketProtocol *bpp,
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
     const ssh2_macalg *mac, bool etm_mode, const void *mac_key,
-    const ssh_compression_alg *compression, bool delayed_compression)
+    const ssh_compression_alg *compression, bool delayed_compression,
+    int compression_level)
 {
     struct ssh2_bpp_state *s;
     assert(bpp->vt == &ssh2_bpp_vtable);
     s = container_of(bpp, struct ssh2_bpp_state, bpp);
 
+    assert(s->out_nbatch == 0);
     ssh2_bpp_free_outgoing_crypto(s);
 
     if (cipher) {
@@ -153,6 +239,10 @@ void ssh2_bpp_new_outgoing_crypto(
         s->out.mac = NULL;
     }
 
+    ssh2_bpp_new_pipeline(s, &s->out, true, cipher, ckey, iv,
+                          mac, etm_mode, mac_key);
+
+    s->out.compression_level = compression_level;
     if (delayed_compression && !s->seen_userauth_success) {
         s->out.pending_compression = compression;
         s->out_comp = NULL;
@@ -165,7 +255,7 @@ void ssh2_bpp_new_outgoing_crypto(
         /* 'compression' is always non-NULL, because no compression is
          * indicated by ssh_comp_none. But this setup call may return a
          * null out_comp. */
-        s->out_comp = ssh_compressor_new(compression);
+        s->out_comp = ssh_compressor_new(compression, compression_level);
 
         if (s->out_comp)
             bpp_logevent("Initialised %s compression",
@@ -183,6 +273,7 @@ void ssh2_bpp_new_incoming_crypto(
     assert(bpp->vt == &ssh2_bpp_vtable);
     s = container_of(bpp, struct ssh2_bpp_state, bpp);
 
+    ssh2_bpp_drop_in_batch(s);
     ssh2_bpp_free_incoming_crypto(s);
 
     if (cipher) {
@@ -210,6 +301,9 @@ void ssh2_bpp_new_incoming_crypto(
         s->in.mac = NULL;
     }
 
+    ssh2_bpp_new_pipeline(s, &s->in, false, cipher, ckey, iv,
+                          mac, etm_mode, mac_key);
+
     if (delayed_compression && !s->seen_userauth_success) {
         s->in.pending_compression = compression;
         s->in_decomp = NULL;
@@ -258,7 +352,8 @@ static void ssh2_bpp_enable_pending_compression(struct ssh2_bpp_state *s)
         s->in.pending_compression = NULL;
     }
     if (s->out.pending_compression) {
-        s->out_comp = ssh_compressor_new(s->out.pending_compression);
+        s->out_comp = ssh_compressor_new(s->out.pending_compression,
+                                         s->out.compression_level);
         bpp_logevent("Initialised delayed %s compression",
                      ssh_compressor_alg(s->out_comp)->text_name);
         s->out.pending_compression = NULL;
@@ -278,6 +373,120 @@ static void ssh2_bpp_enable_pending_compression(struct ssh2_bpp_state *s)
 
 #define userauth_range(pkttype) ((unsigned)((pkttype) - 50) < 20)
 
+/*
+ * With a pipeline for incoming packets, see if several whole packets
+ * are already waiting in in_raw, and if so, decrypt and check them
+ * all at once, leaving them in in_batch for handle_input to take in
+ * turn. Anything odd about a packet's length just ends the batch
+ * there, and the packet is left for the usual code to complain about.
+ */
+static void ssh2_bpp_decrypt_ahead(struct ssh2_bpp_state *s)
+{
+    size_t avail, pos, n, i;
+    unsigned long sequence = s->in.sequence;
+    unsigned char ctr[SSH2_PIPELINE_MAXBLK];
+    unsigned char first[SSH2_PIPELINE_MAXBLK];
+    long len, packetlen;
+
+    assert(s->in_batchpos == s->in_nbatch);
+    s->in_nbatch = s->in_batchpos = 0;
+
+    /* No batches while compressed, since then we can't see which
+     * packet is NEWKEYS (see below) */
+    if (s->in_decomp || s->in.pending_compression)
+        goto done;
+
+    avail = bufchain_size(s->bpp.in_raw);
+    if (avail > SSH2_PIPELINE_MAXBATCH * (OUR_V2_PACKETLIMIT / 4))
+        avail = SSH2_PIPELINE_MAXBATCH * (OUR_V2_PACKETLIMIT / 4);
+    if (avail < 2 * (s->cipherblk + s->maclen))
+        goto done;
+    if (s->aheadbufsize < avail) {
+        s->aheadbufsize = avail;
+        s->aheadbuf = sresize(s->aheadbuf, s->aheadbufsize, unsigned char);
+    }
+    bufchain_fetch(s->bpp.in_raw, s->aheadbuf, avail);
+    memcpy(ctr, s->in.ctr, sizeof(ctr));
+
+    for (pos = n = 0; n < SSH2_PIPELINE_MAXBATCH; n++) {
+        ssh2_pipeline_job *job = &s->in_jobs[n];
+        PktIn *pktin;
+
+        if (avail - pos < s->cipherblk)
+            break;
+        if (s->in.etm_mode) {
+            memcpy(first, s->aheadbuf + pos, 4);
+            if (ssh_cipher_alg(s->in.cipher)->flags &
+                SSH_CIPHER_SEPARATE_LENGTH)
+                ssh_cipher_decrypt_length(s->in.cipher, first, 4, sequence);
+            len = toint(GET_32BIT_MSB_FIRST(first));
+            if (len < 0 || len > (long)OUR_V2_PACKETLIMIT ||
+                len % s->cipherblk != 0)
+                break;
+        } else {
+            memcpy(first, s->aheadbuf + pos, s->cipherblk);
+            if (s->in.sdctr)
+                ssh_cipher_setiv(s->in.cipher, ctr);
+            ssh_cipher_decrypt(s->in.cipher, first, s->cipherblk);
+            len = toint(GET_32BIT_MSB_FIRST(first));
+            if (len < 0 || len > (long)OUR_V2_PACKETLIMIT ||
+                (len + 4) % s->cipherblk != 0)
+                break;
+        }
+        packetlen = len + 4;
+        if (avail - pos < packetlen + s->maclen)
+            break;
+
+        pktin = snew_plus(PktIn, packetlen + s->maclen);
+        pktin->qnode.prev = pktin->qnode.next = NULL;
+        pktin->type = 0;
+        pktin->qnode.on_free_queue = false;
+        job->data = snew_plus_get_aux(pktin);
+        memcpy(job->data, s->aheadbuf + pos, packetlen + s->maclen);
+        job->len = packetlen;
+        job->sequence = sequence++;
+        if (s->in.etm_mode) {
+            memcpy(job->iv, ctr, sizeof(ctr));
+        } else {
+            memcpy(job->data, first, s->cipherblk);
+            memcpy(job->iv, ctr, sizeof(ctr));
+            ssh2_pipeline_ctr_add(job->iv, s->cipherblk, s->cipherblk);
+        }
+        if (s->in.sdctr)
+            ssh2_pipeline_ctr_add(ctr, s->cipherblk, s->in.etm_mode ?
+                                  packetlen - 4 : packetlen);
+        s->in_batch[n] = pktin;
+        pos += packetlen + s->maclen;
+    }
+    s->in_nbatch = n;
+
+    if (n >= 2) {
+        ssh2_pipeline_run(s->in.pipeline, s->in_jobs, n);
+
+        /*
+         * Everything after a NEWKEYS is under the new keys, which
+         * we don't have yet, so has to be done again later.
+         */
+        for (i = 0; i < n; i++)
+            if (s->in_jobs[i].mac_ok &&
+                s->in_jobs[i].data[5] == SSH2_MSG_NEWKEYS)
+                break;
+        if (i + 1 < n) {
+            s->in_batchpos = i + 1;
+            ssh2_bpp_drop_in_batch(s);
+            s->in_nbatch = i + 1;
+        }
+    } else {
+        /* Not worth it for one packet */
+        ssh2_bpp_drop_in_batch(s);
+    }
+
+  done:
+    /* Put the BPP's own cipher back where the next packet starts */
+    if (s->in.sdctr)
+        ssh_cipher_setiv(s->in.cipher, s->in.ctr);
+}
+
 static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
 {
     struct ssh2_bpp_state *s = container_of(bpp, struct ssh2_bpp_state, bpp);
@@ -295,7 +504,28 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             s->cipherblk = 8;
         s->maclen = s->in.mac ? ssh2_mac_alg(s->in.mac)->len : 0;
 
-        if (s->in.cipher &&
+        if (s->in.pipeline && s->in_batchpos == s->in_nbatch)
+            ssh2_bpp_decrypt_ahead(s);
+
+        if (s->in_batchpos < s->in_nbatch) {
+            /*
+             * The pipeline has already dealt with this packet, so all
+             * that's left is to take it out of in_raw.
+             */
+            ssh2_pipeline_job *job = &s->in_jobs[s->in_batchpos];
+            s->pktin = s->in_batch[s->in_batchpos++];
+            s->data = job->data;
+            s->packetlen = job->len;
+            s->len = s->packetlen - 4;
+            s->maxlen = s->packetlen + s->maclen;
+            bufchain_consume(s->bpp.in_raw, s->maxlen);
+            ssh_check_frozen(s->bpp.ssh);
+
+            if (!job->mac_ok) {
+                ssh_sw_abort(s->bpp.ssh, "Incorrect MAC received on packet");
+                crStopV;
+            }
+        } else if (s->in.cipher &&
             (ssh_cipher_alg(s->in.cipher)->flags & SSH_CIPHER_IS_CBC) &&
             s->in.mac && !s->in.etm_mode) {
             /*
@@ -522,6 +752,11 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
         dts_consume(&s->stats->in, s->packetlen);
 
         s->pktin->sequence = s->in.sequence++;
+        if (s->in.cipher)
+            ssh_cipher_next_message(s->in.cipher);
+        if (s->in.sdctr)
+            ssh2_pipeline_ctr_add(s->in.ctr, s->cipherblk, s->in.etm_mode ?
+                                  s->packetlen - 4 : s->packetlen);
 
         s->length = s->packetlen - s->pad;
         assert(s->length >= 0);
@@ -799,7 +1034,7 @@ static void ssh2_bpp_format_packet_inner(struct ssh2_bpp_state *s, PktOut *pkt)
     PUT_32BIT_MSB_FIRST(pkt->data, origlen + padding - 4);
 
     /* Encrypt length if the scheme requires it */
-    if (s->out.cipher &&
+    if (s->out.cipher && !s->out.pipeline &&
         (ssh_cipher_alg(s->out.cipher)->flags & SSH_CIPHER_SEPARATE_LENGTH)) {
         ssh_cipher_encrypt_length(s->out.cipher, pkt->data, 4,
                                   s->out.sequence);
@@ -807,7 +1042,21 @@ static void ssh2_bpp_format_packet_inner(struct ssh2_bpp_state *s, PktOut *pkt)
 
     put_padding(pkt, maclen, 0);
 
-    if (s->out.mac && s->out.etm_mode) {
+    if (s->out.pipeline) {
+        /*
+         * The rest is left to the pipeline, once handle_output has
+         * a batch of packets for it.
+         */
+        ssh2_pipeline_job *job = &s->out_jobs[s->out_nbatch];
+        job->data = pkt->data;
+        job->len = origlen + padding;
+        job->sequence = s->out.sequence;
+        if (s->out.sdctr) {
+            memcpy(job->iv, s->out.ctr, sizeof(job->iv));
+            ssh2_pipeline_ctr_add(s->out.ctr, cipherblk, s->out.etm_mode ?
+                                  job->len - 4 : job->len);
+        }
+    } else if (s->out.mac && s->out.etm_mode) {
         /*
          * OpenSSH-defined encrypt-then-MAC protocol.
          */
@@ -828,10 +1077,48 @@ static void ssh2_bpp_format_packet_inner(struct ssh2_bpp_state *s, PktOut *pkt)
     }
 
     s->out.sequence++;       /* whether or not we MACed */
+    if (s->out.cipher)
+        ssh_cipher_next_message(s->out.cipher);
 
     dts_consume(&s->stats->out, origlen + padding);
 }
 
+/*
+ * Encrypt and send all the packets waiting for the pipeline.
+ */
+static void ssh2_bpp_flush_batch(struct ssh2_bpp_state *s)
+{
+    size_t i;
+
+    if (!s->out_nbatch)
+        return;
+
+    ssh2_pipeline_run(s->out.pipeline, s->out_jobs, s->out_nbatch);
+    for (i = 0; i < s->out_nbatch; i++) {
+        bufchain_add(s->bpp.out_raw, s->out_batch[i]->data,
+                     s->out_batch[i]->length);
+        ssh_free_pktout(s->out_batch[i]);
+    }
+    s->out_nbatch = 0;
+}
+
+/*
+ * Send a packet ssh2_bpp_format_packet_inner has dealt with, and free
+ * it, or with a pipeline, add it to the batch.
+ */
+static void ssh2_bpp_send_packet(struct ssh2_bpp_state *s, PktOut *pkt)
+{
+    if (s->out.pipeline) {
+        s->out_batch[s->out_nbatch++] = pkt;
+        if (s->out_nbatch == SSH2_PIPELINE_MAXBATCH)
+            ssh2_bpp_flush_batch(s);
+    } else {
+        bufchain_add(s->bpp.out_raw, pkt->data, pkt->length);
+        ssh_free_pktout(pkt);
+    }
+}
+
+/* Takes ownership of pkt */
 static void ssh2_bpp_format_packet(struct ssh2_bpp_state *s, PktOut *pkt)
 {
     if (pkt->minlen > 0 && !s->out_comp) {
@@ -892,13 +1179,12 @@ static void ssh2_bpp_format_packet(struct ssh2_bpp_state *s, PktOut *pkt)
                 put_byte(ignore_pkt, 0);  /* make space for random padding */
             random_read(ignore_pkt->data + origlen, length);
             ssh2_bpp_format_packet_inner(s, ignore_pkt);
-            bufchain_add(s->bpp.out_raw, ignore_pkt->data, ignore_pkt->length);
-            ssh_free_pktout(ignore_pkt);
+            ssh2_bpp_send_packet(s, ignore_pkt);
         }
     }
 
     ssh2_bpp_format_packet_inner(s, pkt);
-    bufchain_add(s->bpp.out_raw, pkt->data, pkt->length);
+    ssh2_bpp_send_packet(s, pkt);
 }
 
 static void ssh2_bpp_handle_output(BinaryPacketProtocol *bpp)
@@ -963,7 +1249,6 @@ static void ssh2_bpp_handle_output(BinaryPacketProtocol *bpp)
             n_userauth--;
 
         ssh2_bpp_format_packet(s, pkt);
-        ssh_free_pktout(pkt);
 
         if (n_userauth == 0 && s->out.pending_compression && !s->is_server) {
             /*
@@ -974,9 +1259,11 @@ static void ssh2_bpp_handle_output(BinaryPacketProtocol *bpp)
              * until we see the reply.
              */
             s->pending_compression = true;
-            return;
+            break;
         } else if (type == SSH2_MSG_USERAUTH_SUCCESS && s->is_server) {
             ssh2_bpp_enable_pending_compression(s);
         }
     }
+
+    ssh2_bpp_flush_batch(s);
 }
@@ -6,11 +6,11 @@
 
 #include "putty.h"
 #include "ssh.h"
-#include "sshbpp.h"
+#include "bpp.h"
 #include "ssh/ppl.h"
 #include "ssh/channel.h"
 #include "sshcr.h"
-#include "ssh1connection.h"
+#include "connection1.h"
 #include "ssh/server.h"
 
 static size_t ssh1sesschan_write(SshChannel *c, bool is_stderr,
@@ -81,7 +81,9 @@ bool ssh1_handle_direction_specific_packet(
         s->finished_setup = true;
         return true;
 
-      case SSH1_CMSG_REQUEST_COMPRESSION:
+      case SSH1_CMSG_REQUEST_COMPRESSION: {
+        /* Compress at whatever level the client asked for. */
+        int level = get_uint32(pktin);
         if (s->compressing || !s->ssc->ssh1_allow_compression) {
             pktout = ssh_bpp_new_pktout(s->ppl.bpp, SSH1_SMSG_FAILURE);
             pq_push(s->ppl.out_pq, pktout);
@@ -94,11 +96,12 @@ bool ssh1_handle_direction_specific_packet(
             ssh_bpp_handle_output(s->ppl.bpp);
             /* And now ensure that the _next_ packet will be the first
              * compressed one. */
-            ssh1_bpp_start_compression(s->ppl.bpp);
+            ssh1_bpp_start_compression(s->ppl.bpp, level);
             s->compressing = true;
         }
 
         return true;
+      }
 
       case SSH1_CMSG_REQUEST_PTY: {
         if (s->finished_setup)
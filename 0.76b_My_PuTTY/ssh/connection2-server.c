@@ -6,7 +6,7 @@
 
 #include "putty.h"
 #include "ssh.h"
-#include "sshbpp.h"
+#include "bpp.h"
 #include "ssh/ppl.h"
 #include "ssh/channel.h"
 #include "sshcr.h"
@@ -161,6 +161,8 @@ static const SshChannelVtable ssh2channel_vtable = {
 static void ssh2_channel_check_close(struct ssh2_channel *c);
 static void ssh2_channel_try_eof(struct ssh2_channel *c);
 static void ssh2_set_window(struct ssh2_channel *c, int newwin);
+static void ssh2_channel_configure_window(struct ssh2_channel *c,
+                                          ptrlen type);
 static size_t ssh2_try_send(struct ssh2_channel *c);
 static void ssh2_try_send_and_unthrottle(struct ssh2_channel *c);
 static void ssh2_channel_check_throttle(struct ssh2_channel *c);
@@ -230,6 +232,7 @@ static void ssh2_channel_free(struct ssh2_channel *c)
         c->chanreq_head = c->chanreq_head->next;
         sfree(chanreq);
     }
+    c->connlayer->winbudget_used -= c->winbudget_used;
     if (c->chan) {
         struct ssh2_connection_state *s = c->connlayer;
         if (s->mainchan_sc == &c->sc) {
@@ -426,6 +429,7 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                 c->remmaxpkt = pktsize;
                 if (c->remmaxpkt > s->ppl.bpp->vt->packet_size_limit)
                     c->remmaxpkt = s->ppl.bpp->vt->packet_size_limit;
+                ssh2_channel_configure_window(c, type);
                 if (c->chan->initial_fixed_window_size) {
                     c->locwindow = c->locmaxwin = c->remlocwin =
                         c->chan->initial_fixed_window_size;
@@ -435,7 +439,7 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                 put_uint32(pktout, c->remoteid);
                 put_uint32(pktout, c->localid);
                 put_uint32(pktout, c->locwindow);
-                put_uint32(pktout, OUR_V2_MAXPKT); /* our max pkt size */
+                put_uint32(pktout, c->locmaxpkt); /* our max pkt size */
                 pq_push(s->ppl.out_pq, pktout);
             }
 
@@ -540,6 +544,7 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                     int bufsize;
                     c->locwindow -= data.len;
                     c->remlocwin -= data.len;
+                    c->winsample_bytes += data.len;
                     if (ext_type != 0 && ext_type != SSH2_EXTENDED_DATA_STDERR)
                         data.len = 0; /* ignore unknown extended data */
                     bufsize = chan_send(
@@ -560,9 +565,11 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                     /*
                      * If it looks like the remote end hit the end of
                      * its window, and we didn't want it to do that,
-                     * think about using a larger window.
+                     * think about using a larger window. (Auto-tuned
+                     * windows are grown in ssh2_channel_autotune
+                     * instead.)
                      */
-                    if (c->remlocwin <= 0 &&
+                    if (!c->autowin && c->remlocwin <= 0 &&
                         c->throttle_state == UNTHROTTLED &&
                         c->locmaxwin < 0x40000000)
                         c->locmaxwin += OUR_V2_WINSIZE;
@@ -858,10 +865,63 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
     }
 }
 
+/* What we remember about each winadj request until it's answered */
+struct winadj_request {
+    unsigned size;                     /* how far it opened the window */
+    unsigned long sent;                /* GETTICKCOUNT() when sent */
+};
+
+/*
+ * Use the round-trip time of a winadj request to resize an
+ * auto-tuned channel's window.
+ *
+ * The data received between two winadj replies, scaled to one round
+ * trip, is what the link delivered per round trip: if the window was
+ * what limited it, that's about the window size, so aiming for twice
+ * it doubles the window every round trip until the window is no
+ * longer the limit. Windows never shrink, since SSH-2 has no way to
+ * take back window we've already offered.
+ */
+static void ssh2_channel_autotune(struct ssh2_channel *c, unsigned long rtt)
+{
+    struct ssh2_connection_state *s = c->connlayer;
+    unsigned long now = GETTICKCOUNT(), interval = now - c->winsample_time;
+    uint64_t target;
+    int budget, grow;
+
+    if (rtt == 0)
+        rtt = 1;
+    if (interval < rtt)
+        return;                        /* not a whole round trip of data */
+    target = (uint64_t)c->winsample_bytes * 2 * rtt / interval;
+    c->winsample_time = now;
+    c->winsample_bytes = 0;
+
+    if (target > 0x40000000)
+        target = 0x40000000;
+    if (target <= (uint64_t)c->locmaxwin)
+        return;
+
+    /* The budget is configured in KB; keep the sum clear of INT_MAX */
+    budget = conf_get_int(s->conf, CONF_ssh_win_budget);
+    if (budget > 0x100000)
+        budget = 0x100000;
+    budget = budget * 1024 - s->winbudget_used;
+    grow = (int)(target - c->locmaxwin);
+    if (grow > budget)
+        grow = budget;
+    if (grow <= 0)
+        return;
+
+    c->locmaxwin += grow;
+    c->winbudget_used += grow;
+    s->winbudget_used += grow;
+}
+
 static void ssh2_handle_winadj_response(struct ssh2_channel *c,
                                         PktIn *pktin, void *ctx)
 {
-    unsigned *sizep = ctx;
+    struct winadj_request *wr = ctx;
 
     /*
      * Winadj responses should always be failures. However, at least
@@ -871,8 +931,10 @@ static void ssh2_handle_winadj_response(struct ssh2_channel *c,
      * life, we don't worry about what kind of response we got.
      */
 
-    c->remlocwin += *sizep;
-    sfree(sizep);
+    c->remlocwin += wr->size;
+    if (c->autowin)
+        ssh2_channel_autotune(c, GETTICKCOUNT() - wr->sent);
+    sfree(wr);
     /*
      * winadj messages are only sent when the window is fully open, so
      * if we get an ack of one, we know any pending unthrottle is
@@ -909,8 +971,8 @@ static void ssh2_set_window(struct ssh2_channel *c, int newwin)
      * window so that it has no choice (assuming it doesn't ignore the
      * window as well).
      */
-    if ((s->ppl.remote_bugs & BUG_SSH2_MAXPKT) && newwin > OUR_V2_MAXPKT)
-        newwin = OUR_V2_MAXPKT;
+    if ((s->ppl.remote_bugs & BUG_SSH2_MAXPKT) && newwin > c->locmaxpkt)
+        newwin = c->locmaxpkt;
 
     /*
      * Only send a WINDOW_ADJUST if there's significantly more window
@@ -921,7 +983,7 @@ static void ssh2_set_window(struct ssh2_channel *c, int newwin)
      */
     if (newwin / 2 >= c->locwindow) {
         PktOut *pktout;
-        unsigned *up;
+        struct winadj_request *wr;
 
         /*
          * In order to keep track of how much window the client
@@ -935,10 +997,11 @@ static void ssh2_set_window(struct ssh2_channel *c, int newwin)
          */
         if (newwin == c->locmaxwin &&
             !(s->ppl.remote_bugs & BUG_CHOKES_ON_WINADJ)) {
-            up = snew(unsigned);
-            *up = newwin - c->locwindow;
+            wr = snew(struct winadj_request);
+            wr->size = newwin - c->locwindow;
+            wr->sent = GETTICKCOUNT();
             pktout = ssh2_chanreq_init(c, "winadj@putty.projects.tartarus.org",
-                                       ssh2_handle_winadj_response, up);
+                                       ssh2_handle_winadj_response, wr);
             pq_push(s->ppl.out_pq, pktout);
 
             if (c->throttle_state != UNTHROTTLED)
@@ -1293,8 +1356,13 @@ void ssh2_channel_init(struct ssh2_channel *c)
     c->throttling_conn = false;
     c->throttled_by_backlog = false;
     c->sharectx = NULL;
-    c->locwindow = c->locmaxwin = c->remlocwin =
+    c->locwindow = c->locmaxwin = c->remlocwin = c->basewin =
         s->ssh_is_simple ? OUR_V2_BIGWIN : OUR_V2_WINSIZE;
+    c->locmaxpkt = OUR_V2_MAXPKT;
+    c->autowin = false;
+    c->winsample_time = GETTICKCOUNT();
+    c->winsample_bytes = 0;
+    c->winbudget_used = 0;
     c->chanreq_head = NULL;
     c->throttle_state = UNTHROTTLED;
     bufchain_init(&c->outbuffer);
@@ -1313,14 +1381,66 @@ PktOut *ssh2_chanopen_init(struct ssh2_channel *c, const char *type)
     struct ssh2_connection_state *s = c->connlayer;
     PktOut *pktout;
 
+    ssh2_channel_configure_window(c, ptrlen_from_asciz(type));
+
     pktout = ssh_bpp_new_pktout(s->ppl.bpp, SSH2_MSG_CHANNEL_OPEN);
     put_stringz(pktout, type);
     put_uint32(pktout, c->localid);
     put_uint32(pktout, c->locwindow);     /* our window size */
-    put_uint32(pktout, OUR_V2_MAXPKT);    /* our max pkt size */
+    put_uint32(pktout, c->locmaxpkt);     /* our max pkt size */
     return pktout;
 }
 
+/*
+ * Set up the window and maximum packet size we'll offer for a new
+ * channel, from what's configured for its type. Called just before we
+ * first tell the other side about them.
+ */
+static void ssh2_channel_configure_window(struct ssh2_channel *c,
+                                          ptrlen type)
+{
+    struct ssh2_connection_state *s = c->connlayer;
+    int winkey, pktkey, kb, maxpkt;
+
+    if (ptrlen_eq_string(type, "session")) {
+        winkey = CONF_ssh_win_session;
+        pktkey = CONF_ssh_maxpkt_session;
+    } else if (ptrlen_eq_string(type, "direct-tcpip") ||
+               ptrlen_eq_string(type, "forwarded-tcpip")) {
+        winkey = CONF_ssh_win_portfwd;
+        pktkey = CONF_ssh_maxpkt_portfwd;
+    } else if (ptrlen_eq_string(type, "x11")) {
+        winkey = CONF_ssh_win_x11;
+        pktkey = CONF_ssh_maxpkt_x11;
+    } else {
+        return;                        /* agent etc.: keep the defaults */
+    }
+
+    maxpkt = conf_get_int(s->conf, pktkey);
+    if (maxpkt > 0) {
+        if (maxpkt < 1024)
+            maxpkt = 1024;
+        if (maxpkt > OUR_V2_MAXPKT_LIMIT)
+            maxpkt = OUR_V2_MAXPKT_LIMIT;
+        c->locmaxpkt = maxpkt;
+    }
+
+    /* The only channel in a simple connection isn't flow-controlled */
+    if (s->ssh_is_simple)
+        return;
+
+    kb = conf_get_int(s->conf, winkey);
+    if (kb > 0) {
+        if (kb > 0x40000000 / 1024)
+            kb = 0x40000000 / 1024;
+        c->locwindow = c->locmaxwin = c->remlocwin = c->basewin = kb * 1024;
+    }
+
+    /* Auto-tuning needs winadj replies to time round trips with */
+    c->autowin = conf_get_bool(s->conf, CONF_ssh_win_autotune) &&
+        !(s->ppl.remote_bugs & BUG_CHOKES_ON_WINADJ);
+}
+
 /*
  * Construct the common parts of a CHANNEL_REQUEST.  If handler is not
  * NULL then a reply will be requested and the handler will be called
@@ -1445,14 +1565,16 @@ static void ssh2channel_x11_sharing_handover(
 static void ssh2channel_window_override_removed(SshChannel *sc)
 {
     struct ssh2_channel *c = container_of(sc, struct ssh2_channel, sc);
-    struct ssh2_connection_state *s = c->connlayer;
 
     /*
      * This function is called when a client-side Channel has just
-     * stopped requiring an initial fixed-size window.
+     * stopped requiring an initial fixed-size window. Go back to the
+     * window configured for the channel's type.
      */
     assert(!c->chan->initial_fixed_window_size);
-    ssh2_set_window(c, s->ssh_is_simple ? OUR_V2_BIGWIN : OUR_V2_WINSIZE);
+    if (c->locmaxwin < c->basewin)
+        c->locmaxwin = c->basewin;
+    ssh2_set_window(c, c->basewin);
 }
 
 static void ssh2channel_hint_channel_is_simple(SshChannel *sc)
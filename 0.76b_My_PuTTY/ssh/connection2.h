@@ -25,6 +25,7 @@ struct ssh2_connection_state {
 
     tree234 *channels;                 /* indexed by local id */
     bool all_channels_throttled;
+    int winbudget_used;                /* window added by auto-tuning */
 
     bool X11_fwd_enabled;
     tree234 *x11authtree;
@@ -109,6 +110,25 @@ struct ssh2_channel {
      */
     int remlocwin;
 
+    /*
+     * The window and maximum packet size we offered when the channel
+     * was opened, from the configuration for its type. locmaxwin
+     * starts at basewin and only grows from there.
+     */
+    int basewin;
+    unsigned locmaxpkt;
+
+    /*
+     * If autowin is set, locmaxwin is grown to about twice the
+     * bandwidth-delay product, measured as the data received between
+     * one winadj round trip and the next. winbudget_used is how much
+     * of the connection-wide budget for that this channel has taken.
+     */
+    bool autowin;
+    unsigned long winsample_time;
+    size_t winsample_bytes;
+    int winbudget_used;
+
     /*
      * These store the list of channel requests that we're waiting for
      * replies to. (CHANNEL_FAILURE doesn't come with any indication
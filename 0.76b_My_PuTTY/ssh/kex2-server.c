@@ -6,13 +6,13 @@
 
 #include "putty.h"
 #include "ssh.h"
-#include "sshbpp.h"
+#include "bpp.h"
 #include "ssh/ppl.h"
 #include "sshcr.h"
 #include "ssh/server.h"
 #include "sshkeygen.h"
 #include "storage.h"
-#include "ssh2transport.h"
+#include "transport2.h"
 #include "mpint.h"
 
 void ssh2_transport_provide_hostkeys(PacketProtocolLayer *ppl,
@@ -7,7 +7,7 @@
 #include "putty.h"
 #include "mpint.h"
 #include "ssh.h"
-#include "sshbpp.h"
+#include "bpp.h"
 #include "ssh/ppl.h"
 #include "sshcr.h"
 #include "ssh/server.h"
@@ -1141,7 +1141,7 @@ static void ssh1_login_process_queue(PacketProtocolLayer *ppl)
     if (conf_get_bool(s->conf, CONF_compression)) {
         ppl_logevent("Requesting compression");
         pkt = ssh_bpp_new_pktout(s->ppl.bpp, SSH1_CMSG_REQUEST_COMPRESSION);
-        put_uint32(pkt, 6);         /* gzip compression level */
+        put_uint32(pkt, conf_get_int(s->conf, CONF_compression_level));
         pq_push(s->ppl.out_pq, pkt);
         crMaybeWaitUntilV((pktin = ssh1_login_pop(s)) != NULL);
         if (pktin->type == SSH1_SMSG_SUCCESS) {
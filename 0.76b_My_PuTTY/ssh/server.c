@@ -7,13 +7,13 @@
 
 #include "putty.h"
 #include "ssh.h"
-#include "sshbpp.h"
+#include "bpp.h"
 #include "ssh/ppl.h"
 #include "ssh/channel.h"
 #include "ssh/server.h"
 #ifndef NO_GSSAPI
-#include "sshgssc.h"
-#include "sshgss.h"
+#include "ssh/gssc.h"
+#include "ssh/gss.h"
 #endif
 
 struct Ssh { int dummy; };
@@ -164,20 +164,22 @@ static void server_receive(
 
 static void server_sent(Plug *plug, size_t bufsize)
 {
-#ifdef FIXME
     server *srv = container_of(plug, server, plug);
 
     /*
      * If the send backlog on the SSH socket itself clears, we should
      * unthrottle the whole world if it was throttled. Also trigger an
      * extra call to the consumer of the BPP's output, to try to send
-     * some more data off its bufchain.
+     * some more data off its bufchain. (Without that, anything left
+     * in out_raw when the backlog went over the limit would never be
+     * sent at all.)
      */
     if (bufsize < SSH_MAX_BACKLOG) {
+#ifdef FIXME
         srv_throttle_all(srv, 0, bufsize);
+#endif
         queue_idempotent_callback(&srv->ic_out_raw);
     }
-#endif
 }
 
 LogContext *ssh_get_logctx(Ssh *ssh)
@@ -516,6 +518,8 @@ static void server_got_ssh_version(struct ssh_version_receiver *rcv,
         PacketProtocolLayer *userauth_layer, *transport_child_layer;
 
         srv->bpp = ssh2_bpp_new(srv->logctx, &srv->stats, true);
+        ssh2_bpp_set_crypto_threads(
+            srv->bpp, conf_get_int(srv->conf, CONF_ssh_crypto_threads));
         server_connect_bpp(srv);
 
         connection_layer = ssh2_connection_new(
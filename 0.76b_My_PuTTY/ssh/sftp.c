@@ -8,7 +8,7 @@
 #include <assert.h>
 #include <limits.h>
 
-#include "misc.h"
+#include "putty.h"
 #include "tree234.h"
 #include "sftp.h"
 
@@ -884,16 +884,186 @@ struct req {
     int len, retlen, complete;
     uint64_t offset;
     struct req *next, *prev;
+    unsigned long sent;                /* GETTICKCOUNT() when we sent it */
+    int shortlen;      /* for a gap-filling read, the short read before it */
+    struct fxp_xfer *xfer;
 };
 
 struct fxp_xfer {
-    uint64_t offset, furthestdata, filesize;
-    int req_totalsize, req_maxsize;
+    uint64_t offset, furthestdata, filesize, limit;
+    int req_totalsize, req_maxsize, req_count;
+    int max_req_count, max_req_totalsize;
     bool eof, err;
     struct fxp_handle *fh;
     struct req *head, *tail;
+    unsigned long rate_start;
+    uint64_t rate_bytes;
 };
 
+/*
+ * Pipelining policy. By default we keep 1Mb of 32Kb read requests
+ * outstanding during a download and write in 4Kb chunks, which is
+ * what PSFTP has always done. Those can be overridden, or autotuning
+ * can be enabled, in which case they're only a starting point: the
+ * read window is resized to twice the bandwidth-delay product we
+ * measure from the replies, and the read size doubles as long as the
+ * window can hold plenty of requests and the server keeps filling
+ * them. Either way, a read bigger than the default that comes back
+ * short is followed by one for the rest, and if that turns out not
+ * to be at EOF, the short read is taken to be the server telling us
+ * the largest read it's prepared to serve.
+ *
+ * Whatever we learn carries over into the next transfer in the same
+ * session, so that mget and pscp -r don't start from scratch on
+ * every file.
+ *
+ * With several transfers in progress at once (psftp -parallel), the
+ * autotuned window and its limit are for all of them together, and
+ * each gets an equal share (but never less than the default window),
+ * so that running more transfers doesn't multiply the memory used. A
+ * window set by hand without autotuning is for each transfer.
+ */
+#define XFER_DEFAULT_WINDOW 1048576
+#define XFER_DEFAULT_BLOCK 32768
+#define XFER_DEFAULT_UPLOAD_BLOCK 4096
+#define XFER_AUTOTUNE_WINDOW (64 << 20)
+#define XFER_AUTOTUNE_BLOCK (255 << 10) /* OpenSSH's sftp-server limit */
+#define XFER_MIN_BLOCK 512
+/* Must stay comfortably inside the packet size limit in sftp_recv() */
+#define XFER_MAX_BLOCK ((1 << 20) - 1024)
+
+static bool xfer_autotune = false;
+static int xfer_max_window = XFER_DEFAULT_WINDOW;
+static int xfer_max_block = XFER_DEFAULT_BLOCK;
+static int xfer_window = XFER_DEFAULT_WINDOW;
+static int xfer_block = XFER_DEFAULT_BLOCK;
+static int xfer_upload_block = XFER_DEFAULT_UPLOAD_BLOCK;
+static bool xfer_have_rtt = false;
+static unsigned long xfer_rtt;         /* smallest reply time seen */
+static int xfer_nactive = 0;           /* between xfer_init and cleanup */
+
+/* One transfer's share of a window for all the transfers in progress */
+static int xfer_share(int window)
+{
+    if (xfer_autotune && xfer_nactive > 1)
+        window = max(window / xfer_nactive, min(window, XFER_DEFAULT_WINDOW));
+    return window;
+}
+
+void xfer_set_pipeline(bool autotune, int window, int blocksize)
+{
+    if (window < 0)
+        window = 0;
+    if (blocksize > XFER_MAX_BLOCK)
+        blocksize = XFER_MAX_BLOCK;
+    else if (blocksize > 0 && blocksize < XFER_MIN_BLOCK)
+        blocksize = XFER_MIN_BLOCK;
+
+    xfer_autotune = autotune;
+    if (autotune) {
+        xfer_max_window = window ? window : XFER_AUTOTUNE_WINDOW;
+        xfer_max_block = blocksize ? blocksize : XFER_AUTOTUNE_BLOCK;
+        xfer_window = min(XFER_DEFAULT_WINDOW, xfer_max_window);
+        xfer_block = min(XFER_DEFAULT_BLOCK, xfer_max_block);
+        xfer_upload_block = blocksize ? blocksize : XFER_DEFAULT_BLOCK;
+    } else {
+        xfer_max_window = xfer_window = window ? window : XFER_DEFAULT_WINDOW;
+        xfer_max_block = xfer_block = blocksize ? blocksize : XFER_DEFAULT_BLOCK;
+        xfer_upload_block = blocksize ? blocksize : XFER_DEFAULT_UPLOAD_BLOCK;
+    }
+    xfer_have_rtt = false;
+}
+
+int xfer_max_blocksize(void)
+{
+    return max(xfer_block, xfer_max_block);
+}
+
+int xfer_upload_blocksize(void)
+{
+    return xfer_upload_block;
+}
+
+static void xfer_link_req(struct fxp_xfer *xfer, struct req *rr,
+                          struct req *prev)
+{
+    rr->prev = prev;
+    rr->next = prev ? prev->next : xfer->head;
+    if (rr->prev)
+        rr->prev->next = rr;
+    else
+        xfer->head = rr;
+    if (rr->next)
+        rr->next->prev = rr;
+    else
+        xfer->tail = rr;
+}
+
+static void xfer_req_sent(struct fxp_xfer *xfer, struct req *rr)
+{
+    rr->sent = GETTICKCOUNT();
+    xfer->req_totalsize += rr->len;
+    xfer->req_count++;
+    if (xfer->max_req_totalsize < xfer->req_totalsize)
+        xfer->max_req_totalsize = xfer->req_totalsize;
+    if (xfer->max_req_count < xfer->req_count)
+        xfer->max_req_count = xfer->req_count;
+}
+
+static void xfer_req_done(struct fxp_xfer *xfer, struct req *rr)
+{
+    xfer->req_totalsize -= rr->len;
+    xfer->req_count--;
+}
+
+/*
+ * Feed a reply into the autotuner. Every time we've spent at least
+ * one round trip (and not less than a tenth of a second) collecting
+ * data, resize the window to twice the product of the rate we saw
+ * and the smallest round trip time so far. While the window is the
+ * bottleneck, that doubles it each round; once the link is, it
+ * settles at enough to keep the link busy.
+ */
+static void xfer_autotune_reply(struct fxp_xfer *xfer, struct req *rr,
+                                int bytes)
+{
+    unsigned long now, rtt, elapsed;
+    uint64_t target, share;
+
+    if (!xfer_autotune)
+        return;
+
+    now = GETTICKCOUNT();
+    rtt = now - rr->sent;
+    if (!xfer_have_rtt || rtt < xfer_rtt) {
+        xfer_rtt = rtt;
+        xfer_have_rtt = true;
+    }
+
+    xfer->rate_bytes += bytes;
+    elapsed = now - xfer->rate_start;
+    if (elapsed == 0 || elapsed < xfer_rtt || elapsed < TICKSPERSEC / 10)
+        return;
+
+    target = 2 * xfer->rate_bytes * (xfer_rtt ? xfer_rtt : 1) / elapsed;
+    share = xfer_share(xfer_max_window);
+    if (target < XFER_DEFAULT_WINDOW)
+        target = XFER_DEFAULT_WINDOW;
+    if (target > share)
+        target = share;
+    xfer->req_maxsize = target;
+    /* Remember the total, for transfers starting later */
+    target *= (xfer_nactive > 1 ? xfer_nactive : 1);
+    xfer_window = min(target, (uint64_t)xfer_max_window);
+#ifdef DEBUG_DOWNLOAD
+    printf("rtt %lu, %"PRIu64" bytes in %lu ticks: window now %d\n",
+           xfer_rtt, xfer->rate_bytes, elapsed, xfer->req_maxsize);
+#endif
+
+    xfer->rate_bytes = 0;
+    xfer->rate_start = now;
+}
+
 static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
 {
     struct fxp_xfer *xfer = snew(struct fxp_xfer);
@@ -902,10 +1072,15 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576;
+    xfer_nactive++;
+    xfer->req_maxsize = xfer_share(xfer_window);
+    xfer->req_count = xfer->max_req_count = xfer->max_req_totalsize = 0;
     xfer->err = false;
     xfer->filesize = UINT64_MAX;
     xfer->furthestdata = 0;
+    xfer->limit = UINT64_MAX;
+    xfer->rate_start = GETTICKCOUNT();
+    xfer->rate_bytes = 0;
 
     return xfer;
 }
@@ -919,36 +1094,49 @@ bool xfer_done(struct fxp_xfer *xfer)
     return (xfer->eof || xfer->err) && !xfer->head;
 }
 
+static struct req *xfer_download_send(struct fxp_xfer *xfer,
+                                      struct req *prev,
+                                      uint64_t offset, int len)
+{
+    struct req *rr;
+    struct sftp_request *req;
+
+    rr = snew(struct req);
+    rr->offset = offset;
+    rr->complete = 0;
+    rr->shortlen = 0;
+    rr->xfer = xfer;
+    xfer_link_req(xfer, rr, prev);
+
+    rr->len = len;
+    rr->buffer = snewn(rr->len, char);
+    sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
+    fxp_set_userdata(req, rr);
+    xfer_req_sent(xfer, rr);
+
+    return rr;
+}
+
 void xfer_download_queue(struct fxp_xfer *xfer)
 {
     while (xfer->req_totalsize < xfer->req_maxsize &&
 	   !xfer->eof && !xfer->err) {
 	/*
-	 * Queue a new read request.
+	 * Queue a new read request, unless we've reached the end
+	 * of the range we were asked for.
 	 */
 	struct req *rr;
-	struct sftp_request *req;
-
-	rr = snew(struct req);
-	rr->offset = xfer->offset;
-	rr->complete = 0;
-	if (xfer->tail) {
-	    xfer->tail->next = rr;
-	    rr->prev = xfer->tail;
-	} else {
-	    xfer->head = rr;
-	    rr->prev = NULL;
-	}
-	xfer->tail = rr;
-	rr->next = NULL;
+        int len = xfer_block;
 
-	rr->len = 32768;
-	rr->buffer = snewn(rr->len, char);
-	sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
-	fxp_set_userdata(req, rr);
+        if (xfer->offset >= xfer->limit) {
+            xfer->eof = true;
+            break;
+        }
+        if (len > xfer->limit - xfer->offset)
+            len = xfer->limit - xfer->offset;
 
+	rr = xfer_download_send(xfer, xfer->tail, xfer->offset, len);
 	xfer->offset += rr->len;
-	xfer->req_totalsize += rr->len;
 
 #ifdef DEBUG_DOWNLOAD
         printf("queueing read request %p at %"PRIu64"\n", rr, rr->offset);
@@ -957,15 +1145,28 @@ void xfer_download_queue(struct fxp_xfer *xfer)
 }
 
 struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
+{
+    return xfer_download_init_range(fh, offset, UINT64_MAX);
+}
+
+struct fxp_xfer *xfer_download_init_range(struct fxp_handle *fh,
+                                          uint64_t offset, uint64_t limit)
 {
     struct fxp_xfer *xfer = xfer_init(fh, offset);
 
     xfer->eof = false;
+    xfer->limit = limit;
     xfer_download_queue(xfer);
 
     return xfer;
 }
 
+struct fxp_xfer *xfer_from_request(struct sftp_request *req)
+{
+    struct req *rr = (struct req *)fxp_get_userdata(req);
+    return rr ? rr->xfer : NULL;
+}
+
 /*
  * Returns INT_MIN to indicate that it didn't even get as far as
  * fxp_read_recv and hence has not freed pktin.
@@ -973,11 +1174,18 @@ struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_download_gotreply(xfer, rreq, pktin);
+}
+
+int xfer_download_gotreply(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                           struct sftp_packet *pktin)
+{
+    struct req *rr;
+
     rr = (struct req *)fxp_get_userdata(rreq);
     if (!rr) {
         fxp_internal_error("request ID is not part of the current download");
@@ -1003,6 +1211,29 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     }
 
     rr->complete = 1;
+    xfer_autotune_reply(xfer, rr, rr->retlen);
+
+    if (rr->retlen > 0 && rr->shortlen) {
+        /*
+         * The gap after a short read had data in it, so the short
+         * read wasn't EOF: it was the most the server will give us
+         * at once. Don't ask for more than that again, whether the
+         * block size was autotuned or set by hand.
+         */
+        xfer_max_block = rr->shortlen;
+        if (xfer_block > xfer_max_block)
+            xfer_block = xfer_max_block;
+#ifdef DEBUG_DOWNLOAD
+        printf("server read limit is %d\n", xfer_max_block);
+#endif
+    } else if (xfer_autotune && rr->retlen > 0 && rr->retlen == rr->len &&
+               rr->len == xfer_block && xfer_block < xfer_max_block &&
+               xfer->req_maxsize >= 16 * xfer_block) {
+        xfer_block = min(2 * xfer_block, xfer_max_block);
+#ifdef DEBUG_DOWNLOAD
+        printf("block size now %d\n", xfer_block);
+#endif
+    }
 
     /*
      * Special case: if we have received fewer bytes than we
@@ -1015,6 +1246,14 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
      * should be doing here - if it _was_ a special file, I suspect
      * I simply shouldn't have been queueing multiple requests in
      * the first place...
+     *
+     * A read bigger than the default, though, may be more than
+     * the server will return at once, whether the size was
+     * autotuned or set by hand. So for those (and for a gap that
+     * comes back short in its turn) we queue a read for the gap,
+     * and if that one hits EOF, it will settle the file size. A
+     * short read of the default size or less is still taken to be
+     * EOF, which saves a round trip at the end of every file.
      */
     if (rr->retlen > 0 && xfer->furthestdata < rr->offset) {
 	xfer->furthestdata = rr->offset;
@@ -1023,7 +1262,16 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 #endif
     }
 
-    if (rr->retlen < rr->len) {
+    if (rr->retlen > 0 && rr->retlen < rr->len &&
+        (rr->len > XFER_DEFAULT_BLOCK || rr->shortlen) && !xfer->err) {
+        struct req *gap = xfer_download_send(
+            xfer, rr, rr->offset + rr->retlen, rr->len - rr->retlen);
+        gap->shortlen = rr->retlen;
+#ifdef DEBUG_DOWNLOAD
+        printf("short block! queueing read request %p at %"PRIu64"\n",
+               gap, gap->offset);
+#endif
+    } else if (rr->retlen < rr->len) {
 	uint64_t filesize = rr->offset + (rr->retlen < 0 ? 0 : rr->retlen);
 #ifdef DEBUG_DOWNLOAD
 	printf("short block! trying filesize = %"PRIu64"\n", filesize);
@@ -1081,7 +1329,7 @@ bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
 	    xfer->head->prev = NULL;
 	else
 	    xfer->tail = NULL;
-	xfer->req_totalsize -= rr->len;
+	xfer_req_done(xfer, rr);
 	sfree(rr);
     }
 
@@ -1123,23 +1371,17 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
     rr = snew(struct req);
     rr->offset = xfer->offset;
     rr->complete = 0;
-    if (xfer->tail) {
-	xfer->tail->next = rr;
-	rr->prev = xfer->tail;
-    } else {
-	xfer->head = rr;
-	rr->prev = NULL;
-    }
-    xfer->tail = rr;
-    rr->next = NULL;
+    rr->shortlen = 0;
+    rr->xfer = xfer;
+    xfer_link_req(xfer, rr, xfer->tail);
 
     rr->len = len;
     rr->buffer = NULL;
     sftp_register(req = fxp_write_send(xfer->fh, buffer, rr->offset, len));
     fxp_set_userdata(req, rr);
+    xfer_req_sent(xfer, rr);
 
     xfer->offset += rr->len;
-    xfer->req_totalsize += rr->len;
 
 #ifdef DEBUG_UPLOAD
     printf("queueing write request %p at %"PRIu64" [len %d]\n",
@@ -1154,12 +1396,19 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
 int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
-    struct req *rr, *prev, *next;
-    bool ret;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
         return INT_MIN;            /* this packet doesn't even make sense */
+    return xfer_upload_gotreply(xfer, rreq, pktin);
+}
+
+int xfer_upload_gotreply(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                         struct sftp_packet *pktin)
+{
+    struct req *rr, *prev, *next;
+    bool ret;
+
     rr = (struct req *)fxp_get_userdata(rreq);
     if (!rr) {
         fxp_internal_error("request ID is not part of the current upload");
@@ -1169,6 +1418,8 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 #ifdef DEBUG_UPLOAD
     printf("write request %p has returned [%d]\n", rr, ret ? 1 : 0);
 #endif
+    if (ret)
+        xfer_autotune_reply(xfer, rr, rr->len);
 
     /*
      * Remove this one from the queue.
@@ -1183,7 +1434,7 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 	next->prev = prev;
     else
 	xfer->tail = prev;
-    xfer->req_totalsize -= rr->len;
+    xfer_req_done(xfer, rr);
     sfree(rr);
 
     if (!ret)
@@ -1192,6 +1443,24 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     return 1;
 }
 
+/*
+ * Describe how deep the pipeline got during a transfer, for the
+ * user's benefit. Call before xfer_cleanup.
+ */
+char *xfer_pipeline_summary(struct fxp_xfer *xfer)
+{
+    if (xfer_autotune && xfer_have_rtt)
+        return dupprintf("pipeline: up to %d requests / %d bytes in flight"
+                         ", block size %d, window %d, rtt %lums",
+                         xfer->max_req_count, xfer->max_req_totalsize,
+                         xfer_block, xfer->req_maxsize,
+                         xfer_rtt * 1000 / TICKSPERSEC);
+    return dupprintf("pipeline: up to %d requests / %d bytes in flight"
+                     ", block size %d, window %d",
+                     xfer->max_req_count, xfer->max_req_totalsize,
+                     xfer_block, xfer->req_maxsize);
+}
+
 void xfer_cleanup(struct fxp_xfer *xfer)
 {
     struct req *rr;
@@ -1201,5 +1470,6 @@ void xfer_cleanup(struct fxp_xfer *xfer)
 	sfree(rr->buffer);
 	sfree(rr);
     }
+    xfer_nactive--;
     sfree(xfer);
 }
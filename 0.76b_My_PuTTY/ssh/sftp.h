@@ -312,6 +312,38 @@ bool xfer_done(struct fxp_xfer *xfer);
 void xfer_set_error(struct fxp_xfer *xfer);
 void xfer_cleanup(struct fxp_xfer *xfer);
 
+/*
+ * For callers running several transfers over the channel at once.
+ * xfer_download_init_range reads only as far as `limit'.
+ * xfer_from_request says which transfer a request (as returned from
+ * sftp_find_request) belongs to, or NULL if it isn't part of one; the
+ * _gotreply functions are then like _gotpkt, but take the request
+ * the caller has already looked up.
+ */
+struct fxp_xfer *xfer_download_init_range(struct fxp_handle *fh,
+                                          uint64_t offset, uint64_t limit);
+struct fxp_xfer *xfer_from_request(struct sftp_request *req);
+int xfer_download_gotreply(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                           struct sftp_packet *pktin);
+int xfer_upload_gotreply(struct fxp_xfer *xfer, struct sftp_request *rreq,
+                         struct sftp_packet *pktin);
+
+/*
+ * Control the pipelining of transfers. With autotune false, `window'
+ * bytes of `blocksize'-byte read requests are kept in flight and
+ * uploads are sent in `blocksize' chunks; zero means the traditional
+ * default. With autotune true, both are adjusted on the fly, and
+ * nonzero values are ceilings.
+ *
+ * xfer_max_blocksize returns the most data a single download buffer
+ * can currently contain, and xfer_upload_blocksize the chunk size
+ * callers should pass to xfer_upload_data.
+ */
+void xfer_set_pipeline(bool autotune, int window, int blocksize);
+int xfer_max_blocksize(void);
+int xfer_upload_blocksize(void);
+char *xfer_pipeline_summary(struct fxp_xfer *xfer);
+
 /*
  * Vtable for the platform-specific filesystem implementation that
  * answers requests in an SFTP server.
@@ -207,6 +207,8 @@ static void ssh_got_ssh_version(struct ssh_version_receiver *rcv,
                 (conf_get_bool(ssh->conf, CONF_ssh_simple) && !ssh->connshare);
 
             ssh->bpp = ssh2_bpp_new(ssh->logctx, &ssh->stats, false);
+            ssh2_bpp_set_crypto_threads(
+                ssh->bpp, conf_get_int(ssh->conf, CONF_ssh_crypto_threads));
             ssh_connect_bpp(ssh);
 
 #ifndef NO_GSSAPI
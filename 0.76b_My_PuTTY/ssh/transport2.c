@@ -26,7 +26,7 @@ const static ssh2_macalg *const buggymacs[] = {
     &ssh_hmac_sha1_buggy, &ssh_hmac_sha1_96_buggy, &ssh_hmac_md5
 };
 
-static ssh_compressor *ssh_comp_none_init(void)
+static ssh_compressor *ssh_comp_none_init(int level)
 {
     return NULL;
 }
@@ -1435,7 +1435,8 @@ static void ssh2_transport_process_queue(PacketProtocolLayer *ppl)
             s->ppl.bpp,
             s->out.cipher, cipher_key->u, cipher_iv->u,
             s->out.mac, s->out.etm_mode, mac_key->u,
-            s->out.comp, s->out.comp_delayed);
+            s->out.comp, s->out.comp_delayed,
+            conf_get_int(s->conf, CONF_compression_level));
 
         strbuf_free(cipher_key);
         strbuf_free(cipher_iv);
@@ -18,7 +18,7 @@
 #define DH_MIN_SIZE 1024
 #define DH_MAX_SIZE 8192
 
-#define MAXKEXLIST 16
+#define MAXKEXLIST 24
 struct kexinit_algorithm {
     const char *name;
     union {
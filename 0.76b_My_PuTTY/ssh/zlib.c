@@ -60,15 +60,16 @@ struct LZ77Context {
 
 /*
  * Initialise the private fields of an LZ77Context. It's up to the
- * user to initialise the public fields.
+ * user to initialise the public fields. `level' runs from 1 (fastest)
+ * to 9 (best compression), as in zlib.
  */
-static int lz77_init(struct LZ77Context *ctx);
+static int lz77_init(struct LZ77Context *ctx, int level);
 
 /*
  * Supply data to be compressed. Will update the private fields of
  * the LZ77Context, and will call literal() and match() to output.
- * If `compress' is false, it will never emit a match, but will
- * instead call literal() for everything.
+ * Every byte supplied is accounted for by the time this returns, but
+ * the data remains in the window for later calls to match against.
  */
 static void lz77_compress(struct LZ77Context *ctx,
                           const unsigned char *data, int len);
@@ -77,51 +78,71 @@ static void lz77_compress(struct LZ77Context *ctx,
  * Modifiable parameters.
  */
 #define WINSIZE 32768                  /* window size. Must be power of 2! */
-#define HASHMAX 2039                   /* one more than max hash value */
-#define MAXMATCH 32                    /* how many matches we track */
+#define HASHBITS 15                    /* log2 of the hash table size */
 #define HASHCHARS 3                    /* how many chars make a hash */
+#define MAXMATCH 258                   /* longest match Deflate can send */
+#define TOOFAR 4096                    /* 3-byte matches further back than
+                                        * this cost more than literals */
 
 /*
- * This compressor takes a less slapdash approach than the
- * gzip/zlib one. Rather than allowing our hash chains to fall into
- * disuse near the far end, we keep them doubly linked so we can
- * _find_ the far end, and then every time we add a new byte to the
- * window (thus rolling round by one and removing the previous
- * byte), we can carefully remove the hash chain entry.
+ * The matcher keeps recent input in a buffer two windows long. A hash
+ * table maps each three-byte string to the most recent buffer
+ * position at which it occurred, and a chain array links every
+ * position to the previous one with the same hash. Nothing is ever
+ * unlinked: when the buffer fills, we slide its top half down over
+ * the bottom half and rebase every stored position, so that anything
+ * which has fallen out of the window turns into the end-of-chain
+ * marker. (Position 0 doubles as that marker, which costs us the odd
+ * match against the very first byte of a buffer; nobody will miss it.)
+ *
+ * How far we're prepared to walk down a chain, and how hard we try to
+ * improve on a match we've already got, are set by the compression
+ * level, using the same trade-offs as zlib does.
  */
-
-#define INVALID -1                     /* invalid hash _and_ invalid offset */
-struct WindowEntry {
-    short next, prev;                  /* array indices within the window */
-    short hashval;
-};
-
-struct HashEntry {
-    short first;                       /* window index of first in chain */
+#define BUFSIZE (2 * WINSIZE)
+#define HASHSIZE (1 << HASHBITS)
+#define LOOKAHEAD (MAXMATCH + HASHCHARS + 1)
+#define MAXDIST (WINSIZE - LOOKAHEAD)
+#define NIL 0
+
+struct LZ77Level {
+    int good;      /* once we have a match this long, search less hard */
+    int lazy;      /* don't look for a better match beyond this length */
+    int nice;      /* stop searching when we find a match this long */
+    int chain;     /* max number of hash chain entries to examine */
 };
 
-struct Match {
-    int distance, len;
+static const struct LZ77Level lz77_levels[] = {
+    {4, 4, 8, 4},                      /* 1: fastest */
+    {4, 5, 16, 8},
+    {4, 6, 32, 32},
+    {4, 4, 16, 16},
+    {8, 16, 32, 32},
+    {8, 16, 128, 128},                 /* 6: default */
+    {8, 32, 128, 256},
+    {32, 128, 258, 1024},
+    {32, 258, 258, 4096},              /* 9: best */
 };
 
 struct LZ77InternalContext {
-    struct WindowEntry win[WINSIZE];
-    unsigned char data[WINSIZE];
-    int winpos;
-    struct HashEntry hashtab[HASHMAX];
-    unsigned char pending[HASHCHARS];
-    int npending;
+    unsigned char data[BUFSIZE];
+    unsigned short head[HASHSIZE];     /* newest position for each hash */
+    unsigned short prev[WINSIZE];      /* previous position, same hash */
+    unsigned pos;                      /* next position to be encoded */
+    unsigned end;                      /* end of valid data */
+    unsigned inserted;                 /* next position to be hashed */
+    struct LZ77Level params;
 };
 
-static int lz77_hash(const unsigned char *data)
+static inline unsigned lz77_hash(const unsigned char *data)
 {
-    return (257 * data[0] + 263 * data[1] + 269 * data[2]) % HASHMAX;
+    uint32_t v = data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16);
+    return (uint32_t)(v * 0x9E3779B1U) >> (32 - HASHBITS);
 }
 
-static int lz77_init(struct LZ77Context *ctx)
+static int lz77_init(struct LZ77Context *ctx, int level)
 {
     struct LZ77InternalContext *st;
-    int i;
 
     st = snew(struct LZ77InternalContext);
     if (!st)
@@ -129,223 +150,225 @@ static int lz77_init(struct LZ77Context *ctx)
 
     ctx->ictx = st;
 
-    for (i = 0; i < WINSIZE; i++)
-        st->win[i].next = st->win[i].prev = st->win[i].hashval = INVALID;
-    for (i = 0; i < HASHMAX; i++)
-        st->hashtab[i].first = INVALID;
-    st->winpos = 0;
+    memset(st->head, 0, sizeof(st->head));
+    memset(st->prev, 0, sizeof(st->prev));
+    st->pos = st->end = st->inserted = 0;
 
-    st->npending = 0;
+    if (level < 1)
+        level = 1;
+    if (level > (int)lenof(lz77_levels))
+        level = lenof(lz77_levels);
+    st->params = lz77_levels[level - 1];
 
     return 1;
 }
 
-static void lz77_advance(struct LZ77InternalContext *st,
-                         unsigned char c, int hash)
+/*
+ * Add every position before `limit' to the hash chains, as far as
+ * we have enough data to hash.
+ */
+static void lz77_insert_upto(struct LZ77InternalContext *st, unsigned limit)
 {
-    int off;
+    unsigned p, hashable = (st->end >= HASHCHARS ?
+                            st->end - HASHCHARS + 1 : 0);
 
-    /*
-     * Remove the hash entry at winpos from the tail of its chain,
-     * or empty the chain if it's the only thing on the chain.
-     */
-    if (st->win[st->winpos].prev != INVALID) {
-        st->win[st->win[st->winpos].prev].next = INVALID;
-    } else if (st->win[st->winpos].hashval != INVALID) {
-        st->hashtab[st->win[st->winpos].hashval].first = INVALID;
+    if (limit > hashable)
+        limit = hashable;
+
+    for (p = st->inserted; p < limit; p++) {
+        unsigned hash = lz77_hash(st->data + p);
+        st->prev[p & (WINSIZE - 1)] = st->head[hash];
+        st->head[hash] = p;
     }
+    if (p > st->inserted)
+        st->inserted = p;
+}
 
-    /*
-     * Create a new entry at winpos and add it to the head of its
-     * hash chain.
-     */
-    st->win[st->winpos].hashval = hash;
-    st->win[st->winpos].prev = INVALID;
-    off = st->win[st->winpos].next = st->hashtab[hash].first;
-    st->hashtab[hash].first = st->winpos;
-    if (off != INVALID)
-        st->win[off].prev = st->winpos;
-    st->data[st->winpos] = c;
+/*
+ * Move the top half of the buffer down over the bottom half.
+ */
+static void lz77_slide(struct LZ77InternalContext *st)
+{
+    unsigned i;
 
-    /*
-     * Advance the window pointer.
-     */
-    st->winpos = (st->winpos + 1) & (WINSIZE - 1);
-}
+    lz77_insert_upto(st, st->pos);
+    assert(st->pos >= WINSIZE && st->inserted >= WINSIZE);
 
-#define CHARAT(k) ( (k)<0 ? st->data[(st->winpos+k)&(WINSIZE-1)] : data[k] )
+    memmove(st->data, st->data + WINSIZE, BUFSIZE - WINSIZE);
+    st->pos -= WINSIZE;
+    st->end -= WINSIZE;
+    st->inserted -= WINSIZE;
 
-static void lz77_compress(struct LZ77Context *ctx,
-                          const unsigned char *data, int len)
+    for (i = 0; i < HASHSIZE; i++)
+        st->head[i] = (st->head[i] >= WINSIZE ? st->head[i] - WINSIZE : NIL);
+    for (i = 0; i < WINSIZE; i++)
+        st->prev[i] = (st->prev[i] >= WINSIZE ? st->prev[i] - WINSIZE : NIL);
+}
+
+/*
+ * Search the hash chain for `pos' (which must already have been
+ * inserted) for a match longer than `prevlen'. Returns its length and
+ * fills in *distance, or returns 0 if there isn't one.
+ */
+static int lz77_longest_match(struct LZ77InternalContext *st, unsigned pos,
+                              int prevlen, int *distance)
 {
-    struct LZ77InternalContext *st = ctx->ictx;
-    int i, distance, off, nmatch, matchlen, advance;
-    struct Match defermatch, matches[MAXMATCH];
-    int deferchr;
+    const unsigned char *scan = st->data + pos;
+    unsigned limit = (pos > MAXDIST ? pos - MAXDIST : NIL);
+    unsigned cur = st->prev[pos & (WINSIZE - 1)];
+    int maxlen = st->end - pos, nice = st->params.nice;
+    int chain = st->params.chain, bestlen = prevlen, found = 0;
+
+    if (bestlen < HASHCHARS - 1)
+        bestlen = HASHCHARS - 1;
+    if (maxlen > MAXMATCH)
+        maxlen = MAXMATCH;
+    if (maxlen < HASHCHARS || bestlen >= maxlen)
+        return 0;
+    if (nice > maxlen)
+        nice = maxlen;
+    if (bestlen >= st->params.good)
+        chain >>= 2;
 
-    assert(st->npending <= HASHCHARS);
+    while (cur > limit && chain-- > 0) {
+        const unsigned char *m = st->data + cur;
 
-    /*
-     * Add any pending characters from last time to the window. (We
-     * might not be able to.)
-     *
-     * This leaves st->pending empty in the usual case (when len >=
-     * HASHCHARS); otherwise it leaves st->pending empty enough that
-     * adding all the remaining 'len' characters will not push it past
-     * HASHCHARS in size.
-     */
-    for (i = 0; i < st->npending; i++) {
-        unsigned char foo[HASHCHARS];
-        int j;
-        if (len + st->npending - i < HASHCHARS) {
-            /* Update the pending array. */
-            for (j = i; j < st->npending; j++)
-                st->pending[j - i] = st->pending[j];
-            break;
+        /*
+         * Check the byte that would make this match beat the best
+         * so far before bothering to compare the rest.
+         */
+        if (m[bestlen] == scan[bestlen] && m[0] == scan[0] &&
+            m[1] == scan[1]) {
+            int len = 2;
+            while (len < maxlen && m[len] == scan[len])
+                len++;
+            if (len > bestlen) {
+                found = 1;
+                bestlen = len;
+                *distance = pos - cur;
+                if (len >= nice)
+                    break;
+            }
         }
-        for (j = 0; j < HASHCHARS; j++)
-            foo[j] = (i + j < st->npending ? st->pending[i + j] :
-                      data[i + j - st->npending]);
-        lz77_advance(st, foo[0], lz77_hash(foo));
+        cur = st->prev[cur & (WINSIZE - 1)];
     }
-    st->npending -= i;
 
-    defermatch.distance = 0; /* appease compiler */
-    defermatch.len = 0;
-    deferchr = '\0';
-    while (len > 0) {
+    return found ? bestlen : 0;
+}
 
-        if (len >= HASHCHARS) {
-            /*
-             * Hash the next few characters.
-             */
-            int hash = lz77_hash(data);
+static void lz77_compress(struct LZ77Context *ctx,
+                          const unsigned char *data, int len)
+{
+    struct LZ77InternalContext *st = ctx->ictx;
+    int prevlen = 0, prevdist = 0;
+    bool deferred = false;      /* byte at pos-1 not yet emitted? */
 
-            /*
-             * Look the hash up in the corresponding hash chain and see
-             * what we can find.
-             */
-            nmatch = 0;
-            for (off = st->hashtab[hash].first;
-                 off != INVALID; off = st->win[off].next) {
-                /* distance = 1       if off == st->winpos-1 */
-                /* distance = WINSIZE if off == st->winpos   */
-                distance =
-                    WINSIZE - (off + WINSIZE - st->winpos) % WINSIZE;
-                for (i = 0; i < HASHCHARS; i++)
-                    if (CHARAT(i) != CHARAT(i - distance))
-                        break;
-                if (i == HASHCHARS) {
-                    matches[nmatch].distance = distance;
-                    matches[nmatch].len = 3;
-                    if (++nmatch >= MAXMATCH)
-                        break;
-                }
-            }
-        } else {
-            nmatch = 0;
+    while (1) {
+        unsigned stop;
+
+        /*
+         * Top up the buffer, and work out how far we can get without
+         * running short of lookahead. Once we've got all the input,
+         * we go right to the end.
+         */
+        if (len > 0) {
+            unsigned n;
+            if (st->end == BUFSIZE)
+                lz77_slide(st);
+            n = BUFSIZE - st->end;
+            if (n > (unsigned)len)
+                n = len;
+            memcpy(st->data + st->end, data, n);
+            st->end += n;
+            data += n;
+            len -= n;
         }
+        stop = (len > 0 ? st->end - LOOKAHEAD : st->end);
 
-        if (nmatch > 0) {
-            /*
-             * We've now filled up matches[] with nmatch potential
-             * matches. Follow them down to find the longest. (We
-             * assume here that it's always worth favouring a
-             * longer match over a shorter one.)
-             */
-            matchlen = HASHCHARS;
-            while (matchlen < len) {
-                int j;
-                for (i = j = 0; i < nmatch; i++) {
-                    if (CHARAT(matchlen) ==
-                        CHARAT(matchlen - matches[i].distance)) {
-                        matches[j++] = matches[i];
-                    }
-                }
-                if (j == 0)
-                    break;
-                matchlen++;
-                nmatch = j;
+        /*
+         * Lazy matching: having found a match at one position, we
+         * look at the next one too before committing, and if that
+         * gives a longer match we emit a single literal and go with
+         * the new one instead.
+         */
+        while (st->pos < stop) {
+            int curlen = 0, curdist = 0;
+
+            lz77_insert_upto(st, st->pos + 1);
+            if (prevlen < st->params.lazy) {
+                curlen = lz77_longest_match(st, st->pos, prevlen, &curdist);
+                if (curlen == HASHCHARS && curdist > TOOFAR)
+                    curlen = 0;
             }
 
-            /*
-             * We've now got all the longest matches. We favour the
-             * shorter distances, which means we go with matches[0].
-             * So see if we want to defer it or throw it away.
-             */
-            matches[0].len = matchlen;
-            if (defermatch.len > 0) {
-                if (matches[0].len > defermatch.len + 1) {
-                    /* We have a better match. Emit the deferred char,
-                     * and defer this match. */
-                    ctx->literal(ctx, (unsigned char) deferchr);
-                    defermatch = matches[0];
-                    deferchr = data[0];
-                    advance = 1;
-                } else {
-                    /* We don't have a better match. Do the deferred one. */
-                    ctx->match(ctx, defermatch.distance, defermatch.len);
-                    advance = defermatch.len - 1;
-                    defermatch.len = 0;
-                }
-            } else {
-                /* There was no deferred match. Defer this one. */
-                defermatch = matches[0];
-                deferchr = data[0];
-                advance = 1;
-            }
-        } else {
-            /*
-             * We found no matches. Emit the deferred match, if
-             * any; otherwise emit a literal.
-             */
-            if (defermatch.len > 0) {
-                ctx->match(ctx, defermatch.distance, defermatch.len);
-                advance = defermatch.len - 1;
-                defermatch.len = 0;
+            if (prevlen >= HASHCHARS && curlen == 0) {
+                ctx->match(ctx, prevdist, prevlen);
+                st->pos += prevlen - 1;
+                prevlen = 0;
+                deferred = false;
             } else {
-                ctx->literal(ctx, data[0]);
-                advance = 1;
+                if (deferred)
+                    ctx->literal(ctx, st->data[st->pos - 1]);
+                prevlen = curlen;
+                prevdist = curdist;
+                deferred = true;
+                st->pos++;
             }
         }
 
-        /*
-         * Now advance the position by `advance' characters,
-         * keeping the window and hash chains consistent.
-         */
-        while (advance > 0) {
-            if (len >= HASHCHARS) {
-                lz77_advance(st, *data, lz77_hash(data));
-            } else {
-                assert(st->npending < HASHCHARS);
-                st->pending[st->npending++] = *data;
-            }
-            data++;
-            len--;
-            advance--;
+        if (len == 0)
+            break;
+    }
+
+    if (deferred) {
+        if (prevlen >= HASHCHARS) {
+            ctx->match(ctx, prevdist, prevlen);
+            st->pos += prevlen - 1;
+        } else {
+            ctx->literal(ctx, st->data[st->pos - 1]);
         }
     }
 }
 
 /* ----------------------------------------------------------------------
- * Zlib compression. We always use the static Huffman tree option.
- * Mostly this is because it's hard to scan a block in advance to
- * work out better trees; dynamic trees are great when you're
- * compressing a large file under no significant time constraint,
- * but when you're compressing little bits in real time, things get
- * hairier.
- *
- * I suppose it's possible that I could compute Huffman trees based
- * on the frequencies in the _previous_ block, as a sort of
- * heuristic, but I'm not confident that the gain would balance out
- * having to transmit the trees.
+ * Zlib compression. The LZ77 output for each block is buffered, and
+ * when the block is complete we send it using whichever of the
+ * static Huffman trees or a set of dynamic trees built from the
+ * block's own symbol frequencies comes out shorter. Interactive
+ * traffic mostly stays with the static trees, since a dynamic tree
+ * header costs several dozen bytes that a short packet never earns
+ * back; bulk data (file transfers, big screen updates) gains a good
+ * deal from the dynamic ones.
  */
 
+#define SYMBUFSIZE 16384               /* LZ77 symbols per Deflate block */
+#define NLITLEN 286                    /* literal/length alphabet */
+#define NFIXEDLITLEN 288               /* ... as laid out in the static tree */
+#define NDIST 30                       /* distance alphabet */
+#define NCODELEN 19                    /* code length alphabet */
+
 struct Outbuf {
     strbuf *outbuf;
     unsigned long outbits;
     int noutbits;
     bool firstblock;
+
+    /*
+     * The current block's LZ77 output. A literal is stored as the
+     * byte value with distance 0; a match as its length and distance.
+     */
+    unsigned short syms[SYMBUFSIZE], dists[SYMBUFSIZE];
+    int nsyms;
+    unsigned litfreq[NLITLEN], distfreq[NDIST];
+
+    /* Lookup tables from match length and distance to code number. */
+    unsigned char lencode[MAXMATCH + 1], distcode[512];
+
+    /* The static trees, in the same form as we build dynamic ones. */
+    unsigned char fixedlitlens[NFIXEDLITLEN];
+    unsigned short fixedlitcodes[NFIXEDLITLEN];
+    unsigned char fixeddistlens[NDIST];
+    unsigned short fixeddistcodes[NDIST];
 };
 
 static void outbits(struct Outbuf *out, unsigned long bits, int nbits)
@@ -465,107 +488,315 @@ static const coderecord distcodes[] = {
     {29, 13, 24577, 32768},
 };
 
+static void zlib_flush_block(struct Outbuf *out);
+
 static void zlib_literal(struct LZ77Context *ectx, unsigned char c)
 {
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
 
-    if (c <= 143) {
-        /* 0 through 143 are 8 bits long starting at 00110000. */
-        outbits(out, mirrorbytes[0x30 + c], 8);
-    } else {
-        /* 144 through 255 are 9 bits long starting at 110010000. */
-        outbits(out, 1 + 2 * mirrorbytes[0x90 - 144 + c], 9);
-    }
+    out->syms[out->nsyms] = c;
+    out->dists[out->nsyms] = 0;
+    out->litfreq[c]++;
+    if (++out->nsyms == SYMBUFSIZE)
+        zlib_flush_block(out);
+}
+
+static inline int zlib_distcode(struct Outbuf *out, int distance)
+{
+    /*
+     * Distance codes above 256 all cover whole multiples of 128, so
+     * the second half of the table can be indexed coarsely.
+     */
+    return (distance <= 256 ? out->distcode[distance - 1] :
+            out->distcode[256 + ((distance - 1) >> 7)]);
 }
 
 static void zlib_match(struct LZ77Context *ectx, int distance, int len)
 {
-    const coderecord *d, *l;
-    int i, j, k;
     struct Outbuf *out = (struct Outbuf *) ectx->userdata;
 
-    while (len > 0) {
-        int thislen;
+    assert(len >= HASHCHARS && len <= MAXMATCH);
+    assert(distance >= 1 && distance <= WINSIZE);
 
-        /*
-         * We can transmit matches of lengths 3 through 258
-         * inclusive. So if len exceeds 258, we must transmit in
-         * several steps, with 258 or less in each step.
-         *
-         * Specifically: if len >= 261, we can transmit 258 and be
-         * sure of having at least 3 left for the next step. And if
-         * len <= 258, we can just transmit len. But if len == 259
-         * or 260, we must transmit len-3.
-         */
-        thislen = (len > 260 ? 258 : len <= 258 ? len : len - 3);
-        len -= thislen;
+    out->syms[out->nsyms] = len;
+    out->dists[out->nsyms] = distance;
+    out->litfreq[lencodes[out->lencode[len]].code]++;
+    out->distfreq[distcodes[zlib_distcode(out, distance)].code]++;
+    if (++out->nsyms == SYMBUFSIZE)
+        zlib_flush_block(out);
+}
 
-        /*
-         * Binary-search to find which length code we're
-         * transmitting.
-         */
-        i = -1;
-        j = lenof(lencodes);
-        while (1) {
-            assert(j - i >= 2);
-            k = (j + i) / 2;
-            if (thislen < lencodes[k].min)
-                j = k;
-            else if (thislen > lencodes[k].max)
-                i = k;
-            else {
-                l = &lencodes[k];
-                break;                 /* found it! */
+/*
+ * Reverse the bottom `nbits' bits of a Huffman code, since Deflate
+ * sends codes most significant bit first but packs everything else
+ * least significant bit first.
+ */
+static inline unsigned zlib_bitrev(unsigned code, int nbits)
+{
+    return ((mirrorbytes[code & 0xFF] << 8) | mirrorbytes[code >> 8])
+        >> (16 - nbits);
+}
+
+static int zlib_freqcmp(const void *av, const void *bv)
+{
+    unsigned a = *(const unsigned *)av, b = *(const unsigned *)bv;
+    return a < b ? -1 : a > b ? +1 : 0;
+}
+
+/*
+ * Build Huffman code lengths for the given symbol frequencies, none
+ * longer than `limit'. If the ideal tree is too deep, we flatten the
+ * frequency distribution and try again, which converges quickly and
+ * costs very little in practice.
+ *
+ * Deflate decoders don't all cope with a tree containing fewer than
+ * two codes, so if there's only one symbol (or none) in use we make
+ * up the numbers with a dummy.
+ */
+static void zlib_huffman_lengths(const unsigned *freqs, int nsyms,
+                                 int limit, unsigned char *lengths)
+{
+    unsigned keys[NLITLEN], weight[2 * NLITLEN];
+    int parent[2 * NLITLEN];
+    unsigned char depth[2 * NLITLEN];
+    int shift, i, n;
+
+    assert(nsyms <= NLITLEN);
+
+    for (shift = 0;; shift++) {
+        int leaf, node, next, maxdepth;
+
+        n = 0;
+        for (i = 0; i < nsyms; i++) {
+            lengths[i] = 0;
+            if (freqs[i]) {
+                unsigned f = freqs[i] >> shift;
+                keys[n++] = ((f ? f : 1) << 9) | i;
             }
         }
 
+        if (n < 2) {
+            int sym = (n ? keys[0] & 511 : 0);
+            lengths[sym] = 1;
+            lengths[sym ? 0 : 1] = 1;
+            return;
+        }
+
         /*
-         * Transmit the length code. 256-279 are seven bits
-         * starting at 0000000; 280-287 are eight bits starting at
-         * 11000000.
+         * Two-queue construction: leaves sorted by weight in one
+         * queue, and internal nodes, which come out of the process
+         * in non-decreasing order of weight, in the other.
          */
-        if (l->code <= 279) {
-            outbits(out, mirrorbytes[(l->code - 256) * 2], 7);
+        qsort(keys, n, sizeof(*keys), zlib_freqcmp);
+        for (i = 0; i < n; i++)
+            weight[i] = keys[i] >> 9;
+        leaf = 0;
+        node = n;
+        for (next = n; next < 2 * n - 1; next++) {
+            int a, b;
+            a = (leaf < n && (node >= next || weight[leaf] <= weight[node]) ?
+                 leaf++ : node++);
+            b = (leaf < n && (node >= next || weight[leaf] <= weight[node]) ?
+                 leaf++ : node++);
+            weight[next] = weight[a] + weight[b];
+            parent[a] = parent[b] = next;
+        }
+
+        depth[2 * n - 2] = 0;
+        for (i = 2 * n - 3; i >= 0; i--)
+            depth[i] = depth[parent[i]] + 1;
+
+        maxdepth = 0;
+        for (i = 0; i < n; i++) {
+            lengths[keys[i] & 511] = depth[i];
+            if (maxdepth < depth[i])
+                maxdepth = depth[i];
+        }
+        if (maxdepth <= limit)
+            return;
+    }
+}
+
+/*
+ * Assign canonical Huffman codes (RFC1951 section 3.2.2) to a set of
+ * code lengths, pre-reversed ready for outbits().
+ */
+static void zlib_huffman_codes(const unsigned char *lengths, int nsyms,
+                               unsigned short *codes)
+{
+    int count[16], next[16], code, i;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < nsyms; i++)
+        count[lengths[i]]++;
+    count[0] = 0;
+
+    code = 0;
+    for (i = 1; i < 16; i++) {
+        code = (code + count[i - 1]) << 1;
+        next[i] = code;
+    }
+
+    for (i = 0; i < nsyms; i++)
+        codes[i] = (lengths[i] ? zlib_bitrev(next[lengths[i]]++, lengths[i])
+                    : 0);
+}
+
+/*
+ * Send the buffered symbols using a given pair of trees, followed by
+ * the end-of-block code.
+ */
+static void zlib_write_symbols(
+    struct Outbuf *out,
+    const unsigned char *litlens, const unsigned short *litcodes,
+    const unsigned char *distlens, const unsigned short *distcodes_)
+{
+    int i;
+
+    for (i = 0; i < out->nsyms; i++) {
+        int sym = out->syms[i], distance = out->dists[i];
+
+        if (!distance) {
+            outbits(out, litcodes[sym], litlens[sym]);
         } else {
-            outbits(out, mirrorbytes[0xc0 - 280 + l->code], 8);
+            const coderecord *l = &lencodes[out->lencode[sym]];
+            const coderecord *d = &distcodes[zlib_distcode(out, distance)];
+
+            outbits(out, litcodes[l->code], litlens[l->code]);
+            if (l->extrabits)
+                outbits(out, sym - l->min, l->extrabits);
+            outbits(out, distcodes_[d->code], distlens[d->code]);
+            if (d->extrabits)
+                outbits(out, distance - d->min, d->extrabits);
         }
+    }
 
-        /*
-         * Transmit the extra bits.
-         */
-        if (l->extrabits)
-            outbits(out, thislen - l->min, l->extrabits);
+    outbits(out, litcodes[256], litlens[256]);
+}
 
-        /*
-         * Binary-search to find which distance code we're
-         * transmitting.
-         */
-        i = -1;
-        j = lenof(distcodes);
-        while (1) {
-            assert(j - i >= 2);
-            k = (j + i) / 2;
-            if (distance < distcodes[k].min)
-                j = k;
-            else if (distance > distcodes[k].max)
-                i = k;
-            else {
-                d = &distcodes[k];
-                break;                 /* found it! */
+/*
+ * Send everything buffered so far as a complete Deflate block.
+ */
+static void zlib_flush_block(struct Outbuf *out)
+{
+    static const unsigned char lenlenmap[NCODELEN] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    static const unsigned char lenlenextra[3] = { 2, 3, 7 };
+
+    unsigned char litlens[NLITLEN], distlens[NDIST], lenlens[NCODELEN];
+    unsigned short litcodes[NLITLEN], distcodes_[NDIST], lencodes_[NCODELEN];
+    unsigned char lens[NLITLEN + NDIST];
+    unsigned char lensyms[NLITLEN + NDIST], lenextra[NLITLEN + NDIST];
+    unsigned lenfreq[NCODELEN];
+    unsigned long fixedbits, dynbits;
+    int hlit, hdist, hclen, nlens, nlensyms, i;
+
+    out->litfreq[256] = 1;             /* end of block */
+
+    zlib_huffman_lengths(out->litfreq, NLITLEN, 15, litlens);
+    zlib_huffman_lengths(out->distfreq, NDIST, 15, distlens);
+
+    for (hlit = NLITLEN; hlit > 257 && !litlens[hlit - 1]; hlit--);
+    for (hdist = NDIST; hdist > 1 && !distlens[hdist - 1]; hdist--);
+    memcpy(lens, litlens, hlit);
+    memcpy(lens + hlit, distlens, hdist);
+    nlens = hlit + hdist;
+
+    /*
+     * Run-length encode the two sets of code lengths, as one
+     * sequence, into the code length alphabet: 16 repeats the
+     * previous length 3-6 times, 17 and 18 give runs of 3-10 and
+     * 11-138 zeroes.
+     */
+    memset(lenfreq, 0, sizeof(lenfreq));
+    nlensyms = 0;
+    for (i = 0; i < nlens;) {
+        int run = 1;
+        while (i + run < nlens && lens[i + run] == lens[i])
+            run++;
+
+        if (lens[i] == 0 && run >= 3) {
+            if (run > 138)
+                run = 138;
+            lensyms[nlensyms] = (run >= 11 ? 18 : 17);
+            lenextra[nlensyms++] = run - (run >= 11 ? 11 : 3);
+        } else {
+            lensyms[nlensyms++] = lens[i];
+            if (lens[i] != 0 && run >= 4) {
+                if (run > 7)
+                    run = 7;
+                lensyms[nlensyms] = 16;
+                lenextra[nlensyms++] = run - 1 - 3;
+            } else {
+                run = 1;
             }
         }
+        i += run;
+    }
+    for (i = 0; i < nlensyms; i++)
+        lenfreq[lensyms[i]]++;
+
+    zlib_huffman_lengths(lenfreq, NCODELEN, 7, lenlens);
+    for (hclen = NCODELEN; hclen > 4 && !lenlens[lenlenmap[hclen - 1]];
+         hclen--);
+
+    /*
+     * Work out which way is cheaper. The extra bits on lengths and
+     * distances come to the same either way, so we leave them out.
+     */
+    fixedbits = dynbits = 0;
+    for (i = 0; i < NLITLEN; i++) {
+        fixedbits += (unsigned long)out->litfreq[i] * out->fixedlitlens[i];
+        dynbits += (unsigned long)out->litfreq[i] * litlens[i];
+    }
+    for (i = 0; i < NDIST; i++) {
+        fixedbits += (unsigned long)out->distfreq[i] * 5;
+        dynbits += (unsigned long)out->distfreq[i] * distlens[i];
+    }
+    dynbits += 5 + 5 + 4 + 3 * hclen;
+    for (i = 0; i < NCODELEN; i++)
+        dynbits += (unsigned long)lenfreq[i] *
+            (lenlens[i] + (i >= 16 ? lenlenextra[i - 16] : 0));
+
+    if (dynbits < fixedbits) {
+        zlib_huffman_codes(litlens, NLITLEN, litcodes);
+        zlib_huffman_codes(distlens, NDIST, distcodes_);
+        zlib_huffman_codes(lenlens, NCODELEN, lencodes_);
 
         /*
-         * Transmit the distance code. Five bits starting at 00000.
+         * Start a Deflate dynamic-trees block: BFINAL=0, BTYPE=10
+         * (which comes out as 100 in the order we send it), then the
+         * tree sizes, the code length tree, and the code lengths.
          */
-        outbits(out, mirrorbytes[d->code * 8], 5);
+        outbits(out, 4, 3);
+        outbits(out, hlit - 257, 5);
+        outbits(out, hdist - 1, 5);
+        outbits(out, hclen - 4, 4);
+        for (i = 0; i < hclen; i++)
+            outbits(out, lenlens[lenlenmap[i]], 3);
+        for (i = 0; i < nlensyms; i++) {
+            int sym = lensyms[i];
+            outbits(out, lencodes_[sym], lenlens[sym]);
+            if (sym >= 16)
+                outbits(out, lenextra[i], lenlenextra[sym - 16]);
+        }
 
+        zlib_write_symbols(out, litlens, litcodes, distlens, distcodes_);
+    } else {
         /*
-         * Transmit the extra bits.
+         * Start a Deflate fixed-trees block. We transmit a zero bit
+         * (BFINAL=0), followed by a zero bit and a one bit
+         * (BTYPE=01). Of course these are in the wrong order (01 0).
          */
-        if (d->extrabits)
-            outbits(out, distance - d->min, d->extrabits);
+        outbits(out, 2, 3);
+        zlib_write_symbols(out, out->fixedlitlens, out->fixedlitcodes,
+                           out->fixeddistlens, out->fixeddistcodes);
     }
+
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
 }
 
 struct ssh_zlib_compressor {
@@ -573,12 +804,13 @@ struct ssh_zlib_compressor {
     ssh_compressor sc;
 };
 
-ssh_compressor *zlib_compress_init(void)
+ssh_compressor *zlib_compress_init(int level)
 {
     struct Outbuf *out;
     struct ssh_zlib_compressor *comp = snew(struct ssh_zlib_compressor);
+    int i, j;
 
-    lz77_init(&comp->ectx);
+    lz77_init(&comp->ectx, level);
     comp->sc.vt = &ssh_zlib;
     comp->ectx.literal = zlib_literal;
     comp->ectx.match = zlib_match;
@@ -587,6 +819,32 @@ ssh_compressor *zlib_compress_init(void)
     out->outbuf = NULL;
     out->outbits = out->noutbits = 0;
     out->firstblock = true;
+    out->nsyms = 0;
+    memset(out->litfreq, 0, sizeof(out->litfreq));
+    memset(out->distfreq, 0, sizeof(out->distfreq));
+
+    for (i = 0; i < lenof(lencodes); i++)
+        for (j = lencodes[i].min; j <= lencodes[i].max; j++)
+            out->lencode[j] = i;
+    for (i = 0; i < lenof(distcodes); i++)
+        for (j = distcodes[i].min; j <= distcodes[i].max; j++) {
+            if (j <= 256)
+                out->distcode[j - 1] = i;
+            else
+                out->distcode[256 + ((j - 1) >> 7)] = i;
+        }
+
+    /*
+     * The static literal/length tree has 0-143 in 8 bits, 144-255 in
+     * 9, 256-279 in 7 and 280-287 in 8. Distances are all 5 bits.
+     */
+    for (i = 0; i < NFIXEDLITLEN; i++)
+        out->fixedlitlens[i] = (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    for (i = 0; i < NDIST; i++)
+        out->fixeddistlens[i] = 5;
+    zlib_huffman_codes(out->fixedlitlens, NFIXEDLITLEN, out->fixedlitcodes);
+    zlib_huffman_codes(out->fixeddistlens, NDIST, out->fixeddistcodes);
+
     comp->ectx.userdata = out;
 
     return &comp->sc;
@@ -599,7 +857,9 @@ void zlib_compress_cleanup(ssh_compressor *sc)
     struct Outbuf *out = (struct Outbuf *)comp->ectx.userdata;
     if (out->outbuf)
         strbuf_free(out->outbuf);
+    smemclr(out, sizeof(*out));
     sfree(out);
+    smemclr(comp->ectx.ictx, sizeof(*comp->ectx.ictx));
     sfree(comp->ectx.ictx);
     sfree(comp);
 }
@@ -612,7 +872,6 @@ void zlib_compress_block(ssh_compressor *sc,
     struct ssh_zlib_compressor *comp =
         container_of(sc, struct ssh_zlib_compressor, sc);
     struct Outbuf *out = (struct Outbuf *) comp->ectx.userdata;
-    bool in_block;
 
     assert(!out->outbuf);
     out->outbuf = strbuf_new_nm();
@@ -625,32 +884,21 @@ void zlib_compress_block(ssh_compressor *sc,
     if (out->firstblock) {
         outbits(out, 0x9C78, 16);
         out->firstblock = false;
-
-        in_block = false;
-    } else
-        in_block = true;
-
-    if (!in_block) {
-        /*
-         * Start a Deflate (RFC1951) fixed-trees block. We
-         * transmit a zero bit (BFINAL=0), followed by a zero
-         * bit and a one bit (BTYPE=01). Of course these are in
-         * the wrong order (01 0).
-         */
-        outbits(out, 2, 3);
     }
 
     /*
-     * Do the compression.
+     * Do the compression. This may send some complete blocks along
+     * the way if the input is large; whatever is left over goes out
+     * now as the last block for this packet.
      */
     lz77_compress(&comp->ectx, block, len);
+    if (out->nsyms > 0)
+        zlib_flush_block(out);
 
     /*
-     * End the block (by transmitting code 256, which is
-     * 0000000 in fixed-tree mode), and transmit some empty
-     * blocks to ensure we have emitted the byte containing the
-     * last piece of genuine data. There are three ways we can
-     * do this:
+     * Now we must make sure we have emitted the byte containing the
+     * last piece of genuine data. There are three ways we can do
+     * this:
      *
      *  - Minimal flush. Output end-of-block and then open a
      *    new static block. This takes 9 bits, which is
@@ -666,21 +914,20 @@ void zlib_compress_block(ssh_compressor *sc,
      *    boundary, then send bytes 00 00 FF FF). Then open the
      *    new block.
      *
-     * For the moment, we will use Zlib partial flush.
+     * For the moment, we will use Zlib partial flush. Since we can't
+     * know what kind of block the next packet will want until we
+     * see it, we don't leave one open: the blocks above have
+     * already been closed, and the next packet opens its own.
      */
-    outbits(out, 0, 7);        /* close block */
     outbits(out, 2, 3 + 7);    /* empty static block */
-    outbits(out, 2, 3);        /* open new block */
 
     /*
      * If we've been asked to pad out the compressed data until it's
      * at least a given length, do so by emitting further empty static
      * blocks.
      */
-    while (out->outbuf->len < minlen) {
-        outbits(out, 0, 7);            /* close block */
-        outbits(out, 2, 3);            /* open new static block */
-    }
+    while (out->outbuf->len < minlen)
+        outbits(out, 2, 3 + 7);
 
     *outlen = out->outbuf->len;
     *outblock = (unsigned char *)strbuf_to_str(out->outbuf);
@@ -688,9 +935,9 @@ void zlib_compress_block(ssh_compressor *sc,
 }
 
 /* ----------------------------------------------------------------------
- * Zlib decompression. Of course, even though our compressor always
- * uses static trees, our _decompressor_ has to be capable of
- * handling dynamic trees if it sees them.
+ * Zlib decompression. This has to cope with anything a general
+ * Deflate implementation might send us, not just what our own
+ * compressor produces.
  */
 
 /*
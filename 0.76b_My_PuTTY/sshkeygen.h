@@ -67,6 +67,18 @@ void pcs_ready(PrimeCandidateSource *s);
  * course. */
 mp_int *pcs_generate(PrimeCandidateSource *s);
 
+/* Generate a whole batch of candidates at once, for a caller that will
+ * test them in parallel. They come from a random run of PCS_BATCH_WIDTH
+ * consecutive values of the internal cofactor, sieved together, which
+ * makes it cheap to also rule out every prime below PCS_SIEVE_LIMIT
+ * rather than just the smallprimes[] array; they're returned in a
+ * random order. The return value is the number of candidates written
+ * into the new array *out (which you must free, along with everything
+ * in it). A return of 0 means a one-shot source has been used up. */
+#define PCS_BATCH_WIDTH 4096
+#define PCS_SIEVE_LIMIT (1U << 20)
+size_t pcs_generate_batch(PrimeCandidateSource *s, mp_int ***out);
+
 /* Free a PrimeCandidateSource. */
 void pcs_free(PrimeCandidateSource *s);
 
@@ -106,6 +118,14 @@ unsigned miller_rabin_checks_needed(unsigned bits);
  * that proves the number to be composite. */
 mp_int *miller_rabin_find_potential_primitive_root(MillerRabin *mr);
 
+/* Versions of the two functions above that get their random witness
+ * values from a caller-supplied source instead of random_read. */
+typedef void (*MillerRabinRandomFn)(void *ctx, void *out, size_t len);
+bool miller_rabin_test_random_from(MillerRabin *mr,
+                                   MillerRabinRandomFn rf, void *ctx);
+mp_int *miller_rabin_find_potential_primitive_root_from(
+    MillerRabin *mr, MillerRabinRandomFn rf, void *ctx);
+
 /* ----------------------------------------------------------------------
  * A system for proving numbers to be prime, using the Pocklington
  * test, which requires knowing a partial factorisation of p-1
@@ -234,6 +254,48 @@ extern const ProgressReceiverVtable null_progress_vt;
 /* A helper function for dreaming up progress cost estimates. */
 double estimate_modexp_cost(unsigned bits);
 
+/* ----------------------------------------------------------------------
+ * Parallel search for a prime, used by the prime generation policies
+ * below when they've been allowed more than one thread. Candidates
+ * from a PrimeCandidateSource are tested several at a time, and the
+ * search returns the first one in the batch's order that passes, not
+ * whichever one happens to finish first. Each candidate's witnesses
+ * come from its own stream seeded from random_read when the search
+ * starts, so the result depends only on what random_read returns,
+ * not on the number of threads or how they were scheduled.
+ */
+
+typedef struct PrimeSearch PrimeSearch;
+
+/* Set the number of threads (counting the caller) that prime
+ * generation may use, or 0 for one per CPU. The default, 1, uses the
+ * original serial loop in prime.c and never starts a thread. */
+void primegen_set_threads(unsigned nthreads);
+unsigned primegen_get_threads(void);
+
+/* Use a PrimeSearch even on one thread, so that timings for every
+ * thread count include the same sieving (for benchmarks). */
+void primegen_set_search_always(bool always);
+
+/* Whether a PrimeSearch is worth using for this PrimeCandidateSource. */
+bool primesearch_wanted(PrimeCandidateSource *pcs);
+
+/* Make a search over the (ready) PrimeCandidateSource, which remains
+ * owned by the caller. With want_witness false, a candidate passes if
+ * it survives 'nchecks' Miller-Rabin tests; with it true, a candidate
+ * passes if miller_rabin_find_potential_primitive_root finds it a
+ * witness, which is then returned alongside it. */
+PrimeSearch *primesearch_new(PrimeCandidateSource *pcs, unsigned nchecks,
+                             bool want_witness);
+
+/* Return the next candidate to pass, or NULL if the source runs out.
+ * 'prog' (if not NULL) has report_attempt called once per candidate
+ * rejected or returned, from the calling thread only. */
+mp_int *primesearch_next(PrimeSearch *ps, ProgressReceiver *prog,
+                         mp_int **witness_out);
+
+void primesearch_free(PrimeSearch *ps);
+
 /* ----------------------------------------------------------------------
  * The top-level API for generating primes.
  */
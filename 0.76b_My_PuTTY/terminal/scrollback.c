@@ -0,0 +1,965 @@
+/*
+ * scrollback.c: storage for the lines that have scrolled off the top
+ * of the terminal.
+ *
+ * terminal.c hands us each line already run-length encoded by
+ * compressline(), typically a few dozen bytes. Rather than keeping
+ * every one of those in an allocation of its own, we pack them into
+ * blocks of SB_BLOCK_LINES lines. The newest block is open: its lines
+ * sit end to end in one growable buffer, with a table of where each
+ * one starts. When it fills up it is sealed, which compresses the
+ * whole block as a unit with a small LZ77 codec. Scrollback tends to
+ * repeat itself from line to line (prompts, log prefixes, columns of
+ * numbers) in a way that the per-line RLE can't see and the LZ pass
+ * can.
+ *
+ * Every block but the newest holds exactly SB_BLOCK_LINES lines, and
+ * lines are only ever removed from the two ends, so finding line n is
+ * a division. The oldest block may have had some of its lines
+ * discarded already; `skip' counts those, and the block is freed
+ * once it has none left.
+ *
+ * Reading a line from a sealed block means decompressing the whole
+ * block. We keep the last few decompressed blocks around, because
+ * do_paint asks for the lines of the scrollback a screenful at a
+ * time, and they nearly always come from the same one or two blocks;
+ * a search or a big copy to the clipboard walks through them in
+ * order.
+ *
+ * Optionally, the memory taken by the blocks can be limited. Once
+ * it's over the limit, the oldest sealed blocks are moved out to a
+ * temporary file provided by the platform, and mapped back in when
+ * someone wants to read them. Since the oldest blocks are always the
+ * ones to go, the blocks on disk are always a prefix of the array.
+ * The file is managed with a simple first-fit list of free extents;
+ * blocks are freed in much the same order as they were written, so
+ * the space at the front of the file is reused long before it has had
+ * a chance to fragment.
+ *
+ * To make searching cheap, each block also has a Bloom filter of the
+ * trigrams (ignoring case) in its lines, filled in by terminal.c as it
+ * adds them, and a search only has to decompress the blocks whose
+ * filter has all the trigrams of what it's looking for. The open
+ * block's filter is as big as any block could need; when the block is
+ * sealed, the filter is folded down to suit the number of distinct
+ * trigrams it actually got, which for ordinary text is a few bits a
+ * trigram. Filters count towards the memory limit, and go out to the
+ * spill file along with their blocks. A line removed from the end
+ * leaves its trigrams behind in the filter, which does no harm beyond
+ * the odd false positive.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <wctype.h>
+
+#include "putty.h"
+#include "terminal.h"
+
+#define SB_BLOCK_LINES 256
+#define SB_CACHE_BLOCKS 8
+#define SB_FILTER_MAXBITS 131072       /* an open block's filter, 16Kb */
+#define SB_FILTER_MINBITS 512
+
+typedef struct SbBlock SbBlock;
+struct SbBlock {
+    unsigned nlines;
+    bool sealed;
+    /* Until the block is sealed, its lines' trigrams may not all be
+     * in its filter yet, so scrollback_add seals the last block when
+     * it starts the next one rather than as soon as it's full. */
+
+    /*
+     * In an open block, `data' holds the lines end to end, and line i
+     * occupies offsets[i] up to offsets[i+1].
+     *
+     * In a sealed block, `data' holds the compressed form of a
+     * buffer in which the length of each line (as a 7-bit varint) is
+     * followed by all the lines end to end, and which is `rawlen'
+     * bytes long. If compression didn't make it any smaller, it's
+     * stored as it is, with `lz' false.
+     *
+     * A sealed block can also be `spilled', in which case `data' is
+     * NULL and its `len' bytes are at `fileoff' in the spill file,
+     * followed by its filter, if it has one, with `filter' NULL.
+     */
+    unsigned char *data;
+    size_t len, size;
+    size_t rawlen;
+    bool lz, spilled;
+    uint64_t fileoff;
+    uint32_t *offsets;
+    uint32_t *filter;
+    size_t filterbits;                 /* a power of 2, or 0 if no filter */
+};
+
+/* A decompressed sealed block */
+typedef struct SbCache {
+    SbBlock *blk;                      /* NULL if this entry is unused */
+    unsigned long used;                /* for finding the LRU entry */
+    unsigned char *data;
+    size_t size;
+    uint32_t offsets[SB_BLOCK_LINES + 1];
+} SbCache;
+
+typedef struct SbExtent {
+    uint64_t off, len;
+} SbExtent;
+
+struct Scrollback {
+    SbBlock **blocks;
+    size_t nblocks, blocksize;
+    unsigned skip;                     /* lines gone from blocks[0] */
+    int count;
+
+    SbCache cache[SB_CACHE_BLOCKS];
+    unsigned long cacheclock;
+
+    size_t memory;                     /* bytes allocated for blocks */
+    size_t limit;                      /* most `memory' we want, or 0 */
+
+    /*
+     * The spill file, if we've needed one. blocks[0..nspilled) are
+     * in it. `freelist' holds the unused extents below `fileend',
+     * sorted by offset and never adjacent to each other.
+     */
+    SpillFile *spill;
+    bool spill_failed;
+    size_t nspilled;
+    SbExtent *freelist;
+    size_t nfree, freesize;
+    uint64_t fileend;
+};
+
+/* ----------------------------------------------------------------------
+ * The block compressor. This is a byte-oriented LZ77 in the style of
+ * LZ4: it makes no attempt to find the best match, only to find
+ * matches quickly, and decompression is little more than memcpy.
+ *
+ * The compressed data is a sequence of records, each consisting of
+ *
+ *  - a token byte, whose high nibble is the number of literal bytes
+ *    and whose low nibble is the match length minus SB_MINMATCH (in
+ *    each case 15 means that the number continues in further bytes,
+ *    each added on, up to and including the first which isn't 255)
+ *  - the literal bytes
+ *  - a two-byte little-endian match offset, back from the current
+ *    output position, and the rest of the match length if any.
+ *
+ * The last record has only literals, and ends the data.
+ */
+
+#define SB_MINMATCH 4
+#define SB_HASHBITS 12
+#define SB_MAXOFFSET 65535
+
+static inline uint32_t sb_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline unsigned sb_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - SB_HASHBITS);
+}
+
+static void sb_put_length(strbuf *out, size_t n)
+{
+    while (n >= 255) {
+        put_byte(out, 255);
+        n -= 255;
+    }
+    put_byte(out, n);
+}
+
+static void sb_put_record(strbuf *out, const unsigned char *lit,
+                          size_t litlen, size_t offset, size_t matchlen)
+{
+    size_t ml = matchlen ? matchlen - SB_MINMATCH : 0;
+
+    put_byte(out, ((litlen < 15 ? litlen : 15) << 4) | (ml < 15 ? ml : 15));
+    if (litlen >= 15)
+        sb_put_length(out, litlen - 15);
+    put_data(out, lit, litlen);
+    if (matchlen) {
+        put_byte(out, offset & 0xFF);
+        put_byte(out, offset >> 8);
+        if (ml >= 15)
+            sb_put_length(out, ml - 15);
+    }
+}
+
+static void sb_compress(const unsigned char *in, size_t len, strbuf *out)
+{
+    uint32_t table[1 << SB_HASHBITS];  /* position + 1, or 0 for none */
+    size_t i = 0, anchor = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (i + SB_MINMATCH <= len) {
+        uint32_t v = sb_read32(in + i);
+        unsigned h = sb_hash(v);
+        size_t cand = table[h];
+
+        table[h] = i + 1;
+        if (cand && i - (cand - 1) <= SB_MAXOFFSET &&
+            sb_read32(in + cand - 1) == v) {
+            size_t m = cand - 1, matchlen = SB_MINMATCH;
+
+            while (i + matchlen < len && in[m + matchlen] == in[i + matchlen])
+                matchlen++;
+            sb_put_record(out, in + anchor, i - anchor, i - m, matchlen);
+            i += matchlen;
+            anchor = i;
+
+            /* Make the end of the match findable as well */
+            if (i >= 2 && i - 2 + SB_MINMATCH <= len)
+                table[sb_hash(sb_read32(in + i - 2))] = i - 2 + 1;
+        } else {
+            i++;
+        }
+    }
+
+    sb_put_record(out, in + anchor, len - anchor, 0, 0);
+}
+
+static size_t sb_get_length(BinarySource *src, size_t n)
+{
+    if (n == 15) {
+        unsigned byte;
+        do {
+            byte = get_byte(src);
+            n += byte;
+        } while (byte == 255 && !get_err(src));
+    }
+    return n;
+}
+
+static void sb_decompress(const unsigned char *in, size_t len,
+                          unsigned char *out, size_t outlen)
+{
+    BinarySource src[1];
+    size_t pos = 0;
+
+    BinarySource_BARE_INIT(src, in, len);
+
+    while (true) {
+        unsigned token = get_byte(src);
+        size_t litlen = sb_get_length(src, token >> 4);
+        ptrlen lit = get_data(src, litlen);
+        size_t offset, matchlen;
+
+        assert(!get_err(src));
+        assert(lit.len <= outlen - pos);
+        memcpy(out + pos, lit.ptr, lit.len);
+        pos += lit.len;
+
+        if (!get_avail(src))
+            break;
+
+        offset = get_byte(src);
+        offset |= get_byte(src) << 8;
+        matchlen = sb_get_length(src, token & 15) + SB_MINMATCH;
+        assert(!get_err(src));
+        assert(offset > 0 && offset <= pos);
+        assert(matchlen <= outlen - pos);
+
+        /* The match may overlap its own output, so copy bytewise */
+        {
+            const unsigned char *from = out + pos - offset;
+            unsigned char *to = out + pos;
+            size_t n = matchlen;
+            if (offset >= n) {
+                memcpy(to, from, n);
+            } else {
+                while (n--)
+                    *to++ = *from++;
+            }
+        }
+        pos += matchlen;
+    }
+
+    assert(pos == outlen);
+}
+
+/* ----------------------------------------------------------------------
+ * Space in the spill file.
+ */
+
+static uint64_t sb_file_alloc(Scrollback *sb, uint64_t len)
+{
+    uint64_t off;
+    size_t i;
+
+    for (i = 0; i < sb->nfree; i++) {
+        SbExtent *ext = &sb->freelist[i];
+        if (ext->len >= len) {
+            off = ext->off;
+            ext->off += len;
+            ext->len -= len;
+            if (!ext->len) {
+                sb->nfree--;
+                memmove(ext, ext + 1, (sb->nfree - i) * sizeof(SbExtent));
+            }
+            return off;
+        }
+    }
+
+    off = sb->fileend;
+    sb->fileend += len;
+    return off;
+}
+
+static void sb_file_release(Scrollback *sb, uint64_t off, uint64_t len)
+{
+    size_t i;
+
+    /* Find the first free extent after this one */
+    for (i = 0; i < sb->nfree && sb->freelist[i].off < off; i++);
+
+    /* Merge with the free extents either side, if they touch */
+    if (i < sb->nfree && sb->freelist[i].off == off + len) {
+        len += sb->freelist[i].len;
+        sb->nfree--;
+        memmove(sb->freelist + i, sb->freelist + i + 1,
+                (sb->nfree - i) * sizeof(SbExtent));
+    }
+    if (i > 0 && sb->freelist[i-1].off + sb->freelist[i-1].len == off) {
+        i--;
+        off = sb->freelist[i].off;
+        len += sb->freelist[i].len;
+        sb->nfree--;
+        memmove(sb->freelist + i, sb->freelist + i + 1,
+                (sb->nfree - i) * sizeof(SbExtent));
+    }
+
+    if (off + len == sb->fileend) {
+        /* Free space at the end of the file just goes back to it */
+        sb->fileend = off;
+    } else {
+        sgrowarray(sb->freelist, sb->freesize, sb->nfree);
+        memmove(sb->freelist + i + 1, sb->freelist + i,
+                (sb->nfree - i) * sizeof(SbExtent));
+        sb->freelist[i].off = off;
+        sb->freelist[i].len = len;
+        sb->nfree++;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Trigram filters. Each trigram sets two bits, taken from two
+ * different hashes of it, modulo the size of the filter. Since the
+ * size is a power of 2, halving a filter is a matter of ORing its top
+ * half onto its bottom half, which gives just the filter we'd have
+ * got by making it at the smaller size in the first place.
+ */
+
+static inline wchar_t sb_fold(wchar_t c)
+{
+    if (c < 0x80)
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    return towlower(c);
+}
+
+static inline uint32_t sb_trigram(wchar_t a, wchar_t b, wchar_t c)
+{
+    uint32_t h = (uint32_t)a * 0x9E3779B1U;
+    h = (h ^ (uint32_t)b) * 0x85EBCA77U;
+    h = (h ^ (uint32_t)c) * 0xC2B2AE3DU;
+    return h ^ (h >> 15);
+}
+
+#define SB_FILTER_BIT1(h, bits) ((h) & ((bits) - 1))
+#define SB_FILTER_BIT2(h, bits) (((h) * 0x7FEB352DU >> 15) & ((bits) - 1))
+
+static inline bool sb_filter_test(const uint32_t *filter, unsigned bit)
+{
+    return (filter[bit / 32] >> (bit % 32)) & 1;
+}
+
+static inline unsigned sb_popcount(uint32_t x)
+{
+    x = x - ((x >> 1) & 0x55555555U);
+    x = (x & 0x33333333U) + ((x >> 2) & 0x33333333U);
+    x = (x + (x >> 4)) & 0x0F0F0F0FU;
+    return (x * 0x01010101U) >> 24;
+}
+
+/*
+ * Once a block has all its trigrams, halve its filter for as long as
+ * that leaves no more than half the bits set. Any more full than that
+ * and a search for a short string would stop being able to skip many
+ * blocks.
+ */
+static void sb_filter_shrink(Scrollback *sb, SbBlock *blk)
+{
+    size_t oldbits = blk->filterbits, words, i, set;
+
+    if (!blk->filter)
+        return;
+
+    while (blk->filterbits > SB_FILTER_MINBITS) {
+        words = blk->filterbits / 64;
+        for (i = set = 0; i < words; i++)
+            set += sb_popcount(blk->filter[i] | blk->filter[i + words]);
+        if (set > words * 32 / 2)
+            break;
+        for (i = 0; i < words; i++)
+            blk->filter[i] |= blk->filter[i + words];
+        blk->filterbits /= 2;
+    }
+
+    if (blk->filterbits < oldbits) {
+        smemclr(blk->filter + blk->filterbits / 32,
+                (oldbits - blk->filterbits) / 8);
+        blk->filter = sresize(blk->filter, blk->filterbits / 32, uint32_t);
+        sb->memory -= (oldbits - blk->filterbits) / 8;
+    }
+}
+
+/*
+ * Make a shrunk filter full size again, for a block that's had to be
+ * reopened. Every bit of the big filter is a copy of the one it
+ * would fold onto, so nothing already in it is lost.
+ */
+static void sb_filter_grow(Scrollback *sb, SbBlock *blk)
+{
+    size_t oldwords = blk->filterbits / 32, i;
+    uint32_t *filter;
+
+    if (!blk->filter || blk->filterbits == SB_FILTER_MAXBITS)
+        return;
+
+    filter = snewn(SB_FILTER_MAXBITS / 32, uint32_t);
+    for (i = 0; i < SB_FILTER_MAXBITS / 32; i++)
+        filter[i] = blk->filter[i % oldwords];
+    sb->memory += (SB_FILTER_MAXBITS - blk->filterbits) / 8;
+    smemclr(blk->filter, oldwords * 4);
+    sfree(blk->filter);
+    blk->filter = filter;
+    blk->filterbits = SB_FILTER_MAXBITS;
+}
+
+/* ----------------------------------------------------------------------
+ * The cache of decompressed blocks.
+ */
+
+static void sb_cache_forget(Scrollback *sb, SbBlock *blk)
+{
+    size_t i;
+
+    for (i = 0; i < SB_CACHE_BLOCKS; i++)
+        if (sb->cache[i].blk == blk)
+            sb->cache[i].blk = NULL;
+}
+
+static void sb_cache_free(Scrollback *sb)
+{
+    size_t i;
+
+    for (i = 0; i < SB_CACHE_BLOCKS; i++) {
+        SbCache *c = &sb->cache[i];
+        /* Scrollback can be private, so don't leave it lying around */
+        smemclr(c->data, c->size);
+        sfree(c->data);
+        c->data = NULL;
+        c->size = 0;
+        c->blk = NULL;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Blocks.
+ */
+
+static SbBlock *sb_block_new(Scrollback *sb)
+{
+    SbBlock *blk = snew(SbBlock);
+
+    blk->nlines = 0;
+    blk->sealed = false;
+    blk->lz = false;
+    blk->spilled = false;
+    blk->fileoff = 0;
+    blk->data = NULL;
+    blk->len = blk->size = blk->rawlen = 0;
+    blk->offsets = snewn(SB_BLOCK_LINES + 1, uint32_t);
+    blk->offsets[0] = 0;
+    blk->filter = NULL;
+    blk->filterbits = 0;
+
+    sb->memory += sizeof(SbBlock) + (SB_BLOCK_LINES + 1) * sizeof(uint32_t);
+    return blk;
+}
+
+static void sb_block_free(Scrollback *sb, SbBlock *blk)
+{
+    sb_cache_forget(sb, blk);
+
+    if (blk->spilled)
+        sb_file_release(sb, blk->fileoff, blk->len + blk->filterbits / 8);
+
+    sb->memory -= sizeof(SbBlock) + blk->size;
+    if (blk->offsets)
+        sb->memory -= (SB_BLOCK_LINES + 1) * sizeof(uint32_t);
+    if (blk->filter)
+        sb->memory -= blk->filterbits / 8;
+
+    smemclr(blk->data, blk->size);
+    sfree(blk->data);
+    sfree(blk->offsets);
+    sfree(blk->filter);
+    sfree(blk);
+}
+
+/*
+ * Move the oldest block that's still in memory out to the spill
+ * file. Returns false if that can't be done.
+ */
+static bool sb_block_spill(Scrollback *sb)
+{
+    SbBlock *blk;
+    size_t filterlen;
+
+    if (sb->spill_failed || sb->nspilled >= sb->nblocks)
+        return false;
+    blk = sb->blocks[sb->nspilled];
+    if (!blk->sealed)
+        return false;
+
+    if (!sb->spill) {
+        sb->spill = spill_file_new();
+        if (!sb->spill) {
+            sb->spill_failed = true;
+            return false;
+        }
+    }
+
+    filterlen = blk->filterbits / 8;
+    blk->fileoff = sb_file_alloc(sb, blk->len + filterlen);
+    if (!spill_file_write(sb->spill, blk->fileoff, blk->data, blk->len) ||
+        (filterlen && !spill_file_write(sb->spill, blk->fileoff + blk->len,
+                                        blk->filter, filterlen))) {
+        /* Keep everything in memory from now on */
+        sb_file_release(sb, blk->fileoff, blk->len + filterlen);
+        sb->spill_failed = true;
+        return false;
+    }
+
+    sb->memory -= blk->size + filterlen;
+    smemclr(blk->data, blk->size);
+    sfree(blk->data);
+    blk->data = NULL;
+    blk->size = 0;
+    smemclr(blk->filter, filterlen);
+    sfree(blk->filter);
+    blk->filter = NULL;
+    blk->spilled = true;
+    sb->nspilled++;
+    return true;
+}
+
+static void sb_enforce_limit(Scrollback *sb)
+{
+    while (sb->limit && sb->memory > sb->limit)
+        if (!sb_block_spill(sb))
+            break;
+}
+
+static void sb_block_seal(Scrollback *sb, SbBlock *blk)
+{
+    strbuf *raw = strbuf_new_nm(), *packed = strbuf_new_nm();
+    unsigned i;
+
+    assert(!blk->sealed);
+
+    for (i = 0; i < blk->nlines; i++) {
+        size_t n = blk->offsets[i+1] - blk->offsets[i];
+        while (n >= 128) {
+            put_byte(raw, (n & 0x7F) | 0x80);
+            n >>= 7;
+        }
+        put_byte(raw, n);
+    }
+    put_data(raw, blk->data, blk->len);
+
+    sb_compress(raw->u, raw->len, packed);
+
+    sb->memory -= blk->size + (SB_BLOCK_LINES + 1) * sizeof(uint32_t);
+    smemclr(blk->data, blk->size);
+    sfree(blk->data);
+    sfree(blk->offsets);
+    blk->offsets = NULL;
+
+    blk->rawlen = raw->len;
+    blk->lz = packed->len < raw->len;
+    if (blk->lz) {
+        blk->len = blk->size = packed->len;
+        blk->data = snewn(blk->size, unsigned char);
+        memcpy(blk->data, packed->u, packed->len);
+    } else {
+        blk->len = blk->size = raw->len;
+        blk->data = snewn(blk->size, unsigned char);
+        memcpy(blk->data, raw->u, raw->len);
+    }
+    blk->sealed = true;
+    sb->memory += blk->size;
+    sb_filter_shrink(sb, blk);
+
+    strbuf_free(raw);
+    strbuf_free(packed);
+
+    sb_enforce_limit(sb);
+}
+
+/*
+ * Make a sealed block's contents available in the cache, and return
+ * the cache entry. The entry's offsets are of the start of each line
+ * in its data, with one more for the end of the last.
+ */
+static SbCache *sb_block_load(Scrollback *sb, SbBlock *blk)
+{
+    BinarySource src[1];
+    const unsigned char *packed;
+    SbCache *c = NULL;
+    size_t i;
+
+    assert(blk->sealed);
+    for (i = 0; i < SB_CACHE_BLOCKS; i++) {
+        if (sb->cache[i].blk == blk) {
+            c = &sb->cache[i];
+            c->used = ++sb->cacheclock;
+            return c;
+        }
+        if (!c || !sb->cache[i].blk ||
+            (c->blk && sb->cache[i].used < c->used))
+            c = &sb->cache[i];
+    }
+
+    if (c->size < blk->rawlen) {
+        smemclr(c->data, c->size);
+        sfree(c->data);
+        c->size = blk->rawlen + blk->rawlen / 4;
+        c->data = snewn(c->size, unsigned char);
+    }
+
+    if (blk->spilled) {
+        packed = spill_file_map(sb->spill, blk->fileoff, blk->len);
+        if (!packed)
+            modalfatalbox("Unable to read scrollback back from its "
+                          "temporary file");
+    } else {
+        packed = blk->data;
+    }
+    if (blk->lz)
+        sb_decompress(packed, blk->len, c->data, blk->rawlen);
+    else
+        memcpy(c->data, packed, blk->rawlen);
+
+    /*
+     * Read the line lengths at the front, and turn them into offsets
+     * relative to the start of the data.
+     */
+    BinarySource_BARE_INIT(src, c->data, blk->rawlen);
+    for (i = 0; i < blk->nlines; i++) {
+        size_t n = 0;
+        unsigned shift = 0, byte;
+        do {
+            byte = get_byte(src);
+            n |= (size_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        c->offsets[i+1] = n;
+    }
+    assert(!get_err(src));
+    c->offsets[0] = src->pos;
+    for (i = 0; i < blk->nlines; i++)
+        c->offsets[i+1] += c->offsets[i];
+    assert(c->offsets[blk->nlines] == blk->rawlen);
+
+    c->blk = blk;
+    c->used = ++sb->cacheclock;
+    return c;
+}
+
+/*
+ * Turn a sealed block back into an open one, so that lines can be
+ * removed from its end.
+ */
+static void sb_block_unseal(Scrollback *sb, SbBlock *blk)
+{
+    SbCache *c = sb_block_load(sb, blk);
+    size_t start = c->offsets[0];
+    unsigned i;
+
+    if (blk->spilled) {
+        size_t filterlen = blk->filterbits / 8;
+        if (filterlen) {
+            const void *filter = spill_file_map(
+                sb->spill, blk->fileoff + blk->len, filterlen);
+            if (!filter)
+                modalfatalbox("Unable to read scrollback back from its "
+                              "temporary file");
+            blk->filter = snewn(filterlen / 4, uint32_t);
+            memcpy(blk->filter, filter, filterlen);
+            sb->memory += filterlen;
+        }
+        sb_file_release(sb, blk->fileoff, blk->len + filterlen);
+        blk->spilled = false;
+        sb->nspilled--;
+    }
+    sb_filter_grow(sb, blk);
+    sb->memory -= blk->size;
+    smemclr(blk->data, blk->size);
+    sfree(blk->data);
+
+    blk->len = blk->size = blk->rawlen - start;
+    blk->data = snewn(blk->size, unsigned char);
+    memcpy(blk->data, c->data + start, blk->len);
+    blk->offsets = snewn(SB_BLOCK_LINES + 1, uint32_t);
+    for (i = 0; i <= blk->nlines; i++)
+        blk->offsets[i] = c->offsets[i] - start;
+    blk->sealed = false;
+    sb_cache_forget(sb, blk);
+
+    sb->memory += blk->size + (SB_BLOCK_LINES + 1) * sizeof(uint32_t);
+}
+
+/* ----------------------------------------------------------------------
+ * The external interface.
+ */
+
+Scrollback *scrollback_new(void)
+{
+    Scrollback *sb = snew(Scrollback);
+    memset(sb, 0, sizeof(Scrollback));
+    return sb;
+}
+
+void scrollback_clear(Scrollback *sb)
+{
+    size_t i;
+
+    for (i = 0; i < sb->nblocks; i++)
+        sb_block_free(sb, sb->blocks[i]);
+    sb->nblocks = 0;
+    sb->skip = 0;
+    sb->count = 0;
+    sb_cache_free(sb);
+
+    /* The spill file is kept, but everything in it is now free */
+    sb->nspilled = 0;
+    sb->nfree = 0;
+    sb->fileend = 0;
+}
+
+void scrollback_free(Scrollback *sb)
+{
+    scrollback_clear(sb);
+    if (sb->spill)
+        spill_file_free(sb->spill);
+    sfree(sb->freelist);
+    sfree(sb->blocks);
+    sfree(sb);
+}
+
+void scrollback_set_memory_limit(Scrollback *sb, size_t limit)
+{
+    sb->limit = limit;
+    sb_enforce_limit(sb);
+}
+
+int scrollback_count(Scrollback *sb)
+{
+    return sb->count;
+}
+
+size_t scrollback_memory(Scrollback *sb)
+{
+    size_t total = sizeof(Scrollback) + sb->blocksize * sizeof(SbBlock *) +
+        sb->freesize * sizeof(SbExtent) + sb->memory;
+    size_t i;
+
+    for (i = 0; i < SB_CACHE_BLOCKS; i++)
+        total += sb->cache[i].size;
+    return total;
+}
+
+uint64_t scrollback_disk_usage(Scrollback *sb)
+{
+    return sb->fileend;
+}
+
+void scrollback_add(Scrollback *sb, ptrlen line)
+{
+    SbBlock *blk = sb->nblocks ? sb->blocks[sb->nblocks - 1] : NULL;
+
+    if (!blk || blk->nlines == SB_BLOCK_LINES) {
+        if (blk)
+            sb_block_seal(sb, blk);
+        sgrowarray(sb->blocks, sb->blocksize, sb->nblocks);
+        blk = sb->blocks[sb->nblocks++] = sb_block_new(sb);
+    }
+
+    if (blk->size - blk->len < line.len) {
+        size_t oldsize = blk->size;
+        sgrowarrayn_nm(blk->data, blk->size, blk->len, line.len);
+        sb->memory += blk->size - oldsize;
+    }
+    memcpy(blk->data + blk->len, line.ptr, line.len);
+    blk->len += line.len;
+    blk->offsets[++blk->nlines] = blk->len;
+    sb->count++;
+}
+
+void scrollback_remove_oldest(Scrollback *sb)
+{
+    assert(sb->count > 0);
+
+    sb->count--;
+    if (++sb->skip == sb->blocks[0]->nlines) {
+        if (sb->blocks[0]->spilled)
+            sb->nspilled--;
+        sb_block_free(sb, sb->blocks[0]);
+        sb->nblocks--;
+        memmove(sb->blocks, sb->blocks + 1, sb->nblocks * sizeof(SbBlock *));
+        sb->skip = 0;
+    }
+}
+
+void scrollback_remove_newest(Scrollback *sb, strbuf *out)
+{
+    SbBlock *blk;
+    size_t start;
+
+    assert(sb->count > 0);
+
+    blk = sb->blocks[sb->nblocks - 1];
+    if (blk->sealed)
+        sb_block_unseal(sb, blk);
+
+    start = blk->offsets[blk->nlines - 1];
+    if (out)
+        put_data(out, blk->data + start, blk->len - start);
+    smemclr(blk->data + start, blk->len - start);
+    blk->len = start;
+    blk->nlines--;
+    sb->count--;
+
+    if (sb->count == 0) {
+        scrollback_clear(sb);
+    } else if (blk->nlines == 0) {
+        sb_block_free(sb, blk);
+        sb->nblocks--;
+    }
+}
+
+ptrlen scrollback_get(Scrollback *sb, int index)
+{
+    unsigned n, i;
+    SbBlock *blk;
+    const uint32_t *offsets;
+    const unsigned char *data;
+
+    assert(index >= 0 && index < sb->count);
+
+    n = index + sb->skip;
+    blk = sb->blocks[n / SB_BLOCK_LINES];
+    i = n % SB_BLOCK_LINES;
+    assert(i < blk->nlines);
+
+    if (blk->sealed) {
+        SbCache *c = sb_block_load(sb, blk);
+        offsets = c->offsets;
+        data = c->data;
+    } else {
+        offsets = blk->offsets;
+        data = blk->data;
+    }
+
+    return make_ptrlen(data + offsets[i], offsets[i+1] - offsets[i]);
+}
+
+void scrollback_index(Scrollback *sb, const wchar_t *text, size_t len)
+{
+    SbBlock *blk;
+    wchar_t a, b;
+    size_t i;
+
+    assert(sb->count > 0);
+    if (len < 3)
+        return;
+
+    blk = sb->blocks[sb->nblocks - 1];
+    assert(!blk->sealed);
+    if (!blk->filter) {
+        blk->filterbits = SB_FILTER_MAXBITS;
+        blk->filter = snewn(SB_FILTER_MAXBITS / 32, uint32_t);
+        memset(blk->filter, 0, SB_FILTER_MAXBITS / 8);
+        sb->memory += SB_FILTER_MAXBITS / 8;
+    }
+
+    a = sb_fold(text[0]);
+    b = sb_fold(text[1]);
+    for (i = 2; i < len; i++) {
+        wchar_t c = sb_fold(text[i]);
+        uint32_t h = sb_trigram(a, b, c);
+        unsigned bit1 = SB_FILTER_BIT1(h, SB_FILTER_MAXBITS);
+        unsigned bit2 = SB_FILTER_BIT2(h, SB_FILTER_MAXBITS);
+        blk->filter[bit1 / 32] |= 1U << (bit1 % 32);
+        blk->filter[bit2 / 32] |= 1U << (bit2 % 32);
+        a = b;
+        b = c;
+    }
+}
+
+size_t scrollback_trigrams(const wchar_t *text, size_t len, uint32_t *out)
+{
+    size_t i;
+
+    for (i = 2; i < len; i++)
+        out[i-2] = sb_trigram(sb_fold(text[i-2]), sb_fold(text[i-1]),
+                              sb_fold(text[i]));
+    return len < 2 ? 0 : len - 2;
+}
+
+bool scrollback_might_contain(Scrollback *sb, int index,
+                              const uint32_t *grams, size_t ngrams,
+                              int *start, int *end)
+{
+    unsigned n;
+    int first;
+    SbBlock *blk;
+    const uint32_t *filter;
+    size_t i;
+
+    assert(index >= 0 && index < sb->count);
+
+    n = index + sb->skip;
+    blk = sb->blocks[n / SB_BLOCK_LINES];
+    first = (int)(n - n % SB_BLOCK_LINES) - (int)sb->skip;
+    *start = first < 0 ? 0 : first;
+    *end = first + (int)blk->nlines;
+
+    if (!ngrams)
+        return true;
+    if (!blk->filterbits)
+        return false;
+    if (blk->spilled) {
+        filter = spill_file_map(sb->spill, blk->fileoff + blk->len,
+                                blk->filterbits / 8);
+        if (!filter)
+            return true;               /* let the search look properly */
+    } else {
+        filter = blk->filter;
+    }
+    for (i = 0; i < ngrams; i++)
+        if (!sb_filter_test(filter, SB_FILTER_BIT1(grams[i],
+                                                   blk->filterbits)) ||
+            !sb_filter_test(filter, SB_FILTER_BIT2(grams[i],
+                                                   blk->filterbits)))
+            return false;
+    return true;
+}
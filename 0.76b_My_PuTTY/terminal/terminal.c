@@ -7,11 +7,16 @@
 #include <ctype.h>
 #include <limits.h>
 #include <wchar.h>
+#include <wctype.h>
 
 #include <time.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "putty.h"
 #include "terminal.h"
+#include <regex.h>
 
 #ifdef MOD_FAR2L
 /* base64 library - needed for far2l extensions support */
@@ -726,18 +731,16 @@ static void makeliteral_cc(strbuf *b, termchar *c, unsigned long *state)
     makeliteral_chr(b, &z, &zstate);
 }
 
-typedef struct compressed_scrollback_line {
-    size_t len;
-} compressed_scrollback_line;
-
-static termline *decompressline(compressed_scrollback_line *line);
+static termline *decompressline(ptrlen line);
 
-static compressed_scrollback_line *compressline(termline *ldata)
+/*
+ * Compress a line for the scrollback, appending the result to b.
+ */
+static void compressline(termline *ldata, strbuf *b)
 {
-    strbuf *b = strbuf_new();
-
-    /* Leave space for the header structure */
-    strbuf_append(b, sizeof(compressed_scrollback_line));
+#ifdef TERM_CC_DIAGS
+    size_t start = b->len;
+#endif
 
     /*
      * First, store the column count, 7 bits at a time, least
@@ -784,11 +787,6 @@ static compressed_scrollback_line *compressline(termline *ldata)
     makerle(b, ldata, makeliteral_truecolour);
     makerle(b, ldata, makeliteral_cc);
 
-    size_t linelen = b->len - sizeof(compressed_scrollback_line);
-    compressed_scrollback_line *line =
-        (compressed_scrollback_line *)strbuf_to_str(b);
-    line->len = linelen;
-
     /*
      * Diagnostics: ensure that the compressed data really does
      * decompress to the right thing.
@@ -802,13 +800,13 @@ static compressed_scrollback_line *compressline(termline *ldata)
 	int i;
 
 #ifdef DIAGNOSTIC_SB_COMPRESSION
-	for (i = 0; i < b->len; i++) {
-	    printf(" %02x ", b->data[i]);
+	for (i = start; i < b->len; i++) {
+	    printf(" %02x ", b->u[i]);
 	}
 	printf("\n");
 #endif
 
-        dcl = decompressline(line);
+        dcl = decompressline(make_ptrlen(b->u + start, b->len - start));
 	assert(ldata->cols == dcl->cols);
 	assert(ldata->lattr == dcl->lattr);
 	for (i = 0; i < ldata->cols; i++)
@@ -816,16 +814,14 @@ static compressed_scrollback_line *compressline(termline *ldata)
 
 #ifdef DIAGNOSTIC_SB_COMPRESSION
 	printf("%d cols (%d bytes) -> %d bytes (factor of %g)\n",
-	       ldata->cols, 4 * ldata->cols, dused,
-	       (double)dused / (4 * ldata->cols));
+	       ldata->cols, 4 * ldata->cols, (int)(b->len - start),
+	       (double)(b->len - start) / (4 * ldata->cols));
 #endif
 
 	freetermline(dcl);
     }
 #endif
 #endif /* TERM_CC_DIAGS */
-
-    return line;
 }
 
 static void readrle(BinarySource *bs, termline *ldata,
@@ -963,13 +959,13 @@ static void readliteral_cc(BinarySource *bs, termchar *c, termline *ldata,
     }
 }
 
-static termline *decompressline(compressed_scrollback_line *line)
+static termline *decompressline(ptrlen line)
 {
     int ncols, byte, shift;
     BinarySource bs[1];
     termline *ldata;
 
-    BinarySource_BARE_INIT(bs, line+1, line->len);
+    BinarySource_BARE_INIT_PL(bs, line);
 
     /*
      * First read in the column count.
@@ -1107,12 +1103,102 @@ static void resizeline(Terminal *term, termline *line, int cols)
     }
 }
 
+/*
+ * The most memory the scrollback should take before it goes to disk.
+ */
+static size_t sb_memory_limit(Terminal *term)
+{
+    if (term->scrollback_memory <= 0)
+        return 0;
+    return (size_t)term->scrollback_memory * 1024;
+}
+
+/*
+ * Translate a character from a termline into Unicode, as clipme()
+ * does, but always giving one wchar_t for each character cell so that
+ * search hits map straight back to columns.
+ */
+static wchar_t search_char(Terminal *term, unsigned long uc)
+{
+    switch (uc & CSET_MASK) {
+      case CSET_LINEDRW:
+        uc = term->ucsdata->unitab_xterm[uc & 0xFF];
+        break;
+      case CSET_ASCII:
+        uc = term->ucsdata->unitab_line[uc & 0xFF];
+        break;
+      case CSET_SCOACS:
+        uc = term->ucsdata->unitab_scoacs[uc & 0xFF];
+        break;
+    }
+    switch (uc & CSET_MASK) {
+      case CSET_ACP:
+        uc = term->ucsdata->unitab_font[uc & 0xFF];
+        break;
+      case CSET_OEMCP:
+        uc = term->ucsdata->unitab_oemcp[uc & 0xFF];
+        break;
+    }
+    if (DIRECT_FONT(uc))
+        uc &= 0xFF;
+#ifdef PLATFORM_IS_UTF16
+    if (uc > 0xFFFF)
+        uc = 0xFFFD;
+#endif
+    return uc;
+}
+
+/*
+ * Extract the text of a line into term->srchtext, one character per
+ * cell, leaving out the right-hand halves of wide characters and any
+ * trailing spaces. term->srchcols[i] is the column that character i
+ * came from. Returns the number of characters.
+ */
+static size_t search_line_text(Terminal *term, termline *ldata)
+{
+    size_t n = 0;
+    int x;
+
+    if (term->srchsize <= (size_t)ldata->cols) {
+        sgrowarray(term->srchtext, term->srchsize, ldata->cols);
+        term->srchcols = sresize(term->srchcols, term->srchsize, int);
+    }
+
+    for (x = 0; x < ldata->cols; x++) {
+        unsigned long chr = ldata->chars[x].chr;
+        if (chr == UCSWIDE)
+            continue;
+        term->srchtext[n] = search_char(term, chr);
+        term->srchcols[n] = x;
+        n++;
+    }
+    while (n > 0 && term->srchtext[n-1] == ' ')
+        n--;
+    return n;
+}
+
+/*
+ * Move a line that's leaving the top of the screen into the
+ * scrollback, and add it to the search index.
+ */
+static void sb_push(Terminal *term, termline *line)
+{
+    size_t len;
+
+    strbuf_clear(term->sbline);
+    compressline(line, term->sbline);
+    scrollback_add(term->scrollback, ptrlen_from_strbuf(term->sbline));
+
+    len = search_line_text(term, line);
+    scrollback_index(term->scrollback, term->srchtext, len);
+}
+
 /*
  * Get the number of lines in the scrollback.
  */
 static int sblines(Terminal *term)
 {
-    int sblines = count234(term->scrollback);
+    int sblines = scrollback_count(term->scrollback);
     if (term->erase_to_scrollback &&
 	term->alt_which && term->alt_screen) {
 	    sblines += term->alt_sblines;
@@ -1121,7 +1207,7 @@ static int sblines(Terminal *term)
 }
 
 static void null_line_error(Terminal *term, int y, int lineno,
-                            tree234 *whichtree, int treeindex,
+                            void *whichtree, int treeindex,
                             const char *varname)
 {
     modalfatalbox("%s==NULL in terminal.c\n"
@@ -1134,7 +1220,7 @@ static void null_line_error(Terminal *term, int y, int lineno,
                   "Please contact <putty@projects.tartarus.org> "
                   "and pass on the above information.",
                   varname, lineno, y, term->cols, term->rows,
-                  term->scrollback, count234(term->scrollback),
+                  term->scrollback, scrollback_count(term->scrollback),
                   term->screen, count234(term->screen),
                   term->alt_screen, count234(term->alt_screen),
                   term->alt_sblines, whichtree, treeindex, commitid);
@@ -1150,6 +1236,7 @@ static termline *lineptr(Terminal *term, int y, int lineno, int screen)
     termline *line;
     tree234 *whichtree;
     int treeindex;
+    bool insb = false;
 
     if (y >= 0) {
         whichtree = term->screen;
@@ -1165,26 +1252,29 @@ static termline *lineptr(Terminal *term, int y, int lineno, int screen)
             altlines = term->alt_sblines;
         }
         if (y < -altlines) {
-            whichtree = term->scrollback;
-            treeindex = y + altlines + count234(term->scrollback);
+            whichtree = NULL;
+            insb = true;
+            treeindex = y + altlines + scrollback_count(term->scrollback);
         } else {
             whichtree = term->alt_screen;
             treeindex = y + term->alt_sblines;
             /* treeindex = y + count234(term->alt_screen); */
         }
     }
-    if (whichtree == term->scrollback) {
-        compressed_scrollback_line *cline = index234(whichtree, treeindex);
-        if (!cline)
-            null_line_error(term, y, lineno, whichtree, treeindex, "cline");
-        line = decompressline(cline);
+    if (insb) {
+        if (treeindex < 0 ||
+            treeindex >= scrollback_count(term->scrollback))
+            null_line_error(term, y, lineno, term->scrollback, treeindex,
+                            "cline");
+        line = decompressline(scrollback_get(term->scrollback, treeindex));
     } else {
         line = index234(whichtree, treeindex);
     }
 
     /* We assume that we don't screw up and retrieve something out of range. */
     if (line == NULL)
-        null_line_error(term, y, lineno, whichtree, treeindex, "line");
+        null_line_error(term, y, lineno, insb ? (void *)term->scrollback :
+                        (void *)whichtree, treeindex, "line");
     assert(line != NULL);
 
     /*
@@ -1630,10 +1720,11 @@ void term_copy_stuff_from_conf(Terminal *term)
     term->enter_sends_crlf = conf_get_int(term->conf, CONF_enter_sends_crlf);
     term->rxvt_homeend = conf_get_int(term->conf, CONF_rxvt_homeend);
 #else
-    term->rxvt_homeend = conf_get_bool(term->conf, CONF_rxvt_homeend);
+    term->rxvt_homeend = conf_get_int(term->conf, CONF_rxvt_homeend) != 0;
 #endif
     term->scroll_on_disp = conf_get_bool(term->conf, CONF_scroll_on_disp);
     term->scroll_on_key = conf_get_bool(term->conf, CONF_scroll_on_key);
+    term->scrollback_memory = conf_get_int(term->conf, CONF_scrollback_memory);
     term->xterm_mouse_forbidden = conf_get_bool(term->conf, CONF_no_mouse_rep);
     term->xterm_256_colour = conf_get_bool(term->conf, CONF_xterm_256_colour);
     term->true_colour = conf_get_bool(term->conf, CONF_true_colour);
@@ -1795,6 +1886,8 @@ void term_reconfig(Terminal *term, Conf *conf)
     term_schedule_tblink(term);
     term_schedule_cblink(term);
     term_copy_stuff_from_conf(term);
+    if (term->scrollback)
+        scrollback_set_memory_limit(term->scrollback, sb_memory_limit(term));
     term_update_raw_mouse_mode(term);
 }
 
@@ -1803,7 +1896,6 @@ void term_reconfig(Terminal *term, Conf *conf)
  */
 void term_clrsb(Terminal *term)
 {
-    unsigned char *line;
     int i;
 
     /*
@@ -1815,9 +1907,7 @@ void term_clrsb(Terminal *term)
     /*
      * Clear the actual scrollback.
      */
-    while ((line = delpos234(term->scrollback, 0)) != NULL) {
-	sfree(line);            /* this is compressed data, not a termline */
-    }
+    scrollback_clear(term->scrollback);
 
     /*
      * When clearing the scrollback, we also truncate any termlines on
@@ -2049,7 +2139,12 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata, TermWin *win)
 
     term_copy_stuff_from_conf(term);
 
-    term->screen = term->alt_screen = term->scrollback = NULL;
+    term->screen = term->alt_screen = NULL;
+    term->scrollback = NULL;
+    term->sbline = strbuf_new_nm();
+    term->srchtext = NULL;
+    term->srchcols = NULL;
+    term->srchsize = 0;
     term->tempsblines = 0;
     term->alt_sblines = 0;
     term->disptop = 0;
@@ -2141,9 +2236,10 @@ void term_free(Terminal *term)
     struct beeptime *beep;
     int i;
 
-    while ((line = delpos234(term->scrollback, 0)) != NULL)
-	sfree(line);		       /* compressed data, not a termline */
-    freetree234(term->scrollback);
+    scrollback_free(term->scrollback);
+    strbuf_free(term->sbline);
+    sfree(term->srchtext);
+    sfree(term->srchcols);
     while ((line = delpos234(term->screen, 0)) != NULL)
 	freetermline(line);
     freetree234(term->screen);
@@ -2230,7 +2326,8 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
     term->alt_b = term->marg_b = newrows - 1;
 
     if (term->rows == -1) {
-	term->scrollback = newtree234(NULL);
+	term->scrollback = scrollback_new();
+	scrollback_set_memory_limit(term->scrollback, sb_memory_limit(term));
 	term->screen = newtree234(NULL);
 	term->tempsblines = 0;
 	term->rows = 0;
@@ -2255,17 +2352,17 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
      *    amount of scrollback we actually have, we must throw some
      *    away.
      */
-    sblen = count234(term->scrollback);
+    sblen = scrollback_count(term->scrollback);
     /* Do this loop to expand the screen if newrows > rows */
     assert(term->rows == count234(term->screen));
     while (term->rows < newrows) {
 	if (term->tempsblines > 0) {
-	    compressed_scrollback_line *cline;
 	    /* Insert a line from the scrollback at the top of the screen. */
 	    assert(sblen >= term->tempsblines);
-	    cline = delpos234(term->scrollback, --sblen);
-	    line = decompressline(cline);
-	    sfree(cline);
+	    strbuf_clear(term->sbline);
+	    scrollback_remove_newest(term->scrollback, term->sbline);
+	    sblen--;
+	    line = decompressline(ptrlen_from_strbuf(term->sbline));
 	    line->temporary = false;   /* reconstituted line is now real */
 	    term->tempsblines -= 1;
 	    addpos234(term->screen, line, 0);
@@ -2289,7 +2386,8 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
 	} else {
 	    /* push top row to scrollback */
 	    line = delpos234(term->screen, 0);
-	    addpos234(term->scrollback, compressline(line), sblen++);
+	    sb_push(term, line);
+	    sblen++;
 	    freetermline(line);
 	    term->tempsblines += 1;
 	    term->curs.y -= 1;
@@ -2304,14 +2402,13 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
 
     /* Delete any excess lines from the scrollback. */
     while (sblen > newsavelines) {
-	line = delpos234(term->scrollback, 0);
-	sfree(line);
+	scrollback_remove_oldest(term->scrollback);
 	sblen--;
     }
     if (sblen < term->tempsblines)
 	term->tempsblines = sblen;
-    assert(count234(term->scrollback) <= newsavelines);
-    assert(count234(term->scrollback) >= term->tempsblines);
+    assert(scrollback_count(term->scrollback) <= newsavelines);
+    assert(scrollback_count(term->scrollback) >= term->tempsblines);
     term->disptop = 0;
 
     /* Make a new displayed text buffer. */
@@ -2655,22 +2752,18 @@ static void scroll(Terminal *term, int topline, int botline,
 	    cc_check(line);
 #endif
 	    if (sb && term->savelines > 0) {
-		int sblen = count234(term->scrollback);
+		int sblen = scrollback_count(term->scrollback);
 		/*
 		 * We must add this line to the scrollback. We'll
 		 * remove a line from the top of the scrollback if
 		 * the scrollback is full.
 		 */
-		if (sblen == term->savelines) {
-		    unsigned char *cline;
-
-		    sblen--;
-		    cline = delpos234(term->scrollback, 0);
-		    sfree(cline);
-		} else
+		if (sblen == term->savelines)
+		    scrollback_remove_oldest(term->scrollback);
+		else
 		    term->tempsblines += 1;
 
-		addpos234(term->scrollback, compressline(line), sblen);
+		sb_push(term, line);
 
 		/* now `line' itself can be reused as the bottom line */
 
@@ -4490,6 +4583,182 @@ unsigned long term_translate(
     return c;
 }
 
+/*
+ * Return the length of the run of printable ASCII (0x20 to 0x7E) at
+ * the start of a buffer. This is what almost all of the output of a
+ * busy session consists of, between the occasional control character
+ * or escape sequence, so term_out can hand it to the display in one
+ * go rather than a character at a time.
+ */
+static size_t term_printable_run(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    /*
+     * Printable ASCII is exactly the bytes which, taken as signed,
+     * are greater than 0x1F and less than 0x7F.
+     */
+    const __m128i lo = _mm_set1_epi8(0x1F), hi = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo),
+                                   _mm_cmplt_epi8(v, hi));
+        unsigned mask = _mm_movemask_epi8(ok);
+        if (mask != 0xFFFF) {
+            mask = ~mask;
+            while (!(mask & 1)) {
+                mask >>= 1;
+                i++;
+            }
+            return i;
+        }
+    }
+#else
+    /*
+     * A word at a time: the usual bit tricks for 'some byte is less
+     * than 0x20' and 'some byte is greater than 0x7E' (adding 1 to
+     * such a byte sets its top bit, if it wasn't set already) tell us
+     * whether the word is all printable, and if not, we find the
+     * first byte that isn't below.
+     */
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t x, below, above;
+        memcpy(&x, p + i, 8);
+        below = (x - ones * 0x20) & ~x & highs;
+        above = ((x + ones) | x) & highs;
+        if (below | above)
+            break;
+    }
+#endif
+
+    while (i < len && p[i] >= 0x20 && p[i] < 0x7F)
+        i++;
+    return i;
+}
+
+/*
+ * Determine whether a printable ASCII byte received in the current
+ * state would go through term_translate and come out unchanged, as
+ * itself in CSET_ASCII. (The exceptions are the line-drawing and SCO
+ * character sets, UK-ASCII's pound sign, and a half-received UTF-8
+ * sequence.) The caller has already checked that the code page
+ * doesn't declare any of these bytes to be a control character.
+ */
+static bool term_ascii_is_direct(Terminal *term)
+{
+    if (in_utf(term)) {
+        if (term->utf8.state)
+            return false;
+        if (term->utf8linedraw &&
+            term->cset_attr[term->cset] == CSET_LINEDRW)
+            return false;
+#ifdef ASCPORT
+        if (conf_get_bool(term->conf, CONF_acs_in_utf))
+            return false;
+#endif
+        return true;
+    }
+    return !term->sco_acs && term->cset_attr[term->cset] == CSET_ASCII;
+}
+
+/*
+ * Display a run of printable ASCII characters, with exactly the
+ * effect of passing each one to term_display_graphic_char in turn,
+ * but doing the work that doesn't depend on the character (wrapping,
+ * insert mode, the selection and the boundary checks) once for each
+ * line of the run instead of once per character.
+ */
+static void term_display_ascii_run(Terminal *term, const unsigned char *s,
+                                   size_t len)
+{
+    assert(len > 0);
+
+    if (term->logctx)
+        logtraffic_data(term->logctx, s, len, LGTYP_ASCII);
+
+    while (len > 0) {
+        termline *cline = scrlineptr(term->curs.y);
+        int linecols, x0, n, i;
+
+        if (term->wrapnext && term->wrap) {
+            cline->lattr |= LATTR_WRAPPED;
+            if (term->curs.y == term->marg_b)
+                scroll(term, term->marg_t, term->marg_b, 1, true);
+            else if (term->curs.y < term->rows - 1)
+                term->curs.y++;
+            term->curs.x = 0;
+            term->wrapnext = false;
+            cline = scrlineptr(term->curs.y);
+        }
+
+        check_trust_status(term, cline);
+        linecols = term->cols;
+        if (cline->trusted)
+            linecols -= TRUST_SIGIL_WIDTH;
+
+        x0 = term->curs.x;
+        if (!term->wrap && x0 == linecols - 1) {
+            /*
+             * With wrapping off, every character from here on
+             * overwrites the last one in the line, so only the last
+             * of them makes any difference.
+             */
+            s += len - 1;
+            len = 1;
+        }
+        n = linecols - x0;
+        if (n < 1)
+            n = 1;
+        if ((size_t)n > len)
+            n = len;
+
+        if (term->insert)
+            insch(term, n);
+        if (term->selstate != NO_SELECTION) {
+            pos from = term->curs, to = term->curs;
+            to.x += n;
+            check_selection(term, from, to);
+        }
+
+        /*
+         * Only the cells at the two ends of the run can be half of a
+         * double-width character that survives it.
+         */
+        check_boundary(term, x0, term->curs.y);
+        check_boundary(term, x0 + n, term->curs.y);
+
+        for (i = 0; i < n; i++) {
+            /* FULL-TERMCHAR */
+            clear_cc(cline, x0 + i);
+            cline->chars[x0 + i].chr = s[i] | CSET_ASCII;
+            cline->chars[x0 + i].attr = term->curr_attr;
+            cline->chars[x0 + i].truecolour = term->curr_truecolour;
+        }
+        term->last_graphic_char = s[n - 1] | CSET_ASCII;
+        s += n;
+        len -= n;
+
+        term->curs.x = x0 + n;
+        if (term->curs.x >= linecols) {
+            term->curs.x = linecols - 1;
+            term->wrapnext = true;
+            if (term->wrap && term->vt52_mode) {
+                cline->lattr |= LATTR_WRAPPED;
+                if (term->curs.y == term->marg_b)
+                    scroll(term, term->marg_t, term->marg_b, 1, true);
+                else if (term->curs.y < term->rows - 1)
+                    term->curs.y++;
+                term->curs.x = 0;
+                term->wrapnext = false;
+            }
+        }
+    }
+    seen_disp_event(term);
+}
+
 /*
  * Remove everything currently in `inbuf' and stick it up on the
  * in-memory display. There's a big state machine in here to
@@ -4501,6 +4770,7 @@ static void term_out(Terminal *term)
     int unget;
     unsigned char localbuf[256], *chars;
     size_t nchars = 0;
+    int ascii_ok = -1;
 
     unget = -1;
 
@@ -4518,6 +4788,32 @@ static void term_out(Terminal *term)
 		assert(chars != NULL);
 		assert(nchars > 0);
 	    }
+
+            /*
+             * Fast path: a run of ordinary printable characters in
+             * the ground state goes straight to the screen, without
+             * a trip round the state machine for each one.
+             */
+            if (term->termstate == TOPLEVEL && !term->printing &&
+                term->logtype != LGTYP_DEBUG &&
+                *chars >= 0x20 && *chars < 0x7F) {
+                size_t run = term_printable_run(chars, nchars);
+
+                if (ascii_ok < 0) {
+                    ascii_ok = 1;
+                    for (c = 0x20; c < 0x7F; c++)
+                        if (term->ucsdata->unitab_ctrl[c] != 0xFF)
+                            ascii_ok = 0;
+                }
+
+                if (run > 1 && ascii_ok && term_ascii_is_direct(term)) {
+                    term_display_ascii_run(term, chars, run);
+                    chars += run;
+                    nchars -= run;
+                    continue;
+                }
+            }
+
 	    c = *chars++;
 	    nchars--;
 
@@ -6698,8 +6994,9 @@ static void do_paint(Terminal *term)
 	 * HACK: PuttyTray / Nutty
 	 * Hyperlink stuff: Find visible hyperlinks
 	 *
-	 * TODO: We should find out somehow that the stuff on screen has changed since last
-	 *       paint. How to do it?
+	 * url_update says something may have changed since the last paint.
+	 * urlhack only runs the regex over the rows (joined where they wrap)
+	 * that it didn't see last time.
 	 */
 	int urlhack_underline_always = conf_get_int(term->conf, CONF_url_underline) == URLHACK_UNDERLINE_ALWAYS;
 
@@ -6723,6 +7020,7 @@ static void do_paint(Terminal *term)
 					urlhack_putchar(tchar & CHAR_MASK ? (char)(tchar & CHAR_MASK) : ' ');
 					//urlhack_putchar((char)(lp->chars[j].chr & CHAR_MASK));
 				}
+				urlhack_newline(lp->lattr & LATTR_WRAPPED);
 				unlineptr(lp);
 			}
 			urlhack_go_find_me_some_hyperlinks(term->cols);
@@ -7277,6 +7575,343 @@ void term_scroll_to_selection(Terminal *term, int which_end)
     term_scroll(term, -1, y);
 }
 
+/*
+ * Searching the scrollback and the screen.
+ *
+ * A search looks at one line at a time (a match can't span a line
+ * break, even a wrapped one) and shows what it finds as the selection,
+ * so that the next search carries on from there. Lines in the
+ * scrollback are looked at a block at a time: if scrollback.c says
+ * the block can't contain all the trigrams the pattern needs, none
+ * of it is decompressed.
+ */
+typedef struct term_search_ctx {
+    bool regex, match_case;
+    const wchar_t *needle;
+    size_t nlen;
+    regex_t rx;
+    strbuf *utf8;                      /* the line, for regexec */
+    size_t *charpos, *bytechar;        /* char -> byte and back */
+    size_t possize, bytesize;
+} term_search_ctx;
+
+/*
+ * Work out which trigrams any match of a regular expression must
+ * contain, from the runs of literal characters in it that aren't
+ * inside brackets or made optional by a quantifier. Anything with an
+ * alternation in it is given up on. The result is at most as long as
+ * the expression.
+ */
+static size_t search_regex_trigrams(const wchar_t *re, uint32_t *grams)
+{
+    size_t len = wcslen(re), n = 0, runlen = 0, i;
+    wchar_t *run;
+    int depth = 0;
+
+    if (wcschr(re, L'|'))
+        return 0;
+
+    run = snewn(len + 1, wchar_t);
+    for (i = 0; i < len; i++) {
+        wchar_t c = re[i];
+        bool lit = false;
+
+        switch (c) {
+          case L'\\':
+            if (i + 1 < len && !iswalnum(re[i+1])) {
+                c = re[++i];
+                lit = true;
+            } else {
+                i++;                   /* a class, anchor or backref */
+            }
+            break;
+          case L'[':
+            i++;
+            if (i < len && re[i] == L'^')
+                i++;
+            if (i < len && re[i] == L']')
+                i++;
+            while (i < len && re[i] != L']') {
+                if (re[i] == L'[' && i + 1 < len &&
+                    (re[i+1] == L':' || re[i+1] == L'=' || re[i+1] == L'.')) {
+                    wchar_t kind = re[i+1];
+                    for (i += 2; i + 1 < len; i++)
+                        if (re[i] == kind && re[i+1] == L']')
+                            break;
+                    i++;
+                }
+                i++;
+            }
+            break;
+          case L'*': case L'?': case L'{':
+            /* The last atom is optional, so drop it from the run */
+            if (runlen)
+                runlen--;
+            if (c == L'{')
+                while (i < len && re[i] != L'}')
+                    i++;
+            break;
+          case L'(':
+            depth++;
+            break;
+          case L')':
+            depth--;
+            break;
+          case L'+': case L'.': case L'^': case L'$':
+            break;
+          default:
+            lit = true;
+            break;
+        }
+
+        if (lit && depth == 0) {
+            run[runlen++] = c;
+        } else {
+            if (runlen >= 3)
+                n += scrollback_trigrams(run, runlen, grams + n);
+            runlen = 0;
+        }
+    }
+    if (runlen >= 3)
+        n += scrollback_trigrams(run, runlen, grams + n);
+
+    sfree(run);
+    return n;
+}
+
+static inline wchar_t search_fold(wchar_t c)
+{
+    if (c < 0x80)
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    return towlower(c);
+}
+
+static bool search_match_at(term_search_ctx *ctx, const wchar_t *text)
+{
+    size_t i;
+
+    if (ctx->match_case)
+        return !memcmp(text, ctx->needle, ctx->nlen * sizeof(wchar_t));
+    for (i = 0; i < ctx->nlen; i++)
+        if (search_fold(text[i]) != ctx->needle[i])
+            return false;
+    return true;
+}
+
+/*
+ * Find a match in a line of text which starts at or after character
+ * `from', or, if backward, the last match which starts before
+ * character `to'. On success, [*mstart,*mend) are the characters it
+ * covers.
+ */
+static bool search_line(term_search_ctx *ctx, const wchar_t *text,
+                        size_t len, size_t from, size_t to, bool backward,
+                        size_t *mstart, size_t *mend)
+{
+    size_t i, pos;
+    bool found = false;
+
+    if (!ctx->regex) {
+        if (len < ctx->nlen)
+            return false;
+        if (!backward) {
+            for (i = from; i + ctx->nlen <= len; i++)
+                if (search_match_at(ctx, text + i))
+                    goto plain_found;
+        } else {
+            for (i = (to < len - ctx->nlen + 1 ? to : len - ctx->nlen + 1);
+                 i-- > 0 ;)
+                if (search_match_at(ctx, text + i))
+                    goto plain_found;
+        }
+        return false;
+      plain_found:
+        *mstart = i;
+        *mend = i + ctx->nlen;
+        return true;
+    }
+
+    /*
+     * For a regex, convert the line to UTF-8, keeping track of where
+     * each character went. Then try matching from successive
+     * characters, since we want the first match to start in range
+     * (or the last, going backwards), not just the first in the line.
+     */
+    strbuf_clear(ctx->utf8);
+    sgrowarray(ctx->charpos, ctx->possize, len);
+    for (i = 0; i < len; i++) {
+        char buf[6];
+        size_t n = encode_utf8(buf, text[i] ? text[i] : ' '), j;
+        ctx->charpos[i] = ctx->utf8->len;
+        sgrowarrayn(ctx->bytechar, ctx->bytesize, ctx->utf8->len, n + 1);
+        for (j = 0; j < n; j++)
+            ctx->bytechar[ctx->utf8->len + j] = i;
+        put_data(ctx->utf8, buf, n);
+    }
+    ctx->charpos[len] = ctx->utf8->len;
+    sgrowarray(ctx->bytechar, ctx->bytesize, ctx->utf8->len);
+    ctx->bytechar[ctx->utf8->len] = len;
+
+    for (pos = backward ? 0 : from; pos <= len && (!backward || pos < to); ) {
+        size_t off = ctx->charpos[pos];
+        regmatch_t m;
+        size_t s, e;
+
+        if (regexec(&ctx->rx, ctx->utf8->s + off, 1, &m,
+                    off ? REG_NOTBOL : 0) != 0)
+            break;
+        s = ctx->bytechar[off + m.rm_so];
+        e = ctx->bytechar[off + m.rm_eo];
+        if (e > s) {                   /* an empty match isn't much use */
+            if (backward && s >= to)
+                break;
+            found = true;
+            *mstart = s;
+            *mend = e;
+            if (!backward)
+                break;
+        }
+        pos = s + 1;
+    }
+    return found;
+}
+
+TermSearchResult term_search(Terminal *term, const wchar_t *pattern,
+                             int flags)
+{
+    term_search_ctx ctx[1];
+    bool backward = (flags & TERM_SEARCH_BACKWARD) != 0;
+    TermSearchResult ret = TERM_SEARCH_NOT_FOUND;
+    size_t plen = wcslen(pattern), ngrams, i;
+    uint32_t *grams;
+    wchar_t *folded = NULL;
+    int sbtop = -sblines(term), altlines = 0, count, okstart = 0, okend = 0;
+    pos from;
+
+    if (!plen)
+        return TERM_SEARCH_NOT_FOUND;
+
+    memset(ctx, 0, sizeof(ctx));
+    ctx->regex = (flags & TERM_SEARCH_REGEX) != 0;
+    ctx->match_case = (flags & TERM_SEARCH_MATCH_CASE) != 0;
+    grams = snewn(plen, uint32_t);
+
+    if (ctx->regex) {
+        strbuf *re = strbuf_new();
+        for (i = 0; i < plen; i++) {
+            char buf[6];
+            put_data(re, buf, encode_utf8(buf, pattern[i]));
+        }
+        if (regcomp(&ctx->rx, re->s, REG_EXTENDED |
+                    (ctx->match_case ? 0 : REG_ICASE)) != 0) {
+            strbuf_free(re);
+            sfree(grams);
+            return TERM_SEARCH_BAD_PATTERN;
+        }
+        strbuf_free(re);
+        ctx->utf8 = strbuf_new_nm();
+        ngrams = search_regex_trigrams(pattern, grams);
+    } else {
+        if (ctx->match_case) {
+            ctx->needle = pattern;
+        } else {
+            folded = snewn(plen, wchar_t);
+            for (i = 0; i < plen; i++)
+                folded[i] = search_fold(pattern[i]);
+            ctx->needle = folded;
+        }
+        ctx->nlen = plen;
+        ngrams = scrollback_trigrams(pattern, plen, grams);
+    }
+
+    /*
+     * Start from the current selection if there is one, and
+     * otherwise from the top (or bottom) of the window.
+     */
+    if (term->selstate == SELECTED) {
+        from = term->selstart;
+        if (!backward)
+            from.x++;
+    } else if (!backward) {
+        from.y = term->disptop;
+        from.x = 0;
+    } else {
+        from.y = term->disptop + term->rows - 1;
+        from.x = term->cols;
+    }
+    if (from.y < sbtop) {
+        from.y = sbtop;
+        from.x = 0;
+    } else if (from.y >= term->rows) {
+        from.y = term->rows - 1;
+        from.x = term->cols;
+    }
+
+    if (term->erase_to_scrollback && term->alt_which && term->alt_screen)
+        altlines = term->alt_sblines;
+    count = scrollback_count(term->scrollback);
+
+    while (from.y >= sbtop && from.y < term->rows) {
+        int y = from.y, idx = y + altlines + count;
+        termline *ldata;
+        size_t len, lim, ms, me;
+        bool found;
+
+        if (y < -altlines && (idx < okstart || idx >= okend)) {
+            int start, end;
+            if (!scrollback_might_contain(term->scrollback, idx, grams,
+                                          ngrams, &start, &end)) {
+                from.y = (backward ? start - 1 : end) - altlines - count;
+                from.x = backward ? term->cols : 0;
+                continue;
+            }
+            okstart = start;
+            okend = end;
+        }
+
+        ldata = lineptr(y);
+        len = search_line_text(term, ldata);
+        for (lim = 0; lim < len && term->srchcols[lim] < from.x; lim++);
+        found = search_line(ctx, term->srchtext, len, lim, lim, backward,
+                            &ms, &me);
+        if (found) {
+            term->selstart.y = term->selend.y = y;
+            term->selstart.x = term->srchcols[ms];
+            term->selend.x = term->srchcols[me - 1] + 1;
+            if (term->selend.x < ldata->cols &&
+                ldata->chars[term->selend.x].chr == UCSWIDE)
+                term->selend.x++;
+        }
+        unlineptr(ldata);
+
+        if (found) {
+            term->selanchor = term->selstart;
+            term->seltype = LEXICOGRAPHIC;
+            term->selmode = SM_CHAR;
+            term->selstate = SELECTED;
+            if (y < term->disptop || y >= term->disptop + term->rows)
+                term_scroll_to_selection(term, 0);
+            else
+                term_schedule_update(term);
+            ret = TERM_SEARCH_FOUND;
+            break;
+        }
+
+        from.y += backward ? -1 : 1;
+        from.x = backward ? term->cols : 0;
+    }
+
+    if (ctx->regex) {
+        regfree(&ctx->rx);
+        strbuf_free(ctx->utf8);
+        sfree(ctx->charpos);
+        sfree(ctx->bytechar);
+    }
+    sfree(folded);
+    sfree(grams);
+    return ret;
+}
+
 /*
  * Helper routine for clipme(): growing buffer.
  */
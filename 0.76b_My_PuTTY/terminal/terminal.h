@@ -25,6 +25,7 @@ typedef struct {
 
 typedef struct termchar termchar;
 typedef struct termline termline;
+typedef struct Scrollback Scrollback;
 
 struct termchar {
     /*
@@ -78,7 +79,11 @@ struct terminal_tag {
 
     int compatibility_level;
 
-    tree234 *scrollback;	       /* lines scrolled off top of screen */
+    Scrollback *scrollback;	       /* lines scrolled off top of screen */
+    strbuf *sbline;		       /* scratch space for compressline */
+    wchar_t *srchtext;		       /* scratch space for searching */
+    int *srchcols;
+    size_t srchsize;
     tree234 *screen;		       /* lines on primary screen */
     tree234 *alt_screen;	       /* lines on alternate screen */
     int disptop;		       /* distance scrolled back (0 or -ve) */
@@ -375,6 +380,7 @@ struct terminal_tag {
 #endif
     bool scroll_on_disp;
     bool scroll_on_key;
+    int scrollback_memory;
     bool xterm_256_colour;
     bool true_colour;
 
@@ -569,4 +575,37 @@ static inline bool decpos_fn(pos *p, int cols)
 #define incpos(p) incpos_fn(&(p), GET_TERM_COLS)
 #define decpos(p) decpos_fn(&(p), GET_TERM_COLS)
 
+/*
+ * Block-packed storage for compressed scrollback lines, in
+ * scrollback.c. Index 0 is the oldest line. The data returned by
+ * scrollback_get is only valid until the next call on the same
+ * Scrollback. With a nonzero memory limit, old blocks beyond it are
+ * moved out to a spill file (see putty.h).
+ */
+Scrollback *scrollback_new(void);
+void scrollback_free(Scrollback *sb);
+void scrollback_clear(Scrollback *sb);
+void scrollback_set_memory_limit(Scrollback *sb, size_t limit);
+int scrollback_count(Scrollback *sb);
+size_t scrollback_memory(Scrollback *sb);
+uint64_t scrollback_disk_usage(Scrollback *sb);
+void scrollback_add(Scrollback *sb, ptrlen line);
+void scrollback_remove_oldest(Scrollback *sb);
+void scrollback_remove_newest(Scrollback *sb, strbuf *out);
+ptrlen scrollback_get(Scrollback *sb, int index);
+
+/*
+ * The search index. scrollback_index records the text of the line
+ * most recently added. scrollback_trigrams turns a string into the
+ * trigrams it contains, writing up to `len' of them to `out'; then
+ * scrollback_might_contain reports the range [start,end) of lines
+ * stored alongside line `index', and whether any of them might contain
+ * all those trigrams. Case is ignored throughout.
+ */
+void scrollback_index(Scrollback *sb, const wchar_t *text, size_t len);
+size_t scrollback_trigrams(const wchar_t *text, size_t len, uint32_t *out);
+bool scrollback_might_contain(Scrollback *sb, int index,
+                              const uint32_t *grams, size_t ngrams,
+                              int *start, int *end);
+
 #endif
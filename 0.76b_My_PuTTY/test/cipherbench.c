@@ -0,0 +1,354 @@
+/*
+ * cipherbench.c: check and time the multi-block SDCTR and ChaCha20
+ * code.
+ *
+ * First some known-answer tests through the ssh_cipher interface:
+ * the AES-256 CTR example from NIST SP 800-38A, a longer run of
+ * AES-128 keystream whose counter carries out of its bottom 64 bits
+ * part way through a multi-block batch, and a run of the keystream
+ * chacha20-poly1305@openssh.com encrypts packet data with. (The long
+ * expected values are SHA-256 hashes of output from another
+ * implementation.)
+ *
+ * Then each of the faster implementations is checked against the
+ * plain one it replaces: AES-NI against the software AES, and the
+ * SSE2 and AVX2 ChaCha20 against chacha20_round, fed in pieces of
+ * awkward sizes so as to start and stop in the middle of blocks and
+ * batches, and with the ChaCha20 block counter about to carry.
+ *
+ * Finally each implementation that this CPU can run is timed on 16K
+ * buffers, about the size of an SSH packet in a bulk transfer. On x86
+ * the time is also given in cycles per byte, counted by RDTSC, whose
+ * rate on modern CPUs is fixed rather than following the core clock,
+ * so treat it as a guide.
+ *
+ * This includes crypto/chacha20-poly1305.c itself, so as to be able
+ * to choose which ChaCha20 implementation to run. From the top of the
+ * source tree:
+ *
+ *   gcc -O2 -I. -Icharset -Iunix -Iutils -Issh -o cipherbench \
+ *       test/cipherbench.c crypto/aes.c crypto/aesgcm.c crypto/sha256.c \
+ *       crypto/cpu-features.c utils/memory.c utils/utils.c utils/marshal.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crypto/chacha20-poly1305.c"
+
+#if defined(__x86_64__) || defined(__i386)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+void out_of_memory(void) { fprintf(stderr, "out of memory\n"); exit(1); }
+
+static int failures;
+
+static void check(const char *what, const void *got, const void *expected,
+                  size_t len)
+{
+    if (memcmp(got, expected, len)) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void check_hash(const char *what, const void *data, size_t len,
+                       const unsigned char *expected)
+{
+    unsigned char hash[32];
+    ssh_hash *h = ssh_hash_new(&ssh_sha256);
+    put_data(h, data, len);
+    ssh_hash_final(h, hash);
+    check(what, hash, expected, 32);
+}
+
+/* Fill a buffer with something that isn't all the same */
+static void fill(unsigned char *buf, size_t len, unsigned seed)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+static void aes_kats(const ssh_cipheralg *alg256, const ssh_cipheralg *alg128,
+                     const char *name)
+{
+    static const unsigned char nist_key[32] = {
+        0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae,
+        0xf0, 0x85, 0x7d, 0x77, 0x81, 0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61,
+        0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4,
+    };
+    static const unsigned char nist_iv[16] = {
+        0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+        0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+    };
+    static const unsigned char nist_plaintext[64] = {
+        0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e,
+        0x11, 0x73, 0x93, 0x17, 0x2a, 0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03,
+        0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51, 0x30,
+        0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19,
+        0x1a, 0x0a, 0x52, 0xef, 0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b,
+        0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+    };
+    static const unsigned char nist_ciphertext[64] = {
+        0x60, 0x1e, 0xc3, 0x13, 0x77, 0x57, 0x89, 0xa5, 0xb7, 0xa7, 0xf5,
+        0x04, 0xbb, 0xf3, 0xd2, 0x28, 0xf4, 0x43, 0xe3, 0xca, 0x4d, 0x62,
+        0xb5, 0x9a, 0xca, 0x84, 0xe9, 0x90, 0xca, 0xca, 0xf5, 0xc5, 0x2b,
+        0x09, 0x30, 0xda, 0xa2, 0x3d, 0xe9, 0x4c, 0xe8, 0x70, 0x17, 0xba,
+        0x2d, 0x84, 0x98, 0x8d, 0xdf, 0xc9, 0xc5, 0x8d, 0xb6, 0x7a, 0xad,
+        0xa6, 0x13, 0xc2, 0xdd, 0x08, 0x45, 0x79, 0x41, 0xa6,
+    };
+    /* Key 00..0f, counter 0000000000000001fffffffffffffffa */
+    static const unsigned char carry_key[16] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+        0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    };
+    static const unsigned char carry_iv[16] = {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xfa,
+    };
+    static const unsigned char carry_hash[32] = {
+        0xa4, 0x90, 0x97, 0x19, 0xd6, 0x12, 0x3d, 0x30, 0x58, 0x1b, 0x1b,
+        0x73, 0x4b, 0xf4, 0x3f, 0x55, 0xfb, 0x7f, 0x9e, 0xbc, 0xc8, 0x16,
+        0x7f, 0xa9, 0xf9, 0x3b, 0xa5, 0xa1, 0x3f, 0xf2, 0x03, 0x31,
+    };
+    unsigned char buf[4096];
+    char what[80];
+    ssh_cipher *c;
+
+    c = ssh_cipher_new(alg256);
+    ssh_cipher_setkey(c, nist_key);
+    ssh_cipher_setiv(c, nist_iv);
+    memcpy(buf, nist_plaintext, 64);
+    ssh_cipher_encrypt(c, buf, 64);
+    sprintf(what, "%s: SP 800-38A F.5.5", name);
+    check(what, buf, nist_ciphertext, 64);
+    ssh_cipher_free(c);
+
+    c = ssh_cipher_new(alg128);
+    ssh_cipher_setkey(c, carry_key);
+    ssh_cipher_setiv(c, carry_iv);
+    ssh_cipher_keystream(c, buf, sizeof(buf));
+    sprintf(what, "%s: keystream across a 64-bit carry", name);
+    check_hash(what, buf, sizeof(buf), carry_hash);
+    ssh_cipher_free(c);
+}
+
+static void chacha20_kats(void)
+{
+    /* Content key 00..1f, sequence number 0x01020304 */
+    static const unsigned char first64[64] = {
+        0x96, 0xc2, 0x1c, 0xb2, 0xdb, 0x11, 0x26, 0xa9, 0xd4, 0x6d, 0x24,
+        0xfc, 0xa8, 0x40, 0x5a, 0x74, 0x01, 0x2d, 0x14, 0xd7, 0x33, 0xb9,
+        0x6d, 0xde, 0x8d, 0x72, 0x4c, 0xaa, 0x21, 0x5a, 0x2f, 0xd8, 0x60,
+        0xdd, 0x20, 0x41, 0x25, 0x70, 0xf9, 0x41, 0xc2, 0x02, 0x2b, 0x9b,
+        0x7b, 0xe8, 0xde, 0x0f, 0x8e, 0x4f, 0xbb, 0x05, 0xcb, 0x4d, 0x0e,
+        0x6b, 0xe8, 0x42, 0x3f, 0x04, 0xc2, 0xb8, 0x4b, 0x2d,
+    };
+    static const unsigned char hash4096[32] = {
+        0x45, 0x96, 0x89, 0xb9, 0x1e, 0xb7, 0xde, 0x1f, 0x0d, 0x8a, 0xa6,
+        0xf3, 0x14, 0xb4, 0x57, 0x13, 0xcd, 0xdc, 0x46, 0x84, 0xba, 0xf7,
+        0x6d, 0x61, 0x98, 0x6a, 0x96, 0xc9, 0xc6, 0x3f, 0xa3, 0x3c,
+    };
+    unsigned char key[64], lenfield[4], buf[4096];
+    int i;
+
+    for (i = 0; i < 64; i++)
+        key[i] = i;
+
+    for (i = CHACHA20_SIMD_NONE; i <= chacha20_simd_available(); i++) {
+        static const char *const names[] = { "scalar", "SSE2", "AVX2" };
+        ssh_cipher *c = ssh_cipher_new(&ssh2_chacha20_poly1305);
+        struct ccp_context *ctx =
+            container_of(c, struct ccp_context, ciph);
+        char what[80];
+
+        ssh_cipher_setkey(c, key);
+        ctx->b_cipher.simd = i;
+        ssh_cipher_encrypt_length(c, lenfield, 4, 0x01020304);
+        ssh_cipher_keystream(c, buf, sizeof(buf));
+        sprintf(what, "ChaCha20 (%s): first block", names[i]);
+        check(what, buf, first64, 64);
+        sprintf(what, "ChaCha20 (%s): 4096 bytes", names[i]);
+        check_hash(what, buf, sizeof(buf), hash4096);
+        ssh_cipher_free(c);
+    }
+}
+
+/* Compare two ciphers over data fed in pieces of varying size */
+static void aes_crosscheck(const ssh_cipheralg *fast,
+                           const ssh_cipheralg *slow, const char *name)
+{
+    unsigned char key[32], iv[16], a[8192], b[8192];
+    ssh_cipher *cf = ssh_cipher_new(fast), *cs = ssh_cipher_new(slow);
+    size_t pos, piece;
+    unsigned seed = 1;
+
+    fill(key, sizeof(key), 2);
+    memset(iv, 0xFF, sizeof(iv));
+    iv[0] = 0x12;
+    iv[15] = 0xF0;                       /* carry after 15 blocks */
+    ssh_cipher_setkey(cf, key);
+    ssh_cipher_setkey(cs, key);
+    ssh_cipher_setiv(cf, iv);
+    ssh_cipher_setiv(cs, iv);
+    fill(a, sizeof(a), 3);
+    memcpy(b, a, sizeof(b));
+    for (pos = 0; pos < sizeof(a); pos += piece) {
+        seed = seed * 1103515245 + 12345;
+        piece = 16 * ((seed >> 16) % 20 + 1);
+        if (piece > sizeof(a) - pos)
+            piece = sizeof(a) - pos;
+        ssh_cipher_encrypt(cf, a + pos, piece);
+        ssh_cipher_encrypt(cs, b + pos, piece);
+    }
+    check(name, a, b, sizeof(a));
+    ssh_cipher_free(cf);
+    ssh_cipher_free(cs);
+}
+
+static void chacha20_crosscheck(int simd, const char *name)
+{
+    struct chacha20 fast, slow;
+    unsigned char key[32], iv[8], a[8192], b[8192];
+    size_t pos, piece;
+    unsigned seed = 1;
+
+    fill(key, sizeof(key), 4);
+    fill(iv, sizeof(iv), 5);
+    chacha20_key(&fast, key);
+    chacha20_key(&slow, key);
+    chacha20_iv(&fast, iv);
+    chacha20_iv(&slow, iv);
+    fast.simd = simd;
+    slow.simd = CHACHA20_SIMD_NONE;
+    /* Make the counter carry into its top word in mid-batch */
+    fast.state[12] = slow.state[12] = 0xFFFFFFFD;
+
+    fill(a, sizeof(a), 6);
+    memcpy(b, a, sizeof(b));
+    for (pos = 0; pos < sizeof(a); pos += piece) {
+        seed = seed * 1103515245 + 12345;
+        piece = (seed >> 16) % 1100 + 1;
+        if (piece > sizeof(a) - pos)
+            piece = sizeof(a) - pos;
+        chacha20_encrypt(&fast, a + pos, piece);
+        chacha20_encrypt(&slow, b + pos, piece);
+    }
+    check(name, a, b, sizeof(a));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef void (*bench_fn)(void *ctx, unsigned char *buf, int len);
+
+static void bench(const char *name, bench_fn fn, void *ctx)
+{
+    static unsigned char buf[16384];
+    size_t bytes = 0;
+    double start = now(), end;
+#ifdef HAVE_RDTSC
+    unsigned long long tsc = __rdtsc();
+#endif
+
+    do {
+        int i;
+        for (i = 0; i < 64; i++)
+            fn(ctx, buf, sizeof(buf));
+        bytes += 64 * sizeof(buf);
+    } while ((end = now()) - start < 0.25);
+
+    printf("  %-28s %8.1f MB/s", name, bytes / (end - start) / 1e6);
+#ifdef HAVE_RDTSC
+    printf("  %6.2f cycles/byte", (double)(__rdtsc() - tsc) / bytes);
+#endif
+    printf("\n");
+}
+
+static void bench_cipher(void *ctx, unsigned char *buf, int len)
+{
+    ssh_cipher_encrypt((ssh_cipher *)ctx, buf, len);
+}
+
+static void bench_chacha20(void *ctx, unsigned char *buf, int len)
+{
+    chacha20_encrypt((struct chacha20 *)ctx, buf, len);
+}
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        const ssh_cipheralg *sw, *hw;
+    } aes[] = {
+        { "aes128-ctr", &ssh_aes128_sdctr_sw, &ssh_aes128_sdctr_hw },
+        { "aes256-ctr", &ssh_aes256_sdctr_sw, &ssh_aes256_sdctr_hw },
+    };
+    static const char *const chacha_names[] = {
+        "chacha20 (scalar)", "chacha20 (SSE2, 4 blocks)",
+        "chacha20 (AVX2, 8 blocks)",
+    };
+    ssh_cipher *probe = ssh_cipher_new(&ssh_aes128_sdctr_hw);
+    bool aes_hw = (probe != NULL);
+    int simd = chacha20_simd_available(), i;
+    unsigned char key[32] = { 0 }, iv[16] = { 0 };
+
+    if (probe)
+        ssh_cipher_free(probe);
+
+    printf("Known-answer tests and cross-checks\n");
+    aes_kats(&ssh_aes256_sdctr_sw, &ssh_aes128_sdctr_sw, "AES (software)");
+    if (aes_hw) {
+        aes_kats(&ssh_aes256_sdctr_hw, &ssh_aes128_sdctr_hw, "AES (hardware)");
+        aes_crosscheck(&ssh_aes128_sdctr_hw, &ssh_aes128_sdctr_sw,
+                       "aes128-ctr hardware against software");
+        aes_crosscheck(&ssh_aes256_sdctr_hw, &ssh_aes256_sdctr_sw,
+                       "aes256-ctr hardware against software");
+    }
+    chacha20_kats();
+    for (i = CHACHA20_SIMD_NONE + 1; i <= simd; i++)
+        chacha20_crosscheck(i, chacha_names[i]);
+    printf("  %s\n", failures ? "FAILED" : "all passed");
+
+    printf("Speed\n");
+    for (i = 0; i < lenof(aes); i++) {
+        char name[40];
+        ssh_cipher *c;
+
+        sprintf(name, "%s (software)", aes[i].name);
+        c = ssh_cipher_new(aes[i].sw);
+        ssh_cipher_setkey(c, key);
+        ssh_cipher_setiv(c, iv);
+        bench(name, bench_cipher, c);
+        ssh_cipher_free(c);
+
+        if (aes_hw) {
+            sprintf(name, "%s (hardware)", aes[i].name);
+            c = ssh_cipher_new(aes[i].hw);
+            ssh_cipher_setkey(c, key);
+            ssh_cipher_setiv(c, iv);
+            bench(name, bench_cipher, c);
+            ssh_cipher_free(c);
+        }
+    }
+    for (i = CHACHA20_SIMD_NONE; i <= simd; i++) {
+        struct chacha20 ctx;
+        chacha20_key(&ctx, key);
+        chacha20_iv(&ctx, iv);
+        ctx.simd = i;
+        bench(chacha_names[i], bench_chacha20, &ctx);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * confbench.c: check utils/conf.c, and time reading options from it.
+ *
+ * Every option is set to a value of its type (and the options with
+ * subkeys get a few entries each), and then read back, copied,
+ * serialised and deserialised, and checked at each stage.
+ *
+ * Then the options without subkeys are read over and over, as the
+ * terminal and the front end do, and the time per read is compared
+ * with finding the same options in a tree234 keyed on the primary
+ * key, which is what conf.c used to do for every read. Copying a
+ * whole Conf is timed as well.
+ *
+ * Usage: confbench [-r rounds]
+ *
+ * From the top of the source tree:
+ *
+ *   gcc -O2 -I. -Icharset -Iunix -Iutils -o confbench test/confbench.c \
+ *       utils/conf.c utils/tree234.c utils/memory.c utils/utils.c \
+ *       utils/marshal.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "putty.h"
+#include "tree234.h"
+
+void out_of_memory(void) { fprintf(stderr, "out of memory\n"); exit(1); }
+
+/* The parts of the platform code conf.c expects */
+Filename *filename_from_str(const char *str)
+{
+    Filename *fn = snew(Filename);
+    fn->path = dupstr(str);
+    return fn;
+}
+Filename *filename_copy(const Filename *fn)
+{
+    return filename_from_str(fn->path);
+}
+void filename_free(Filename *fn)
+{
+    sfree(fn->path);
+    sfree(fn);
+}
+void filename_serialise(BinarySink *bs, const Filename *f)
+{
+    put_asciz(bs, f->path);
+}
+Filename *filename_deserialise(BinarySource *src)
+{
+    return filename_from_str(get_asciz(src));
+}
+FontSpec *fontspec_new(const char *name)
+{
+    FontSpec *f = snew(FontSpec);
+    f->name = dupstr(name);
+    return f;
+}
+FontSpec *fontspec_copy(const FontSpec *f)
+{
+    return fontspec_new(f->name);
+}
+void fontspec_free(FontSpec *f)
+{
+    sfree(f->name);
+    sfree(f);
+}
+void fontspec_serialise(BinarySink *bs, FontSpec *f)
+{
+    put_asciz(bs, f->name);
+}
+FontSpec *fontspec_deserialise(BinarySource *src)
+{
+    return fontspec_new(get_asciz(src));
+}
+
+enum { T_NONE, T_BOOL, T_INT, T_STR, T_FILENAME, T_FONT };
+#define SUBKEYTYPE(valtype, keytype, keyword) T_ ## keytype,
+static const int subkeytypes[] = { CONFIG_OPTIONS(SUBKEYTYPE) };
+#define VALUETYPE(valtype, keytype, keyword) T_ ## valtype,
+static const int valuetypes[] = { CONFIG_OPTIONS(VALUETYPE) };
+
+static void fill(Conf *conf)
+{
+    char buf[64];
+    int i, j;
+
+    for (i = 0; i < N_CONFIG_OPTIONS; i++) {
+        sprintf(buf, "option %d", i);
+        switch (subkeytypes[i]) {
+          case T_NONE:
+            switch (valuetypes[i]) {
+              case T_BOOL: conf_set_bool(conf, i, i & 1); break;
+              case T_INT: conf_set_int(conf, i, i * 7); break;
+              case T_STR: conf_set_str(conf, i, buf); break;
+              case T_FILENAME: {
+                Filename *fn = filename_from_str(buf);
+                conf_set_filename(conf, i, fn);
+                filename_free(fn);
+                break;
+              }
+              case T_FONT: {
+                FontSpec *fs = fontspec_new(buf);
+                conf_set_fontspec(conf, i, fs);
+                fontspec_free(fs);
+                break;
+              }
+            }
+            break;
+          case T_INT:
+            for (j = 0; j < 8; j++)
+                conf_set_int_int(conf, i, j, i + j);
+            break;
+          case T_STR:
+            for (j = 0; j < 3; j++) {
+                char key[16];
+                sprintf(key, "key%d", 2 - j);
+                conf_set_str_str(conf, i, key, buf);
+            }
+            break;
+        }
+    }
+}
+
+static int check_conf(Conf *conf, const char *what)
+{
+    char buf[64], *key;
+    int errors = 0, i, j;
+
+    for (i = 0; i < N_CONFIG_OPTIONS; i++) {
+        bool ok = true;
+        sprintf(buf, "option %d", i);
+        switch (subkeytypes[i]) {
+          case T_NONE:
+            switch (valuetypes[i]) {
+              case T_BOOL: ok = conf_get_bool(conf, i) == (i & 1); break;
+              case T_INT: ok = conf_get_int(conf, i) == i * 7; break;
+              case T_STR: ok = !strcmp(conf_get_str(conf, i), buf); break;
+              case T_FILENAME:
+                ok = !strcmp(conf_get_filename(conf, i)->path, buf);
+                break;
+              case T_FONT:
+                ok = !strcmp(conf_get_fontspec(conf, i)->name, buf);
+                break;
+            }
+            break;
+          case T_INT:
+            for (j = 0; j < 8; j++)
+                if (conf_get_int_int(conf, i, j) != i + j)
+                    ok = false;
+            break;
+          case T_STR:
+            if (strcmp(conf_get_str_str(conf, i, "key1"), buf) ||
+                conf_get_str_str_opt(conf, i, "key3") ||
+                !conf_get_str_strs(conf, i, NULL, &key) ||
+                strcmp(key, "key0") ||
+                strcmp(conf_get_str_nthstrkey(conf, i, 2), "key2") ||
+                conf_get_str_nthstrkey(conf, i, 3))
+                ok = false;
+            break;
+        }
+        if (!ok && errors++ < 10)
+            fprintf(stderr, "%s: option %d is wrong\n", what, i);
+    }
+    return errors;
+}
+
+static int check(void)
+{
+    Conf *conf = conf_new(), *copy, *copy2;
+    strbuf *ser = strbuf_new(), *ser2 = strbuf_new();
+    BinarySource src[1];
+    int errors = 0, i;
+
+    fill(conf);
+    errors += check_conf(conf, "filled");
+
+    /* setting options again, even to their own values, changes nothing */
+    fill(conf);
+    for (i = 0; i < N_CONFIG_OPTIONS; i++)
+        if (subkeytypes[i] == T_NONE && valuetypes[i] == T_STR)
+            conf_set_str(conf, i, conf_get_str(conf, i));
+    errors += check_conf(conf, "refilled");
+
+    copy = conf_copy(conf);
+    errors += check_conf(copy, "copied");
+    copy2 = conf_new();
+    conf_set_int(copy2, CONF_port, 1);
+    conf_set_str_str(copy2, CONF_environmt, "stale", "x");
+    conf_copy_into(copy2, copy);
+    conf_free(copy);
+    errors += check_conf(copy2, "copied into");
+    conf_free(copy2);
+
+    conf_serialise(BinarySink_UPCAST(ser), conf);
+    copy = conf_new();
+    BinarySource_BARE_INIT(src, ser->u, ser->len);
+    if (!conf_deserialise(copy, src) || get_avail(src) != 0) {
+        fprintf(stderr, "deserialise failed\n");
+        errors++;
+    }
+    errors += check_conf(copy, "deserialised");
+    conf_serialise(BinarySink_UPCAST(ser2), copy);
+    if (ser->len != ser2->len || memcmp(ser->u, ser2->u, ser->len)) {
+        fprintf(stderr, "serialisations differ\n");
+        errors++;
+    }
+    conf_free(copy);
+
+    conf_del_str_str(conf, CONF_environmt, "key1");
+    if (conf_get_str_str_opt(conf, CONF_environmt, "key1") ||
+        !conf_get_str_str_opt(conf, CONF_environmt, "key2")) {
+        fprintf(stderr, "delete failed\n");
+        errors++;
+    }
+
+    strbuf_free(ser);
+    strbuf_free(ser2);
+    conf_free(conf);
+    return errors;
+}
+
+/* What a read used to cost: a find234 on the primary key */
+struct oldentry {
+    int primary;
+    int value;
+};
+
+static int oldcmp(void *av, void *bv)
+{
+    struct oldentry *a = (struct oldentry *)av, *b = (struct oldentry *)bv;
+    return a->primary < b->primary ? -1 : a->primary > b->primary ? +1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int keys[N_CONFIG_OPTIONS], nkeys = 0, rounds = 20000, errors, i, r;
+    struct oldentry entries[N_CONFIG_OPTIONS];
+    tree234 *tree = newtree234(oldcmp);
+    Conf *conf;
+    clock_t start;
+    double tnew, told, tcopy;
+    long sum = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: confbench [-r rounds]\n");
+            return 1;
+        }
+    }
+    if (rounds < 1) {
+        fprintf(stderr, "confbench: bad number of rounds\n");
+        return 1;
+    }
+
+    if ((errors = check()) != 0) {
+        fprintf(stderr, "%d errors\n", errors);
+        return 1;
+    }
+    printf("%d options, all read back correctly\n", N_CONFIG_OPTIONS);
+
+    conf = conf_new();
+    fill(conf);
+    for (i = 0; i < N_CONFIG_OPTIONS; i++) {
+        if (subkeytypes[i] == T_NONE &&
+            (valuetypes[i] == T_BOOL || valuetypes[i] == T_INT)) {
+            keys[nkeys++] = i;
+            entries[i].primary = i;
+            entries[i].value = (valuetypes[i] == T_BOOL ?
+                                conf_get_bool(conf, i) : conf_get_int(conf, i));
+            add234(tree, &entries[i]);
+        }
+    }
+
+    start = clock();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < nkeys; i++)
+            sum += (valuetypes[keys[i]] == T_BOOL ?
+                    conf_get_bool(conf, keys[i]) :
+                    conf_get_int(conf, keys[i]));
+    tnew = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < nkeys; i++) {
+            struct oldentry key, *e;
+            key.primary = keys[i];
+            e = find234(tree, &key, NULL);
+            sum += e->value;
+        }
+    told = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    for (r = 0; r < rounds / 100 + 1; r++)
+        conf_free(conf_copy(conf));
+    tcopy = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%d bool and int options, %d rounds (%ld)\n", nkeys, rounds, sum);
+    printf("array read  %8.2f ns\n", tnew * 1e9 / ((double)rounds * nkeys));
+    printf("tree read   %8.2f ns\n", told * 1e9 / ((double)rounds * nkeys));
+    printf("conf_copy   %8.2f us\n", tcopy * 1e6 / (rounds / 100 + 1));
+
+    freetree234(tree);
+    conf_free(conf);
+    return 0;
+}
@@ -1,6 +1,23 @@
+/*
+ * fuzzterm: feed standard input to a terminal with no window, and
+ * print a transcript of what it draws.
+ *
+ * With -b it is instead a throughput benchmark, timing the terminal
+ * the way 'cat' of a big file into a window exercises it: the whole
+ * of standard input is read first, then passed to the terminal
+ * several times over in large blocks, with a screen update after each
+ * (drawn into nothing), and the rate is reported.
+ *
+ * Usage: fuzzterm < input
+ *        fuzzterm -b [-n passes] [-r rows] [-c cols] [-s scrollback]
+ *                    < input
+ */
+
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "putty.h"
 #include "dialog.h"
@@ -11,6 +28,45 @@ const bool buildinfo_gtk_relevant = false;
 
 static const TermWinVtable fuzz_termwin_vt;
 
+static bool quiet = false;             /* don't print what gets drawn */
+
+static int bench(Terminal *term, int passes)
+{
+        char *data = NULL;
+        size_t datasize = 0, datalen = 0, pos;
+        clock_t start;
+        double secs;
+        int c, i;
+
+        while ((c = getchar()) != EOF) {
+                sgrowarray(data, datasize, datalen);
+                data[datalen++] = c;
+        }
+        if (!datalen) {
+                fprintf(stderr, "fuzzterm: no input\n");
+                return 1;
+        }
+
+        start = clock();
+        for (i = 0; i < passes; i++) {
+                for (pos = 0; pos < datalen; pos += 16384) {
+                        size_t len = datalen - pos;
+                        if (len > 16384)
+                                len = 16384;
+                        term_data(term, false, data + pos, len);
+                        term_update(term);
+                }
+        }
+        secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (secs < 1e-6)
+                secs = 1e-6;
+
+        printf("%zu bytes x %d passes: %.3f s, %.1f MB/s\n",
+               datalen, passes, secs, datalen * (double)passes / secs / 1e6);
+        sfree(data);
+        return 0;
+}
+
 int main(int argc, char **argv)
 {
         char blk[512];
@@ -19,6 +75,31 @@ int main(int argc, char **argv)
         Conf *conf;
         struct unicode_data ucsdata;
         TermWin termwin;
+        bool benchmark = false;
+        int passes = 10, rows = 24, cols = 80, savelines = 10000, i;
+
+        for (i = 1; i < argc; i++) {
+                if (!strcmp(argv[i], "-b"))
+                        benchmark = true;
+                else if (!strcmp(argv[i], "-n") && i+1 < argc)
+                        passes = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-r") && i+1 < argc)
+                        rows = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-c") && i+1 < argc)
+                        cols = atoi(argv[++i]);
+                else if (!strcmp(argv[i], "-s") && i+1 < argc)
+                        savelines = atoi(argv[++i]);
+                else {
+                        fprintf(stderr, "usage: fuzzterm [-b [-n passes] "
+                                "[-r rows] [-c cols] [-s scrollback]] "
+                                "< input\n");
+                        return 1;
+                }
+        }
+        if (passes < 1 || rows < 1 || cols < 1 || savelines < 0) {
+                fprintf(stderr, "fuzzterm: bad pass count or screen size\n");
+                return 1;
+        }
 
         termwin.vt = &fuzz_termwin_vt;
 
@@ -29,8 +110,14 @@ int main(int argc, char **argv)
                  CS_NONE, conf_get_int(conf, CONF_vtmode));
 
         term = term_init(conf, &ucsdata, &termwin);
-        term_size(term, 24, 80, 10000);
+        term_size(term, rows, cols, savelines);
         term->ldisc = NULL;
+
+        if (benchmark) {
+                quiet = true;
+                return bench(term, passes);
+        }
+
         /* Tell american fuzzy lop that this is a good place to fork. */
 #ifdef __AFL_HAVE_MANUAL_CONTROL
         __AFL_INIT();
@@ -51,6 +138,8 @@ static void fuzz_draw_text(
 {
     int i;
 
+    if (quiet)
+        return;
     printf("TEXT[attr=%08lx,lattr=%02x]@(%d,%d):", attr, lattr, x, y);
     for (i = 0; i < len; i++) {
         printf(" %x", (unsigned)text[i]);
@@ -63,6 +152,8 @@ static void fuzz_draw_cursor(
 {
     int i;
 
+    if (quiet)
+        return;
     printf("CURS[attr=%08lx,lattr=%02x]@(%d,%d):", attr, lattr, x, y);
     for (i = 0; i < len; i++) {
         printf(" %x", (unsigned)text[i]);
@@ -71,6 +162,8 @@ static void fuzz_draw_cursor(
 }
 static void fuzz_draw_trust_sigil(TermWin *tw, int x, int y)
 {
+    if (quiet)
+        return;
     printf("TRUST@(%d,%d)\n", x, y);
 }
 static int fuzz_char_width(TermWin *tw, int uc) { return 1; }
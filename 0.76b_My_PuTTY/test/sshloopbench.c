@@ -0,0 +1,2133 @@
+/*
+ * sshloopbench.c: time whole SSH-2 sessions between PuTTY's own
+ * client and server, with no network in between.
+ *
+ * The client and server halves of the SSH code can't be linked into
+ * the same program (each defines the connection layer's and the
+ * top-level Ssh's functions its own way), so this file is built
+ * twice: once as the client, which drives everything and prints the
+ * results, and once with LOOPBENCH_SERVER defined as the server. The
+ * client starts the server as a child process and, for each SSH
+ * connection, makes a socketpair and hands one end of it to the
+ * server over a control socket, along with the algorithms the server
+ * should insist on. Everything else - host keys, authentication (the
+ * server accepts "none"), the commands run in session channels, the
+ * SFTP server's files, the far ends of forwarded ports - is made up
+ * in memory, so the only costs measured are those of the SSH code
+ * itself and the kernel's socket copies.
+ *
+ * The scenarios are
+ *
+ *   kex       repeated connection setup (key exchange, host key
+ *             signature, userauth "none", opening the session
+ *             channel), for each key exchange and host key type
+ *   upload    bulk data from client to server in the session channel
+ *   download  bulk data from server to client in the session channel,
+ *             both of those for each cipher, MAC and compression
+ *   sftp      SFTP get and put of one large file
+ *   channels  many port-forwarded connections at once, each carrying
+ *             an equal share of the data from client to server
+ *
+ * and for each combination of algorithms the rate (handshakes/s or
+ * MB/s of payload) is reported, along with the CPU time each side
+ * used per handshake or per byte (from getrusage, so it includes any
+ * crypto threads).
+ *
+ * Usage: sshloopbench [-n megabytes] [-c channels] [-t seconds]
+ *                     [-T crypto-threads] [-s server-program] [-v]
+ *                     [scenario...]
+ *
+ * From the top of the source tree, with COMMON, CLIENT and SERVER
+ * holding the lists of files below:
+ *
+ *   gcc -O2 -DNO_GSSAPI -I. -Icharset -Iunix -Iutils -Issh -Icrypto \
+ *       -Iterminal -o sshloopbench test/sshloopbench.c \
+ *       $COMMON $CLIENT -lpthread -lm
+ *   gcc -O2 -DNO_GSSAPI -DLOOPBENCH_SERVER -I. -Icharset -Iunix \
+ *       -Iutils -Issh -Icrypto -Iterminal -o sshloopbench-server \
+ *       test/sshloopbench.c $COMMON $SERVER -lpthread -lm
+ *
+ *   COMMON="callback.c timing.c settings.c sshrand.c sshpubk.c
+ *       errsock.c ssh/common.c ssh/verstring.c ssh/bpp2.c
+ *       ssh/bpp2-pipeline.c ssh/bpp-bare.c ssh/bpp1.c ssh/censor1.c
+ *       ssh/censor2.c ssh/zlib.c ssh/crc-attack-detector.c
+ *       ssh/transport2.c ssh/connection2.c ssh/connection1.c
+ *       ssh/portfwd.c ssh/x11fwd.c ssh/sftpcommon.c
+ *       ssh/transient-hostkey-cache.c stubs/nullplug.c
+ *       unix/utils/threads.c", plus every .c file in crypto and utils
+ *   CLIENT="ssh/ssh.c ssh/kex2-client.c ssh/userauth2-client.c
+ *       ssh/connection2-client.c ssh/connection1-client.c ssh/login1.c
+ *       ssh/mainchan.c ssh/agentf.c ssh/nosharing.c ssh/sftp.c
+ *       pinger.c"
+ *   SERVER="ssh/server.c ssh/kex2-server.c ssh/userauth2-server.c
+ *       ssh/connection2-server.c ssh/connection1-server.c
+ *       ssh/login1-server.c ssh/sesschan.c ssh/sftpserver.c
+ *       ssh/scpserver.c", plus every .c file in keygen
+ *
+ * The client looks for the server program next to itself unless -s
+ * says otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "putty.h"
+#include "ssh.h"
+#include "ssh/channel.h"
+#include "ssh/sftp.h"
+#ifdef LOOPBENCH_SERVER
+#include "ssh/server.h"
+#include "sshkeygen.h"
+#endif
+
+static bool verbose;
+
+/* How much either end lets pile up in a channel before it waits */
+#define SEND_BACKLOG 1048576
+
+/*
+ * The data sent is taken from a megabyte of lines of lower-case
+ * 'words', so that compression has about as much to do as it would
+ * with text, rather than with a buffer of zeroes. (A megabyte, so
+ * that zlib's 32K window never sees the same data twice.)
+ */
+#define PATTERN_SIZE 1048576
+
+static const char *pattern_data(uint64_t pos, size_t *len)
+{
+    static char *pattern;
+
+    if (!pattern) {
+        uint32_t state = 12345;
+        pattern = snewn(PATTERN_SIZE, char);
+        for (size_t i = 0; i < PATTERN_SIZE; i++) {
+            state ^= state << 13;       /* xorshift32 */
+            state ^= state >> 17;
+            state ^= state << 5;
+            unsigned r = state % 32;
+            pattern[i] = r < 26 ? 'a' + r : r < 31 ? ' ' : '\n';
+        }
+    }
+
+    size_t offset = pos % PATTERN_SIZE;
+    if (*len > PATTERN_SIZE - offset)
+        *len = PATTERN_SIZE - offset;
+    return pattern + offset;
+}
+
+static void pattern_copy(char *buf, uint64_t pos, size_t len)
+{
+    while (len > 0) {
+        size_t chunk = len;
+        const char *data = pattern_data(pos, &chunk);
+        memcpy(buf, data, chunk);
+        buf += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * The event loop: timers, toplevel callbacks, and a few real file
+ * descriptors, plus 'pumps' that are called every time round to move
+ * data that isn't waiting on any descriptor.
+ */
+
+unsigned long getticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * TICKSPERSEC + ts.tv_nsec / (1000000000 / TICKSPERSEC);
+}
+
+static unsigned long next_timer;
+static bool timer_pending;
+
+void timer_change_notify(unsigned long next)
+{
+    next_timer = next;
+    timer_pending = true;
+}
+
+typedef bool (*pump_fn_t)(void *ctx);  /* returns true if it did anything */
+typedef struct Pump { pump_fn_t fn; void *ctx; } Pump;
+static Pump *pumps;
+static size_t npumps, pumpsize;
+
+static void pump_add(pump_fn_t fn, void *ctx)
+{
+    sgrowarray(pumps, pumpsize, npumps);
+    pumps[npumps].fn = fn;
+    pumps[npumps].ctx = ctx;
+    npumps++;
+}
+
+static void pump_remove(void *ctx)
+{
+    for (size_t i = 0; i < npumps; i++)
+        if (pumps[i].ctx == ctx)
+            pumps[i].fn = NULL;        /* tidied up by the loop */
+}
+
+typedef struct FdSocket FdSocket;
+static FdSocket **fdsocks;
+static size_t nfdsocks, fdsocksize;
+static void fdsocket_poll_setup(FdSocket *fs, struct pollfd *pfd);
+static void fdsocket_poll_result(FdSocket *fs, struct pollfd *pfd);
+static void fdsockets_reap(void);
+
+/* An extra descriptor the loop should watch, and what to do about it */
+static int extra_fd = -1;
+static void (*extra_fd_readable)(void);
+
+static void loop_once(void)
+{
+    bool busy = false;
+
+    if (run_toplevel_callbacks())
+        busy = true;
+
+    for (size_t i = 0; i < npumps; i++)
+        if (pumps[i].fn && pumps[i].fn(pumps[i].ctx))
+            busy = true;
+    size_t j = 0;
+    for (size_t i = 0; i < npumps; i++)
+        if (pumps[i].fn)
+            pumps[j++] = pumps[i];
+    npumps = j;
+
+    if (toplevel_callback_pending())
+        busy = true;
+
+    int timeout = -1;
+    if (busy) {
+        timeout = 0;
+    } else if (timer_pending) {
+        long diff = (long)(next_timer - GETTICKCOUNT());
+        timeout = diff <= 0 ? 0 : diff;
+    }
+
+    size_t n = nfdsocks;
+    struct pollfd *pfds = snewn(n + 1, struct pollfd);
+    for (size_t i = 0; i < n; i++)
+        fdsocket_poll_setup(fdsocks[i], &pfds[i]);
+    pfds[n].fd = extra_fd;
+    pfds[n].events = POLLIN;
+    pfds[n].revents = 0;
+
+    if (poll(pfds, n + 1, timeout) < 0 && errno != EINTR) {
+        perror("sshloopbench: poll");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        fdsocket_poll_result(fdsocks[i], &pfds[i]);
+    if (extra_fd >= 0 && (pfds[n].revents & (POLLIN | POLLHUP)))
+        extra_fd_readable();
+    sfree(pfds);
+
+    fdsockets_reap();
+
+    if (timer_pending) {
+        unsigned long now = GETTICKCOUNT(), next;
+        if (now - next_timer < ULONG_MAX / 2) {
+            if (run_timers(now, &next))
+                next_timer = next;
+            else
+                timer_pending = false;
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * A Socket on a real (socketpair) file descriptor, carrying an SSH
+ * connection.
+ */
+
+struct FdSocket {
+    int fd;
+    Plug *plug;
+    bufchain output;
+    bool frozen, want_eof, sent_eof, got_eof, closed;
+    char *error;
+    Socket sock;
+};
+
+static Plug *fdsocket_plug(Socket *s, Plug *p)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    Plug *ret = fs->plug;
+    if (p)
+        fs->plug = p;
+    return ret;
+}
+
+static void fdsocket_close(Socket *s)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    fs->closed = true;                 /* freed when the loop next can */
+}
+
+static void fdsocket_try_send(FdSocket *fs)
+{
+    size_t sent = 0;
+
+    while (bufchain_size(&fs->output) > 0) {
+        ptrlen data = bufchain_prefix(&fs->output);
+        ssize_t ret = send(fs->fd, data.ptr, data.len,
+                           MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && !fs->error)
+                fs->error = dupstr(strerror(errno));
+            break;
+        }
+        bufchain_consume(&fs->output, ret);
+        sent += ret;
+    }
+
+    if (fs->want_eof && !fs->sent_eof && bufchain_size(&fs->output) == 0) {
+        shutdown(fs->fd, SHUT_WR);
+        fs->sent_eof = true;
+    }
+
+    if (sent && !fs->closed)
+        plug_sent(fs->plug, bufchain_size(&fs->output));
+}
+
+static size_t fdsocket_write(Socket *s, const void *data, size_t len)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    bufchain_add(&fs->output, data, len);
+    return bufchain_size(&fs->output);
+}
+
+static void fdsocket_write_eof(Socket *s)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    fs->want_eof = true;
+}
+
+static void fdsocket_set_frozen(Socket *s, bool is_frozen)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    fs->frozen = is_frozen;
+}
+
+static const char *fdsocket_socket_error(Socket *s)
+{
+    FdSocket *fs = container_of(s, FdSocket, sock);
+    return fs->error;
+}
+
+static SocketPeerInfo *fdsocket_peer_info(Socket *s)
+{
+    return NULL;
+}
+
+static const SocketVtable fdsocket_vt = {
+    .plug = fdsocket_plug,
+    .close = fdsocket_close,
+    .write = fdsocket_write,
+    .write_oob = fdsocket_write,
+    .write_eof = fdsocket_write_eof,
+    .set_frozen = fdsocket_set_frozen,
+    .socket_error = fdsocket_socket_error,
+    .peer_info = fdsocket_peer_info,
+};
+
+static Socket *fdsocket_new(int fd, Plug *plug)
+{
+    FdSocket *fs = snew(FdSocket);
+    memset(fs, 0, sizeof(*fs));
+    fs->fd = fd;
+    fs->plug = plug;
+    fs->sock.vt = &fdsocket_vt;
+    bufchain_init(&fs->output);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    sgrowarray(fdsocks, fdsocksize, nfdsocks);
+    fdsocks[nfdsocks++] = fs;
+    return &fs->sock;
+}
+
+static void fdsocket_poll_setup(FdSocket *fs, struct pollfd *pfd)
+{
+    pfd->fd = fs->closed ? -1 : fs->fd;
+    pfd->events = 0;
+    pfd->revents = 0;
+    if (!fs->frozen && !fs->got_eof)
+        pfd->events |= POLLIN;
+    if (bufchain_size(&fs->output) > 0)
+        pfd->events |= POLLOUT;
+}
+
+static void fdsocket_poll_result(FdSocket *fs, struct pollfd *pfd)
+{
+    static char buf[262144];
+
+    if (fs->closed)
+        return;
+
+    if (pfd->revents & POLLOUT)
+        fdsocket_try_send(fs);
+    if (fs->closed)
+        return;
+
+    if (fs->error) {
+        char *error = fs->error;
+        fs->error = NULL;
+        plug_closing(fs->plug, error, 0, false);
+        sfree(error);
+        return;
+    }
+
+    if (pfd->revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t ret = recv(fs->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (ret > 0) {
+            plug_receive(fs->plug, 0, buf, ret);
+        } else if (ret == 0) {
+            fs->got_eof = true;
+            plug_closing(fs->plug, NULL, 0, false);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            plug_closing(fs->plug, strerror(errno), errno, false);
+        }
+    }
+
+    /* Anything written while handling that can go straight away */
+    if (!fs->closed && bufchain_size(&fs->output) > 0)
+        fdsocket_try_send(fs);
+}
+
+static void fdsockets_reap(void)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < nfdsocks; i++) {
+        FdSocket *fs = fdsocks[i];
+        if (fs->closed) {
+            close(fs->fd);
+            bufchain_clear(&fs->output);
+            sfree(fs->error);
+            sfree(fs);
+        } else {
+            fdsocks[j++] = fs;
+        }
+    }
+    nfdsocks = j;
+}
+
+/* ----------------------------------------------------------------------
+ * An in-memory Socket standing for the far end of a forwarded port:
+ * something that sends 'to_send' bytes (as fast as the SSH side will
+ * take them, in 32K chunks) and then EOF, or, with 'eof_on_eof', sends
+ * nothing and answers EOF with EOF. Whatever arrives is counted.
+ */
+
+typedef struct MemSocket {
+    Plug *plug;
+    uint64_t to_send, received;
+    bool frozen, eof_on_eof, got_eof, sent_eof, closed;
+    void (*on_close)(struct MemSocket *ms);
+    Socket sock;
+} MemSocket;
+
+static Plug *memsocket_plug(Socket *s, Plug *p)
+{
+    MemSocket *ms = container_of(s, MemSocket, sock);
+    Plug *ret = ms->plug;
+    if (p)
+        ms->plug = p;
+    return ret;
+}
+
+static void memsocket_close(Socket *s)
+{
+    MemSocket *ms = container_of(s, MemSocket, sock);
+    ms->closed = true;                 /* freed by its pump */
+    if (ms->on_close)
+        ms->on_close(ms);
+}
+
+static size_t memsocket_write(Socket *s, const void *data, size_t len)
+{
+    MemSocket *ms = container_of(s, MemSocket, sock);
+    ms->received += len;
+    return 0;
+}
+
+static void memsocket_write_eof(Socket *s)
+{
+    MemSocket *ms = container_of(s, MemSocket, sock);
+    ms->got_eof = true;
+}
+
+static void memsocket_set_frozen(Socket *s, bool is_frozen)
+{
+    MemSocket *ms = container_of(s, MemSocket, sock);
+    ms->frozen = is_frozen;
+}
+
+static const char *memsocket_socket_error(Socket *s)
+{
+    return NULL;
+}
+
+static const SocketVtable memsocket_vt = {
+    .plug = memsocket_plug,
+    .close = memsocket_close,
+    .write = memsocket_write,
+    .write_oob = memsocket_write,
+    .write_eof = memsocket_write_eof,
+    .set_frozen = memsocket_set_frozen,
+    .socket_error = memsocket_socket_error,
+    .peer_info = fdsocket_peer_info,
+};
+
+static bool memsocket_pump(void *ctx)
+{
+    MemSocket *ms = (MemSocket *)ctx;
+
+    if (ms->closed) {
+        pump_remove(ms);
+        sfree(ms);
+        return true;
+    }
+
+    if (ms->frozen || ms->sent_eof)
+        return false;
+
+    if (ms->to_send > 0) {
+        size_t len = ms->to_send < 32768 ? ms->to_send : 32768;
+        const char *data = pattern_data(ms->to_send, &len);
+        ms->to_send -= len;
+        plug_receive(ms->plug, 0, data, len);
+        return true;
+    }
+
+    if (!ms->eof_on_eof || ms->got_eof) {
+        ms->sent_eof = true;
+        plug_closing(ms->plug, NULL, 0, false);
+        return true;
+    }
+
+    return false;
+}
+
+static MemSocket *memsocket_new(Plug *plug, bool frozen)
+{
+    MemSocket *ms = snew(MemSocket);
+    memset(ms, 0, sizeof(*ms));
+    ms->plug = plug;
+    ms->frozen = frozen;
+    ms->sock.vt = &memsocket_vt;
+    pump_add(memsocket_pump, ms);
+    return ms;
+}
+
+/* ----------------------------------------------------------------------
+ * Networking functions the SSH code calls. Name lookups always
+ * succeed; the client's one outgoing connection goes to whichever
+ * socketpair the driver has just set up, and the server's outgoing
+ * connections (for forwarded ports) go to MemSockets.
+ */
+
+struct SockAddr {
+    int refcount;
+    char *name;
+};
+
+SockAddr *name_lookup(const char *host, int port, char **canonicalname,
+                      Conf *conf, int addressfamily, LogContext *logctx,
+                      const char *lookup_reason_for_logging)
+{
+    SockAddr *addr = snew(SockAddr);
+    addr->refcount = 1;
+    addr->name = dupstr(host);
+    *canonicalname = dupstr(host);
+    return addr;
+}
+
+SockAddr *sk_nonamelookup(const char *host)
+{
+    char *canonical;
+    SockAddr *addr = name_lookup(host, 0, &canonical, NULL, 0, NULL, NULL);
+    sfree(canonical);
+    return addr;
+}
+
+SockAddr *sk_namelookup(const char *host, char **canonicalname,
+                        int address_family)
+{
+    return name_lookup(host, 0, canonicalname, NULL, 0, NULL, NULL);
+}
+
+const char *sk_addr_error(SockAddr *addr) { return NULL; }
+void sk_getaddr(SockAddr *addr, char *buf, int buflen)
+{ strncpy(buf, addr->name, buflen); buf[buflen-1] = '\0'; }
+bool sk_addr_needs_port(SockAddr *addr) { return true; }
+bool sk_hostname_is_local(const char *name) { return true; }
+bool sk_address_is_local(SockAddr *addr) { return true; }
+bool sk_address_is_special_local(SockAddr *addr) { return false; }
+int sk_addrtype(SockAddr *addr) { return ADDRTYPE_NAME; }
+void sk_addrcopy(SockAddr *addr, char *buf) { strcpy(buf, addr->name); }
+SockAddr *sk_addr_dup(SockAddr *addr) { addr->refcount++; return addr; }
+void sk_addr_free(SockAddr *addr)
+{
+    if (--addr->refcount == 0) {
+        sfree(addr->name);
+        sfree(addr);
+    }
+}
+int net_service_lookup(char *service) { return 0; }
+char *get_hostname(void) { return dupstr("loopback"); }
+void *sk_getxdmdata(Socket *sock, int *lenp) { return NULL; }
+
+Socket *sk_new(SockAddr *addr, int port, bool privport, bool oobinline,
+               bool nodelay, bool keepalive, Plug *plug)
+{
+    sk_addr_free(addr);
+    return new_error_socket_fmt(plug, "no real network in sshloopbench");
+}
+
+Socket *sk_newlistener(const char *srcaddr, int port, Plug *plug,
+                       bool local_host_only, int address_family)
+{
+    return new_error_socket_fmt(plug, "no real network in sshloopbench");
+}
+
+#ifndef LOOPBENCH_SERVER
+static int next_connection_fd = -1;
+#endif
+
+Socket *new_connection(SockAddr *addr, const char *hostname,
+                       int port, bool privport,
+                       bool oobinline, bool nodelay, bool keepalive,
+                       Plug *plug, Conf *conf)
+{
+    sk_addr_free(addr);
+#ifndef LOOPBENCH_SERVER
+    assert(next_connection_fd >= 0);
+    Socket *s = fdsocket_new(next_connection_fd, plug);
+    next_connection_fd = -1;
+    return s;
+#else
+    MemSocket *ms = memsocket_new(plug, false);
+    ms->eof_on_eof = true;
+    return &ms->sock;
+#endif
+}
+
+/* The client's listening sockets for forwarded ports: the driver
+ * 'connects' to them by calling plug_accepting on the Plug */
+typedef struct FakeListener {
+    Plug *plug;
+    Socket sock;
+} FakeListener;
+static Plug *listener_plug;
+
+static void fakelistener_close(Socket *s)
+{
+    FakeListener *fl = container_of(s, FakeListener, sock);
+    if (listener_plug == fl->plug)
+        listener_plug = NULL;
+    sfree(fl);
+}
+
+static const SocketVtable fakelistener_vt = {
+    .plug = memsocket_plug,            /* never called */
+    .close = fakelistener_close,
+    .socket_error = memsocket_socket_error,
+    .peer_info = fdsocket_peer_info,
+};
+
+Socket *new_listener(const char *srcaddr, int port, Plug *plug,
+                     bool local_host_only, Conf *conf, int addressfamily)
+{
+    FakeListener *fl = snew(FakeListener);
+    fl->plug = plug;
+    fl->sock.vt = &fakelistener_vt;
+    listener_plug = plug;
+    return &fl->sock;
+}
+
+/* ----------------------------------------------------------------------
+ * Everything else the SSH code wants from a front end and platform.
+ */
+
+const char *const appname = "sshloopbench";
+const bool buildinfo_gtk_relevant = false;
+char *buildinfo_gtk_version(void) { return NULL; }
+char *get_username(void) { return dupstr("bench"); }
+int mb_to_wc(int codepage, int flags, const char *mbstr, int mblen,
+             wchar_t *wcstr, int wclen)
+{
+    int n = 0;
+    while (n < mblen && n < wclen) {
+        wcstr[n] = (unsigned char)mbstr[n];
+        n++;
+    }
+    return n;
+}
+#ifdef LOOPBENCH_SERVER
+const struct BackendVtable *const backends[] = { NULL };
+#else
+const struct BackendVtable *const backends[] = { &ssh_backend, NULL };
+#endif
+const bool share_can_be_downstream = false;
+const bool share_can_be_upstream = false;
+
+static const char *role(void)
+{
+#ifdef LOOPBENCH_SERVER
+    return "server";
+#else
+    return "client";
+#endif
+}
+
+struct LogContext { int dummy; };
+static LogContext the_logctx;
+LogContext *log_init(LogPolicy *lp, Conf *conf) { return &the_logctx; }
+void log_free(LogContext *logctx) {}
+void log_reconfig(LogContext *logctx, Conf *conf) {}
+void logevent(LogContext *logctx, const char *event)
+{
+    if (verbose)
+        fprintf(stderr, "%s: %s\n", role(), event);
+}
+void logeventvf(LogContext *logctx, const char *fmt, va_list ap)
+{
+    if (verbose) {
+        char *event = dupvprintf(fmt, ap);
+        logevent(logctx, event);
+        sfree(event);
+    }
+}
+void logeventf(LogContext *logctx, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    logeventvf(logctx, fmt, ap);
+    va_end(ap);
+}
+void logevent_and_free(LogContext *logctx, char *event)
+{
+    logevent(logctx, event);
+    sfree(event);
+}
+void log_packet(LogContext *logctx, int direction, int type,
+                const char *texttype, const void *data, size_t len,
+                int n_blanks, const struct logblank_t *blanks,
+                const unsigned long *seq,
+                unsigned downstream_id, const char *additional_log_text) {}
+void backend_socket_log(Seat *seat, LogContext *logctx,
+                        PlugLogType type, SockAddr *addr, int port,
+                        const char *error_msg, int error_code, Conf *conf,
+                        bool session_started) {}
+
+void modalfatalbox(const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "sshloopbench %s: ", role());
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(1);
+}
+void nonfatal(const char *fmt, ...)
+{
+    va_list ap;
+    fprintf(stderr, "sshloopbench %s: ", role());
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+/* Random numbers: sshrand.c seeds from these */
+void noise_get_heavy(void (*func) (void *, int))
+{
+    char buf[64];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf))
+        modalfatalbox("unable to read /dev/urandom");
+    close(fd);
+    func(buf, sizeof(buf));
+    smemclr(buf, sizeof(buf));
+}
+void noise_regular(void) {}
+void noise_ultralight(NoiseSourceId id, unsigned long data) {}
+void write_random_seed(void *data, int len) {}
+uint64_t prng_reseed_time_ms(void) { return 0; }
+
+/* Saved settings: there aren't any, so everything gets its default */
+settings_r *open_settings_r(const char *sessionname) { return NULL; }
+char *read_setting_s(settings_r *handle, const char *key) { return NULL; }
+int read_setting_i(settings_r *handle, const char *key, int defvalue)
+{ return defvalue; }
+FontSpec *read_setting_fontspec(settings_r *handle, const char *name)
+{ return NULL; }
+Filename *read_setting_filename(settings_r *handle, const char *name)
+{ return NULL; }
+void close_settings_r(settings_r *handle) {}
+settings_w *open_settings_w(const char *sessionname, char **errmsg)
+{ *errmsg = NULL; return NULL; }
+void write_setting_s(settings_w *handle, const char *key, const char *value) {}
+void write_setting_i(settings_w *handle, const char *key, int value) {}
+void write_setting_fontspec(settings_w *handle, const char *name,
+                            FontSpec *font) {}
+void write_setting_filename(settings_w *handle, const char *name,
+                            Filename *result) {}
+void close_settings_w(settings_w *handle) {}
+settings_e *enum_settings_start(void) { return NULL; }
+bool enum_settings_next(settings_e *handle, strbuf *out) { return false; }
+void enum_settings_finish(settings_e *handle) {}
+char *platform_default_s(const char *name) { return NULL; }
+bool platform_default_b(const char *name, bool def) { return def; }
+int platform_default_i(const char *name, int def) { return def; }
+FontSpec *platform_default_fontspec(const char *name)
+{ return fontspec_new(""); }
+Filename *platform_default_filename(const char *name)
+{ return filename_from_str(""); }
+
+FontSpec *fontspec_new(const char *name)
+{
+    FontSpec *f = snew(FontSpec);
+    f->name = dupstr(name);
+    return f;
+}
+FontSpec *fontspec_copy(const FontSpec *f) { return fontspec_new(f->name); }
+void fontspec_free(FontSpec *f) { sfree(f->name); sfree(f); }
+void fontspec_serialise(BinarySink *bs, FontSpec *f)
+{ put_asciz(bs, f->name); }
+FontSpec *fontspec_deserialise(BinarySource *src)
+{ return fontspec_new(get_asciz(src)); }
+
+Filename *filename_from_str(const char *str)
+{
+    Filename *fn = snew(Filename);
+    fn->path = dupstr(str);
+    return fn;
+}
+Filename *filename_copy(const Filename *fn)
+{ return filename_from_str(fn->path); }
+const char *filename_to_str(const Filename *fn) { return fn->path; }
+bool filename_equal(const Filename *a, const Filename *b)
+{ return !strcmp(a->path, b->path); }
+bool filename_is_null(const Filename *fn) { return !*fn->path; }
+void filename_free(Filename *fn) { sfree(fn->path); sfree(fn); }
+void filename_serialise(BinarySink *bs, const Filename *f)
+{ put_asciz(bs, f->path); }
+Filename *filename_deserialise(BinarySource *src)
+{ return filename_from_str(get_asciz(src)); }
+FILE *f_open(const Filename *fn, const char *mode, bool isprivate)
+{ return NULL; }
+
+/* No agent, no X server, no host key store */
+#ifndef LOOPBENCH_SERVER
+bool agent_exists(void) { return false; }
+#endif
+agent_pending_query *agent_query(
+    strbuf *in, void **out, int *outlen,
+    void (*callback)(void *, void *, int), void *callback_ctx)
+{ *out = NULL; *outlen = 0; return NULL; }
+void agent_cancel_query(agent_pending_query *pq) {}
+Socket *platform_make_agent_socket(Plug *plug, const char *dirprefix,
+                                   char **error, char **name)
+{ *error = dupstr("no agent in sshloopbench"); return NULL; }
+Socket *agent_connect(Plug *plug)
+{ return new_error_socket_fmt(plug, "no agent in sshloopbench"); }
+int check_stored_host_key(const char *hostname, int port,
+                          const char *keytype, const char *key) { return 1; }
+bool have_ssh_host_key(const char *hostname, int port, const char *keytype)
+{ return false; }
+void store_host_key(const char *hostname, int port,
+                    const char *keytype, const char *key) {}
+void platform_get_x11_auth(struct X11Display *display, Conf *conf) {}
+const bool platform_uses_x11_unix_by_default = true;
+SockAddr *platform_get_x11_unix_address(const char *path, int displaynum)
+{ return NULL; }
+char *platform_get_x_display(void) { return NULL; }
+int platform_make_x11_server(Plug *plug, const char *progname, int mindisp,
+                             const char *screen_number_suffix,
+                             ptrlen authproto, ptrlen authdata,
+                             Socket **sockets, Conf *conf) { return 0; }
+void ldisc_echoedit_update(Ldisc *ldisc) {}
+void old_keyfile_warning(void) {}
+
+/* Time (which only the client measures), and how much of the CPU
+ * this process has had, in seconds */
+#ifndef LOOPBENCH_SERVER
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+static double cpu_seconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Messages on the control socket (a SOCK_SEQPACKET socketpair, so
+ * each one arrives whole) are text:
+ *
+ *   "connect <kex> <hostkey> <cipher> <mac> <comp> <threads>", with
+ *   the server end of a new connection's socketpair attached;
+ *
+ *   "cpu", to which the server replies with the CPU time it's used.
+ */
+
+#ifdef LOOPBENCH_SERVER
+
+/* ----------------------------------------------------------------------
+ * The server.
+ */
+
+static int ctl_fd;
+
+/* Host keys, all made when the server starts, so that making them
+ * isn't counted against the first key exchange to use each one */
+static const char *const hostkey_algs[] = {
+    "ssh-ed25519", "ecdsa-sha2-nistp256", "ssh-rsa",
+};
+static ssh_key *hostkeys[lenof(hostkey_algs)];
+
+static void make_hostkeys(void)
+{
+    struct eddsa_key *edkey = snew(struct eddsa_key);
+    eddsa_generate(edkey, 255);
+    hostkeys[0] = &edkey->sshk;
+
+    struct ecdsa_key *eckey = snew(struct ecdsa_key);
+    ecdsa_generate(eckey, 256);
+    hostkeys[1] = &eckey->sshk;
+
+    PrimeGenerationContext *pgc =
+        primegen_new_context(&primegen_probabilistic);
+    ProgressReceiver null_progress = { .vt = &null_progress_vt };
+    RSAKey *rsakey = snew(RSAKey);
+    rsa_generate(rsakey, 2048, false, pgc, &null_progress);
+    rsakey->comment = NULL;
+    hostkeys[2] = &rsakey->sshk;
+    primegen_free_context(pgc);
+}
+
+static ssh_key *get_hostkey(const char *alg)
+{
+    for (size_t i = 0; i < lenof(hostkey_algs); i++)
+        if (!strcmp(alg, hostkey_algs[i]))
+            return hostkeys[i];
+    modalfatalbox("no host key of type '%s'", alg);
+}
+
+/* Everyone may log in, as anyone, with no authentication at all */
+struct AuthPolicy { int dummy; };
+static AuthPolicy authpolicy;
+unsigned auth_methods(AuthPolicy *ap) { return AUTHMETHOD_NONE; }
+bool auth_none(AuthPolicy *ap, ptrlen username) { return true; }
+int auth_password(AuthPolicy *ap, ptrlen username, ptrlen password,
+                  ptrlen *new_password_opt) { return 0; }
+bool auth_publickey(AuthPolicy *ap, ptrlen username, ptrlen public_blob)
+{ return false; }
+RSAKey *auth_publickey_ssh1(
+    AuthPolicy *ap, ptrlen username, mp_int *rsa_modulus) { return NULL; }
+AuthKbdInt *auth_kbdint_prompts(AuthPolicy *ap, ptrlen username)
+{ return NULL; }
+int auth_kbdint_responses(AuthPolicy *ap, const ptrlen *responses)
+{ return -1; }
+char *auth_ssh1int_challenge(AuthPolicy *ap, unsigned method, ptrlen username)
+{ return NULL; }
+bool auth_ssh1int_response(AuthPolicy *ap, ptrlen response)
+{ return false; }
+bool auth_successful(AuthPolicy *ap, ptrlen username, unsigned method)
+{ return true; }
+
+/*
+ * Each connection's configuration, which has to outlive the server
+ * instance, so it's found from the LogPolicy the server hands back
+ * when the instance goes away.
+ */
+typedef struct BenchConnection {
+    SshServerConfig ssc;
+    Conf *conf;
+    char *lists;
+    LogPolicy logpolicy;
+} BenchConnection;
+
+static void bench_eventlog(LogPolicy *lp, const char *event) {}
+static int bench_askappend(LogPolicy *lp, Filename *filename,
+                           void (*callback)(void *ctx, int result),
+                           void *ctx) { return 2; }
+static void bench_logging_error(LogPolicy *lp, const char *event) {}
+static bool bench_lp_verbose(LogPolicy *lp) { return false; }
+
+static const LogPolicyVtable bench_logpolicy_vt = {
+    .eventlog = bench_eventlog,
+    .askappend = bench_askappend,
+    .logging_error = bench_logging_error,
+    .verbose = bench_lp_verbose,
+};
+
+void server_instance_terminated(LogPolicy *lp)
+{
+    BenchConnection *bc = container_of(lp, BenchConnection, logpolicy);
+    conf_free(bc->conf);
+    sfree(bc->lists);
+    sfree(bc);
+}
+
+void platform_logevent(const char *msg)
+{
+    if (verbose)
+        fprintf(stderr, "server: %s\n", msg);
+}
+
+/*
+ * The commands session channels run, in place of a pty or pipes to a
+ * real process:
+ *
+ *   "sink"       count what arrives until EOF, then send back the
+ *                count (in decimal) and exit
+ *   "source N"   wait for a byte from the client (so that it can
+ *                start its clock), then send N bytes and exit
+ *   anything     do nothing until EOF, then exit
+ *   else
+ *
+ * A command only exits once everything it's sent has gone into the
+ * channel, because the session channel closes as soon as it has
+ * passed on the exit status, whatever is still waiting in its buffer.
+ */
+typedef struct BenchCommand {
+    Seat *seat;
+    uint64_t received, to_send;
+    bool sink, source, started, exiting, finished;
+    Backend backend;
+} BenchCommand;
+
+static bool benchcmd_pump(void *ctx)
+{
+    BenchCommand *bc = (BenchCommand *)ctx;
+
+    if (!bc->started || bc->finished)
+        return false;
+
+    while (bc->to_send > 0) {
+        size_t len = bc->to_send < 32768 ? bc->to_send : 32768;
+        const char *data = pattern_data(bc->to_send, &len);
+        bc->to_send -= len;
+        if (seat_output(bc->seat, false, data, len) > SEND_BACKLOG)
+            return true;
+    }
+    if (bc->source)
+        bc->exiting = true;
+
+    if (!bc->exiting || seat_output(bc->seat, false, NULL, 0) > 0)
+        return false;
+
+    bc->finished = true;
+    seat_eof(bc->seat);
+    seat_notify_remote_exit(bc->seat);
+    return true;
+}
+
+static void benchcmd_free(Backend *be)
+{
+    BenchCommand *bc = container_of(be, BenchCommand, backend);
+    pump_remove(bc);
+    sfree(bc);
+}
+
+static size_t benchcmd_send(Backend *be, const char *buf, size_t len)
+{
+    BenchCommand *bc = container_of(be, BenchCommand, backend);
+    bc->received += len;
+    if (bc->source && len)
+        bc->started = true;
+    return 0;
+}
+
+static void benchcmd_size(Backend *be, int width, int height) {}
+
+static void benchcmd_special(Backend *be, SessionSpecialCode code, int arg)
+{
+    BenchCommand *bc = container_of(be, BenchCommand, backend);
+
+    if (code != SS_EOF || bc->exiting || bc->source)
+        return;
+
+    if (bc->sink) {
+        char *reply = dupprintf("%llu\n", (unsigned long long)bc->received);
+        seat_output(bc->seat, false, reply, strlen(reply));
+        sfree(reply);
+    }
+    bc->started = bc->exiting = true;
+}
+
+static int benchcmd_exitcode(Backend *be)
+{
+    BenchCommand *bc = container_of(be, BenchCommand, backend);
+    return bc->finished ? 0 : -1;
+}
+
+static const BackendVtable benchcmd_vt = {
+    .free = benchcmd_free,
+    .send = benchcmd_send,
+    .size = benchcmd_size,
+    .special = benchcmd_special,
+    .exitcode = benchcmd_exitcode,
+    .id = "benchcmd",
+    .displayname = "sshloopbench command",
+};
+
+Backend *pty_backend_create(
+    Seat *seat, LogContext *logctx, Conf *conf, char **argv, const char *cmd,
+    struct ssh_ttymodes ttymodes, bool pipes_instead_of_pty, const char *dir,
+    const char *const *env_vars_to_unset)
+{
+    BenchCommand *bc = snew(BenchCommand);
+    memset(bc, 0, sizeof(*bc));
+    bc->seat = seat;
+    bc->backend.vt = &benchcmd_vt;
+    if (cmd && !strcmp(cmd, "sink")) {
+        bc->sink = true;
+    } else if (cmd && !strncmp(cmd, "source ", 7)) {
+        bc->source = true;
+        bc->to_send = strtoull(cmd + 7, NULL, 10);
+    }
+    pump_add(benchcmd_pump, bc);
+    return &bc->backend;
+}
+
+int pty_backend_exit_signum(Backend *be) { return -1; }
+ptrlen pty_backend_exit_signame(Backend *be, char **aux_msg)
+{
+    *aux_msg = NULL;
+    return PTRLEN_LITERAL("");
+}
+
+/*
+ * The SFTP server's filesystem. Opening "/N" for reading gives a file
+ * of N bytes; anything opened for writing swallows what's written.
+ */
+typedef struct BenchSftpServer {
+    uint64_t size;
+    SftpServer srv;
+} BenchSftpServer;
+
+static SftpServer *benchsftp_new(const SftpServerVtable *vt)
+{
+    BenchSftpServer *bs = snew(BenchSftpServer);
+    bs->size = 0;
+    bs->srv.vt = vt;
+    return &bs->srv;
+}
+
+static void benchsftp_free(SftpServer *srv)
+{
+    BenchSftpServer *bs = container_of(srv, BenchSftpServer, srv);
+    sfree(bs);
+}
+
+static void benchsftp_realpath(SftpServer *srv, SftpReplyBuilder *reply,
+                               ptrlen path)
+{
+    fxp_reply_simple_name(reply, path.len ? path : PTRLEN_LITERAL("/"));
+}
+
+static void benchsftp_open(SftpServer *srv, SftpReplyBuilder *reply,
+                           ptrlen path, unsigned flags,
+                           struct fxp_attrs attrs)
+{
+    BenchSftpServer *bs = container_of(srv, BenchSftpServer, srv);
+    if (!(flags & SSH_FXF_WRITE)) {
+        char *name = mkstr(path);
+        bs->size = strtoull(name + (*name == '/'), NULL, 10);
+        sfree(name);
+    }
+    fxp_reply_handle(reply, PTRLEN_LITERAL("bench"));
+}
+
+static void benchsftp_ok(SftpServer *srv, SftpReplyBuilder *reply,
+                         ptrlen handle)
+{
+    fxp_reply_ok(reply);
+}
+
+static void benchsftp_attrs(SftpServer *srv, SftpReplyBuilder *reply)
+{
+    BenchSftpServer *bs = container_of(srv, BenchSftpServer, srv);
+    struct fxp_attrs attrs;
+    attrs.flags = SSH_FILEXFER_ATTR_SIZE;
+    attrs.size = bs->size;
+    fxp_reply_attrs(reply, attrs);
+}
+
+static void benchsftp_stat(SftpServer *srv, SftpReplyBuilder *reply,
+                           ptrlen path, bool follow_symlinks)
+{
+    benchsftp_attrs(srv, reply);
+}
+
+static void benchsftp_fstat(SftpServer *srv, SftpReplyBuilder *reply,
+                            ptrlen handle)
+{
+    benchsftp_attrs(srv, reply);
+}
+
+static void benchsftp_read(SftpServer *srv, SftpReplyBuilder *reply,
+                           ptrlen handle, uint64_t offset, unsigned length)
+{
+    static char buf[262144];
+    BenchSftpServer *bs = container_of(srv, BenchSftpServer, srv);
+
+    if (offset >= bs->size) {
+        fxp_reply_error(reply, SSH_FX_EOF, "End of file");
+        return;
+    }
+    if (length > sizeof(buf))
+        length = sizeof(buf);
+    if (length > bs->size - offset)
+        length = bs->size - offset;
+    pattern_copy(buf, offset, length);
+    fxp_reply_data(reply, make_ptrlen(buf, length));
+}
+
+static void benchsftp_write(SftpServer *srv, SftpReplyBuilder *reply,
+                            ptrlen handle, uint64_t offset, ptrlen data)
+{
+    fxp_reply_ok(reply);
+}
+
+static void benchsftp_unsupported(SftpServer *srv, SftpReplyBuilder *reply)
+{
+    fxp_reply_error(reply, SSH_FX_OP_UNSUPPORTED, "Not supported");
+}
+static void benchsftp_path_unsupported(
+    SftpServer *srv, SftpReplyBuilder *reply, ptrlen path)
+{ benchsftp_unsupported(srv, reply); }
+static void benchsftp_path_attrs_unsupported(
+    SftpServer *srv, SftpReplyBuilder *reply, ptrlen path,
+    struct fxp_attrs attrs)
+{ benchsftp_unsupported(srv, reply); }
+static void benchsftp_rename(SftpServer *srv, SftpReplyBuilder *reply,
+                             ptrlen srcpath, ptrlen dstpath)
+{ benchsftp_unsupported(srv, reply); }
+static void benchsftp_readdir(SftpServer *srv, SftpReplyBuilder *reply,
+                              ptrlen handle, int max_entries,
+                              bool omit_longname)
+{ benchsftp_unsupported(srv, reply); }
+
+static const SftpServerVtable benchsftp_vt = {
+    .new = benchsftp_new,
+    .free = benchsftp_free,
+    .realpath = benchsftp_realpath,
+    .open = benchsftp_open,
+    .opendir = benchsftp_path_unsupported,
+    .close = benchsftp_ok,
+    .mkdir = benchsftp_path_attrs_unsupported,
+    .rmdir = benchsftp_path_unsupported,
+    .remove = benchsftp_path_unsupported,
+    .rename = benchsftp_rename,
+    .stat = benchsftp_stat,
+    .fstat = benchsftp_fstat,
+    .setstat = benchsftp_path_attrs_unsupported,
+    .fsetstat = benchsftp_path_attrs_unsupported,
+    .read = benchsftp_read,
+    .write = benchsftp_write,
+    .readdir = benchsftp_readdir,
+};
+
+static void server_start_connection(int fd, char *args)
+{
+    BenchConnection *bc = snew(BenchConnection);
+    memset(bc, 0, sizeof(*bc));
+    bc->logpolicy.vt = &bench_logpolicy_vt;
+    bc->lists = args;
+
+    /* kex, hostkey, cipher, mac, compression, crypto threads */
+    char *words[6];
+    char *p = args;
+    for (size_t i = 0; i < lenof(words); i++) {
+        words[i] = p;
+        p += strcspn(p, " ");
+        if (*p)
+            *p++ = '\0';
+    }
+
+    bc->ssc.application_name = "sshloopbench";
+    bc->ssc.kex_override[KEXLIST_KEX] = ptrlen_from_asciz(words[0]);
+    bc->ssc.kex_override[KEXLIST_HOSTKEY] = ptrlen_from_asciz(words[1]);
+    bc->ssc.kex_override[KEXLIST_CSCIPHER] = ptrlen_from_asciz(words[2]);
+    bc->ssc.kex_override[KEXLIST_SCCIPHER] = ptrlen_from_asciz(words[2]);
+    bc->ssc.kex_override[KEXLIST_CSMAC] = ptrlen_from_asciz(words[3]);
+    bc->ssc.kex_override[KEXLIST_SCMAC] = ptrlen_from_asciz(words[3]);
+    bc->ssc.kex_override[KEXLIST_CSCOMP] = ptrlen_from_asciz(words[4]);
+    bc->ssc.kex_override[KEXLIST_SCCOMP] = ptrlen_from_asciz(words[4]);
+
+    bc->conf = make_ssh_server_conf();
+    conf_set_int(bc->conf, CONF_ssh_crypto_threads, atoi(words[5]));
+
+    ssh_key *hostkey = get_hostkey(words[1]);
+    static ssh_key *hostkey_array[1];
+    hostkey_array[0] = hostkey;
+
+    Plug *plug = ssh_server_plug(bc->conf, &bc->ssc, hostkey_array, 1, NULL,
+                                 &authpolicy, &bc->logpolicy, &benchsftp_vt);
+    ssh_server_start(plug, fdsocket_new(fd, plug));
+}
+
+static void ctl_readable(void)
+{
+    char buf[1024];
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { buf, sizeof(buf) - 1 };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+
+    ssize_t len = recvmsg(ctl_fd, &msg, 0);
+    if (len <= 0)
+        exit(0);                       /* the client has finished with us */
+    buf[len] = '\0';
+
+    if (!strcmp(buf, "cpu")) {
+        char *reply = dupprintf("%.9f", cpu_seconds());
+        if (send(ctl_fd, reply, strlen(reply), 0) < 0)
+            exit(1);
+        sfree(reply);
+    } else if (!strncmp(buf, "connect ", 8)) {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        int fd;
+        if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+            modalfatalbox("connect message without a descriptor");
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        server_start_connection(fd, dupstr(buf + 8));
+    } else {
+        modalfatalbox("unexpected control message '%s'", buf);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: sshloopbench-server control-fd [-v]\n"
+                "(this is run by sshloopbench, not by hand)\n");
+        return 1;
+    }
+    ctl_fd = atoi(argv[1]);
+    verbose = argc > 2 && !strcmp(argv[2], "-v");
+
+    signal(SIGPIPE, SIG_IGN);
+    random_ref();
+    make_hostkeys();
+
+    extra_fd = ctl_fd;
+    extra_fd_readable = ctl_readable;
+    while (1)
+        loop_once();
+}
+
+#else /* LOOPBENCH_SERVER */
+
+/* ----------------------------------------------------------------------
+ * The client, and the driver for the whole thing.
+ */
+
+/* Connection sharing (ssh/sharing.c is Windows-only in this tree) */
+Socket *ssh_connection_sharing_init(
+    const char *host, int port, Conf *conf, LogContext *logctx,
+    Plug *sshplug, ssh_sharing_state **state)
+{ *state = NULL; return NULL; }
+void ssh_connshare_provide_connlayer(ssh_sharing_state *sharestate,
+                                     ConnectionLayer *cl) {}
+bool ssh_share_test_for_upstream(const char *host, int port, Conf *conf)
+{ return false; }
+void share_got_pkt_from_server(ssh_sharing_connstate *cs, int type,
+                               const void *pkt, int pktlen) {}
+void share_activate(ssh_sharing_state *sharestate,
+                    const char *server_verstring) {}
+void sharestate_free(ssh_sharing_state *state) {}
+int share_ndownstreams(ssh_sharing_state *state) { return 0; }
+void share_setup_x11_channel(ssh_sharing_connstate *cs, share_channel *chan,
+                             unsigned upstream_id, unsigned server_id,
+                             unsigned server_currwin, unsigned server_maxpkt,
+                             unsigned client_adjusted_window,
+                             const char *peer_addr, int peer_port, int endian,
+                             int protomajor, int protominor,
+                             const void *initial_data, int initial_len) {}
+
+static int ctl_fd = -1;
+static pid_t server_pid;
+static int crypto_threads = 1;
+
+static double server_cpu_seconds(void);
+
+static void start_server(const char *program)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("sshloopbench: socketpair");
+        exit(1);
+    }
+
+    server_pid = fork();
+    if (server_pid < 0) {
+        perror("sshloopbench: fork");
+        exit(1);
+    }
+    if (server_pid == 0) {
+        char fdstr[16];
+        close(sv[0]);
+        sprintf(fdstr, "%d", sv[1]);
+        execl(program, program, fdstr, verbose ? "-v" : (char *)NULL,
+              (char *)NULL);
+        fprintf(stderr, "sshloopbench: %s: %s\n", program, strerror(errno));
+        _exit(1);
+    }
+
+    close(sv[1]);
+    ctl_fd = sv[0];
+
+    /* Wait until it's ready (i.e. has made its host keys) */
+    server_cpu_seconds();
+}
+
+static void stop_server(void)
+{
+    int status;
+    close(ctl_fd);
+    waitpid(server_pid, &status, 0);
+}
+
+static void ctl_send(const char *text, int fd)
+{
+    char cmsgbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { (void *)text, strlen(text) };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(cmsgbuf, 0, sizeof(cmsgbuf));
+        msg.msg_control = cmsgbuf;
+        msg.msg_controllen = sizeof(cmsgbuf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    if (sendmsg(ctl_fd, &msg, 0) < 0) {
+        perror("sshloopbench: talking to server");
+        exit(1);
+    }
+}
+
+static double server_cpu_seconds(void)
+{
+    char buf[64];
+    ctl_send("cpu", -1);
+    ssize_t len = recv(ctl_fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        fprintf(stderr, "sshloopbench: server has gone away\n");
+        exit(1);
+    }
+    buf[len] = '\0';
+    return atof(buf);
+}
+
+/* CPU used by both sides since the last call to cpu_mark */
+static double client_cpu_start, server_cpu_start;
+static void cpu_mark(void)
+{
+    server_cpu_start = server_cpu_seconds();
+    client_cpu_start = cpu_seconds();
+}
+static void cpu_since_mark(double *client, double *server)
+{
+    *client = cpu_seconds() - client_cpu_start;
+    *server = server_cpu_seconds() - server_cpu_start;
+}
+
+/*
+ * The algorithms for one connection. The server offers only these,
+ * and the client offers everything it has, so these are what get
+ * used.
+ */
+typedef struct Algorithms {
+    const char *kex, *hostkey, *cipher, *mac, *comp;
+} Algorithms;
+
+/* The client's Seat: takes the session's output, and says yes to
+ * everything it's asked */
+typedef struct BenchClient {
+    Backend *backend;
+    Conf *conf;
+    uint64_t output;                   /* bytes from the session */
+    strbuf *text;                      /* ... kept, if this is non-NULL */
+    bufchain *sftp_input;              /* ... or given to the SFTP client */
+    bool remote_exited;
+    char *fatal;
+    Seat seat;
+} BenchClient;
+
+static size_t bench_output(Seat *seat, bool is_stderr,
+                           const void *data, size_t len)
+{
+    BenchClient *bc = container_of(seat, BenchClient, seat);
+    bc->output += len;
+    if (bc->sftp_input)
+        bufchain_add(bc->sftp_input, data, len);
+    else if (bc->text)
+        put_data(bc->text, data, len);
+    return 0;
+}
+
+static bool bench_eof(Seat *seat) { return false; }
+
+static void bench_notify_remote_exit(Seat *seat)
+{
+    BenchClient *bc = container_of(seat, BenchClient, seat);
+    if (backend_exitcode(bc->backend) >= 0)
+        bc->remote_exited = true;
+}
+
+static void bench_connection_fatal(Seat *seat, const char *message)
+{
+    BenchClient *bc = container_of(seat, BenchClient, seat);
+    if (!bc->fatal)
+        bc->fatal = dupstr(message);
+}
+
+static int bench_verify_ssh_host_key(
+    Seat *seat, const char *host, int port, const char *keytype,
+    char *keystr, const char *keydisp, char **key_fingerprints,
+    void (*callback)(void *ctx, int result), void *ctx) { return 1; }
+static int bench_confirm_weak_crypto_primitive(
+    Seat *seat, const char *algtype, const char *algname,
+    void (*callback)(void *ctx, int result), void *ctx) { return 1; }
+static int bench_confirm_weak_cached_hostkey(
+    Seat *seat, const char *algname, const char *betteralgs,
+    void (*callback)(void *ctx, int result), void *ctx) { return 1; }
+
+static const SeatVtable bench_seat_vt = {
+    .output = bench_output,
+    .eof = bench_eof,
+    .get_userpass_input = nullseat_get_userpass_input,
+    .notify_remote_exit = bench_notify_remote_exit,
+    .connection_fatal = bench_connection_fatal,
+    .update_specials_menu = nullseat_update_specials_menu,
+    .get_ttymode = nullseat_get_ttymode,
+    .set_busy_status = nullseat_set_busy_status,
+    .verify_ssh_host_key = bench_verify_ssh_host_key,
+    .confirm_weak_crypto_primitive = bench_confirm_weak_crypto_primitive,
+    .confirm_weak_cached_hostkey = bench_confirm_weak_cached_hostkey,
+    .is_utf8 = nullseat_is_never_utf8,
+    .echoedit_update = nullseat_echoedit_update,
+    .get_x_display = nullseat_get_x_display,
+    .get_windowid = nullseat_get_windowid,
+    .get_window_pixel_size = nullseat_get_window_pixel_size,
+    .stripctrl_new = nullseat_stripctrl_new,
+    .set_trust_status = nullseat_set_trust_status_vacuously,
+    .verbose = nullseat_verbose_no,
+    .interactive = nullseat_interactive_no,
+    .get_cursor_position = nullseat_get_cursor_position,
+};
+
+static void bench_check(BenchClient *bc)
+{
+    if (bc->fatal) {
+        fprintf(stderr, "sshloopbench: connection failed: %s\n", bc->fatal);
+        exit(1);
+    }
+}
+
+/*
+ * Connect, run 'command' (or the SFTP subsystem, if 'command' is
+ * NULL), and wait until the session is ready for data.
+ */
+static BenchClient *bench_connect(const Algorithms *algs, const char *command,
+                                  const char *portfwd)
+{
+    BenchClient *bc = snew(BenchClient);
+    memset(bc, 0, sizeof(*bc));
+    bc->seat.vt = &bench_seat_vt;
+
+    Conf *conf = bc->conf = conf_new();
+    load_open_settings(NULL, conf);
+    conf_set_str(conf, CONF_host, "loopback");
+    conf_set_int(conf, CONF_port, 22);
+    conf_set_int(conf, CONF_protocol, PROT_SSH);
+    conf_set_int(conf, CONF_sshprot, 3);
+    conf_set_str(conf, CONF_username, "bench");
+    conf_set_bool(conf, CONF_tryagent, false);
+    conf_set_bool(conf, CONF_agentfwd, false);
+    conf_set_bool(conf, CONF_x11_forward, false);
+    conf_set_bool(conf, CONF_nopty, true);
+    conf_set_bool(conf, CONF_ssh_connection_sharing, false);
+    conf_set_bool(conf, CONF_ssh2_des_cbc, true);
+    conf_set_int(conf, CONF_ping_interval, 0);
+    conf_set_int(conf, CONF_ssh_crypto_threads, crypto_threads);
+    conf_set_bool(conf, CONF_compression, strcmp(algs->comp, "none") != 0);
+    if (command) {
+        conf_set_str(conf, CONF_remote_cmd, command);
+    } else {
+        conf_set_str(conf, CONF_remote_cmd, "sftp");
+        conf_set_bool(conf, CONF_ssh_subsys, true);
+    }
+    if (portfwd)
+        conf_set_str_str(conf, CONF_portfwd, "L1", portfwd);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("sshloopbench: socketpair");
+        exit(1);
+    }
+    char *args = dupprintf("connect %s %s %s %s %s %d", algs->kex,
+                           algs->hostkey, algs->cipher, algs->mac,
+                           algs->comp, crypto_threads);
+    ctl_send(args, sv[1]);
+    sfree(args);
+    close(sv[1]);
+
+    char *realhost = NULL;
+    next_connection_fd = sv[0];
+    const char *error = backend_init(
+        &ssh_backend, &bc->seat, &bc->backend, &the_logctx, conf,
+        "loopback", 22, &realhost, true, false);
+    if (error) {
+        fprintf(stderr, "sshloopbench: %s\n", error);
+        exit(1);
+    }
+    sfree(realhost);
+
+    while (!backend_sendok(bc->backend)) {
+        bench_check(bc);
+        loop_once();
+    }
+    return bc;
+}
+
+static void bench_disconnect(BenchClient *bc)
+{
+    backend_free(bc->backend);
+    conf_free(bc->conf);
+    if (bc->text)
+        strbuf_free(bc->text);
+    sfree(bc->fatal);
+    sfree(bc);
+
+    /* Let anything the closing connection left queued run out */
+    while (toplevel_callback_pending())
+        loop_once();
+}
+
+static void bench_wait_exit(BenchClient *bc)
+{
+    while (!bc->remote_exited) {
+        bench_check(bc);
+        loop_once();
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * The scenarios.
+ */
+
+static uint64_t bulk_bytes = (uint64_t)256 << 20;
+static int nchannels = 64;
+static double kex_seconds = 2;
+
+static void report(const char *scenario, const char *algs, double rate,
+                   const char *unit, double client_cpu, double server_cpu,
+                   const char *cpu_unit)
+{
+    printf("%-10s %-58s %10.1f %-5s %9.2f %9.2f %s\n", scenario, algs,
+           rate, unit, client_cpu, server_cpu, cpu_unit);
+    fflush(stdout);
+}
+
+static char *algs_name(const Algorithms *algs, bool bulk)
+{
+    if (!bulk)
+        return dupprintf("%s %s", algs->kex, algs->hostkey);
+    if (strstr(algs->cipher, "-gcm@") || strstr(algs->cipher, "poly1305"))
+        return dupprintf("%s %s", algs->cipher, algs->comp);
+    return dupprintf("%s %s %s", algs->cipher, algs->mac, algs->comp);
+}
+
+static void scenario_kex(const Algorithms *algs)
+{
+    unsigned nhandshakes = 0;
+    double client_cpu, server_cpu;
+
+    cpu_mark();
+    double start = now(), elapsed;
+    do {
+        bench_disconnect(bench_connect(algs, "idle", NULL));
+        nhandshakes++;
+        elapsed = now() - start;
+    } while (elapsed < kex_seconds);
+    cpu_since_mark(&client_cpu, &server_cpu);
+
+    char *name = algs_name(algs, false);
+    report("kex", name, nhandshakes / elapsed, "hs/s",
+           client_cpu * 1e3 / nhandshakes, server_cpu * 1e3 / nhandshakes,
+           "ms/hs");
+    sfree(name);
+}
+
+static void report_bulk(const char *scenario, const Algorithms *algs,
+                        uint64_t bytes, double elapsed,
+                        double client_cpu, double server_cpu)
+{
+    char *name = algs_name(algs, true);
+    report(scenario, name, bytes / 1048576.0 / elapsed, "MB/s",
+           client_cpu * 1e9 / bytes, server_cpu * 1e9 / bytes, "ns/B");
+    sfree(name);
+}
+
+static void scenario_upload(const Algorithms *algs)
+{
+    double client_cpu, server_cpu;
+    BenchClient *bc = bench_connect(algs, "sink", NULL);
+    bc->text = strbuf_new();
+
+    cpu_mark();
+    double start = now();
+    uint64_t left = bulk_bytes;
+    while (left > 0) {
+        bench_check(bc);
+        if (backend_sendbuffer(bc->backend) < SEND_BACKLOG) {
+            size_t len = left < 32768 ? left : 32768;
+            const char *data = pattern_data(left, &len);
+            backend_send(bc->backend, data, len);
+            left -= len;
+        } else {
+            loop_once();
+        }
+    }
+    backend_special(bc->backend, SS_EOF, 0);
+    bench_wait_exit(bc);
+    double elapsed = now() - start;
+    cpu_since_mark(&client_cpu, &server_cpu);
+
+    unsigned long long got = strtoull(bc->text->s, NULL, 10);
+    if (got != bulk_bytes) {
+        fprintf(stderr, "sshloopbench: server received %llu bytes, "
+                "not %llu\n", got, (unsigned long long)bulk_bytes);
+        exit(1);
+    }
+
+    report_bulk("upload", algs, bulk_bytes, elapsed, client_cpu, server_cpu);
+    bench_disconnect(bc);
+}
+
+static void scenario_download(const Algorithms *algs)
+{
+    double client_cpu, server_cpu;
+    char *command = dupprintf("source %llu", (unsigned long long)bulk_bytes);
+    BenchClient *bc = bench_connect(algs, command, NULL);
+    sfree(command);
+
+    cpu_mark();
+    double start = now();
+    backend_send(bc->backend, "go", 1);
+    bench_wait_exit(bc);
+    double elapsed = now() - start;
+    cpu_since_mark(&client_cpu, &server_cpu);
+
+    if (bc->output != bulk_bytes) {
+        fprintf(stderr, "sshloopbench: client received %llu bytes, "
+                "not %llu\n", (unsigned long long)bc->output,
+                (unsigned long long)bulk_bytes);
+        exit(1);
+    }
+
+    report_bulk("download", algs, bulk_bytes, elapsed,
+                client_cpu, server_cpu);
+    bench_disconnect(bc);
+}
+
+/* The SFTP client code talks to whichever connection this is */
+static BenchClient *sftp_client;
+static bufchain sftp_input;
+
+bool sftp_recvdata(char *buf, size_t len)
+{
+    while (bufchain_size(&sftp_input) < len) {
+        bench_check(sftp_client);
+        if (sftp_client->remote_exited)
+            return false;
+        loop_once();
+    }
+    bufchain_fetch_consume(&sftp_input, buf, len);
+    return true;
+}
+
+bool sftp_senddata(const char *buf, size_t len)
+{
+    backend_send(sftp_client->backend, buf, len);
+    return true;
+}
+
+size_t sftp_sendbuffer(void)
+{
+    return backend_sendbuffer(sftp_client->backend);
+}
+
+static void sftp_bench_failed(const char *what)
+{
+    fprintf(stderr, "sshloopbench: SFTP %s: %s\n", what, fxp_error());
+    exit(1);
+}
+
+static struct sftp_packet *sftp_bench_reply(struct sftp_request *req)
+{
+    sftp_register(req);
+    struct sftp_packet *pktin = sftp_recv();
+    if (!pktin || sftp_find_request(pktin) != req)
+        sftp_bench_failed("reply");
+    return pktin;
+}
+
+static struct fxp_handle *sftp_bench_open(const char *path, int type)
+{
+    struct sftp_request *req = fxp_open_send(path, type, NULL);
+    struct sftp_packet *pktin = sftp_bench_reply(req);
+    struct fxp_handle *fh = fxp_open_recv(pktin, req);
+    if (!fh)
+        sftp_bench_failed("open");
+    return fh;
+}
+
+static void sftp_bench_close(struct fxp_handle *fh)
+{
+    struct sftp_request *req = fxp_close_send(fh);
+    struct sftp_packet *pktin = sftp_bench_reply(req);
+    fxp_close_recv(pktin, req);
+}
+
+static void scenario_sftp(const Algorithms *algs)
+{
+    double client_cpu, server_cpu;
+    struct fxp_handle *fh;
+    struct fxp_xfer *xfer;
+
+    sftp_client = bench_connect(algs, NULL, NULL);
+    bufchain_init(&sftp_input);
+    sftp_client->sftp_input = &sftp_input;
+    xfer_set_pipeline(conf_get_bool(sftp_client->conf, CONF_sftp_autotune),
+                      conf_get_int(sftp_client->conf, CONF_sftp_window),
+                      conf_get_int(sftp_client->conf, CONF_sftp_blocksize));
+    if (!fxp_init())
+        sftp_bench_failed("init");
+
+    /* get */
+    char *path = dupprintf("/%llu", (unsigned long long)bulk_bytes);
+    fh = sftp_bench_open(path, SSH_FXF_READ);
+    sfree(path);
+
+    cpu_mark();
+    double start = now();
+    uint64_t got = 0;
+    xfer = xfer_download_init(fh, 0);
+    while (!xfer_done(xfer)) {
+        void *vbuf;
+        int len;
+
+        xfer_download_queue(xfer);
+        struct sftp_packet *pktin = sftp_recv();
+        if (!pktin)
+            sftp_bench_failed("receive");
+        int ret = xfer_download_gotpkt(xfer, pktin);
+        if (ret <= 0) {
+            if (ret == INT_MIN)
+                sfree(pktin);
+            sftp_bench_failed("read");
+        }
+        while (xfer_download_data(xfer, &vbuf, &len)) {
+            got += len;
+            sfree(vbuf);
+        }
+    }
+    xfer_cleanup(xfer);
+    double elapsed = now() - start;
+    cpu_since_mark(&client_cpu, &server_cpu);
+    sftp_bench_close(fh);
+
+    if (got != bulk_bytes) {
+        fprintf(stderr, "sshloopbench: SFTP get gave %llu bytes, "
+                "not %llu\n", (unsigned long long)got,
+                (unsigned long long)bulk_bytes);
+        exit(1);
+    }
+    report_bulk("sftp-get", algs, bulk_bytes, elapsed,
+                client_cpu, server_cpu);
+
+    /* put */
+    fh = sftp_bench_open("/upload", SSH_FXF_WRITE | SSH_FXF_CREAT |
+                         SSH_FXF_TRUNC);
+    int blocksize = xfer_upload_blocksize();
+    char *buf = snewn(blocksize, char);
+    pattern_copy(buf, 0, blocksize);
+
+    cpu_mark();
+    start = now();
+    uint64_t left = bulk_bytes;
+    xfer = xfer_upload_init(fh, 0);
+    while (left > 0 || !xfer_done(xfer)) {
+        while (left > 0 && xfer_upload_ready(xfer)) {
+            int len = left < blocksize ? left : blocksize;
+            xfer_upload_data(xfer, buf, len);
+            left -= len;
+        }
+        if (xfer_done(xfer)) {
+            /* Nothing outstanding: just wait for the send buffer to
+             * drain, as psftp does */
+            bench_check(sftp_client);
+            loop_once();
+            continue;
+        }
+        struct sftp_packet *pktin = sftp_recv();
+        if (!pktin)
+            sftp_bench_failed("receive");
+        int ret = xfer_upload_gotpkt(xfer, pktin);
+        if (ret <= 0) {
+            if (ret == INT_MIN)
+                sfree(pktin);
+            sftp_bench_failed("write");
+        }
+    }
+    xfer_cleanup(xfer);
+    elapsed = now() - start;
+    cpu_since_mark(&client_cpu, &server_cpu);
+    sftp_bench_close(fh);
+    sfree(buf);
+
+    report_bulk("sftp-put", algs, bulk_bytes, elapsed,
+                client_cpu, server_cpu);
+
+    bench_disconnect(sftp_client);
+    bufchain_clear(&sftp_input);
+    sftp_client = NULL;
+}
+
+static int channels_open;
+
+static void channel_closed(MemSocket *ms)
+{
+    channels_open--;
+}
+
+static Socket *channel_accept(accept_ctx_t ctx, Plug *plug)
+{
+    MemSocket *ms = memsocket_new(plug, true);
+    ms->to_send = *(uint64_t *)ctx.p;
+    ms->on_close = channel_closed;
+    return &ms->sock;
+}
+
+static void scenario_channels(const Algorithms *algs)
+{
+    double client_cpu, server_cpu;
+    BenchClient *bc = bench_connect(algs, "idle", "target:1");
+
+    while (!listener_plug) {
+        bench_check(bc);
+        loop_once();
+    }
+
+    uint64_t each = bulk_bytes / nchannels;
+    accept_ctx_t actx;
+    actx.p = &each;
+
+    cpu_mark();
+    double start = now();
+    for (int i = 0; i < nchannels; i++) {
+        channels_open++;
+        if (plug_accepting(listener_plug, channel_accept, actx)) {
+            fprintf(stderr, "sshloopbench: forwarded connection refused\n");
+            exit(1);
+        }
+    }
+    while (channels_open > 0) {
+        bench_check(bc);
+        loop_once();
+    }
+    double elapsed = now() - start;
+    cpu_since_mark(&client_cpu, &server_cpu);
+
+    char *scenario = dupprintf("channels%d", nchannels);
+    report_bulk(scenario, algs, each * nchannels, elapsed,
+                client_cpu, server_cpu);
+    sfree(scenario);
+    bench_disconnect(bc);
+}
+
+/* ----------------------------------------------------------------------
+ * The combinations of algorithms tried.
+ */
+
+static const char *const kexes[] = {
+    "curve25519-sha256", "ecdh-sha2-nistp256",
+    "diffie-hellman-group14-sha256",
+};
+static const char *const hostkey_types[] = {
+    "ssh-ed25519", "ecdsa-sha2-nistp256", "ssh-rsa",
+};
+static const char *const ciphers[] = {
+    "aes128-ctr", "aes256-ctr", "aes256-cbc", "aes128-gcm@openssh.com",
+    "aes256-gcm@openssh.com", "chacha20-poly1305@openssh.com",
+};
+static const char *const macs[] = {
+    "hmac-sha2-256", "hmac-sha2-256-etm@openssh.com", "hmac-sha1",
+};
+static const char *const comps[] = { "none", "zlib" };
+
+static const Algorithms bulk_default = {
+    "curve25519-sha256", "ssh-ed25519", "aes256-ctr", "hmac-sha2-256", "none",
+};
+
+static bool is_aead(const char *cipher)
+{
+    return strstr(cipher, "-gcm@") || strstr(cipher, "poly1305");
+}
+
+/* Call fn for every cipher/MAC/compression combination (the MAC only
+ * varying for ciphers that need one) */
+static void for_each_bulk(void (*fn)(const Algorithms *), bool all_comps)
+{
+    Algorithms algs = bulk_default;
+    for (size_t c = 0; c < lenof(comps); c++) {
+        if (c > 0 && !all_comps)
+            break;
+        algs.comp = comps[c];
+        for (size_t i = 0; i < lenof(ciphers); i++) {
+            algs.cipher = ciphers[i];
+            for (size_t m = 0; m < lenof(macs); m++) {
+                if (is_aead(ciphers[i]) && m > 0)
+                    break;
+                algs.mac = macs[m];
+                fn(&algs);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const all_scenarios[] = {
+        "kex", "upload", "download", "sftp", "channels",
+    };
+    const char *scenarios[lenof(all_scenarios)];
+    size_t nscenarios = 0;
+    char *server_program = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc) {
+            bulk_bytes = (uint64_t)strtoull(argv[++i], NULL, 10) << 20;
+        } else if (!strcmp(argv[i], "-c") && i+1 < argc) {
+            nchannels = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i+1 < argc) {
+            kex_seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-T") && i+1 < argc) {
+            crypto_threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i+1 < argc) {
+            server_program = dupstr(argv[++i]);
+        } else if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else {
+            size_t j;
+            for (j = 0; j < lenof(all_scenarios); j++)
+                if (!strcmp(argv[i], all_scenarios[j]))
+                    break;
+            if (argv[i][0] == '-' || j == lenof(all_scenarios) ||
+                nscenarios == lenof(scenarios)) {
+                fprintf(stderr, "usage: sshloopbench [-n megabytes] "
+                        "[-c channels] [-t seconds]\n"
+                        "                    [-T crypto-threads] "
+                        "[-s server-program] [-v] [scenario...]\n"
+                        "scenarios: kex upload download sftp channels\n");
+                return 1;
+            }
+            scenarios[nscenarios++] = all_scenarios[j];
+        }
+    }
+    if (!nscenarios) {
+        for (size_t j = 0; j < lenof(all_scenarios); j++)
+            scenarios[nscenarios++] = all_scenarios[j];
+    }
+    if (nchannels < 1)
+        nchannels = 1;
+    if (!bulk_bytes)
+        bulk_bytes = 1;
+
+    if (!server_program) {
+        const char *slash = strrchr(argv[0], '/');
+        server_program = dupprintf("%.*ssshloopbench-server",
+                                   slash ? (int)(slash + 1 - argv[0]) : 2,
+                                   slash ? argv[0] : "./");
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    random_ref();
+    start_server(server_program);
+    sfree(server_program);
+
+    printf("%-10s %-58s %16s %9s %9s\n", "scenario", "algorithms", "rate",
+           "client", "server");
+
+    for (size_t s = 0; s < nscenarios; s++) {
+        const char *sc = scenarios[s];
+        if (!strcmp(sc, "kex")) {
+            Algorithms algs = bulk_default;
+            for (size_t k = 0; k < lenof(kexes); k++) {
+                algs.kex = kexes[k];
+                for (size_t h = 0; h < lenof(hostkey_types); h++) {
+                    algs.hostkey = hostkey_types[h];
+                    scenario_kex(&algs);
+                }
+            }
+        } else if (!strcmp(sc, "upload")) {
+            for_each_bulk(scenario_upload, true);
+        } else if (!strcmp(sc, "download")) {
+            for_each_bulk(scenario_download, true);
+        } else if (!strcmp(sc, "sftp")) {
+            for_each_bulk(scenario_sftp, false);
+        } else if (!strcmp(sc, "channels")) {
+            for_each_bulk(scenario_channels, false);
+        }
+    }
+
+    stop_server();
+    random_unref();
+    return 0;
+}
+
+#endif /* LOOPBENCH_SERVER */
@@ -0,0 +1,235 @@
+/*
+ * telnetbench.c: check and time the Telnet backend's receive path.
+ *
+ * A synthetic stream like a busy serial console's output (lines of
+ * text ending in CR LF) is made up, with Telnet escapes sprinkled
+ * through it at a chosen density: doubled IACs standing for a 0xFF
+ * data byte, IAC NOP and IAC GA commands, and CR NUL. It's fed to
+ * do_telnet_read in socket-sized chunks, and what comes out of the
+ * other side for the terminal is checked against what the stream
+ * should decode to. Then the stream is run through repeatedly and the
+ * MB/s of input reported, for each density, both with the server
+ * sending in binary mode (when only IAC is special) and without.
+ *
+ * Usage: telnetbench [-n megabytes] [-c chunk-size]
+ *
+ * From the top of the source tree:
+ *
+ *   gcc -O2 -ffunction-sections -fdata-sections -I. -Icharset -Iunix -Iutils \
+ *       -o telnetbench test/telnetbench.c utils/memory.c utils/utils.c \
+ *       utils/marshal.c -Wl,--gc-sections
+ *
+ * (telnet.c is included whole, to get at do_telnet_read; --gc-sections
+ * leaves out the parts of it that would need the rest of PuTTY.)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "otherbackends/telnet.c"
+
+/* Things telnet.c expects from the rest of PuTTY, none of which the
+ * escapes in our stream should ever need */
+void logeventf(LogContext *ctx, const char *fmt, ...) { abort(); }
+void logevent(LogContext *ctx, const char *event) { abort(); }
+char *conf_get_str(Conf *conf, int key) { abort(); }
+char *conf_get_str_str_opt(Conf *conf, int key, const char *subkey)
+{ abort(); }
+char *conf_get_str_strs(Conf *conf, int key, char *subkeyin,
+                        char **subkeyout) { abort(); }
+int conf_get_int(Conf *conf, int key) { abort(); }
+bool conf_get_bool(Conf *conf, int key) { abort(); }
+void out_of_memory(void) { abort(); }
+
+/* The terminal: either keep what arrives, or just count it */
+static strbuf *received;
+static size_t nreceived;
+
+static size_t bench_output(Seat *seat, bool is_stderr,
+                           const void *data, size_t len)
+{
+    if (received)
+        put_data(received, data, len);
+    nreceived += len;
+    return 0;
+}
+
+static const SeatVtable bench_seat_vt = {
+    .output = bench_output,
+};
+static Seat bench_seat = { .vt = &bench_seat_vt };
+
+static void bench_set_frozen(Socket *s, bool is_frozen) {}
+
+static const SocketVtable bench_socket_vt = {
+    .set_frozen = bench_set_frozen,
+};
+static Socket bench_socket = { .vt = &bench_socket_vt };
+
+static uint32_t rng_state = 12345;
+
+static uint32_t rng(void)
+{
+    /* xorshift32, so the stream is the same every time */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/*
+ * Make up 'size' bytes of stream, in which a special sequence starts
+ * at each byte with probability 'density', and put what it should
+ * decode to in 'expected'.
+ */
+static void make_stream(strbuf *stream, strbuf *expected, size_t size,
+                        double density, bool binary)
+{
+    uint32_t threshold = density * 4294967295.0;
+    int col = 0;
+
+    while (stream->len < size) {
+        if (rng() < threshold) {
+            switch (rng() % 4) {
+              case 0:                  /* an escaped 0xFF data byte */
+                put_byte(stream, IAC);
+                put_byte(stream, IAC);
+                put_byte(expected, IAC);
+                break;
+              case 1:
+                put_byte(stream, IAC);
+                put_byte(stream, NOP);
+                break;
+              case 2:
+                put_byte(stream, IAC);
+                put_byte(stream, GA);
+                break;
+              case 3:                  /* a bare CR, as a server sends it */
+                put_byte(stream, CR);
+                put_byte(stream, NUL);
+                put_byte(expected, CR);
+                if (binary)
+                    put_byte(expected, NUL);
+                col = 0;
+                break;
+            }
+        } else if (col >= 72) {
+            put_byte(stream, CR);
+            put_byte(stream, LF);
+            put_byte(expected, CR);
+            put_byte(expected, LF);
+            col = 0;
+        } else {
+            char c = ' ' + rng() % 95;
+            put_byte(stream, c);
+            put_byte(expected, c);
+            col++;
+        }
+    }
+}
+
+static Telnet *make_telnet(bool binary)
+{
+    Telnet *telnet = snew(Telnet);
+    memset(telnet, 0, sizeof(*telnet));
+    telnet->seat = &bench_seat;
+    telnet->s = &bench_socket;
+    telnet->sb_buf = strbuf_new();
+    telnet->state = TOP_LEVEL;
+    for (size_t i = 0; i < NUM_OPTS; i++)
+        telnet->opt_states[i] = INACTIVE;
+    if (binary)
+        telnet->opt_states[o_they_bin.index] = ACTIVE;
+    return telnet;
+}
+
+static void free_telnet(Telnet *telnet)
+{
+    strbuf_free(telnet->sb_buf);
+    sfree(telnet);
+}
+
+static void feed(Telnet *telnet, strbuf *stream, size_t chunk)
+{
+    for (size_t pos = 0; pos < stream->len; pos += chunk) {
+        size_t len = stream->len - pos;
+        if (len > chunk)
+            len = chunk;
+        do_telnet_read(telnet, stream->s + pos, len);
+    }
+}
+
+static double now(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+    static const double densities[] = { 0, 0.0001, 0.001, 0.01, 0.1 };
+    size_t megabytes = 256, chunk = 16384;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc) {
+            megabytes = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i+1 < argc) {
+            chunk = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: telnetbench [-n megabytes] "
+                    "[-c chunk-size]\n");
+            return 1;
+        }
+    }
+    if (chunk < 1)
+        chunk = 1;
+
+    printf("%-8s %-10s %10s\n", "mode", "density", "MB/s");
+
+    for (int binary = 0; binary < 2; binary++) {
+        for (size_t d = 0; d < lenof(densities); d++) {
+            strbuf *stream = strbuf_new(), *expected = strbuf_new();
+            make_stream(stream, expected, 8 << 20, densities[d], binary);
+
+            /* Check it, including with chunks that split up escapes */
+            size_t check_chunks[] = { chunk, 1, 2, 3, 4095 };
+            for (size_t k = 0; k < lenof(check_chunks); k++) {
+                Telnet *telnet = make_telnet(binary);
+                received = strbuf_new();
+                feed(telnet, stream, check_chunks[k]);
+                if (received->len != expected->len ||
+                    memcmp(received->s, expected->s, expected->len)) {
+                    fprintf(stderr, "telnetbench: wrong output for density "
+                            "%g, %s mode, chunk size %zu\n", densities[d],
+                            binary ? "binary" : "text", check_chunks[k]);
+                    return 1;
+                }
+                strbuf_free(received);
+                received = NULL;
+                free_telnet(telnet);
+            }
+
+            Telnet *telnet = make_telnet(binary);
+            size_t passes = (megabytes << 20) / stream->len;
+            if (passes < 1)
+                passes = 1;
+            nreceived = 0;
+            double start = now();
+            for (size_t k = 0; k < passes; k++)
+                feed(telnet, stream, chunk);
+            double elapsed = now() - start;
+            free_telnet(telnet);
+
+            printf("%-8s %-10g %10.1f\n", binary ? "binary" : "text",
+                   densities[d],
+                   passes * (double)stream->len / 1048576.0 / elapsed);
+
+            strbuf_free(stream);
+            strbuf_free(expected);
+        }
+    }
+
+    return 0;
+}
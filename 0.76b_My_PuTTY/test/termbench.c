@@ -0,0 +1,1031 @@
+/*
+ * termbench.c: headless throughput benchmarks for the terminal.
+ *
+ * Like fuzzterm, this drives terminal.c with no window behind it: a
+ * workload is passed to term_data() in blocks, and term_update() is
+ * called after each block to make do_paint() redraw the screen into a
+ * drawing backend that only counts what it is asked to draw. Unlike
+ * fuzzterm it times all of that, reporting for each workload the
+ * overall rate, how the time divided between parsing (term_data) and
+ * painting (term_update), how much drawing was done, and how many
+ * memory allocations were made per megabyte of input.
+ *
+ * The built-in workloads are generated from a fixed seed, so they are
+ * the same on every run and every machine:
+ *
+ *   cat        plain text scrolling up the screen, like 'cat' of a
+ *              big source file
+ *   top        full-screen redraws by cursor addressing, like 'top'
+ *   vim        scrolling within a margin, reverse index, syntax
+ *              colouring and a status line, like a text editor
+ *   truecolour 24-bit foreground and background changes every few
+ *              characters
+ *   unicode    UTF-8 text with combining characters, double-width
+ *              CJK, and right-to-left text for the bidi code
+ *
+ * Recorded workloads (a session log of all session output, or
+ * anything captured with 'script') can be replayed with -f, as many as
+ * needed; they are decoded as UTF-8.
+ *
+ * Usage: termbench [options] [workload...]
+ *   -n passes        times to run each workload (default 3)
+ *   -r rows, -c cols screen size (default 24x80)
+ *   -s lines         scrollback size (default 2000)
+ *   -u bytes         input between screen updates (default 16384)
+ *   -z bytes         size of each generated workload (default 2000000)
+ *   -f file          also replay a recorded workload
+ *   -m               machine-readable output: one tab-separated line
+ *                    per workload, after a '#' header line
+ *   -S lines         instead of the workloads, measure the scrollback:
+ *                    fill that many lines of it with text, then report
+ *                    the memory it takes, how long term_scroll()
+ *                    and the repaint after it take, and how long
+ *                    term_search() takes to find things in it
+ *   -M kbytes        keep at most this much scrollback in memory, and
+ *                    the rest in a temporary file (default 0, no limit)
+ *
+ * KiTTY doesn't ship PuTTY's unix directory, so the few platform
+ * functions the terminal needs are stubbed at the end of this file,
+ * and the benchmark builds on Linux by itself. From the top of the
+ * source tree:
+ *
+ *   gcc -O2 -I. -Icharset -Iunix -Iutils -Iterminal -o termbench \
+ *       test/termbench.c terminal/terminal.c terminal/scrollback.c \
+ *       terminal/bidi.c \
+ *       utils/conf.c utils/tree234.c utils/memory.c utils/misc.c \
+ *       utils/utils.c utils/marshal.c utils/wcwidth.c utils/version.c \
+ *       settings.c timing.c callback.c logging.c
+ *
+ * To count allocations (and, for -S, the heap in use), add
+ *
+ *   -DCOUNT_ALLOCS -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "putty.h"
+#include "storage.h"
+#include "terminal.h"
+
+/* ----------------------------------------------------------------------
+ * Measurement.
+ */
+
+static double now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static unsigned long long nallocs, nallocbytes, livebytes;
+
+#ifdef COUNT_ALLOCS
+#include <malloc.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+    void *p = __real_malloc(size);
+    nallocs++;
+    nallocbytes += size;
+    livebytes += malloc_usable_size(p);
+    return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *p = __real_calloc(n, size);
+    nallocs++;
+    nallocbytes += n * size;
+    livebytes += malloc_usable_size(p);
+    return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    void *p;
+    nallocs++;
+    nallocbytes += size;
+    livebytes -= malloc_usable_size(ptr);
+    p = __real_realloc(ptr, size);
+    livebytes += malloc_usable_size(p);
+    return p;
+}
+
+void __wrap_free(void *ptr)
+{
+    livebytes -= malloc_usable_size(ptr);
+    __real_free(ptr);
+}
+#endif
+
+/*
+ * The drawing backend. It draws nothing, but counts what it would
+ * have drawn, which shows whether a change to the terminal has made
+ * do_paint do more or less work.
+ */
+static unsigned long long ndraws, ndrawchars;
+
+static bool bench_setup_draw_ctx(TermWin *tw) { return true; }
+static void bench_draw_text(
+    TermWin *tw, int x, int y, wchar_t *text, int len,
+    unsigned long attr, int lattr, truecolour tc)
+{
+    ndraws++;
+    ndrawchars += len;
+}
+static void bench_draw_cursor(
+    TermWin *tw, int x, int y, wchar_t *text, int len,
+    unsigned long attr, int lattr, truecolour tc) {}
+static void bench_draw_trust_sigil(TermWin *tw, int x, int y) {}
+static int bench_char_width(TermWin *tw, int uc) { return 1; }
+static void bench_free_draw_ctx(TermWin *tw) {}
+static void bench_set_cursor_pos(TermWin *tw, int x, int y) {}
+static void bench_set_raw_mouse_mode(TermWin *tw, bool enable) {}
+static void bench_set_raw_mouse_mode_pointer(TermWin *tw, bool enable) {}
+static void bench_set_scrollbar(TermWin *tw, int total, int start, int page) {}
+static void bench_bell(TermWin *tw, int mode) {}
+static void bench_clip_write(
+    TermWin *tw, int clipboard, wchar_t *text, int *attrs,
+    truecolour *colours, int len, bool must_deselect) {}
+static void bench_clip_request_paste(TermWin *tw, int clipboard) {}
+static void bench_refresh(TermWin *tw) {}
+static void bench_request_resize(TermWin *tw, int w, int h) {}
+static void bench_set_title(TermWin *tw, const char *title) {}
+static void bench_set_icon_title(TermWin *tw, const char *icontitle) {}
+static void bench_set_minimised(TermWin *tw, bool minimised) {}
+static void bench_set_maximised(TermWin *tw, bool maximised) {}
+static void bench_move(TermWin *tw, int x, int y) {}
+static void bench_set_zorder(TermWin *tw, bool top) {}
+static void bench_palette_set(TermWin *tw, unsigned start, unsigned ncolours,
+                              const rgb *colours) {}
+static void bench_palette_get_overrides(TermWin *tw, Terminal *term) {}
+
+static const TermWinVtable bench_termwin_vt = {
+    .setup_draw_ctx = bench_setup_draw_ctx,
+    .draw_text = bench_draw_text,
+    .draw_cursor = bench_draw_cursor,
+    .draw_trust_sigil = bench_draw_trust_sigil,
+    .char_width = bench_char_width,
+    .free_draw_ctx = bench_free_draw_ctx,
+    .set_cursor_pos = bench_set_cursor_pos,
+    .set_raw_mouse_mode = bench_set_raw_mouse_mode,
+    .set_raw_mouse_mode_pointer = bench_set_raw_mouse_mode_pointer,
+    .set_scrollbar = bench_set_scrollbar,
+    .bell = bench_bell,
+    .clip_write = bench_clip_write,
+    .clip_request_paste = bench_clip_request_paste,
+    .refresh = bench_refresh,
+    .request_resize = bench_request_resize,
+    .set_title = bench_set_title,
+    .set_icon_title = bench_set_icon_title,
+    .set_minimised = bench_set_minimised,
+    .set_maximised = bench_set_maximised,
+    .move = bench_move,
+    .set_zorder = bench_set_zorder,
+    .palette_set = bench_palette_set,
+    .palette_get_overrides = bench_palette_get_overrides,
+};
+
+/* ----------------------------------------------------------------------
+ * Workload generators. Each appends about `size' bytes to `sb'.
+ */
+
+static unsigned long rng_state;
+
+static unsigned rng(unsigned n)
+{
+    rng_state = rng_state * 1103515245 + 12345;
+    return (unsigned)((rng_state >> 16) & 0x7FFF) % n;
+}
+
+static const char *const words[] = {
+    "int", "char", "return", "if", "else", "for", "while", "static",
+    "const", "struct", "term", "line", "buf", "len", "size_t", "void",
+    "NULL", "0", "1", "x", "y", "i", "n", "=", "==", "+", "->", "(", ")",
+    "{", "}", ";", ",", "*", "&", "\"hello, world\"", "/* comment */",
+};
+#define NWORDS lenof(words)
+
+static void gen_text_line(strbuf *sb, int maxlen)
+{
+    int indent = rng(5) * 4, len = indent;
+
+    put_datapl(sb, make_ptrlen("                ", indent));
+    while (len < maxlen) {
+        const char *w = words[rng(NWORDS)];
+        put_datapl(sb, ptrlen_from_asciz(w));
+        put_byte(sb, ' ');
+        len += strlen(w) + 1;
+        if (rng(8) == 0)
+            break;
+    }
+}
+
+static void gen_cat(strbuf *sb, size_t size, int rows, int cols)
+{
+    while (sb->len < size) {
+        if (rng(10))
+            gen_text_line(sb, rng(cols * 3 / 2));
+        put_datapl(sb, PTRLEN_LITERAL("\r\n"));
+    }
+}
+
+static void gen_top(strbuf *sb, size_t size, int rows, int cols)
+{
+    static const char *const cmds[] = {
+        "kitty", "sshd", "bash", "vim", "make", "cc1", "systemd", "top",
+    };
+    unsigned frame = 0;
+
+    while (sb->len < size) {
+        int y;
+
+        strbuf_catf(sb, "\033[H\033[mtop - 12:%02u:%02u up 3 days, "
+                    "load average: %u.%02u, %u.%02u, %u.%02u\033[K\r\n",
+                    frame / 60 % 60, frame % 60, rng(4), rng(100),
+                    rng(4), rng(100), rng(4), rng(100));
+        strbuf_catf(sb, "Tasks: %u total, %u running\033[K\r\n",
+                    200 + rng(20), 1 + rng(4));
+        strbuf_catf(sb, "\033[K\r\n\033[7m%-*.*s\033[m\r\n", cols - 1,
+                    cols - 1, "    PID USER      PR  NI    VIRT    RES"
+                    "  %CPU  %MEM     TIME+ COMMAND");
+        for (y = 4; y < rows - 1; y++) {
+            bool busy = rng(4) == 0;
+            strbuf_catf(sb, "%s%7u user      20   0 %7u %6u %5u.%u "
+                        "%5u.%u %3u:%02u.%02u %s\033[m\033[K\r\n",
+                        busy ? "\033[1m" : "", 1000 + rng(30000),
+                        rng(999999), rng(99999), rng(100), rng(10),
+                        rng(10), rng(10), rng(100), rng(60), rng(100),
+                        cmds[rng(lenof(cmds))]);
+        }
+        put_datapl(sb, PTRLEN_LITERAL("\033[J"));
+        frame++;
+    }
+}
+
+static void gen_colour_line(strbuf *sb, int maxlen)
+{
+    static const char *const colours[] = {
+        "\033[33m", "\033[32m", "\033[36m", "\033[1;34m", "\033[35m",
+    };
+    int len = 0;
+
+    while (len < maxlen) {
+        const char *w = words[rng(NWORDS)];
+        if (rng(3) == 0) {
+            strbuf_catf(sb, "%s%s\033[m ", colours[rng(lenof(colours))], w);
+        } else {
+            put_datapl(sb, ptrlen_from_asciz(w));
+            put_byte(sb, ' ');
+        }
+        len += strlen(w) + 1;
+    }
+}
+
+static void gen_vim(strbuf *sb, size_t size, int rows, int cols)
+{
+    unsigned line = 1;
+
+    strbuf_catf(sb, "\033[?1049h\033[1;%dr\033[H\033[2J", rows - 1);
+    while (sb->len < size) {
+        int i, n = 1 + rng(8);
+
+        if (rng(6) == 0) {
+            /* scroll back: reverse index at the top of the margin */
+            for (i = 0; i < n; i++) {
+                put_datapl(sb, PTRLEN_LITERAL("\033[H\033M"));
+                gen_colour_line(sb, rng(cols - 8));
+            }
+        } else {
+            /* scroll forward: newline at the bottom of the margin */
+            for (i = 0; i < n; i++) {
+                strbuf_catf(sb, "\033[%d;1H\n\033[K", rows - 1);
+                gen_colour_line(sb, rng(cols - 8));
+            }
+        }
+        line += n;
+        strbuf_catf(sb, "\033[%d;1H\033[7m file.c%*u,%-4u\033[m\033[K"
+                    "\033[%u;%uH", rows, cols - 20, line, 1 + rng(40),
+                    1 + rng(rows - 1), 1 + rng(cols / 2));
+    }
+    put_datapl(sb, PTRLEN_LITERAL("\033[r\033[?1049l"));
+}
+
+static void gen_truecolour(strbuf *sb, size_t size, int rows, int cols)
+{
+    unsigned t = 0;
+
+    while (sb->len < size) {
+        int x;
+
+        for (x = 0; x < cols - 1; x += 4) {
+            strbuf_catf(sb, "\033[38;2;%u;%u;%um\033[48;2;%u;%u;%umXXXX",
+                        (t + x) & 0xFF, (t * 3) & 0xFF, (x * 5) & 0xFF,
+                        (255 - x) & 0xFF, (t + 128) & 0xFF, x & 0xFF);
+        }
+        put_datapl(sb, PTRLEN_LITERAL("\033[m\r\n"));
+        t += 7;
+    }
+}
+
+static void gen_unicode(strbuf *sb, size_t size, int rows, int cols)
+{
+    static const char *const pieces[] = {
+        "caf\xC3\xA9 ",                         /* precomposed */
+        "cafe\xCC\x81 ",                        /* e + combining acute */
+        "a\xCC\x88\xCC\xA3 ",                   /* a + two combiners */
+        "Vi\xE1\xBB\x87t Nam ",
+        "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E ", /* CJK, double width */
+        "\xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 ", /* Hangul */
+        "\xD7\xA9\xD7\x9C\xD7\x95\xD7\x9D ",     /* Hebrew */
+        "\xD9\x85\xD8\xB1\xD8\xAD\xD8\xA8\xD8\xA7 ", /* Arabic */
+        "\xE2\x94\x80\xE2\x94\x82\xE2\x94\x8C ", /* box drawing */
+        "plain ascii text ",
+    };
+
+    while (sb->len < size) {
+        int len = 0, maxlen = rng(cols);
+        while (len < maxlen) {
+            put_datapl(sb, ptrlen_from_asciz(pieces[rng(lenof(pieces))]));
+            len += 6;
+        }
+        put_datapl(sb, PTRLEN_LITERAL("\r\n"));
+    }
+}
+
+static const struct workload {
+    const char *name;
+    void (*gen)(strbuf *sb, size_t size, int rows, int cols);
+    bool utf8;
+} workloads[] = {
+    { "cat", gen_cat, false },
+    { "top", gen_top, false },
+    { "vim", gen_vim, false },
+    { "truecolour", gen_truecolour, false },
+    { "unicode", gen_unicode, true },
+};
+
+/* ----------------------------------------------------------------------
+ * Running a workload.
+ */
+
+struct options {
+    int passes, rows, cols, savelines, sblines, sbmemory;
+    size_t update, size;
+    bool machine;
+};
+
+struct result {
+    double total, parse, paint;
+    unsigned long long allocs, allocbytes, draws, drawchars;
+};
+
+static Terminal *new_terminal(const struct options *opt, Conf *conf,
+                              struct unicode_data *ucsdata, TermWin *termwin,
+                              int savelines, bool utf8)
+{
+    Terminal *term;
+
+    do_defaults(NULL, conf);
+    if (utf8)
+        conf_set_str(conf, CONF_line_codepage, "UTF-8");
+    conf_set_int(conf, CONF_scrollback_memory, opt->sbmemory);
+    init_ucs(ucsdata, conf_get_str(conf, CONF_line_codepage),
+             conf_get_bool(conf, CONF_utf8_override),
+             CS_NONE, conf_get_int(conf, CONF_vtmode));
+    termwin->vt = &bench_termwin_vt;
+    term = term_init(conf, ucsdata, termwin);
+    term_size(term, opt->rows, opt->cols, savelines);
+    term->ldisc = NULL;
+    /* As once a session has started: no trust sigils on the screen */
+    term_set_trust_status(term, false);
+    return term;
+}
+
+static void run_once(const struct options *opt, ptrlen data, bool utf8,
+                     struct result *res)
+{
+    Conf *conf = conf_new();
+    struct unicode_data ucsdata;
+    TermWin termwin;
+    Terminal *term;
+    unsigned long long allocs0, allocbytes0, draws0, drawchars0;
+    size_t pos;
+    double t0, t1, t2, start;
+
+    term = new_terminal(opt, conf, &ucsdata, &termwin, opt->savelines, utf8);
+
+    allocs0 = nallocs;
+    allocbytes0 = nallocbytes;
+    draws0 = ndraws;
+    drawchars0 = ndrawchars;
+
+    start = now();
+    for (pos = 0; pos < data.len; pos += opt->update) {
+        size_t len = data.len - pos;
+        if (len > opt->update)
+            len = opt->update;
+
+        t0 = now();
+        term_data(term, false, (const char *)data.ptr + pos, len);
+        t1 = now();
+        term_update(term);
+        t2 = now();
+
+        res->parse += t1 - t0;
+        res->paint += t2 - t1;
+    }
+    res->total += now() - start;
+
+    res->allocs += nallocs - allocs0;
+    res->allocbytes += nallocbytes - allocbytes0;
+    res->draws += ndraws - draws0;
+    res->drawchars += ndrawchars - drawchars0;
+
+    term_free(term);
+    conf_free(conf);
+}
+
+static void report(const struct options *opt, const char *name,
+                   size_t len, const struct result *res)
+{
+    double mb = len * (double)opt->passes / 1e6;
+    double total = res->total > 1e-9 ? res->total : 1e-9;
+
+    if (opt->machine) {
+        printf("%s\t%zu\t%d\t%.6f\t%.6f\t%.6f\t%.2f\t", name, len,
+               opt->passes, res->total, res->parse, res->paint,
+               mb / total);
+#ifdef COUNT_ALLOCS
+        printf("%.1f\t%.1f\t", res->allocs / mb, res->allocbytes / mb);
+#else
+        printf("-\t-\t");
+#endif
+        printf("%.1f\t%.1f\n", res->draws / mb, res->drawchars / mb);
+        return;
+    }
+
+    printf("%s: %zu bytes x %d passes\n", name, len, opt->passes);
+    printf("  %8.2f MB/s    %.3f s: parse %.3f s (%.0f%%), "
+           "paint %.3f s (%.0f%%)\n", mb / total, res->total,
+           res->parse, 100 * res->parse / total,
+           res->paint, 100 * res->paint / total);
+#ifdef COUNT_ALLOCS
+    printf("  %8.0f allocations/MB (%.0f KB/MB)\n",
+           res->allocs / mb, res->allocbytes / mb / 1024);
+#endif
+    printf("  %8.0f draw_text calls/MB, %.0f chars drawn/MB\n",
+           res->draws / mb, res->drawchars / mb);
+}
+
+static void run(const struct options *opt, const char *name, ptrlen data,
+                bool utf8)
+{
+    struct result res;
+    int i;
+
+    memset(&res, 0, sizeof(res));
+    for (i = 0; i < opt->passes; i++)
+        run_once(opt, data, utf8, &res);
+    report(opt, name, data.len, &res);
+}
+
+/*
+ * Search backwards from the bottom for every match of a pattern, as
+ * pressing 'find previous' repeatedly does, up to `max' of them.
+ * Returns the mean time per search (counting the last, unsuccessful,
+ * one if we got that far).
+ */
+static double time_search(Terminal *term, const wchar_t *pattern, int flags,
+                          int max, int *hits)
+{
+    double t0;
+    int n = 0;
+
+    term->selstate = NO_SELECTION;
+    term_scroll(term, -1, 0);
+    *hits = 0;
+
+    t0 = now();
+    while (n < max) {
+        n++;
+        if (term_search(term, pattern, flags | TERM_SEARCH_BACKWARD) !=
+            TERM_SEARCH_FOUND)
+            break;
+        (*hits)++;
+    }
+    return (now() - t0) / n;
+}
+
+/*
+ * The scrollback benchmark. The text is 'cat' without the lines that
+ * wrap, so that the scrollback ends up holding exactly as many lines
+ * as were asked for, and with a line for the searches to find every
+ * so often.
+ */
+static void run_scrollback(const struct options *opt)
+{
+    Conf *conf = conf_new();
+    struct unicode_data ucsdata;
+    TermWin termwin;
+    Terminal *term;
+    strbuf *sb = strbuf_new();
+    unsigned long long live0, heap;
+    uint64_t disk;
+    size_t store;
+    double fill, jump, jumpmax, page, srare, sregex, smiss, sscan, t0, t;
+    int lines = opt->sblines, i, njumps, npages, nrare, nregex, nmiss, nscan;
+    size_t pos;
+
+    rng_state = 1;
+    for (i = 0; i < lines + opt->rows; i++) {
+        if (i % 10007 == 5003)
+            put_datapl(sb, PTRLEN_LITERAL("write: Disk quota exceeded"));
+        else if (rng(10))
+            gen_text_line(sb, rng(opt->cols - 19));
+        put_datapl(sb, PTRLEN_LITERAL("\r\n"));
+    }
+
+    live0 = livebytes;
+    term = new_terminal(opt, conf, &ucsdata, &termwin, lines, false);
+
+    t0 = now();
+    for (pos = 0; pos < sb->len; pos += opt->update) {
+        size_t len = sb->len - pos;
+        if (len > opt->update)
+            len = opt->update;
+        term_data(term, false, (const char *)sb->u + pos, len);
+        term_update(term);
+    }
+    fill = now() - t0;
+    heap = livebytes - live0;          /* zero without COUNT_ALLOCS */
+    store = scrollback_memory(term->scrollback);
+    disk = scrollback_disk_usage(term->scrollback);
+
+    /* Jump to random places, as dragging the scroll bar does */
+    njumps = 2000;
+    jump = jumpmax = 0;
+    for (i = 0; i < njumps; i++) {
+        int where = (rng(32768) * 32768 + rng(32768)) % (lines + 1);
+        t0 = now();
+        term_scroll(term, 1, where);
+        term_update(term);
+        t = now() - t0;
+        jump += t;
+        if (jumpmax < t)
+            jumpmax = t;
+    }
+
+    /* Page up from the bottom, as Shift-PgUp does */
+    term_scroll(term, -1, 0);
+    term_update(term);
+    npages = lines / opt->rows;
+    if (npages > 2000)
+        npages = 2000;
+    t0 = now();
+    for (i = 0; i < npages; i++) {
+        term_scroll(term, 0, -opt->rows);
+        term_update(term);
+    }
+    page = npages ? (now() - t0) / npages : 0;
+
+    /*
+     * Searches: a plain string and a regex that can use the index, a
+     * string that isn't there at all, and a regex that isn't there
+     * and can't use the index, so has to look at every line.
+     */
+    srare = time_search(term, L"quota exceeded", 0, 1000, &nrare);
+    sregex = time_search(term, L"[Qq]uota +exc", TERM_SEARCH_REGEX,
+                         1000, &nregex);
+    smiss = time_search(term, L"xyzzy", 0, 1, &nmiss);
+    sscan = time_search(term, L"xyzzy|plugh", TERM_SEARCH_REGEX, 1, &nscan);
+
+    if (opt->machine) {
+        printf("#lines\tfill_us_per_line\tstore_bytes_per_line\t"
+               "disk_bytes_per_line\theap_bytes_per_line\tjump_us\t"
+               "jump_max_us\tpage_us\tsearch_us\tsearch_regex_us\t"
+               "search_miss_us\tsearch_scan_us\n");
+        printf("%d\t%.3f\t%.1f\t%.1f\t", lines,
+               fill * 1e6 / (lines + opt->rows), (double)store / lines,
+               (double)disk / lines);
+        if (heap)
+            printf("%.1f\t", (double)heap / lines);
+        else
+            printf("-\t");
+        printf("%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+               jump * 1e6 / njumps, jumpmax * 1e6, page * 1e6, srare * 1e6,
+               sregex * 1e6, smiss * 1e6, sscan * 1e6);
+    } else {
+        printf("scrollback: %d lines at %dx%d\n", lines, opt->cols,
+               opt->rows);
+        printf("  fill      %8.3f us per line (%.2f MB/s)\n",
+               fill * 1e6 / (lines + opt->rows), sb->len / fill / 1e6);
+        printf("  store     %8.1f bytes per line (%zu KB)\n",
+               (double)store / lines, store / 1024);
+        if (disk)
+            printf("  disk      %8.1f bytes per line (%llu KB)\n",
+                   (double)disk / lines, (unsigned long long)(disk / 1024));
+        if (heap)
+            printf("  heap      %8.1f bytes per line, with the screen\n",
+                   (double)heap / lines);
+        printf("  jump      %8.1f us mean, %.1f us worst, over %d "
+               "random positions\n", jump * 1e6 / njumps, jumpmax * 1e6,
+               njumps);
+        printf("  page up   %8.1f us per page\n", page * 1e6);
+        printf("  search    %8.1f us per search, string (%d hits)\n",
+               srare * 1e6, nrare);
+        printf("            %8.1f us per search, regex (%d hits)\n",
+               sregex * 1e6, nregex);
+        printf("            %8.1f us, string not there\n", smiss * 1e6);
+        printf("            %8.1f us, regex not there, with no trigrams\n",
+               sscan * 1e6);
+    }
+
+    term_free(term);
+    conf_free(conf);
+    strbuf_free(sb);
+}
+
+static bool read_file(const char *filename, strbuf *sb)
+{
+    FILE *fp = fopen(filename, "rb");
+    char buf[65536];
+    size_t len;
+
+    if (!fp) {
+        perror(filename);
+        return false;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        put_data(sb, buf, len);
+    fclose(fp);
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: termbench [-n passes] [-r rows] [-c cols] "
+            "[-s scrollback] [-u update-bytes]\n"
+            "                 [-z workload-bytes] [-f file]... [-m] "
+            "[workload...]\n"
+            "       termbench [-r rows] [-c cols] [-u update-bytes] [-m] "
+            "[-M kbytes] -S lines\n"
+            "workloads:");
+    for (size_t i = 0; i < lenof(workloads); i++)
+        fprintf(stderr, " %s", workloads[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct options opt;
+    const char **files = NULL, **names = NULL;
+    size_t nfiles = 0, filesize = 0, nnames = 0, namesize = 0, i, j;
+
+    opt.passes = 3;
+    opt.rows = 24;
+    opt.cols = 80;
+    opt.savelines = 2000;
+    opt.sblines = 0;
+    opt.sbmemory = 0;
+    opt.update = 16384;
+    opt.size = 2000000;
+    opt.machine = false;
+
+    for (i = 1; i < argc; i++) {
+        const char *p = argv[i];
+        if (!strcmp(p, "-n") && i+1 < argc) {
+            opt.passes = atoi(argv[++i]);
+        } else if (!strcmp(p, "-r") && i+1 < argc) {
+            opt.rows = atoi(argv[++i]);
+        } else if (!strcmp(p, "-c") && i+1 < argc) {
+            opt.cols = atoi(argv[++i]);
+        } else if (!strcmp(p, "-s") && i+1 < argc) {
+            opt.savelines = atoi(argv[++i]);
+        } else if (!strcmp(p, "-u") && i+1 < argc) {
+            opt.update = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(p, "-z") && i+1 < argc) {
+            opt.size = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(p, "-f") && i+1 < argc) {
+            sgrowarray(files, filesize, nfiles);
+            files[nfiles++] = argv[++i];
+        } else if (!strcmp(p, "-S") && i+1 < argc) {
+            opt.sblines = atoi(argv[++i]);
+        } else if (!strcmp(p, "-M") && i+1 < argc) {
+            opt.sbmemory = atoi(argv[++i]);
+        } else if (!strcmp(p, "-m")) {
+            opt.machine = true;
+        } else if (p[0] != '-') {
+            for (j = 0; j < lenof(workloads); j++)
+                if (!strcmp(p, workloads[j].name))
+                    break;
+            if (j == lenof(workloads)) {
+                fprintf(stderr, "termbench: unknown workload '%s'\n", p);
+                usage();
+                return 1;
+            }
+            sgrowarray(names, namesize, nnames);
+            names[nnames++] = p;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (opt.passes < 1 || opt.rows < 2 || opt.cols < 20 ||
+        opt.savelines < 0 || opt.sblines < 0 || opt.update < 1) {
+        fprintf(stderr, "termbench: bad pass count, screen size, "
+                "scrollback or update size\n");
+        return 1;
+    }
+
+    if (opt.sblines) {
+        run_scrollback(&opt);
+        return 0;
+    }
+
+    if (opt.machine)
+        printf("#workload\tbytes\tpasses\ttotal_s\tparse_s\tpaint_s\t"
+               "mb_per_s\tallocs_per_mb\talloc_bytes_per_mb\t"
+               "draws_per_mb\tdrawchars_per_mb\n");
+    else
+        printf("%dx%d screen, %d lines of scrollback, "
+               "update every %zu bytes\n",
+               opt.cols, opt.rows, opt.savelines, opt.update);
+
+    for (i = 0; i < lenof(workloads); i++) {
+        const struct workload *w = &workloads[i];
+        strbuf *sb;
+
+        if (nnames) {
+            for (j = 0; j < nnames; j++)
+                if (!strcmp(names[j], w->name))
+                    break;
+            if (j == nnames)
+                continue;
+        } else if (nfiles) {
+            continue;                  /* -f alone runs just the files */
+        }
+
+        sb = strbuf_new();
+        rng_state = 1;
+        w->gen(sb, opt.size, opt.rows, opt.cols);
+        run(&opt, w->name, ptrlen_from_strbuf(sb), w->utf8);
+        strbuf_free(sb);
+    }
+
+    for (i = 0; i < nfiles; i++) {
+        strbuf *sb = strbuf_new();
+        if (read_file(files[i], sb))
+            run(&opt, files[i], ptrlen_from_strbuf(sb), true);
+        strbuf_free(sb);
+    }
+
+    sfree(files);
+    sfree(names);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Everything else the terminal and its supporting modules need, most
+ * of which would come from the unix directory in a PuTTY source tree.
+ */
+
+const bool buildinfo_gtk_relevant = false;
+char *buildinfo_gtk_version(void) { return NULL; }
+const char *const appname = "termbench";
+const int ngsslibs = 0;
+const char *const gsslibnames[0] = { };
+const struct keyvalwhere gsslibkeywords[0] = { };
+const struct BackendVtable *const backends[] = { NULL };
+
+void ldisc_send(Ldisc *ldisc, const void *buf, int len, bool interactive) {}
+void ldisc_echoedit_update(Ldisc *ldisc) {}
+void modalfatalbox(const char *fmt, ...) { exit(1); }
+void nonfatal(const char *fmt, ...) { }
+void timer_change_notify(unsigned long next) { }
+
+unsigned long getticks(void)
+{
+    return (unsigned long)(now() * 1000);
+}
+
+struct tm ltime(void)
+{
+    time_t t = time(NULL);
+    return *localtime(&t);
+}
+
+char *get_username(void) { return dupstr("termbench"); }
+
+/* The settings store is always empty, so do_defaults gets defaults */
+settings_w *open_settings_w(const char *sessionname, char **errmsg)
+{ return NULL; }
+void write_setting_s(settings_w *handle, const char *key, const char *value)
+{ }
+void write_setting_i(settings_w *handle, const char *key, int value) { }
+void write_setting_filename(settings_w *handle, const char *key,
+                            Filename *value) { }
+void write_setting_fontspec(settings_w *handle, const char *key,
+                            FontSpec *font) { }
+void close_settings_w(settings_w *handle) { }
+settings_r *open_settings_r(const char *sessionname) { return NULL; }
+char *read_setting_s(settings_r *handle, const char *key) { return NULL; }
+int read_setting_i(settings_r *handle, const char *key, int defvalue)
+{ return defvalue; }
+Filename *read_setting_filename(settings_r *handle, const char *key)
+{ return NULL; }
+FontSpec *read_setting_fontspec(settings_r *handle, const char *key)
+{ return NULL; }
+void close_settings_r(settings_r *handle) { }
+settings_e *enum_settings_start(void) { return NULL; }
+bool enum_settings_next(settings_e *handle, strbuf *out) { return false; }
+void enum_settings_finish(settings_e *handle) { }
+
+char *platform_default_s(const char *name) { return NULL; }
+bool platform_default_b(const char *name, bool def) { return def; }
+int platform_default_i(const char *name, int def) { return def; }
+FontSpec *platform_default_fontspec(const char *name)
+{ return fontspec_new(""); }
+Filename *platform_default_filename(const char *name)
+{ return filename_from_str(""); }
+
+Filename *filename_from_str(const char *str)
+{
+    Filename *fn = snew(Filename);
+    fn->path = dupstr(str);
+    return fn;
+}
+const char *filename_to_str(const Filename *fn) { return fn->path; }
+Filename *filename_copy(const Filename *fn)
+{ return filename_from_str(fn->path); }
+bool filename_equal(const Filename *f1, const Filename *f2)
+{ return !strcmp(f1->path, f2->path); }
+bool filename_is_null(const Filename *fn) { return !*fn->path; }
+void filename_free(Filename *fn)
+{
+    sfree(fn->path);
+    sfree(fn);
+}
+void filename_serialise(BinarySink *bs, const Filename *f)
+{ put_asciz(bs, f->path); }
+Filename *filename_deserialise(BinarySource *src)
+{ return filename_from_str(get_asciz(src)); }
+char filename_char_sanitise(char c) { return c == '/' ? '.' : c; }
+FILE *f_open(const Filename *fn, char const *mode, bool isprivate)
+{ return fopen(fn->path, mode); }
+bool open_for_write_would_lose_data(const Filename *fn) { return false; }
+
+FontSpec *fontspec_new(const char *name)
+{
+    FontSpec *f = snew(FontSpec);
+    f->name = dupstr(name);
+    return f;
+}
+FontSpec *fontspec_copy(const FontSpec *f) { return fontspec_new(f->name); }
+void fontspec_free(FontSpec *f)
+{
+    sfree(f->name);
+    sfree(f);
+}
+void fontspec_serialise(BinarySink *bs, FontSpec *f)
+{ put_asciz(bs, f->name); }
+FontSpec *fontspec_deserialise(BinarySource *src)
+{ return fontspec_new(get_asciz(src)); }
+
+/* Session logging isn't benchmarked, so it never gets as far as these */
+LogWriter *logwriter_new(FILE *fp, size_t bufsize, size_t batch,
+                         unsigned interval_ms) { return NULL; }
+bool logwriter_write(LogWriter *lw, const void *data, size_t len)
+{ return false; }
+uint64_t logwriter_dropped(LogWriter *lw) { return 0; }
+size_t logwriter_peak(LogWriter *lw) { return 0; }
+void logwriter_free(LogWriter *lw) { }
+
+/*
+ * The scrollback spill file, done the POSIX way, so that -M measures
+ * something like what the Windows version does.
+ */
+struct SpillFile {
+    int fd;
+    void *view;
+    size_t viewlen;
+};
+
+SpillFile *spill_file_new(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char *path = dupprintf("%s/termbenchXXXXXX", dir ? dir : "/tmp");
+    SpillFile *sf;
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        sfree(path);
+        return NULL;
+    }
+    unlink(path);
+    sfree(path);
+
+    sf = snew(SpillFile);
+    sf->fd = fd;
+    sf->view = NULL;
+    sf->viewlen = 0;
+    return sf;
+}
+
+bool spill_file_write(SpillFile *sf, uint64_t offset,
+                      const void *data, size_t len)
+{
+    return pwrite(sf->fd, data, len, offset) == (ssize_t)len;
+}
+
+const void *spill_file_map(SpillFile *sf, uint64_t offset, size_t len)
+{
+    uint64_t start = offset - offset % sysconf(_SC_PAGESIZE);
+
+    if (sf->view)
+        munmap(sf->view, sf->viewlen);
+    sf->viewlen = offset + len - start;
+    sf->view = mmap(NULL, sf->viewlen, PROT_READ, MAP_SHARED, sf->fd, start);
+    if (sf->view == MAP_FAILED) {
+        sf->view = NULL;
+        return NULL;
+    }
+    return (const char *)sf->view + (offset - start);
+}
+
+void spill_file_free(SpillFile *sf)
+{
+    if (sf->view)
+        munmap(sf->view, sf->viewlen);
+    close(sf->fd);
+    sfree(sf);
+}
+
+printer_job *printer_start_job(char *printer) { return NULL; }
+void printer_job_data(printer_job *pj, const void *data, size_t len) { }
+void printer_finish_job(printer_job *pj) { }
+
+/*
+ * Character sets: just enough for ISO 8859-1 and UTF-8, which are all
+ * the workloads use.
+ */
+bool init_ucs(struct unicode_data *ucsdata, char *line_codepage,
+              bool utf8_override, int font_charset, int vtmode)
+{
+    int i;
+
+    memset(ucsdata, 0, sizeof(*ucsdata));
+    ucsdata->line_codepage = (!strcmp(line_codepage, "UTF-8") ?
+                              CP_UTF8 : CS_ISO8859_1);
+    ucsdata->font_codepage = CS_ISO8859_1;
+    for (i = 0; i < 256; i++) {
+        ucsdata->unitab_line[i] = i;
+        ucsdata->unitab_font[i] = i;
+        ucsdata->unitab_xterm[i] = i;
+        ucsdata->unitab_scoacs[i] = i;
+        ucsdata->unitab_oemcp[i] = i;
+        ucsdata->unitab_ctrl[i] = (i < ' ' || (i >= 0x7F && i < 0xA0) ?
+                                   i : 0xFF);
+    }
+    for (i = 0x60; i < 0x7F; i++)
+        ucsdata->unitab_xterm[i] = 0x2500 + i;   /* rough line drawing */
+    return true;
+}
+
+bool is_dbcs_leadbyte(int codepage, char byte) { return false; }
+
+int mb_to_wc(int codepage, int flags, const char *mbstr, int mblen,
+             wchar_t *wcstr, int wclen)
+{
+    int i;
+    for (i = 0; i < mblen && i < wclen; i++)
+        wcstr[i] = (unsigned char)mbstr[i];
+    return i;
+}
+
+int wc_to_mb(int codepage, int flags, const wchar_t *wcstr, int wclen,
+             char *mbstr, int mblen, const char *defchr,
+             struct unicode_data *ucsdata)
+{
+    int i;
+    for (i = 0; i < wclen && i < mblen; i++)
+        mbstr[i] = (wcstr[i] < 0x100 ? wcstr[i] : '?');
+    return i;
+}
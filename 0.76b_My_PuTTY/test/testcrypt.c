@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "defs.h"
 #include "ssh.h"
@@ -253,6 +254,7 @@ static const ssh2_macalg *get_macalg(BinarySource *in)
         {"hmac_sha1_96_buggy", &ssh_hmac_sha1_96_buggy},
         {"hmac_sha256", &ssh_hmac_sha256},
         {"poly1305", &ssh2_poly1305},
+        {"aesgcm", &ssh2_aesgcm_mac},
     };
 
     ptrlen name = get_word(in);
@@ -272,6 +274,7 @@ static const ssh_keyalg *get_keyalg(BinarySource *in)
         {"dsa", &ssh_dss},
         {"rsa", &ssh_rsa},
         {"ed25519", &ssh_ecdsa_ed25519},
+        {"ed25519_generic", &ssh_ecdsa_ed25519_generic},
         {"ed448", &ssh_ecdsa_ed448},
         {"p256", &ssh_ecdsa_nistp256},
         {"p384", &ssh_ecdsa_nistp384},
@@ -314,6 +317,12 @@ static const ssh_cipheralg *get_cipheralg(BinarySource *in)
         {"aes128_cbc", &ssh_aes128_cbc},
         {"aes128_cbc_hw", &ssh_aes128_cbc_hw},
         {"aes128_cbc_sw", &ssh_aes128_cbc_sw},
+        {"aes256_gcm", &ssh_aes256_gcm},
+        {"aes256_gcm_hw", &ssh_aes256_gcm_hw},
+        {"aes256_gcm_sw", &ssh_aes256_gcm_sw},
+        {"aes128_gcm", &ssh_aes128_gcm},
+        {"aes128_gcm_hw", &ssh_aes128_gcm_hw},
+        {"aes128_gcm_sw", &ssh_aes128_gcm_sw},
         {"blowfish_ctr", &ssh_blowfish_ssh2_ctr},
         {"blowfish_ssh2", &ssh_blowfish_ssh2},
         {"blowfish_ssh1", &ssh_blowfish_ssh1},
@@ -355,6 +364,7 @@ static const ssh_kex *get_ecdh_alg(BinarySource *in)
         const ssh_kex *value;
     } algs[] = {
         {"curve25519", &ssh_ec_kex_curve25519},
+        {"curve25519_generic", &ssh_ec_kex_curve25519_generic},
         {"curve448", &ssh_ec_kex_curve448},
         {"nistp256", &ssh_ec_kex_nistp256},
         {"nistp384", &ssh_ec_kex_nistp384},
@@ -938,6 +948,21 @@ strbuf *ssh_cipher_decrypt_length_wrapper(ssh_cipher *c, ptrlen input,
 #undef ssh_cipher_decrypt_length
 #define ssh_cipher_decrypt_length ssh_cipher_decrypt_length_wrapper
 
+strbuf *ssh_cipher_keystream_wrapper(ssh_cipher *c, size_t len)
+{
+    const ssh_cipheralg *alg = ssh_cipher_alg(c);
+    if (!(alg->flags & (SSH_CIPHER_IS_SDCTR | SSH_CIPHER_SEPARATE_LENGTH)))
+        fatal_error("ssh_cipher_keystream: needs a counter-mode cipher");
+    if (len % alg->blksize)
+        fatal_error("ssh_cipher_keystream: needs a multiple of %d bytes",
+                    alg->blksize);
+    strbuf *sb = strbuf_new();
+    ssh_cipher_keystream(c, strbuf_append(sb, len), len);
+    return sb;
+}
+#undef ssh_cipher_keystream
+#define ssh_cipher_keystream ssh_cipher_keystream_wrapper
+
 strbuf *ssh2_mac_genresult_wrapper(ssh2_mac *m)
 {
     strbuf *sb = strbuf_new();
@@ -1292,6 +1317,28 @@ strbuf *argon2_wrapper(Argon2Flavour flavour, uint32_t mem, uint32_t passes,
 }
 #define argon2 argon2_wrapper
 
+strbuf *x25519_multiply_wrapper(ptrlen scalar, ptrlen u)
+{
+    if (scalar.len != 32 || u.len != 32)
+        fatal_error("x25519_multiply: inputs must be 32 bytes long");
+    strbuf *out = strbuf_new();
+    x25519_multiply(strbuf_append(out, 32), scalar.ptr, u.ptr);
+    return out;
+}
+#define x25519_multiply x25519_multiply_wrapper
+
+strbuf *ed25519_base_multiply_wrapper(ptrlen scalar)
+{
+    if (scalar.len != 32)
+        fatal_error("ed25519_base_multiply: scalar must be 32 bytes long");
+    if (((const unsigned char *)scalar.ptr)[31] & 0x80)
+        fatal_error("ed25519_base_multiply: scalar must be less than 2^255");
+    strbuf *out = strbuf_new();
+    ed25519_base_multiply(strbuf_append(out, 32), scalar.ptr);
+    return out;
+}
+#define ed25519_base_multiply ed25519_base_multiply_wrapper
+
 #define OPTIONAL_PTR_FUNC(type)                                         \
     typedef TD_val_##type TD_opt_val_##type;                            \
     static TD_opt_val_##type get_opt_val_##type(BinarySource *in) {     \
@@ -1507,6 +1554,115 @@ void dputs(const char *buf)
     fputs(buf, stderr);
 }
 
+/*
+ * Argon2 benchmark mode (testcrypt --argon2-bench). This checks the
+ * test vectors from RFC 9106 and times argon2() over a range of
+ * memory, pass and parallelism settings, each one first in plain C on
+ * one thread (which is how it always used to run), then with the SIMD
+ * version of G if this CPU has one, then on as many threads as the
+ * lanes can use. Every setting has to give the same answer each way.
+ */
+static double argon2_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int argon2_benchmark(void)
+{
+    static const struct {
+        Argon2Flavour flavour;
+        const char *expected;
+    } rfc9106[] = {
+        {Argon2d, "512b391b6f1162975371d30919734294"
+                  "f868e3be3984f3c1a13a4db9fabe4acb"},
+        {Argon2i, "c814d9d1dc7f37aa13f0d77f2494bda1"
+                  "c8de6b016dd388d29952a4c4672b6ce8"},
+        {Argon2id, "0d640df58d78766c08c037a34a8b53c9"
+                   "d01ef0452d75b65eb52520e96b01e659"},
+    };
+    static const struct {
+        unsigned threads;
+        bool simd;
+        const char *name;
+    } impls[] = {
+        {1, false, "C, 1 thread"},
+        {1, true, "SIMD, 1 thread"},
+        {0, true, "SIMD, threaded"},
+    };
+    static const uint32_t mems[] = { 8192, 65536, 262144 };
+    static const uint32_t passes[] = { 1, 3 };
+    static const uint32_t parallels[] = { 1, 2, 4, 8 };
+    unsigned char P[32], S[16], K[8], X[12];
+    int failures = 0;
+
+    memset(P, 0x01, sizeof(P));
+    memset(S, 0x02, sizeof(S));
+    memset(K, 0x03, sizeof(K));
+    memset(X, 0x04, sizeof(X));
+
+    for (size_t i = 0; i < lenof(impls); i++) {
+        argon2_set_limits(impls[i].threads, impls[i].simd);
+        for (size_t j = 0; j < lenof(rfc9106); j++) {
+            strbuf *out = argon2(
+                rfc9106[j].flavour, 32, 3, 4, 32,
+                make_ptrlen(P, sizeof(P)), make_ptrlen(S, sizeof(S)),
+                make_ptrlen(K, sizeof(K)), make_ptrlen(X, sizeof(X)));
+            char hex[65];
+            for (size_t k = 0; k < 32; k++)
+                sprintf(hex + 2*k, "%02x", out->u[k]);
+            if (strcmp(hex, rfc9106[j].expected)) {
+                printf("%s: RFC 9106 vector %d: got %s\n",
+                       impls[i].name, (int)j, hex);
+                failures++;
+            }
+            strbuf_free(out);
+        }
+    }
+    printf("RFC 9106 test vectors: %s\n", failures ? "FAILED" : "ok");
+
+    printf("%8s %6s %8s  %14s %14s %14s\n", "mem (KB)", "passes",
+           "parallel", impls[0].name, impls[1].name, impls[2].name);
+    for (size_t mi = 0; mi < lenof(mems); mi++) {
+        for (size_t ti = 0; ti < lenof(passes); ti++) {
+            for (size_t pi = 0; pi < lenof(parallels); pi++) {
+                strbuf *first = NULL;
+
+                printf("%8"PRIu32" %6"PRIu32" %8"PRIu32" ", mems[mi],
+                       passes[ti], parallels[pi]);
+                for (size_t i = 0; i < lenof(impls); i++) {
+                    argon2_set_limits(impls[i].threads, impls[i].simd);
+                    double start = argon2_bench_now();
+                    strbuf *out = argon2(
+                        Argon2id, mems[mi], passes[ti], parallels[pi], 32,
+                        make_ptrlen(P, sizeof(P)), make_ptrlen(S, sizeof(S)),
+                        PTRLEN_LITERAL(""), PTRLEN_LITERAL(""));
+                    double elapsed = argon2_bench_now() - start;
+
+                    printf(" %12.1fms", elapsed * 1000);
+                    if (!first) {
+                        first = out;
+                    } else {
+                        if (!ptrlen_eq_ptrlen(ptrlen_from_strbuf(first),
+                                              ptrlen_from_strbuf(out))) {
+                            printf(" (MISMATCH)");
+                            failures++;
+                        }
+                        strbuf_free(out);
+                    }
+                    fflush(stdout);
+                }
+                printf("\n");
+                strbuf_free(first);
+            }
+        }
+    }
+
+    argon2_set_limits(0, true);
+    return failures ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
     const char *infile = NULL, *outfile = NULL;
@@ -1524,9 +1680,14 @@ int main(int argc, char **argv)
                 outfile = *++argv;
             } else if (!strcmp(p, "--")) {
                 doing_opts = false;
+            } else if (!strcmp(p, "--argon2-bench")) {
+                return argon2_benchmark();
             } else if (!strcmp(p, "--help")) {
                 printf("usage: testcrypt [INFILE] [-o OUTFILE]\n");
-                printf(" also: testcrypt --help       display this text\n");
+                printf(" also: testcrypt --argon2-bench  check and time "
+                       "Argon2\n");
+                printf("       testcrypt --help          display this "
+                       "text\n");
                 return 0;
             } else {
                 fprintf(stderr, "unknown command line option '%s'\n", p);
@@ -121,6 +121,8 @@ FUNC2(val_epoint, ecc_edwards_add, val_epoint, val_epoint)
 FUNC2(val_epoint, ecc_edwards_multiply, val_epoint, val_mpint)
 FUNC2(uint, ecc_edwards_eq, val_epoint, val_epoint)
 FUNC3(void, ecc_edwards_get_affine, val_epoint, out_val_mpint, out_val_mpint)
+FUNC2(val_string, x25519_multiply, val_string_ptrlen, val_string_ptrlen)
+FUNC1(val_string, ed25519_base_multiply, val_string_ptrlen)
 
 /*
  * The ssh_hash abstraction. Note the 'consumed', indicating that
@@ -190,6 +192,8 @@ FUNC2(val_string, ssh_cipher_encrypt, val_cipher, val_string_ptrlen)
 FUNC2(val_string, ssh_cipher_decrypt, val_cipher, val_string_ptrlen)
 FUNC3(val_string, ssh_cipher_encrypt_length, val_cipher, val_string_ptrlen, uint)
 FUNC3(val_string, ssh_cipher_decrypt_length, val_cipher, val_string_ptrlen, uint)
+FUNC1(void, ssh_cipher_next_message, val_cipher)
+FUNC2(val_string, ssh_cipher_keystream, val_cipher, uint)
 
 /*
  * Integer Diffie-Hellman.
@@ -268,6 +272,7 @@ FUNC2(val_string_asciz, ssh2_fingerprint_blob, val_string_ptrlen, fptype)
  */
 FUNC9(val_string, argon2, argon2flavour, uint, uint, uint, uint, val_string_ptrlen, val_string_ptrlen, val_string_ptrlen, val_string_ptrlen)
 FUNC2(val_string, argon2_long_hash, uint, val_string_ptrlen)
+FUNC2(void, argon2_set_limits, uint, boolean)
 
 /*
  * Key generation functions.
@@ -280,6 +285,7 @@ FUNC3(val_rsa, rsa1_generate, uint, boolean, val_pgc)
 FUNC1(val_pgc, primegen_new_context, primegenpolicy)
 FUNC2(opt_val_mpint, primegen_generate, val_pgc, consumed_val_pcs)
 FUNC2(val_string, primegen_mpu_certificate, val_pgc, val_mpint)
+FUNC1(void, primegen_set_threads, uint)
 FUNC1(val_pcs, pcs_new, uint)
 FUNC3(val_pcs, pcs_new_with_firstbits, uint, uint, uint)
 FUNC3(void, pcs_require_residue, val_pcs, val_mpint, val_mpint)
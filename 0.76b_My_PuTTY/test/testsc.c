@@ -249,6 +249,12 @@ VOLATILE_WRAPPED_DEFN(static, size_t, looplimit, (size_t x))
     X(Y, ssh_aes128_cbc)                        \
     X(Y, ssh_aes128_cbc_hw)                     \
     X(Y, ssh_aes128_cbc_sw)                     \
+    X(Y, ssh_aes256_gcm)                        \
+    X(Y, ssh_aes256_gcm_hw)                     \
+    X(Y, ssh_aes256_gcm_sw)                     \
+    X(Y, ssh_aes128_gcm)                        \
+    X(Y, ssh_aes128_gcm_hw)                     \
+    X(Y, ssh_aes128_gcm_sw)                     \
     X(Y, ssh2_chacha20_poly1305)                \
     /* end of list */
 
@@ -327,6 +333,8 @@ VOLATILE_WRAPPED_DEFN(static, size_t, looplimit, (size_t x))
     X(ecc_edwards_eq)                           \
     X(ecc_edwards_get_affine)                   \
     X(ecc_edwards_decompress)                   \
+    X(x25519_multiply)                          \
+    X(ed25519_base_multiply)                    \
     CIPHERS(CIPHER_TESTLIST, X)                 \
     MACS(MAC_TESTLIST, X)                       \
     HASHES(HASH_TESTLIST, X)                    \
@@ -1265,6 +1273,38 @@ static void test_ecc_edwards_decompress(void)
     ecc_edwards_curve_free(ec);
 }
 
+static void test_x25519_multiply(void)
+{
+    unsigned char scalar[32], u[32], out[32];
+    for (size_t i = 0; i < looplimit(5); i++) {
+        random_read(scalar, sizeof(scalar));
+        random_read(u, sizeof(u));
+
+        log_start();
+        x25519_multiply(out, scalar, u);
+        log_end();
+    }
+}
+
+static void test_ed25519_base_multiply(void)
+{
+    unsigned char scalar[32], out[32];
+
+    /* Prime the lazy initialisation of the table of multiples of the
+     * base point */
+    memset(scalar, 0, sizeof(scalar));
+    ed25519_base_multiply(out, scalar);
+
+    for (size_t i = 0; i < looplimit(5); i++) {
+        random_read(scalar, sizeof(scalar));
+        scalar[31] &= 0x7F;
+
+        log_start();
+        ed25519_base_multiply(out, scalar);
+        log_end();
+    }
+}
+
 static void test_cipher(const ssh_cipheralg *calg)
 {
     ssh_cipher *c = ssh_cipher_new(calg);
@@ -1323,6 +1363,7 @@ static void test_cipher(const ssh_cipheralg *calg)
         if (calg->flags & SSH_CIPHER_SEPARATE_LENGTH)
             ssh_cipher_decrypt_length(c, data, datalen, seq);
         ssh_cipher_decrypt(c, data, datalen);
+        ssh_cipher_next_message(c);
         log_end();
     }
 
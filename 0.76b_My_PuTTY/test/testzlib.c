@@ -8,12 +8,19 @@
  *
  * It's also useful as a means for a fuzzer to get reasonably direct
  * access to PuTTY's zlib decompressor.
+ *
+ * With -c it runs the compressor instead, so that its output can be
+ * checked against other people's decoders; and with -b it feeds a
+ * file through both halves a packet at a time, as SSH would, checks
+ * the data comes back unchanged, and reports the compression ratio
+ * and speed.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 #include "defs.h"
 #include "ssh.h"
@@ -29,12 +36,113 @@ void dputs(const char *buf)
     fputs(buf, stderr);
 }
 
+static int compress_file(FILE *fp, int level)
+{
+    unsigned char buf[4096], *outbuf;
+    int ret, outlen;
+    ssh_compressor *handle;
+
+    handle = ssh_compressor_new(&ssh_zlib, level);
+
+    while (1) {
+        ret = fread(buf, 1, sizeof(buf), fp);
+        if (ret <= 0)
+            break;
+        ssh_compressor_compress(handle, buf, ret, &outbuf, &outlen, 0);
+        fwrite(outbuf, 1, outlen, stdout);
+        sfree(outbuf);
+    }
+
+    ssh_compressor_free(handle);
+    return 0;
+}
+
+static int benchmark_file(FILE *fp, int level, int packetlen)
+{
+    strbuf *input = strbuf_new_nm();
+    unsigned char buf[4096], **packets;
+    int *packetlens, npackets, ret, i, outlen;
+    size_t offset, complen;
+    ssh_compressor *comp;
+    ssh_decompressor *decomp;
+    clock_t start, compress_time, decompress_time;
+    bool ok = true;
+
+    while ((ret = fread(buf, 1, sizeof(buf), fp)) > 0)
+        put_data(input, buf, ret);
+
+    npackets = (input->len + packetlen - 1) / packetlen;
+    packets = snewn(npackets, unsigned char *);
+    packetlens = snewn(npackets, int);
+
+    comp = ssh_compressor_new(&ssh_zlib, level);
+    complen = 0;
+    start = clock();
+    for (i = 0, offset = 0; i < npackets; i++, offset += packetlen) {
+        int len = input->len - offset;
+        if (len > packetlen)
+            len = packetlen;
+        ssh_compressor_compress(comp, input->u + offset, len,
+                                &packets[i], &packetlens[i], 0);
+        complen += packetlens[i];
+    }
+    compress_time = clock() - start;
+    ssh_compressor_free(comp);
+
+    decomp = ssh_decompressor_new(&ssh_zlib);
+    start = clock();
+    for (i = 0, offset = 0; i < npackets; i++, offset += packetlen) {
+        unsigned char *outbuf;
+        int len = input->len - offset;
+        if (len > packetlen)
+            len = packetlen;
+        if (!ssh_decompressor_decompress(decomp, packets[i], packetlens[i],
+                                         &outbuf, &outlen)) {
+            fprintf(stderr, "packet %d: decoding error\n", i);
+            ok = false;
+            break;
+        }
+        if (outlen != len || memcmp(outbuf, input->u + offset, len)) {
+            fprintf(stderr, "packet %d: data does not match\n", i);
+            ok = false;
+        }
+        sfree(outbuf);
+        if (!ok)
+            break;
+    }
+    decompress_time = clock() - start;
+    ssh_decompressor_free(decomp);
+
+    if (ok) {
+        double ctime = (double)compress_time / CLOCKS_PER_SEC;
+        double dtime = (double)decompress_time / CLOCKS_PER_SEC;
+        double mb = input->len / 1048576.0;
+
+        printf("level %d, %d-byte packets: %"SIZEu" -> %"SIZEu" bytes"
+               " (%.2f%%)\n",
+               level, packetlen, input->len, complen,
+               input->len ? 100.0 * complen / input->len : 100.0);
+        printf("compress %.3fs (%.1f MB/s), decompress %.3fs (%.1f MB/s)\n",
+               ctime, ctime > 0 ? mb / ctime : 0.0,
+               dtime, dtime > 0 ? mb / dtime : 0.0);
+    }
+
+    for (i = 0; i < npackets; i++)
+        sfree(packets[i]);
+    sfree(packets);
+    sfree(packetlens);
+    strbuf_free(input);
+    return ok ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
     unsigned char buf[16], *outbuf;
     int ret, outlen;
     ssh_decompressor *handle;
     int noheader = false, opts = true;
+    int compress = false, benchmark = false;
+    int level = ZLIB_DEFAULT_LEVEL, packetlen = 32768;
     char *filename = NULL;
     FILE *fp;
 
@@ -44,6 +152,19 @@ int main(int argc, char **argv)
         if (p[0] == '-' && opts) {
             if (!strcmp(p, "-d")) {
                 noheader = true;
+            } else if (!strcmp(p, "-c")) {
+                compress = true;
+            } else if (!strcmp(p, "-b")) {
+                benchmark = true;
+            } else if (p[1] == 'l' && p[2] >= '1' && p[2] <= '9' && !p[3]) {
+                level = p[2] - '0';
+            } else if (!strcmp(p, "-p") && argc > 1) {
+                --argc;
+                packetlen = atoi(*++argv);
+                if (packetlen <= 0) {
+                    fprintf(stderr, "packet size must be positive\n");
+                    return 1;
+                }
             } else if (!strcmp(p, "--")) {
                 opts = false;          /* next thing is filename */
             } else if (!strcmp(p, "--help")) {
@@ -51,7 +172,17 @@ int main(int argc, char **argv)
                        " from standard input\n");
                 printf("       testzlib -d       decode Deflate (RFC1951) data"
                        " from standard input\n");
+                printf("       testzlib -c       encode standard input as zlib"
+                       " (RFC1950) data\n");
+                printf("       testzlib -b       round-trip standard input a"
+                       " packet at a time, and\n"
+                       "                         report compression ratio"
+                       " and speed\n");
                 printf("       testzlib --help   display this text\n");
+                printf("options: -l1 ... -l9     compression level"
+                       " (default %d)\n", ZLIB_DEFAULT_LEVEL);
+                printf("         -p <bytes>      packet size for -b"
+                       " (default 32768)\n");
                 return 0;
             } else {
                 fprintf(stderr, "unknown command line option '%s'\n", p);
@@ -65,6 +196,25 @@ int main(int argc, char **argv)
         }
     }
 
+    if (filename)
+        fp = fopen(filename, "rb");
+    else
+        fp = stdin;
+
+    if (!fp) {
+        assert(filename);
+        fprintf(stderr, "unable to open '%s'\n", filename);
+        return 1;
+    }
+
+    if (compress || benchmark) {
+        ret = (compress ? compress_file(fp, level) :
+               benchmark_file(fp, level, packetlen));
+        if (filename)
+            fclose(fp);
+        return ret;
+    }
+
     handle = ssh_decompressor_new(&ssh_zlib);
 
     if (noheader) {
@@ -78,17 +228,6 @@ int main(int argc, char **argv)
         assert(outlen == 0);
     }
 
-    if (filename)
-        fp = fopen(filename, "rb");
-    else
-        fp = stdin;
-
-    if (!fp) {
-        assert(filename);
-        fprintf(stderr, "unable to open '%s'\n", filename);
-        return 1;
-    }
-
     while (1) {
         ret = fread(buf, 1, sizeof(buf), fp);
         if (ret <= 0)
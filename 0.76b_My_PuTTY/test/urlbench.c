@@ -0,0 +1,189 @@
+/*
+ * urlbench.c: time hyperlink detection the way do_paint drives it.
+ *
+ * Reads a transcript (anything a host might send: a session log, the
+ * output of a build, 'ls -lR') on standard input and scrolls it
+ * through a simulated screen, a few lines per repaint. Each repaint
+ * hands every row to urlhack and asks it to find the links, and then
+ * hit-tests a spread of mouse positions, as WM_MOUSEMOVE does.
+ *
+ * The transcript is run through twice, once only handing over the
+ * rows, and the difference is reported as the cost of detection. (The
+ * clock is too coarse on Windows to time each repaint by itself.)
+ *
+ * Usage: urlbench [-r rows] [-c cols] [-s lines-per-repaint] [-j]
+ *                 < transcript
+ *
+ * -j joins all the rows into one segment, as terminal.c did before it
+ * told urlhack where lines wrap, which also defeats most of the
+ * per-segment caching.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "putty.h"
+#include "urlhack.h"
+
+/* Things urlhack.c expects from the rest of KiTTY */
+int debug_flag = 0;
+void debug_logevent(const char *fmt, ...) {}
+void logevent(LogContext *logctx, const char *event) {}
+void InitRegistryAllSessions(HKEY hMainKey, LPCTSTR lpSubKey,
+                             char *SubKeyName, char *filename, char *text) {}
+
+struct screen {
+    int rows, cols;
+    char *text;                        /* rows * cols, a ring of rows */
+    unsigned char *wrapped;
+    int top;                           /* ring index of the top row */
+};
+
+static void screen_scroll(struct screen *s, const char *line, int len,
+                          int wrapped)
+{
+    char *row = s->text + s->top * s->cols;
+    int i;
+
+    for (i = 0; i < s->cols; i++) {
+        unsigned char c = (i < len ? (unsigned char)line[i] : ' ');
+        row[i] = (c < ' ' || c == 0x7F ? ' ' : (char)c);
+    }
+    s->wrapped[s->top] = wrapped;
+    s->top = (s->top + 1) % s->rows;
+}
+
+static long repaint(struct screen *s, bool join, bool detect, long *hits)
+{
+    int i, j, x, y;
+
+    urlhack_reset();
+    for (i = 0; i < s->rows; i++) {
+        int r = (s->top + i) % s->rows;
+        for (j = 0; j < s->cols; j++)
+            urlhack_putchar(s->text[r * s->cols + j]);
+        if (!join)
+            urlhack_newline(s->wrapped[r]);
+    }
+    if (!detect)
+        return 0;
+    urlhack_go_find_me_some_hyperlinks(s->cols);
+
+    for (y = 0; y < s->rows; y++)
+        for (x = 0; x < s->cols; x += 7)
+            if (urlhack_is_in_link_region(x, y))
+                (*hits)++;
+
+    for (i = 0; urlhack_get_link_region(i).x0 >= 0; i++);
+    return i;
+}
+
+/*
+ * Scroll the whole transcript through the screen, returning the CPU
+ * time taken.
+ */
+static double run(struct screen *s, const char *data, size_t len, int step,
+                  bool join, bool detect, long *repaints, long *links,
+                  long *hits)
+{
+    size_t pos = 0;
+    int pending = 0;
+    clock_t start;
+
+    memset(s->text, ' ', s->rows * s->cols);
+    memset(s->wrapped, 0, s->rows);
+    s->top = 0;
+    *repaints = *links = *hits = 0;
+
+    start = clock();
+    while (pos < len) {
+        const char *line = data + pos, *end = memchr(line, '\n', len - pos);
+        int linelen, i;
+
+        if (!end)
+            end = data + len;
+        pos = end - data + 1;
+        linelen = end - line;
+        if (linelen > 0 && line[linelen - 1] == '\r')
+            linelen--;
+
+        /* Long lines wrap onto several rows, as the terminal would */
+        for (i = 0; i + s->cols < linelen; i += s->cols)
+            screen_scroll(s, line + i, s->cols, 1);
+        screen_scroll(s, line + i, linelen - i, 0);
+
+        if (++pending >= step) {
+            *links += repaint(s, join, detect, hits);
+            (*repaints)++;
+            pending = 0;
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+    struct screen s;
+    int step = 3, i;
+    bool join = false;
+    long repaints, links, hits;
+    char *data = NULL;
+    size_t datasize = 0, datalen = 0;
+    double base, total;
+    int c;
+
+    s.rows = 24;
+    s.cols = 80;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i+1 < argc)
+            s.rows = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && i+1 < argc)
+            s.cols = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+1 < argc)
+            step = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-j"))
+            join = true;
+        else {
+            fprintf(stderr, "usage: urlbench [-r rows] [-c cols] "
+                    "[-s lines-per-repaint] [-j] < transcript\n");
+            return 1;
+        }
+    }
+    if (s.rows < 1 || s.cols < 1 || step < 1) {
+        fprintf(stderr, "urlbench: bad screen size or step\n");
+        return 1;
+    }
+
+    while ((c = getchar()) != EOF) {
+        sgrowarray(data, datasize, datalen);
+        data[datalen++] = c;
+    }
+
+    s.text = snewn(s.rows * s.cols, char);
+    s.wrapped = snewn(s.rows, unsigned char);
+
+    urlhack_init();
+    urlhack_set_regular_expression(URLHACK_REGEX_CLASSIC,
+                                   urlhack_default_regex);
+
+    base = run(&s, data, datalen, step, join, false,
+               &repaints, &links, &hits);
+    total = run(&s, data, datalen, step, join, true,
+                &repaints, &links, &hits);
+
+    printf("%dx%d screen, %d lines per repaint%s\n", s.cols, s.rows, step,
+           join ? ", rows joined" : "");
+    printf("%ld repaints, %ld links, %ld hit-test hits\n",
+           repaints, links, hits);
+    if (repaints)
+        printf("%.3f s in detection, %.1f us per repaint\n",
+               total - base, (total - base) * 1e6 / repaints);
+
+    urlhack_cleanup();
+    sfree(s.text);
+    sfree(s.wrapped);
+    sfree(data);
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * wcbench.c: check and time the character width lookups in
+ * utils/wcwidth.c.
+ *
+ * wcwidth.c is included here, rather than linked, so that the lookup
+ * table behind mk_wcwidth() and mk_wcwidth_cjk() can be compared with
+ * the binary searches through the interval tables it was built from.
+ * First every code point (and a few past the end of Unicode) is
+ * checked to have the same width both ways, in both variants, and
+ * mk_wcswidth() is checked against adding up the widths one by one.
+ *
+ * Then each of these kinds of text is measured, both ways, over a
+ * string long enough to make clock() worth reading:
+ *
+ *   - ASCII, as in most of what a terminal ever shows
+ *   - CJK, mostly Han and kana with ASCII and punctuation
+ *   - emoji, with variation selectors, skin tones and ZWJ sequences
+ *   - combining, Latin and Cyrillic with stacked accents
+ *
+ * Usage: wcbench [-n chars] [-r rounds]
+ *
+ * From the top of the source tree:
+ *
+ *   gcc -O2 -ffunction-sections -fdata-sections -I. -Icharset -Iunix \
+ *       -Iutils -o wcbench test/wcbench.c utils/memory.c utils/utils.c \
+ *       -Wl,--gc-sections utils/utils.c utils/marshal.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/wcwidth.c"
+
+void out_of_memory(void) { fprintf(stderr, "out of memory\n"); exit(1); }
+
+static int check(void)
+{
+    unsigned int buf[64], c;
+    int errors = 0, i, w, wc, sum, sumcjk;
+
+    for (c = 0; c < 0x110100; c++) {
+        w = mk_wcwidth(c);
+        wc = mk_wcwidth_cjk(c);
+        if (w != wcwidth_search(c) || wc != wcwidth_cjk_search(c)) {
+            if (errors++ < 10)
+                fprintf(stderr, "U+%04X: width %d/%d, should be %d/%d\n",
+                        c, w, wc, wcwidth_search(c), wcwidth_cjk_search(c));
+        }
+    }
+
+    /* strings of everything, a run of 64 code points at a time */
+    for (c = 0; c < 0x110000; c += lenof(buf)) {
+        sum = sumcjk = 0;
+        for (i = 0; i < lenof(buf); i++) {
+            buf[i] = c + i;
+            if (sum >= 0)
+                sum = (w = wcwidth_search(c + i)) < 0 ? -1 : sum + w;
+            if (sumcjk >= 0)
+                sumcjk = (w = wcwidth_cjk_search(c + i)) < 0 ? -1 :
+                    sumcjk + w;
+        }
+        if (c == 0)
+            sum = sumcjk = 0;          /* stops at the NUL */
+        if (mk_wcswidth(buf, lenof(buf)) != sum ||
+            mk_wcswidth_cjk(buf, lenof(buf)) != sumcjk) {
+            if (errors++ < 10)
+                fprintf(stderr, "U+%04X...: string width %d/%d, "
+                        "should be %d/%d\n", c, mk_wcswidth(buf, lenof(buf)),
+                        mk_wcswidth_cjk(buf, lenof(buf)), sum, sumcjk);
+        }
+    }
+
+    /* ASCII runs broken at every offset by a control or a wide char */
+    for (i = 0; i < lenof(buf); i++) {
+        int j;
+        for (j = 0; j < lenof(buf); j++)
+            buf[j] = 'a' + j % 26;
+        buf[i] = 0x3042;
+        if (mk_wcswidth(buf, lenof(buf)) != lenof(buf) + 1 ||
+            mk_wcswidth(buf, i) != i) {
+            if (errors++ < 10)
+                fprintf(stderr, "wide char at %d: wrong width\n", i);
+        }
+        buf[i] = 0x1B;
+        if (mk_wcswidth(buf, lenof(buf)) != -1 ||
+            mk_wcswidth(buf, i + 1) != -1 || mk_wcswidth(buf, i) != i) {
+            if (errors++ < 10)
+                fprintf(stderr, "control char at %d: wrong width\n", i);
+        }
+    }
+
+    return errors;
+}
+
+static const unsigned int sample_ascii[] = {
+    'l','s',' ','-','l',' ','/','u','s','r','/','s','h','a','r','e',
+    '/','d','o','c',' ','|',' ','g','r','e','p',' ','-','i',' ','x',
+};
+static const unsigned int sample_cjk[] = {
+    0x65E5, 0x672C, 0x8A9E, 0x306E, 0x30C6, 0x30AD, 0x30B9, 0x30C8,
+    0x3002, 0x4E2D, 0x6587, 0xFF08, 'U', 'T', 'F', '-', '8', 0xFF09,
+    0xD55C, 0xAD6D, 0xC5B4, ' ', 0x300C, 0x6F22, 0x5B57, 0x300D,
+    0x00B7, 0x2026, 0x25CB, 0x2192, ' ', '4', '2',
+};
+static const unsigned int sample_emoji[] = {
+    0x1F600, ' ', 0x1F44D, 0x1F3FD, ' ', 0x2764, 0xFE0F, ' ',
+    0x1F468, 0x200D, 0x1F469, 0x200D, 0x1F467, ' ', 0x1F1EF, 0x1F1F5,
+    ' ', 0x1F680, 0x2728, 0x1F525, ' ', 'o', 'k', ' ', 0x1F9D1,
+    0x1F3FB, 0x200D, 0x1F4BB, ' ', 0x263A, 0xFE0F, 0x2705,
+};
+static const unsigned int sample_combining[] = {
+    'a', 0x0301, 'e', 0x0300, 0x0323, 'o', 0x0302, 0x0303, ' ',
+    0x0417, 0x0306, 0x0430, 0x0301, ' ', 'n', 0x0303, 'u', 0x0308,
+    ' ', 0x1EA0, 0x0306, 'Z', 0x0337, 0x0336, 0x035C, ' ', 0x05D0,
+    0x05B8, 0x0E01, 0x0E34, 0x0E48,
+};
+
+static double timeit(const unsigned int *text, size_t n, int rounds,
+                     bool table, bool string, long *total)
+{
+    clock_t start = clock();
+    int r;
+    size_t i;
+    long sum = 0;
+
+    for (r = 0; r < rounds; r++) {
+        if (table && string) {
+            sum += mk_wcswidth(text, n) + mk_wcswidth_cjk(text, n);
+        } else {
+            for (i = 0; i < n; i++) {
+                if (table)
+                    sum += mk_wcwidth(text[i]) + mk_wcwidth_cjk(text[i]);
+                else
+                    sum += wcwidth_search(text[i]) +
+                        wcwidth_cjk_search(text[i]);
+            }
+        }
+    }
+
+    *total += sum;
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench(const char *name, const unsigned int *sample,
+                  size_t samplelen, size_t n, int rounds)
+{
+    unsigned int *text = snewn(n, unsigned int);
+    double search, table, string, per = 1e9 / ((double)n * rounds * 2);
+    long total = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        text[i] = sample[i % samplelen];
+
+    search = timeit(text, n, rounds, false, false, &total);
+    table = timeit(text, n, rounds, true, false, &total);
+    string = timeit(text, n, rounds, true, true, &total);
+    printf("%-10s search %6.2f  table %6.2f  wcswidth %6.2f  ns/char"
+           "  (%ld)\n", name, search * per, table * per, string * per,
+           total);
+
+    sfree(text);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = 1 << 16;
+    int rounds = 200, errors, i;
+    clock_t start;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            n = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: wcbench [-n chars] [-r rounds]\n");
+            return 1;
+        }
+    }
+    if (n < 1 || rounds < 1) {
+        fprintf(stderr, "wcbench: bad length or rounds\n");
+        return 1;
+    }
+
+    start = clock();
+    mk_wcwidth(0x100);
+    printf("table built in %.2f ms\n",
+           (double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+    if ((errors = check()) != 0) {
+        fprintf(stderr, "%d mismatches\n", errors);
+        return 1;
+    }
+    printf("all code points match\n");
+
+#define BENCH(name) bench(#name, sample_##name, lenof(sample_##name), \
+                          n, rounds)
+    BENCH(ascii);
+    BENCH(cjk);
+    BENCH(emoji);
+    BENCH(combining);
+#undef BENCH
+
+    return 0;
+}
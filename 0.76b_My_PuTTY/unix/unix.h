@@ -457,4 +457,12 @@ bool cliloop_no_pw_setup(void *ctx, pollwrapper *pw);
 void cliloop_no_pw_check(void *ctx, pollwrapper *pw);
 bool cliloop_always_continue(void *ctx, bool, bool);
 
+/* Atomic counters for the worker threads declared in putty.h */
+typedef long atomic_counter;
+#define atomic_counter_inc(p) __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST)
+#define atomic_counter_dec(p) __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST)
+#define atomic_counter_load(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define atomic_counter_cas(p, old, new) __atomic_compare_exchange_n( \
+        p, &(long){old}, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
 #endif /* PUTTY_UNIX_H */
@@ -0,0 +1,80 @@
+/*
+ * Worker threads, semaphores and the processor count, as declared in
+ * putty.h, on top of POSIX threads.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "putty.h"
+
+struct WorkerThread {
+    pthread_t thread;
+    void (*fn)(void *ctx);
+    void *ctx;
+};
+
+struct Semaphore {
+    sem_t sem;
+};
+
+static void *worker_thread_main(void *param)
+{
+    WorkerThread *wt = (WorkerThread *)param;
+    wt->fn(wt->ctx);
+    return NULL;
+}
+
+WorkerThread *worker_thread_start(void (*fn)(void *ctx), void *ctx)
+{
+    WorkerThread *wt = snew(WorkerThread);
+
+    wt->fn = fn;
+    wt->ctx = ctx;
+    if (pthread_create(&wt->thread, NULL, worker_thread_main, wt) != 0) {
+        sfree(wt);
+        return NULL;
+    }
+    return wt;
+}
+
+void worker_thread_join(WorkerThread *wt)
+{
+    pthread_join(wt->thread, NULL);
+    sfree(wt);
+}
+
+Semaphore *semaphore_new(void)
+{
+    Semaphore *sem = snew(Semaphore);
+    if (sem_init(&sem->sem, 0, 0) != 0) {
+        sfree(sem);
+        return NULL;
+    }
+    return sem;
+}
+
+void semaphore_free(Semaphore *sem)
+{
+    sem_destroy(&sem->sem);
+    sfree(sem);
+}
+
+void semaphore_post(Semaphore *sem, unsigned n)
+{
+    while (n-- > 0)
+        sem_post(&sem->sem);
+}
+
+void semaphore_wait(Semaphore *sem)
+{
+    while (sem_wait(&sem->sem) != 0)
+        ;                              /* EINTR */
+}
+
+unsigned ncpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <string.h>
 #include <assert.h>
 
 #include "tree234.h"
@@ -66,7 +67,17 @@ struct conf_entry {
     struct value value;
 };
 
+/*
+ * Options without a subkey, which are nearly all of them and include
+ * the ones read over and over again by the terminal and the front
+ * end, are kept in an array indexed by primary key, so that reading
+ * one is a single load. 'present' says which of them have been set
+ * (a Conf starts off empty, like the tree). Only the entries with
+ * subkeys go in the tree.
+ */
 struct conf_tag {
+    struct value values[N_CONFIG_OPTIONS];
+    bool present[N_CONFIG_OPTIONS];
     tree234 *tree;
 };
 
@@ -206,6 +217,7 @@ Conf *conf_new(void)
 {
     Conf *conf = snew(struct conf_tag);
 
+    memset(conf->present, 0, sizeof(conf->present));
     conf->tree = newtree234(conf_cmp);
 
     return conf;
@@ -214,6 +226,13 @@ Conf *conf_new(void)
 static void conf_clear(Conf *conf)
 {
     struct conf_entry *entry;
+    int i;
+
+    for (i = 0; i < N_CONFIG_OPTIONS; i++)
+        if (conf->present[i]) {
+            free_value(&conf->values[i], valuetypes[i]);
+            conf->present[i] = false;
+        }
 
     while ((entry = delpos234(conf->tree, 0)) != NULL)
 	free_entry(entry);
@@ -226,6 +245,29 @@ void conf_free(Conf *conf)
     sfree(conf);
 }
 
+/*
+ * Store a value for an option without a subkey, taking ownership of
+ * its dynamic data. The old value is freed only after the new one has
+ * been made, since the caller may have made the new one from it.
+ */
+static void conf_store(Conf *conf, int primary, struct value *value)
+{
+    if (conf->present[primary])
+	free_value(&conf->values[primary], valuetypes[primary]);
+    conf->values[primary] = *value;
+    conf->present[primary] = true;
+}
+
+/*
+ * Return the value of an option without a subkey, which must be set.
+ */
+static inline struct value *conf_value(Conf *conf, int primary)
+{
+    assert(subkeytypes[primary] == TYPE_NONE);
+    assert(conf->present[primary]);
+    return &conf->values[primary];
+}
+
 static void conf_insert(Conf *conf, struct conf_entry *entry)
 {
     struct conf_entry *oldentry = add234(conf->tree, entry);
@@ -244,6 +286,17 @@ void conf_copy_into(Conf *newconf, Conf *oldconf)
 
     conf_clear(newconf);
 
+    /*
+     * Copy the whole array in one go, and then go back and make new
+     * copies of the values that point to dynamic data.
+     */
+    memcpy(newconf->values, oldconf->values, sizeof(newconf->values));
+    memcpy(newconf->present, oldconf->present, sizeof(newconf->present));
+    for (i = 0; i < N_CONFIG_OPTIONS; i++)
+	if (newconf->present[i] && valuetypes[i] >= TYPE_STR)
+	    copy_value(&newconf->values[i], &oldconf->values[i],
+		       valuetypes[i]);
+
     for (i = 0; (entry = index234(oldconf->tree, i)) != NULL; i++) {
 	entry2 = snew(struct conf_entry);
 	copy_key(&entry2->key, &entry->key);
@@ -264,8 +317,6 @@ Conf *conf_copy(Conf *oldconf)
 
 bool conf_get_bool(Conf *conf, int primary)
 {
-    struct key key;
-    struct conf_entry *entry;
 #ifdef MOD_PERSO
 	if( valuetypes[primary] == TYPE_INT ) {
 		int i = conf_get_int( conf, primary ) ;
@@ -273,29 +324,19 @@ bool conf_get_bool(Conf *conf, int primary)
 		return true ;
 	}
 #endif
-    assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_BOOL);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
-    assert(entry);
-    return entry->value.u.boolval;
+    return conf_value(conf, primary)->u.boolval;
 }
 
 int conf_get_int(Conf *conf, int primary)
 {
-    struct key key;
-    struct conf_entry *entry;
 #ifdef MOD_PERSO
 	if( valuetypes[primary] == TYPE_BOOL ) {
 		return (conf_get_bool( conf, primary ) ? 1 : 0) ;
 	}
 #endif
-    assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_INT);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
-    assert(entry);
-    return entry->value.u.intval;
+    return conf_value(conf, primary)->u.intval;
 }
 
 int conf_get_int_int(Conf *conf, int primary, int secondary)
@@ -314,15 +355,8 @@ int conf_get_int_int(Conf *conf, int primary, int secondary)
 
 char *conf_get_str(Conf *conf, int primary)
 {
-    struct key key;
-    struct conf_entry *entry;
-
-    assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_STR);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
-    assert(entry);
-    return entry->value.u.stringval;
+    return conf_value(conf, primary)->u.stringval;
 }
 
 char *conf_get_str_str_opt(Conf *conf, int primary, const char *secondary)
@@ -389,33 +423,19 @@ char *conf_get_str_nthstrkey(Conf *conf, int primary, int n)
 
 Filename *conf_get_filename(Conf *conf, int primary)
 {
-    struct key key;
-    struct conf_entry *entry;
-
-    assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FILENAME);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
-    assert(entry);
-    return entry->value.u.fileval;
+    return conf_value(conf, primary)->u.fileval;
 }
 
 FontSpec *conf_get_fontspec(Conf *conf, int primary)
 {
-    struct key key;
-    struct conf_entry *entry;
-
-    assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FONT);
-    key.primary = primary;
-    entry = find234(conf->tree, &key, NULL);
-    assert(entry);
-    return entry->value.u.fontval;
+    return conf_value(conf, primary)->u.fontval;
 }
 
 void conf_set_bool(Conf *conf, int primary, bool value)
 {
-    struct conf_entry *entry = snew(struct conf_entry);
+    struct value val;
 #ifdef MOD_PERSO
 	if( valuetypes[primary] == TYPE_INT ) {
 		conf_set_int( conf, primary, (value?1:0) );
@@ -424,14 +444,13 @@ void conf_set_bool(Conf *conf, int primary, bool value)
 #endif
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_BOOL);
-    entry->key.primary = primary;
-    entry->value.u.boolval = value;
-    conf_insert(conf, entry);
+    val.u.boolval = value;
+    conf_store(conf, primary, &val);
 }
 
 void conf_set_int(Conf *conf, int primary, int value)
 {
-    struct conf_entry *entry = snew(struct conf_entry);
+    struct value val;
 #ifdef MOD_PERSO
 	if( valuetypes[primary] == TYPE_BOOL ) {
 		conf_set_bool( conf, primary, (value==0?false:true) );
@@ -441,9 +460,8 @@ void conf_set_int(Conf *conf, int primary, int value)
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_INT);
-    entry->key.primary = primary;
-    entry->value.u.intval = value;
-    conf_insert(conf, entry);
+    val.u.intval = value;
+    conf_store(conf, primary, &val);
 }
 
 void conf_set_int_int(Conf *conf, int primary,
@@ -461,13 +479,12 @@ void conf_set_int_int(Conf *conf, int primary,
 
 void conf_set_str(Conf *conf, int primary, const char *value)
 {
-    struct conf_entry *entry = snew(struct conf_entry);
+    struct value val;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_STR);
-    entry->key.primary = primary;
-    entry->value.u.stringval = dupstr(value);
-    conf_insert(conf, entry);
+    val.u.stringval = dupstr(value);
+    conf_store(conf, primary, &val);
 }
 
 void conf_set_str_str(Conf *conf, int primary, const char *secondary,
@@ -501,58 +518,76 @@ void conf_del_str_str(Conf *conf, int primary, const char *secondary)
 
 void conf_set_filename(Conf *conf, int primary, const Filename *value)
 {
-    struct conf_entry *entry = snew(struct conf_entry);
+    struct value val;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FILENAME);
-    entry->key.primary = primary;
-    entry->value.u.fileval = filename_copy(value);
-    conf_insert(conf, entry);
+    val.u.fileval = filename_copy(value);
+    conf_store(conf, primary, &val);
 }
 
 void conf_set_fontspec(Conf *conf, int primary, const FontSpec *value)
 {
-    struct conf_entry *entry = snew(struct conf_entry);
+    struct value val;
 
     assert(subkeytypes[primary] == TYPE_NONE);
     assert(valuetypes[primary] == TYPE_FONT);
-    entry->key.primary = primary;
-    entry->value.u.fontval = fontspec_copy(value);
-    conf_insert(conf, entry);
+    val.u.fontval = fontspec_copy(value);
+    conf_store(conf, primary, &val);
+}
+
+static void serialise_value(BinarySink *bs, struct value *value, int type)
+{
+    switch (type) {
+      case TYPE_BOOL:
+	put_bool(bs, value->u.boolval);
+	break;
+      case TYPE_INT:
+	put_uint32(bs, value->u.intval);
+	break;
+      case TYPE_STR:
+	put_asciz(bs, value->u.stringval);
+	break;
+      case TYPE_FILENAME:
+        filename_serialise(bs, value->u.fileval);
+	break;
+      case TYPE_FONT:
+        fontspec_serialise(bs, value->u.fontval);
+	break;
+    }
 }
 
 void conf_serialise(BinarySink *bs, Conf *conf)
 {
-    int i;
+    int i, primary;
     struct conf_entry *entry;
 
-    for (i = 0; (entry = index234(conf->tree, i)) != NULL; i++) {
-	put_uint32(bs, entry->key.primary);
-
-	switch (subkeytypes[entry->key.primary]) {
-	  case TYPE_INT:
-	    put_uint32(bs, entry->key.secondary.i);
-	    break;
-	  case TYPE_STR:
-            put_asciz(bs, entry->key.secondary.s);
-	    break;
+    /*
+     * Write everything out in order of primary key, as it used to be
+     * when it was all in the tree: the entries in the tree are in
+     * that order already, so they just have to be merged in.
+     */
+    i = 0;
+    entry = index234(conf->tree, i);
+    for (primary = 0; primary < N_CONFIG_OPTIONS; primary++) {
+	if (conf->present[primary]) {
+	    put_uint32(bs, primary);
+	    serialise_value(bs, &conf->values[primary], valuetypes[primary]);
 	}
-	switch (valuetypes[entry->key.primary]) {
-	  case TYPE_BOOL:
-	    put_bool(bs, entry->value.u.boolval);
-	    break;
-	  case TYPE_INT:
-	    put_uint32(bs, entry->value.u.intval);
-	    break;
-	  case TYPE_STR:
-	    put_asciz(bs, entry->value.u.stringval);
-	    break;
-	  case TYPE_FILENAME:
-            filename_serialise(bs, entry->value.u.fileval);
-	    break;
-	  case TYPE_FONT:
-            fontspec_serialise(bs, entry->value.u.fontval);
-	    break;
+
+	for (; entry && entry->key.primary == primary;
+	     entry = index234(conf->tree, ++i)) {
+	    put_uint32(bs, entry->key.primary);
+
+	    switch (subkeytypes[entry->key.primary]) {
+	      case TYPE_INT:
+		put_uint32(bs, entry->key.secondary.i);
+		break;
+	      case TYPE_STR:
+		put_asciz(bs, entry->key.secondary.s);
+		break;
+	    }
+	    serialise_value(bs, &entry->value, valuetypes[entry->key.primary]);
 	}
     }
 
@@ -609,6 +644,11 @@ bool conf_deserialise(Conf *conf, BinarySource *src)
             return false;
         }
 
-	conf_insert(conf, entry);
+	if (subkeytypes[primary] == TYPE_NONE) {
+	    conf_store(conf, primary, &entry->value);
+	    sfree(entry);
+	} else {
+	    conf_insert(conf, entry);
+	}
     }
 }
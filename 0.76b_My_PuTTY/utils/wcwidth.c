@@ -60,6 +60,10 @@
  */
 
 #include <wchar.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "putty.h" /* for prototypes */
 
@@ -88,8 +92,372 @@ static bool bisearch(unsigned int ucs, const struct interval *table, int max) {
   return false;
 }
 
+/* sorted list of non-overlapping intervals of non-spacing characters */
+/* generated by "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c" */
+static const struct interval combining[] = {
+  { 0x0300, 0x036F }, { 0x0483, 0x0486 }, { 0x0488, 0x0489 },
+  { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
+  { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0600, 0x0603 },
+  { 0x0610, 0x0615 }, { 0x064B, 0x065E }, { 0x0670, 0x0670 },
+  { 0x06D6, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED },
+  { 0x070F, 0x070F }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
+  { 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 }, { 0x0901, 0x0902 },
+  { 0x093C, 0x093C }, { 0x0941, 0x0948 }, { 0x094D, 0x094D },
+  { 0x0951, 0x0954 }, { 0x0962, 0x0963 }, { 0x0981, 0x0981 },
+  { 0x09BC, 0x09BC }, { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD },
+  { 0x09E2, 0x09E3 }, { 0x0A01, 0x0A02 }, { 0x0A3C, 0x0A3C },
+  { 0x0A41, 0x0A42 }, { 0x0A47, 0x0A48 }, { 0x0A4B, 0x0A4D },
+  { 0x0A70, 0x0A71 }, { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC },
+  { 0x0AC1, 0x0AC5 }, { 0x0AC7, 0x0AC8 }, { 0x0ACD, 0x0ACD },
+  { 0x0AE2, 0x0AE3 }, { 0x0B01, 0x0B01 }, { 0x0B3C, 0x0B3C },
+  { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B43 }, { 0x0B4D, 0x0B4D },
+  { 0x0B56, 0x0B56 }, { 0x0B82, 0x0B82 }, { 0x0BC0, 0x0BC0 },
+  { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C48 },
+  { 0x0C4A, 0x0C4D }, { 0x0C55, 0x0C56 }, { 0x0CBC, 0x0CBC },
+  { 0x0CBF, 0x0CBF }, { 0x0CC6, 0x0CC6 }, { 0x0CCC, 0x0CCD },
+  { 0x0CE2, 0x0CE3 }, { 0x0D41, 0x0D43 }, { 0x0D4D, 0x0D4D },
+  { 0x0DCA, 0x0DCA }, { 0x0DD2, 0x0DD4 }, { 0x0DD6, 0x0DD6 },
+  { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
+  { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EB9 }, { 0x0EBB, 0x0EBC },
+  { 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 },
+  { 0x0F37, 0x0F37 }, { 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E },
+  { 0x0F80, 0x0F84 }, { 0x0F86, 0x0F87 }, { 0x0F90, 0x0F97 },
+  { 0x0F99, 0x0FBC }, { 0x0FC6, 0x0FC6 }, { 0x102D, 0x1030 },
+  { 0x1032, 0x1032 }, { 0x1036, 0x1037 }, { 0x1039, 0x1039 },
+  { 0x1058, 0x1059 }, { 0x1160, 0x11FF }, { 0x135F, 0x135F },
+  { 0x1712, 0x1714 }, { 0x1732, 0x1734 }, { 0x1752, 0x1753 },
+  { 0x1772, 0x1773 }, { 0x17B4, 0x17B5 }, { 0x17B7, 0x17BD },
+  { 0x17C6, 0x17C6 }, { 0x17C9, 0x17D3 }, { 0x17DD, 0x17DD },
+  { 0x180B, 0x180D }, { 0x18A9, 0x18A9 }, { 0x1920, 0x1922 },
+  { 0x1927, 0x1928 }, { 0x1932, 0x1932 }, { 0x1939, 0x193B },
+  { 0x1A17, 0x1A18 }, { 0x1B00, 0x1B03 }, { 0x1B34, 0x1B34 },
+  { 0x1B36, 0x1B3A }, { 0x1B3C, 0x1B3C }, { 0x1B42, 0x1B42 },
+  { 0x1B6B, 0x1B73 }, { 0x1DC0, 0x1DCA }, { 0x1DFE, 0x1DFF },
+  { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2063 },
+  { 0x206A, 0x206F }, { 0x20D0, 0x20EF }, { 0x302A, 0x302F },
+  { 0x3099, 0x309A }, { 0xA806, 0xA806 }, { 0xA80B, 0xA80B },
+  { 0xA825, 0xA826 }, { 0xFB1E, 0xFB1E }, { 0xFE00, 0xFE0F },
+  { 0xFE20, 0xFE23 }, { 0xFEFF, 0xFEFF }, { 0xFFF9, 0xFFFB },
+  { 0x10A01, 0x10A03 }, { 0x10A05, 0x10A06 }, { 0x10A0C, 0x10A0F },
+  { 0x10A38, 0x10A3A }, { 0x10A3F, 0x10A3F }, { 0x1D167, 0x1D169 },
+  { 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD },
+  { 0x1D242, 0x1D244 }, { 0xE0001, 0xE0001 }, { 0xE0020, 0xE007F },
+  { 0xE0100, 0xE01EF }
+};
+
+/* A sorted list of intervals of double-width characters generated by:
+ * https://raw.githubusercontent.com/GNOME/glib/37d4c2941bd0326b8b6e6bb22c81bd424fcc040b/glib/gen-unicode-tables.pl
+ * from the Unicode 9.0.0 data files available at:
+ * https://www.unicode.org/Public/13.0.0/ucd/
+ */
+static const struct interval wide[] = {
+  {0x1100, 0x115F},
+  {0x231A, 0x231B},
+  {0x2329, 0x232A},
+  {0x23E9, 0x23EC},
+  {0x23F0, 0x23F0},
+  {0x23F3, 0x23F3},
+  {0x25FD, 0x25FE},
+  {0x2614, 0x2615},
+  {0x2648, 0x2653},
+  {0x267F, 0x267F},
+  {0x2693, 0x2693},
+  {0x26A1, 0x26A1},
+  {0x26AA, 0x26AB},
+  {0x26BD, 0x26BE},
+  {0x26C4, 0x26C5},
+  {0x26CE, 0x26CE},
+  {0x26D4, 0x26D4},
+  {0x26EA, 0x26EA},
+  {0x26F2, 0x26F3},
+  {0x26F5, 0x26F5},
+  {0x26FA, 0x26FA},
+  {0x26FD, 0x26FD},
+  {0x2705, 0x2705},
+  {0x270A, 0x270B},
+  {0x2728, 0x2728},
+  {0x274C, 0x274C},
+  {0x274E, 0x274E},
+  {0x2753, 0x2755},
+  {0x2757, 0x2757},
+  {0x2795, 0x2797},
+  {0x27B0, 0x27B0},
+  {0x27BF, 0x27BF},
+  {0x2B1B, 0x2B1C},
+  {0x2B50, 0x2B50},
+  {0x2B55, 0x2B55},
+  {0x2E80, 0x2E99},
+  {0x2E9B, 0x2EF3},
+  {0x2F00, 0x2FD5},
+  {0x2FF0, 0x2FFB},
+  {0x3000, 0x303E},
+  {0x3041, 0x3096},
+  {0x3099, 0x30FF},
+  {0x3105, 0x312F},
+  {0x3131, 0x318E},
+  {0x3190, 0x31E3},
+  {0x31F0, 0x321E},
+  {0x3220, 0x3247},
+  {0x3250, 0x4DBF},
+  {0x4E00, 0xA48C},
+  {0xA490, 0xA4C6},
+  {0xA960, 0xA97C},
+  {0xAC00, 0xD7A3},
+  {0xF900, 0xFAFF},
+  {0xFE10, 0xFE19},
+  {0xFE30, 0xFE52},
+  {0xFE54, 0xFE66},
+  {0xFE68, 0xFE6B},
+  {0xFF01, 0xFF60},
+  {0xFFE0, 0xFFE6},
+  {0x16FE0, 0x16FE4},
+  {0x16FF0, 0x16FF1},
+  {0x17000, 0x187F7},
+  {0x18800, 0x18CD5},
+  {0x18D00, 0x18D08},
+  {0x1B000, 0x1B11E},
+  {0x1B150, 0x1B152},
+  {0x1B164, 0x1B167},
+  {0x1B170, 0x1B2FB},
+  {0x1F004, 0x1F004},
+  {0x1F0CF, 0x1F0CF},
+  {0x1F18E, 0x1F18E},
+  {0x1F191, 0x1F19A},
+  {0x1F200, 0x1F202},
+  {0x1F210, 0x1F23B},
+  {0x1F240, 0x1F248},
+  {0x1F250, 0x1F251},
+  {0x1F260, 0x1F265},
+  {0x1F300, 0x1F320},
+  {0x1F32D, 0x1F335},
+  {0x1F337, 0x1F37C},
+  {0x1F37E, 0x1F393},
+  {0x1F3A0, 0x1F3CA},
+  {0x1F3CF, 0x1F3D3},
+  {0x1F3E0, 0x1F3F0},
+  {0x1F3F4, 0x1F3F4},
+  {0x1F3F8, 0x1F43E},
+  {0x1F440, 0x1F440},
+  {0x1F442, 0x1F4FC},
+  {0x1F4FF, 0x1F53D},
+  {0x1F54B, 0x1F54E},
+  {0x1F550, 0x1F567},
+  {0x1F57A, 0x1F57A},
+  {0x1F595, 0x1F596},
+  {0x1F5A4, 0x1F5A4},
+  {0x1F5FB, 0x1F64F},
+  {0x1F680, 0x1F6C5},
+  {0x1F6CC, 0x1F6CC},
+  {0x1F6D0, 0x1F6D2},
+  {0x1F6D5, 0x1F6D7},
+  {0x1F6EB, 0x1F6EC},
+  {0x1F6F4, 0x1F6FC},
+  {0x1F7E0, 0x1F7EB},
+  {0x1F90C, 0x1F93A},
+  {0x1F93C, 0x1F945},
+  {0x1F947, 0x1F978},
+  {0x1F97A, 0x1F9CB},
+  {0x1F9CD, 0x1F9FF},
+  {0x1FA70, 0x1FA74},
+  {0x1FA78, 0x1FA7A},
+  {0x1FA80, 0x1FA86},
+  {0x1FA90, 0x1FAA8},
+  {0x1FAB0, 0x1FAB6},
+  {0x1FAC0, 0x1FAC2},
+  {0x1FAD0, 0x1FAD6},
+  {0x20000, 0x2FFFD},
+  {0x30000, 0x3FFFD},
+};
+
+/* A sorted list of intervals of ambiguous width characters generated by:
+ * https://raw.githubusercontent.com/GNOME/glib/37d4c2941bd0326b8b6e6bb22c81bd424fcc040b/glib/gen-unicode-tables.pl
+ * from the Unicode 9.0.0 data files available at:
+ * http://www.unicode.org/Public/9.0.0/ucd/
+ */
+static const struct interval ambiguous[] = {
+  {0x00A1, 0x00A1},
+  {0x00A4, 0x00A4},
+  {0x00A7, 0x00A8},
+  {0x00AA, 0x00AA},
+  {0x00AD, 0x00AE},
+  {0x00B0, 0x00B4},
+  {0x00B6, 0x00BA},
+  {0x00BC, 0x00BF},
+  {0x00C6, 0x00C6},
+  {0x00D0, 0x00D0},
+  {0x00D7, 0x00D8},
+  {0x00DE, 0x00E1},
+  {0x00E6, 0x00E6},
+  {0x00E8, 0x00EA},
+  {0x00EC, 0x00ED},
+  {0x00F0, 0x00F0},
+  {0x00F2, 0x00F3},
+  {0x00F7, 0x00FA},
+  {0x00FC, 0x00FC},
+  {0x00FE, 0x00FE},
+  {0x0101, 0x0101},
+  {0x0111, 0x0111},
+  {0x0113, 0x0113},
+  {0x011B, 0x011B},
+  {0x0126, 0x0127},
+  {0x012B, 0x012B},
+  {0x0131, 0x0133},
+  {0x0138, 0x0138},
+  {0x013F, 0x0142},
+  {0x0144, 0x0144},
+  {0x0148, 0x014B},
+  {0x014D, 0x014D},
+  {0x0152, 0x0153},
+  {0x0166, 0x0167},
+  {0x016B, 0x016B},
+  {0x01CE, 0x01CE},
+  {0x01D0, 0x01D0},
+  {0x01D2, 0x01D2},
+  {0x01D4, 0x01D4},
+  {0x01D6, 0x01D6},
+  {0x01D8, 0x01D8},
+  {0x01DA, 0x01DA},
+  {0x01DC, 0x01DC},
+  {0x0251, 0x0251},
+  {0x0261, 0x0261},
+  {0x02C4, 0x02C4},
+  {0x02C7, 0x02C7},
+  {0x02C9, 0x02CB},
+  {0x02CD, 0x02CD},
+  {0x02D0, 0x02D0},
+  {0x02D8, 0x02DB},
+  {0x02DD, 0x02DD},
+  {0x02DF, 0x02DF},
+  {0x0300, 0x036F},
+  {0x0391, 0x03A1},
+  {0x03A3, 0x03A9},
+  {0x03B1, 0x03C1},
+  {0x03C3, 0x03C9},
+  {0x0401, 0x0401},
+  {0x0410, 0x044F},
+  {0x0451, 0x0451},
+  {0x2010, 0x2010},
+  {0x2013, 0x2016},
+  {0x2018, 0x2019},
+  {0x201C, 0x201D},
+  {0x2020, 0x2022},
+  {0x2024, 0x2027},
+  {0x2030, 0x2030},
+  {0x2032, 0x2033},
+  {0x2035, 0x2035},
+  {0x203B, 0x203B},
+  {0x203E, 0x203E},
+  {0x2074, 0x2074},
+  {0x207F, 0x207F},
+  {0x2081, 0x2084},
+  {0x20AC, 0x20AC},
+  {0x2103, 0x2103},
+  {0x2105, 0x2105},
+  {0x2109, 0x2109},
+  {0x2113, 0x2113},
+  {0x2116, 0x2116},
+  {0x2121, 0x2122},
+  {0x2126, 0x2126},
+  {0x212B, 0x212B},
+  {0x2153, 0x2154},
+  {0x215B, 0x215E},
+  {0x2160, 0x216B},
+  {0x2170, 0x2179},
+  {0x2189, 0x2189},
+  {0x2190, 0x2199},
+  {0x21B8, 0x21B9},
+  {0x21D2, 0x21D2},
+  {0x21D4, 0x21D4},
+  {0x21E7, 0x21E7},
+  {0x2200, 0x2200},
+  {0x2202, 0x2203},
+  {0x2207, 0x2208},
+  {0x220B, 0x220B},
+  {0x220F, 0x220F},
+  {0x2211, 0x2211},
+  {0x2215, 0x2215},
+  {0x221A, 0x221A},
+  {0x221D, 0x2220},
+  {0x2223, 0x2223},
+  {0x2225, 0x2225},
+  {0x2227, 0x222C},
+  {0x222E, 0x222E},
+  {0x2234, 0x2237},
+  {0x223C, 0x223D},
+  {0x2248, 0x2248},
+  {0x224C, 0x224C},
+  {0x2252, 0x2252},
+  {0x2260, 0x2261},
+  {0x2264, 0x2267},
+  {0x226A, 0x226B},
+  {0x226E, 0x226F},
+  {0x2282, 0x2283},
+  {0x2286, 0x2287},
+  {0x2295, 0x2295},
+  {0x2299, 0x2299},
+  {0x22A5, 0x22A5},
+  {0x22BF, 0x22BF},
+  {0x2312, 0x2312},
+  {0x2460, 0x24E9},
+  {0x24EB, 0x254B},
+  {0x2550, 0x2573},
+  {0x2580, 0x258F},
+  {0x2592, 0x2595},
+  {0x25A0, 0x25A1},
+  {0x25A3, 0x25A9},
+  {0x25B2, 0x25B3},
+  {0x25B6, 0x25B7},
+  {0x25BC, 0x25BD},
+  {0x25C0, 0x25C1},
+  {0x25C6, 0x25C8},
+  {0x25CB, 0x25CB},
+  {0x25CE, 0x25D1},
+  {0x25E2, 0x25E5},
+  {0x25EF, 0x25EF},
+  {0x2605, 0x2606},
+  {0x2609, 0x2609},
+  {0x260E, 0x260F},
+  {0x261C, 0x261C},
+  {0x261E, 0x261E},
+  {0x2640, 0x2640},
+  {0x2642, 0x2642},
+  {0x2660, 0x2661},
+  {0x2663, 0x2665},
+  {0x2667, 0x266A},
+  {0x266C, 0x266D},
+  {0x266F, 0x266F},
+  {0x269E, 0x269F},
+  {0x26BF, 0x26BF},
+  {0x26C6, 0x26CD},
+  {0x26CF, 0x26D3},
+  {0x26D5, 0x26E1},
+  {0x26E3, 0x26E3},
+  {0x26E8, 0x26E9},
+  {0x26EB, 0x26F1},
+  {0x26F4, 0x26F4},
+  {0x26F6, 0x26F9},
+  {0x26FB, 0x26FC},
+  {0x26FE, 0x26FF},
+  {0x273D, 0x273D},
+  {0x2776, 0x277F},
+  {0x2B56, 0x2B59},
+  {0x3248, 0x324F},
+  {0xE000, 0xF8FF},
+  {0xFE00, 0xFE0F},
+  {0xFFFD, 0xFFFD},
+  {0x1F100, 0x1F10A},
+  {0x1F110, 0x1F12D},
+  {0x1F130, 0x1F169},
+  {0x1F170, 0x1F18D},
+  {0x1F18F, 0x1F190},
+  {0x1F19B, 0x1F1AC},
+  {0xE0100, 0xE01EF},
+  {0xF0000, 0xFFFFD},
+  {0x100000, 0x10FFFD},
+};
+
 
-/* The following two functions define the column width of an ISO 10646
+/* The following function defines the column width of an ISO 10646
  * character as follows:
  *
  *    - The null character (U+0000) has a column width of 0.
@@ -121,185 +489,8 @@ static bool bisearch(unsigned int ucs, const struct interval *table, int max) {
  * in ISO 10646.
  */
 
-int mk_wcwidth(unsigned int ucs)
+static int wcwidth_search(unsigned int ucs)
 {
-  /* sorted list of non-overlapping intervals of non-spacing characters */
-  /* generated by "uniset +cat=Me +cat=Mn +cat=Cf -00AD +1160-11FF +200B c" */
-  static const struct interval combining[] = {
-    { 0x0300, 0x036F }, { 0x0483, 0x0486 }, { 0x0488, 0x0489 },
-    { 0x0591, 0x05BD }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 },
-    { 0x05C4, 0x05C5 }, { 0x05C7, 0x05C7 }, { 0x0600, 0x0603 },
-    { 0x0610, 0x0615 }, { 0x064B, 0x065E }, { 0x0670, 0x0670 },
-    { 0x06D6, 0x06E4 }, { 0x06E7, 0x06E8 }, { 0x06EA, 0x06ED },
-    { 0x070F, 0x070F }, { 0x0711, 0x0711 }, { 0x0730, 0x074A },
-    { 0x07A6, 0x07B0 }, { 0x07EB, 0x07F3 }, { 0x0901, 0x0902 },
-    { 0x093C, 0x093C }, { 0x0941, 0x0948 }, { 0x094D, 0x094D },
-    { 0x0951, 0x0954 }, { 0x0962, 0x0963 }, { 0x0981, 0x0981 },
-    { 0x09BC, 0x09BC }, { 0x09C1, 0x09C4 }, { 0x09CD, 0x09CD },
-    { 0x09E2, 0x09E3 }, { 0x0A01, 0x0A02 }, { 0x0A3C, 0x0A3C },
-    { 0x0A41, 0x0A42 }, { 0x0A47, 0x0A48 }, { 0x0A4B, 0x0A4D },
-    { 0x0A70, 0x0A71 }, { 0x0A81, 0x0A82 }, { 0x0ABC, 0x0ABC },
-    { 0x0AC1, 0x0AC5 }, { 0x0AC7, 0x0AC8 }, { 0x0ACD, 0x0ACD },
-    { 0x0AE2, 0x0AE3 }, { 0x0B01, 0x0B01 }, { 0x0B3C, 0x0B3C },
-    { 0x0B3F, 0x0B3F }, { 0x0B41, 0x0B43 }, { 0x0B4D, 0x0B4D },
-    { 0x0B56, 0x0B56 }, { 0x0B82, 0x0B82 }, { 0x0BC0, 0x0BC0 },
-    { 0x0BCD, 0x0BCD }, { 0x0C3E, 0x0C40 }, { 0x0C46, 0x0C48 },
-    { 0x0C4A, 0x0C4D }, { 0x0C55, 0x0C56 }, { 0x0CBC, 0x0CBC },
-    { 0x0CBF, 0x0CBF }, { 0x0CC6, 0x0CC6 }, { 0x0CCC, 0x0CCD },
-    { 0x0CE2, 0x0CE3 }, { 0x0D41, 0x0D43 }, { 0x0D4D, 0x0D4D },
-    { 0x0DCA, 0x0DCA }, { 0x0DD2, 0x0DD4 }, { 0x0DD6, 0x0DD6 },
-    { 0x0E31, 0x0E31 }, { 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E },
-    { 0x0EB1, 0x0EB1 }, { 0x0EB4, 0x0EB9 }, { 0x0EBB, 0x0EBC },
-    { 0x0EC8, 0x0ECD }, { 0x0F18, 0x0F19 }, { 0x0F35, 0x0F35 },
-    { 0x0F37, 0x0F37 }, { 0x0F39, 0x0F39 }, { 0x0F71, 0x0F7E },
-    { 0x0F80, 0x0F84 }, { 0x0F86, 0x0F87 }, { 0x0F90, 0x0F97 },
-    { 0x0F99, 0x0FBC }, { 0x0FC6, 0x0FC6 }, { 0x102D, 0x1030 },
-    { 0x1032, 0x1032 }, { 0x1036, 0x1037 }, { 0x1039, 0x1039 },
-    { 0x1058, 0x1059 }, { 0x1160, 0x11FF }, { 0x135F, 0x135F },
-    { 0x1712, 0x1714 }, { 0x1732, 0x1734 }, { 0x1752, 0x1753 },
-    { 0x1772, 0x1773 }, { 0x17B4, 0x17B5 }, { 0x17B7, 0x17BD },
-    { 0x17C6, 0x17C6 }, { 0x17C9, 0x17D3 }, { 0x17DD, 0x17DD },
-    { 0x180B, 0x180D }, { 0x18A9, 0x18A9 }, { 0x1920, 0x1922 },
-    { 0x1927, 0x1928 }, { 0x1932, 0x1932 }, { 0x1939, 0x193B },
-    { 0x1A17, 0x1A18 }, { 0x1B00, 0x1B03 }, { 0x1B34, 0x1B34 },
-    { 0x1B36, 0x1B3A }, { 0x1B3C, 0x1B3C }, { 0x1B42, 0x1B42 },
-    { 0x1B6B, 0x1B73 }, { 0x1DC0, 0x1DCA }, { 0x1DFE, 0x1DFF },
-    { 0x200B, 0x200F }, { 0x202A, 0x202E }, { 0x2060, 0x2063 },
-    { 0x206A, 0x206F }, { 0x20D0, 0x20EF }, { 0x302A, 0x302F },
-    { 0x3099, 0x309A }, { 0xA806, 0xA806 }, { 0xA80B, 0xA80B },
-    { 0xA825, 0xA826 }, { 0xFB1E, 0xFB1E }, { 0xFE00, 0xFE0F },
-    { 0xFE20, 0xFE23 }, { 0xFEFF, 0xFEFF }, { 0xFFF9, 0xFFFB },
-    { 0x10A01, 0x10A03 }, { 0x10A05, 0x10A06 }, { 0x10A0C, 0x10A0F },
-    { 0x10A38, 0x10A3A }, { 0x10A3F, 0x10A3F }, { 0x1D167, 0x1D169 },
-    { 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD },
-    { 0x1D242, 0x1D244 }, { 0xE0001, 0xE0001 }, { 0xE0020, 0xE007F },
-    { 0xE0100, 0xE01EF }
-  };
-
-  /* A sorted list of intervals of double-width characters generated by:
-   * https://raw.githubusercontent.com/GNOME/glib/37d4c2941bd0326b8b6e6bb22c81bd424fcc040b/glib/gen-unicode-tables.pl
-   * from the Unicode 9.0.0 data files available at:
-   * https://www.unicode.org/Public/13.0.0/ucd/
-   */
-  static const struct interval wide[] = {
-    {0x1100, 0x115F},
-    {0x231A, 0x231B},
-    {0x2329, 0x232A},
-    {0x23E9, 0x23EC},
-    {0x23F0, 0x23F0},
-    {0x23F3, 0x23F3},
-    {0x25FD, 0x25FE},
-    {0x2614, 0x2615},
-    {0x2648, 0x2653},
-    {0x267F, 0x267F},
-    {0x2693, 0x2693},
-    {0x26A1, 0x26A1},
-    {0x26AA, 0x26AB},
-    {0x26BD, 0x26BE},
-    {0x26C4, 0x26C5},
-    {0x26CE, 0x26CE},
-    {0x26D4, 0x26D4},
-    {0x26EA, 0x26EA},
-    {0x26F2, 0x26F3},
-    {0x26F5, 0x26F5},
-    {0x26FA, 0x26FA},
-    {0x26FD, 0x26FD},
-    {0x2705, 0x2705},
-    {0x270A, 0x270B},
-    {0x2728, 0x2728},
-    {0x274C, 0x274C},
-    {0x274E, 0x274E},
-    {0x2753, 0x2755},
-    {0x2757, 0x2757},
-    {0x2795, 0x2797},
-    {0x27B0, 0x27B0},
-    {0x27BF, 0x27BF},
-    {0x2B1B, 0x2B1C},
-    {0x2B50, 0x2B50},
-    {0x2B55, 0x2B55},
-    {0x2E80, 0x2E99},
-    {0x2E9B, 0x2EF3},
-    {0x2F00, 0x2FD5},
-    {0x2FF0, 0x2FFB},
-    {0x3000, 0x303E},
-    {0x3041, 0x3096},
-    {0x3099, 0x30FF},
-    {0x3105, 0x312F},
-    {0x3131, 0x318E},
-    {0x3190, 0x31E3},
-    {0x31F0, 0x321E},
-    {0x3220, 0x3247},
-    {0x3250, 0x4DBF},
-    {0x4E00, 0xA48C},
-    {0xA490, 0xA4C6},
-    {0xA960, 0xA97C},
-    {0xAC00, 0xD7A3},
-    {0xF900, 0xFAFF},
-    {0xFE10, 0xFE19},
-    {0xFE30, 0xFE52},
-    {0xFE54, 0xFE66},
-    {0xFE68, 0xFE6B},
-    {0xFF01, 0xFF60},
-    {0xFFE0, 0xFFE6},
-    {0x16FE0, 0x16FE4},
-    {0x16FF0, 0x16FF1},
-    {0x17000, 0x187F7},
-    {0x18800, 0x18CD5},
-    {0x18D00, 0x18D08},
-    {0x1B000, 0x1B11E},
-    {0x1B150, 0x1B152},
-    {0x1B164, 0x1B167},
-    {0x1B170, 0x1B2FB},
-    {0x1F004, 0x1F004},
-    {0x1F0CF, 0x1F0CF},
-    {0x1F18E, 0x1F18E},
-    {0x1F191, 0x1F19A},
-    {0x1F200, 0x1F202},
-    {0x1F210, 0x1F23B},
-    {0x1F240, 0x1F248},
-    {0x1F250, 0x1F251},
-    {0x1F260, 0x1F265},
-    {0x1F300, 0x1F320},
-    {0x1F32D, 0x1F335},
-    {0x1F337, 0x1F37C},
-    {0x1F37E, 0x1F393},
-    {0x1F3A0, 0x1F3CA},
-    {0x1F3CF, 0x1F3D3},
-    {0x1F3E0, 0x1F3F0},
-    {0x1F3F4, 0x1F3F4},
-    {0x1F3F8, 0x1F43E},
-    {0x1F440, 0x1F440},
-    {0x1F442, 0x1F4FC},
-    {0x1F4FF, 0x1F53D},
-    {0x1F54B, 0x1F54E},
-    {0x1F550, 0x1F567},
-    {0x1F57A, 0x1F57A},
-    {0x1F595, 0x1F596},
-    {0x1F5A4, 0x1F5A4},
-    {0x1F5FB, 0x1F64F},
-    {0x1F680, 0x1F6C5},
-    {0x1F6CC, 0x1F6CC},
-    {0x1F6D0, 0x1F6D2},
-    {0x1F6D5, 0x1F6D7},
-    {0x1F6EB, 0x1F6EC},
-    {0x1F6F4, 0x1F6FC},
-    {0x1F7E0, 0x1F7EB},
-    {0x1F90C, 0x1F93A},
-    {0x1F93C, 0x1F945},
-    {0x1F947, 0x1F978},
-    {0x1F97A, 0x1F9CB},
-    {0x1F9CD, 0x1F9FF},
-    {0x1FA70, 0x1FA74},
-    {0x1FA78, 0x1FA7A},
-    {0x1FA80, 0x1FA86},
-    {0x1FA90, 0x1FAA8},
-    {0x1FAB0, 0x1FAB6},
-    {0x1FAC0, 0x1FAC2},
-    {0x1FAD0, 0x1FAD6},
-    {0x20000, 0x2FFFD},
-    {0x30000, 0x3FFFD},
-  };
-
   /* test for 8-bit control characters */
   if (ucs == 0)
     return 0;
@@ -323,236 +514,238 @@ int mk_wcwidth(unsigned int ucs)
 }
 
 
-int mk_wcswidth(const unsigned int *pwcs, size_t n)
-{
-  int w, width = 0;
-
-  for (;*pwcs && n-- > 0; pwcs++)
-    if ((w = mk_wcwidth(*pwcs)) < 0)
-      return -1;
-    else
-      width += w;
-
-  return width;
-}
-
-
 /*
- * The following functions are the same as mk_wcwidth() and
- * mk_wcswidth(), except that spacing characters in the East Asian
+ * The following function is the same as wcwidth_search(), except
+ * that spacing characters in the East Asian
  * Ambiguous (A) category as defined in Unicode Technical Report #11
  * have a column width of 2. This variant might be useful for users of
  * CJK legacy encodings who want to migrate to UCS without changing
  * the traditional terminal character-width behaviour. It is not
  * otherwise recommended for general use.
  */
-int mk_wcwidth_cjk(unsigned int ucs)
+static int wcwidth_cjk_search(unsigned int ucs)
 {
-  /* A sorted list of intervals of ambiguous width characters generated by:
-   * https://raw.githubusercontent.com/GNOME/glib/37d4c2941bd0326b8b6e6bb22c81bd424fcc040b/glib/gen-unicode-tables.pl
-   * from the Unicode 9.0.0 data files available at:
-   * http://www.unicode.org/Public/9.0.0/ucd/
-   */
-  static const struct interval ambiguous[] = {
-    {0x00A1, 0x00A1},
-    {0x00A4, 0x00A4},
-    {0x00A7, 0x00A8},
-    {0x00AA, 0x00AA},
-    {0x00AD, 0x00AE},
-    {0x00B0, 0x00B4},
-    {0x00B6, 0x00BA},
-    {0x00BC, 0x00BF},
-    {0x00C6, 0x00C6},
-    {0x00D0, 0x00D0},
-    {0x00D7, 0x00D8},
-    {0x00DE, 0x00E1},
-    {0x00E6, 0x00E6},
-    {0x00E8, 0x00EA},
-    {0x00EC, 0x00ED},
-    {0x00F0, 0x00F0},
-    {0x00F2, 0x00F3},
-    {0x00F7, 0x00FA},
-    {0x00FC, 0x00FC},
-    {0x00FE, 0x00FE},
-    {0x0101, 0x0101},
-    {0x0111, 0x0111},
-    {0x0113, 0x0113},
-    {0x011B, 0x011B},
-    {0x0126, 0x0127},
-    {0x012B, 0x012B},
-    {0x0131, 0x0133},
-    {0x0138, 0x0138},
-    {0x013F, 0x0142},
-    {0x0144, 0x0144},
-    {0x0148, 0x014B},
-    {0x014D, 0x014D},
-    {0x0152, 0x0153},
-    {0x0166, 0x0167},
-    {0x016B, 0x016B},
-    {0x01CE, 0x01CE},
-    {0x01D0, 0x01D0},
-    {0x01D2, 0x01D2},
-    {0x01D4, 0x01D4},
-    {0x01D6, 0x01D6},
-    {0x01D8, 0x01D8},
-    {0x01DA, 0x01DA},
-    {0x01DC, 0x01DC},
-    {0x0251, 0x0251},
-    {0x0261, 0x0261},
-    {0x02C4, 0x02C4},
-    {0x02C7, 0x02C7},
-    {0x02C9, 0x02CB},
-    {0x02CD, 0x02CD},
-    {0x02D0, 0x02D0},
-    {0x02D8, 0x02DB},
-    {0x02DD, 0x02DD},
-    {0x02DF, 0x02DF},
-    {0x0300, 0x036F},
-    {0x0391, 0x03A1},
-    {0x03A3, 0x03A9},
-    {0x03B1, 0x03C1},
-    {0x03C3, 0x03C9},
-    {0x0401, 0x0401},
-    {0x0410, 0x044F},
-    {0x0451, 0x0451},
-    {0x2010, 0x2010},
-    {0x2013, 0x2016},
-    {0x2018, 0x2019},
-    {0x201C, 0x201D},
-    {0x2020, 0x2022},
-    {0x2024, 0x2027},
-    {0x2030, 0x2030},
-    {0x2032, 0x2033},
-    {0x2035, 0x2035},
-    {0x203B, 0x203B},
-    {0x203E, 0x203E},
-    {0x2074, 0x2074},
-    {0x207F, 0x207F},
-    {0x2081, 0x2084},
-    {0x20AC, 0x20AC},
-    {0x2103, 0x2103},
-    {0x2105, 0x2105},
-    {0x2109, 0x2109},
-    {0x2113, 0x2113},
-    {0x2116, 0x2116},
-    {0x2121, 0x2122},
-    {0x2126, 0x2126},
-    {0x212B, 0x212B},
-    {0x2153, 0x2154},
-    {0x215B, 0x215E},
-    {0x2160, 0x216B},
-    {0x2170, 0x2179},
-    {0x2189, 0x2189},
-    {0x2190, 0x2199},
-    {0x21B8, 0x21B9},
-    {0x21D2, 0x21D2},
-    {0x21D4, 0x21D4},
-    {0x21E7, 0x21E7},
-    {0x2200, 0x2200},
-    {0x2202, 0x2203},
-    {0x2207, 0x2208},
-    {0x220B, 0x220B},
-    {0x220F, 0x220F},
-    {0x2211, 0x2211},
-    {0x2215, 0x2215},
-    {0x221A, 0x221A},
-    {0x221D, 0x2220},
-    {0x2223, 0x2223},
-    {0x2225, 0x2225},
-    {0x2227, 0x222C},
-    {0x222E, 0x222E},
-    {0x2234, 0x2237},
-    {0x223C, 0x223D},
-    {0x2248, 0x2248},
-    {0x224C, 0x224C},
-    {0x2252, 0x2252},
-    {0x2260, 0x2261},
-    {0x2264, 0x2267},
-    {0x226A, 0x226B},
-    {0x226E, 0x226F},
-    {0x2282, 0x2283},
-    {0x2286, 0x2287},
-    {0x2295, 0x2295},
-    {0x2299, 0x2299},
-    {0x22A5, 0x22A5},
-    {0x22BF, 0x22BF},
-    {0x2312, 0x2312},
-    {0x2460, 0x24E9},
-    {0x24EB, 0x254B},
-    {0x2550, 0x2573},
-    {0x2580, 0x258F},
-    {0x2592, 0x2595},
-    {0x25A0, 0x25A1},
-    {0x25A3, 0x25A9},
-    {0x25B2, 0x25B3},
-    {0x25B6, 0x25B7},
-    {0x25BC, 0x25BD},
-    {0x25C0, 0x25C1},
-    {0x25C6, 0x25C8},
-    {0x25CB, 0x25CB},
-    {0x25CE, 0x25D1},
-    {0x25E2, 0x25E5},
-    {0x25EF, 0x25EF},
-    {0x2605, 0x2606},
-    {0x2609, 0x2609},
-    {0x260E, 0x260F},
-    {0x261C, 0x261C},
-    {0x261E, 0x261E},
-    {0x2640, 0x2640},
-    {0x2642, 0x2642},
-    {0x2660, 0x2661},
-    {0x2663, 0x2665},
-    {0x2667, 0x266A},
-    {0x266C, 0x266D},
-    {0x266F, 0x266F},
-    {0x269E, 0x269F},
-    {0x26BF, 0x26BF},
-    {0x26C6, 0x26CD},
-    {0x26CF, 0x26D3},
-    {0x26D5, 0x26E1},
-    {0x26E3, 0x26E3},
-    {0x26E8, 0x26E9},
-    {0x26EB, 0x26F1},
-    {0x26F4, 0x26F4},
-    {0x26F6, 0x26F9},
-    {0x26FB, 0x26FC},
-    {0x26FE, 0x26FF},
-    {0x273D, 0x273D},
-    {0x2776, 0x277F},
-    {0x2B56, 0x2B59},
-    {0x3248, 0x324F},
-    {0xE000, 0xF8FF},
-    {0xFE00, 0xFE0F},
-    {0xFFFD, 0xFFFD},
-    {0x1F100, 0x1F10A},
-    {0x1F110, 0x1F12D},
-    {0x1F130, 0x1F169},
-    {0x1F170, 0x1F18D},
-    {0x1F18F, 0x1F190},
-    {0x1F19B, 0x1F1AC},
-    {0xE0100, 0xE01EF},
-    {0xF0000, 0xFFFFD},
-    {0x100000, 0x10FFFD},
-  };
-
   /* binary search in table of non-spacing characters */
   if (bisearch(ucs, ambiguous,
                sizeof(ambiguous) / sizeof(struct interval) - 1))
     return 2;
 
-  return mk_wcwidth(ucs);
+  return wcwidth_search(ucs);
 }
 
+/*
+ * Looking a character up in the interval tables above means a binary
+ * search through two or three of them, and the terminal does it for
+ * every character it puts on the screen. So the first time a width is
+ * asked for, the tables are turned into a two-level lookup table:
+ * wcw_pages[] gives, for each page of 256 code points, the index of a
+ * block in wcw_blocks[], which has one byte for each code point in the
+ * page. Most pages are identical to some other page (all width 1, or
+ * all width 2 in the CJK ranges), so they share a block, and only a
+ * few dozen distinct blocks are stored.
+ *
+ * Each byte holds the code point's width plus one in its bottom two
+ * bits, and its width in the CJK variant plus one in the next two. So
+ * a combining character is one whose width is 0, and an ambiguous one
+ * is one whose two widths differ.
+ *
+ * Code points beyond the end of Unicode aren't in any of the tables,
+ * and are width 1 either way.
+ */
+#define WCW_PAGEBITS 8
+#define WCW_PAGESIZE (1 << WCW_PAGEBITS)
+#define WCW_LIMIT 0x110000
+#define WCW_CLASS(w, wcjk) (((w) + 1) | (((wcjk) + 1) << 2))
+#define WCW_OUTSIDE WCW_CLASS(1, 1)
 
-int mk_wcswidth_cjk(const unsigned int *pwcs, size_t n)
+static unsigned short wcw_pages[WCW_LIMIT >> WCW_PAGEBITS];
+static unsigned char *wcw_blocks;
+
+/*
+ * Return true if the code points lo to hi are either all in the table
+ * or all not in it, i.e. no interval starts or ends part way through.
+ */
+static bool wcw_uniform(unsigned int lo, unsigned int hi,
+                        const struct interval *table, int n)
 {
-  int w, width = 0;
+  int min = 0, max = n - 1, mid;
 
-  for (;*pwcs && n-- > 0; pwcs++)
-    if ((w = mk_wcwidth_cjk(*pwcs)) < 0)
-      return -1;
+  /* find the first interval that doesn't end before lo */
+  while (max >= min) {
+    mid = (min + max) / 2;
+    if (table[mid].last < lo)
+      min = mid + 1;
     else
-      width += w;
+      max = mid - 1;
+  }
+
+  return min == n || table[min].first > hi ||
+    (table[min].first <= lo && table[min].last >= hi);
+}
+
+#define WCW_UNIFORM(lo, hi, table) \
+  wcw_uniform(lo, hi, table, sizeof(table) / sizeof(struct interval))
+
+static unsigned char wcw_classify(unsigned int ucs)
+{
+  return WCW_CLASS(wcwidth_search(ucs), wcwidth_cjk_search(ucs));
+}
+
+static void wcw_init(void)
+{
+  unsigned char block[WCW_PAGESIZE];
+  unsigned short uniform[16];
+  size_t nblocks = 0, blocksize = 0, b;
+  unsigned int page, lo, hi, i;
+  unsigned char *blocks = NULL;
+
+  for (i = 0; i < lenof(uniform); i++)
+    uniform[i] = 0xFFFF;
+
+  for (page = 0; page < lenof(wcw_pages); page++) {
+    lo = page << WCW_PAGEBITS;
+    hi = lo + WCW_PAGESIZE - 1;
+
+    /* The controls make page 0 different from any other. */
+    if (page > 0 && WCW_UNIFORM(lo, hi, combining) &&
+        WCW_UNIFORM(lo, hi, wide) && WCW_UNIFORM(lo, hi, ambiguous)) {
+      unsigned char cls = wcw_classify(lo);
+      if (uniform[cls] == 0xFFFF) {
+        sgrowarray(blocks, blocksize, (nblocks + 1) * WCW_PAGESIZE - 1);
+        memset(blocks + nblocks * WCW_PAGESIZE, cls, WCW_PAGESIZE);
+        uniform[cls] = nblocks++;
+      }
+      wcw_pages[page] = uniform[cls];
+      continue;
+    }
+
+    for (i = 0; i < WCW_PAGESIZE; i++)
+      block[i] = wcw_classify(lo + i);
+    for (b = 0; b < nblocks; b++)
+      if (!memcmp(blocks + b * WCW_PAGESIZE, block, WCW_PAGESIZE))
+        break;
+    if (b == nblocks) {
+      sgrowarray(blocks, blocksize, (nblocks + 1) * WCW_PAGESIZE - 1);
+      memcpy(blocks + nblocks * WCW_PAGESIZE, block, WCW_PAGESIZE);
+      nblocks++;
+    }
+    wcw_pages[page] = b;
+  }
+
+  wcw_blocks = blocks;
+}
+
+/* The class of a character, once wcw_init has been called */
+static inline unsigned char wcw_lookup(unsigned int ucs)
+{
+  if (ucs >= WCW_LIMIT)
+    return WCW_OUTSIDE;
+  return wcw_blocks[((size_t)wcw_pages[ucs >> WCW_PAGEBITS] << WCW_PAGEBITS) |
+                    (ucs & (WCW_PAGESIZE - 1))];
+}
+
+static inline unsigned char wcw_class(unsigned int ucs)
+{
+  if (!wcw_blocks)
+    wcw_init();
+  return wcw_lookup(ucs);
+}
+
+/*
+ * Return how many characters at the start of pwcs[0..n) are printable
+ * ASCII, i.e. in the range 0x20 to 0x7E, and so simply of width 1.
+ * With SSE2, four characters are checked at once: subtracting 0x20
+ * moves the range down to 0 to 0x5E, and flipping the top bit lets a
+ * signed comparison do the unsigned one.
+ */
+static size_t wcw_ascii_run(const unsigned int *pwcs, size_t n)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i base = _mm_set1_epi32(0x20);
+  const __m128i flip = _mm_set1_epi32((int)0x80000000U);
+  const __m128i limit = _mm_set1_epi32((int)(0x5FU ^ 0x80000000U));
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(pwcs + i));
+    v = _mm_xor_si128(_mm_sub_epi32(v, base), flip);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, limit)));
+    if (mask != 0xF) {
+      while (mask & 1) {
+        mask >>= 1;
+        i++;
+      }
+      return i;
+    }
+  }
+#endif
+
+  for (; i < n; i++)
+    if (pwcs[i] - 0x20 >= 0x5F)
+      break;
+  return i;
+}
+
+/*
+ * Width of a string, taking the widths from the bits at `shift' in
+ * each character's class: stop at a NUL, and return -1 if there's a
+ * control character before then.
+ *
+ * Only the ASCII at the start is skipped as a run. Once anything
+ * else turns up, the ASCII stretches in between are mostly too short
+ * to pay for finding their ends, so each character is looked up as
+ * it comes.
+ */
+static inline int wcw_swidth(const unsigned int *pwcs, size_t n, int shift)
+{
+  size_t run = wcw_ascii_run(pwcs, n);
+  int width = run, w;
+
+  if (run < n && !wcw_blocks)
+    wcw_init();
+
+  for (pwcs += run, n -= run; n > 0; pwcs++, n--) {
+    if (*pwcs - 0x20 < 0x5F) {
+      width++;
+      continue;
+    }
+    if (*pwcs == 0)
+      break;
+    if ((w = ((wcw_lookup(*pwcs) >> shift) & 3) - 1) < 0)
+      return -1;
+    width += w;
+  }
 
   return width;
 }
+
+/*
+ * The functions exported to the rest of PuTTY. mk_wcwidth() and
+ * mk_wcswidth() use the widths described above wcwidth_search();
+ * mk_wcwidth_cjk() and mk_wcswidth_cjk() are the variants described
+ * above wcwidth_cjk_search().
+ */
+int mk_wcwidth(unsigned int ucs)
+{
+  if (ucs - 0x20 < 0x5F)
+    return 1;                          /* printable ASCII */
+  return (wcw_class(ucs) & 3) - 1;
+}
+
+int mk_wcswidth(const unsigned int *pwcs, size_t n)
+{
+  return wcw_swidth(pwcs, n, 0);
+}
+
+int mk_wcwidth_cjk(unsigned int ucs)
+{
+  if (ucs - 0x20 < 0x5F)
+    return 1;
+  return ((wcw_class(ucs) >> 2) & 3) - 1;
+}
+
+int mk_wcswidth_cjk(const unsigned int *pwcs, size_t n)
+{
+  return wcw_swidth(pwcs, n, 2);
+}
@@ -0,0 +1,253 @@
+/*
+ * log-writer.c: write session log data from a background thread.
+ *
+ * A busy session can generate a great many small log writes: one per
+ * chunk of terminal output, or one per line of an SSH packet dump.
+ * Doing each of those as a stdio call (and perhaps a flush) on the
+ * thread that is also driving the terminal means that a slow disk
+ * turns directly into a sluggish window.
+ *
+ * So logging.c can optionally hand its output to one of these
+ * instead. The main thread copies the data into a ring buffer and
+ * returns at once. A subthread wakes up when a batch's worth has
+ * built up, or when the flush interval expires, and writes out
+ * everything pending in at most two fwrite calls followed by a flush.
+ *
+ * The ring has exactly one producer (the main thread, which advances
+ * `head') and one consumer (the subthread, which advances `tail'), so
+ * it needs no lock: each side only reads the other's index, and the
+ * interlocked operations order the data against the index that
+ * publishes it.
+ *
+ * If the disk can't keep up and the ring fills, the main thread still
+ * never waits. It discards the excess, counts it, and puts a marker
+ * in the log at the point of the gap as soon as there's room.
+ */
+
+#include <assert.h>
+
+#include "putty.h"
+
+struct LogWriter {
+    /*
+     * Set up at creation time, and read-only thereafter.
+     */
+    FILE *fp;                          /* owned by logging.c */
+    HANDLE thread;
+    HANDLE ev_wake;                    /* auto-reset: wake the subthread */
+    char *buf;
+    ULONG size, mask;                  /* ring size, a power of 2 */
+    ULONG batch;                       /* wake the subthread at this fill */
+    DWORD interval;                    /* ... or after this many ms */
+
+    /*
+     * Free-running byte counters; the ring index is the counter
+     * masked by `mask'. `head' is written only by the main thread and
+     * `tail' only by the subthread.
+     */
+    volatile LONG head, tail;
+
+    volatile LONG kicked;              /* ev_wake set and not yet seen */
+    volatile LONG done;                /* main thread wants us to stop */
+    volatile LONG error;               /* a write to fp has failed */
+
+    /*
+     * Only ever touched by the main thread.
+     */
+    uint64_t dropped;                  /* total bytes discarded */
+    uint64_t gap;                      /* bytes discarded, not yet marked */
+    ULONG peak;                        /* highest fill level seen */
+};
+
+static DWORD WINAPI logwriter_threadfunc(void *param)
+{
+    LogWriter *lw = (LogWriter *)param;
+
+    while (1) {
+        ULONG head, tail;
+        bool finished, wrote = false;
+
+        WaitForSingleObject(lw->ev_wake, lw->interval);
+        InterlockedExchange(&lw->kicked, 0);
+        finished = InterlockedCompareExchange(&lw->done, 0, 0) != 0;
+
+        /*
+         * Reading `head' with an interlocked operation means we see
+         * all the data the main thread wrote before publishing it.
+         */
+        head = (ULONG)InterlockedCompareExchange(&lw->head, 0, 0);
+        tail = (ULONG)lw->tail;
+
+        while (tail != head) {
+            ULONG off = tail & lw->mask;
+            ULONG len = head - tail;
+            if (len > lw->size - off)
+                len = lw->size - off;
+
+            if (!lw->error && fwrite(lw->buf + off, 1, len, lw->fp) < len)
+                InterlockedExchange(&lw->error, 1);
+            wrote = true;
+
+            tail += len;
+            InterlockedExchange(&lw->tail, (LONG)tail);
+        }
+
+        if (wrote && !lw->error && fflush(lw->fp) != 0)
+            InterlockedExchange(&lw->error, 1);
+
+        if (finished)
+            break;
+    }
+
+    return 0;
+}
+
+LogWriter *logwriter_new(FILE *fp, size_t bufsize, size_t batch,
+                         unsigned interval_ms)
+{
+    LogWriter *lw = snew(LogWriter);
+    DWORD threadid;
+    ULONG size;
+
+    for (size = 4096; size < bufsize && size < 0x40000000UL; size <<= 1);
+
+    lw->fp = fp;
+    lw->size = size;
+    lw->mask = size - 1;
+    lw->batch = (batch && batch < size ? batch : size / 2);
+    lw->interval = (interval_ms ? interval_ms : 1);
+    lw->buf = snewn(size, char);
+    lw->head = lw->tail = 0;
+    lw->kicked = lw->done = lw->error = 0;
+    lw->dropped = lw->gap = 0;
+    lw->peak = 0;
+
+    lw->ev_wake = CreateEvent(NULL, false, false, NULL);
+    if (!lw->ev_wake)
+        goto fail;
+    lw->thread = CreateThread(NULL, 0, logwriter_threadfunc, lw,
+                              0, &threadid);
+    if (!lw->thread) {
+        CloseHandle(lw->ev_wake);
+        goto fail;
+    }
+
+    return lw;
+
+  fail:
+    sfree(lw->buf);
+    sfree(lw);
+    return NULL;
+}
+
+/*
+ * Text marking the place where data had to be discarded.
+ */
+static int logwriter_gap_marker(char *buf, uint64_t gap)
+{
+    return sprintf(buf, "\r\n[%"PRIu64" bytes of session log lost: "
+                   "log file could not keep up]\r\n", gap);
+}
+
+/*
+ * Free space in the ring, as seen from the main thread.
+ */
+static ULONG logwriter_space(LogWriter *lw)
+{
+    ULONG tail = (ULONG)InterlockedCompareExchange(&lw->tail, 0, 0);
+    return lw->size - ((ULONG)lw->head - tail);
+}
+
+/*
+ * Copy data into the ring, as much as will fit, and return how much
+ * that was. Called only from the main thread.
+ */
+static size_t logwriter_put(LogWriter *lw, const void *data, size_t len)
+{
+    ULONG space = logwriter_space(lw);
+    ULONG head = (ULONG)lw->head, off = head & lw->mask, first, fill;
+
+    if (len > space)
+        len = space;
+    first = (len < lw->size - off ? len : lw->size - off);
+    memcpy(lw->buf + off, data, first);
+    memcpy(lw->buf, (const char *)data + first, len - first);
+
+    head += len;
+    InterlockedExchange(&lw->head, (LONG)head);
+
+    fill = lw->size - space + len;
+    if (lw->peak < fill)
+        lw->peak = fill;
+    if (fill >= lw->batch && InterlockedExchange(&lw->kicked, 1) == 0)
+        SetEvent(lw->ev_wake);
+
+    return len;
+}
+
+bool logwriter_write(LogWriter *lw, const void *data, size_t len)
+{
+    size_t written;
+
+    if (InterlockedCompareExchange(&lw->error, 0, 0))
+        return false;
+
+    if (lw->gap) {
+        /*
+         * We've had to throw data away since the last successful
+         * write. Don't resume until there's at least room to say so.
+         */
+        char marker[128];
+        int mlen = logwriter_gap_marker(marker, lw->gap);
+        if (logwriter_space(lw) < mlen) {
+            lw->gap += len;
+            lw->dropped += len;
+            return true;
+        }
+        logwriter_put(lw, marker, mlen);
+        lw->gap = 0;
+    }
+
+    written = logwriter_put(lw, data, len);
+    lw->gap += len - written;
+    lw->dropped += len - written;
+    return true;
+}
+
+uint64_t logwriter_dropped(LogWriter *lw)
+{
+    return lw->dropped;
+}
+
+size_t logwriter_peak(LogWriter *lw)
+{
+    return lw->peak;
+}
+
+void logwriter_free(LogWriter *lw)
+{
+    /*
+     * Ask the subthread to write out whatever is still pending and
+     * then stop, and wait for it to do so. This is the only place the
+     * main thread ever waits for the disk.
+     */
+    InterlockedExchange(&lw->done, 1);
+    SetEvent(lw->ev_wake);
+    WaitForSingleObject(lw->thread, INFINITE);
+
+    /*
+     * If the last thing that happened was a gap, the subthread is out
+     * of the way now, so we can note it in the file ourselves.
+     */
+    if (lw->gap && !lw->error) {
+        char marker[128];
+        int mlen = logwriter_gap_marker(marker, lw->gap);
+        fwrite(marker, 1, mlen, lw->fp);
+        fflush(lw->fp);
+    }
+
+    CloseHandle(lw->thread);
+    CloseHandle(lw->ev_wake);
+    sfree(lw->buf);
+    sfree(lw);
+}
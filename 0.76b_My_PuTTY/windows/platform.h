@@ -726,6 +726,14 @@ char *get_jumplist_registry_entries(void);
 #define CLIPUI_DEFAULT_MOUSE CLIPUI_EXPLICIT
 #define CLIPUI_DEFAULT_INS CLIPUI_EXPLICIT
 
+/* Atomic counters for the worker threads declared in putty.h */
+typedef LONG atomic_counter;
+#define atomic_counter_inc(p) ((long)InterlockedIncrement(p) - 1)
+#define atomic_counter_dec(p) ((long)InterlockedDecrement(p))
+#define atomic_counter_load(p) ((long)InterlockedCompareExchange(p, 0, 0))
+#define atomic_counter_cas(p, old, new) \
+    (InterlockedCompareExchange(p, new, old) == (old))
+
 /* In winmisc.c */
 char *registry_get_string(HKEY root, const char *path, const char *leaf);
 
@@ -613,6 +613,9 @@ static DWORD WINAPI generate_key_thread(void *param)
 
     win_progress_initialise(&prog);
 
+    /* Search for primes on every CPU we've got */
+    primegen_set_threads(0);
+
     PrimeGenerationContext *pgc = primegen_new_context(params->primepolicy);
 
     if (params->keytype == DSA)
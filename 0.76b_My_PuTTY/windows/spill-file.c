@@ -0,0 +1,126 @@
+/*
+ * spill-file.c: the temporary file that old scrollback is moved out
+ * to once it's over the configured memory limit.
+ *
+ * The file lives in the user's temp directory, is opened for our
+ * exclusive use, and is marked for deletion when the handle is
+ * closed, so nothing is left behind even if we crash. Blocks are
+ * written with WriteFile at the offset terminal/scrollback.c asks
+ * for, and read back by mapping a view of the file over them, so
+ * that a block the user scrolls to comes straight from the page
+ * cache without a copy.
+ *
+ * A file mapping object can't see beyond the size the file was when
+ * the mapping was created, so it's recreated whenever a read is for
+ * data past that point.
+ */
+
+#include <assert.h>
+
+#include "putty.h"
+
+struct SpillFile {
+    HANDLE file;
+    HANDLE mapping;                    /* or NULL */
+    uint64_t mapsize;                  /* file size when mapping was made */
+    uint64_t filesize;                 /* end of the furthest write */
+    DWORD granularity;                 /* views must start on a multiple */
+    void *view;                        /* the current view, or NULL */
+};
+
+SpillFile *spill_file_new(void)
+{
+    char dir[MAX_PATH + 1], path[MAX_PATH + 1];
+    SYSTEM_INFO si;
+    SpillFile *sf;
+    HANDLE h;
+    DWORD len;
+
+    len = GetTempPath(lenof(dir), dir);
+    if (len == 0 || len > lenof(dir))
+        return NULL;
+    if (!GetTempFileName(dir, "kty", 0, path))
+        return NULL;
+
+    h = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                   CREATE_ALWAYS,
+                   FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                   NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        DeleteFile(path);
+        return NULL;
+    }
+
+    GetSystemInfo(&si);
+
+    sf = snew(SpillFile);
+    sf->file = h;
+    sf->mapping = NULL;
+    sf->mapsize = sf->filesize = 0;
+    sf->granularity = si.dwAllocationGranularity;
+    sf->view = NULL;
+    return sf;
+}
+
+bool spill_file_write(SpillFile *sf, uint64_t offset,
+                      const void *data, size_t len)
+{
+    OVERLAPPED ov;
+    DWORD written;
+
+    if (len > 0xFFFFFFFFU)
+        return false;
+
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    if (!WriteFile(sf->file, data, (DWORD)len, &written, &ov) ||
+        written != len)
+        return false;
+
+    if (sf->filesize < offset + len)
+        sf->filesize = offset + len;
+    return true;
+}
+
+const void *spill_file_map(SpillFile *sf, uint64_t offset, size_t len)
+{
+    uint64_t start;
+
+    if (sf->view) {
+        UnmapViewOfFile(sf->view);
+        sf->view = NULL;
+    }
+
+    if (offset + len > sf->filesize)
+        return NULL;
+
+    if (!sf->mapping || offset + len > sf->mapsize) {
+        if (sf->mapping)
+            CloseHandle(sf->mapping);
+        sf->mapping = CreateFileMapping(sf->file, NULL, PAGE_READONLY,
+                                        (DWORD)(sf->filesize >> 32),
+                                        (DWORD)sf->filesize, NULL);
+        if (!sf->mapping)
+            return NULL;
+        sf->mapsize = sf->filesize;
+    }
+
+    start = offset - offset % sf->granularity;
+    sf->view = MapViewOfFile(sf->mapping, FILE_MAP_READ,
+                             (DWORD)(start >> 32), (DWORD)start,
+                             (SIZE_T)(offset + len - start));
+    if (!sf->view)
+        return NULL;
+    return (const char *)sf->view + (offset - start);
+}
+
+void spill_file_free(SpillFile *sf)
+{
+    if (sf->view)
+        UnmapViewOfFile(sf->view);
+    if (sf->mapping)
+        CloseHandle(sf->mapping);
+    CloseHandle(sf->file);             /* and FILE_FLAG_DELETE_ON_CLOSE */
+    sfree(sf);
+}
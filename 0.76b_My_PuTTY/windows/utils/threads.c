@@ -0,0 +1,82 @@
+/*
+ * Worker threads, semaphores and the processor count, as declared in
+ * putty.h, on top of the Win32 thread API.
+ */
+
+#include <limits.h>
+
+#include "putty.h"
+
+struct WorkerThread {
+    HANDLE handle;
+    void (*fn)(void *ctx);
+    void *ctx;
+};
+
+struct Semaphore {
+    HANDLE handle;
+};
+
+static DWORD WINAPI worker_thread_main(void *param)
+{
+    WorkerThread *wt = (WorkerThread *)param;
+    wt->fn(wt->ctx);
+    return 0;
+}
+
+WorkerThread *worker_thread_start(void (*fn)(void *ctx), void *ctx)
+{
+    WorkerThread *wt = snew(WorkerThread);
+    DWORD tid;
+
+    wt->fn = fn;
+    wt->ctx = ctx;
+    wt->handle = CreateThread(NULL, 0, worker_thread_main, wt, 0, &tid);
+    if (!wt->handle) {
+        sfree(wt);
+        return NULL;
+    }
+    return wt;
+}
+
+void worker_thread_join(WorkerThread *wt)
+{
+    WaitForSingleObject(wt->handle, INFINITE);
+    CloseHandle(wt->handle);
+    sfree(wt);
+}
+
+Semaphore *semaphore_new(void)
+{
+    HANDLE h = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    if (!h)
+        return NULL;
+
+    Semaphore *sem = snew(Semaphore);
+    sem->handle = h;
+    return sem;
+}
+
+void semaphore_free(Semaphore *sem)
+{
+    CloseHandle(sem->handle);
+    sfree(sem);
+}
+
+void semaphore_post(Semaphore *sem, unsigned n)
+{
+    if (n)
+        ReleaseSemaphore(sem->handle, n, NULL);
+}
+
+void semaphore_wait(Semaphore *sem)
+{
+    WaitForSingleObject(sem->handle, INFINITE);
+}
+
+unsigned ncpus(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+}
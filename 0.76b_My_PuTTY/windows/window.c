@@ -464,6 +464,7 @@ static void close_session(void *ignored_context);
 ScriptData scriptdata; 
 
 #include "script_win.c"
+#include "script_match.c"
 #include "script_ahk.c"
 #include "script.c" 
 /* rutty */
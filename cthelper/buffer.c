@@ -29,6 +29,20 @@ buffer_free(Buffer *pb)
   DBUG_VOID_RETURN;
 }
 
+void
+buffer_resize(Buffer *pb, size_t size)
+{
+  Buffer b;
+
+  DBUG_ENTER("buffer_resize");
+  assert(pb && *pb && size >= (*pb)->len);
+  b = (Buffer)realloc(*pb, sizeof(struct buffer_tag) + size);
+  assert(b);
+  b->avail = size - b->len;
+  *pb = b;
+  DBUG_VOID_RETURN;
+}
+
 ssize_t
 buffer_read(Buffer b, int d)
 {
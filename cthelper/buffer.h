@@ -16,6 +16,13 @@ Buffer buffer_init(size_t size);
 /* Free a buffer; sets *pb to NULL */
 void buffer_free(Buffer *pb);
 
+/* Change the size of a buffer made by buffer_init(), keeping its contents;
+ * `size' must be at least the length of the contents */
+void buffer_resize(Buffer *pb, size_t size);
+
+/* Returns the total size of a buffer */
+#define buffer_size(b) ((b)->avail + (b)->len)
+
 /* Initialize a Buffer with alloca() */
 #define BUFFER_ALLOCA(b,s) do{\
     b = alloca(sizeof(b)+(s)); b->avail = s; b->len = 0;\
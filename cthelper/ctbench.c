@@ -0,0 +1,175 @@
+/* ctbench: measure how fast cthelper moves a command's output to PuTTY.
+ *
+ * cthelper is run in its debugging mode (port 0), where the terminal it's
+ * started in stands in for the socket to PuTTY.  ctbench starts it in a
+ * pty of its own, has it run a command that writes a lot of output, and
+ * times how long it takes for that output to arrive.  Each workload is
+ * run with both of cthelper's loops, the portable select() one and the
+ * Linux epoll one, and the best of several runs is reported.
+ *
+ * The workloads are `yes' and `cat' of a file, of the given size.  The pty
+ * cthelper runs the command in is set to -opost, so that the output
+ * arrives exactly as it was written and the benchmark knows when it has
+ * all arrived.
+ *
+ * cthelper has to be built with -DDEBUG for port 0 to work:
+ *
+ *   gcc -O2 -DDEBUG -DDBUG_OFF -o cthelper cthelper.c buffer.c message.c \
+ *       pump.c -lutil
+ *   gcc -O2 -o ctbench ctbench.c -lutil
+ *
+ * Usage: ctbench [-n megabytes] [-r runs] [-f file] [path/to/cthelper]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <pty.h>
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run `command' under cthelper using loop `mode', and return how many
+ * seconds it took for `expect' bytes of output to arrive, or -1 */
+static double
+run(const char *cthelper, const char *mode, const char *command,
+    long long expect)
+{
+  static char buf[1 << 20];
+  struct termios ts;
+  long long got = 0;
+  double start, end = -1;
+  pid_t pid;
+  int m;
+
+  memset(&ts, 0, sizeof(ts));
+  cfmakeraw(&ts);
+  start = now();
+  switch ((pid = forkpty(&m, 0, &ts, 0))) {
+  case -1:
+    perror("forkpty");
+    return -1;
+  case 0:
+    setenv("CTHELPER_PUMP", mode, 1);
+    execl(cthelper, cthelper, "0", "dumb", "-opost",
+          "/bin/sh", "-c", command, (char *)0);
+    perror(cthelper);
+    _exit(127);
+  }
+
+  while (got < expect) {
+    ssize_t n = read(m, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  if (got == expect)
+    end = now();
+  else
+    fprintf(stderr, "%s: got %lld bytes of %lld\n", mode, got, expect);
+
+  /* in debugging mode cthelper waits for its "socket" to close */
+  close(m);
+  kill(pid, SIGHUP);
+  waitpid(pid, 0, 0);
+  return end < 0 ? -1 : end - start;
+}
+
+static void
+bench(const char *cthelper, const char *name, const char *command,
+      long long bytes, int runs)
+{
+  static const char *const modes[] = { "select", "epoll" };
+  int i, j;
+
+  for (i = 0; i < 2; i++) {
+    double best = -1;
+    for (j = 0; j < runs; j++) {
+      double t = run(cthelper, modes[i], command, bytes);
+      if (t > 0 && (best < 0 || t < best))
+        best = t;
+    }
+    if (best > 0)
+      printf("%-6s %-6s %8.1f MB/s  (%lld bytes in %.3fs)\n", name, modes[i],
+             bytes / best / 1e6, bytes, best);
+    else
+      printf("%-6s %-6s failed\n", name, modes[i]);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *cthelper = "./cthelper", *file = 0;
+  long long bytes = 256LL << 20;
+  int runs = 3, opt;
+  char command[4096];
+
+  while ((opt = getopt(argc, argv, "n:r:f:")) != -1) {
+    switch (opt) {
+    case 'n': bytes = atoll(optarg) << 20; break;
+    case 'r': runs = atoi(optarg); break;
+    case 'f': file = optarg; break;
+    default:
+      fprintf(stderr,
+        "usage: ctbench [-n megabytes] [-r runs] [-f file] [cthelper]\n");
+      return 1;
+    }
+  }
+  if (optind < argc)
+    cthelper = argv[optind];
+  if (access(cthelper, X_OK) != 0) {
+    perror(cthelper);
+    return 1;
+  }
+
+  snprintf(command, sizeof(command), "yes | head -c %lld", bytes);
+  bench(cthelper, "yes", command, bytes, runs);
+
+  {
+    char tmp[] = "/tmp/ctbenchXXXXXX";
+    long long size = bytes;
+    if (!file) {
+      /* a file of random bytes, which doesn't compress into a pattern */
+      int fd = mkstemp(tmp);
+      if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+      }
+      close(fd);
+      snprintf(command, sizeof(command),
+               "head -c %lld /dev/urandom > %s", bytes, tmp);
+      if (system(command) != 0)
+        return 1;
+      file = tmp;
+    }
+    else {
+      FILE *fp = fopen(file, "rb");
+      if (!fp || fseek(fp, 0, SEEK_END) != 0) {
+        perror(file);
+        return 1;
+      }
+      size = ftell(fp);
+      fclose(fp);
+    }
+    snprintf(command, sizeof(command), "cat '%s'", file);
+    bench(cthelper, "cat", command, size, runs);
+    if (file == tmp)
+      unlink(tmp);
+  }
+  return 0;
+}
@@ -31,8 +31,13 @@
 #define pty_fork forkpty
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "cthelper.h"
 #include "buffer.h"
+#include "pump.h"
 #include "message.h"
 
 #include "debug.h"
@@ -42,6 +47,7 @@ enum {
   CTLBUF = 32,
   PTOBUF = 256,
   PTIBUF = 256,
+  PUMPMAX = 1024 * 1024, /* most a Pump will hold */
 };
 
 static int
@@ -484,111 +490,17 @@ static void restore(void)
 
 #define obligatory_max(a,b) ((a)>(b)?(a):(b))
 
-int
-main(int argc, char *const *argv)
+/* The portable loop: select() on the descriptors, and copy through small
+ * fixed buffers */
+static void
+select_loop(int c, int s)
 {
-  int
-    c,      /* control descriptor (stdin) */
-    s;      /* socket descriptor (PuTTY) */
   Buffer
     cbuf,   /* control buffer */
     pbuf,   /* pty buffer */
     sbuf;   /* socket buffer */
 
-  DBUG_INIT_ENV("main",argv[0],"DBUG_OPTS");
-
-#ifndef DBUG_OFF
-  setvbuf(DBUG_FILE, 0, _IONBF, 0);
-#endif
-
-  /* General steps:
-    1. connect to cygterm backend
-    2. create pty
-    3. fork child process (/bin/bash)
-    4. select on pty, cygterm backend forwarding pty data and messages
-  */
-
-  if (argc < 4) {
-    DBUG_PRINT("error", ("Too few arguments"));
-    DBUG_RETURN(CthelperInvalidUsage);
-  }
-
-  DBUG_PRINT("startup", ("isatty: (%d,%d,%d)",
-    isatty(STDIN_FILENO), isatty(STDOUT_FILENO), isatty(STDERR_FILENO)));
-  DBUG_PRINT("startup", (
-    "cmdline: [%s] %s %s %s ...", argv[0], argv[1], argv[2], argv[3]));
-  {
-    extern char **environ;
-    char **envp;
-    for (envp = environ; *envp; envp++)
-      DBUG_PRINT("startup", ("%s", *envp));
-  }
-
-  /* It is not necessary to close all open descriptors.  There are no
-   * files inherited from the PuTTY process except standard input.
-   */
-#ifndef DEBUG
-  close(STDERR_FILENO);
-#endif
-
-  /* Duplicate c and open /dev/null as 0 so that 0 can mean "closed". */
-  c = dup(STDIN_FILENO); close(STDIN_FILENO);
-  open("/dev/null", O_RDWR);
-
-  /* Command line:
-   * argv[1] =  port number
-   * argv[2] =  terminal name
-   * argv[3] =  terminal characteristics string
-   * Any remaining arguments are the command to execute.  If there are no
-   * other arguments, use the user's default login shell with a - prefix
-   * for its argv[0].
-   */
-/*
-cthelper command line parameters:
-
-cthelper PORT TERM ATTRS [COMMAND [ARGS]]
-
-    PORT
-        port number for PuTTY pty input data socket
-    TERM
-        name of terminal (set TERM environment variable)
-    ATTRS
-    a colon-separated list of terminal attributes
-    See init_pty() for details.
-    COMMAND
-        Runs COMMAND with ARGS as child process.  If COMMAND is not
-        supplied, cthelper will run the user's login shell as specified in
-        /etc/passwd specifying "-" for its argv[0] as typical.
-*/
-
-
-  /* connect to cygterm */
-  {
-    int ct_port = strtol(argv[1], 0, 0);
-#ifdef DEBUG
-    if (ct_port == 0) {
-      /* For debugging purposes, make the tty we are started
-       * in the "socket". This allows to test cthelper without
-       * putty.exe */
-      assert(isatty(STDOUT_FILENO));
-      raw();
-      atexit(restore);
-      c = open("/dev/null", O_RDONLY);
-      s = dup(STDOUT_FILENO);
-    }
-    else 
-#endif
-    if (ct_port <= 0) {
-      DBUG_PRINT("startup", ("invalid port"));
-      DBUG_RETURN(CthelperInvalidPort);
-    }
-    DBUG_PRINT("startup", ("connect cygterm"));
-    if (0 > (s = connect_cygterm(ct_port))) {
-      DBUG_PRINT("startup", ("connect_cygterm: bad"));
-      DBUG_RETURN(CthelperConnectFailed);
-    }
-    DBUG_PRINT("startup", ("OK"));
-  }
+  DBUG_ENTER("select_loop");
 
   /* initialize buffers */
   DBUG_PRINT("startup", ("initialize buffers"));
@@ -596,38 +508,6 @@ cthelper PORT TERM ATTRS [COMMAND [ARGS]]
   BUFFER_ALLOCA(pbuf, PTOBUF);
   BUFFER_ALLOCA(sbuf, PTIBUF);
 
-  /* set up signal handling */
-  signal(SIGCHLD, handle_sigchld);
-
-  /* start child process */
-  if (0 > (t = setup_child(&child, argv[2], argv[3], argv + 4))) {
-    DBUG_PRINT("startup", ("setup_child failed: %s", strerror(-t)));
-    DBUG_RETURN(CthelperPtyforkFailure);
-  }
-
-  /*  To explain what is happening here:
-   *  's' is the socket between PuTTY and cthelper; it is read to get
-   *  input for the tty and written to display output from the pty.
-   *  't' is the pseudo terminal; it is read to get pty input which is sent to
-   *  PuTTY and written to pass input from PuTTY to the pty.
-   *  'c' is standard input, which is a one-way anonymous pipe from PuTTY.
-   *  It is read to receive special messages from PuTTY such as
-   *  terminal resize events.
-   *
-   *  This is the flow of data through the buffers:
-   *      s => sbuf => t
-   *      t => pbuf => s
-   *      c => cbuf => process_message()
-   *
-   *  When 't' is closed, we close(s) to signal PuTTY we are done.
-   *  When 's' is closed, we kill(child, HUP) to kill the child process.
-   */
-
-  setnonblock(c);
-  setnonblock(s);
-  setnonblock(t);
-
-  DBUG_PRINT("info", ("c==%d, s==%d, t==%d", c, s, t));
   /* allow easy select() and FD_ISSET() stuff */
   assert(0 < c && c < s && s < t);
   DBUG_PRINT("startup", ("starting select loop"));
@@ -768,6 +648,342 @@ cthelper PORT TERM ATTRS [COMMAND [ARGS]]
     DBUG_LEAVE;
   }
   DBUG_PRINT("info", ("end of select loop"));
+  DBUG_VOID_RETURN;
+}
+
+#ifdef __linux__
+/* Change what epoll watches a descriptor for, if it needs changing.  A
+ * descriptor we want nothing from is taken out of the set altogether,
+ * because epoll reports a hangup whatever it was asked to watch for, and
+ * a pty whose child has gone would otherwise wake us up until we were
+ * ready to read from it again. */
+static void
+watch(int ep, int d, unsigned int *now, unsigned int want)
+{
+  struct epoll_event ev;
+
+  if (*now == want)
+    return;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = want;
+  ev.data.fd = d;
+  if (!want)
+    epoll_ctl(ep, EPOLL_CTL_DEL, d, &ev);
+  else if (0 != epoll_ctl(ep, *now ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, d, &ev))
+    DBUG_PRINT("error", ("epoll_ctl(%d): %s", d, strerror(errno)));
+  *now = want;
+}
+
+/* Stop watching a descriptor and close it.  (Closing it isn't enough by
+ * itself when it's been dup()ed, as stdout is in the debugging mode.) */
+static void
+unwatch(int ep, int *d, unsigned int *now)
+{
+  watch(ep, *d, now, 0);
+  close(*d);
+  *d = 0;
+}
+
+/* The Linux loop: the same job as select_loop(), but with epoll, and with
+ * the data between the pty and the socket going through Pumps, which
+ * splice() it where they can and otherwise read and write it in large
+ * chunks.  Set CTHELPER_PUMP=select in the environment to use
+ * select_loop() instead. */
+static void
+epoll_loop(int c, int s)
+{
+  int ep;
+  unsigned int cw = 0, sw = 0, tw = 0; /* what each is watched for */
+  int shut = 0;
+  Buffer cbuf;  /* control buffer */
+  Pump
+    in,         /* s => in => t */
+    out;        /* t => out => s */
+
+  DBUG_ENTER("epoll_loop");
+
+  if (0 > (ep = epoll_create1(EPOLL_CLOEXEC))) {
+    DBUG_PRINT("error", ("epoll_create1: %s", strerror(errno)));
+    select_loop(c, s);
+    DBUG_VOID_RETURN;
+  }
+  BUFFER_ALLOCA(cbuf, CTLBUF);
+  in = pump_init(PUMPMAX);
+  out = pump_init(PUMPMAX);
+
+  DBUG_PRINT("startup", ("starting epoll loop"));
+  while (s || t) {
+    struct epoll_event ev[3];
+    unsigned int cr = 0, sr = 0, tr = 0; /* what each is ready for */
+    int i, n;
+    ssize_t r;
+
+    DBUG_ENTER("epoll");
+    watch(ep, c, &cw, c && !buffer_isfull(cbuf) ? EPOLLIN : 0);
+    watch(ep, s, &sw, !s ? 0 :
+      (pump_isfull(in) ? 0 : EPOLLIN) | (pump_isempty(out) ? 0 : EPOLLOUT));
+    watch(ep, t, &tw, !t ? 0 :
+      (pump_isfull(out) ? 0 : EPOLLIN) | (pump_isempty(in) ? 0 : EPOLLOUT));
+
+    switch (n = epoll_wait(ep, ev, 3, -1)) {
+    case -1:
+      DBUG_PRINT("error", ("%s", strerror(errno)));
+      if (errno != EINTR) {
+        /* Something bad happened */
+        if (c) unwatch(ep, &c, &cw);
+        if (s) unwatch(ep, &s, &sw);
+        if (t) unwatch(ep, &t, &tw);
+      }
+      break;
+    default:
+      for (i = 0; i < n; i++) {
+        if (ev[i].data.fd == c) cr = ev[i].events;
+        else if (ev[i].data.fd == s) sr = ev[i].events;
+        else if (ev[i].data.fd == t) tr = ev[i].events;
+      }
+      DBUG_PRINT("info", ("%d ready descriptors [[c==%x,s==%x,t==%x]]",
+        n, cr, sr, tr));
+
+      if (cr) {
+        DBUG_ENTER("c=>cbuf");
+        switch (buffer_read(cbuf, c)) {
+        case -1:
+          DBUG_PRINT("error", ("error reading c: %s", strerror(errno)));
+          if (errno == EINTR || errno == EAGAIN) break;
+          /*FALLTHRU*/
+        case 0:
+          /* PuTTY closed the message pipe */
+          DBUG_PRINT("io", ("c closed"));
+          unwatch(ep, &c, &cw);
+          break;
+        default:
+          DBUG_PRINT("io", ("cbuf => process_message()"));
+          process_message(cbuf, t);
+          break;
+        }
+        DBUG_LEAVE;
+      }
+      if (sr & ~EPOLLOUT) {
+        DBUG_ENTER("s=>in");
+        if (0 == (r = pump_fill(in, s))
+            || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+          /* PuTTY closed the socket */
+          DBUG_PRINT("io", ("s closed"));
+          unwatch(ep, &s, &sw);
+        }
+        DBUG_LEAVE;
+      }
+      if (tr & ~EPOLLOUT) {
+        char junk[4096];
+        DBUG_ENTER("t=>out");
+        /* with the socket gone, there's nowhere for pty output to go, but
+         * it has to be read for the pty to report the child's exit */
+        r = s ? pump_fill(out, t) : read(t, junk, sizeof(junk));
+        if (r == 0 || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+          /* pty closed */
+          DBUG_PRINT("io", ("t closed"));
+          unwatch(ep, &t, &tw);
+        }
+        DBUG_LEAVE;
+      }
+      break;
+    }
+
+    /* Write what we have now, rather than waiting to be told we can: the
+     * descriptor is almost always ready, and this saves a trip round the
+     * loop for every read. */
+    if (t && !pump_isempty(in)) {
+      DBUG_ENTER("in=>t");
+      r = pump_flush(in, t);
+      if (r == 0 || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+        /* pty closed */
+        DBUG_PRINT("io", ("t closed"));
+        unwatch(ep, &t, &tw);
+      }
+      DBUG_LEAVE;
+    }
+    if (s && !pump_isempty(out)) {
+      DBUG_ENTER("out=>s");
+      r = pump_flush(out, s);
+      if (r == 0 || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+        /* PuTTY closed the socket */
+        DBUG_PRINT("io", ("s closed"));
+        unwatch(ep, &s, &sw);
+      }
+      DBUG_LEAVE;
+    }
+
+    if (child_signalled) check_child();
+
+    if (!t && s && !shut && pump_isempty(out)) {
+      DBUG_PRINT("info", ("shutdown socket"));
+      shutdown(s, SHUT_WR);
+      shut = 1;
+    }
+
+    if (!s && (!t || pump_isempty(in)) && child_alive()) {
+      DBUG_PRINT("sig", ("kill child"));
+      kill(child, SIGHUP);
+      /* handle_sigchld() will close(t) */
+    }
+    DBUG_LEAVE;
+  }
+  DBUG_PRINT("info", ("end of epoll loop"));
+
+  pump_free(&in);
+  pump_free(&out);
+  close(ep);
+  DBUG_VOID_RETURN;
+}
+#endif
+
+int
+main(int argc, char *const *argv)
+{
+  int
+    c,      /* control descriptor (stdin) */
+    s;      /* socket descriptor (PuTTY) */
+
+  DBUG_INIT_ENV("main",argv[0],"DBUG_OPTS");
+
+#ifndef DBUG_OFF
+  setvbuf(DBUG_FILE, 0, _IONBF, 0);
+#endif
+
+  /* General steps:
+    1. connect to cygterm backend
+    2. create pty
+    3. fork child process (/bin/bash)
+    4. select on pty, cygterm backend forwarding pty data and messages
+  */
+
+  if (argc < 4) {
+    DBUG_PRINT("error", ("Too few arguments"));
+    DBUG_RETURN(CthelperInvalidUsage);
+  }
+
+  DBUG_PRINT("startup", ("isatty: (%d,%d,%d)",
+    isatty(STDIN_FILENO), isatty(STDOUT_FILENO), isatty(STDERR_FILENO)));
+  DBUG_PRINT("startup", (
+    "cmdline: [%s] %s %s %s ...", argv[0], argv[1], argv[2], argv[3]));
+  {
+    extern char **environ;
+    char **envp;
+    for (envp = environ; *envp; envp++)
+      DBUG_PRINT("startup", ("%s", *envp));
+  }
+
+  /* It is not necessary to close all open descriptors.  There are no
+   * files inherited from the PuTTY process except standard input.
+   */
+#ifndef DEBUG
+  close(STDERR_FILENO);
+#endif
+
+  /* Duplicate c and open /dev/null as 0 so that 0 can mean "closed". */
+  c = dup(STDIN_FILENO); close(STDIN_FILENO);
+  open("/dev/null", O_RDWR);
+
+  /* Command line:
+   * argv[1] =  port number
+   * argv[2] =  terminal name
+   * argv[3] =  terminal characteristics string
+   * Any remaining arguments are the command to execute.  If there are no
+   * other arguments, use the user's default login shell with a - prefix
+   * for its argv[0].
+   */
+/*
+cthelper command line parameters:
+
+cthelper PORT TERM ATTRS [COMMAND [ARGS]]
+
+    PORT
+        port number for PuTTY pty input data socket
+    TERM
+        name of terminal (set TERM environment variable)
+    ATTRS
+    a colon-separated list of terminal attributes
+    See init_pty() for details.
+    COMMAND
+        Runs COMMAND with ARGS as child process.  If COMMAND is not
+        supplied, cthelper will run the user's login shell as specified in
+        /etc/passwd specifying "-" for its argv[0] as typical.
+*/
+
+
+  /* connect to cygterm */
+  {
+    int ct_port = strtol(argv[1], 0, 0);
+#ifdef DEBUG
+    if (ct_port == 0) {
+      /* For debugging purposes, make the tty we are started
+       * in the "socket". This allows to test cthelper without
+       * putty.exe */
+      assert(isatty(STDOUT_FILENO));
+      raw();
+      atexit(restore);
+      c = open("/dev/null", O_RDONLY);
+      s = dup(STDOUT_FILENO);
+    }
+    else 
+#endif
+    if (ct_port <= 0) {
+      DBUG_PRINT("startup", ("invalid port"));
+      DBUG_RETURN(CthelperInvalidPort);
+    }
+    else {
+      DBUG_PRINT("startup", ("connect cygterm"));
+      if (0 > (s = connect_cygterm(ct_port))) {
+        DBUG_PRINT("startup", ("connect_cygterm: bad"));
+        DBUG_RETURN(CthelperConnectFailed);
+      }
+      DBUG_PRINT("startup", ("OK"));
+    }
+  }
+
+  /* set up signal handling */
+  signal(SIGCHLD, handle_sigchld);
+
+  /* start child process */
+  if (0 > (t = setup_child(&child, argv[2], argv[3], argv + 4))) {
+    DBUG_PRINT("startup", ("setup_child failed: %s", strerror(-t)));
+    DBUG_RETURN(CthelperPtyforkFailure);
+  }
+
+  /*  To explain what is happening here:
+   *  's' is the socket between PuTTY and cthelper; it is read to get
+   *  input for the tty and written to display output from the pty.
+   *  't' is the pseudo terminal; it is read to get pty input which is sent to
+   *  PuTTY and written to pass input from PuTTY to the pty.
+   *  'c' is standard input, which is a one-way anonymous pipe from PuTTY.
+   *  It is read to receive special messages from PuTTY such as
+   *  terminal resize events.
+   *
+   *  This is the flow of data through the buffers:
+   *      s => sbuf => t
+   *      t => pbuf => s
+   *      c => cbuf => process_message()
+   *
+   *  When 't' is closed, we close(s) to signal PuTTY we are done.
+   *  When 's' is closed, we kill(child, HUP) to kill the child process.
+   */
+
+  setnonblock(c);
+  setnonblock(s);
+  setnonblock(t);
+
+  DBUG_PRINT("info", ("c==%d, s==%d, t==%d", c, s, t));
+#ifdef __linux__
+  {
+    const char *pump = getenv("CTHELPER_PUMP");
+    if (pump && 0 == strcmp(pump, "select"))
+      select_loop(c, s);
+    else
+      epoll_loop(c, s);
+  }
+#else
+  select_loop(c, s);
+#endif
 
   /* ensure child process killed */
   /* XXX I'm not sure if all of this is necessary, but it probably won't
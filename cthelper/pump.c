@@ -0,0 +1,193 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* for splice() and F_SETPIPE_SZ */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "pump.h"
+#include "debug.h"
+
+/* Size of a pump's Buffer to begin with */
+enum { PUMPBUF = 4096 };
+
+Pump
+pump_init(size_t max)
+{
+  Pump p;
+
+  DBUG_ENTER("pump_init");
+  p = (Pump)malloc(sizeof(struct pump_tag));
+  assert(p);
+  p->pipe[0] = p->pipe[1] = -1;
+  p->inpipe = p->pipesize = 0;
+  p->buf = 0;
+  p->off = 0;
+  p->max = max < PUMPBUF ? PUMPBUF : max;
+
+#ifdef __linux__
+  if (0 == pipe2(p->pipe, O_NONBLOCK | O_CLOEXEC)) {
+    int size;
+    /* the default pipe is 64K; ask for more, and take what we're given */
+    fcntl(p->pipe[1], F_SETPIPE_SZ, (int)p->max);
+    if (0 < (size = fcntl(p->pipe[1], F_GETPIPE_SZ)))
+      p->pipesize = size;
+    else {
+      close(p->pipe[0]); close(p->pipe[1]);
+      p->pipe[0] = p->pipe[1] = -1;
+    }
+  }
+  else
+    p->pipe[0] = p->pipe[1] = -1;
+#endif
+
+  if (p->pipe[0] < 0)
+    p->buf = buffer_init(PUMPBUF);
+  DBUG_PRINT("pump", ("pipe %d, max %u", p->pipe[0], (unsigned)p->max));
+  DBUG_RETURN(p);
+}
+
+void
+pump_free(Pump *pp)
+{
+  DBUG_ENTER("pump_free");
+  assert(pp);
+  if (*pp) {
+    if ((*pp)->pipe[0] >= 0) {
+      close((*pp)->pipe[0]);
+      close((*pp)->pipe[1]);
+    }
+    if ((*pp)->buf)
+      buffer_free(&(*pp)->buf);
+    free(*pp);
+  }
+  *pp = 0;
+  DBUG_VOID_RETURN;
+}
+
+#ifdef __linux__
+/* splice() doesn't work on everything (on ttys it depends on the kernel
+ * version), so the first time it refuses, move whatever is in the pipe into
+ * a Buffer and use that from then on. */
+static void
+pump_unsplice(Pump p)
+{
+  ssize_t n;
+
+  DBUG_ENTER("pump_unsplice");
+  DBUG_PRINT("pump", ("can't splice: using a buffer"));
+  p->buf = buffer_init(p->inpipe > PUMPBUF ? p->inpipe : PUMPBUF);
+  while (p->inpipe > 0 && (n = buffer_read(p->buf, p->pipe[0])) > 0)
+    p->inpipe -= n;
+  close(p->pipe[0]); close(p->pipe[1]);
+  p->pipe[0] = p->pipe[1] = -1;
+  p->inpipe = 0;
+  DBUG_VOID_RETURN;
+}
+#endif
+
+ssize_t
+pump_fill(Pump p, int d)
+{
+  ssize_t n, total;
+  Buffer b;
+
+  DBUG_ENTER("pump_fill");
+  total = 0;
+  n = -1;
+  errno = EAGAIN;
+
+#ifdef __linux__
+  while (p->pipe[0] >= 0 && p->inpipe < p->pipesize) {
+    n = splice(d, 0, p->pipe[1], 0, p->pipesize - p->inpipe,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      DBUG_PRINT("io", ("spliced in %4d", (int)n));
+      p->inpipe += n;
+      total += n;
+    }
+    else if (n < 0 && errno == EINVAL)
+      pump_unsplice(p);
+    else
+      break;
+  }
+  if (p->pipe[0] >= 0)
+    DBUG_RETURN(total ? total : n);
+#endif
+
+  for (;;) {
+    b = p->buf;
+    if (buffer_isfull(b)) {
+      if (p->off > 0) {
+        /* make room by moving what's left to the front */
+        buffer_consumed(b, p->off);
+        p->off = 0;
+      }
+      else if (buffer_size(b) < p->max) {
+        /* the reader is keeping up with us: read more at a time */
+        size_t size = buffer_size(b) * 2;
+        buffer_resize(&p->buf, size < p->max ? size : p->max);
+        b = p->buf;
+        DBUG_PRINT("pump", ("buffer grown to %u", (unsigned)buffer_size(b)));
+      }
+      else
+        break;
+    }
+    if ((n = buffer_read(b, d)) <= 0)
+      break;
+    total += n;
+    if (!buffer_isfull(b))
+      break; /* short read: there's nothing more waiting */
+  }
+  DBUG_RETURN(total ? total : n);
+}
+
+ssize_t
+pump_flush(Pump p, int d)
+{
+  ssize_t n, total;
+  Buffer b;
+
+  DBUG_ENTER("pump_flush");
+  total = 0;
+  n = -1;
+  errno = EAGAIN;
+
+#ifdef __linux__
+  while (p->pipe[0] >= 0 && p->inpipe > 0) {
+    n = splice(p->pipe[0], 0, d, 0, p->inpipe,
+               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      DBUG_PRINT("io", ("spliced out %4d", (int)n));
+      p->inpipe -= n;
+      total += n;
+    }
+    else if (n < 0 && errno == EINVAL)
+      pump_unsplice(p);
+    else
+      break;
+  }
+  if (p->pipe[0] >= 0)
+    DBUG_RETURN(total ? total : n);
+#endif
+
+  b = p->buf;
+  while (b->len > p->off) {
+    if ((n = write(d, &b->data[p->off], b->len - p->off)) <= 0)
+      break;
+    DBUG_PRINT("io", ("wrote %4d", (int)n));
+    p->off += n;
+    total += n;
+  }
+  if (p->off == b->len) {
+    b->avail += b->len;
+    b->len = 0;
+    p->off = 0;
+  }
+  DBUG_RETURN(total ? total : n);
+}
@@ -0,0 +1,54 @@
+#ifndef PUMP_H
+#define PUMP_H
+
+#include <sys/types.h>
+
+#include "buffer.h"
+
+/* A Pump moves data one way between two non-blocking descriptors.
+ *
+ * Where the kernel allows it, data goes from one descriptor to the
+ * other with splice() through a pipe, without being copied into this
+ * process at all.  Otherwise it goes through a Buffer, which starts
+ * small and grows, up to the size given to pump_init(), whenever a read
+ * fills it, so that a busy descriptor is read and written in large
+ * chunks.  Either way, pump_fill() reads everything that is waiting
+ * before pump_flush() writes it out in one go.
+ *
+ * Only Linux has splice(); elsewhere a Pump always uses a Buffer.
+ */
+typedef struct pump_tag *Pump;
+struct pump_tag {
+  int pipe[2];      /* splice() goes through here; -1 if not splicing */
+  size_t inpipe;    /* bytes waiting in the pipe */
+  size_t pipesize;  /* capacity of the pipe */
+  Buffer buf;       /* or the data waits here, from `off' on */
+  size_t off;
+  size_t max;       /* largest the Buffer may grow */
+};
+
+/* Initialize a Pump that holds at most `max' bytes */
+Pump pump_init(size_t max);
+
+/* Free a pump; sets *pp to NULL */
+void pump_free(Pump *pp);
+
+/* Returns true if the pump can't take any more */
+#define pump_isfull(p) ((p)->pipe[0] >= 0 ? \
+  (p)->inpipe == (p)->pipesize : \
+  (p)->off == 0 && buffer_isfull((p)->buf) && buffer_size((p)->buf) == (p)->max)
+
+/* Returns true if the pump is empty */
+#define pump_isempty(p) ((p)->pipe[0] >= 0 ? \
+  (p)->inpipe == 0 : (p)->buf->len == (p)->off)
+
+/* Reads everything available from descriptor `des', as far as there is
+ * room.  Returns the number of bytes read if any, otherwise 0 at end of
+ * file or -1 with errno set (EAGAIN if there was nothing to read) */
+ssize_t pump_fill(Pump p, int des);
+
+/* Writes as much of the pump's contents as possible to descriptor `des'.
+ * Returns as pump_fill() does */
+ssize_t pump_flush(Pump p, int des);
+
+#endif /* PUMP_H */
@@ -206,6 +206,7 @@ void save_open_settings_forced(char *filename, Conf *conf) {
 #endif
 		    );
     write_setting_i_forced(sesskey, "ScrollbackLines", conf_get_int(conf, CONF_savelines));
+    write_setting_i_forced(sesskey, "ScrollbackMemory", conf_get_int(conf, CONF_scrollback_memory));
     write_setting_b_forced(sesskey, "DECOriginMode", conf_get_bool(conf, CONF_dec_om));
     write_setting_b_forced(sesskey, "AutoWrapMode", conf_get_bool(conf, CONF_wrap_mode));
     write_setting_b_forced(sesskey, "LFImpliesCR", conf_get_bool(conf, CONF_lfhascr));
@@ -798,6 +799,7 @@ void load_open_settings_forced(char *filename, Conf *conf) {
 #else
     gppi_forced(sesskey, "ScrollbackLines", 2000, conf, CONF_savelines);
 #endif
+    gppi_forced(sesskey, "ScrollbackMemory", 0, conf, CONF_scrollback_memory);
     gppb_forced(sesskey, "DECOriginMode", false, conf, CONF_dec_om);
     gppb_forced(sesskey, "AutoWrapMode", true, conf, CONF_wrap_mode);
     gppb_forced(sesskey, "LFImpliesCR", false, conf, CONF_lfhascr);
@@ -466,257 +466,22 @@ void SaveDumpPortableConfig( FILE * fp ) {
 }
 
 
-HSettingsItem SettingsNewItem( const char * name, const char * value ) {
-	if( name==NULL ) return NULL ; 
-	HSettingsItem NewItem = malloc( sizeof( SettingsItem ) ) ;
-	NewItem->pNext = NULL ;
-	NewItem->pPrevious = NULL ;
-	NewItem->name = malloc( strlen(name) + 1 ) ; strcpy( NewItem->name, name ) ;
-	if( value == NULL ) { 
-		NewItem->value = NULL ;
-	} else {
-		NewItem->value = malloc( strlen(value) + 1 ) ; strcpy( NewItem->value, value ) ;
-	}
-	return NewItem ;
-}
-
-HSettingsList SettingsInit() {
-	HSettingsList list = (HSettingsList)malloc( sizeof(SettingsList) ) ;
-	list->filename = NULL ;
-	list->num = 0 ;
-	list->first = NULL ;
-	list->last = NULL ;
-	return list ;
-}
-
 HSettingsList PortableSettings ;
 
-void SettingsDelItem( HSettingsList list, const char * key ) {
-	if( list != NULL ) {
-		HSettingsItem current = list->first ;
-		while( current != NULL ) {
-			if( current->name != NULL ) {
-				if( !strcmp( current->name, key ) ) {
-					if( current->value != NULL ) { free( current->value ) ; current->value = NULL ; }
-					free( current->name ) ; current->name = NULL ;
-					if( current->pPrevious != NULL ) { 
-						current->pPrevious->pNext = current->pNext ;
-					} else {
-						list->first = current->pNext ;
-					}
-					if( current->pNext != NULL )	{
-						current->pNext->pPrevious = current->pPrevious ;
-					} else {
-						list->last = current->pPrevious ;
-					}
-				} 
-			}
-			current = current->pNext ;
-		}
-	}
-}
-
-void SettingsAddItem( HSettingsList list, const char * name, const char * value ) {
-	if( list!=NULL ) {
-		HSettingsItem NewItem = SettingsNewItem( name, value ) ;
-		if( NewItem != NULL ) {
-			HSettingsItem current = list->last ;
-			if( current == NULL ) {
-				list->first = NewItem ;
-				NewItem->pNext = NULL ;
-				NewItem->pPrevious = NULL ;
-			} else {
-				SettingsDelItem( list, name ) ;
-				current->pNext = NewItem ;
-				NewItem->pPrevious = current ;
-			}
-			list->last = NewItem ;
-			list->num = list->num + 1 ;
-		}
-	}
-}
-
-void SettingsFreeItem( HSettingsItem item ) {
-	if( item != NULL ) {
-//debug_log("%s=%s\n",item->name,item->value);
-		if( item->value != NULL ) { free( item->value ) ; item->value = NULL ; } // POURQUOI CA PLANTE ???
-		if( item->name != NULL ) { free( item->name ) ; item->name = NULL ; }
-		item->pPrevious = NULL ;
-		item->pNext = NULL ;
-		free( item ) ;
-	}
-}
-
-void SettingsFree( HSettingsList list ) {
-	if( list != NULL ) {
-		HSettingsItem current = list->first, next ;
-		if( current != NULL ) {
-			while( current != NULL ) {
-				next = current->pNext ;
-				SettingsFreeItem( current ) ;
-				current = next ;
-			} 
-		}
-		list->first = NULL ;
-		list->last = NULL ;
-		if( list->filename != NULL ) { free( list->filename ) ; list->filename = NULL ; }
-		list->num = 0 ;
-		free( list ) ;
-	}
-}
-
-char * SettingsKey( HSettingsList list, const char * key ) {
-	if( list != NULL ) {
-		HSettingsItem current = list->first ;
-		while( current != NULL ) {
-			if( current->name != NULL ) {
-				if( !strcmp( current->name, key ) ) return current->value ;
-			}
-			current = current->pNext ;
-		}
-	}
-	return NULL ;
-}
-
-char * SettingsKey_str( HSettingsList list, const char * key ) {
-	if( list != NULL ) {
-		HSettingsItem current = list->first ;
-		while( current != NULL ) {
-			if( current->name != NULL ) {
-				if( !strcmp( current->name, key ) ) {
-					return dupstr( current->value ) ;
-				}
-			}
-			current = current->pNext ;
-		}
-	}
-	return NULL ;
-}
-
-int SettingsKey_int( HSettingsList list, const char * key, const int defvalue ) {
-	if( list != NULL ) {
-		HSettingsItem current = list->first ;
-		while( current != NULL ) {
-			if( current->name != NULL ) {
-				if( !strcmp( current->name, key ) ) {
-					return atoi( current->value ) ;
-				}
-			}
-			current = current->pNext ;
-		}
-	}
-	return defvalue ;
-}
-
-void SettingsLoad( HSettingsList list, const char * filename ) {
-	FILE * fp ;
-	char *buffer;
-	int p ;
-	
-//debug_log("filename=%s|\n",filename); int i=0;
-	
-	if( (fp=fopen(filename,"rb")) != NULL ) {
-		list->filename = (char*) malloc( strlen(filename)+1 ) ; strcpy( list->filename, filename ) ;
-		buffer = (char*)malloc(4096*sizeof(char)) ;
-		while( fgets(buffer,4096,fp) != NULL ) {
-//debug_log("\nline %05d[%d]: %s|\n",++i,strlen(buffer),buffer);
-			while( buffer[strlen(buffer)-1]!='\n' ) {
-				buffer = realloc( buffer, strlen(buffer) + 4096 ) ;
-				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
-//debug_log("\nline %05d[%d]: %s|\n",++i,strlen(buffer),buffer);
-			}
-
-			char *name, *value, *value2 ;
-			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
-//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
-//debug_log("\t-2=%c -3=%c\n",buffer[strlen(buffer)-2],buffer[strlen(buffer)-3]);
-			while( buffer[strlen(buffer)-1]!='\\' ) {
-//debug_log("ici\n");
-				while( buffer[strlen(buffer)-1]=='\r' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'r' ; }
-				while( buffer[strlen(buffer)-1]=='\n' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'n' ; }
-				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
-				while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
-			}
-//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
-			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
-//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
-			if( buffer[strlen(buffer)-1] != '\\' ) { strcat( buffer, "\\" ) ; }
-//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
-			p = poss( "\\", buffer ) ;
-			if( p>1 ) {
-				name = (char*) malloc( p+1 ) ;
-				memcpy( name, buffer, p-1 ) ; name[p-1]='\0' ;
-				value = (char*) malloc( strlen(buffer)-p+1 ) ;
-				strcpy( value, buffer+p ) ;
-				value[strlen(value)-1]='\0' ;
-//debug_log("line %05d: %s|%s|\n",i,name,value);
-				value2 = (char*) malloc( strlen(value)+1 ) ;
-				unmungestr( value, value2, strlen(value)+1 ) ;
-//debug_log("line %05d: %s|%s|%s|\n",i,name,value,value2);
-				SettingsAddItem( list, name, value2 ) ;
-				free( value2 ) ;
-				free( value ) ;
-				free( name ) ;
-			}
-		}
-		free(buffer) ;
-		fclose(fp );
-	} else {
-		//if( strcmp(filename,"Default%20Settings") ) MessageBox(NULL,"Unable to open session file", "Error", MB_OK);
-		errorShow( "Unable to read session file", filename ) ;
-	}
-}
-
-void SettingsSave( HSettingsList list, const char * filename ) {
-	FILE * fp ;
-	char buffer[4096] ;
-	
-	if( (fp=fopen(filename,"wb")) != NULL ) {
-		if( list != NULL ) {
-			HSettingsItem current = list->first ;
-			while( current != NULL ) {
-				if( current->name != NULL ) {
-					if( current->value == NULL ) {
-						sprintf( buffer, "%s\\\\\n", current->value ) ;
-					} else {
-						char * p = (char*) malloc( 3*strlen(current->value)+1 ) ;
-						mungestr( current->value, p ) ;
-						sprintf( buffer, "%s\\%s\\\n", current->name, p ) ;
-						free( p ) ;
-					}
-					fputs( buffer, fp ) ;
-					fflush( fp ) ;
-				}
-				current = current->pNext ;
-			}
-		}
-		fclose(fp);
-	} else {
-		errorShow( "Unable to write session file", filename ) ;
-	}
-}
-
+#include "kitty_store_list.c"
 
 /*
 void SettingsPrint( HSettingsList list ) {
 	if( list != NULL ) {
 		debug_log( "->filename=%s\n", list->filename ) ;
 		debug_log( "->num=%d\n", list->num ) ;
-		debug_log( "->first=%ld\n", list->first ) ;
-		debug_log( "->last=%ld\n", list->last ) ;
-		HSettingsItem current = list->first ;
-		while( current != NULL ) {
-			if( current->name !=NULL ) {
-				if( current->value !=NULL ) { debug_log( "%s=%s\n", current->name, current->value ) ;
-				} else { debug_log( "%s=NULL\n", current->name ) ;
-				}
+		int i ;
+		for( i = 0 ; i < list->nitems ; i++ ) {
+			HSettingsItem current = list->items[i] ;
+			if( current == NULL ) { debug_log( "[%d] deleted\n", i ) ; continue ; }
+			if( current->value !=NULL ) { debug_log( "%s=%s\n", current->name, current->value ) ;
+			} else { debug_log( "%s=NULL\n", current->name ) ;
 			}
-			debug_log("	current=%ld\n", current );
-			if( current->pPrevious == NULL ) { debug_log( "	previous=NULL\n" ) ; }
-			else { debug_log( "	previous=%ld\n", current->pPrevious ) ; }
-			if( current->pNext == NULL ) { debug_log( "	next=NULL\n" ) ; }
-			else { debug_log( "	next=%ld\n", current->pNext ) ; }
-			current = current->pNext ;
 		}
 	}
 	debug_log( "NULL\n\n" ) ;
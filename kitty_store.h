@@ -31,38 +31,10 @@ extern char sshkpath[2 * MAX_PATH] ;
 extern char keysuffix[16] ;
 extern char jumplistpath[2 * MAX_PATH] ;
 
-struct SettingsItem {
-	char * name ;
-	char * value ;
-	struct SettingsItem * pNext ; 
-	struct SettingsItem * pPrevious ; 
-} ;
-typedef struct SettingsItem SettingsItem, *HSettingsItem ;
-
-struct SettingsList {
-	char * filename ;
-	int num ;
-	HSettingsItem first ;
-	HSettingsItem last ;
-} ;
-typedef struct SettingsList SettingsList, *HSettingsList;
+#include "kitty_store_list.h"
 
 extern HSettingsList PortableSettings ;
 
-HSettingsItem SettingsNewItem( const char * name, const char * value ) ;
-void SettingsFreeItem( HSettingsItem item ) ;
-
-HSettingsList SettingsInit() ;
-void SettingsDelItem( HSettingsList list, const char * key ) ;
-void SettingsAddItem( HSettingsList list, const char * name, const char * value ) ;
-void SettingsFree( HSettingsList list ) ;
-char * SettingsKey( HSettingsList list, const char * key ) ;
-char * SettingsKey_str( HSettingsList list, const char * key ) ;
-int SettingsKey_int( HSettingsList list, const char * key, const int defvalue ) ;
-
-void SettingsLoad( HSettingsList list, const char * filename ) ;
-void SettingsSave( HSettingsList list, const char * filename ) ;
-
 int loadPath() ;
 char * SetInitialSessPath( void ) ;
 char * GetSessPath( void ) ;
@@ -0,0 +1,428 @@
+/* kitty_store_bench.c
+
+ time loading and saving portable session files, with the SettingsList of
+ kitty_store_list.c and with the linked list that came before it
+
+ build (in this directory):  gcc -O2 -o kitty_store_bench kitty_store_bench.c
+ usage: kitty_store_bench [-n sessions] [-k keys] [-d directory]
+
+ makes up the given number of sessions (default 3000), each with the given
+ number of keys (default 300, about what a real KiTTY session has), with
+ values that need munging as real ones do. Then, for each store:
+   save   - build each session's list and write its file
+   load   - read each file back and look up every key in it
+ the files are written to a scratch directory (default kitty_store_bench.d,
+ removed afterwards); both stores have to give back every value as saved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* What kitty_store_list.c needs from the rest of KiTTY: these do what the
+   ones in kitty_tools.c and kitty_commun.c do, which can't be built without
+   Windows */
+typedef unsigned long DWORD ;
+
+DWORD errorShow( const char* pcErrText, const char* pcErrParam ) {
+	fprintf( stderr, "%s: %s\n", pcErrText, pcErrParam ) ;
+	exit( 1 ) ;
+}
+
+char *dupstr( const char *s ) {
+	char *p = NULL ;
+	if( s ) { p = malloc( strlen(s) + 1 ) ; strcpy( p, s ) ; }
+	return p ;
+}
+
+int poss( const char * c, const char * ch ) {
+	char * cc ;
+	if( ( ch == NULL ) || ( c == NULL ) ) return -1 ;
+	cc = strstr( ch, c ) ;
+	if( cc == NULL ) return 0 ;
+	return (int) ( cc - ch ) + 1 ;
+}
+
+void mungestr( const char *in, char *out ) {
+	char hex[16] = "0123456789ABCDEF";
+	int candot = 0 ;
+	while( *in ) {
+		if( *in == ' ' || *in == '\\' || *in == '*' || *in == '?' ||
+			*in ==':' || *in =='/' || *in =='\"' || *in =='<' || *in =='>' || *in =='|' ||
+			*in == '%' || *in < ' ' || *in > '~' || (*in == '.'
+			&& !candot) ) {
+			*out++ = '%' ;
+			*out++ = hex[((unsigned char) *in) >> 4] ;
+			*out++ = hex[((unsigned char) *in) & 15] ;
+		} else {
+			*out++ = *in ;
+		}
+		in++ ;
+		candot = 1 ;
+	}
+	*out = '\0' ;
+	return ;
+}
+
+void unmungestr( const char *in, char *out, int outlen ) {
+	while (*in) {
+		if( *in == '%' && in[1] && in[2] ) {
+			int i, j ;
+			i = in[1] - '0' ;
+			i -= (i > 9 ? 7 : 0) ;
+			j = in[2] - '0' ;
+			j -= (j > 9 ? 7 : 0) ;
+			*out++ = (i << 4) + j ;
+			if( !--outlen )
+				return ;
+			in += 3	;
+		} else {
+			*out++ = *in++ ;
+			if( !--outlen )
+				return;
+		}
+	}
+	*out = '\0' ;
+	return ;
+}
+
+#include "kitty_store_list.h"
+#include "kitty_store_list.c"
+
+/* The store as it was before the hash table: a doubly linked list, which
+   every add (through its delete of any old item of that name) and every
+   lookup walks from the start. Kept as it was, apart from the names, and
+   from saving a NULL value, which wrote the value for the name */
+struct OldSettingsItem {
+	char * name ;
+	char * value ;
+	struct OldSettingsItem * pNext ;
+	struct OldSettingsItem * pPrevious ;
+} ;
+typedef struct OldSettingsItem OldSettingsItem, *HOldSettingsItem ;
+
+struct OldSettingsList {
+	char * filename ;
+	int num ;
+	HOldSettingsItem first ;
+	HOldSettingsItem last ;
+} ;
+typedef struct OldSettingsList OldSettingsList, *HOldSettingsList ;
+
+static HOldSettingsItem OldSettingsNewItem( const char * name, const char * value ) {
+	if( name==NULL ) return NULL ;
+	HOldSettingsItem NewItem = malloc( sizeof( OldSettingsItem ) ) ;
+	NewItem->pNext = NULL ;
+	NewItem->pPrevious = NULL ;
+	NewItem->name = malloc( strlen(name) + 1 ) ; strcpy( NewItem->name, name ) ;
+	if( value == NULL ) {
+		NewItem->value = NULL ;
+	} else {
+		NewItem->value = malloc( strlen(value) + 1 ) ; strcpy( NewItem->value, value ) ;
+	}
+	return NewItem ;
+}
+
+static HOldSettingsList OldSettingsInit( void ) {
+	HOldSettingsList list = (HOldSettingsList)malloc( sizeof(OldSettingsList) ) ;
+	list->filename = NULL ;
+	list->num = 0 ;
+	list->first = NULL ;
+	list->last = NULL ;
+	return list ;
+}
+
+static void OldSettingsDelItem( HOldSettingsList list, const char * key ) {
+	if( list != NULL ) {
+		HOldSettingsItem current = list->first ;
+		while( current != NULL ) {
+			if( current->name != NULL ) {
+				if( !strcmp( current->name, key ) ) {
+					if( current->value != NULL ) { free( current->value ) ; current->value = NULL ; }
+					free( current->name ) ; current->name = NULL ;
+					if( current->pPrevious != NULL ) {
+						current->pPrevious->pNext = current->pNext ;
+					} else {
+						list->first = current->pNext ;
+					}
+					if( current->pNext != NULL )	{
+						current->pNext->pPrevious = current->pPrevious ;
+					} else {
+						list->last = current->pPrevious ;
+					}
+				}
+			}
+			current = current->pNext ;
+		}
+	}
+}
+
+static void OldSettingsAddItem( HOldSettingsList list, const char * name, const char * value ) {
+	if( list!=NULL ) {
+		HOldSettingsItem NewItem = OldSettingsNewItem( name, value ) ;
+		if( NewItem != NULL ) {
+			HOldSettingsItem current = list->last ;
+			if( current == NULL ) {
+				list->first = NewItem ;
+				NewItem->pNext = NULL ;
+				NewItem->pPrevious = NULL ;
+			} else {
+				OldSettingsDelItem( list, name ) ;
+				current->pNext = NewItem ;
+				NewItem->pPrevious = current ;
+			}
+			list->last = NewItem ;
+			list->num = list->num + 1 ;
+		}
+	}
+}
+
+static void OldSettingsFree( HOldSettingsList list ) {
+	if( list != NULL ) {
+		HOldSettingsItem current = list->first, next ;
+		while( current != NULL ) {
+			next = current->pNext ;
+			if( current->value != NULL ) { free( current->value ) ; }
+			if( current->name != NULL ) { free( current->name ) ; }
+			free( current ) ;
+			current = next ;
+		}
+		if( list->filename != NULL ) { free( list->filename ) ; }
+		free( list ) ;
+	}
+}
+
+static char * OldSettingsKey( HOldSettingsList list, const char * key ) {
+	if( list != NULL ) {
+		HOldSettingsItem current = list->first ;
+		while( current != NULL ) {
+			if( current->name != NULL ) {
+				if( !strcmp( current->name, key ) ) return current->value ;
+			}
+			current = current->pNext ;
+		}
+	}
+	return NULL ;
+}
+
+static void OldSettingsLoad( HOldSettingsList list, const char * filename ) {
+	FILE * fp ;
+	char *buffer;
+	int p ;
+
+	if( (fp=fopen(filename,"rb")) != NULL ) {
+		list->filename = (char*) malloc( strlen(filename)+1 ) ; strcpy( list->filename, filename ) ;
+		buffer = (char*)malloc(4096*sizeof(char)) ;
+		while( fgets(buffer,4096,fp) != NULL ) {
+			while( buffer[strlen(buffer)-1]!='\n' ) {
+				buffer = realloc( buffer, strlen(buffer) + 4096 ) ;
+				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
+			}
+
+			char *name, *value, *value2 ;
+			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+			while( buffer[strlen(buffer)-1]!='\\' ) {
+				while( buffer[strlen(buffer)-1]=='\r' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'r' ; }
+				while( buffer[strlen(buffer)-1]=='\n' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'n' ; }
+				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
+				while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+			}
+			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+			if( buffer[strlen(buffer)-1] != '\\' ) { strcat( buffer, "\\" ) ; }
+			p = poss( "\\", buffer ) ;
+			if( p>1 ) {
+				name = (char*) malloc( p+1 ) ;
+				memcpy( name, buffer, p-1 ) ; name[p-1]='\0' ;
+				value = (char*) malloc( strlen(buffer)-p+1 ) ;
+				strcpy( value, buffer+p ) ;
+				value[strlen(value)-1]='\0' ;
+				value2 = (char*) malloc( strlen(value)+1 ) ;
+				unmungestr( value, value2, strlen(value)+1 ) ;
+				OldSettingsAddItem( list, name, value2 ) ;
+				free( value2 ) ;
+				free( value ) ;
+				free( name ) ;
+			}
+		}
+		free(buffer) ;
+		fclose(fp );
+	} else {
+		errorShow( "Unable to read session file", filename ) ;
+	}
+}
+
+static void OldSettingsSave( HOldSettingsList list, const char * filename ) {
+	FILE * fp ;
+	char buffer[4096] ;
+
+	if( (fp=fopen(filename,"wb")) != NULL ) {
+		if( list != NULL ) {
+			HOldSettingsItem current = list->first ;
+			while( current != NULL ) {
+				if( current->name != NULL ) {
+					if( current->value == NULL ) {
+						sprintf( buffer, "%s\\\\\n", current->name ) ;
+					} else {
+						char * p = (char*) malloc( 3*strlen(current->value)+1 ) ;
+						mungestr( current->value, p ) ;
+						sprintf( buffer, "%s\\%s\\\n", current->name, p ) ;
+						free( p ) ;
+					}
+					fputs( buffer, fp ) ;
+					fflush( fp ) ;
+				}
+				current = current->pNext ;
+			}
+		}
+		fclose(fp);
+	} else {
+		errorShow( "Unable to write session file", filename ) ;
+	}
+}
+
+/* The synthetic sessions: the same names in each, values that differ */
+static int nsessions = 3000, nkeys = 300 ;
+static char ** names ;
+
+static void make_names( void ) {
+	static const char * real[] = { "HostName", "PortNumber", "Protocol",
+		"UserName", "TerminalType", "Font", "Colour0", "Colour1",
+		"PortForwardings", "RemoteCommand", "Folder", "LogFileName" } ;
+	int i, nreal = sizeof(real) / sizeof(real[0]) ;
+	names = (char**) malloc( nkeys * sizeof(char*) ) ;
+	for( i = 0 ; i < nkeys ; i++ ) {
+		names[i] = (char*) malloc( 32 ) ;
+		if( i < nreal ) strcpy( names[i], real[i] ) ;
+		else sprintf( names[i], "Setting%04d", i ) ;
+	}
+}
+
+/* Paths, separators, spaces and dots, as munging has to deal with */
+static void make_value( char * buf, int session, int key ) {
+	switch( key % 4 ) {
+		case 0: sprintf( buf, "%d", session * 7 + key ) ; break ;
+		case 1: sprintf( buf, "host%d.example.com", session ) ; break ;
+		case 2: sprintf( buf, "C:\\Users\\kitty\\log %d-%d.txt", session, key ) ; break ;
+		default: sprintf( buf, "L%d=localhost:%d,R%d=db:5432", 8000 + key, 22 + session, key ) ; break ;
+	}
+}
+
+static void session_file( char * buf, const char * dir, int session ) {
+	sprintf( buf, "%s/Session%%20%05d", dir, session ) ;
+}
+
+static void check( const char * store, int session, int key, const char * got ) {
+	char want[256] ;
+	make_value( want, session, key ) ;
+	if( (got == NULL) || strcmp( got, want ) ) {
+		fprintf( stderr, "%s: session %d key %s is %s, not %s\n", store, session,
+			names[key], got ? got : "missing", want ) ;
+		exit( 1 ) ;
+	}
+}
+
+static double seconds( struct timespec * start ) {
+	struct timespec now ;
+	clock_gettime( CLOCK_MONOTONIC, &now ) ;
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9 ;
+}
+
+static void bench_new( const char * dir, double * tsave, double * tload ) {
+	struct timespec start ;
+	char file[4096], value[256] ;
+	int s, k ;
+
+	clock_gettime( CLOCK_MONOTONIC, &start ) ;
+	for( s = 0 ; s < nsessions ; s++ ) {
+		HSettingsList list = SettingsInit() ;
+		for( k = 0 ; k < nkeys ; k++ ) {
+			make_value( value, s, k ) ;
+			SettingsAddItem( list, names[k], value ) ;
+		}
+		session_file( file, dir, s ) ;
+		SettingsSave( list, file ) ;
+		SettingsFree( list ) ;
+	}
+	*tsave = seconds( &start ) ;
+
+	clock_gettime( CLOCK_MONOTONIC, &start ) ;
+	for( s = 0 ; s < nsessions ; s++ ) {
+		HSettingsList list = SettingsInit() ;
+		session_file( file, dir, s ) ;
+		SettingsLoad( list, file ) ;
+		for( k = 0 ; k < nkeys ; k++ ) check( "hash table", s, k, SettingsKey( list, names[k] ) ) ;
+		SettingsFree( list ) ;
+	}
+	*tload = seconds( &start ) ;
+}
+
+static void bench_old( const char * dir, double * tsave, double * tload ) {
+	struct timespec start ;
+	char file[4096], value[256] ;
+	int s, k ;
+
+	clock_gettime( CLOCK_MONOTONIC, &start ) ;
+	for( s = 0 ; s < nsessions ; s++ ) {
+		HOldSettingsList list = OldSettingsInit() ;
+		for( k = 0 ; k < nkeys ; k++ ) {
+			make_value( value, s, k ) ;
+			OldSettingsAddItem( list, names[k], value ) ;
+		}
+		session_file( file, dir, s ) ;
+		OldSettingsSave( list, file ) ;
+		OldSettingsFree( list ) ;
+	}
+	*tsave = seconds( &start ) ;
+
+	clock_gettime( CLOCK_MONOTONIC, &start ) ;
+	for( s = 0 ; s < nsessions ; s++ ) {
+		HOldSettingsList list = OldSettingsInit() ;
+		session_file( file, dir, s ) ;
+		OldSettingsLoad( list, file ) ;
+		for( k = 0 ; k < nkeys ; k++ ) check( "linked list", s, k, OldSettingsKey( list, names[k] ) ) ;
+		OldSettingsFree( list ) ;
+	}
+	*tload = seconds( &start ) ;
+}
+
+int main( int argc, char ** argv ) {
+	const char * dir = "kitty_store_bench.d" ;
+	double tsave, tload ;
+	char file[4096] ;
+	int i ;
+
+	for( i = 1 ; i < argc ; i++ ) {
+		if( !strcmp( argv[i], "-n" ) && i+1 < argc ) nsessions = atoi( argv[++i] ) ;
+		else if( !strcmp( argv[i], "-k" ) && i+1 < argc ) nkeys = atoi( argv[++i] ) ;
+		else if( !strcmp( argv[i], "-d" ) && i+1 < argc ) dir = argv[++i] ;
+		else break ;
+	}
+	if( (i < argc) || (nsessions < 1) || (nkeys < 1) ) {
+		fprintf( stderr, "usage: kitty_store_bench [-n sessions] [-k keys] [-d directory]\n" ) ;
+		return 1 ;
+	}
+	if( mkdir( dir, 0777 ) && (access( dir, W_OK ) != 0) ) {
+		perror( dir ) ;
+		return 1 ;
+	}
+	make_names() ;
+
+	printf( "%d sessions of %d keys\n", nsessions, nkeys ) ;
+	printf( "%-12s %10s %10s\n", "store", "save (s)", "load (s)" ) ;
+	bench_old( dir, &tsave, &tload ) ;
+	printf( "%-12s %10.3f %10.3f\n", "linked list", tsave, tload ) ;
+	bench_new( dir, &tsave, &tload ) ;
+	printf( "%-12s %10.3f %10.3f\n", "hash table", tsave, tload ) ;
+
+	for( i = 0 ; i < nsessions ; i++ ) {
+		session_file( file, dir, i ) ;
+		remove( file ) ;
+	}
+	rmdir( dir ) ;
+	for( i = 0 ; i < nkeys ; i++ ) free( names[i] ) ;
+	free( names ) ;
+	return 0 ;
+}
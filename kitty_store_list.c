@@ -0,0 +1,252 @@
+/* kitty_store_list.c
+
+ the SettingsList of a portable session file: its items in file order,
+ with an open-addressing hash table on the names to find them quickly.
+ Included by kitty_store.c, and by kitty_store_bench.c, which is built
+ on its own; so nothing here may depend on Windows. What it needs from
+ the rest of KiTTY (mungestr, unmungestr, poss, dupstr, errorShow) the
+ includer provides.
+*/
+
+HSettingsItem SettingsNewItem( const char * name, const char * value ) {
+	if( name==NULL ) return NULL ; 
+	HSettingsItem NewItem = malloc( sizeof( SettingsItem ) ) ;
+	NewItem->name = malloc( strlen(name) + 1 ) ; strcpy( NewItem->name, name ) ;
+	if( value == NULL ) { 
+		NewItem->value = NULL ;
+	} else {
+		NewItem->value = malloc( strlen(value) + 1 ) ; strcpy( NewItem->value, value ) ;
+	}
+	return NewItem ;
+}
+
+#define SETTINGS_EMPTY (-1)
+#define SETTINGS_DELETED (-2)
+#define SETTINGS_MINTABLE 64
+
+// Hachage FNV-1a du nom de la clé
+static unsigned int SettingsHash( const char * key ) {
+	unsigned int h = 2166136261U ;
+	while( *key ) { h ^= (unsigned char)*key++ ; h *= 16777619U ; }
+	return h ;
+}
+
+// Retourne l'emplacement de la clé dans la table, ou -1 si elle n'y est pas
+static int SettingsFindSlot( HSettingsList list, const char * key ) {
+	unsigned int mask = list->tablesize - 1, i ;
+	for( i = SettingsHash( key ) & mask ; list->table[i] != SETTINGS_EMPTY ; i = (i + 1) & mask ) {
+		if( list->table[i] >= 0 ) {
+			if( !strcmp( list->items[list->table[i]]->name, key ) ) return i ;
+		}
+	}
+	return -1 ;
+}
+
+// Reconstruit la table, et tasse le tableau des items, quand elle devient trop pleine
+static void SettingsRehash( HSettingsList list ) {
+	int i, j, size = SETTINGS_MINTABLE ;
+	unsigned int mask, k ;
+	while( size < 4 * (list->num + 1) ) size *= 2 ;
+
+	for( i = j = 0 ; i < list->nitems ; i++ ) {
+		if( list->items[i] != NULL ) list->items[j++] = list->items[i] ;
+	}
+	list->nitems = j ;
+
+	free( list->table ) ;
+	list->table = (int*) malloc( size * sizeof(int) ) ;
+	for( i = 0 ; i < size ; i++ ) list->table[i] = SETTINGS_EMPTY ;
+	list->tablesize = size ;
+	list->tableused = list->nitems ;
+	mask = size - 1 ;
+	for( i = 0 ; i < list->nitems ; i++ ) {
+		for( k = SettingsHash( list->items[i]->name ) & mask ; list->table[k] != SETTINGS_EMPTY ; k = (k + 1) & mask ) ;
+		list->table[k] = i ;
+	}
+}
+
+HSettingsList SettingsInit() {
+	HSettingsList list = (HSettingsList)malloc( sizeof(SettingsList) ) ;
+	list->filename = NULL ;
+	list->num = 0 ;
+	list->items = NULL ;
+	list->nitems = 0 ;
+	list->itemsize = 0 ;
+	list->table = NULL ;
+	SettingsRehash( list ) ;
+	return list ;
+}
+
+void SettingsDelItem( HSettingsList list, const char * key ) {
+	if( (list != NULL) && (key != NULL) ) {
+		int slot = SettingsFindSlot( list, key ) ;
+		if( slot >= 0 ) {
+			SettingsFreeItem( list->items[list->table[slot]] ) ;
+			list->items[list->table[slot]] = NULL ;
+			list->table[slot] = SETTINGS_DELETED ;
+			list->num = list->num - 1 ;
+		}
+	}
+}
+
+void SettingsAddItem( HSettingsList list, const char * name, const char * value ) {
+	if( (list != NULL) && (name != NULL) ) {
+		int slot = SettingsFindSlot( list, name ) ;
+		if( slot >= 0 ) {
+			// La clé existe déjà: on remplace la valeur sans changer sa place
+			HSettingsItem item = list->items[list->table[slot]] ;
+			if( item->value != NULL ) { free( item->value ) ; }
+			if( value == NULL ) {
+				item->value = NULL ;
+			} else {
+				item->value = malloc( strlen(value) + 1 ) ; strcpy( item->value, value ) ;
+			}
+			return ;
+		}
+
+		// Si le tableau est plein mais surtout de trous, il suffit de le tasser
+		if( (4 * (list->tableused + 1) > 3 * list->tablesize)
+			|| ((list->nitems == list->itemsize) && (2 * list->num < list->nitems)) ) { SettingsRehash( list ) ; }
+		if( list->nitems == list->itemsize ) {
+			list->itemsize = (list->itemsize == 0) ? 64 : 2 * list->itemsize ;
+			list->items = (HSettingsItem*) realloc( list->items, list->itemsize * sizeof(HSettingsItem) ) ;
+		}
+
+		unsigned int mask = list->tablesize - 1, i ;
+		for( i = SettingsHash( name ) & mask ; list->table[i] >= 0 ; i = (i + 1) & mask ) ;
+		if( list->table[i] == SETTINGS_EMPTY ) { list->tableused = list->tableused + 1 ; }
+		list->table[i] = list->nitems ;
+		list->items[list->nitems++] = SettingsNewItem( name, value ) ;
+		list->num = list->num + 1 ;
+	}
+}
+
+void SettingsFreeItem( HSettingsItem item ) {
+	if( item != NULL ) {
+//debug_log("%s=%s\n",item->name,item->value);
+		if( item->value != NULL ) { free( item->value ) ; item->value = NULL ; } // POURQUOI CA PLANTE ???
+		if( item->name != NULL ) { free( item->name ) ; item->name = NULL ; }
+		free( item ) ;
+	}
+}
+
+void SettingsFree( HSettingsList list ) {
+	if( list != NULL ) {
+		int i ;
+		for( i = 0 ; i < list->nitems ; i++ ) { SettingsFreeItem( list->items[i] ) ; }
+		free( list->items ) ; list->items = NULL ;
+		free( list->table ) ; list->table = NULL ;
+		if( list->filename != NULL ) { free( list->filename ) ; list->filename = NULL ; }
+		list->num = 0 ;
+		free( list ) ;
+	}
+}
+
+char * SettingsKey( HSettingsList list, const char * key ) {
+	if( (list != NULL) && (key != NULL) ) {
+		int slot = SettingsFindSlot( list, key ) ;
+		if( slot >= 0 ) return list->items[list->table[slot]]->value ;
+	}
+	return NULL ;
+}
+
+char * SettingsKey_str( HSettingsList list, const char * key ) {
+	if( (list != NULL) && (key != NULL) ) {
+		int slot = SettingsFindSlot( list, key ) ;
+		if( slot >= 0 ) return dupstr( list->items[list->table[slot]]->value ) ;
+	}
+	return NULL ;
+}
+
+int SettingsKey_int( HSettingsList list, const char * key, const int defvalue ) {
+	if( (list != NULL) && (key != NULL) ) {
+		int slot = SettingsFindSlot( list, key ) ;
+		if( slot >= 0 ) return atoi( list->items[list->table[slot]]->value ) ;
+	}
+	return defvalue ;
+}
+
+void SettingsLoad( HSettingsList list, const char * filename ) {
+	FILE * fp ;
+	char *buffer;
+	int p ;
+	
+//debug_log("filename=%s|\n",filename); int i=0;
+	
+	if( (fp=fopen(filename,"rb")) != NULL ) {
+		list->filename = (char*) malloc( strlen(filename)+1 ) ; strcpy( list->filename, filename ) ;
+		buffer = (char*)malloc(4096*sizeof(char)) ;
+		while( fgets(buffer,4096,fp) != NULL ) {
+//debug_log("\nline %05d[%d]: %s|\n",++i,strlen(buffer),buffer);
+			while( buffer[strlen(buffer)-1]!='\n' ) {
+				buffer = realloc( buffer, strlen(buffer) + 4096 ) ;
+				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
+//debug_log("\nline %05d[%d]: %s|\n",++i,strlen(buffer),buffer);
+			}
+
+			char *name, *value, *value2 ;
+			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
+//debug_log("\t-2=%c -3=%c\n",buffer[strlen(buffer)-2],buffer[strlen(buffer)-3]);
+			while( buffer[strlen(buffer)-1]!='\\' ) {
+//debug_log("ici\n");
+				while( buffer[strlen(buffer)-1]=='\r' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'r' ; }
+				while( buffer[strlen(buffer)-1]=='\n' ) { buffer[strlen(buffer)+1]='\0' ; buffer[strlen(buffer)-1]='\\' ; buffer[strlen(buffer)] = 'n' ; }
+				if( fgets( buffer+strlen(buffer), 4096, fp ) == NULL ) { break ; }
+				while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+			}
+//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
+			while( (buffer[strlen(buffer)-1]=='\n') || (buffer[strlen(buffer)-1]=='\r') ) buffer[strlen(buffer)-1] = '\0' ;
+//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
+			if( buffer[strlen(buffer)-1] != '\\' ) { strcat( buffer, "\\" ) ; }
+//debug_log("line %05d[%d]: %s|\n",i,strlen(buffer),buffer);
+			p = poss( "\\", buffer ) ;
+			if( p>1 ) {
+				name = (char*) malloc( p+1 ) ;
+				memcpy( name, buffer, p-1 ) ; name[p-1]='\0' ;
+				value = (char*) malloc( strlen(buffer)-p+1 ) ;
+				strcpy( value, buffer+p ) ;
+				value[strlen(value)-1]='\0' ;
+//debug_log("line %05d: %s|%s|\n",i,name,value);
+				value2 = (char*) malloc( strlen(value)+1 ) ;
+				unmungestr( value, value2, strlen(value)+1 ) ;
+//debug_log("line %05d: %s|%s|%s|\n",i,name,value,value2);
+				SettingsAddItem( list, name, value2 ) ;
+				free( value2 ) ;
+				free( value ) ;
+				free( name ) ;
+			}
+		}
+		free(buffer) ;
+		fclose(fp );
+	} else {
+		//if( strcmp(filename,"Default%20Settings") ) MessageBox(NULL,"Unable to open session file", "Error", MB_OK);
+		errorShow( "Unable to read session file", filename ) ;
+	}
+}
+
+void SettingsSave( HSettingsList list, const char * filename ) {
+	FILE * fp ;
+	
+	if( (fp=fopen(filename,"wb")) != NULL ) {
+		if( list != NULL ) {
+			int i ;
+			for( i = 0 ; i < list->nitems ; i++ ) {
+				HSettingsItem current = list->items[i] ;
+				if( current == NULL ) continue ;
+				if( current->value == NULL ) {
+					fprintf( fp, "%s\\\\\n", current->name ) ;
+				} else {
+					char * p = (char*) malloc( 3*strlen(current->value)+1 ) ;
+					mungestr( current->value, p ) ;
+					fprintf( fp, "%s\\%s\\\n", current->name, p ) ;
+					free( p ) ;
+				}
+			}
+		}
+		fclose(fp);
+	} else {
+		errorShow( "Unable to write session file", filename ) ;
+	}
+}
+
@@ -0,0 +1,37 @@
+#ifndef KITTY_STORE_LIST
+#define KITTY_STORE_LIST
+
+struct SettingsItem {
+	char * name ;
+	char * value ;
+} ;
+typedef struct SettingsItem SettingsItem, *HSettingsItem ;
+
+/* Items are kept in insertion order (which is the order they are saved in),
+ * with an open-addressing hash table on the names to find them quickly */
+struct SettingsList {
+	char * filename ;
+	int num ;			/* number of items */
+	HSettingsItem * items ;		/* insertion order, NULL where deleted */
+	int nitems, itemsize ;		/* used and allocated length of items */
+	int * table ;			/* index into items, or -1 empty, -2 deleted */
+	int tablesize ;			/* a power of 2 */
+	int tableused ;			/* slots not SETTINGS_EMPTY */
+} ;
+typedef struct SettingsList SettingsList, *HSettingsList;
+
+HSettingsItem SettingsNewItem( const char * name, const char * value ) ;
+void SettingsFreeItem( HSettingsItem item ) ;
+
+HSettingsList SettingsInit() ;
+void SettingsDelItem( HSettingsList list, const char * key ) ;
+void SettingsAddItem( HSettingsList list, const char * name, const char * value ) ;
+void SettingsFree( HSettingsList list ) ;
+char * SettingsKey( HSettingsList list, const char * key ) ;
+char * SettingsKey_str( HSettingsList list, const char * key ) ;
+int SettingsKey_int( HSettingsList list, const char * key, const int defvalue ) ;
+
+void SettingsLoad( HSettingsList list, const char * filename ) ;
+void SettingsSave( HSettingsList list, const char * filename ) ;
+
+#endif
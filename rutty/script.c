@@ -23,13 +23,22 @@ void script_init(ScriptData * scriptdata, Conf * conf)
     scriptdata->except = conf_get_int(conf, CONF_script_except);
     scriptdata->timeout = conf_get_int(conf, CONF_script_timeout) * TICKSPERSEC ;  /* in winstuff.h */
 
+    scriptdata->remotedata_c = script_cond_size;
+    scriptdata->remotedata_s = script_cond_size;
+    scriptdata->remotedata[0] = '\0' ;
+
     script_cond_set(scriptdata->waitfor, &scriptdata->waitfor_c, conf_get_str(conf, CONF_script_waitfor), strlen(conf_get_str(conf, CONF_script_waitfor)));
     script_cond_set(scriptdata->halton, &scriptdata->halton_c, conf_get_str(conf, CONF_script_halton), strlen(conf_get_str(conf, CONF_script_halton)));
+    script_setcond(scriptdata, &scriptdata->waitfor_m, scriptdata->waitfor, scriptdata->waitfor_c);
+    script_setcond(scriptdata, &scriptdata->halton_m, scriptdata->halton, scriptdata->halton_c);
+    script_match_reset(ruttyAHK_prompt_m);
 
     scriptdata->crlf = conf_get_int(conf, CONF_script_crlf);
 
     scriptdata->waitfor2[0] = '\0';
     scriptdata->waitfor2_c = -1;  /* -1= there is no condition from file, 0= there an empty line (cr/lf) */
+    script_match_free(scriptdata->waitfor2_m);
+    scriptdata->waitfor2_m = NULL;
 
     scriptdata->runs = FALSE;
     scriptdata->send = FALSE;
@@ -37,9 +46,6 @@ void script_init(ScriptData * scriptdata, Conf * conf)
 
     scriptdata->latest = 0;
 
-    scriptdata->remotedata_c = script_cond_size;
-    scriptdata->remotedata[0] = '\0' ;
-
     scriptdata->localdata_c = 0 ;
     scriptdata->localdata[0] = '\0' ;
 
@@ -355,6 +361,7 @@ int script_chkline(ScriptData * scriptdata)
     if(scriptdata->nextline_c>0 && scriptdata->nextline[0]==scriptdata->cond_char)
     {
       script_cond_set(scriptdata->waitfor2,&scriptdata->waitfor2_c,&scriptdata->nextline[1],scriptdata->nextline_c-1);
+      script_setcond(scriptdata, &scriptdata->waitfor2_m, scriptdata->waitfor2, scriptdata->waitfor2_c);
       script_getline(scriptdata);
       return TRUE;
     }
@@ -362,89 +369,44 @@ int script_chkline(ScriptData * scriptdata)
     {
       scriptdata->waitfor2_c = -1;
       scriptdata->waitfor2[0] = '\0';
+      script_match_free(scriptdata->waitfor2_m);
+      scriptdata->waitfor2_m = NULL;
     }
     return FALSE;
 }
 
 
-/* copy condition from settings or scriptfile to scriptdata structure
-   there are 2 options:
-   condition line  - the complete line must mach before the script is continued or halted
-   "word1"word2"   - if one of these words is found the script is continued or halted
-                     note: the first char must be "
-   !!BUG: "word1" "word2" never workt ! you had to enter "word1"word2"
-   !!to be compatible with older versions I don't change it
-   !!the only change is that it now can be "word1""word2"
-                     
-   'waitfor' and 'halton' are string lists, strings seperated by \0
-   lateron we compare it backwards, from end to start, to make that easier the terminating \0 is at start !
+/* compile a condition list for script_remote
+   the line received so far counts, as it did when the list was compared with the buffer
 */
-void script_cond_set(char * cond, int *p, char *in, int sz)
+void script_setcond(ScriptData * scriptdata, ScriptMatch ** m, char * cond, int c)
 {
-    int i = 0;
-    (*p) = 0;
-
-    while(sz>0 && (in[sz-1] =='\n' || in[sz-1] =='\r'))  /* remove cr/lf */
-       sz--;
-
-    if(sz==0)
-    {
-      cond[*p]='\0';
-    }
-    else if(in[0]!='"')
-    {
-      if(sz>(script_cond_size-1))
-        i = sz - (script_cond_size-1);  /* line to large - use only last part */
-      cond[(*p)++]='\0';
-      while(i<sz)
-        cond[(*p)++] = in[i++];
-    }
-    else
-    {
-      if(sz>script_cond_size)
-        sz = script_cond_size;  /* word list to large, use only first part */
-      i++;  //skip staring "
-      while(i<sz)
-      {
-        cond[(*p)++] = '\0';
-        while(i<sz && in[i]!='"')  //copy upto end or " 
-          cond[(*p)++] = in[i++];
-        i++;  
-        while(i<sz && in[i]==' ')  //skip spaces after/between " 
-          i++;
-        while(i<sz && in[i]=='"')  //skip aditional "
-          i++;
-      }
-    }
+    script_match_free(*m);
+    *m = script_match_new(cond, c);
+    if(script_match_error(*m)!=NULL)
+      logevent(NULL, script_match_error(*m));
+    script_match_feed(*m, &scriptdata->remotedata[scriptdata->remotedata_s], scriptdata->remotedata_c - scriptdata->remotedata_s);
 }
 
 
-/* compare received 'data' with our condition list 'ref'
-   'ref' is a list of words, from end to start, terminated with \0
-   'dc' and 'rc' points to the end+1
-   if 'data' has an \0 in it compare will fail
+/* advance all condition lists by one char from host, -1 is a new line
 */
-int script_cond_chk(char *ref, int rc, char *data, int dc)
+static void script_remote_match(ScriptData * scriptdata, int c)
 {
-    int rcc = rc;
-    int dcc = dc;
-
-    while(rcc>0 && dcc>0)
+    if(c<0)
     {
-      do {
-           rcc--;
-           dcc--;
-      } while (rcc>=0 && dcc>=0 && ref[rcc]!= '\0' && ref[rcc]==data[dcc]);
-
-      if(ref[rcc]=='\0')
-        return TRUE;
-
-      /* no match - find next word in list*/
-      dcc = dc;
-      while(rcc>0 && ref[--rcc]!='\0')
-        ; /* all done in loop */
+      script_match_reset(scriptdata->halton_m);
+      script_match_reset(scriptdata->waitfor_m);
+      script_match_reset(scriptdata->waitfor2_m);
+      script_match_reset(ruttyAHK_prompt_m);
+    }
+    else
+    {
+      script_match_step(scriptdata->halton_m, c);
+      script_match_step(scriptdata->waitfor_m, c);
+      script_match_step(scriptdata->waitfor2_m, c);
+      script_match_step(ruttyAHK_prompt_m, c);
     }
-    return FALSE;
 }
 
 
@@ -477,6 +439,7 @@ void script_setsend(ScriptData * scriptdata)
 
 /* capture data from host
    check if thats were we are waiting for
+   the condition lists are advanced one char at a time, see script_match.c
 */
 void script_remote(ScriptData * scriptdata, const char * data, int len)
 {
@@ -492,7 +455,9 @@ void script_remote(ScriptData * scriptdata, const char * data, int len)
 
       /* reset buffer */
       scriptdata->remotedata_c = script_cond_size ;
+      scriptdata->remotedata_s = script_cond_size ;
       scriptdata->remotedata[scriptdata->remotedata_c] = '\0' ;
+      script_remote_match(scriptdata, -1);
     }
     else
     {
@@ -504,14 +469,16 @@ void script_remote(ScriptData * scriptdata, const char * data, int len)
         scriptdata->remotedata_c = 0;
         while(scriptdata->remotedata_c < script_cond_size)
           scriptdata->remotedata[scriptdata->remotedata_c++]=scriptdata->remotedata[j++];
+        scriptdata->remotedata_s = 0;
       }
       scriptdata->remotedata[scriptdata->remotedata_c++]=data[i];
+      script_remote_match(scriptdata, (unsigned char)data[i]);
     }
 
     if (scriptdata->runs)
     {
       /* test for halton */
-      if(scriptdata->halton_c > 0 && script_cond_chk(scriptdata->halton,scriptdata->halton_c,scriptdata->remotedata,scriptdata->remotedata_c))
+      if(scriptdata->halton_c > 0 && script_match_hit(scriptdata->halton_m))
       {
         script_close(scriptdata);
         logevent(NULL, "script halted");
@@ -524,10 +491,10 @@ void script_remote(ScriptData * scriptdata, const char * data, int len)
       {
         if(scriptdata->waitfor2_c >= 0)  /* use prompt from script file */
         {
-          if( scriptdata->waitfor2_c == 0 || script_cond_chk(scriptdata->waitfor2,scriptdata->waitfor2_c,scriptdata->remotedata,scriptdata->remotedata_c) )
+          if( scriptdata->waitfor2_c == 0 || script_match_hit(scriptdata->waitfor2_m) )
             script_setsend(scriptdata);
         }
-        else if( scriptdata->waitfor_c == 0 || script_cond_chk(scriptdata->waitfor,scriptdata->waitfor_c,scriptdata->remotedata,scriptdata->remotedata_c) )
+        else if( scriptdata->waitfor_c == 0 || script_match_hit(scriptdata->waitfor_m) )
         {
           script_setsend(scriptdata);
         }
@@ -536,7 +503,7 @@ void script_remote(ScriptData * scriptdata, const char * data, int len)
     
     if (ruttyAHK && (ruttyAHK_prompt_c > 0))   //special for AHK: prompt found - send message to ahk
     {
-      if(script_cond_chk(ruttyAHK_prompt_s, ruttyAHK_prompt_c, scriptdata->remotedata, scriptdata->remotedata_c))
+      if(script_match_hit(ruttyAHK_prompt_m))
         script_ahk_out(ruttyAHK_prompt, &(scriptdata->remotedata[script_cond_size]), (scriptdata->remotedata_c - script_cond_size)); 
     }
   }  
@@ -10,6 +10,9 @@
 #define script_line_size 4096
 #define script_cond_size 256
 
+/* compiled condition list, see script_match.c */
+typedef struct scriptMATCH ScriptMatch;
+
 struct scriptDATA {
    int line_delay;  /* ms */
    int char_delay;  /* ms */
@@ -27,6 +30,11 @@ struct scriptDATA {
 
    char waitfor2[script_cond_size];
    int waitfor2_c;
+
+   ScriptMatch * waitfor_m;  /* compiled waitfor, halton and waitfor2 */
+   ScriptMatch * halton_m;
+   ScriptMatch * waitfor2_m;
+
    int runs;
    int send;
 
@@ -42,6 +50,7 @@ struct scriptDATA {
    int nextline_cc;
    char remotedata[script_line_size];
    int remotedata_c;
+   int remotedata_s;  /* start of current line in remotedata */
    char localdata[script_line_size];
    int localdata_c;
    
@@ -69,13 +78,24 @@ BOOL script_record(ScriptData * scriptdata, Filename * script_filename);
 void script_setsend(ScriptData * scriptdata);
 void script_record_stop(ScriptData * scriptdata);
 BOOL script_record_line(ScriptData * scriptdata, int remote);
-int script_cond_chk(char *ref, int rc, char *data, int dc);
-void script_cond_set(char * cond, int *p, char *in, int sz);
 int script_chkline(ScriptData * scriptdata);
 void script_timeout(void *ctx, long now);
 void script_sendline(void *ctx, long now);
 void script_sendchar(void *ctx, long now);
 void script_getline(ScriptData * scriptdata);
+void script_setcond(ScriptData * scriptdata, ScriptMatch ** m, char * cond, int c);
+
+
+/* script_match.c */
+int script_cond_chk(char *ref, int rc, char *data, int dc);
+void script_cond_set(char * cond, int *p, char *in, int sz);
+ScriptMatch * script_match_new(const char * cond, int c);
+void script_match_free(ScriptMatch * m);
+void script_match_reset(ScriptMatch * m);
+void script_match_step(ScriptMatch * m, int c);
+void script_match_feed(ScriptMatch * m, const char * data, int len);
+int script_match_hit(ScriptMatch * m);
+const char * script_match_error(ScriptMatch * m);
 
 
 /* script_win.c */
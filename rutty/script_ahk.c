@@ -20,6 +20,7 @@ static char ruttyAHK_windowname[ruttyAHK_wn_siz];
 
 static int ruttyAHK_prompt_c = 0;
 static char ruttyAHK_prompt_s[script_cond_size];
+static ScriptMatch * ruttyAHK_prompt_m = NULL;
 
 /* enable AHK mode
   send empty string to disable 
@@ -51,6 +52,8 @@ void script_ahk_set(COPYDATASTRUCT *cds)
   {
     ruttyAHK_prompt_c = 0;
     ruttyAHK_prompt_s[0] = '\0';
+    script_match_free(ruttyAHK_prompt_m);
+    ruttyAHK_prompt_m = NULL;
     logevent(NULL, "notify AHK on prompt disabled");
     return; 
   }
@@ -61,6 +64,7 @@ void script_ahk_set(COPYDATASTRUCT *cds)
   //memcpy(ruttyAHK_prompt_s, (char *) cds->lpData, siz);
   //ruttyAHK_prompt_s[siz]='\0';
   script_cond_set(ruttyAHK_prompt_s, &ruttyAHK_prompt_c, (char *) cds->lpData, cds->cbData);
+  script_setcond(&scriptdata, &ruttyAHK_prompt_m, ruttyAHK_prompt_s, ruttyAHK_prompt_c);
   logevent(NULL, "notify AHK on prompt enabled");
   return; 
  }
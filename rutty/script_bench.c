@@ -0,0 +1,189 @@
+/* script_bench.c
+
+ part of rutty - a modified version of putty
+ throughput of the script condition matching, fed by a recorded transcript
+
+ build (in this directory):  gcc -O2 -o script_bench script_bench.c
+ usage: script_bench [-n passes] transcript [condition...]
+
+ the transcript is anything the host sent, e.g. a session log of all
+ session output. Each condition is given as in the scripting panel:
+   script_bench -n 20 session.log '"$ "# "' '"error"failed"denied"' '~"^\[\w+@[^ ]+ [^]]*\][$#] "'
+ without conditions a set of prompts and error words is used.
+
+ every condition is run through the old compare (script_cond_chk on the
+ line buffer after each byte) and through ScriptMatch, both report the
+ number of bytes after which the line ended with a match; they should
+ agree, except that the old compare can't do regex conditions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#define TRUE 1
+#define FALSE 0
+#define snew(type) ((type *)malloc(sizeof(type)))
+#define snewn(n, type) ((type *)malloc((n) * sizeof(type)))
+#define sfree(p) free(p)
+
+#define script_line_size 4096
+#define script_cond_size 256
+typedef struct scriptMATCH ScriptMatch;
+void script_match_reset(ScriptMatch * m);
+
+#include "script_match.c"
+
+static const char * default_conds[] = {
+   "\"$ \"# \"> \"% \"login: \"Password: \"password: \"(yes/no)? \"--More--\"",
+   "\"error\"Error\"ERROR\"failed\"Failed\"FAILED\"denied\"Denied\"not found\"No such file\"cannot\"Cannot\"fatal\"Fatal\"panic\"Segmentation fault\"core dumped\"Permission denied\"Connection refused\"timed out\"Timeout\"unreachable\"Unknown command\"Invalid\"invalid\"syntax error\"abort\"Abort\"killed\"Killed\"",
+   "~\"^\\[\\w+@[^ ]+ [^]]*\\][$#] \"^[-a-zA-Z0-9_.]+[>#] \"",
+};
+
+/* the line buffer of script_remote, with the old compare after every byte */
+static long bench_old(char * cond, int c, const char * data, long len)
+{
+    static char line[script_line_size];
+    int n = script_cond_size;
+    long i, hits = 0;
+
+    memset(line, 0, sizeof(line));
+    for(i=0;i<len;i++)
+    {
+      if(data[i]=='\n' || data[i]=='\r' || data[i]=='\0')
+      {
+        n = script_cond_size;
+        /* script_remote leaves the tail of a long line here, clear it as
+           the first line of a session sees it, so the counts are comparable */
+        memset(line, 0, script_cond_size);
+      }
+      else
+      {
+        if(n>=script_line_size)
+        {
+          memmove(line, &line[script_line_size - script_cond_size], script_cond_size);
+          n = script_cond_size;
+        }
+        line[n++] = data[i];
+      }
+      if(script_cond_chk(cond, c, line, n))
+        hits++;
+    }
+    return hits;
+}
+
+static long bench_new(ScriptMatch * m, const char * data, long len)
+{
+    long i, hits = 0;
+
+    script_match_reset(m);
+    for(i=0;i<len;i++)
+    {
+      if(data[i]=='\n' || data[i]=='\r' || data[i]=='\0')
+        script_match_reset(m);
+      else
+        script_match_step(m, (unsigned char)data[i]);
+      if(script_match_hit(m))
+        hits++;
+    }
+    return hits;
+}
+
+static double seconds(clock_t start)
+{
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    return (t > 1e-6) ? t : 1e-6;
+}
+
+int main(int argc, char ** argv)
+{
+    const char ** conds = default_conds;
+    int nconds = sizeof(default_conds) / sizeof(default_conds[0]);
+    int passes = 10, i, p;
+    const char * fname = NULL;
+    char * data;
+    long len;
+    FILE * fp;
+
+    for(i=1;i<argc;i++)
+    {
+      if(!strcmp(argv[i], "-n") && i+1<argc)
+        passes = atoi(argv[++i]);
+      else
+        break;
+    }
+    if(i>=argc || passes<1)
+    {
+      fprintf(stderr, "usage: script_bench [-n passes] transcript [condition...]\n");
+      return 1;
+    }
+    fname = argv[i++];
+    if(i<argc)
+    {
+      conds = (const char **)&argv[i];
+      nconds = argc - i;
+    }
+
+    if((fp = fopen(fname, "rb"))==NULL)
+    {
+      perror(fname);
+      return 1;
+    }
+    fseek(fp, 0L, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    data = snewn(len + 1, char);
+    if(fread(data, 1, len, fp)!=(size_t)len)
+    {
+      perror(fname);
+      return 1;
+    }
+    fclose(fp);
+
+    printf("%s: %ld bytes x %d passes\n", fname, len, passes);
+    for(i=0;i<nconds;i++)
+    {
+      char cond[script_cond_size + 1];
+      char in[4096];
+      int c, re;
+      long hold = 0, hnew = 0;
+      double told, tnew;
+      clock_t start;
+      ScriptMatch * m;
+
+      strncpy(in, conds[i], sizeof(in) - 1);
+      in[sizeof(in) - 1] = '\0';
+      script_cond_set(cond, &c, in, strlen(in));
+      re = (memchr(cond, '\n', c)!=NULL);
+      m = script_match_new(cond, c);
+      if(script_match_error(m)!=NULL)
+        printf("  %s\n", script_match_error(m));
+
+      start = clock();
+      for(p=0;p<passes;p++)
+        hnew = bench_new(m, data, len);
+      tnew = seconds(start);
+
+      printf("condition %d: %.60s\n", i+1, conds[i]);
+      if(!re)
+      {
+        start = clock();
+        for(p=0;p<passes;p++)
+          hold = bench_old(cond, c, data, len);
+        told = seconds(start);
+        printf("  old compare: %8.1f MB/s  %ld matches\n", len * (double)passes / told / 1e6, hold);
+      }
+      printf("  ScriptMatch: %8.1f MB/s  %ld matches\n", len * (double)passes / tnew / 1e6, hnew);
+      if(!re && hold!=hnew)
+        printf("  MISMATCH\n");
+      script_match_free(m);
+    }
+
+    sfree(data);
+    return 0;
+}
+
+
+/* end of file */
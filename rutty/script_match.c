@@ -0,0 +1,768 @@
+/* script_match.c
+
+ part of rutty - a modified version of putty
+ condition lists ('waitfor', 'halton', AHK prompt) and the matcher for them
+
+ script_remote() has to know, after every byte from the host, whether the
+ current line now ends with one of the words in a condition list.
+ Comparing every word against the line buffer each time costs
+ (words x length) per byte, so instead a list is compiled once into a
+ ScriptMatch and that is advanced by one step per byte:
+   - plain words go into a single Aho-Corasick automaton, stored as a full
+     transition table over the bytes that occur in the words
+   - regex words are run as a small Thompson NFA each, all threads in step
+ both only ever look at the current line; script_match_reset() starts a
+ new one.
+*/
+
+
+/* copy condition from settings or scriptfile to scriptdata structure
+   there are 3 options:
+   condition line  - the complete line must mach before the script is continued or halted
+   "word1"word2"   - if one of these words is found the script is continued or halted
+                     note: the first char must be "
+   !!BUG: "word1" "word2" never workt ! you had to enter "word1"word2"
+   !!to be compatible with older versions I don't change it
+   !!the only change is that it now can be "word1""word2"
+   ~"regex1"regex2" - as above, but the words are (extended) regular expressions
+                     the line must end with a match, ^ anchors it to the start of the line
+
+   'waitfor' and 'halton' are string lists, strings seperated by \0
+   the terminating \0 is at start, a regex has a \n after it (can't be in a received line)
+*/
+void script_cond_set(char * cond, int *p, char *in, int sz)
+{
+    int i = 0;
+    int re = FALSE;
+    (*p) = 0;
+
+    while(sz>0 && (in[sz-1] =='\n' || in[sz-1] =='\r'))  /* remove cr/lf */
+       sz--;
+
+    if(sz>1 && in[0]=='~' && in[1]=='"')
+    {
+      re = TRUE;
+      in++;
+      sz--;
+    }
+
+    if(sz==0)
+    {
+      cond[*p]='\0';
+    }
+    else if(in[0]!='"')
+    {
+      if(sz>(script_cond_size-1))
+        i = sz - (script_cond_size-1);  /* line to large - use only last part */
+      cond[(*p)++]='\0';
+      while(i<sz)
+        cond[(*p)++] = in[i++];
+    }
+    else
+    {
+      if(sz>script_cond_size)
+        sz = script_cond_size;  /* word list to large, use only first part */
+      i++;  //skip staring "
+      while(i<sz && (*p)<script_cond_size-2)
+      {
+        cond[(*p)++] = '\0';
+        if(re)
+          cond[(*p)++] = '\n';
+        while(i<sz && in[i]!='"' && (*p)<script_cond_size)  //copy upto end or "
+          cond[(*p)++] = in[i++];
+        i++;
+        while(i<sz && in[i]==' ')  //skip spaces after/between "
+          i++;
+        while(i<sz && in[i]=='"')  //skip aditional "
+          i++;
+      }
+    }
+}
+
+
+/* compare received 'data' with our condition list 'ref'
+   'ref' is a list of words, from end to start, terminated with \0
+   'dc' and 'rc' points to the end+1
+   if 'data' has an \0 in it compare will fail
+   note: this is the old per byte compare, script_remote() uses ScriptMatch
+*/
+int script_cond_chk(char *ref, int rc, char *data, int dc)
+{
+    int rcc = rc;
+    int dcc = dc;
+
+    while(rcc>0 && dcc>0)
+    {
+      do {
+           rcc--;
+           dcc--;
+      } while (rcc>=0 && dcc>=0 && ref[rcc]!= '\0' && ref[rcc]==data[dcc]);
+
+      if(ref[rcc]=='\0')
+        return TRUE;
+
+      /* no match - find next word in list*/
+      dcc = dc;
+      while(rcc>0 && ref[--rcc]!='\0')
+        ; /* all done in loop */
+    }
+    return FALSE;
+}
+
+
+/* regex: parsed into a tree, then compiled to instructions for the NFA
+*/
+#define script_re_maxnode 512
+#define script_re_maxinst 1024
+#define script_re_maxrep 32
+
+enum {RE_SET, RE_CAT, RE_ALT, RE_REP, RE_EMPTY};  /* tree nodes */
+enum {RI_SET, RI_SPLIT, RI_JMP, RI_MATCH};  /* instructions */
+
+struct scriptRENODE {
+   int type;
+   int a, b;  /* children */
+   int min, max;  /* RE_REP, max -1 = no limit */
+   unsigned char set[32];  /* RE_SET */
+};
+
+struct scriptREINST {
+   int op;
+   int x, y;  /* RI_JMP: x, RI_SPLIT: x and y */
+   unsigned char set[32];  /* RI_SET: bytes that go to the next instruction */
+};
+
+struct scriptREGEX {
+   struct scriptREINST * inst;
+   int ninst;
+   int anchored;  /* ^ - only start a match at the start of the line */
+   int * cur, * next;  /* active threads */
+   int ncur, nnext;
+   int * on;  /* on[pc]==gen: pc already in 'next' */
+   int gen;
+   int hit;
+};
+
+struct scriptREPARSE {
+   const char * s, * end;
+   struct scriptRENODE * node;
+   int nnode;
+   const char * error;
+};
+
+struct scriptMATCH {
+   /* Aho-Corasick automaton for the plain words */
+   unsigned char class[256];  /* byte -> column in 'next', 0 = not in any word */
+   int nclass;
+   int nstates;
+   unsigned short * next;  /* nstates x nclass */
+   unsigned char * out;  /* a word ends in this state */
+   int state;
+
+   struct scriptREGEX * re;
+   int nre;
+
+   int hit;
+   const char * error;  /* first bad regex, it's used as a plain word instead */
+};
+
+
+#define script_re_setbit(set, c) ((set)[(unsigned char)(c)>>3] |= 1<<((unsigned char)(c)&7))
+#define script_re_inset(set, c) ((set)[(unsigned char)(c)>>3] & (1<<((unsigned char)(c)&7)))
+
+static int script_re_node(struct scriptREPARSE * ps, int type, int a, int b)
+{
+    struct scriptRENODE * n;
+    if(ps->nnode>=script_re_maxnode)
+    {
+      if(!ps->error)
+        ps->error = "regex too complex";
+      return 0;
+    }
+    n = &ps->node[ps->nnode];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    return ps->nnode++;
+}
+
+/* \d \w \s and their negations, anything else is the char itself */
+static void script_re_escape(unsigned char * set, int c)
+{
+    int i, neg = FALSE;
+    unsigned char tmp[32];
+
+    memset(tmp, 0, sizeof(tmp));
+    switch(c)
+    {
+      case 'D': neg = TRUE;  /* fall through */
+      case 'd':
+        for(i='0';i<='9';i++) script_re_setbit(tmp, i);
+        break;
+      case 'W': neg = TRUE;  /* fall through */
+      case 'w':
+        for(i=0;i<256;i++)
+          if(isalnum(i) || i=='_') script_re_setbit(tmp, i);
+        break;
+      case 'S': neg = TRUE;  /* fall through */
+      case 's':
+        for(i=0;i<256;i++)
+          if(isspace(i)) script_re_setbit(tmp, i);
+        break;
+      case 't': script_re_setbit(tmp, '\t'); break;
+      case 'e': script_re_setbit(tmp, 0x1b); break;
+      default: script_re_setbit(tmp, c); break;
+    }
+    for(i=0;i<32;i++)
+      set[i] |= neg ? (unsigned char)~tmp[i] : tmp[i];
+}
+
+/* [...] - 's' points after the [ */
+static void script_re_bracket(struct scriptREPARSE * ps, unsigned char * set)
+{
+    int i, neg = FALSE, first = TRUE;
+
+    if(ps->s<ps->end && *ps->s=='^')
+    {
+      neg = TRUE;
+      ps->s++;
+    }
+    while(ps->s<ps->end && (first || *ps->s!=']'))
+    {
+      int lo = (unsigned char)*ps->s++;
+      first = FALSE;
+      if(lo=='\\' && ps->s<ps->end)
+      {
+        script_re_escape(set, (unsigned char)*ps->s++);
+        continue;
+      }
+      if(ps->s+1<ps->end && ps->s[0]=='-' && ps->s[1]!=']')
+      {
+        int hi = (unsigned char)ps->s[1];
+        ps->s += 2;
+        for(i=lo;i<=hi;i++)
+          script_re_setbit(set, i);
+      }
+      else
+        script_re_setbit(set, lo);
+    }
+    if(ps->s>=ps->end)
+    {
+      if(!ps->error)
+        ps->error = "missing ] in regex";
+    }
+    else
+      ps->s++;
+    if(neg)
+      for(i=0;i<32;i++)
+        set[i] = ~set[i];
+}
+
+static int script_re_alt(struct scriptREPARSE * ps);
+
+static int script_re_atom(struct scriptREPARSE * ps)
+{
+    int n, c = (unsigned char)*ps->s++;
+
+    if(c=='(')
+    {
+      n = script_re_alt(ps);
+      if(ps->s<ps->end && *ps->s==')')
+        ps->s++;
+      else if(!ps->error)
+        ps->error = "missing ) in regex";
+      return n;
+    }
+
+    n = script_re_node(ps, RE_SET, 0, 0);
+    if(c=='.')
+      memset(ps->node[n].set, 0xff, 32);
+    else if(c=='[')
+      script_re_bracket(ps, ps->node[n].set);
+    else if(c=='\\' && ps->s<ps->end)
+      script_re_escape(ps->node[n].set, (unsigned char)*ps->s++);
+    else
+      script_re_setbit(ps->node[n].set, c);
+    return n;
+}
+
+static int script_re_number(struct scriptREPARSE * ps)
+{
+    int n = 0;
+    while(ps->s<ps->end && isdigit((unsigned char)*ps->s) && n<1000)
+      n = n*10 + (*ps->s++ - '0');
+    return n;
+}
+
+static int script_re_repeat(struct scriptREPARSE * ps)
+{
+    int n = script_re_atom(ps);
+
+    while(ps->s<ps->end && !ps->error)
+    {
+      int min, max;
+      char c = *ps->s;
+      if(c=='*')       { min = 0; max = -1; }
+      else if(c=='+')  { min = 1; max = -1; }
+      else if(c=='?')  { min = 0; max = 1; }
+      else if(c=='{' && ps->s+1<ps->end && isdigit((unsigned char)ps->s[1]))
+      {
+        ps->s++;
+        min = max = script_re_number(ps);
+        if(ps->s<ps->end && *ps->s==',')
+        {
+          ps->s++;
+          max = (ps->s<ps->end && *ps->s=='}') ? -1 : script_re_number(ps);
+        }
+        if(ps->s>=ps->end || *ps->s!='}' || (max>=0 && max<min) || min>script_re_maxrep || max>script_re_maxrep)
+        {
+          ps->error = "bad {} in regex";
+          return n;
+        }
+      }
+      else
+        break;
+      ps->s++;
+      n = script_re_node(ps, RE_REP, n, 0);
+      ps->node[n].min = min;
+      ps->node[n].max = max;
+    }
+    return n;
+}
+
+static int script_re_cat(struct scriptREPARSE * ps)
+{
+    int n = -1;
+    while(ps->s<ps->end && *ps->s!='|' && *ps->s!=')' && !ps->error)
+    {
+      int m;
+      if(*ps->s=='$' && ps->s+1==ps->end)  /* we always match at the end of the line */
+      {
+        ps->s++;
+        break;
+      }
+      m = script_re_repeat(ps);
+      n = (n<0) ? m : script_re_node(ps, RE_CAT, n, m);
+    }
+    return (n<0) ? script_re_node(ps, RE_EMPTY, 0, 0) : n;
+}
+
+static int script_re_alt(struct scriptREPARSE * ps)
+{
+    int n = script_re_cat(ps);
+    while(ps->s<ps->end && *ps->s=='|' && !ps->error)
+    {
+      ps->s++;
+      n = script_re_node(ps, RE_ALT, n, script_re_cat(ps));
+    }
+    return n;
+}
+
+/* emit instructions for node 'n', FALSE if the program gets too large */
+static int script_re_emit(struct scriptREPARSE * ps, struct scriptREGEX * re, int n)
+{
+    struct scriptRENODE * node = &ps->node[n];
+    struct scriptREINST * in = re->inst;
+    int i, split, jmp;
+
+    if(re->ninst+2 >= script_re_maxinst)
+      return FALSE;
+
+    switch(node->type)
+    {
+      case RE_SET:
+        in[re->ninst].op = RI_SET;
+        memcpy(in[re->ninst++].set, node->set, 32);
+        return TRUE;
+
+      case RE_CAT:
+        return script_re_emit(ps, re, node->a) && script_re_emit(ps, re, node->b);
+
+      case RE_ALT:
+        split = re->ninst++;
+        in[split].op = RI_SPLIT;
+        in[split].x = re->ninst;
+        if(!script_re_emit(ps, re, node->a))
+          return FALSE;
+        jmp = re->ninst++;
+        in[jmp].op = RI_JMP;
+        in[split].y = re->ninst;
+        if(!script_re_emit(ps, re, node->b))
+          return FALSE;
+        in[jmp].x = re->ninst;
+        return TRUE;
+
+      case RE_REP:
+        for(i=0;i<node->min;i++)
+          if(!script_re_emit(ps, re, node->a))
+            return FALSE;
+        if(node->max<0)
+        {
+          split = re->ninst++;
+          in[split].op = RI_SPLIT;
+          in[split].x = re->ninst;
+          if(!script_re_emit(ps, re, node->a) || re->ninst+1 >= script_re_maxinst)
+            return FALSE;
+          in[re->ninst].op = RI_JMP;
+          in[re->ninst++].x = split;
+          in[split].y = re->ninst;
+          return TRUE;
+        }
+        /* optional copies: each one can skip straight to the end */
+        {
+          int skips[script_re_maxrep], nskip = 0;
+          for(;i<node->max;i++)
+          {
+            split = re->ninst++;
+            in[split].op = RI_SPLIT;
+            in[split].x = re->ninst;
+            skips[nskip++] = split;
+            if(!script_re_emit(ps, re, node->a))
+              return FALSE;
+          }
+          while(nskip>0)
+            in[skips[--nskip]].y = re->ninst;
+        }
+        return TRUE;
+
+      default:  /* RE_EMPTY */
+        return TRUE;
+    }
+}
+
+/* compile regex 'pat', error message or NULL */
+static const char * script_re_compile(struct scriptREGEX * re, const char * pat, int len)
+{
+    struct scriptREPARSE ps;
+    int root;
+
+    memset(re, 0, sizeof(*re));
+    ps.s = pat;
+    ps.end = pat + len;
+    ps.node = snewn(script_re_maxnode, struct scriptRENODE);
+    ps.nnode = 0;
+    ps.error = NULL;
+
+    if(ps.s<ps.end && *ps.s=='^')
+    {
+      re->anchored = TRUE;
+      ps.s++;
+    }
+    root = script_re_alt(&ps);
+    if(!ps.error && ps.s<ps.end)
+      ps.error = "unmatched ) in regex";
+
+    if(!ps.error)
+    {
+      re->inst = snewn(script_re_maxinst, struct scriptREINST);
+      memset(re->inst, 0, script_re_maxinst * sizeof(struct scriptREINST));
+      if(script_re_emit(&ps, re, root))
+        re->inst[re->ninst++].op = RI_MATCH;
+      else
+        ps.error = "regex too complex";
+    }
+    sfree(ps.node);
+
+    if(ps.error)
+    {
+      sfree(re->inst);
+      re->inst = NULL;
+      return ps.error;
+    }
+
+    re->cur = snewn(re->ninst, int);
+    re->next = snewn(re->ninst, int);
+    re->on = snewn(re->ninst, int);
+    memset(re->on, 0, re->ninst * sizeof(int));
+    return NULL;
+}
+
+/* add thread 'pc' to 'next', following jumps */
+static void script_re_add(struct scriptREGEX * re, int pc)
+{
+    while(re->on[pc]!=re->gen)
+    {
+      re->on[pc] = re->gen;
+      switch(re->inst[pc].op)
+      {
+        case RI_JMP:
+          pc = re->inst[pc].x;
+          break;
+        case RI_SPLIT:
+          script_re_add(re, re->inst[pc].x);
+          pc = re->inst[pc].y;
+          break;
+        case RI_MATCH:
+          re->hit = TRUE;
+          /* fall through */
+        default:
+          re->next[re->nnext++] = pc;
+          return;
+      }
+    }
+}
+
+/* make 'next' the current thread list */
+static void script_re_swap(struct scriptREGEX * re)
+{
+    int * t = re->cur;
+    re->cur = re->next;
+    re->next = t;
+    re->ncur = re->nnext;
+}
+
+static void script_re_reset(struct scriptREGEX * re)
+{
+    re->gen++;
+    re->nnext = 0;
+    re->hit = FALSE;
+    script_re_add(re, 0);
+    script_re_swap(re);
+}
+
+static void script_re_step(struct scriptREGEX * re, int c)
+{
+    int i;
+
+    re->gen++;
+    re->nnext = 0;
+    re->hit = FALSE;
+    for(i=0;i<re->ncur;i++)
+    {
+      int pc = re->cur[i];
+      if(re->inst[pc].op==RI_SET && script_re_inset(re->inst[pc].set, c))
+        script_re_add(re, pc+1);
+    }
+    if(!re->anchored)
+      script_re_add(re, 0);  /* a match can start at the next char */
+    script_re_swap(re);
+}
+
+
+/* build the Aho-Corasick automaton from the plain words
+   'words' is a condition list as made by script_cond_set, regex words are skipped
+*/
+static void script_match_ac(ScriptMatch * m, const char * words, int c)
+{
+    int i, j, n, head, tail;
+    int * fail, * queue;
+    int size = 1;
+
+    /* byte classes */
+    memset(m->class, 0, sizeof(m->class));
+    m->nclass = 1;
+    for(i=0;i<c;i++)
+    {
+      if(words[i]=='\0')
+        continue;
+      if(words[i]=='\n' && i>0 && words[i-1]=='\0')  /* regex - skip it */
+      {
+        while(i+1<c && words[i+1]!='\0')
+          i++;
+        continue;
+      }
+      size++;
+      if(m->class[(unsigned char)words[i]]==0)
+        m->class[(unsigned char)words[i]] = m->nclass++;
+    }
+
+    /* trie, -1 = no edge yet */
+    m->next = snewn(size * m->nclass, unsigned short);
+    m->out = snewn(size, unsigned char);
+    fail = snewn(size, int);
+    queue = snewn(size, int);
+    memset(m->out, 0, size);
+    for(i=0;i<size*m->nclass;i++)
+      m->next[i] = 0xffff;
+    m->nstates = 1;
+
+    for(i=0;i<c;i=j)
+    {
+      int re = (i+1<c && words[i+1]=='\n');
+      n = 0;
+      for(j=i+1;j<c && words[j]!='\0';j++)
+      {
+        unsigned short * e;
+        if(re)
+          continue;
+        e = &m->next[n * m->nclass + m->class[(unsigned char)words[j]]];
+        if(*e==0xffff)
+          *e = m->nstates++;
+        n = *e;
+      }
+      if(!re)
+        m->out[n] = TRUE;
+    }
+
+    /* breadth first: fill in failure transitions, so every state has an
+       edge for every class, and let a state end a word if its fail state does */
+    head = tail = 0;
+    for(j=0;j<m->nclass;j++)
+    {
+      unsigned short * e = &m->next[j];
+      if(*e==0xffff)
+        *e = 0;
+      else
+      {
+        fail[*e] = 0;
+        queue[tail++] = *e;
+      }
+    }
+    while(head<tail)
+    {
+      n = queue[head++];
+      m->out[n] |= m->out[fail[n]];
+      for(j=0;j<m->nclass;j++)
+      {
+        unsigned short * e = &m->next[n * m->nclass + j];
+        unsigned short f = m->next[fail[n] * m->nclass + j];
+        if(*e==0xffff)
+          *e = f;
+        else
+        {
+          fail[*e] = f;
+          queue[tail++] = *e;
+        }
+      }
+    }
+
+    sfree(fail);
+    sfree(queue);
+}
+
+
+/* compile condition list 'cond' (as made by script_cond_set)
+   returns NULL for an empty list
+*/
+ScriptMatch * script_match_new(const char * cond, int c)
+{
+    ScriptMatch * m;
+    char * words;
+    int i, j;
+
+    if(c<=0)
+      return NULL;
+
+    m = snew(ScriptMatch);
+    memset(m, 0, sizeof(*m));
+    words = snewn(c, char);
+    memcpy(words, cond, c);
+    cond = words;
+
+    for(i=0;i<c;i++)
+      if(cond[i]=='\0' && i+1<c && cond[i+1]=='\n')
+        m->nre++;
+    if(m->nre>0)
+      m->re = snewn(m->nre, struct scriptREGEX);
+
+    /* a regex that doesn't compile is used as a plain word, so it can still
+       be found, drop the \n to make it one */
+    m->nre = 0;
+    for(i=0;i<c;i=j)
+    {
+      for(j=i+1;j<c && cond[j]!='\0';j++)
+        ;
+      if(i+1<c && cond[i+1]=='\n')
+      {
+        const char * err = script_re_compile(&m->re[m->nre], &cond[i+2], j-i-2);
+        if(err==NULL)
+          m->nre++;
+        else
+        {
+          if(m->error==NULL)
+            m->error = err;
+          memmove(&words[i+1], &words[i+2], c-i-2);
+          c--;
+          j--;
+        }
+      }
+    }
+
+    script_match_ac(m, words, c);
+    sfree(words);
+    script_match_reset(m);
+    return m;
+}
+
+
+void script_match_free(ScriptMatch * m)
+{
+    int i;
+
+    if(m==NULL)
+      return;
+    for(i=0;i<m->nre;i++)
+    {
+      sfree(m->re[i].inst);
+      sfree(m->re[i].cur);
+      sfree(m->re[i].next);
+      sfree(m->re[i].on);
+    }
+    sfree(m->re);
+    sfree(m->next);
+    sfree(m->out);
+    sfree(m);
+}
+
+
+/* start of a new line */
+void script_match_reset(ScriptMatch * m)
+{
+    int i;
+
+    if(m==NULL)
+      return;
+    m->state = 0;
+    m->hit = m->out[0];  /* an empty word matches an empty line */
+    for(i=0;i<m->nre;i++)
+    {
+      script_re_reset(&m->re[i]);
+      m->hit |= m->re[i].hit;
+    }
+}
+
+
+/* next char of the line */
+void script_match_step(ScriptMatch * m, int c)
+{
+    int i;
+
+    if(m==NULL)
+      return;
+    m->state = m->next[m->state * m->nclass + m->class[(unsigned char)c]];
+    m->hit = m->out[m->state];
+    for(i=0;i<m->nre;i++)
+    {
+      script_re_step(&m->re[i], c);
+      m->hit |= m->re[i].hit;
+    }
+}
+
+
+/* catch up with the line received so far, for a new condition */
+void script_match_feed(ScriptMatch * m, const char * data, int len)
+{
+    int i;
+
+    script_match_reset(m);
+    for(i=0;i<len;i++)
+      script_match_step(m, data[i]);
+}
+
+
+/* does the line received so far end with one of the words */
+int script_match_hit(ScriptMatch * m)
+{
+    return (m!=NULL) && m->hit;
+}
+
+
+/* why a regex couldn't be used, or NULL */
+const char * script_match_error(ScriptMatch * m)
+{
+    return (m!=NULL) ? m->error : NULL;
+}
+
+
+/* end of file */
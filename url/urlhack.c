@@ -17,10 +17,20 @@ void debug_logevent( const char *fmt, ... ) ;
 
 int urlhack_mouse_old_x = -1, urlhack_mouse_old_y = -1, urlhack_current_region = -1;
 
-static text_region **link_regions;
+static text_region *link_regions;
 static unsigned int link_regions_len;
 static unsigned int link_regions_current_pos;
 
+/*
+ * Link regions by screen row, so that hit-testing the mouse position
+ * only looks at the links on that row: the regions touching row y are
+ * link_row_list[link_row_start[y] .. link_row_start[y+1]-1], in order.
+ */
+static int *link_row_start;
+static int *link_row_list;
+static int link_rows, link_row_size, link_row_list_size;
+static int link_row_index_valid;
+
 // Regex with http://, https://, ftp://, mailto: and ssh:// links
 
 const char* urlhack_default_regex = "((ht|f)tp(s?):\\/\\/[0-9a-zA-Z]([-\\.\\w]*[0-9a-zA-Z])*([:][0-9]+)?\\/?([-a-zA-Z0-9\\.\\?\\,\\'\\/\\\\\\+=&%\\$#_]*))|(mailto:[a-zA-Z0-9\\-_\\.]+@[a-zA-Z0-9\\-_\\.]+\\.[a-z]{2,})|(ssh:\\/\\/([-a-zA-Z0-9_]+([:][^@]*)?@)?[-a-zA-Z0-9_\\.]+((:[0-9]{2,5})?(\\/[-a-zA-Z0-9_]+)?)?)" ;
@@ -40,19 +50,22 @@ const char* urlhack_liberal_regex =
     ")"
     ;
 
+static void urlhack_index_rows(void);
+
 int urlhack_is_in_link_region(int x, int y)
 {
-    unsigned int i = 0;
+    int k;
 
-    while (i != link_regions_current_pos) {
-        text_region r = *link_regions[i];
+    if (!link_row_index_valid)
+        urlhack_index_rows();
+    if (y < 0 || y >= link_rows)
+        return 0;
 
-        if ((r.y0 == r.y1 && y == r.y0 && y == r.y1 && x >= r.x0 && x < r.x1) ||
-            (r.y0 != r.y1 && ((y == r.y0 && x >= r.x0) || (y == r.y1 && x < r.x1) || (y > r.y0 && y < r.y1))))
-            return i+1;
-        i++;
+    for (k = link_row_start[y]; k < link_row_start[y + 1]; k++) {
+        if (urlhack_is_in_this_link_region(link_regions[link_row_list[k]], x, y))
+            return link_row_list[k] + 1;
     }
-    
+
     return 0;
 }
 
@@ -68,19 +81,11 @@ int urlhack_is_in_this_link_region(text_region r, int x, int y)
 
 text_region urlhack_get_link_bounds(int x, int y)
 {
-    unsigned int i = 0;
+    int i = urlhack_is_in_link_region(x, y);
     text_region region;
 
-    while (i != link_regions_current_pos) {
-        text_region r = *link_regions[i];
-
-        if ((r.y0 == r.y1 && y == r.y0 && y == r.y1 && x >= r.x0 && x < r.x1) ||
-            (r.y0 != r.y1 && ((y == r.y0 && x >= r.x0) || (y == r.y1 && x < r.x1) || (y > r.y0 && y < r.y1)))) {
-            return *link_regions[i];
-        }
-
-        i++;
-    }
+    if (i > 0)
+        return link_regions[i - 1];
 
     region.x0 = region.y0 = region.x1 = region.y1 = -1;
     return region;
@@ -95,28 +100,66 @@ text_region urlhack_get_link_region(int index)
         return region;
     }
     else {
-        return *link_regions[index];
+        return link_regions[index];
     }
 }
 
 void urlhack_add_link_region(int x0, int y0, int x1, int y1)
 {
     if (link_regions_current_pos >= link_regions_len) {
-        unsigned int i;
         link_regions_len *= 2;
-        link_regions = sresize(link_regions, link_regions_len, text_region*);
-        for (i = link_regions_current_pos; i < link_regions_len; ++i) {
-            link_regions[i] = NULL;
-        }
+        link_regions = sresize(link_regions, link_regions_len, text_region);
     }
 
-    link_regions[link_regions_current_pos] = snew(text_region);
-    link_regions[link_regions_current_pos]->x0 = x0;
-    link_regions[link_regions_current_pos]->y0 = y0;
-    link_regions[link_regions_current_pos]->x1 = x1;
-    link_regions[link_regions_current_pos]->y1 = y1;
+    link_regions[link_regions_current_pos].x0 = x0;
+    link_regions[link_regions_current_pos].y0 = y0;
+    link_regions[link_regions_current_pos].x1 = x1;
+    link_regions[link_regions_current_pos].y1 = y1;
 
     link_regions_current_pos++;
+    link_row_index_valid = 0;
+}
+
+/*
+ * Rebuild the per-row index after the set of regions has changed.
+ */
+static void urlhack_index_rows(void)
+{
+    unsigned int i;
+    int y, total = 0;
+
+    link_rows = 0;
+    for (i = 0; i < link_regions_current_pos; i++)
+        if (link_regions[i].y1 + 1 > link_rows)
+            link_rows = link_regions[i].y1 + 1;
+
+    if (link_rows + 1 > link_row_size) {
+        link_row_size = link_rows + 1;
+        link_row_start = sresize(link_row_start, link_row_size, int);
+    }
+    memset(link_row_start, 0, (link_rows + 1) * sizeof(int));
+
+    /* count the regions touching each row, then turn counts into starts */
+    for (i = 0; i < link_regions_current_pos; i++)
+        for (y = (link_regions[i].y0 < 0 ? 0 : link_regions[i].y0); y <= link_regions[i].y1; y++)
+            link_row_start[y + 1]++;
+    for (y = 0; y < link_rows; y++)
+        link_row_start[y + 1] += link_row_start[y];
+    total = link_row_start[link_rows];
+
+    if (total > link_row_list_size) {
+        link_row_list_size = total;
+        link_row_list = sresize(link_row_list, link_row_list_size, int);
+    }
+    for (i = 0; i < link_regions_current_pos; i++)
+        for (y = (link_regions[i].y0 < 0 ? 0 : link_regions[i].y0); y <= link_regions[i].y1; y++)
+            link_row_list[link_row_start[y]++] = i;
+    /* the fill loop advanced each start to the next row's start */
+    for (y = link_rows; y > 0; y--)
+        link_row_start[y] = link_row_start[y - 1];
+    link_row_start[0] = 0;
+
+    link_row_index_valid = 1;
 }
 
 void urlhack_launch_url(const char* app, const char *url)
@@ -137,14 +180,8 @@ int urlhack_is_ctrl_pressed()
 
 void urlhack_link_regions_clear()
 {
-    unsigned int i;
-    for (i = 0; i < link_regions_len; ++i) {
-        if (link_regions[i] != NULL) {
-            sfree(link_regions[i]);
-            link_regions[i] = NULL;
-        }
-    }
     link_regions_current_pos = 0;
+    link_row_index_valid = 0;
 }
 
 // Regular expression stuff
@@ -154,21 +191,43 @@ static regex_t urlhack_rx ;
 static char *window_text;
 static int window_text_len;
 static int window_text_current_pos;
+
+/*
+ * The screen is scanned one segment at a time: a run of rows joined by
+ * line wrapping, as marked with urlhack_newline(). A link can't cross
+ * from one segment into the next.
+ *
+ * Most repaints change only a few rows (typing at a prompt), or move
+ * rows without changing them (scrolling), so each segment's matches are
+ * kept, keyed by its text, and the next find pass reuses them for any
+ * segment it meets again rather than running the regex over it.
+ */
+typedef struct {
+    unsigned long hash;
+    int len;
+    char *text;                 /* to confirm a hash hit */
+    int nlinks;
+    int *links;                 /* start and end offset of each link */
+} urlhack_segment;
+
+static unsigned char *row_wrapped;
+static int row_wrapped_len, rows_marked;
+
+static urlhack_segment *segs, *oldsegs;
+static int nsegs, noldsegs, segs_size, oldsegs_size;
+static int *oldseg_table;       /* open addressing index into oldsegs, or -1 */
+static int oldseg_table_size;
+
 void urlhack_enable(void){
 	urlhack_disabled=0;
 }
 void urlhack_init()
 {
-    unsigned int i;
-
     /* 32 links seems like a sane base value */
     link_regions_current_pos = 0;
     link_regions_len = 32;
-    link_regions = snewn(link_regions_len, text_region*);
-
-    for (i = 0; i < link_regions_len; ++i) {
-        link_regions[i] = NULL;
-    }
+    link_regions = snewn(link_regions_len, text_region);
+    link_row_index_valid = 0;
 
     /* Start with default terminal size */
     //window_text_len = 80*24+1;
@@ -177,27 +236,73 @@ void urlhack_init()
     urlhack_reset();
 }
 
+static void urlhack_segments_free(urlhack_segment *list, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        sfree(list[i].text);
+        sfree(list[i].links);
+    }
+}
+
+/* forget all remembered matches, e.g. because the regex has changed */
+static void urlhack_cache_clear(void)
+{
+    urlhack_segments_free(segs, nsegs);
+    urlhack_segments_free(oldsegs, noldsegs);
+    nsegs = noldsegs = 0;
+}
+
 void urlhack_cleanup()
 {
     urlhack_link_regions_clear();
+    urlhack_cache_clear();
     sfree(link_regions);
+    sfree(link_row_start);
+    sfree(link_row_list);
     sfree(window_text);
+    sfree(row_wrapped);
+    sfree(segs);
+    sfree(oldsegs);
+    sfree(oldseg_table);
+    link_regions = NULL;
+    link_row_start = link_row_list = NULL;
+    window_text = NULL;
+    row_wrapped = NULL;
+    segs = oldsegs = NULL;
+    oldseg_table = NULL;
+    link_row_size = link_row_list_size = 0;
+    row_wrapped_len = segs_size = oldsegs_size = oldseg_table_size = 0;
 }
 
 void urlhack_putchar(char ch)
 {
-    if (window_text_current_pos >= window_text_len) {
+    /* keep a byte spare to terminate a segment for regexec */
+    if (window_text_current_pos + 1 >= window_text_len) {
         window_text = sresize(window_text, 2 * window_text_len, char);
-        memset(window_text + window_text_current_pos, '\0', window_text_len - window_text_current_pos);
         window_text_len *= 2;
     }
     window_text[window_text_current_pos++] = ch;
 }
 
+/*
+ * End of a screen row; `wrapped' says the text carries on into the next
+ * one. If this is never called, the whole text is one segment broken
+ * into rows of screen_width, as it always used to be.
+ */
+void urlhack_newline(int wrapped)
+{
+    if (rows_marked >= row_wrapped_len) {
+        row_wrapped_len = row_wrapped_len ? 2 * row_wrapped_len : 256;
+        row_wrapped = sresize(row_wrapped, row_wrapped_len, unsigned char);
+    }
+    row_wrapped[rows_marked++] = wrapped ? 1 : 0;
+}
+
 void urlhack_reset()
 {
-    memset(window_text, '\0', window_text_len);
     window_text_current_pos = 0;
+    rows_marked = 0;
 }
 
 static void rtfm(char *error)
@@ -258,6 +363,7 @@ void urlhack_set_regular_expression(int mode, const char* expression)
 	regfree(&urlhack_rx);
 	is_regexp_compiled = 0;
     }
+    urlhack_cache_clear();
         //set_regerror_func(rtfm);
 	int result ;
 	if( (result=regcomp(&urlhack_rx,(char*)(to_use),REG_EXTENDED)) != 0 ){
@@ -269,13 +375,121 @@ void urlhack_set_regular_expression(int mode, const char* expression)
 		is_regexp_compiled = 1 ; 
 		logevent(NULL, "Hyperlink patch: regex successfully compiled" ) ;
 	}
+	free(to_use);
 #endif
 }
 
+/*
+ * This runs over the whole screen on every pass, so it takes eight
+ * bytes at a time in two independent lanes. It only has to spread
+ * segments over the table; a hit is always confirmed with memcmp.
+ */
+static unsigned long urlhack_hash(const char *text, int len)
+{
+    unsigned int h1 = 0x9E3779B9U, h2 = (unsigned int)len;
+    int i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        unsigned int a, b;
+        memcpy(&a, text + i, 4);
+        memcpy(&b, text + i + 4, 4);
+        h1 = (h1 ^ a) * 0x85EBCA6BU;
+        h1 ^= h1 >> 15;
+        h2 = (h2 ^ b) * 0xC2B2AE35U;
+        h2 ^= h2 >> 13;
+    }
+    for (; i < len; i++)
+        h1 = (h1 ^ (unsigned char)text[i]) * 16777619U;
+
+    h1 ^= h2 * 0x27D4EB2DU;
+    h1 ^= h1 >> 16;
+    return h1;
+}
+
+/*
+ * Index last pass's segments by hash, so this pass can find its
+ * unchanged ones.
+ */
+static void urlhack_index_oldsegs(void)
+{
+    int i, size = 64;
+
+    while (size < 2 * noldsegs)
+        size *= 2;
+    if (size > oldseg_table_size) {
+        oldseg_table_size = size;
+        oldseg_table = sresize(oldseg_table, oldseg_table_size, int);
+    }
+    for (i = 0; i < oldseg_table_size; i++)
+        oldseg_table[i] = -1;
+    for (i = 0; i < noldsegs; i++) {
+        unsigned long j = oldsegs[i].hash & (oldseg_table_size - 1);
+        while (oldseg_table[j] >= 0)
+            j = (j + 1) & (oldseg_table_size - 1);
+        oldseg_table[j] = i;
+    }
+}
+
+/*
+ * Get the matches for one segment into seg: from last pass if the same
+ * text was on screen then, otherwise by running the regex over it.
+ */
+static void urlhack_scan_segment(urlhack_segment *seg, char *text, int len)
+{
+    unsigned long j;
+    char saved;
+    char *text_pos;
+    regmatch_t groupArray;
+    int error, size = 0;
+
+    seg->hash = urlhack_hash(text, len);
+    seg->len = len;
+
+    for (j = seg->hash & (oldseg_table_size - 1); oldseg_table[j] >= 0;
+         j = (j + 1) & (oldseg_table_size - 1)) {
+        urlhack_segment *old = &oldsegs[oldseg_table[j]];
+        if (old->text != NULL && old->hash == seg->hash && old->len == len &&
+            !memcmp(old->text, text, len)) {
+            *seg = *old;
+            old->text = NULL;   /* now owned by seg */
+            old->links = NULL;
+            return;
+        }
+    }
+
+    seg->text = snewn(len, char);
+    memcpy(seg->text, text, len);
+    seg->nlinks = 0;
+    seg->links = NULL;
+
+    saved = text[len];
+    text[len] = '\0';
+    text_pos = text;
+    error = regexec(&urlhack_rx, text_pos, 1, &groupArray ,0) ;
+    while( error==0 ) {
+	char* start_pos = text_pos + groupArray.rm_so ; if(start_pos[0]==' ') start_pos++ ;
+
+	if (seg->nlinks >= size) {
+	    size = size ? 2 * size : 4;
+	    seg->links = sresize(seg->links, 2 * size, int);
+	}
+	seg->links[2 * seg->nlinks] = start_pos - text;
+	seg->links[2 * seg->nlinks + 1] = text_pos + groupArray.rm_eo - text;
+	seg->nlinks++;
+
+	text_pos = text_pos + groupArray.rm_eo + 1;
+	if (text_pos > text + len)
+	    break;
+	error = regexec(&urlhack_rx, text_pos, 1, &groupArray ,REG_NOTBOL) ;
+    }
+    text[len] = saved;
+}
+
 void urlhack_go_find_me_some_hyperlinks(int screen_width)
 {
 #ifndef MOD_NOHYPERLINK
-    char* text_pos;
+    urlhack_segment *tmp;
+    int rows, row, i, tmpsize;
 	
     if( urlhack_disabled!=0 ) {
 	    return ;
@@ -285,27 +499,55 @@ void urlhack_go_find_me_some_hyperlinks(int screen_width)
 	if( !is_regexp_compiled ) return ;
     }
     urlhack_link_regions_clear();
-    text_pos = window_text;
-	regmatch_t groupArray;
-	int error ;
-    error = regexec(&urlhack_rx, text_pos, 1, &groupArray ,0) ;
-    while( error==0 ) {
-
-	    char* start_pos = text_pos + groupArray.rm_so ; if(start_pos[0]==' ') start_pos++ ;
-
-        int x0 = (start_pos - window_text) % screen_width;
-        int y0 = (start_pos - window_text) / screen_width;
-	    
-	int x1 = (text_pos + groupArray.rm_eo - window_text) % screen_width;
-        int y1 = (text_pos + groupArray.rm_eo - window_text) / screen_width;
-	    
-	if (x0 >= screen_width) x0 = screen_width - 1;
-        if (x1 >= screen_width) x1 = screen_width - 1;
-        urlhack_add_link_region(x0, y0, x1, y1);
-		    
-	text_pos = text_pos + groupArray.rm_eo + 1;
-	error = regexec(&urlhack_rx, text_pos, 1, &groupArray ,REG_NOTBOL) ;
+    if (screen_width <= 0)
+	return;
+
+    /* what we found last time is now the cache */
+    tmp = oldsegs; oldsegs = segs; segs = tmp;
+    tmpsize = oldsegs_size; oldsegs_size = segs_size; segs_size = tmpsize;
+    noldsegs = nsegs;
+    nsegs = 0;
+    urlhack_index_oldsegs();
+
+    rows = (window_text_current_pos + screen_width - 1) / screen_width;
+    for (row = 0; row < rows; ) {
+	int first = row, start, len;
+
+	/* without urlhack_newline() calls it's all one segment */
+	while (row < rows - 1 && (rows_marked == 0 || (row < rows_marked && row_wrapped[row])))
+	    row++;
+	row++;
+
+	start = first * screen_width;
+	len = row * screen_width;
+	if (len > window_text_current_pos)
+	    len = window_text_current_pos;
+	len -= start;
+
+	if (nsegs >= segs_size) {
+	    segs_size = segs_size ? 2 * segs_size : 64;
+	    segs = sresize(segs, segs_size, urlhack_segment);
+	}
+	urlhack_scan_segment(&segs[nsegs], window_text + start, len);
+
+	for (i = 0; i < segs[nsegs].nlinks; i++) {
+	    int so = start + segs[nsegs].links[2 * i];
+	    int eo = start + segs[nsegs].links[2 * i + 1];
+	    int x0 = so % screen_width;
+	    int y0 = so / screen_width;
+	    int x1 = eo % screen_width;
+	    int y1 = eo / screen_width;
+
+	    if (x0 >= screen_width) x0 = screen_width - 1;
+	    if (x1 >= screen_width) x1 = screen_width - 1;
+	    urlhack_add_link_region(x0, y0, x1, y1);
 	}
+	nsegs++;
+    }
+
+    /* segments that have gone from the screen */
+    urlhack_segments_free(oldsegs, noldsegs);
+    noldsegs = 0;
 #endif
 }
 
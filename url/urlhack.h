@@ -23,6 +23,7 @@ int urlhack_mouse_old_x, urlhack_mouse_old_y, urlhack_current_region;
 void urlhack_reset();
 void urlhack_go_find_me_some_hyperlinks(int screen_width);
 void urlhack_putchar(char ch);
+void urlhack_newline(int wrapped);
 text_region urlhack_get_link_region(int index);
 
 int urlhack_is_in_link_region(int x, int y);
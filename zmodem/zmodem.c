@@ -0,0 +1,1372 @@
+/*
+ * zmodem.c: ZMODEM file transfer over the terminal session.
+ *
+ * This is a complete sender and receiver, so that a transfer no longer
+ * needs an rz or sz process on the local machine with the session
+ * plumbed through pipes into it. The data the remote end sends goes
+ * straight from term_data() into zmodem_input(), and what we have to
+ * say goes straight out through the host's write function, which
+ * sends it to the backend.
+ *
+ * Incoming bytes go through a decoder which finds headers and data
+ * subpackets, undoes the ZDLE escaping and checks the CRCs, and hands
+ * complete frames to the sender's or the receiver's state machine.
+ * Runs of data bytes with nothing in them to unescape are copied in
+ * one go; so are runs on the way out with nothing to escape. The
+ * CRC-32 is table-driven, eight bytes at a time. (It's not PuTTY's
+ * crc32_update, which does without a table so as not to leak SSH-1
+ * session data through the cache, a concern that doesn't apply to
+ * files we're sending in the clear anyway.)
+ *
+ * The sender streams 8K subpackets without waiting to be acknowledged,
+ * unless the receiver asks for a window, and stops when the data it
+ * has written but the host hasn't sent yet reaches ZM_BACKLOG. It
+ * drops to smaller subpackets if the receiver reports errors. Either
+ * end can pick up a partial file where it left off.
+ *
+ * Nothing in here is specific to Windows; test/zmtest.c runs it on
+ * Linux, against itself and against lrzsz.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "putty.h"
+#include "zmodem.h"
+
+/* Frame types */
+enum {
+    ZRQINIT, ZRINIT, ZSINIT, ZACK, ZFILE, ZSKIP, ZNAK, ZABORT, ZFIN,
+    ZRPOS, ZDATA, ZEOF, ZFERR, ZCRC, ZCHALLENGE, ZCOMPL, ZCAN, ZFREECNT,
+    ZCOMMAND, ZSTDERR
+};
+
+#define ZPAD '*'
+#define ZDLE 0x18                      /* also CAN */
+#define ZBIN 'A'
+#define ZHEX 'B'
+#define ZBIN32 'C'
+
+/* Ends of data subpackets, after a ZDLE */
+#define ZCRCE 'h'                      /* end of frame, header follows */
+#define ZCRCG 'i'                      /* more data follows */
+#define ZCRCQ 'j'                      /* more data follows, ZACK wanted */
+#define ZCRCW 'k'                      /* end of frame, ZACK wanted */
+#define ZRUB0 'l'                      /* escaped 0x7F */
+#define ZRUB1 'm'                      /* escaped 0xFF */
+
+/* ZRINIT flags, in ZF0 */
+#define CANFDX  0x01
+#define CANOVIO 0x02
+#define CANFC32 0x20
+#define ESCCTL  0x40
+
+/* ZFILE conversion options, in ZF0 */
+#define ZCBIN   1
+#define ZCRESUM 3
+
+/* Positions of the flag and position bytes in a header */
+#define ZF0 3
+#define ZP0 0
+#define ZP1 1
+
+#define XON 0x11
+
+#define ZM_MAXBLOCK 8192               /* largest subpacket either way */
+#define ZM_MINBLOCK 1024
+#define ZM_TIMEOUT 10000               /* ms */
+#define ZM_RETRIES 10
+
+#ifdef _WIN32
+#define zm_fseek _fseeki64
+typedef struct _stat64 zm_statbuf;
+#define zm_stat _stat64
+#define ZM_DIRSEP '\\'
+#else
+#define zm_fseek fseeko
+typedef struct stat zm_statbuf;
+#define zm_stat stat
+#define ZM_DIRSEP '/'
+#endif
+
+typedef enum {
+    ZM_IDLE,
+    /* Receiving */
+    ZR_INIT,                           /* sent ZRINIT, waiting for a file */
+    ZR_WAITDATA,                       /* sent ZRPOS, waiting for ZDATA */
+    ZR_DATA,                           /* in the middle of the data */
+    ZR_FIN,                            /* sent ZFIN, waiting for "OO" */
+    /* Sending */
+    ZS_INIT,                           /* sent ZRQINIT, waiting for ZRINIT */
+    ZS_FILE,                           /* sent ZFILE, waiting for ZRPOS */
+    ZS_DATA,                           /* streaming the data */
+    ZS_WAITACK,                        /* sent ZCRCW, waiting for ZACK */
+    ZS_EOF,                            /* sent ZEOF, waiting for ZRINIT */
+    ZS_FIN,                            /* sent ZFIN, waiting for ZFIN */
+} ZmState;
+
+/* What the decoder is in the middle of */
+typedef enum {
+    RX_HUNT,                           /* looking for ZPAD ZDLE */
+    RX_HEX,                            /* hex header digits */
+    RX_BIN,                            /* binary header bytes */
+    RX_DATA,                           /* subpacket data */
+    RX_CRC,                            /* subpacket CRC */
+} RxState;
+
+struct ZModem {
+    ZModemHost *host;
+    ZmState state;
+    bool ok;
+    unsigned flags;
+    strbuf *out;
+
+    /* The decoder */
+    RxState rx;
+    int hunt;                          /* seen ZPAD (1), then ZDLE (2) */
+    int cans;                          /* consecutive CANs: 5 is an abort */
+    int skipcrlf;                      /* after a hex header */
+    bool escape;                       /* the last byte was ZDLE */
+    bool rxbin32;                      /* last header had a 32-bit CRC */
+    unsigned char hdr[9];
+    int datatype;                      /* the header the data follows */
+    size_t hdrlen, hdrwant;
+    char hex[14];
+    unsigned char *buf;                /* ZM_MAXBLOCK + 1 */
+    size_t buflen;
+    unsigned char frameend;
+    unsigned char crc[4];
+    size_t crclen;
+
+    /* The encoder */
+    unsigned char txesc[256];          /* 1: escape; 2: escape after '@' */
+    unsigned char lastsent;
+    bool txbin32;
+
+    /* Timeouts */
+    unsigned long now, deadline;
+    bool timing;
+    int retries, ocount;
+
+    /* The current file */
+    FILE *fp;
+    char *name;
+    uint64_t size, pos, acked;
+
+    /* Receiving */
+    char *dir;
+    bool remote_resume;
+
+    /* Sending */
+    char **files;
+    size_t nfiles, nextfile;
+    size_t window, blocklen;
+    unsigned char *block;
+};
+
+/* ----------------------------------------------------------------------
+ * CRCs. The header and data CRCs are either the 16-bit CCITT one
+ * (XMODEM's) or the usual CRC-32, depending on the header type.
+ */
+
+static uint16_t crc16_table[256];
+static uint32_t crc32_table[8][256];
+
+static void zm_make_tables(void)
+{
+    static bool done = false;
+    unsigned i, j;
+
+    if (done)
+        return;
+
+    for (i = 0; i < 256; i++) {
+        uint16_t c16 = i << 8;
+        uint32_t c32 = i;
+        for (j = 0; j < 8; j++) {
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : (c16 << 1);
+            c32 = (c32 & 1) ? (c32 >> 1) ^ 0xEDB88320U : (c32 >> 1);
+        }
+        crc16_table[i] = c16;
+        crc32_table[0][i] = c32;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            crc32_table[j][i] = (crc32_table[j-1][i] >> 8) ^
+                crc32_table[0][crc32_table[j-1][i] & 0xFF];
+    done = true;
+}
+
+static uint16_t zm_crc16(uint16_t crc, const unsigned char *p, size_t len)
+{
+    while (len--)
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *p++];
+    return crc;
+}
+
+/* Slicing-by-8: fold in eight bytes with eight table lookups */
+static uint32_t zm_crc32(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint32_t a = GET_32BIT_LSB_FIRST(p) ^ crc;
+        uint32_t b = GET_32BIT_LSB_FIRST(p + 4);
+        crc = crc32_table[7][a & 0xFF] ^ crc32_table[6][(a >> 8) & 0xFF] ^
+            crc32_table[5][(a >> 16) & 0xFF] ^ crc32_table[4][a >> 24] ^
+            crc32_table[3][b & 0xFF] ^ crc32_table[2][(b >> 8) & 0xFF] ^
+            crc32_table[1][(b >> 16) & 0xFF] ^ crc32_table[0][b >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+/* ----------------------------------------------------------------------
+ * Output.
+ */
+
+static void zm_flush(ZModem *zm)
+{
+    if (zm->out->len) {
+        zm->host->vt->write(zm->host, zm->out->u, zm->out->len);
+        strbuf_clear(zm->out);
+    }
+}
+
+static void zm_set_escapes(ZModem *zm, bool escctl)
+{
+    static const unsigned char always[] = {
+        ZDLE, ZDLE | 0x80, 0x10, 0x90, 0x11, 0x91, 0x13, 0x93,
+    };
+    unsigned c;
+
+    for (c = 0; c < 256; c++)
+        zm->txesc[c] = (escctl && !(c & 0x60)) ? 1 : 0;
+    for (c = 0; c < lenof(always); c++)
+        zm->txesc[always[c]] = 1;
+    /* CR after '@' could be taken for a Telenet escape */
+    if (!zm->txesc[0x0D]) {
+        zm->txesc[0x0D] = 2;
+        zm->txesc[0x8D] = 2;
+    }
+}
+
+static void zm_put_escaped(ZModem *zm, const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        size_t start = i;
+        unsigned char c;
+
+        while (i < len && !zm->txesc[p[i]])
+            i++;
+        if (i > start) {
+            put_data(zm->out, p + start, i - start);
+            zm->lastsent = p[i - 1];
+        }
+        if (i == len)
+            break;
+
+        c = p[i++];
+        if (zm->txesc[c] == 2 && (zm->lastsent & 0x7F) != '@') {
+            put_byte(zm->out, c);
+            zm->lastsent = c;
+        } else {
+            put_byte(zm->out, ZDLE);
+            put_byte(zm->out, c ^ 0x40);
+            zm->lastsent = c ^ 0x40;
+        }
+    }
+}
+
+static const unsigned char zm_zero[4];
+
+static void zm_pos_hdr(unsigned char *hdr, uint64_t pos)
+{
+    PUT_32BIT_LSB_FIRST(hdr, (uint32_t)pos);
+}
+
+static void zm_flags_hdr(unsigned char *hdr, unsigned f0)
+{
+    memset(hdr, 0, 4);
+    hdr[ZF0] = f0;
+}
+
+static void zm_hex_header(ZModem *zm, int type, const unsigned char *hdr)
+{
+    unsigned char b[5];
+    uint16_t crc;
+    size_t i;
+
+    b[0] = type;
+    memcpy(b + 1, hdr, 4);
+    crc = zm_crc16(0, b, 5);
+
+    put_datapl(zm->out, PTRLEN_LITERAL("**\x18" "B"));
+    for (i = 0; i < 5; i++)
+        strbuf_catf(zm->out, "%02x", b[i]);
+    strbuf_catf(zm->out, "%02x%02x\r\x8a", crc >> 8, crc & 0xFF);
+    if (type != ZFIN && type != ZACK)
+        put_byte(zm->out, XON);
+    zm->lastsent = 0;
+}
+
+static void zm_bin_header(ZModem *zm, int type, const unsigned char *hdr)
+{
+    unsigned char b[5], crc[4];
+
+    b[0] = type;
+    memcpy(b + 1, hdr, 4);
+
+    put_byte(zm->out, ZPAD);
+    put_byte(zm->out, ZDLE);
+    put_byte(zm->out, zm->txbin32 ? ZBIN32 : ZBIN);
+    zm->lastsent = 0;
+    zm_put_escaped(zm, b, 5);
+    if (zm->txbin32) {
+        PUT_32BIT_LSB_FIRST(crc, ~zm_crc32(0xFFFFFFFFU, b, 5));
+        zm_put_escaped(zm, crc, 4);
+    } else {
+        PUT_16BIT_MSB_FIRST(crc, zm_crc16(0, b, 5));
+        zm_put_escaped(zm, crc, 2);
+    }
+}
+
+static void zm_subpacket(ZModem *zm, const void *data, size_t len,
+                         unsigned char end)
+{
+    unsigned char crc[4];
+
+    zm_put_escaped(zm, data, len);
+    put_byte(zm->out, ZDLE);
+    put_byte(zm->out, end);
+    zm->lastsent = end;
+    if (zm->txbin32) {
+        uint32_t c = zm_crc32(0xFFFFFFFFU, data, len);
+        PUT_32BIT_LSB_FIRST(crc, ~zm_crc32(c, &end, 1));
+        zm_put_escaped(zm, crc, 4);
+    } else {
+        PUT_16BIT_MSB_FIRST(crc, zm_crc16(zm_crc16(0, data, len), &end, 1));
+        zm_put_escaped(zm, crc, 2);
+    }
+    if (end == ZCRCW)
+        put_byte(zm->out, XON);
+}
+
+static void zm_send_pos(ZModem *zm, int type, uint64_t pos)
+{
+    unsigned char hdr[4];
+    zm_pos_hdr(hdr, pos);
+    zm_hex_header(zm, type, hdr);
+}
+
+static void zm_set_timer(ZModem *zm)
+{
+    zm->deadline = zm->now + ZM_TIMEOUT;
+}
+
+/* ----------------------------------------------------------------------
+ * Starting and finishing.
+ */
+
+ZModem *zmodem_new(ZModemHost *host)
+{
+    ZModem *zm = snew(ZModem);
+
+    zm_make_tables();
+    memset(zm, 0, sizeof(ZModem));
+    zm->host = host;
+    zm->state = ZM_IDLE;
+    zm->out = strbuf_new_nm();
+    zm->buf = snewn(ZM_MAXBLOCK + 1, unsigned char);
+    zm->block = snewn(ZM_MAXBLOCK, unsigned char);
+    return zm;
+}
+
+static void zm_close_file(ZModem *zm)
+{
+    if (zm->fp) {
+        fclose(zm->fp);
+        zm->fp = NULL;
+    }
+    sfree(zm->name);
+    zm->name = NULL;
+}
+
+static void zm_free_files(ZModem *zm)
+{
+    size_t i;
+
+    for (i = 0; i < zm->nfiles; i++)
+        sfree(zm->files[i]);
+    sfree(zm->files);
+    zm->files = NULL;
+    zm->nfiles = zm->nextfile = 0;
+    sfree(zm->dir);
+    zm->dir = NULL;
+}
+
+static void zm_finish(ZModem *zm, bool ok, const char *msg)
+{
+    zm_flush(zm);
+    zm_close_file(zm);
+    zm_free_files(zm);
+    zm->state = ZM_IDLE;
+    zm->ok = ok;
+    if (msg)
+        zm->host->vt->message(zm->host, msg);
+}
+
+void zmodem_free(ZModem *zm)
+{
+    zm_close_file(zm);
+    zm_free_files(zm);
+    strbuf_free(zm->out);
+    sfree(zm->buf);
+    sfree(zm->block);
+    sfree(zm);
+}
+
+static void zm_start(ZModem *zm, ZmState state, unsigned flags)
+{
+    zm->state = state;
+    zm->flags = flags;
+    zm->ok = false;
+    zm->rx = RX_HUNT;
+    zm->hunt = zm->cans = zm->skipcrlf = 0;
+    zm->escape = false;
+    zm->timing = false;
+    zm->retries = 0;
+    zm->txbin32 = false;
+    zm_set_escapes(zm, (flags & ZM_ESCCTL) != 0);
+}
+
+bool zmodem_receive(ZModem *zm, const char *dir, unsigned flags)
+{
+    unsigned char hdr[4];
+
+    if (zm->state != ZM_IDLE)
+        return false;
+    zm_start(zm, ZR_INIT, flags);
+    zm->dir = dupstr(dir);
+
+    zm_flags_hdr(hdr, CANFDX | CANOVIO | CANFC32 |
+                 ((flags & ZM_ESCCTL) ? ESCCTL : 0));
+    zm_hex_header(zm, ZRINIT, hdr);
+    zm_flush(zm);
+    return true;
+}
+
+bool zmodem_send(ZModem *zm, const char *const *files, size_t nfiles,
+                 unsigned flags)
+{
+    unsigned char hdr[4];
+    size_t i;
+
+    if (zm->state != ZM_IDLE)
+        return false;
+    zm_start(zm, ZS_INIT, flags);
+    zm->files = snewn(nfiles, char *);
+    for (i = 0; i < nfiles; i++)
+        zm->files[i] = dupstr(files[i]);
+    zm->nfiles = nfiles;
+    zm->nextfile = 0;
+
+    /* Start rz at the other end, in case it's sitting at a shell */
+    put_datapl(zm->out, PTRLEN_LITERAL("rz\r"));
+    zm_flags_hdr(hdr, 0);
+    zm_hex_header(zm, ZRQINIT, hdr);
+    zm_flush(zm);
+    return true;
+}
+
+void zmodem_cancel(ZModem *zm)
+{
+    static const char cancel[] = "\x18\x18\x18\x18\x18\x18\x18\x18"
+        "\b\b\b\b\b\b\b\b\b\b";
+
+    if (zm->state == ZM_IDLE)
+        return;
+    put_data(zm->out, cancel, sizeof(cancel) - 1);
+    zm_finish(zm, false, "Transfer cancelled");
+}
+
+bool zmodem_active(ZModem *zm)
+{
+    return zm->state != ZM_IDLE;
+}
+
+bool zmodem_succeeded(ZModem *zm)
+{
+    return zm->ok;
+}
+
+/* ----------------------------------------------------------------------
+ * The sender.
+ */
+
+static const char *zm_basename(const char *path)
+{
+    const char *p, *base = path;
+
+    for (p = path; *p; p++)
+        if (*p == '/' || *p == '\\' || *p == ':')
+            base = p + 1;
+    return base;
+}
+
+static void zm_send_next_file(ZModem *zm)
+{
+    unsigned char hdr[4];
+
+    zm_close_file(zm);
+
+    while (zm->nextfile < zm->nfiles) {
+        const char *path = zm->files[zm->nextfile++];
+        zm_statbuf st;
+        strbuf *info;
+        uint64_t left = 0;
+        size_t i;
+
+        if (zm_stat(path, &st) != 0 || !(zm->fp = fopen(path, "rb"))) {
+            char *msg = dupprintf("Unable to open %s", path);
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            continue;
+        }
+        if ((uint64_t)st.st_size > 0xFFFFFFFFU) {
+            char *msg = dupprintf("%s is too big to send by ZMODEM", path);
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            fclose(zm->fp);
+            zm->fp = NULL;
+            continue;
+        }
+        zm->name = dupstr(zm_basename(path));
+        zm->size = st.st_size;
+        zm->pos = zm->acked = 0;
+        zm->blocklen = ZM_MAXBLOCK;
+
+        for (i = zm->nextfile; i < zm->nfiles; i++) {
+            zm_statbuf st2;
+            if (zm_stat(zm->files[i], &st2) == 0)
+                left += st2.st_size;
+        }
+
+        info = strbuf_new();
+        put_datapl(info, ptrlen_from_asciz(zm->name));
+        put_byte(info, 0);
+        strbuf_catf(info, "%"PRIu64" %lo 0 0 %d %"PRIu64, zm->size,
+                    (unsigned long)st.st_mtime,
+                    (int)(zm->nfiles - zm->nextfile + 1), zm->size + left);
+        put_byte(info, 0);
+
+        zm_flags_hdr(hdr, (zm->flags & ZM_RESUME) ? ZCRESUM : ZCBIN);
+        zm_bin_header(zm, ZFILE, hdr);
+        zm_subpacket(zm, info->u, info->len, ZCRCW);
+        strbuf_free(info);
+
+        zm->state = ZS_FILE;
+        zm_set_timer(zm);
+        zm_flush(zm);
+        return;
+    }
+
+    zm_flags_hdr(hdr, 0);
+    zm_hex_header(zm, ZFIN, hdr);
+    zm->state = ZS_FIN;
+    zm_set_timer(zm);
+    zm_flush(zm);
+}
+
+static void zm_send_from(ZModem *zm, uint64_t pos)
+{
+    unsigned char hdr[4];
+
+    if (zm_fseek(zm->fp, pos, SEEK_SET) != 0) {
+        zmodem_cancel(zm);
+        return;
+    }
+    zm->pos = zm->acked = pos;
+    zm_pos_hdr(hdr, pos);
+    zm_bin_header(zm, ZDATA, hdr);
+    zm->state = ZS_DATA;
+    zm_set_timer(zm);
+}
+
+/*
+ * Keep the output topped up with subpackets, as long as the host is
+ * keeping up with it.
+ */
+static void zm_send_more(ZModem *zm)
+{
+    while (zm->state == ZS_DATA &&
+           zm->host->vt->backlog(zm->host) + zm->out->len < ZM_BACKLOG) {
+        size_t n = fread(zm->block, 1, zm->blocklen, zm->fp);
+        unsigned char end = ZCRCG;
+        bool eof = zm->pos + n >= zm->size;
+
+        if (n < zm->blocklen && !eof && ferror(zm->fp)) {
+            char *msg = dupprintf("Error reading %s", zm->name);
+            zmodem_cancel(zm);
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            return;
+        }
+        if (eof)
+            end = ZCRCE;
+        else if (zm->window && zm->pos + n - zm->acked + zm->blocklen >
+                 zm->window)
+            end = ZCRCW;
+
+        zm_subpacket(zm, zm->block, n, end);
+        zm->pos += n;
+        zm->host->vt->progress(zm->host, zm->name, zm->pos, zm->size);
+
+        if (eof) {
+            zm_send_pos(zm, ZEOF, zm->pos);
+            zm->state = ZS_EOF;
+        } else if (end == ZCRCW) {
+            zm->state = ZS_WAITACK;
+        }
+        zm_set_timer(zm);
+        zm_flush(zm);
+    }
+}
+
+static void zm_sender_header(ZModem *zm, int type, const unsigned char *hdr)
+{
+    uint32_t pos = GET_32BIT_LSB_FIRST(hdr);
+
+    switch (type) {
+      case ZRINIT:
+        if (zm->state == ZS_INIT) {
+            unsigned f = hdr[ZF0];
+            zm->txbin32 = (f & CANFC32) != 0;
+            zm->window = hdr[ZP0] | (hdr[ZP1] << 8);
+            zm_set_escapes(zm, (f & ESCCTL) || (zm->flags & ZM_ESCCTL));
+            zm_send_next_file(zm);
+        } else if (zm->state == ZS_EOF) {
+            char *msg = dupprintf("Sent %s (%"PRIu64" bytes)",
+                                  zm->name, zm->size);
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            zm_send_next_file(zm);
+        }
+        /*
+         * In ZS_FILE this is most likely the receiver's answer to
+         * our ZRQINIT, crossing with its first ZRINIT; if our ZFILE
+         * really was lost, the timeout will send it again.
+         */
+        break;
+
+      case ZRPOS:
+        if (zm->state == ZS_FILE || zm->state == ZS_DATA ||
+            zm->state == ZS_WAITACK || zm->state == ZS_EOF) {
+            if (zm->state == ZS_FILE) {
+                if (pos) {
+                    char *msg = dupprintf("Resuming %s at %"PRIu32,
+                                          zm->name, pos);
+                    zm->host->vt->message(zm->host, msg);
+                    sfree(msg);
+                }
+            } else if (zm->blocklen > ZM_MINBLOCK) {
+                zm->blocklen /= 2;     /* it's had trouble: go gently */
+            }
+            zm_send_from(zm, pos);
+        }
+        break;
+
+      case ZACK:
+        if (zm->state == ZS_DATA || zm->state == ZS_WAITACK) {
+            if (pos > (uint32_t)zm->acked && pos <= (uint32_t)zm->pos)
+                zm->acked = pos;
+            if (zm->state == ZS_WAITACK && pos == (uint32_t)zm->pos)
+                zm_send_from(zm, zm->pos);
+        }
+        break;
+
+      case ZSKIP:
+        if (zm->state == ZS_FILE || zm->state == ZS_DATA ||
+            zm->state == ZS_WAITACK || zm->state == ZS_EOF) {
+            char *msg = dupprintf("Skipped %s", zm->name);
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            zm_send_next_file(zm);
+        }
+        break;
+
+      case ZNAK:
+        if (zm->state == ZS_FILE && ++zm->retries < ZM_RETRIES) {
+            zm->nextfile--;
+            zm_send_next_file(zm);
+        }
+        break;
+
+      case ZCRC:
+        /* The receiver wants to know if its partial file is ours */
+        if (zm->state == ZS_FILE) {
+            uint32_t crc = 0xFFFFFFFFU;
+            uint64_t left = pos ? pos : zm->size;
+            unsigned char out[4];
+            size_t n;
+
+            zm_fseek(zm->fp, 0, SEEK_SET);
+            while (left && (n = fread(zm->block, 1, left < ZM_MAXBLOCK ?
+                                      left : ZM_MAXBLOCK, zm->fp)) > 0) {
+                crc = zm_crc32(crc, zm->block, n);
+                left -= n;
+            }
+            zm_pos_hdr(out, ~crc);
+            zm_hex_header(zm, ZCRC, out);
+        }
+        break;
+
+      case ZCHALLENGE:
+        zm_hex_header(zm, ZACK, hdr);
+        break;
+
+      case ZFIN:
+        if (zm->state == ZS_FIN) {
+            put_datapl(zm->out, PTRLEN_LITERAL("OO"));
+            zm_finish(zm, true, NULL);
+        }
+        break;
+
+      case ZCAN:
+      case ZABORT:
+        zm_finish(zm, false, "Transfer cancelled by the remote end");
+        break;
+
+      case ZFERR:
+        zm_finish(zm, false, "The remote end couldn't write the file");
+        break;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * The receiver.
+ */
+
+static void zm_send_zrinit(ZModem *zm)
+{
+    unsigned char hdr[4];
+    zm_flags_hdr(hdr, CANFDX | CANOVIO | CANFC32 |
+                 ((zm->flags & ZM_ESCCTL) ? ESCCTL : 0));
+    zm_hex_header(zm, ZRINIT, hdr);
+}
+
+/*
+ * Whether Windows would take a file name for a device. That goes by
+ * the part before the first dot, ignoring case and trailing spaces,
+ * so 'nul.txt' and 'Com1 .log' are devices too.
+ */
+static bool zm_device_name(const char *name)
+{
+    static const char *const devices[] = {
+        "CON", "PRN", "AUX", "NUL", "CONIN$", "CONOUT$",
+        "COM1", "COM2", "COM3", "COM4", "COM5", "COM6", "COM7", "COM8",
+        "COM9", "LPT1", "LPT2", "LPT3", "LPT4", "LPT5", "LPT6", "LPT7",
+        "LPT8", "LPT9",
+    };
+    char stem[8];
+    size_t len = strcspn(name, "."), i;
+
+    while (len > 0 && name[len-1] == ' ')
+        len--;
+    if (len >= sizeof(stem))
+        return false;
+    for (i = 0; i < len; i++)
+        stem[i] = (name[i] >= 'a' && name[i] <= 'z' ?
+                   name[i] - 'a' + 'A' : name[i]);
+    stem[len] = '\0';
+
+    for (i = 0; i < lenof(devices); i++)
+        if (!strcmp(stem, devices[i]))
+            return true;
+    return false;
+}
+
+/*
+ * Make a file name from the other end safe to use here: no
+ * directories, nothing that Windows would read as a device or drive,
+ * no control characters. Windows also drops dots and spaces from the
+ * end of a name, so those go before the check for '.' and '..'.
+ */
+static char *zm_safe_name(const char *name)
+{
+    char *safe = dupstr(zm_basename(name)), *p;
+    size_t len;
+
+    for (p = safe; *p; p++)
+        if ((unsigned char)*p < ' ' || strchr("<>\"|?*", *p))
+            *p = '_';
+    len = strlen(safe);
+    while (len > 0 && (safe[len-1] == '.' || safe[len-1] == ' '))
+        safe[--len] = '\0';
+    if (!*safe) {
+        sfree(safe);
+        safe = dupstr("unnamed");
+    } else if (zm_device_name(safe)) {
+        p = dupcat("_", safe);
+        sfree(safe);
+        safe = p;
+    }
+    return safe;
+}
+
+static char *zm_path(ZModem *zm, const char *name)
+{
+    size_t len = strlen(zm->dir);
+
+    if (!len)
+        return dupstr(name);
+    if (zm->dir[len-1] == '/' || zm->dir[len-1] == '\\')
+        return dupcat(zm->dir, name);
+    return dupprintf("%s%c%s", zm->dir, ZM_DIRSEP, name);
+}
+
+static void zm_receive_file(ZModem *zm)
+{
+    char *name, *path, *msg;
+    const char *p;
+    uint64_t size = 0;
+    bool known = false, resume;
+    zm_statbuf st;
+
+    zm->buf[zm->buflen] = '\0';
+    p = (const char *)zm->buf + strlen((const char *)zm->buf) + 1;
+    if (p < (const char *)zm->buf + zm->buflen && *p) {
+        size = strtoull(p, NULL, 10);
+        known = true;
+    }
+
+    name = zm_safe_name((const char *)zm->buf);
+    path = zm_path(zm, name);
+    resume = (zm->flags & ZM_RESUME) || zm->remote_resume;
+    zm->pos = 0;
+
+    if (zm_stat(path, &st) == 0) {
+        if (resume) {
+            if (known && (uint64_t)st.st_size >= size) {
+                msg = dupprintf("Already have %s", name);
+                zm->host->vt->message(zm->host, msg);
+                sfree(msg);
+                sfree(path);
+                sfree(name);
+                zm_hex_header(zm, ZSKIP, zm_zero);
+                return;
+            }
+            zm->fp = fopen(path, "r+b");
+            if (zm->fp && zm_fseek(zm->fp, st.st_size, SEEK_SET) == 0)
+                zm->pos = st.st_size;
+        } else if (zm->flags & ZM_OVERWRITE) {
+            zm->fp = fopen(path, "wb");
+        } else {
+            /* Don't clobber what's there: find a name that's free */
+            int i;
+            for (i = 1; i < 1000; i++) {
+                char *alt = dupprintf("%s.%d", path, i);
+                if (zm_stat(alt, &st) != 0) {
+                    sfree(path);
+                    path = alt;
+                    break;
+                }
+                sfree(alt);
+            }
+            if (i < 1000)
+                zm->fp = fopen(path, "wb");
+        }
+    } else {
+        zm->fp = fopen(path, "wb");
+    }
+
+    if (!zm->fp) {
+        msg = dupprintf("Unable to create %s", path);
+        zm->host->vt->message(zm->host, msg);
+        sfree(msg);
+        sfree(path);
+        sfree(name);
+        zm_hex_header(zm, ZSKIP, zm_zero);
+        return;
+    }
+    setvbuf(zm->fp, NULL, _IOFBF, 65536);
+
+    zm->name = name;
+    zm->size = known ? size : 0;
+    if (zm->pos)
+        msg = dupprintf("Resuming %s at %"PRIu64, path, zm->pos);
+    else
+        msg = dupprintf("Receiving %s", path);
+    zm->host->vt->message(zm->host, msg);
+    sfree(msg);
+    sfree(path);
+
+    zm_send_pos(zm, ZRPOS, zm->pos);
+    zm->state = ZR_WAITDATA;
+}
+
+static void zm_receiver_header(ZModem *zm, int type, const unsigned char *hdr)
+{
+    uint32_t pos = GET_32BIT_LSB_FIRST(hdr);
+
+    switch (type) {
+      case ZRQINIT:
+        if (zm->state == ZR_INIT)
+            zm_send_zrinit(zm);
+        break;
+
+      case ZSINIT:
+      case ZCOMMAND:
+        zm->rx = RX_DATA;
+        break;
+
+      case ZFILE:
+        if (zm->state == ZR_INIT) {
+            zm->remote_resume = hdr[ZF0] == ZCRESUM;
+            zm->rx = RX_DATA;
+        } else if (zm->state == ZR_WAITDATA) {
+            /* It didn't see our ZRPOS */
+            zm_send_pos(zm, ZRPOS, zm->pos);
+        }
+        break;
+
+      case ZDATA:
+        if (zm->state == ZR_WAITDATA || zm->state == ZR_DATA) {
+            if (pos == (uint32_t)zm->pos) {
+                zm->state = ZR_DATA;
+                zm->rx = RX_DATA;
+            } else {
+                zm_send_pos(zm, ZRPOS, zm->pos);
+                zm->state = ZR_WAITDATA;
+            }
+        }
+        break;
+
+      case ZEOF:
+        /*
+         * A ZEOF somewhere other than where we are might have been
+         * sent before our last ZRPOS arrived, so ignore it.
+         */
+        if ((zm->state == ZR_WAITDATA || zm->state == ZR_DATA) &&
+            pos == (uint32_t)zm->pos) {
+            char *msg = dupprintf("Received %s (%"PRIu64" bytes)",
+                                  zm->name, zm->pos);
+            bool ok = fclose(zm->fp) == 0;
+            zm->fp = NULL;
+            zm_close_file(zm);
+            if (!ok) {
+                sfree(msg);
+                zm_hex_header(zm, ZFERR, hdr);
+                zm_finish(zm, false, "Error writing the file");
+                return;
+            }
+            zm->host->vt->message(zm->host, msg);
+            sfree(msg);
+            zm_send_zrinit(zm);
+            zm->state = ZR_INIT;
+        }
+        break;
+
+      case ZFIN:
+        zm_close_file(zm);
+        zm_hex_header(zm, ZFIN, zm_zero);
+        zm->state = ZR_FIN;
+        zm->ocount = 0;
+        break;
+
+      case ZFREECNT: {
+        unsigned char out[4];
+        zm_pos_hdr(out, 0xFFFFFFFFU);
+        zm_hex_header(zm, ZACK, out);
+        break;
+      }
+
+      case ZCAN:
+      case ZABORT:
+        zm_finish(zm, false, "Transfer cancelled by the remote end");
+        break;
+    }
+}
+
+static void zm_receiver_data(ZModem *zm, int type, bool ok)
+{
+    switch (type) {
+      case ZSINIT:
+        if (ok)
+            zm_send_pos(zm, ZACK, 1);
+        else
+            zm_hex_header(zm, ZNAK, zm_zero);
+        break;
+
+      case ZCOMMAND:
+        if (ok) {
+            zm->host->vt->message(zm->host, "Refused a remote command");
+            zm_send_pos(zm, ZCOMPL, 1);
+        }
+        break;
+
+      case ZFILE:
+        if (ok)
+            zm_receive_file(zm);
+        else
+            zm_hex_header(zm, ZNAK, zm_zero);
+        break;
+
+      case ZDATA:
+        if (!ok) {
+            zm_send_pos(zm, ZRPOS, zm->pos);
+            zm->state = ZR_WAITDATA;
+            zm->rx = RX_HUNT;
+            break;
+        }
+        if (fwrite(zm->buf, 1, zm->buflen, zm->fp) != zm->buflen) {
+            zm_hex_header(zm, ZFERR, zm_zero);
+            zm_finish(zm, false, "Error writing the file");
+            break;
+        }
+        zm->pos += zm->buflen;
+        zm->host->vt->progress(zm->host, zm->name, zm->pos, zm->size);
+
+        switch (zm->frameend) {
+          case ZCRCW:
+            zm_send_pos(zm, ZACK, zm->pos);
+            zm->state = ZR_WAITDATA;
+            break;
+          case ZCRCQ:
+            zm_send_pos(zm, ZACK, zm->pos);
+            break;
+          case ZCRCE:
+            zm->state = ZR_WAITDATA;
+            break;
+        }
+        break;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * The decoder.
+ */
+
+/* Bytes that aren't just data inside a subpacket */
+static const unsigned char zm_rx_special[256] = {
+    [ZDLE] = 1, [0x11] = 1, [0x13] = 1, [0x91] = 1, [0x93] = 1,
+};
+
+#define ZM_MORE (-1)
+#define ZM_BADESC (-2)
+#define ZM_FRAMEEND 0x100
+
+/* Undo the escaping of a byte in a binary header or subpacket */
+static int zm_unescape(ZModem *zm, unsigned char c)
+{
+    if (zm->escape) {
+        zm->escape = false;
+        switch (c) {
+          case ZCRCE: case ZCRCG: case ZCRCQ: case ZCRCW:
+            return ZM_FRAMEEND | c;
+          case ZRUB0:
+            return 0x7F;
+          case ZRUB1:
+            return 0xFF;
+        }
+        return (c & 0x60) == 0x40 ? c ^ 0x40 : ZM_BADESC;
+    }
+    if (zm_rx_special[c]) {
+        if (c == ZDLE)
+            zm->escape = true;
+        return ZM_MORE;                /* XON and XOFF are ignored */
+    }
+    return c;
+}
+
+static int zm_hexval(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static void zm_got_header(ZModem *zm, const unsigned char *b)
+{
+    zm->rx = RX_HUNT;
+    zm->retries = 0;
+    zm_set_timer(zm);
+    zm->buflen = 0;
+    if (zm->state >= ZS_INIT)
+        zm_sender_header(zm, b[0], b + 1);
+    else
+        zm_receiver_header(zm, b[0], b + 1);
+    if (zm->rx == RX_DATA)
+        zm->datatype = b[0];
+}
+
+static void zm_got_data(ZModem *zm, bool ok)
+{
+    int type = zm->datatype;
+
+    zm->rx = (ok && (zm->frameend == ZCRCG || zm->frameend == ZCRCQ)) ?
+        RX_DATA : RX_HUNT;
+    if (ok) {
+        zm->retries = 0;
+        zm_set_timer(zm);
+    }
+    if (zm->state != ZM_IDLE && zm->state < ZS_INIT)
+        zm_receiver_data(zm, type, ok);
+    zm->buflen = 0;
+}
+
+static void zm_rx_byte(ZModem *zm, unsigned char c)
+{
+    int v;
+
+    if (c == ZDLE) {
+        if (++zm->cans >= 5) {
+            zm_finish(zm, false, "Transfer cancelled by the remote end");
+            return;
+        }
+    } else {
+        zm->cans = 0;
+    }
+
+    switch (zm->rx) {
+      case RX_HUNT:
+        if (c == ZPAD) {
+            zm->hunt = 1;
+        } else if (c == ZDLE && zm->hunt == 1) {
+            zm->hunt = 2;
+        } else if (zm->hunt == 2 && c == ZHEX) {
+            zm->rx = RX_HEX;
+            zm->hdrlen = 0;
+            zm->hunt = 0;
+        } else if (zm->hunt == 2 && (c == ZBIN || c == ZBIN32)) {
+            zm->rx = RX_BIN;
+            zm->rxbin32 = (c == ZBIN32);
+            zm->hdrlen = 0;
+            zm->hdrwant = zm->rxbin32 ? 9 : 7;
+            zm->escape = false;
+            zm->hunt = 0;
+        } else if (c != XON) {
+            zm->hunt = 0;
+        }
+        break;
+
+      case RX_HEX:
+        if (zm_hexval(c) < 0) {
+            zm->rx = RX_HUNT;
+            break;
+        }
+        zm->hex[zm->hdrlen++] = c;
+        if (zm->hdrlen == 14) {
+            unsigned char b[7];
+            size_t i;
+            for (i = 0; i < 7; i++)
+                b[i] = zm_hexval(zm->hex[2*i]) << 4 | zm_hexval(zm->hex[2*i+1]);
+            zm->rx = RX_HUNT;
+            if (zm_crc16(0, b, 5) == GET_16BIT_MSB_FIRST(b + 5)) {
+                zm->rxbin32 = false;
+                zm->skipcrlf = 2;
+                zm_got_header(zm, b);
+            }
+        }
+        break;
+
+      case RX_BIN:
+        v = zm_unescape(zm, c);
+        if (v == ZM_MORE)
+            break;
+        if (v < 0 || v >= ZM_FRAMEEND) {
+            zm->rx = RX_HUNT;
+            break;
+        }
+        zm->hdr[zm->hdrlen++] = v;
+        if (zm->hdrlen == zm->hdrwant) {
+            unsigned char b[5];
+            bool good;
+            memcpy(b, zm->hdr, 5);
+            if (zm->rxbin32)
+                good = ~zm_crc32(0xFFFFFFFFU, b, 5) ==
+                    GET_32BIT_LSB_FIRST(zm->hdr + 5);
+            else
+                good = zm_crc16(0, b, 5) == GET_16BIT_MSB_FIRST(zm->hdr + 5);
+            zm->rx = RX_HUNT;
+            zm->skipcrlf = 0;
+            if (good)
+                zm_got_header(zm, b);
+        }
+        break;
+
+      case RX_DATA:
+        if (zm->skipcrlf && zm->buflen == 0 && !zm->escape &&
+            ((c & 0x7F) == '\r' || (c & 0x7F) == '\n')) {
+            zm->skipcrlf--;
+            break;
+        }
+        zm->skipcrlf = 0;
+        v = zm_unescape(zm, c);
+        if (v == ZM_MORE)
+            break;
+        if (v == ZM_BADESC) {
+            zm_got_data(zm, false);
+        } else if (v >= ZM_FRAMEEND) {
+            zm->frameend = v & 0xFF;
+            zm->rx = RX_CRC;
+            zm->crclen = 0;
+        } else if (zm->buflen >= ZM_MAXBLOCK) {
+            zm_got_data(zm, false);
+        } else {
+            zm->buf[zm->buflen++] = v;
+        }
+        break;
+
+      case RX_CRC:
+        v = zm_unescape(zm, c);
+        if (v == ZM_MORE)
+            break;
+        if (v < 0 || v >= ZM_FRAMEEND) {
+            zm_got_data(zm, false);
+            break;
+        }
+        zm->crc[zm->crclen++] = v;
+        if (zm->crclen == (zm->rxbin32 ? 4 : 2)) {
+            bool good;
+            if (zm->rxbin32) {
+                uint32_t crc = zm_crc32(0xFFFFFFFFU, zm->buf, zm->buflen);
+                good = ~zm_crc32(crc, &zm->frameend, 1) ==
+                    GET_32BIT_LSB_FIRST(zm->crc);
+            } else {
+                uint16_t crc = zm_crc16(0, zm->buf, zm->buflen);
+                good = zm_crc16(crc, &zm->frameend, 1) ==
+                    GET_16BIT_MSB_FIRST(zm->crc);
+            }
+            zm_got_data(zm, good);
+        }
+        break;
+    }
+}
+
+size_t zmodem_input(ZModem *zm, const void *vdata, size_t len)
+{
+    const unsigned char *data = (const unsigned char *)vdata;
+    size_t i = 0;
+
+    while (i < len && zm->state != ZM_IDLE) {
+        /* Copy plain runs of subpacket data in one go */
+        if (zm->rx == RX_DATA && !zm->escape && !zm->skipcrlf) {
+            const unsigned char *p = data + i;
+            size_t room = ZM_MAXBLOCK - zm->buflen, n = 0;
+            size_t avail = len - i < room ? len - i : room;
+
+            while (n < avail && !zm_rx_special[p[n]])
+                n++;
+            if (n) {
+                memcpy(zm->buf + zm->buflen, p, n);
+                zm->buflen += n;
+                zm->cans = 0;
+                i += n;
+                continue;
+            }
+        }
+
+        /*
+         * After our ZFIN, the sender finishes with "OO", and then
+         * whatever follows belongs to the terminal. But it might have
+         * missed our ZFIN and be sending its own again.
+         */
+        if (zm->state == ZR_FIN && zm->rx == RX_HUNT) {
+            unsigned char c = data[i];
+            if (zm->skipcrlf && ((c & 0x7F) == '\r' || (c & 0x7F) == '\n')) {
+                zm->skipcrlf--;        /* the end of its ZFIN header */
+                i++;
+                continue;
+            }
+            if (c == 'O') {
+                i++;
+                if (++zm->ocount == 2)
+                    zm_finish(zm, true, NULL);
+                continue;
+            }
+            if (c != ZPAD && c != ZDLE && c != XON && !zm->hunt) {
+                zm_finish(zm, true, NULL);
+                break;
+            }
+        }
+
+        zm_rx_byte(zm, data[i++]);
+    }
+
+    zm_flush(zm);
+    if (zm->state == ZS_DATA)
+        zm_send_more(zm);
+    return i;
+}
+
+void zmodem_poll(ZModem *zm, unsigned long now)
+{
+    zm->now = now;
+    if (zm->state == ZM_IDLE)
+        return;
+    if (!zm->timing) {
+        zm->timing = true;
+        zm_set_timer(zm);
+    }
+
+    if ((long)(now - zm->deadline) >= 0) {
+        unsigned char hdr[4];
+
+        zm_set_timer(zm);
+        if (++zm->retries > ZM_RETRIES) {
+            zmodem_cancel(zm);
+            zm->host->vt->message(zm->host, "Timed out");
+            return;
+        }
+
+        switch (zm->state) {
+          case ZR_INIT:
+            zm_send_zrinit(zm);
+            break;
+          case ZR_WAITDATA:
+          case ZR_DATA:
+            zm_send_pos(zm, ZRPOS, zm->pos);
+            zm->state = ZR_WAITDATA;
+            zm->rx = RX_HUNT;
+            break;
+          case ZR_FIN:
+            zm_finish(zm, true, NULL);
+            return;
+          case ZS_INIT:
+            zm_flags_hdr(hdr, 0);
+            zm_hex_header(zm, ZRQINIT, hdr);
+            break;
+          case ZS_FILE:
+            zm->nextfile--;
+            zm_send_next_file(zm);
+            break;
+          case ZS_WAITACK:
+            zm_send_from(zm, zm->acked);
+            break;
+          case ZS_EOF:
+            zm_send_pos(zm, ZEOF, zm->pos);
+            break;
+          case ZS_FIN:
+            zm_flags_hdr(hdr, 0);
+            zm_hex_header(zm, ZFIN, hdr);
+            break;
+          default:
+            break;
+        }
+    }
+
+    zm_flush(zm);
+    if (zm->state == ZS_DATA)
+        zm_send_more(zm);
+}
@@ -0,0 +1,77 @@
+/*
+ * zmodem.h: interface to the built-in ZMODEM sender and receiver.
+ *
+ * The protocol engine in zmodem.c knows nothing about windows or
+ * sessions. Whoever drives it feeds it the data arriving from the
+ * remote end with zmodem_input(), calls zmodem_poll() every so often
+ * so that it can time out and keep its output flowing, and provides a
+ * ZModemHost for it to send data and report what it's doing.
+ */
+
+#ifndef KITTY_ZMODEM_H
+#define KITTY_ZMODEM_H
+
+typedef struct ZModem ZModem;
+typedef struct ZModemHost ZModemHost;
+typedef struct ZModemHostVtable ZModemHostVtable;
+
+struct ZModemHost {
+    const ZModemHostVtable *vt;
+};
+
+struct ZModemHostVtable {
+    /* Send data to the remote end. */
+    void (*write)(ZModemHost *host, const void *data, size_t len);
+
+    /*
+     * How much of what we've written hasn't gone yet. A sender stops
+     * generating data while this is more than ZM_BACKLOG, and carries
+     * on at the next zmodem_poll().
+     */
+    size_t (*backlog)(ZModemHost *host);
+
+    /* A line of news for the user: a file starting or finishing. */
+    void (*message)(ZModemHost *host, const char *msg);
+
+    /* How far through the current file we are. */
+    void (*progress)(ZModemHost *host, const char *name,
+                     uint64_t done, uint64_t size);
+};
+
+#define ZM_BACKLOG 65536
+
+/* Flags for zmodem_receive and zmodem_send */
+#define ZM_RESUME    1   /* continue files that were partly transferred */
+#define ZM_ESCCTL    2   /* escape all control characters */
+#define ZM_OVERWRITE 4   /* replace existing files rather than renaming */
+
+ZModem *zmodem_new(ZModemHost *host);
+void zmodem_free(ZModem *zm);
+
+/*
+ * Start a transfer. Files received go into `dir'. Either can fail
+ * only if a transfer is already under way.
+ */
+bool zmodem_receive(ZModem *zm, const char *dir, unsigned flags);
+bool zmodem_send(ZModem *zm, const char *const *files, size_t nfiles,
+                 unsigned flags);
+
+/*
+ * Process data from the remote end. Returns how much of it was used:
+ * once the transfer has finished, anything after the end of it
+ * belongs to the terminal again.
+ */
+size_t zmodem_input(ZModem *zm, const void *data, size_t len);
+
+/* `now' is in milliseconds, as from GETTICKCOUNT(). */
+void zmodem_poll(ZModem *zm, unsigned long now);
+
+/* Abandon the transfer, telling the remote end. */
+void zmodem_cancel(ZModem *zm);
+
+bool zmodem_active(ZModem *zm);
+
+/* Whether the last transfer went through, once it's no longer active */
+bool zmodem_succeeded(ZModem *zm);
+
+#endif